@@ -0,0 +1,38 @@
+SET search_path TO documentdb_core,documentdb_api,documentdb_api_catalog,documentdb_api_internal;
+
+SET citus.next_shard_id TO 1230000;
+SET documentdb.next_collection_id TO 12300;
+SET documentdb.next_collection_index_id TO 12300;
+
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 1, "g": "A", "v": 5, "tag": "x", "obj": { "a": 1, "b": 1 } }', NULL);
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 2, "g": "A", "v": 3, "tag": "y", "obj": { "b": 1, "d": 2 } }', NULL);
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 3, "g": "A", "v": 8, "tag": "x", "obj": { "c": 3 } }', NULL);
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 4, "g": "A", "v": 1, "tag": "x", "obj": { "a": 1 } }', NULL);
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 5, "g": "B", "v": 2, "tag": "y", "obj": { "a": 5 } }', NULL);
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 6, "g": "B", "v": 7, "tag": "y", "obj": { "d": 6 } }', NULL);
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 7, "g": "B", "v": 4, "tag": "z", "obj": { "a": 5, "e": 7 } }', NULL);
+SELECT documentdb_api.insert_one('db','combinableGroup','{ "_id": 8, "g": "C", "v": 6, "tag": "x", "obj": { "f": 8 } }', NULL);
+
+/* spread the groups over the shards so that each is partially aggregated on several of them */
+SELECT documentdb_api.shard_collection('db', 'combinableGroup', '{ "_id": "hashed" }', false);
+
+SET documentdb.enableCombinableGroupAccumulators TO on;
+
+/* the shards aggregate their documents and the coordinator combines the partial aggregates */
+EXPLAIN (COSTS OFF) SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "combinableGroup", "pipeline": [ { "$group": { "_id": "$g", "first": { "$first": "$v" }, "last": { "$last": "$v" }, "firstN": { "$firstN": { "input": "$v", "n": 10 } }, "lastN": { "$lastN": { "input": "$v", "n": 10 } }, "pushed": { "$push": "$v" }, "tags": { "$addToSet": "$tag" }, "merged": { "$mergeObjects": "$obj" } } } ] }');
+
+/*
+ * The partial aggregates are combined in any order, so the arrays and the keys of the merged object are sorted,
+ * and $first/$last of "$v" are only checked to be a value of the group. $firstN/$lastN ask for more values than
+ * there are in the groups, and the overlapping keys of $mergeObjects have the same value in all the documents.
+ */
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "combinableGroup", "pipeline": [ { "$group": { "_id": "$g", "firstG": { "$first": "$g" }, "lastG": { "$last": "$g" }, "first": { "$first": "$v" }, "last": { "$last": "$v" }, "firstN": { "$firstN": { "input": "$v", "n": 10 } }, "lastN": { "$lastN": { "input": "$v", "n": 10 } }, "pushed": { "$push": "$v" }, "tags": { "$addToSet": "$tag" }, "merged": { "$mergeObjects": "$obj" } } }, { "$project": { "firstOfGroup": "$firstG", "lastOfGroup": "$lastG", "firstInGroup": { "$in": [ "$first", "$pushed" ] }, "lastInGroup": { "$in": [ "$last", "$pushed" ] }, "sortedFirstN": { "$sortArray": { "input": "$firstN", "sortBy": 1 } }, "sortedLastN": { "$sortArray": { "input": "$lastN", "sortBy": 1 } }, "sortedPushed": { "$sortArray": { "input": "$pushed", "sortBy": 1 } }, "sortedTags": { "$sortArray": { "input": "$tags", "sortBy": 1 } }, "sortedMerged": { "$arrayToObject": { "$sortArray": { "input": { "$objectToArray": "$merged" }, "sortBy": { "k": 1 } } } } } }, { "$sort": { "_id": 1 } } ] }');
+
+/* sorted input keeps using the accumulators that aggregate on the coordinator, in order */
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "combinableGroup", "pipeline": [ { "$sort": { "_id": 1 } }, { "$group": { "_id": "$g", "first": { "$first": "$v" }, "last": { "$last": "$v" }, "firstN": { "$firstN": { "input": "$v", "n": 10 } }, "lastN": { "$lastN": { "input": "$v", "n": 2 } }, "pushed": { "$push": "$v" }, "merged": { "$mergeObjects": "$obj" } } }, { "$sort": { "_id": 1 } } ] }');
+
+/* same results with the feature off */
+RESET documentdb.enableCombinableGroupAccumulators;
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "combinableGroup", "pipeline": [ { "$group": { "_id": "$g", "firstG": { "$first": "$g" }, "lastG": { "$last": "$g" }, "first": { "$first": "$v" }, "last": { "$last": "$v" }, "firstN": { "$firstN": { "input": "$v", "n": 10 } }, "lastN": { "$lastN": { "input": "$v", "n": 10 } }, "pushed": { "$push": "$v" }, "tags": { "$addToSet": "$tag" }, "merged": { "$mergeObjects": "$obj" } } }, { "$project": { "firstOfGroup": "$firstG", "lastOfGroup": "$lastG", "firstInGroup": { "$in": [ "$first", "$pushed" ] }, "lastInGroup": { "$in": [ "$last", "$pushed" ] }, "sortedFirstN": { "$sortArray": { "input": "$firstN", "sortBy": 1 } }, "sortedLastN": { "$sortArray": { "input": "$lastN", "sortBy": 1 } }, "sortedPushed": { "$sortArray": { "input": "$pushed", "sortBy": 1 } }, "sortedTags": { "$sortArray": { "input": "$tags", "sortBy": 1 } }, "sortedMerged": { "$arrayToObject": { "$sortArray": { "input": { "$objectToArray": "$merged" }, "sortBy": { "k": 1 } } } } } }, { "$sort": { "_id": 1 } } ] }');
+
+SELECT documentdb_api.drop_collection('db','combinableGroup');
@@ -184,3 +184,32 @@ SELECT bson_dollar_project('{ "_id": 10, "a": 10, "x": 1 }', '{ "_id" : 1, "x.y"
 
 -- Empty spec is a no-op
 SELECT bson_dollar_project(document, '{}')  FROM documentdb_api.collection('db', 'projectops') ORDER BY object_id;
+
+-- splice the projected away fields and the fields with no projection from the source document
+SET documentdb.enableBsonSpliceWriter TO on;
+SELECT bson_dollar_project('{"_id": 1, "a": 1, "b": { "c": 1, "d": 2 }, "e": 3}', '{ "b.c": 0, "e": 0 }');
+SELECT bson_dollar_add_fields('{"_id": 1, "a": 1, "b": { "c": 1 }, "e": 3}', '{ "b.d": { "$add": [ "$a", 1 ] } }');
+RESET documentdb.enableBsonSpliceWriter;
+
+-- returns the projected document with the splice writer on or off
+CREATE FUNCTION pg_temp.project_with_splice_writer(project_function text, document text, spec text, splice_writer bool) RETURNS text AS $$
+DECLARE
+    projected text;
+BEGIN
+    PERFORM set_config('documentdb.enableBsonSpliceWriter', splice_writer::text, true);
+    EXECUTE format('SELECT documentdb_core.bson_to_bson_hex(documentdb_api_catalog.%I(%L, %L))::text', project_function, document, spec) INTO projected;
+    RETURN projected;
+END;
+$$ LANGUAGE plpgsql;
+
+-- the spliced documents are the same as the ones written field by field, with paths through arrays
+SELECT project_function, spec, pg_temp.project_with_splice_writer(project_function, document, spec, true) =
+    pg_temp.project_with_splice_writer(project_function, document, spec, false) AS same_as_writer
+FROM (VALUES
+    ('bson_dollar_project', '{ "a.b": 0, "d.f.g": 0 }'),
+    ('bson_dollar_project', '{ "a.c.b": 0, "i": 0 }'),
+    ('bson_dollar_add_fields', '{ "a.x": 1 }'),
+    ('bson_dollar_add_fields', '{ "d.f.x": "$d.e", "a.c.y": { "$literal": 2 } }'),
+    ('bson_dollar_add_fields', '{ "d.e": { "$size": "$a" } }'),
+    ('bson_dollar_unset', '{ "": [ "a.c", "d.f.h" ] }')) projections(project_function, spec),
+    (VALUES ('{"_id": 1, "a": [ { "b": 1, "c": 2 }, { "b": 3, "c": [ { "b": 1 }, 4 ] }, 5, [ { "b": 2 } ] ], "d": { "e": 1, "f": [ { "g": 1, "h": 2 } ] }, "i": 1}')) documents(document);
@@ -179,4 +179,45 @@ SELECT object_id, document FROM documentdb_api.collection('db', 'decimal128') WH
 SELECT object_id, document FROM documentdb_api.collection('db', 'decimal128') WHERE document @@ '{ "a": {"$gte" : {"$numberDouble": "1.3"}} }';
 SELECT object_id, document FROM documentdb_api.collection('db', 'decimal128') WHERE document @@ '{ "a": {"$lte" : {"$numberDouble": "1.3"}} }';
 SELECT object_id, document FROM documentdb_api.collection('db', 'decimal128') WHERE document @@ '{ "a": {"$eq" : {"$numberDouble": "1.3"}} }';
-SELECT object_id, document FROM documentdb_api.collection('db', 'decimal128') WHERE document @@ '{ "a": {"$eq" : {"$numberDecimal": "1.3"}} }';
\ No newline at end of file
+SELECT object_id, document FROM documentdb_api.collection('db', 'decimal128') WHERE document @@ '{ "a": {"$eq" : {"$numberDecimal": "1.3"}} }';
+
+-- decimal128 values with 64 bit coefficients are added and subtracted as integers, into the same
+-- bytes as the decimal math library returns: the sign and exponent of zeros, and the exponent of the
+-- smaller operand; aligning or adding past 64 bits falls back to the library.
+-- $add starts from 0, so only $subtract adds the two negative zeros
+CREATE FUNCTION pg_temp.decimal_operation(operator text, x text, y text, fast_path bool) RETURNS bson AS $$
+BEGIN
+    PERFORM set_config('documentdb_core.enableDecimal128FastPath', fast_path::text, true);
+    RETURN bson_dollar_project(format('{ "x": { "$numberDecimal": "%s" }, "y": { "$numberDecimal": "%s" } }', x, y)::bson,
+        format('{ "_id": 0, "result": { "%s": [ "$x", "$y" ] } }', operator)::bson);
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT operator, x, y, pg_temp.decimal_operation(operator, x, y, true) AS result,
+    bson_to_bson_hex(pg_temp.decimal_operation(operator, x, y, true))::text = bson_to_bson_hex(pg_temp.decimal_operation(operator, x, y, false))::text AS same_as_library
+FROM (VALUES
+    ('$add', '1.5', '2.25'),
+    ('$add', '1.0', '-1.00'),
+    ('$add', '-0', '-0'),
+    ('$subtract', '-0', '0'),
+    ('$subtract', '5.00', '1.5'),
+    ('$subtract', '1.5', '1.5'),
+    ('$add', '1E+30', '1E-5'),
+    ('$add', '18446744073709551615', '1'),
+    ('$subtract', '-18446744073709551615', '1')) operations(operator, x, y);
+
+-- $sum over amounts of mixed scales, the last of which is past the 64 bit coefficients
+SELECT COUNT(*) FROM (SELECT documentdb_api.insert_one('db', 'decimal128_sum', FORMAT('{ "_id": %s, "a": { "$numberDecimal": "%s" } }', i,
+    CASE WHEN i = 1000 THEN '18446744073709551615' WHEN i % 3 = 0 THEN (-i / 1000.0)::numeric(10, 3)::text ELSE (i / 100.0)::numeric(10, 2)::text END)::bson) FROM generate_series(1, 1000) i) ins;
+
+CREATE FUNCTION pg_temp.decimal_sum(fast_path bool) RETURNS bson AS $$
+DECLARE
+    decimal_sum bson;
+BEGIN
+    PERFORM set_config('documentdb_core.enableDecimal128FastPath', fast_path::text, true);
+    SELECT document INTO decimal_sum FROM bson_aggregation_pipeline('db', '{ "aggregate": "decimal128_sum", "pipeline": [ { "$group": { "_id": null, "sum": { "$sum": "$a" } } } ] }');
+    RETURN decimal_sum;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pg_temp.decimal_sum(true) AS document, bson_to_bson_hex(pg_temp.decimal_sum(true))::text = bson_to_bson_hex(pg_temp.decimal_sum(false))::text AS same_as_library;
@@ -172,17 +172,68 @@ SELECT document FROM bson_aggregation_pipeline('db',
     "collation": { "locale": "en", "strength": 1 }
 }');
 
--- unsupported: $group
+-- $group groups _ids that are equal under the collation, the _id of a group is that of its first document
 SELECT document FROM bson_aggregation_pipeline('db',
 '{ "aggregate": "ci_search",
    "pipeline": [
-     { "$group": {
-         "_id": "$a",
-         "set": { "$addToSet": "$a" }
-     }}
+     { "$match": { "b": { "$exists": true } } },
+     { "$sort": { "_id": 1 } },
+     { "$group": { "_id": "$b", "count": { "$sum": 1 }, "ids": { "$push": "$_id" } } },
+     { "$sort": { "_id": 1 } }
+   ],
+   "collation": { "locale": "en", "strength": 1 }
+}');
+
+SELECT document FROM bson_aggregation_pipeline('db',
+'{ "aggregate": "ci_search",
+   "pipeline": [
+     { "$match": { "b": { "$exists": true } } },
+     { "$sort": { "_id": 1 } },
+     { "$group": { "_id": "$b", "count": { "$sum": 1 }, "ids": { "$push": "$_id" } } },
+     { "$sort": { "_id": 1 } }
+   ],
+   "collation": { "locale": "en", "strength": 3 }
+}');
+
+-- the fused accumulators output the _id of the first document of the group too,
+-- with $$NOW turned off as it keeps the accumulators from being fused
+SET documentdb.enableFusedGroupAccumulators TO on;
+SET documentdb.enableNowSystemVariable TO off;
+SELECT document FROM bson_aggregation_pipeline('db',
+'{ "aggregate": "ci_search",
+   "pipeline": [
+     { "$match": { "b": { "$exists": true } } },
+     { "$sort": { "_id": 1 } },
+     { "$group": { "_id": "$b", "count": { "$sum": 1 }, "minId": { "$min": "$_id" }, "maxId": { "$max": "$_id" } } },
+     { "$sort": { "_id": 1 } }
    ],
    "collation": { "locale": "en", "strength": 1 }
 }');
+RESET documentdb.enableFusedGroupAccumulators;
+RESET documentdb.enableNowSystemVariable;
+
+-- $bucketAuto orders the groupBy values by the collation and keeps the values equal under it in one bucket
+SELECT document FROM bson_aggregation_pipeline('db',
+'{ "aggregate": "ci_search",
+   "pipeline": [
+     { "$match": { "b": { "$exists": true } } },
+     { "$bucketAuto": { "groupBy": "$b", "buckets": 2, "output": { "count": { "$sum": 1 }, "minId": { "$min": "$_id" }, "maxId": { "$max": "$_id" } } } },
+     { "$project": { "_id": 0, "count": 1, "minId": 1, "maxId": 1 } },
+     { "$sort": { "minId": 1 } }
+   ],
+   "collation": { "locale": "en", "strength": 1 }
+}');
+
+SELECT document FROM bson_aggregation_pipeline('db',
+'{ "aggregate": "ci_search",
+   "pipeline": [
+     { "$match": { "b": { "$exists": true } } },
+     { "$bucketAuto": { "groupBy": "$b", "buckets": 2, "output": { "count": { "$sum": 1 }, "minId": { "$min": "$_id" }, "maxId": { "$max": "$_id" } } } },
+     { "$project": { "_id": 0, "count": 1, "minId": 1, "maxId": 1 } },
+     { "$sort": { "minId": 1 } }
+   ],
+   "collation": { "locale": "en", "strength": 3 }
+}');
 
 -- unsupported: $setWindowFields
 SELECT document FROM bson_aggregation_pipeline('db',
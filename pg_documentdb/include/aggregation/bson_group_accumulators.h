@@ -0,0 +1,98 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/aggregation/bson_group_accumulators.h
+ *
+ * Common declarations of the fused accumulators of $group, shared by the
+ * bson_group_accumulators aggregate and the group scan.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef BSON_GROUP_ACCUMULATORS_H
+#define BSON_GROUP_ACCUMULATORS_H
+
+#include "io/bson_core.h"
+#include "operators/bson_expression.h"
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+typedef enum GroupAccumulatorKind
+{
+	GroupAccumulatorKind_Sum = 1,
+	GroupAccumulatorKind_Avg = 2,
+	GroupAccumulatorKind_Min = 3,
+	GroupAccumulatorKind_Max = 4,
+} GroupAccumulatorKind;
+
+/*
+ * The output field of an accumulator and how it accumulates.
+ */
+typedef struct GroupAccumulatorOutput
+{
+	StringView name;
+	GroupAccumulatorKind kind;
+} GroupAccumulatorOutput;
+
+/*
+ * The parsed accumulators spec of the form
+ * { "<field>": { "$sum" | "$avg" | "$min" | "$max": <expression> }, ... }
+ */
+typedef struct GroupAccumulatorsSpec
+{
+	int numAccumulators;
+
+	GroupAccumulatorOutput *outputs;
+
+	AggregationExpressionData *expressions;
+
+	/* The index in fieldPaths of accumulators of top level field paths, -1 otherwise */
+	int *fieldPathIndexes;
+
+	/* The distinct top level fields referenced by the accumulators */
+	int numFieldPaths;
+	StringView *fieldPaths;
+
+	/* Whether any of the accumulators needs its expression evaluated */
+	bool hasEvaluatedExpressions;
+
+	/* The keys the evaluated expressions are written with: their index */
+	char **evaluatedKeys;
+
+	/* Scratch space for the values of a document, reused across documents */
+	bson_value_t *fieldValues;
+	bson_value_t *accumulatorValues;
+} GroupAccumulatorsSpec;
+
+/*
+ * The running state of a single accumulator.
+ */
+typedef struct GroupAccumulatorValue
+{
+	/*
+	 * The sum for $sum and $avg. The current value for $min and $max, which is
+	 * EOD if only empty values (e.g. $$REMOVE) were seen.
+	 */
+	bson_value_t value;
+
+	/* The number of values added for $sum and $avg, or seen for $min and $max */
+	int64 count;
+
+	/* The copy holding value for $min and $max, when it isn't fixed size */
+	pgbson *valueBson;
+} GroupAccumulatorValue;
+
+void ParseGroupAccumulatorsSpec(GroupAccumulatorsSpec *spec, pgbson *specBson);
+void EvaluateGroupAccumulatorValues(GroupAccumulatorsSpec *spec, pgbson *document);
+void InitializeGroupAccumulatorValues(GroupAccumulatorValue *values,
+									  const GroupAccumulatorOutput *outputs,
+									  int numAccumulators);
+void AccumulateGroupValue(GroupAccumulatorKind kind, GroupAccumulatorValue *accumulator,
+						  const bson_value_t *value, int64 count);
+pgbson * BuildGroupAccumulatorsDocument(pgbson *groupId,
+										const GroupAccumulatorOutput *outputs,
+										const GroupAccumulatorValue *values,
+										int numAccumulators);
+
+#endif
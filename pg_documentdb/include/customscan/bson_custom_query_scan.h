@@ -27,4 +27,7 @@ void AddExtensionQueryScanForVectorQuery(PlannerInfo *root, RelOptInfo *rel,
 
 void AddExplainCustomScanWrapper(PlannerInfo *root, RelOptInfo *rel,
 								 RangeTblEntry *rte);
+
+void AddExtensionGroupScanForGroupAggregate(PlannerInfo *root, RelOptInfo *inputRel,
+											RelOptInfo *outputRel);
 #endif
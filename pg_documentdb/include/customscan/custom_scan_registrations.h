@@ -14,5 +14,6 @@
 void RegisterScanNodes(void);
 void RegisterQueryScanNodes(void);
 void RegisterExplainScanNodes(void);
+void RegisterGroupScanNodes(void);
 
 #endif
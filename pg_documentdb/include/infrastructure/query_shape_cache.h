@@ -0,0 +1,28 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/infrastructure/query_shape_cache.h
+ *
+ * Declarations for the cache of find queries generated per query shape.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef QUERY_SHAPE_CACHE_H
+#define QUERY_SHAPE_CACHE_H
+
+#include <nodes/parsenodes.h>
+
+#include "io/bson_core.h"
+#include "aggregation/bson_aggregation_pipeline.h"
+
+Query * GenerateFindQueryWithShapeCache(text *database, pgbson *findSpec,
+										QueryData *queryData, bool addCursorParams,
+										bool setStatementTimeout);
+
+void InvalidateQueryShapeCache(Oid relationId);
+
+Size QueryShapeCacheShmemSize(void);
+void InitializeQueryShapeCacheShmem(void);
+
+#endif
@@ -402,6 +402,15 @@ Oid BsonMaxNAggregateFunctionOid(void);
 Oid BsonMinNAggregateFunctionOid(void);
 Oid BsonMedianAggregateFunctionOid(void);
 Oid BsonPercentileAggregateFunctionOid(void);
+Oid BsonGroupAccumulatorsAggregateFunctionOid(void);
+Oid BsonGroupCollationKeyFunctionOid(void);
+Oid BsonGroupFirstAggregateFunctionOid(void);
+Oid BsonGroupLastAggregateFunctionOid(void);
+Oid BsonGroupFirstNAggregateFunctionOid(void);
+Oid BsonGroupLastNAggregateFunctionOid(void);
+Oid BsonGroupPushAggregateFunctionOid(void);
+Oid BsonGroupAddToSetAggregateFunctionOid(void);
+Oid BsonGroupMergeObjectsAggregateFunctionOid(void);
 
 /* Window functions*/
 Oid BsonLinearFillFunctionOid(void);
@@ -27,6 +27,18 @@ typedef enum PisaQueryAlgorithm
     PISA_ALGORITHM_AUTO = 5
 } PisaQueryAlgorithm;
 
+/*
+ * SelectOptimalAlgorithm switches to MaxScore from this many terms present
+ * in the index, from this many requested results, or when one of several
+ * terms occurs in more than this fraction of the documents.
+ */
+#define PISA_MAXSCORE_MIN_TERMS 5
+#define PISA_MAXSCORE_MIN_RESULTS 100
+#define PISA_COMMON_TERM_FRACTION 0.1
+
+/* Docid reported by an exhausted PisaQueryCursor */
+#define PISA_CURSOR_END_DOCID UINT64_MAX
+
 typedef struct PisaQueryCursor
 {
     char *term;
@@ -37,15 +49,25 @@ typedef struct PisaQueryCursor
     void *internal_cursor;
 } PisaQueryCursor;
 
+/*
+ * Number of candidate scores compared against the threshold at once by
+ * PisaTopKQueueInsertBatch.
+ */
+#define PISA_TOPK_BATCH_WIDTH 16
+
+/*
+ * Bounded min-heap on score holding the best 'capacity' documents seen
+ * so far. Docids and scores are kept in separate arrays so the sift
+ * loops only touch the score array. Once the queue is full, 'threshold'
+ * is the score at the root, i.e. the score a candidate must beat.
+ */
 typedef struct PisaTopKQueue
 {
     int capacity;
     int size;
     double threshold;
-    struct {
-        uint64_t docid;
-        double score;
-    } *entries;
+    uint64_t *docids;
+    double *scores;
 } PisaTopKQueue;
 
 typedef struct PisaAdvancedQueryContext
@@ -75,6 +97,8 @@ PisaTopKQueue *CreatePisaTopKQueue(int capacity);
 void FreePisaTopKQueue(PisaTopKQueue *queue);
 bool PisaTopKQueueWouldEnter(PisaTopKQueue *queue, double score);
 bool PisaTopKQueueInsert(PisaTopKQueue *queue, uint64_t docid, double score);
+int PisaTopKQueueInsertBatch(PisaTopKQueue *queue, const uint64_t *docids,
+                             const double *scores, int count);
 List *PisaTopKQueueGetResults(PisaTopKQueue *queue);
 
 PisaQueryCursor *CreatePisaQueryCursor(const char *term, const char *index_path);
@@ -84,9 +108,13 @@ bool PisaQueryCursorNextGeq(PisaQueryCursor *cursor, uint64_t target_docid);
 uint64_t PisaQueryCursorDocId(PisaQueryCursor *cursor);
 double PisaQueryCursorScore(PisaQueryCursor *cursor);
 double PisaQueryCursorMaxScore(PisaQueryCursor *cursor);
+void PisaQueryCursorShallowNextGeq(PisaQueryCursor *cursor, uint64_t target_docid);
+double PisaQueryCursorBlockMaxScore(PisaQueryCursor *cursor);
+uint64_t PisaQueryCursorBlockLastDocId(PisaQueryCursor *cursor);
 
-PisaQueryExecutionPlan *AnalyzePisaQuery(List *query_terms, int top_k);
-PisaQueryAlgorithm SelectOptimalAlgorithm(List *query_terms, int expected_results);
+PisaQueryExecutionPlan *AnalyzePisaQuery(const char *index_path, List *query_terms, int top_k);
+PisaQueryAlgorithm SelectOptimalAlgorithm(const char *index_path, List *query_terms,
+                                          int expected_results);
 
 List *ExecutePisaWandQuery(PisaAdvancedQueryContext *context);
 List *ExecutePisaBlockMaxWandQuery(PisaAdvancedQueryContext *context);
@@ -97,6 +125,7 @@ List *ExecuteAdvancedPisaQuery(const char *database_name, const char *collection
 
 bool OptimizeQueryWithEssentialTerms(PisaAdvancedQueryContext *context);
 double CalculateQueryUpperBound(List *cursors, int pivot_position);
+double CalculateBlockMaxUpperBound(List *cursors, int pivot_position, uint64_t docid);
 bool ShouldUseBlockMaxOptimization(List *query_terms, int expected_results);
 
 void FreePisaAdvancedQueryContext(PisaAdvancedQueryContext *context);
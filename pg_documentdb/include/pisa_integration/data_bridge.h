@@ -3,6 +3,7 @@
 #include "postgres.h"
 #include "utils/builtins.h"
 #include "io/pgbson.h"
+#include "pisa_integration/forward_index.h"
 
 typedef struct PisaDocument
 {
@@ -32,9 +33,16 @@ List *ExportCollectionToPisa(const char *database_name, const char *collection_n
                              PisaExportMode mode);
 
 bool WritePisaForwardIndex(PisaCollection *collection);
+bool ExportCollectionToPisaForwardIndex(const char *database_name,
+                                        const char *collection_name,
+                                        const char *output_path, PisaExportMode mode);
+bool BuildPisaInvertedIndex(const char *index_path, PisaCompressionType compression_type);
+bool BuildCompletePisaIndex(const char *database_name, const char *collection_name,
+                            const char *base_path, PisaCompressionType compression_type);
 bool WritePisaDocumentList(List *documents, const char *output_path);
 
 char *ExtractTextContentFromBson(const pgbson *document);
+void AddBsonTextToPisaForwardIndex(PisaForwardIndexWriter *writer, const pgbson *document);
 char *GeneratePisaDocumentId(const pgbson *document, int64 collection_id);
 
 void FreePisaDocument(PisaDocument *doc);
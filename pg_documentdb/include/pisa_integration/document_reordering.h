@@ -12,12 +12,19 @@
 #define DOCUMENT_REORDERING_H
 
 #include "postgres.h"
+#include "storage/dsm.h"
 #include "storage/lwlock.h"
+#include "storage/shm_toc.h"
 #include "postmaster/bgworker.h"
 
 #include "io/pgbson.h"
+#include "pisa_integration/forward_index.h"
 #include "pisa_integration/pisa_integration.h"
 
+/* Files kept next to the index by ExecuteRecursiveGraphBisection */
+#define PISA_PERMUTATION_FILE_SUFFIX ".permutation"
+#define PISA_REORDERING_STATS_FILE_SUFFIX ".reordering"
+
 typedef struct DocumentReorderingTask
 {
     char *database_name;
@@ -32,6 +39,11 @@ typedef struct DocumentReorderingTask
     int64 documents_processed;
 } DocumentReorderingTask;
 
+/*
+ * Compression ratios are uncompressed posting bytes (docid and frequency,
+ * 4 bytes each) over the encoded posting list bytes, measured by encoding
+ * the index with the previous and the new docid order.
+ */
 typedef struct DocumentReorderingStats
 {
     int64 total_documents;
@@ -67,6 +79,9 @@ bool CompleteReorderingTask(DocumentReorderingTask *task, bool success);
 bool ExecuteRecursiveGraphBisection(const char *database_name, const char *collection_name,
                                    int depth, int cache_depth);
 bool ReorderDocumentsInCollection(const char *database_name, const char *collection_name);
+uint32 *LoadDocumentReorderingPermutation(const char *index_path,
+                                          PisaForwardIndex *forward_index);
+PGDLLEXPORT void PisaGraphBisectionWorkerMain(dsm_segment *segment, shm_toc *toc);
 
 DocumentReorderingStats *GetReorderingStats(const char *database_name, 
                                            const char *collection_name);
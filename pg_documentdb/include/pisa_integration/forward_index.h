@@ -0,0 +1,121 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/pisa_integration/forward_index.h
+ *
+ * Binary forward index (document -> terms) written by the streaming PISA
+ * export, its in-memory form and its inversion into the block-compressed
+ * inverted index.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PISA_FORWARD_INDEX_H
+#define PISA_FORWARD_INDEX_H
+
+#include "postgres.h"
+
+#include "lib/stringinfo.h"
+#include "storage/dsm.h"
+#include "storage/shm_toc.h"
+#include "utils/hsearch.h"
+
+#include "pisa_integration/pisa_integration.h"
+
+#define PISA_FORWARD_MAGIC "PISAFWD"
+#define PISA_FORWARD_VERSION 1
+#define PISA_FORWARD_FILE_SUFFIX ".forward"
+#define PISA_DOCMAP_FILE_SUFFIX ".docmap"
+
+/* Tokens shorter than this are not indexed */
+#define PISA_FORWARD_MIN_TOKEN_LENGTH 3
+
+/*
+ * File layout:
+ *
+ *   PisaForwardFileHeader
+ *   for every document: uint32 doc_id_length, doc_id bytes,
+ *                       uint32 doc_length, uint32 num_postings,
+ *                       (uint32 term_id, uint32 freq)[num_postings]
+ *   for every term, in term id order: uint32 term_length, term bytes
+ *
+ * Term ids are assigned in order of first appearance, so the file can be
+ * written in a single pass; the header is filled in once the export is
+ * complete.
+ */
+typedef struct PisaForwardFileHeader
+{
+    char magic[8];
+    uint32 version;
+    uint32 num_docs;
+    uint32 num_terms;
+    uint32 reserved;
+    uint64 num_postings;
+    uint64 dictionary_offset;
+} PisaForwardFileHeader;
+
+/*
+ * Streaming writer. Only the term dictionary and the tokens of the
+ * current document are kept in memory.
+ */
+typedef struct PisaForwardIndexWriter
+{
+    char path[MAXPGPATH];
+    char temp_path[MAXPGPATH];
+    FILE *file;
+    MemoryContext context;
+    HTAB *term_table;
+    char **terms;
+    uint64 term_capacity;
+    uint32 num_docs;
+    uint32 num_terms;
+    uint64 num_postings;
+    uint64 file_size;
+    uint32 *tokens;             /* term ids of the current document */
+    uint64 token_count;
+    uint64 token_capacity;
+    StringInfoData record;
+} PisaForwardIndexWriter;
+
+/*
+ * Documents are stored as runs of (term id, frequency) pairs sorted by
+ * term id. Term ids follow the byte order of the terms, which is the
+ * order the index writer expects them in.
+ */
+typedef struct PisaForwardIndex
+{
+    uint32 num_docs;
+    uint32 num_terms;
+    uint64 num_postings;
+    uint64 *doc_offsets;        /* num_docs + 1 offsets into term_ids/freqs */
+    uint32 *term_ids;
+    uint32 *freqs;
+    uint32 *doc_lengths;        /* tokens per document */
+    char **terms;
+    char **doc_ids;             /* external document ids */
+} PisaForwardIndex;
+
+PisaForwardIndexWriter *BeginPisaForwardIndexWriter(const char *forward_file);
+void PisaForwardIndexWriterAddText(PisaForwardIndexWriter *writer, const char *text,
+                                   int length);
+void PisaForwardIndexWriterAddTerm(PisaForwardIndexWriter *writer, const char *term,
+                                   int length, uint32 freq);
+void PisaForwardIndexWriterEndDocument(PisaForwardIndexWriter *writer, const char *doc_id);
+uint64 FinishPisaForwardIndexWriter(PisaForwardIndexWriter *writer);
+
+PisaForwardIndex *LoadPisaForwardIndex(const char *forward_file);
+void FreePisaForwardIndex(PisaForwardIndex *index);
+
+/*
+ * 'permutation' maps new docids to forward index documents; NULL keeps
+ * the forward index order.
+ */
+uint64 MeasurePisaPostingsSize(PisaForwardIndex *index, const uint32 *permutation,
+                               PisaCompressionType compression);
+uint64 WritePisaIndexFromForwardIndex(PisaForwardIndex *index, const uint32 *permutation,
+                                      const char *index_path,
+                                      PisaCompressionType compression);
+
+PGDLLEXPORT void PisaIndexBuildWorkerMain(dsm_segment *segment, shm_toc *toc);
+
+#endif
@@ -0,0 +1,163 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/pisa_integration/index_segments.h
+ *
+ * Segmented PISA indexes: the base index built from the collection, the
+ * delta segments written by index sync, the deleted-docid bitmap, and
+ * the cursor that walks a term across all of them.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PISA_INDEX_SEGMENTS_H
+#define PISA_INDEX_SEGMENTS_H
+
+#include "postgres.h"
+
+#include "pisa_integration/inverted_index.h"
+
+#define PISA_SEGMENTS_MAGIC "PISASEG"
+#define PISA_SEGMENTS_VERSION 1
+#define PISA_SEGMENTS_FILE_SUFFIX ".segments"
+
+/* Segment 0 is the base index at <index_path>, others <index_path>.delta.<id> */
+#define PISA_BASE_SEGMENT_ID 0
+#define PISA_DELTA_SEGMENT_INFIX ".delta."
+
+/*
+ * File layout:
+ *
+ *   PisaSegmentsFileHeader
+ *   PisaSegmentEntry[num_segments], by increasing first_docid
+ *   uint64 deleted[(next_docid + 63) / 64]
+ *
+ * Every segment owns the global docids [first_docid, first_docid +
+ * num_docs); docid d of the segment is global docid first_docid + d.
+ * Ranges never overlap but may leave gaps behind merged segments. A set
+ * bit in 'deleted' hides the global docid from queries until the segment
+ * holding it is merged. The file is replaced atomically, so a reader
+ * always sees a consistent set of segments and deletions.
+ */
+typedef struct PisaSegmentsFileHeader
+{
+    char magic[8];
+    uint32 version;
+    uint32 num_segments;
+    uint32 next_segment_id;
+    uint32 next_docid;
+    uint64 identifier;          /* changes whenever the base is rebuilt */
+    uint64 generation;          /* changes on every flush or merge */
+    uint64 num_deleted;
+} PisaSegmentsFileHeader;
+
+typedef struct PisaSegmentEntry
+{
+    uint32 segment_id;
+    uint32 first_docid;
+    uint32 num_docs;
+    uint32 num_deleted;
+} PisaSegmentEntry;
+
+/*
+ * In-memory form of the segments file. Query backends share one cached
+ * copy per index (see OpenPisaSegmentSet); index sync reads private
+ * copies it can modify and write back.
+ */
+typedef struct PisaSegmentSet
+{
+    char index_path[MAXPGPATH];
+    uint32 num_segments;
+    uint32 max_segments;
+    uint32 next_segment_id;
+    uint32 next_docid;
+    uint64 identifier;
+    uint64 generation;
+    uint64 num_docs;            /* including deleted documents */
+    uint64 num_deleted;
+    PisaSegmentEntry *segments;
+    uint64 *deleted;
+    uint32 deleted_words;
+    uint64 file_inode;
+    int64 file_mtime;
+    int refcount;
+    bool stale;
+} PisaSegmentSet;
+
+/*
+ * Posting list of a term over every segment that contains it, in global
+ * docid order, with deleted documents skipped. Each segment is scored
+ * with the idf of the whole index; its stored upper bounds, computed
+ * with the segment's own idf, are scaled accordingly so that they stay
+ * valid.
+ */
+typedef struct PisaSegmentCursor
+{
+    PisaSegmentSet *segments;
+    int num_lists;
+    PisaPostingCursor **lists;
+    uint32 *first_docids;
+    double *bound_scales;
+    int current;                /* list under the cursor */
+    int shallow;                /* list under the block-max pointer */
+    uint32 docid;               /* global docid, PISA_POSTING_END at the end */
+    double max_score;
+} PisaSegmentCursor;
+
+typedef struct PisaSegmentTermStatistics
+{
+    uint32 doc_freq;
+    uint32 num_blocks;
+    double max_score;
+} PisaSegmentTermStatistics;
+
+void GetPisaSegmentPath(const char *index_path, uint32 segment_id, char *segment_path);
+int LockPisaIndexSegments(const char *index_path, bool wait);
+void UnlockPisaIndexSegments(int lock_fd);
+
+PisaSegmentSet *ReadPisaSegmentSet(const char *index_path);
+void WritePisaSegmentSet(PisaSegmentSet *set);
+void FreePisaSegmentSet(PisaSegmentSet *set);
+void ResetPisaIndexSegments(const char *index_path);
+void RemapPisaBaseSegment(const char *index_path, const uint32 *old_permutation,
+                          const uint32 *new_permutation, uint32 num_docs);
+void RemovePisaSegmentFiles(const char *index_path, uint32 segment_id);
+void PisaSegmentSetMarkDeleted(PisaSegmentSet *set, uint32 docid);
+void PisaSegmentSetAddSegment(PisaSegmentSet *set, uint32 segment_id, uint32 num_docs);
+void PisaSegmentSetReplaceSegments(PisaSegmentSet *set, int first, int last,
+                                   uint32 segment_id, uint32 num_docs);
+
+PisaSegmentSet *OpenPisaSegmentSet(const char *index_path);
+void ReleasePisaSegmentSet(PisaSegmentSet *set);
+bool PisaSegmentSetTermStatistics(PisaSegmentSet *set, const char *term, int term_length,
+                                  PisaSegmentTermStatistics *statistics);
+
+PisaSegmentCursor *OpenPisaSegmentCursor(PisaSegmentSet *set, const char *term,
+                                         int term_length);
+void ClosePisaSegmentCursor(PisaSegmentCursor *cursor);
+void PisaSegmentCursorNext(PisaSegmentCursor *cursor);
+void PisaSegmentCursorNextGeq(PisaSegmentCursor *cursor, uint32 target);
+double PisaSegmentCursorScore(PisaSegmentCursor *cursor);
+void PisaSegmentCursorShallowNextGeq(PisaSegmentCursor *cursor, uint32 target);
+double PisaSegmentCursorBlockMaxScore(PisaSegmentCursor *cursor);
+uint32 PisaSegmentCursorBlockLastDocId(PisaSegmentCursor *cursor);
+
+
+static inline bool
+PisaSegmentSetIsDeleted(PisaSegmentSet *set, uint32 docid)
+{
+    uint32 word = docid / 64;
+
+    return word < set->deleted_words &&
+           (set->deleted[word] & (UINT64CONST(1) << (docid % 64))) != 0;
+}
+
+
+/* Documents of the index that are not deleted */
+static inline uint64
+PisaSegmentSetLiveDocs(PisaSegmentSet *set)
+{
+    return set->num_docs - set->num_deleted;
+}
+
+#endif
@@ -25,6 +25,22 @@ typedef enum PisaDocumentOperation
     PISA_OP_DELETE = 2
 } PisaDocumentOperation;
 
+/*
+ * Change log, <index_path>.changes: the document changes of committed
+ * transactions, appended at commit and applied to the index as a delta
+ * segment by ProcessPendingIndexUpdates. Every record is a
+ * PisaChangeRecordHeader followed by the document id and, unless the
+ * document was deleted, its BSON.
+ */
+#define PISA_CHANGES_FILE_SUFFIX ".changes"
+
+typedef struct PisaChangeRecordHeader
+{
+    uint32 operation;           /* PisaDocumentOperation */
+    uint32 doc_id_length;
+    uint32 document_length;
+} PisaChangeRecordHeader;
+
 typedef struct PisaPendingOperation
 {
     PisaDocumentOperation operation;
@@ -46,6 +62,8 @@ void RegisterDocumentChange(const char *database_name, const char *collection_na
                            const pgbson *document);
 
 void ProcessPendingIndexUpdates(void);
+uint64 FlushPisaIndexChanges(const char *index_path);
+bool MergePisaIndexSegments(const char *index_path);
 void ScheduleIndexRebuild(const char *database_name, const char *collection_name);
 
 bool IsIndexSyncEnabled(const char *database_name, const char *collection_name);
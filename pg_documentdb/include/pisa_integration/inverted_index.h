@@ -0,0 +1,212 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/pisa_integration/inverted_index.h
+ *
+ * On-disk block-compressed inverted index used by the PISA query
+ * algorithms, its writer and its memory-mapped reader.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PISA_INVERTED_INDEX_H
+#define PISA_INVERTED_INDEX_H
+
+#include "postgres.h"
+#include "lib/stringinfo.h"
+
+#include "pisa_integration/pisa_integration.h"
+#include "pisa_integration/posting_codec.h"
+
+#define PISA_INDEX_MAGIC "PISAIDX"
+#define PISA_INDEX_VERSION 2
+#define PISA_INDEX_FILE_SUFFIX ".index"
+
+/* Docid reported by a posting cursor once it is exhausted */
+#define PISA_POSTING_END PG_UINT32_MAX
+
+/* BM25 parameters, same defaults as PISA */
+#define PISA_BM25_K1 0.9
+#define PISA_BM25_B 0.4
+
+/*
+ * File layout:
+ *
+ *   PisaIndexHeader
+ *   uint32 doc_lengths[num_docs]
+ *   postings: for every term, PisaSkipEntry[num_blocks] followed by the
+ *             blocks; each block starts with a PisaBlockHeader. The skip
+ *             entries carry the block-max scores used by Block-Max WAND
+ *   PisaTermEntry[num_terms], sorted by term bytes
+ *   term string pool
+ *
+ * All sections start on an 8 byte boundary.
+ */
+typedef struct PisaIndexHeader
+{
+    char magic[8];
+    uint32 version;
+    uint32 compression;
+    uint32 num_docs;
+    uint32 num_terms;
+    float8 avg_doc_length;
+    uint64 doc_lengths_offset;
+    uint64 postings_offset;
+    uint64 dictionary_offset;
+    uint64 term_pool_offset;
+    uint64 file_size;
+} PisaIndexHeader;
+
+typedef struct PisaTermEntry
+{
+    uint64 postings_offset;     /* relative to header->postings_offset */
+    uint32 term_offset;         /* relative to header->term_pool_offset */
+    uint32 term_length;
+    uint32 doc_freq;
+    uint32 num_blocks;
+    float4 max_score;           /* BM25 upper bound over the whole list */
+    uint32 reserved;
+} PisaTermEntry;
+
+typedef struct PisaSkipEntry
+{
+    uint32 last_docid;
+    uint32 block_offset;        /* relative to the end of the skip table */
+    float4 block_max_score;     /* BM25 upper bound over the block */
+} PisaSkipEntry;
+
+typedef enum PisaBlockEncoding
+{
+    PISA_BLOCK_ENCODING_RAW = 0,
+    PISA_BLOCK_ENCODING_PACKED = 1,
+    PISA_BLOCK_ENCODING_VBYTE = 2
+} PisaBlockEncoding;
+
+typedef struct PisaBlockHeader
+{
+    uint8 encoding;
+    uint8 docid_bits;
+    uint8 freq_bits;
+    uint8 reserved;
+    uint32 freq_offset;         /* bytes from the end of the header */
+} PisaBlockHeader;
+
+typedef struct PisaIndexReader
+{
+    char path[MAXPGPATH];
+    const char *base;
+    size_t size;
+    const PisaIndexHeader *header;
+    const uint32 *doc_lengths;
+    const char *postings;
+    const PisaTermEntry *terms;
+    const char *term_pool;
+    uint64 file_inode;
+    int64 file_mtime;
+    int refcount;
+    bool stale;
+} PisaIndexReader;
+
+typedef struct PisaPostingCursor
+{
+    PisaIndexReader *reader;
+    const PisaTermEntry *term;
+    const PisaSkipEntry *skips;
+    const char *blocks;
+    uint32 block;
+    uint32 shallow_block;       /* block-max pointer, never behind 'block' */
+    uint32 position;
+    uint32 block_count;
+    bool freqs_decoded;
+    double idf;
+    uint32 docids[PISA_BLOCK_SIZE];
+    uint32 freqs[PISA_BLOCK_SIZE];
+} PisaPostingCursor;
+
+typedef struct PisaIndexWriter
+{
+    char path[MAXPGPATH];
+    char temp_path[MAXPGPATH];
+    FILE *file;
+    PisaCompressionType compression;
+    uint32 num_docs;
+    uint32 *doc_lengths;
+    double avg_doc_length;
+    uint64 postings_size;
+    PisaTermEntry *terms;
+    uint32 num_terms;
+    uint32 max_terms;
+    StringInfoData term_pool;
+    StringInfoData block_buffer;
+    int last_term_offset;
+    int last_term_length;
+} PisaIndexWriter;
+
+PisaIndexWriter *BeginPisaIndexWriter(const char *index_file, PisaCompressionType compression,
+                                      uint32 num_docs, const uint32 *doc_lengths);
+void PisaIndexWriterAddTerm(PisaIndexWriter *writer, const char *term, int term_length,
+                            const uint32 *docids, const uint32 *freqs, uint32 count);
+uint64 FinishPisaIndexWriter(PisaIndexWriter *writer);
+uint64 PisaPostingListEncodedSize(PisaCompressionType compression, const uint32 *docids,
+                                  const uint32 *freqs, uint32 count, StringInfo buffer);
+
+char *GetPisaIndexFilePath(const char *index_path);
+PisaIndexReader *OpenPisaIndexReader(const char *index_file);
+void ReleasePisaIndexReader(PisaIndexReader *reader);
+const PisaTermEntry *PisaIndexLookupTerm(PisaIndexReader *reader, const char *term,
+                                         int term_length);
+
+PisaPostingCursor *OpenPisaPostingCursor(PisaIndexReader *reader, const PisaTermEntry *term);
+void ClosePisaPostingCursor(PisaPostingCursor *cursor);
+void PisaPostingCursorNext(PisaPostingCursor *cursor);
+void PisaPostingCursorNextGeq(PisaPostingCursor *cursor, uint32 target);
+uint32 PisaPostingCursorFreq(PisaPostingCursor *cursor);
+double PisaPostingCursorScore(PisaPostingCursor *cursor);
+void PisaPostingCursorShallowNextGeq(PisaPostingCursor *cursor, uint32 target);
+
+int PisaCompareTerms(const char *left, int left_length, const char *right,
+                     int right_length);
+double PisaBm25Idf(uint32 num_docs, uint32 doc_freq);
+
+
+static inline uint32
+PisaPostingCursorDocId(PisaPostingCursor *cursor)
+{
+    return cursor->docids[cursor->position];
+}
+
+
+/*
+ * Block-max score and last docid of the block under the shallow pointer
+ * (0 and PISA_POSTING_END once the shallow pointer ran off the list).
+ */
+static inline double
+PisaPostingCursorBlockMaxScore(PisaPostingCursor *cursor)
+{
+    if (cursor->shallow_block >= cursor->term->num_blocks)
+        return 0.0;
+
+    return cursor->skips[cursor->shallow_block].block_max_score;
+}
+
+
+static inline uint32
+PisaPostingCursorBlockLastDocId(PisaPostingCursor *cursor)
+{
+    if (cursor->shallow_block >= cursor->term->num_blocks)
+        return PISA_POSTING_END;
+
+    return cursor->skips[cursor->shallow_block].last_docid;
+}
+
+
+static inline double
+PisaBm25Score(double idf, uint32 freq, uint32 doc_length, double avg_doc_length)
+{
+    double norm = PISA_BM25_K1 * (1.0 - PISA_BM25_B +
+                                  PISA_BM25_B * doc_length / avg_doc_length);
+
+    return idf * (freq * (PISA_BM25_K1 + 1.0)) / (freq + norm);
+}
+
+#endif
@@ -1,80 +1,97 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/pisa_integration/memory_optimization.h
+ *
+ * Size-classed slab allocator for the short-lived structures of PISA
+ * queries: posting cursors with their block decoding buffers, segment
+ * cursors and top-k queues.
+ *
+ *-------------------------------------------------------------------------
+ */
+
 #ifndef PISA_MEMORY_OPTIMIZATION_H
 #define PISA_MEMORY_OPTIMIZATION_H
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "lib/ilist.h"
 #include "utils/memutils.h"
-#include "storage/lwlock.h"
+#include "utils/timestamp.h"
 
-#define PISA_MEMORY_POOL_SIZE (64 * 1024 * 1024)
-#define PISA_MEMORY_BLOCK_SIZE 4096
-#define PISA_MEMORY_MAX_POOLS 16
+/* Slabs are carved into chunks of a single size class */
+#define PISA_MEMORY_SLAB_SIZE (64 * 1024)
 
-typedef struct PisaMemoryBlock
-{
-    void *data;
-    size_t size;
-    bool is_free;
-    struct PisaMemoryBlock *next;
-    struct PisaMemoryBlock *prev;
-} PisaMemoryBlock;
+/*
+ * Size classes are the powers of two from 32 to 8192 bytes and the
+ * midpoints between them, so at most a third of a chunk is wasted.
+ * Larger requests are allocated directly from the pool's context.
+ */
+#define PISA_MEMORY_MIN_CHUNK_SIZE 32
+#define PISA_MEMORY_MAX_CHUNK_SIZE 8192
+#define PISA_MEMORY_NUM_CLASSES 17
+#define PISA_MEMORY_LARGE_CLASS PISA_MEMORY_NUM_CLASSES
+
+typedef struct PisaMemorySlab PisaMemorySlab;
 
+/*
+ * A pool owns a memory context of its own and everything in the pool is
+ * allocated from it, the pool itself included: resetting or deleting the
+ * context, or one of its parents, frees the pool at once.
+ */
 typedef struct PisaMemoryPool
 {
-    int pool_id;
-    void *pool_start;
-    size_t pool_size;
-    size_t used_size;
-    size_t free_size;
-    PisaMemoryBlock *free_blocks;
-    PisaMemoryBlock *used_blocks;
-    int allocation_count;
-    int deallocation_count;
-    TimestampTz created_at;
-    bool is_active;
+    dlist_node node;                /* in the backend's list of pools */
+    MemoryContext context;
+    MemoryContextCallback reset_callback;
+
+    /* Slabs of each class that have free chunks */
+    dlist_head partial_slabs[PISA_MEMORY_NUM_CLASSES];
+    int num_slabs[PISA_MEMORY_NUM_CLASSES];
+    int retained_slabs[PISA_MEMORY_NUM_CLASSES];  /* empty slabs kept for reuse */
+
+    int64 live_chunks[PISA_MEMORY_NUM_CLASSES + 1];
+    int64 live_bytes[PISA_MEMORY_NUM_CLASSES + 1];
 } PisaMemoryPool;
 
+/* Usage of one size class by all the pools of the backend */
+typedef struct PisaMemoryClassStats
+{
+    int64 allocations;
+    int64 live_chunks;
+    int64 live_bytes;
+    int64 peak_bytes;
+    int64 reserved_bytes;           /* slabs, or large chunks */
+} PisaMemoryClassStats;
+
 typedef struct PisaMemoryStats
 {
-    int64 total_allocated_bytes;
-    int64 total_freed_bytes;
-    int64 current_usage_bytes;
-    int64 peak_usage_bytes;
-    int active_allocations;
-    int total_allocations;
+    PisaMemoryClassStats classes[PISA_MEMORY_NUM_CLASSES + 1];
+    int64 live_bytes;
+    int64 peak_bytes;
+    int64 reserved_bytes;
     int pool_count;
-    double fragmentation_ratio;
-    TimestampTz last_gc_time;
+    TimestampTz last_reset;
 } PisaMemoryStats;
 
-void InitializePisaMemoryOptimization(void);
-void ShutdownPisaMemoryOptimization(void);
-
-void *PisaMemoryAlloc(size_t size);
-void *PisaMemoryRealloc(void *ptr, size_t new_size);
-void PisaMemoryFree(void *ptr);
-void *PisaMemoryAllocZero(size_t size);
-
-PisaMemoryPool *CreateMemoryPool(size_t pool_size);
+PisaMemoryPool *CreateMemoryPool(MemoryContext parent, const char *name);
 void DestroyMemoryPool(PisaMemoryPool *pool);
-void *AllocateFromPool(PisaMemoryPool *pool, size_t size);
-bool FreeToPool(PisaMemoryPool *pool, void *ptr);
+void *AllocateFromPool(PisaMemoryPool *pool, Size size);
+void FreeToPool(void *pointer);
+Size CompactMemoryPool(PisaMemoryPool *pool);
+Size PreallocateMemoryBuffers(PisaMemoryPool *pool, Size buffer_size, int buffer_count);
+int GetPisaMemorySizeClass(Size size);
+Size GetPisaMemoryChunkSize(int size_class);
 
-void DefragmentMemoryPools(void);
-void CompactMemoryPool(PisaMemoryPool *pool);
-void GarbageCollectMemory(void);
+void *PisaMemoryAlloc(Size size);
+void *PisaMemoryAllocZero(Size size);
+void PisaMemoryFree(void *pointer);
+PisaMemoryPool *GetPisaQueryMemoryPool(void);
 
-PisaMemoryStats *GetMemoryStatistics(void);
-void ResetMemoryStatistics(void);
-void UpdateMemoryStatistics(int64 allocated_bytes, int64 freed_bytes);
-
-bool OptimizeMemoryLayout(void);
-void PreallocateMemoryBuffers(size_t buffer_size, int buffer_count);
-void ReleaseUnusedMemory(void);
+Size DefragmentMemoryPools(void);
+Size GarbageCollectMemory(void);
 
-PG_FUNCTION_INFO_V1(documentdb_get_pisa_memory_stats);
-PG_FUNCTION_INFO_V1(documentdb_optimize_pisa_memory);
-PG_FUNCTION_INFO_V1(documentdb_defragment_pisa_memory);
-PG_FUNCTION_INFO_V1(documentdb_gc_pisa_memory);
+void GetMemoryStatistics(PisaMemoryStats *stats);
+void ResetMemoryStatistics(void);
 
 #endif
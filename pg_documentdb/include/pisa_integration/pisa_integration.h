@@ -39,6 +39,9 @@ typedef enum PisaCompressionType
 extern bool pisa_integration_enabled;
 extern char *pisa_index_base_path;
 extern int pisa_default_compression;
+extern int pisa_reordering_workers;
+extern int pisa_index_build_workers;
+extern int pisa_query_cache_size_mb;
 
 void InitializePisaIntegration(void);
 void ShutdownPisaIntegration(void);
@@ -56,3 +59,20 @@ char *ConvertBsonToPisaFormat(const pgbson *document);
 pgbson *ConvertPisaResultToBson(const char *pisa_result);
 
 void RegisterPisaConfigurationParameters(void);
+
+/* Used by the *_for_test functions of the regression tests */
+char *CreatePisaTestDirectory(const char *name);
+void RemovePisaTestDirectory(const char *directory);
+
+/*
+ * xorshift64 step, the deterministic pseudo-random source of the
+ * benchmark and test functions.
+ */
+static inline uint64
+PisaTestRandom(uint64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
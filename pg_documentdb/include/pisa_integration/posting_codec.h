@@ -0,0 +1,41 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/pisa_integration/posting_codec.h
+ *
+ * Block integer codecs used by the PISA posting lists.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PISA_POSTING_CODEC_H
+#define PISA_POSTING_CODEC_H
+
+#include "postgres.h"
+
+/*
+ * Number of postings in a full block. Blocks are bit-packed in the
+ * SIMD-BP128 layout: four interleaved 32-bit lanes of 32 values each,
+ * so a 128-bit vector unit (or the compiler's auto-vectorizer) can
+ * pack/unpack one lane per vector element.
+ */
+#define PISA_BLOCK_SIZE 128
+#define PISA_BLOCK_LANES 4
+
+/* Worst case size of a packed block (32 bits per value) in bytes */
+#define PISA_BLOCK_MAX_PACKED_BYTES (PISA_BLOCK_SIZE * sizeof(uint32))
+
+/* Worst case size of a VByte encoded value */
+#define PISA_VBYTE_MAX_BYTES 5
+
+int PisaRequiredBits(const uint32 *values, int count);
+void PisaBitPackBlock(const uint32 *in, int bits, uint32 *out);
+void PisaBitUnpackBlock(const uint32 *in, int bits, uint32 *out);
+
+int PisaVByteEncode(const uint32 *in, int count, uint8 *out);
+int PisaVByteDecode(const uint8 *in, int count, uint32 *out);
+
+void PisaDeltaEncode(const uint32 *docids, int count, uint32 base, uint32 *gaps);
+void PisaDeltaDecode(uint32 *values, int count, uint32 base);
+
+#endif
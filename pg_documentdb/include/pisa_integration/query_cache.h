@@ -4,24 +4,33 @@
 #include "postgres.h"
 #include "fmgr.h"
 #include "utils/jsonb.h"
-#include "utils/hsearch.h"
 #include "storage/lwlock.h"
 
-#define PISA_CACHE_MAX_ENTRIES 10000
+#include "io/pgbson.h"
+
 #define PISA_CACHE_DEFAULT_TTL 300
-#define PISA_CACHE_KEY_SIZE 256
+#define PISA_CACHE_DEFAULT_SIZE_MB 64
+
+/* Results are stored as chains of chunks of this size */
+#define PISA_CACHE_CHUNK_SIZE 1024
+
+/* Results larger than this fraction of the cache are not cached */
+#define PISA_CACHE_MAX_RESULT_FRACTION 0.125
 
-typedef struct PisaCacheEntry
+/* Collections share this many invalidation counters */
+#define PISA_CACHE_INVALIDATION_SLOTS 4096
+
+/*
+ * Key of a cached query: the collection and the canonical hashes of the
+ * filter and of the query options. Filters that only differ in the order
+ * of their predicates share an entry (see HashBsonQueryFilterExtended).
+ */
+typedef struct PisaQueryCacheKey
 {
-    char cache_key[PISA_CACHE_KEY_SIZE];
-    Jsonb *query_result;
-    TimestampTz created_at;
-    TimestampTz last_accessed;
-    int access_count;
-    int ttl_seconds;
-    bool is_valid;
-    size_t result_size_bytes;
-} PisaCacheEntry;
+    uint64 collection_hash;
+    uint64 filter_hash;
+    uint64 options_hash;
+} PisaQueryCacheKey;
 
 typedef struct PisaCacheStats
 {
@@ -29,39 +38,35 @@ typedef struct PisaCacheStats
     int64 cache_hits;
     int64 cache_misses;
     int64 cache_evictions;
+    int64 cache_invalidations;
     int64 total_entries;
     int64 total_size_bytes;
+    int64 capacity_bytes;
     double hit_ratio;
     TimestampTz last_reset;
 } PisaCacheStats;
 
+Size PisaQueryCacheShmemSize(void);
+void InitializePisaQueryCacheShmem(void);
 void InitializePisaQueryCache(void);
 void ShutdownPisaQueryCache(void);
 
-char *GenerateCacheKey(const char *database_name, const char *collection_name, 
-                      Jsonb *query, Jsonb *options);
+void GeneratePisaCacheKey(PisaQueryCacheKey *key, const char *database_name,
+                          const char *collection_name, const pgbson *filter,
+                          const pgbson *options);
+uint32 GetPisaQueryCacheGeneration(const PisaQueryCacheKey *key);
 
-bool CacheQuery(const char *cache_key, Jsonb *result, int ttl_seconds);
-Jsonb *GetCachedQuery(const char *cache_key);
-bool InvalidateCacheEntry(const char *cache_key);
-bool InvalidateCacheByPattern(const char *pattern);
+bool CacheQuery(const PisaQueryCacheKey *key, uint32 generation, Jsonb *result,
+                int ttl_seconds);
+Jsonb *GetCachedQuery(const PisaQueryCacheKey *key);
+bool InvalidateCacheEntry(const PisaQueryCacheKey *key);
+void InvalidatePisaQueryCache(const char *database_name, const char *collection_name);
+void InvalidatePisaQueryCacheForIndex(const char *index_path);
 
-void EvictExpiredEntries(void);
-void EvictLRUEntries(int count);
-bool IsCacheEntryValid(PisaCacheEntry *entry);
+int EvictExpiredEntries(void);
+int64 EvictPisaQueryCacheEntries(int count);
 
 PisaCacheStats *GetCacheStatistics(void);
-void ResetCacheStatistics(void);
-void UpdateCacheStatistics(bool cache_hit);
-
-bool SetCacheConfiguration(int max_entries, int default_ttl, bool enabled);
-void OptimizeCachePerformance(void);
-
-PG_FUNCTION_INFO_V1(documentdb_cache_pisa_query);
-PG_FUNCTION_INFO_V1(documentdb_get_cached_pisa_query);
-PG_FUNCTION_INFO_V1(documentdb_invalidate_pisa_cache);
-PG_FUNCTION_INFO_V1(documentdb_get_pisa_cache_stats);
-PG_FUNCTION_INFO_V1(documentdb_reset_pisa_cache);
-PG_FUNCTION_INFO_V1(documentdb_configure_pisa_cache);
+void ResetPisaQueryCache(void);
 
 #endif
@@ -22,6 +22,7 @@
 
 extern planner_hook_type ExtensionPreviousPlannerHook;
 extern set_rel_pathlist_hook_type ExtensionPreviousSetRelPathlistHook;
+extern create_upper_paths_hook_type ExtensionPreviousCreateUpperPathsHook;
 extern explain_get_index_name_hook_type ExtensionPreviousIndexNameHook;
 extern bool SimulateRecoveryState;
 extern bool DocumentDBPGReadOnlyForDiskFull;
@@ -32,6 +33,9 @@ PlannedStmt * DocumentDBApiPlanner(Query *parse, const char *queryString, int
 								   ParamListInfo boundParams);
 void ExtensionRelPathlistHook(PlannerInfo *root, RelOptInfo *rel, Index rti,
 							  RangeTblEntry *rte);
+void ExtensionCreateUpperPathsHook(PlannerInfo *root, UpperRelationKind stage,
+								   RelOptInfo *inputRel, RelOptInfo *outputRel,
+								   void *extra);
 bool IsMongoCollectionBasedRTE(RangeTblEntry *rte);
 bool IsResolvableMongoCollectionBasedRTE(RangeTblEntry *rte,
 										 ParamListInfo boundParams);
@@ -0,0 +1,18 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/query/bson_dollar_selectivity.h
+ *
+ * Exports of the selectivity functions of the BSON operators.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BSON_DOLLAR_SELECTIVITY_H
+#define BSON_DOLLAR_SELECTIVITY_H
+
+#include <nodes/pg_list.h>
+
+List * SetBsonSelectivityClauseContext(List *clauses);
+
+#endif
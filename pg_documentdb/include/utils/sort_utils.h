@@ -82,6 +82,8 @@ typedef struct SortSpecData
 } SortSpecData;
 
 int CompareBsonValuesForSort(const void *a, const void *b, void *args);
+void SortElementsWithIndex(ElementWithIndex *elements, int64_t elementCount,
+						   SortContext *sortContext);
 void ValidateSortSpecAndSetSortContext(bson_value_t sortBsonValue,
 									   SortContext *sortContext);
 ElementWithIndex * GetElementWithIndex(const bson_value_t *val, uint32_t index);
@@ -1,5 +1,12 @@
 
 #include "udfs/aggregation/bson_bucket_auto--0.105-0.sql"
+#include "udfs/aggregation/bson_group_accumulators--0.105-0.sql"
+#include "udfs/aggregation/group_aggregates_support--0.105-0.sql"
+#include "udfs/aggregation/window_aggregate_support--0.105-0.sql"
+#include "udfs/aggregation/group_aggregates--0.105-0.sql"
 #include "udfs/commands_crud/bson_update_document--0.105-0.sql"
 #include "udfs/schema_mgmt/cursor_support--0.105-0.sql"
-#include "udfs/users/connection_status--0.105-0.sql"
\ No newline at end of file
+#include "udfs/users/connection_status--0.105-0.sql"
+#include "udfs/query/bson_orderby--0.105-0.sql"
+#include "udfs/query/query_shape_cache--0.105-0.sql"
+#include "operators/bson_btree_orderby_operators_family--0.105-0.sql"
@@ -85,6 +85,18 @@ CREATE OR REPLACE FUNCTION documentdb_api.execute_advanced_pisa_query(
 LANGUAGE C STRICT
 AS 'MODULE_PATHNAME', 'documentdb_execute_advanced_pisa_query';
 
+CREATE OR REPLACE FUNCTION documentdb_api.benchmark_pisa_topk_queue(
+    candidate_count int DEFAULT 1000000,
+    top_k int DEFAULT 10
+) RETURNS TABLE(
+    implementation text,
+    candidates bigint,
+    elapsed_ms float8,
+    threshold float8
+)
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', 'documentdb_benchmark_pisa_topk_queue';
+
 CREATE OR REPLACE FUNCTION documentdb_api.execute_pisa_wand_query(
     database_name text,
     collection_name text,
@@ -297,6 +309,7 @@ GRANT EXECUTE ON FUNCTION documentdb_api.execute_pisa_wand_query(text, text, jso
 GRANT EXECUTE ON FUNCTION documentdb_api.execute_pisa_block_max_wand_query(text, text, jsonb, int) TO documentdb_readonly_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.execute_pisa_maxscore_query(text, text, jsonb, int) TO documentdb_readonly_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.analyze_pisa_query_plan(jsonb, int) TO documentdb_readonly_role;
+GRANT EXECUTE ON FUNCTION documentdb_api.benchmark_pisa_topk_queue(int, int) TO documentdb_admin_role;
 
 GRANT EXECUTE ON FUNCTION documentdb_api.schedule_document_reordering(text, text, int) TO documentdb_admin_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.cancel_document_reordering(text, text) TO documentdb_admin_role;
@@ -359,7 +372,10 @@ LANGUAGE C STRICT
 AS 'MODULE_PATHNAME', 'documentdb_get_shard_statistics';
 
 CREATE OR REPLACE FUNCTION documentdb_api.cache_pisa_query(
-    cache_key text,
+    database_name text,
+    collection_name text,
+    filter documentdb_core.bson,
+    options documentdb_core.bson,
     result jsonb,
     ttl_seconds int DEFAULT 300
 ) RETURNS boolean
@@ -367,13 +383,17 @@ LANGUAGE C STRICT
 AS 'MODULE_PATHNAME', 'documentdb_cache_pisa_query';
 
 CREATE OR REPLACE FUNCTION documentdb_api.get_cached_pisa_query(
-    cache_key text
+    database_name text,
+    collection_name text,
+    filter documentdb_core.bson,
+    options documentdb_core.bson
 ) RETURNS jsonb
 LANGUAGE C STRICT
 AS 'MODULE_PATHNAME', 'documentdb_get_cached_pisa_query';
 
 CREATE OR REPLACE FUNCTION documentdb_api.invalidate_pisa_cache(
-    pattern text
+    database_name text,
+    collection_name text
 ) RETURNS boolean
 LANGUAGE C STRICT
 AS 'MODULE_PATHNAME', 'documentdb_invalidate_pisa_cache';
@@ -388,6 +408,35 @@ RETURNS boolean
 LANGUAGE C STRICT
 AS 'MODULE_PATHNAME', 'documentdb_reset_pisa_cache';
 
+CREATE OR REPLACE FUNCTION documentdb_api.get_pisa_memory_stats()
+RETURNS TABLE(
+    chunk_size int,
+    allocations bigint,
+    live_chunks bigint,
+    live_bytes bigint,
+    peak_bytes bigint,
+    reserved_bytes bigint
+)
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', 'documentdb_get_pisa_memory_stats';
+
+CREATE OR REPLACE FUNCTION documentdb_api.optimize_pisa_memory(
+    buffer_size int,
+    buffer_count int
+) RETURNS bigint
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', 'documentdb_optimize_pisa_memory';
+
+CREATE OR REPLACE FUNCTION documentdb_api.defragment_pisa_memory()
+RETURNS bigint
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', 'documentdb_defragment_pisa_memory';
+
+CREATE OR REPLACE FUNCTION documentdb_api.gc_pisa_memory()
+RETURNS bigint
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', 'documentdb_gc_pisa_memory';
+
 CREATE OR REPLACE FUNCTION documentdb_api.record_pisa_metric(
     metric_type int,
     value float8,
@@ -418,12 +467,17 @@ GRANT EXECUTE ON FUNCTION documentdb_api.coordinate_sharded_query(text, text, js
 GRANT EXECUTE ON FUNCTION documentdb_api.balance_shards(text, text) TO documentdb_admin_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.get_shard_statistics(text, text) TO documentdb_readonly_role;
 
-GRANT EXECUTE ON FUNCTION documentdb_api.cache_pisa_query(text, jsonb, int) TO documentdb_admin_role;
-GRANT EXECUTE ON FUNCTION documentdb_api.get_cached_pisa_query(text) TO documentdb_readonly_role;
-GRANT EXECUTE ON FUNCTION documentdb_api.invalidate_pisa_cache(text) TO documentdb_admin_role;
+GRANT EXECUTE ON FUNCTION documentdb_api.cache_pisa_query(text, text, documentdb_core.bson, documentdb_core.bson, jsonb, int) TO documentdb_admin_role;
+GRANT EXECUTE ON FUNCTION documentdb_api.get_cached_pisa_query(text, text, documentdb_core.bson, documentdb_core.bson) TO documentdb_readonly_role;
+GRANT EXECUTE ON FUNCTION documentdb_api.invalidate_pisa_cache(text, text) TO documentdb_admin_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.get_pisa_cache_stats() TO documentdb_readonly_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.reset_pisa_cache() TO documentdb_admin_role;
 
+GRANT EXECUTE ON FUNCTION documentdb_api.get_pisa_memory_stats() TO documentdb_readonly_role;
+GRANT EXECUTE ON FUNCTION documentdb_api.optimize_pisa_memory(int, int) TO documentdb_admin_role;
+GRANT EXECUTE ON FUNCTION documentdb_api.defragment_pisa_memory() TO documentdb_admin_role;
+GRANT EXECUTE ON FUNCTION documentdb_api.gc_pisa_memory() TO documentdb_admin_role;
+
 GRANT EXECUTE ON FUNCTION documentdb_api.record_pisa_metric(int, float8, text) TO documentdb_admin_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.get_pisa_metrics() TO documentdb_readonly_role;
 GRANT EXECUTE ON FUNCTION documentdb_api.get_pisa_performance_stats() TO documentdb_readonly_role;
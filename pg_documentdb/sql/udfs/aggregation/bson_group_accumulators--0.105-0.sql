@@ -0,0 +1,57 @@
+CREATE OR REPLACE FUNCTION __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_transition(internal, __CORE_SCHEMA__.bson, __CORE_SCHEMA__.bson, __CORE_SCHEMA__.bson)
+ RETURNS internal
+ LANGUAGE c
+ STABLE
+AS 'MODULE_PATHNAME', $function$bson_group_accumulators_transition$function$;
+
+CREATE OR REPLACE FUNCTION __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_final(internal)
+ RETURNS __CORE_SCHEMA__.bson
+ LANGUAGE c
+ STABLE
+AS 'MODULE_PATHNAME', $function$bson_group_accumulators_final$function$;
+
+CREATE OR REPLACE FUNCTION __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_combine(internal, internal)
+ RETURNS internal
+ LANGUAGE c
+ STABLE
+AS 'MODULE_PATHNAME', $function$bson_group_accumulators_combine$function$;
+
+CREATE OR REPLACE FUNCTION __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_serialize(internal)
+ RETURNS bytea
+ LANGUAGE c
+ IMMUTABLE STRICT
+AS 'MODULE_PATHNAME', $function$bson_group_accumulators_serialize$function$;
+
+CREATE OR REPLACE FUNCTION __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_deserialize(bytea, internal)
+ RETURNS internal
+ LANGUAGE c
+ IMMUTABLE STRICT
+AS 'MODULE_PATHNAME', $function$bson_group_accumulators_deserialize$function$;
+
+/*
+ * Evaluates the $sum, $avg, $min, $max and $count accumulators of a $group
+ * together: takes the _id of the group, the document and the accumulators
+ * spec { "<field>": { "<accumulator>": <expression> } } and returns the output
+ * document of the group.
+ */
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_ACCUMULATORS(__CORE_SCHEMA__.bson, __CORE_SCHEMA__.bson, __CORE_SCHEMA__.bson)
+(
+    SFUNC = __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_transition,
+    stype = internal,
+    FINALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_final,
+    SERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_serialize,
+    DESERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_deserialize,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_group_accumulators_combine,
+    PARALLEL = SAFE
+);
+
+/*
+ * Returns the key a $group with a collation groups the _id by: an encoding
+ * of the _id in which strings are replaced by their ICU sort key, so that
+ * _ids that are equal under the collation have the same key.
+ */
+CREATE OR REPLACE FUNCTION __API_SCHEMA_INTERNAL_V2__.bson_group_collation_key(__CORE_SCHEMA__.bson, text)
+ RETURNS bytea
+ LANGUAGE c
+ IMMUTABLE PARALLEL SAFE STRICT
+AS 'MODULE_PATHNAME', $function$bson_group_collation_key$function$;
@@ -31,6 +31,10 @@ CREATE OR REPLACE AGGREGATE __API_CATALOG_SCHEMA__.BSONMAX(__CORE_SCHEMA__.bson)
     FINALFUNC = __API_CATALOG_SCHEMA__.bson_min_max_final,
     stype = __CORE_SCHEMA__.bson,
     COMBINEFUNC = __API_CATALOG_SCHEMA__.bson_max_combine,
+    mstype = bytea,
+    MSFUNC = __API_SCHEMA_INTERNAL_V2__.bson_max_window_transition,
+    MFINALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_min_max_window_final,
+    MINVFUNC = __API_SCHEMA_INTERNAL_V2__.bson_min_max_window_invtransition,
     PARALLEL = SAFE
 );
 
@@ -40,6 +44,10 @@ CREATE OR REPLACE AGGREGATE __API_CATALOG_SCHEMA__.BSONMIN(__CORE_SCHEMA__.bson)
     FINALFUNC = __API_CATALOG_SCHEMA__.bson_min_max_final,
     stype = __CORE_SCHEMA__.bson,
     COMBINEFUNC = __API_CATALOG_SCHEMA__.bson_min_combine,
+    mstype = bytea,
+    MSFUNC = __API_SCHEMA_INTERNAL_V2__.bson_min_window_transition,
+    MFINALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_min_max_window_final,
+    MINVFUNC = __API_SCHEMA_INTERNAL_V2__.bson_min_max_window_invtransition,
     PARALLEL = SAFE
 );
 
@@ -394,4 +402,81 @@ CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSONMEDIAN(__CORE_SCHEMA_
     DESERIALFUNC = __API_SCHEMA_INTERNAL_V2__.tdigest_deserial,
     COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.tdigest_combine,
     PARALLEL = SAFE
-);
\ No newline at end of file
+);
+
+/*
+ * The BSON_GROUP_* aggregates are the aggregates of $first, $last, $firstN, $lastN,
+ * $push, $addToSet and $mergeObjects for a $group whose input isn't sorted. Unlike
+ * __CORE_SCHEMA__.bsonFIRSTONSORTED and the others they have a COMBINEFUNC, and an
+ * internal state that can be serialized where the state isn't a plain bytea, so that
+ * the $group can be partially aggregated (e.g. on the worker nodes). The order the
+ * partial aggregates are combined in is arbitrary, hence the unsorted input.
+ */
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_FIRST(__CORE_SCHEMA__.bson)
+(
+    SFUNC = __API_CATALOG_SCHEMA__.bson_first_transition_on_sorted,
+    FINALFUNC = __API_CATALOG_SCHEMA__.bson_first_last_final_on_sorted,
+    stype = bytea,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_first_combine_on_sorted,
+    PARALLEL = SAFE
+);
+
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_LAST(__CORE_SCHEMA__.bson)
+(
+    SFUNC = __API_CATALOG_SCHEMA__.bson_last_transition_on_sorted,
+    FINALFUNC = __API_CATALOG_SCHEMA__.bson_first_last_final_on_sorted,
+    stype = bytea,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_last_combine_on_sorted,
+    PARALLEL = SAFE
+);
+
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_FIRSTN(__CORE_SCHEMA__.bson, bigint)
+(
+    SFUNC = __API_CATALOG_SCHEMA__.bson_firstn_transition_on_sorted,
+    FINALFUNC = __API_CATALOG_SCHEMA__.bson_firstn_lastn_final_on_sorted,
+    stype = bytea,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_firstn_combine_on_sorted,
+    PARALLEL = SAFE
+);
+
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_LASTN(__CORE_SCHEMA__.bson, bigint)
+(
+    SFUNC = __API_CATALOG_SCHEMA__.bson_lastn_transition_on_sorted,
+    FINALFUNC = __API_CATALOG_SCHEMA__.bson_firstn_lastn_final_on_sorted,
+    stype = bytea,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_lastn_combine_on_sorted,
+    PARALLEL = SAFE
+);
+
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_PUSH(__CORE_SCHEMA__.bson, text, boolean)
+(
+    SFUNC = __API_SCHEMA_INTERNAL_V2__.bson_array_agg_transition,
+    FINALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_array_agg_final,
+    stype = internal,
+    SERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_array_agg_serialize,
+    DESERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_array_agg_deserialize,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_array_agg_combine,
+    PARALLEL = SAFE
+);
+
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_ADD_TO_SET(__CORE_SCHEMA_V2__.bson)
+(
+    SFUNC = __API_SCHEMA_INTERNAL_V2__.bson_add_to_set_transition,
+    FINALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_add_to_set_final,
+    stype = internal,
+    SERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_add_to_set_serialize,
+    DESERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_add_to_set_deserialize,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_add_to_set_combine,
+    PARALLEL = SAFE
+);
+
+CREATE OR REPLACE AGGREGATE __API_SCHEMA_INTERNAL_V2__.BSON_GROUP_MERGE_OBJECTS(__CORE_SCHEMA_V2__.bson)
+(
+    SFUNC = __API_SCHEMA_INTERNAL_V2__.bson_merge_objects_transition_on_sorted,
+    FINALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_object_agg_final,
+    stype = internal,
+    SERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_object_agg_serialize,
+    DESERIALFUNC = __API_SCHEMA_INTERNAL_V2__.bson_object_agg_deserialize,
+    COMBINEFUNC = __API_SCHEMA_INTERNAL_V2__.bson_object_agg_combine,
+    PARALLEL = SAFE
+);
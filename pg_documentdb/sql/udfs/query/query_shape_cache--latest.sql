@@ -0,0 +1,13 @@
+-- This function returns the find query shapes cached by the current backend:
+-- the collection and filter of the shape, whether its template is bindable,
+-- and the finds of the shape across all backends along with how many of them
+-- used a template.
+CREATE OR REPLACE FUNCTION __API_SCHEMA_INTERNAL_V2__.query_shape_cache_stats(
+	OUT collection text,
+	OUT filter_shape __CORE_SCHEMA_V2__.bson,
+	OUT state text,
+	OUT calls int8,
+	OUT template_hits int8)
+RETURNS SETOF RECORD
+LANGUAGE C VOLATILE PARALLEL UNSAFE
+AS 'MODULE_PATHNAME', $$query_shape_cache_stats$$;
@@ -42,6 +42,9 @@ typedef struct BsonArrayGroupAggState
 {
 	pgbson_writer writer;
 	pgbson_array_writer arrayWriter;
+
+	/* The path the array is written at, kept to rebuild a serialized state */
+	const char *path;
 } BsonArrayGroupAggState;
 
 /*
@@ -67,6 +70,38 @@ typedef struct BsonArrayAggState
 	bool isWindowAggregation;
 } BsonArrayAggState;
 
+/*
+ * A value of the window that can still become the $min/$max of the window,
+ * with its position in the window's rows.
+ */
+typedef struct BsonMinMaxWindowEntry
+{
+	pgbson *value;
+	int64_t position;
+} BsonMinMaxWindowEntry;
+
+/*
+ * Moving aggregation state of $min/$max for windows whose start moves.
+ * The entries are a monotonic deque of the values in the window: each
+ * entry is the min/max of the values from it to the end of the window,
+ * so the first entry is the min/max of the window. An added value drops
+ * the entries it beats from the end, and a row leaving the window drops
+ * the first entry if it's that row's. Rows enter and leave the window in
+ * the same order, so each value is added and dropped at most once.
+ * The entries are kept in a ring buffer of capacity entries.
+ */
+typedef struct BsonMinMaxWindowAggState
+{
+	BsonMinMaxWindowEntry *entries;
+	int32_t capacity;
+	int32_t start;
+	int32_t count;
+
+	/* The number of rows added to and removed from the window so far */
+	int64_t addedCount;
+	int64_t removedCount;
+} BsonMinMaxWindowAggState;
+
 typedef struct BsonObjectAggState
 {
 	BsonIntermediatePathNode *tree;
@@ -127,11 +162,22 @@ const char charset[] = "abcdefghijklmnopqrstuvwxyz0123456789";
 /* --------------------------------------------------------- */
 
 static bytea * AllocateBsonNumericAggState(void);
+static bytea * AllocateBsonArrayAggState(bool isWindowAggregation, const char *path);
+static bytea * AllocateBsonObjectAggState(void);
+static bytea * AllocateBsonAddToSetState(bool isWindowAggregation);
+static Datum BsonMinMaxWindowTransitionCore(PG_FUNCTION_ARGS, bool isMax);
+static bytea * SerializeAggregateStateBson(int64_t currentSizeWritten, pgbson *stateBson);
+static pgbson * DeserializeAggregateStateBson(bytea *bytes, int64_t *currentSizeWritten);
+static void CombineBsonArrayAggState(BsonArrayAggState *leftState,
+									 BsonArrayAggState *rightState);
+static void CombineBsonAddToSetState(BsonAddToSetState *leftState,
+									 BsonAddToSetState *rightState);
 static void CheckAggregateIntermediateResultSize(uint32_t size);
 static void CreateObjectAggTreeNodes(BsonObjectAggState *currentState,
 									 pgbson *currentValue);
 static void ValidateMergeObjectsInput(pgbson *input);
 static Datum ParseAndReturnMergeObjectsTree(BsonObjectAggState *state);
+static pgbson * WriteMergeObjectsTree(BsonObjectAggState *state);
 static Datum bson_maxminn_transition(PG_FUNCTION_ARGS, bool isMaxN);
 
 void DeserializeBinaryHeapState(bytea *byteArray, BinaryHeapState *state);
@@ -152,18 +198,31 @@ PG_FUNCTION_INFO_V1(bson_max_transition);
 PG_FUNCTION_INFO_V1(bson_min_max_final);
 PG_FUNCTION_INFO_V1(bson_min_combine);
 PG_FUNCTION_INFO_V1(bson_max_combine);
+PG_FUNCTION_INFO_V1(bson_min_window_transition);
+PG_FUNCTION_INFO_V1(bson_max_window_transition);
+PG_FUNCTION_INFO_V1(bson_min_max_window_invtransition);
+PG_FUNCTION_INFO_V1(bson_min_max_window_final);
 PG_FUNCTION_INFO_V1(bson_build_distinct_response);
 PG_FUNCTION_INFO_V1(bson_array_agg_transition);
 PG_FUNCTION_INFO_V1(bson_array_agg_minvtransition);
 PG_FUNCTION_INFO_V1(bson_array_agg_final);
+PG_FUNCTION_INFO_V1(bson_array_agg_serialize);
+PG_FUNCTION_INFO_V1(bson_array_agg_deserialize);
+PG_FUNCTION_INFO_V1(bson_array_agg_combine);
 PG_FUNCTION_INFO_V1(bson_distinct_array_agg_transition);
 PG_FUNCTION_INFO_V1(bson_distinct_array_agg_final);
 PG_FUNCTION_INFO_V1(bson_object_agg_transition);
 PG_FUNCTION_INFO_V1(bson_object_agg_final);
+PG_FUNCTION_INFO_V1(bson_object_agg_serialize);
+PG_FUNCTION_INFO_V1(bson_object_agg_deserialize);
+PG_FUNCTION_INFO_V1(bson_object_agg_combine);
 PG_FUNCTION_INFO_V1(bson_out_transition);
 PG_FUNCTION_INFO_V1(bson_out_final);
 PG_FUNCTION_INFO_V1(bson_add_to_set_transition);
 PG_FUNCTION_INFO_V1(bson_add_to_set_final);
+PG_FUNCTION_INFO_V1(bson_add_to_set_serialize);
+PG_FUNCTION_INFO_V1(bson_add_to_set_deserialize);
+PG_FUNCTION_INFO_V1(bson_add_to_set_combine);
 PG_FUNCTION_INFO_V1(bson_merge_objects_transition_on_sorted);
 PG_FUNCTION_INFO_V1(bson_merge_objects_transition);
 PG_FUNCTION_INFO_V1(bson_merge_objects_final);
@@ -209,26 +268,8 @@ BsonArrayAggTransitionCore(PG_FUNCTION_ARGS, bool handleSingleValueElement,
 	/* If the intermediate state has never been initialized, create it */
 	if (PG_ARGISNULL(0)) /* First arg is the running aggregated state*/
 	{
-		int bson_size = sizeof(BsonArrayAggState) + VARHDRSZ;
-		bytea *combinedStateBytes = (bytea *) palloc0(bson_size);
-		SET_VARSIZE(combinedStateBytes, bson_size);
-		bytes = combinedStateBytes;
-
+		bytes = AllocateBsonArrayAggState(isWindowAggregation, path);
 		currentState = (BsonArrayAggState *) VARDATA(bytes);
-		currentState->isWindowAggregation = isWindowAggregation;
-		currentState->currentSizeWritten = 0;
-
-		if (isWindowAggregation)
-		{
-			currentState->aggState.window.aggregateList = NIL;
-		}
-		else
-		{
-			PgbsonWriterInit(&currentState->aggState.group.writer);
-			PgbsonWriterStartArray(&currentState->aggState.group.writer, path, strlen(
-									   path),
-								   &currentState->aggState.group.arrayWriter);
-		}
 	}
 	else
 	{
@@ -478,6 +519,113 @@ bson_distinct_array_agg_final(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * The serialfunc of the BSON_GROUP_PUSH aggregate, which has the state of
+ * bson_array_agg in an internal state so that it can be partially aggregated.
+ * The state is serialized as the array written so far.
+ */
+Datum
+bson_array_agg_serialize(PG_FUNCTION_ARGS)
+{
+	bytea *bytes = (bytea *) PG_GETARG_POINTER(0);
+	BsonArrayAggState *state = (BsonArrayAggState *) VARDATA(bytes);
+	if (state->isWindowAggregation)
+	{
+		ereport(ERROR, errmsg(
+					"window aggregate state of $push can't be serialized"));
+	}
+
+	bson_value_t arrayValue = PgbsonArrayWriterGetValue(
+		&state->aggState.group.arrayWriter);
+
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+	PgbsonWriterAppendValue(&writer, state->aggState.group.path,
+							strlen(state->aggState.group.path), &arrayValue);
+
+	PG_RETURN_BYTEA_P(SerializeAggregateStateBson(state->currentSizeWritten,
+												  PgbsonWriterGetPgbson(&writer)));
+}
+
+
+/*
+ * The deserialfunc of the BSON_GROUP_PUSH aggregate.
+ */
+Datum
+bson_array_agg_deserialize(PG_FUNCTION_ARGS)
+{
+	int64_t currentSizeWritten = 0;
+	pgbson *stateBson = DeserializeAggregateStateBson(PG_GETARG_BYTEA_P(0),
+													  &currentSizeWritten);
+
+	pgbsonelement arrayElement;
+	PgbsonToSinglePgbsonElement(stateBson, &arrayElement);
+
+	bool isWindowAggregation = false;
+	bytea *bytes = AllocateBsonArrayAggState(isWindowAggregation, arrayElement.path);
+	BsonArrayAggState *state = (BsonArrayAggState *) VARDATA(bytes);
+
+	bson_iter_t arrayIter;
+	BsonValueInitIterator(&arrayElement.bsonValue, &arrayIter);
+	while (bson_iter_next(&arrayIter))
+	{
+		PgbsonArrayWriterWriteValue(&state->aggState.group.arrayWriter,
+									bson_iter_value(&arrayIter));
+	}
+
+	state->currentSizeWritten = currentSizeWritten;
+	PG_RETURN_POINTER(bytes);
+}
+
+
+/*
+ * The combinefunc of the BSON_GROUP_PUSH aggregate: appends the values of the
+ * right state to the array of the left state.
+ */
+Datum
+bson_array_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggregateContext;
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, errmsg("aggregate function called in non-aggregate context"));
+	}
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+		{
+			PG_RETURN_NULL();
+		}
+
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	BsonArrayAggState *rightState =
+		(BsonArrayAggState *) VARDATA(PG_GETARG_POINTER(1));
+
+	MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+	/* The right state may be a deserialized one, so it's copied into a new state */
+	bytea *bytes;
+	if (PG_ARGISNULL(0))
+	{
+		bool isWindowAggregation = false;
+		bytes = AllocateBsonArrayAggState(isWindowAggregation,
+										  rightState->aggState.group.path);
+	}
+	else
+	{
+		bytes = (bytea *) PG_GETARG_POINTER(0);
+	}
+
+	CombineBsonArrayAggState((BsonArrayAggState *) VARDATA(bytes), rightState);
+
+	MemoryContextSwitchTo(oldContext);
+	PG_RETURN_POINTER(bytes);
+}
+
+
 /*
  * Core implementation of the object aggregation stage. This is used by both object_agg and merge_objects.
  * Both have the same implementation but differ in validations made inside the caller method.
@@ -500,15 +648,8 @@ AggregateObjectsCore(PG_FUNCTION_ARGS)
 	/* If the intermediate state has never been initialized, create it */
 	if (PG_ARGISNULL(0)) /* First arg is the running aggregated state*/
 	{
-		int bson_size = sizeof(BsonObjectAggState) + sizeof(int64_t) + VARHDRSZ;
-		bytea *combinedStateBytes = (bytea *) palloc0(bson_size);
-		SET_VARSIZE(combinedStateBytes, bson_size);
-		bytes = combinedStateBytes;
-
+		bytes = AllocateBsonObjectAggState();
 		currentState = (BsonObjectAggState *) VARDATA(bytes);
-		currentState->currentSizeWritten = 0;
-		currentState->tree = MakeRootNode();
-		currentState->addEmptyPath = false;
 	}
 	else
 	{
@@ -658,6 +799,88 @@ bson_object_agg_final(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * The serialfunc of the BSON_GROUP_MERGE_OBJECTS aggregate, which has the state
+ * of bson_object_agg in an internal state so that it can be partially
+ * aggregated. The state is serialized as the document merged so far.
+ */
+Datum
+bson_object_agg_serialize(PG_FUNCTION_ARGS)
+{
+	bytea *bytes = (bytea *) PG_GETARG_POINTER(0);
+	BsonObjectAggState *state = (BsonObjectAggState *) VARDATA(bytes);
+
+	PG_RETURN_BYTEA_P(SerializeAggregateStateBson(state->currentSizeWritten,
+												  WriteMergeObjectsTree(state)));
+}
+
+
+/*
+ * The deserialfunc of the BSON_GROUP_MERGE_OBJECTS aggregate.
+ */
+Datum
+bson_object_agg_deserialize(PG_FUNCTION_ARGS)
+{
+	int64_t currentSizeWritten = 0;
+	pgbson *stateBson = DeserializeAggregateStateBson(PG_GETARG_BYTEA_P(0),
+													  &currentSizeWritten);
+
+	bytea *bytes = AllocateBsonObjectAggState();
+	BsonObjectAggState *state = (BsonObjectAggState *) VARDATA(bytes);
+
+	/* The tree references the values of the document, so it's copied */
+	CreateObjectAggTreeNodes(state, PgbsonCloneFromPgbson(stateBson));
+	state->currentSizeWritten = currentSizeWritten;
+	PG_RETURN_POINTER(bytes);
+}
+
+
+/*
+ * The combinefunc of the BSON_GROUP_MERGE_OBJECTS aggregate. Merging objects
+ * is associative, so the document merged by the right state is merged into
+ * the left state as if it was its next input.
+ */
+Datum
+bson_object_agg_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggregateContext;
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, errmsg("aggregate function called in non-aggregate context"));
+	}
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+		{
+			PG_RETURN_NULL();
+		}
+
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	BsonObjectAggState *rightState =
+		(BsonObjectAggState *) VARDATA(PG_GETARG_POINTER(1));
+
+	MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+	bytea *bytes = PG_ARGISNULL(0) ? AllocateBsonObjectAggState() :
+				   (bytea *) PG_GETARG_POINTER(0);
+	BsonObjectAggState *leftState = (BsonObjectAggState *) VARDATA(bytes);
+
+	CheckAggregateIntermediateResultSize(leftState->currentSizeWritten +
+										 rightState->currentSizeWritten);
+
+	/* Written in the aggregate context, as the tree references its values */
+	pgbson *rightValue = WriteMergeObjectsTree(rightState);
+	CreateObjectAggTreeNodes(leftState, rightValue);
+	leftState->currentSizeWritten += rightState->currentSizeWritten;
+
+	MemoryContextSwitchTo(oldContext);
+	PG_RETURN_POINTER(bytes);
+}
+
+
 /*
  * Applies the "state transition" (SFUNC) for sum and average.
  * This counts the sum of the values encountered as well as the count
@@ -1125,6 +1348,98 @@ bson_max_combine(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * Applies the moving "state transition" (MSFUNC) for the $min window
+ * operator on windows whose start moves.
+ */
+Datum
+bson_min_window_transition(PG_FUNCTION_ARGS)
+{
+	bool isMax = false;
+	return BsonMinMaxWindowTransitionCore(fcinfo, isMax);
+}
+
+
+/*
+ * Applies the moving "state transition" (MSFUNC) for the $max window
+ * operator on windows whose start moves.
+ */
+Datum
+bson_max_window_transition(PG_FUNCTION_ARGS)
+{
+	bool isMax = true;
+	return BsonMinMaxWindowTransitionCore(fcinfo, isMax);
+}
+
+
+/*
+ * Applies the "inverse state transition" (MINVFUNC) for the $min and $max
+ * window operators: the first row of the window leaves it. Rows leave in the
+ * order they were added, so the row is the one at position removedCount,
+ * and its value is the first entry if it's still a candidate.
+ */
+Datum
+bson_min_max_window_invtransition(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggregateContext;
+	if (AggCheckCallContext(fcinfo, &aggregateContext) != AGG_CONTEXT_WINDOW)
+	{
+		ereport(ERROR, errmsg(
+					"window aggregate function called in non-window-aggregate context"));
+	}
+
+	if (PG_ARGISNULL(0))
+	{
+		/* Returning NULL is an indiacation that inverse can't be applied and the aggregation needs to be redone */
+		PG_RETURN_NULL();
+	}
+
+	bytea *bytes = PG_GETARG_BYTEA_P(0);
+	BsonMinMaxWindowAggState *currentState =
+		(BsonMinMaxWindowAggState *) VARDATA_ANY(bytes);
+
+	int64_t removedPosition = currentState->removedCount++;
+	if (currentState->count > 0 &&
+		currentState->entries[currentState->start].position == removedPosition)
+	{
+		pfree(currentState->entries[currentState->start].value);
+		currentState->start = (currentState->start + 1) % currentState->capacity;
+		currentState->count--;
+	}
+
+	PG_RETURN_POINTER(bytes);
+}
+
+
+/*
+ * Applies the moving "final calculation" (MFINALFUNC) for the $min and $max
+ * window operators: the first entry, or null for an empty window like
+ * bson_min_max_final.
+ */
+Datum
+bson_min_max_window_final(PG_FUNCTION_ARGS)
+{
+	bytea *bytes = PG_ARGISNULL(0) ? NULL : PG_GETARG_BYTEA_P(0);
+	if (bytes != NULL)
+	{
+		BsonMinMaxWindowAggState *state =
+			(BsonMinMaxWindowAggState *) VARDATA_ANY(bytes);
+		if (state->count > 0)
+		{
+			PG_RETURN_POINTER(state->entries[state->start].value);
+		}
+	}
+
+	/* Mongo returns $null for empty sets */
+	pgbsonelement finalValue;
+	finalValue.path = "";
+	finalValue.pathLength = 0;
+	finalValue.bsonValue.value_type = BSON_TYPE_NULL;
+
+	PG_RETURN_POINTER(PgbsonElementToPgbson(&finalValue));
+}
+
+
 /*
  * Builds the final distinct response to be sent to the client.
  * Formats the response as
@@ -1191,15 +1506,8 @@ bson_add_to_set_transition(PG_FUNCTION_ARGS)
 	/* If the intermediate state has never been initialized, create it */
 	if (PG_ARGISNULL(0)) /* First arg is the running aggregated state*/
 	{
-		int bson_size = sizeof(BsonAddToSetState) + VARHDRSZ;
-		bytea *combinedStateBytes = (bytea *) palloc0(bson_size);
-		SET_VARSIZE(combinedStateBytes, bson_size);
-		bytes = combinedStateBytes;
-
+		bytes = AllocateBsonAddToSetState(isWindowAggregation);
 		currentState = (BsonAddToSetState *) VARDATA(bytes);
-		currentState->currentSizeWritten = 0;
-		currentState->set = CreateBsonValueHashSet();
-		currentState->isWindowAggregation = isWindowAggregation;
 	}
 	else
 	{
@@ -1315,6 +1623,109 @@ bson_add_to_set_final(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * The serialfunc of the BSON_GROUP_ADD_TO_SET aggregate, which has the state of
+ * bson_add_to_set in an internal state so that it can be partially aggregated.
+ * The state is serialized as an array of the values in the set.
+ */
+Datum
+bson_add_to_set_serialize(PG_FUNCTION_ARGS)
+{
+	bytea *bytes = (bytea *) PG_GETARG_POINTER(0);
+	BsonAddToSetState *state = (BsonAddToSetState *) VARDATA(bytes);
+
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+
+	pgbson_array_writer arrayWriter;
+	PgbsonWriterStartArray(&writer, "", 0, &arrayWriter);
+
+	HASH_SEQ_STATUS seq_status;
+	const bson_value_t *entry;
+	hash_seq_init(&seq_status, state->set);
+	while ((entry = hash_seq_search(&seq_status)) != NULL)
+	{
+		PgbsonArrayWriterWriteValue(&arrayWriter, entry);
+	}
+
+	PgbsonWriterEndArray(&writer, &arrayWriter);
+
+	PG_RETURN_BYTEA_P(SerializeAggregateStateBson(state->currentSizeWritten,
+												  PgbsonWriterGetPgbson(&writer)));
+}
+
+
+/*
+ * The deserialfunc of the BSON_GROUP_ADD_TO_SET aggregate.
+ */
+Datum
+bson_add_to_set_deserialize(PG_FUNCTION_ARGS)
+{
+	int64_t currentSizeWritten = 0;
+	pgbson *stateBson = DeserializeAggregateStateBson(PG_GETARG_BYTEA_P(0),
+													  &currentSizeWritten);
+
+	/* The set references the values of the array, so it's copied */
+	pgbsonelement arrayElement;
+	PgbsonToSinglePgbsonElement(PgbsonCloneFromPgbson(stateBson), &arrayElement);
+
+	bool isWindowAggregation = false;
+	bytea *bytes = AllocateBsonAddToSetState(isWindowAggregation);
+	BsonAddToSetState *state = (BsonAddToSetState *) VARDATA(bytes);
+
+	bson_iter_t arrayIter;
+	BsonValueInitIterator(&arrayElement.bsonValue, &arrayIter);
+	while (bson_iter_next(&arrayIter))
+	{
+		bool found = false;
+		hash_search(state->set, bson_iter_value(&arrayIter), HASH_ENTER, &found);
+	}
+
+	state->currentSizeWritten = currentSizeWritten;
+	PG_RETURN_POINTER(bytes);
+}
+
+
+/*
+ * The combinefunc of the BSON_GROUP_ADD_TO_SET aggregate: adds the values of
+ * the right set to the left set.
+ */
+Datum
+bson_add_to_set_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggregateContext;
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, errmsg("aggregate function called in non-aggregate context"));
+	}
+
+	if (PG_ARGISNULL(1))
+	{
+		if (PG_ARGISNULL(0))
+		{
+			PG_RETURN_NULL();
+		}
+
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	BsonAddToSetState *rightState =
+		(BsonAddToSetState *) VARDATA(PG_GETARG_POINTER(1));
+
+	MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+	/* The right state may be a deserialized one, so it's copied into a new state */
+	bool isWindowAggregation = false;
+	bytea *bytes = PG_ARGISNULL(0) ? AllocateBsonAddToSetState(isWindowAggregation) :
+				   (bytea *) PG_GETARG_POINTER(0);
+
+	CombineBsonAddToSetState((BsonAddToSetState *) VARDATA(bytes), rightState);
+
+	MemoryContextSwitchTo(oldContext);
+	PG_RETURN_POINTER(bytes);
+}
+
+
 /* --------------------------------------------------------- */
 /* Private helper methods */
 /* --------------------------------------------------------- */
@@ -1330,6 +1741,171 @@ AllocateBsonNumericAggState()
 }
 
 
+/*
+ * Allocates the state of bson_array_agg in the current memory context.
+ */
+static bytea *
+AllocateBsonArrayAggState(bool isWindowAggregation, const char *path)
+{
+	int bson_size = sizeof(BsonArrayAggState) + VARHDRSZ;
+	bytea *combinedStateBytes = (bytea *) palloc0(bson_size);
+	SET_VARSIZE(combinedStateBytes, bson_size);
+
+	BsonArrayAggState *currentState = (BsonArrayAggState *) VARDATA(combinedStateBytes);
+	currentState->isWindowAggregation = isWindowAggregation;
+	currentState->currentSizeWritten = 0;
+
+	if (isWindowAggregation)
+	{
+		currentState->aggState.window.aggregateList = NIL;
+	}
+	else
+	{
+		currentState->aggState.group.path = pstrdup(path);
+		PgbsonWriterInit(&currentState->aggState.group.writer);
+		PgbsonWriterStartArray(&currentState->aggState.group.writer, path, strlen(
+								   path),
+							   &currentState->aggState.group.arrayWriter);
+	}
+
+	return combinedStateBytes;
+}
+
+
+/*
+ * Allocates the state of bson_object_agg in the current memory context.
+ */
+static bytea *
+AllocateBsonObjectAggState(void)
+{
+	int bson_size = sizeof(BsonObjectAggState) + sizeof(int64_t) + VARHDRSZ;
+	bytea *combinedStateBytes = (bytea *) palloc0(bson_size);
+	SET_VARSIZE(combinedStateBytes, bson_size);
+
+	BsonObjectAggState *currentState = (BsonObjectAggState *) VARDATA(
+		combinedStateBytes);
+	currentState->currentSizeWritten = 0;
+	currentState->tree = MakeRootNode();
+	currentState->addEmptyPath = false;
+
+	return combinedStateBytes;
+}
+
+
+/*
+ * Allocates the state of bson_add_to_set in the current memory context.
+ */
+static bytea *
+AllocateBsonAddToSetState(bool isWindowAggregation)
+{
+	int bson_size = sizeof(BsonAddToSetState) + VARHDRSZ;
+	bytea *combinedStateBytes = (bytea *) palloc0(bson_size);
+	SET_VARSIZE(combinedStateBytes, bson_size);
+
+	BsonAddToSetState *currentState = (BsonAddToSetState *) VARDATA(
+		combinedStateBytes);
+	currentState->currentSizeWritten = 0;
+	currentState->set = CreateBsonValueHashSet();
+	currentState->isWindowAggregation = isWindowAggregation;
+
+	return combinedStateBytes;
+}
+
+
+/*
+ * Serializes the state of an aggregate whose values are kept in a bson.
+ * Resulting bytes look like:
+ * | Varlena Header | currentSizeWritten | stateBson |
+ */
+static bytea *
+SerializeAggregateStateBson(int64_t currentSizeWritten, pgbson *stateBson)
+{
+	int requiredByteSize = VARHDRSZ + sizeof(int64_t) + VARSIZE(stateBson);
+	bytea *bytes = (bytea *) palloc(requiredByteSize);
+	SET_VARSIZE(bytes, requiredByteSize);
+
+	char *byteAllocationPointer = VARDATA(bytes);
+	*((int64_t *) byteAllocationPointer) = currentSizeWritten;
+	byteAllocationPointer += sizeof(int64_t);
+	memcpy(byteAllocationPointer, stateBson, VARSIZE(stateBson));
+
+	return bytes;
+}
+
+
+/*
+ * Returns the bson of a state serialized by SerializeAggregateStateBson, which
+ * points into the given bytes.
+ */
+static pgbson *
+DeserializeAggregateStateBson(bytea *bytes, int64_t *currentSizeWritten)
+{
+	char *bytePointer = VARDATA(bytes);
+	*currentSizeWritten = *((int64_t *) bytePointer);
+	bytePointer += sizeof(int64_t);
+
+	return (pgbson *) bytePointer;
+}
+
+
+/*
+ * Appends the values of the array of the right bson_array_agg state to the
+ * array of the left one.
+ */
+static void
+CombineBsonArrayAggState(BsonArrayAggState *leftState, BsonArrayAggState *rightState)
+{
+	CheckAggregateIntermediateResultSize(leftState->currentSizeWritten +
+										 rightState->currentSizeWritten);
+
+	bson_value_t rightArray = PgbsonArrayWriterGetValue(
+		&rightState->aggState.group.arrayWriter);
+
+	bson_iter_t arrayIter;
+	BsonValueInitIterator(&rightArray, &arrayIter);
+	while (bson_iter_next(&arrayIter))
+	{
+		PgbsonArrayWriterWriteValue(&leftState->aggState.group.arrayWriter,
+									bson_iter_value(&arrayIter));
+	}
+
+	leftState->currentSizeWritten += rightState->currentSizeWritten;
+}
+
+
+/*
+ * Adds the values of the right bson_add_to_set state that aren't in the left
+ * one to the left one. The values are copied into the current memory context,
+ * as the set references them.
+ */
+static void
+CombineBsonAddToSetState(BsonAddToSetState *leftState, BsonAddToSetState *rightState)
+{
+	HASH_SEQ_STATUS seq_status;
+	const bson_value_t *entry;
+	hash_seq_init(&seq_status, rightState->set);
+	while ((entry = hash_seq_search(&seq_status)) != NULL)
+	{
+		bool found = false;
+		hash_search(leftState->set, entry, HASH_FIND, &found);
+		if (found)
+		{
+			continue;
+		}
+
+		/* Stored as { "": value } like the values added by the transition */
+		pgbson *value = BsonValueToDocumentPgbson(entry);
+		CheckAggregateIntermediateResultSize(leftState->currentSizeWritten +
+											 PgbsonGetBsonSize(value));
+
+		pgbsonelement singleBsonElement;
+		PgbsonToSinglePgbsonElement(value, &singleBsonElement);
+		hash_search(leftState->set, &singleBsonElement.bsonValue, HASH_ENTER, &found);
+		leftState->currentSizeWritten += PgbsonGetBsonSize(value);
+	}
+}
+
+
 void
 CheckAggregateIntermediateResultSize(uint32_t size)
 {
@@ -1440,27 +2016,7 @@ ParseAndReturnMergeObjectsTree(BsonObjectAggState *state)
 {
 	if (state != NULL)
 	{
-		pgbson_writer writer;
-		PgbsonWriterInit(&writer);
-
-		/*
-		 * If we removed the original empty path, then we need to include it
-		 * again for bson_repath_and_build.
-		 */
-		if (state->addEmptyPath)
-		{
-			pgbson_writer childWriter;
-			PgbsonWriterStartDocument(&writer, "", 0, &childWriter);
-			TraverseTreeAndWrite(state->tree, &childWriter, NULL);
-			PgbsonWriterEndDocument(&writer, &childWriter);
-		}
-		else
-		{
-			TraverseTreeAndWrite(state->tree, &writer, NULL);
-		}
-
-
-		pgbson *result = PgbsonWriterGetPgbson(&writer);
+		pgbson *result = WriteMergeObjectsTree(state);
 		FreeTree(state->tree);
 
 		PG_RETURN_POINTER(result);
@@ -1472,6 +2028,35 @@ ParseAndReturnMergeObjectsTree(BsonObjectAggState *state)
 }
 
 
+/*
+ * Writes the document merged by a mergeObjects tree.
+ */
+static pgbson *
+WriteMergeObjectsTree(BsonObjectAggState *state)
+{
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+
+	/*
+	 * If we removed the original empty path, then we need to include it
+	 * again for bson_repath_and_build.
+	 */
+	if (state->addEmptyPath)
+	{
+		pgbson_writer childWriter;
+		PgbsonWriterStartDocument(&writer, "", 0, &childWriter);
+		TraverseTreeAndWrite(state->tree, &childWriter, NULL);
+		PgbsonWriterEndDocument(&writer, &childWriter);
+	}
+	else
+	{
+		TraverseTreeAndWrite(state->tree, &writer, NULL);
+	}
+
+	return PgbsonWriterGetPgbson(&writer);
+}
+
+
 /*
  * Comparator function for heap utils. For MaxN, we need to build min-heap
  */
@@ -1884,3 +2469,93 @@ bson_maxminn_combine(PG_FUNCTION_ARGS)
 										  bytesRight);
 	PG_RETURN_POINTER(bytesRight);
 }
+
+
+/*
+ * Core implementation of the moving state transition of $min and $max:
+ * adds the value of the row entering the window to the monotonic deque
+ * of BsonMinMaxWindowAggState. Null values are never the result, but
+ * still take a position so that the inverse transition can match rows.
+ */
+static Datum
+BsonMinMaxWindowTransitionCore(PG_FUNCTION_ARGS, bool isMax)
+{
+	MemoryContext aggregateContext;
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, errmsg("aggregate function called in non-aggregate context"));
+	}
+
+	/* Only the copy of the value kept in the state goes in the aggregate context */
+	pgbson *currentValue = PG_GETARG_MAYBE_NULL_PGBSON(1);
+	MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+	bytea *bytes;
+	BsonMinMaxWindowAggState *currentState;
+	if (PG_ARGISNULL(0))
+	{
+		int stateSize = sizeof(BsonMinMaxWindowAggState) + VARHDRSZ;
+		bytes = (bytea *) palloc0(stateSize);
+		SET_VARSIZE(bytes, stateSize);
+
+		currentState = (BsonMinMaxWindowAggState *) VARDATA(bytes);
+		currentState->capacity = 8;
+		currentState->entries = palloc(sizeof(BsonMinMaxWindowEntry) *
+									   currentState->capacity);
+	}
+	else
+	{
+		bytes = PG_GETARG_BYTEA_P(0);
+		currentState = (BsonMinMaxWindowAggState *) VARDATA_ANY(bytes);
+	}
+
+	int64_t position = currentState->addedCount++;
+	if (currentValue == NULL)
+	{
+		MemoryContextSwitchTo(oldContext);
+		PG_RETURN_POINTER(bytes);
+	}
+
+	/* Drop the values at the end that the current value replaces as the min/max */
+	while (currentState->count > 0)
+	{
+		int32_t last = (currentState->start + currentState->count - 1) %
+					   currentState->capacity;
+		int32_t compResult = ComparePgbson(currentState->entries[last].value,
+										   currentValue);
+		if (isMax ? compResult > 0 : compResult < 0)
+		{
+			break;
+		}
+
+		pfree(currentState->entries[last].value);
+		currentState->count--;
+	}
+
+	if (currentState->count == currentState->capacity)
+	{
+		/* Grow the ring buffer, unwrapping its entries to the start */
+		int32_t newCapacity = currentState->capacity * 2;
+		BsonMinMaxWindowEntry *newEntries = palloc(sizeof(BsonMinMaxWindowEntry) *
+												   newCapacity);
+		for (int32_t i = 0; i < currentState->count; i++)
+		{
+			newEntries[i] = currentState->entries[(currentState->start + i) %
+												  currentState->capacity];
+		}
+
+		pfree(currentState->entries);
+		currentState->entries = newEntries;
+		currentState->capacity = newCapacity;
+		currentState->start = 0;
+	}
+
+	int32_t next = (currentState->start + currentState->count) %
+				   currentState->capacity;
+	currentState->entries[next].value = PgbsonCloneFromPgbson(currentValue);
+	currentState->entries[next].position = position;
+	currentState->count++;
+
+	MemoryContextSwitchTo(oldContext);
+	PG_RETURN_POINTER(bytes);
+}
@@ -38,13 +38,16 @@
 #include <utils/builtins.h>
 #include <utils/lsyscache.h>
 #include <utils/numeric.h>
+#include <utils/typcache.h>
 #include <utils/lsyscache.h>
 #include <utils/fmgroids.h>
+#include <utils/syscache.h>
 #include <nodes/supportnodes.h>
 #include <parser/parse_relation.h>
 #include <parser/parse_func.h>
 
 #include "io/bson_core.h"
+#include "io/bson_hash.h"
 #include "metadata/metadata_cache.h"
 #include "query/query_operator.h"
 #include "planner/documentdb_planner.h"
@@ -77,6 +80,8 @@ extern bool DefaultInlineWriteOperations;
 extern bool EnableSortbyIdPushDownToPrimaryKey;
 extern int MaxAggregationStagesAllowed;
 extern bool EnableIndexOrderbyPushdown;
+extern bool EnableFusedGroupAccumulators;
+extern bool EnableCombinableGroupAccumulators;
 
 /* GUC to config tdigest compression */
 extern int TdigestCompressionAccuracy;
@@ -863,6 +868,7 @@ PG_FUNCTION_INFO_V1(command_bson_aggregation_pipeline);
 PG_FUNCTION_INFO_V1(command_api_collection);
 PG_FUNCTION_INFO_V1(command_aggregation_support);
 PG_FUNCTION_INFO_V1(documentdb_core_bson_to_bson);
+PG_FUNCTION_INFO_V1(bson_group_collation_key);
 
 
 inline static void
@@ -990,6 +996,31 @@ documentdb_core_bson_to_bson(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * Returns the key of the _id of a $group with a collation: the comparable
+ * encoding of the _id with the strings in it encoded as their ICU sort
+ * key. The sort keys are computed once per row, and grouping compares and
+ * hashes the bytes of the keys.
+ */
+Datum
+bson_group_collation_key(PG_FUNCTION_ARGS)
+{
+	pgbson *groupId = PG_GETARG_PGBSON_PACKED(0);
+	char *collationString = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+	StringInfoData key;
+	initStringInfo(&key);
+	appendStringInfoSpaces(&key, VARHDRSZ);
+
+	bson_value_t groupIdValue = ConvertPgbsonToBsonValue(groupId);
+	AppendBsonValueComparableEncodingWithCollation(&key, &groupIdValue,
+												   collationString);
+
+	SET_VARSIZE(key.data, key.len);
+	PG_RETURN_BYTEA_P((bytea *) key.data);
+}
+
+
 /*
  * Common utility function for parsing a batchSize argument for find/aggregate/getMore
  */
@@ -5558,6 +5589,192 @@ AddPercentileMedianGroupAccumulator(Query *query, const bson_value_t *accumulato
 }
 
 
+/*
+ * Adds a single BSON_GROUP_ACCUMULATORS aggregate for the accumulators of
+ * the $group when they are all $sum, $avg, $min, $max or $count. The
+ * aggregate evaluates the accumulators together over each document and
+ * builds the output of the group, _id included: its argument is the same
+ * expression as the grouping so the planner evaluates it once.
+ * Returns the Var of the aggregate for the outer query, or NULL if the
+ * accumulators can't be fused and need to be added individually.
+ */
+static Var *
+TryAddFusedGroupAccumulators(const bson_value_t *groupSpec, Query *query,
+							 Expr *groupExpr, Expr *documentExpr,
+							 ParseState *parseState, char *identifiers)
+{
+	pgbson_writer specWriter;
+	PgbsonWriterInit(&specWriter);
+
+	int numAccumulators = 0;
+	bson_iter_t groupIter;
+	BsonValueInitIterator(groupSpec, &groupIter);
+	while (bson_iter_next(&groupIter))
+	{
+		StringView keyView = bson_iter_key_string_view(&groupIter);
+		if (StringViewEquals(&keyView, &IdFieldStringView))
+		{
+			continue;
+		}
+
+		/* Invalid accumulators are left to the regular path for their errors */
+		bson_iter_t accumulatorIterator;
+		pgbsonelement accumulatorElement;
+		if (StringViewContains(&keyView, '.') ||
+			!BSON_ITER_HOLDS_DOCUMENT(&groupIter) ||
+			!bson_iter_recurse(&groupIter, &accumulatorIterator) ||
+			!TryGetSinglePgbsonElementFromBsonIterator(&accumulatorIterator,
+													   &accumulatorElement))
+		{
+			return NULL;
+		}
+
+		StringView accumulatorName = {
+			.length = accumulatorElement.pathLength, .string = accumulatorElement.path
+		};
+
+		if (StringViewEqualsCString(&accumulatorName, "$count"))
+		{
+			accumulatorName.string = "$sum";
+			accumulatorName.length = 4;
+			accumulatorElement.bsonValue.value_type = BSON_TYPE_INT32;
+			accumulatorElement.bsonValue.value.v_int32 = 1;
+		}
+		else if (!StringViewEqualsCString(&accumulatorName, "$sum") &&
+				 !StringViewEqualsCString(&accumulatorName, "$avg") &&
+				 !StringViewEqualsCString(&accumulatorName, "$min") &&
+				 !StringViewEqualsCString(&accumulatorName, "$max"))
+		{
+			return NULL;
+		}
+
+		/* Parse the expression now, invalid expressions fail at planning as they do unfused */
+		ParseAggregationExpressionContext parseContext = { 0 };
+		AggregationExpressionData expressionData;
+		memset(&expressionData, 0, sizeof(AggregationExpressionData));
+		ParseAggregationExpressionData(&expressionData, &accumulatorElement.bsonValue,
+									   &parseContext);
+
+		pgbson_writer accumulatorWriter;
+		PgbsonWriterStartDocument(&specWriter, keyView.string, keyView.length,
+								  &accumulatorWriter);
+		PgbsonWriterAppendValue(&accumulatorWriter, accumulatorName.string,
+								accumulatorName.length, &accumulatorElement.bsonValue);
+		PgbsonWriterEndDocument(&specWriter, &accumulatorWriter);
+		numAccumulators++;
+	}
+
+	if (numAccumulators == 0)
+	{
+		return NULL;
+	}
+
+	Const *specConst = MakeBsonConst(PgbsonWriterGetPgbson(&specWriter));
+	Aggref *aggref = CreateMultiArgAggregate(BsonGroupAccumulatorsAggregateFunctionOid(),
+											 list_make3(copyObject(groupExpr),
+														documentExpr, specConst),
+											 list_make3_oid(BsonTypeId(), BsonTypeId(),
+															BsonTypeId()),
+											 parseState);
+	return AddGroupExpression((Expr *) aggref, parseState, identifiers, query,
+							  BsonTypeId(), NULL);
+}
+
+
+/*
+ * Whether the output of the query is in a defined order: whether it, or any
+ * of the queries it reads from up to the last $group, has an ORDER BY. The
+ * order of the documents of a $group isn't defined, so an earlier sort
+ * doesn't make it past it.
+ */
+static bool
+QueryHasOrderedOutput(Query *query)
+{
+	if (query->sortClause != NIL)
+	{
+		return true;
+	}
+
+	if (query->groupClause != NIL || query->hasAggs)
+	{
+		return false;
+	}
+
+	ListCell *cell;
+	foreach(cell, query->rtable)
+	{
+		RangeTblEntry *rte = (RangeTblEntry *) lfirst(cell);
+		if (rte->rtekind == RTE_SUBQUERY && QueryHasOrderedOutput(rte->subquery))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * Logs whether the aggregates of the $group query can all be partially
+ * aggregated, i.e. computed by parallel workers or on the shards of a
+ * distributed collection and combined after: they need a combine function,
+ * and serialization functions if their state is internal. Otherwise the
+ * documents of the group are all brought to a single node to aggregate them.
+ */
+static void
+ReportGroupPartialAggregation(Query *query)
+{
+	if (!message_level_is_interesting(DEBUG1))
+	{
+		return;
+	}
+
+	List *aggregates = pull_var_clause((Node *) query->targetList,
+									   PVC_INCLUDE_AGGREGATES);
+	ListCell *cell;
+	foreach(cell, aggregates)
+	{
+		if (!IsA(lfirst(cell), Aggref))
+		{
+			continue;
+		}
+
+		Aggref *aggref = (Aggref *) lfirst(cell);
+		HeapTuple aggTuple = SearchSysCache1(AGGFNOID,
+											 ObjectIdGetDatum(aggref->aggfnoid));
+		if (!HeapTupleIsValid(aggTuple))
+		{
+			elog(ERROR, "cache lookup failed for aggregate %u", aggref->aggfnoid);
+		}
+
+		Form_pg_aggregate aggForm = (Form_pg_aggregate) GETSTRUCT(aggTuple);
+		bool hasCombineFunction = OidIsValid(aggForm->aggcombinefn);
+		bool hasSerializationFunctions = aggForm->aggtranstype != INTERNALOID ||
+										 (OidIsValid(aggForm->aggserialfn) &&
+										  OidIsValid(aggForm->aggdeserialfn));
+		ReleaseSysCache(aggTuple);
+
+		if (!hasCombineFunction)
+		{
+			ereport(DEBUG1, (errmsg(
+								 "$group cannot be partially aggregated: aggregate %s has no combine function",
+								 get_func_name(aggref->aggfnoid))));
+			return;
+		}
+
+		if (!hasSerializationFunctions)
+		{
+			ereport(DEBUG1, (errmsg(
+								 "$group cannot be partially aggregated: aggregate %s has no serialization functions",
+								 get_func_name(aggref->aggfnoid))));
+			return;
+		}
+	}
+
+	ereport(DEBUG1, (errmsg("$group can be partially aggregated")));
+}
+
+
 /*
  * Handles the $group stage.
  * Creates a subquery.
@@ -5576,7 +5793,9 @@ Query *
 HandleGroup(const bson_value_t *existingValue, Query *query,
 			AggregationPipelineBuildContext *context)
 {
-	if (IsCollationApplicable(context->collationString))
+	/* Grouping by the collation key needs bson_group_collation_key from 0.105 */
+	if (IsCollationApplicable(context->collationString) &&
+		!IsClusterVersionAtleast(DocDB_V0, 105, 0))
 	{
 		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 						errmsg("collation is not supported in $group stage yet.")));
@@ -5597,6 +5816,15 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 	/* Take the current output (That's to be grouped)*/
 	TargetEntry *origEntry = linitial(query->targetList);
 
+	/*
+	 * On unsorted input the order dependent accumulators can use the variants
+	 * whose partial aggregates can be combined in any order.
+	 */
+	bool useCombinableAccumulators = EnableCombinableGroupAccumulators &&
+									 context->sortSpec.value_type == BSON_TYPE_EOD &&
+									 IsClusterVersionAtleast(DocDB_V0, 105, 0) &&
+									 !QueryHasOrderedOutput(query);
+
 	/* Clear the group's output */
 	query->targetList = NIL;
 
@@ -5632,7 +5860,23 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 	Oid bsonExpressionGetFunction;
 	Expr *groupIdDocumentExpr = GetDocumentExprForGroupAccumulatorValue(&idValue,
 																		origEntry->expr);
-	if (context->variableSpec != NULL)
+	bool isCollationAware = IsCollationApplicable(context->collationString);
+	Const *collationConst = NULL;
+	if (isCollationAware)
+	{
+		collationConst = MakeTextConst(context->collationString,
+									   strlen(context->collationString));
+	}
+
+	if (isCollationAware && IsClusterVersionAtleast(DocDB_V0, 102, 0))
+	{
+		Expr *variableSpec = context->variableSpec != NULL ? context->variableSpec :
+							 (Expr *) MakeBsonConst(PgbsonInitEmpty());
+		bsonExpressionGetFunction = BsonExpressionGetWithLetAndCollationFunctionOid();
+		groupArgs = list_make5(groupIdDocumentExpr, MakeBsonConst(groupValue),
+							   MakeBoolValueConst(true), variableSpec, collationConst);
+	}
+	else if (context->variableSpec != NULL)
 	{
 		bsonExpressionGetFunction = BsonExpressionGetWithLetFunctionOid();
 		groupArgs = list_make4(groupIdDocumentExpr, MakeBsonConst(groupValue),
@@ -5674,14 +5918,45 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 	repathArgs = lappend(repathArgs, AddGroupExpression((Expr *) idFieldText, parseState,
 														identifiers, query, TEXTOID,
 														NULL));
-	repathArgs = lappend(repathArgs, AddGroupExpression((Expr *) groupFunc, parseState,
+
+	/*
+	 * With a collation, _ids that are equal under the collation (e.g. "a" and
+	 * "A" at strength 2) are one group. The group is keyed by the collation
+	 * key of its _id, and its _id is that of its first document.
+	 */
+	TargetEntry *groupKeyEntry = NULL;
+	Expr *groupIdExpr = (Expr *) groupFunc;
+	if (isCollationAware)
+	{
+		FuncExpr *groupKeyFunc = makeFuncExpr(
+			BsonGroupCollationKeyFunctionOid(), BYTEAOID,
+			list_make2(groupFunc, collationConst), InvalidOid,
+			InvalidOid, COERCE_EXPLICIT_CALL);
+		AddGroupExpression((Expr *) groupKeyFunc, parseState, identifiers, query,
+						   BYTEAOID, &groupKeyEntry);
+
+		parseState->p_expr_kind = EXPR_KIND_SELECT_TARGET;
+		groupIdExpr = (Expr *) CreateSingleArgAggregate(
+			BsonFirstOnSortedAggregateFunctionOid(), (Expr *) groupFunc, parseState);
+	}
+
+	repathArgs = lappend(repathArgs, AddGroupExpression(groupIdExpr, parseState,
 														identifiers, query, BsonTypeId(),
 														&groupEntry));
 
 	/* Now add accumulators */
 	parseState->p_expr_kind = EXPR_KIND_SELECT_TARGET;
+	Var *fusedAccumulatorsVar = NULL;
+	if (EnableFusedGroupAccumulators && context->variableSpec == NULL)
+	{
+		fusedAccumulatorsVar = TryAddFusedGroupAccumulators(existingValue, query,
+															 (Expr *) groupFunc,
+															 origEntry->expr,
+															 parseState, identifiers);
+	}
+
 	BsonValueInitIterator(existingValue, &groupIter);
-	while (bson_iter_next(&groupIter))
+	while (fusedAccumulatorsVar == NULL && bson_iter_next(&groupIter))
 	{
 		StringView keyView = bson_iter_key_string_view(&groupIter);
 		if (StringViewEquals(&keyView, &IdFieldStringView))
@@ -5777,13 +6052,16 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 		{
 			if (context->sortSpec.value_type == BSON_TYPE_EOD)
 			{
+				Oid aggregateOid = useCombinableAccumulators ?
+								   BsonGroupFirstAggregateFunctionOid() :
+								   BsonFirstOnSortedAggregateFunctionOid();
 				repathArgs = AddSimpleGroupAccumulator(query,
 													   &accumulatorElement.bsonValue,
 													   repathArgs,
 													   accumulatorText, parseState,
 													   identifiers,
 													   origEntry->expr,
-													   BsonFirstOnSortedAggregateFunctionOid(),
+													   aggregateOid,
 													   context->variableSpec);
 			}
 			else
@@ -5803,13 +6081,16 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 		{
 			if (context->sortSpec.value_type == BSON_TYPE_EOD)
 			{
+				Oid aggregateOid = useCombinableAccumulators ?
+								   BsonGroupLastAggregateFunctionOid() :
+								   BsonLastOnSortedAggregateFunctionOid();
 				repathArgs = AddSimpleGroupAccumulator(query,
 													   &accumulatorElement.bsonValue,
 													   repathArgs,
 													   accumulatorText, parseState,
 													   identifiers,
 													   origEntry->expr,
-													   BsonLastOnSortedAggregateFunctionOid(),
+													   aggregateOid,
 													   context->variableSpec);
 			}
 			else
@@ -5834,6 +6115,9 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 											&elementsToFetch, accumulatorName.string);
 			if (context->sortSpec.value_type == BSON_TYPE_EOD)
 			{
+				Oid aggregateOid = useCombinableAccumulators ?
+								   BsonGroupFirstNAggregateFunctionOid() :
+								   BsonFirstNOnSortedAggregateFunctionOid();
 				repathArgs = AddSimpleNGroupAccumulator(query,
 														&input,
 														&elementsToFetch,
@@ -5841,7 +6125,7 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 														accumulatorText, parseState,
 														identifiers,
 														origEntry->expr,
-														BsonFirstNOnSortedAggregateFunctionOid(),
+														aggregateOid,
 														&accumulatorName,
 														context->variableSpec);
 			}
@@ -5869,6 +6153,9 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 											&elementsToFetch, accumulatorName.string);
 			if (context->sortSpec.value_type == BSON_TYPE_EOD)
 			{
+				Oid aggregateOid = useCombinableAccumulators ?
+								   BsonGroupLastNAggregateFunctionOid() :
+								   BsonLastNOnSortedAggregateFunctionOid();
 				repathArgs = AddSimpleNGroupAccumulator(query,
 														&input,
 														&elementsToFetch,
@@ -5876,7 +6163,7 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 														accumulatorText, parseState,
 														identifiers,
 														origEntry->expr,
-														BsonLastNOnSortedAggregateFunctionOid(),
+														aggregateOid,
 														&accumulatorName,
 														context->variableSpec);
 			}
@@ -5921,26 +6208,32 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 		}
 		else if (StringViewEqualsCString(&accumulatorName, "$addToSet"))
 		{
+			Oid aggregateOid = useCombinableAccumulators ?
+							   BsonGroupAddToSetAggregateFunctionOid() :
+							   BsonAddToSetAggregateFunctionOid();
 			repathArgs = AddSimpleGroupAccumulator(query,
 												   &accumulatorElement.bsonValue,
 												   repathArgs,
 												   accumulatorText, parseState,
 												   identifiers,
 												   origEntry->expr,
-												   BsonAddToSetAggregateFunctionOid(),
+												   aggregateOid,
 												   context->variableSpec);
 		}
 		else if (StringViewEqualsCString(&accumulatorName, "$mergeObjects"))
 		{
 			if (context->sortSpec.value_type == BSON_TYPE_EOD)
 			{
+				Oid aggregateOid = useCombinableAccumulators ?
+								   BsonGroupMergeObjectsAggregateFunctionOid() :
+								   BsonMergeObjectsOnSortedFunctionOid();
 				repathArgs = AddSimpleGroupAccumulator(query,
 													   &accumulatorElement.bsonValue,
 													   repathArgs,
 													   accumulatorText, parseState,
 													   identifiers,
 													   origEntry->expr,
-													   BsonMergeObjectsOnSortedFunctionOid(),
+													   aggregateOid,
 													   context->variableSpec);
 			}
 			else
@@ -5961,13 +6254,16 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 		{
 			char *fieldPath = "";
 			bool handleSingleValue = true;
+			Oid aggregateOid = useCombinableAccumulators ?
+							   BsonGroupPushAggregateFunctionOid() :
+							   BsonArrayAggregateAllArgsFunctionOid();
 			repathArgs = AddArrayAggGroupAccumulator(query,
 													 &accumulatorElement.bsonValue,
 													 repathArgs,
 													 accumulatorText, parseState,
 													 identifiers,
 													 origEntry->expr,
-													 BsonArrayAggregateAllArgsFunctionOid(),
+													 aggregateOid,
 													 fieldPath,
 													 handleSingleValue,
 													 context->variableSpec);
@@ -6133,13 +6429,33 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 
 	/* Assign the _id clause as what we're grouping on */
 	SortGroupClause *grpcl = makeNode(SortGroupClause);
-	grpcl->tleSortGroupRef = assignSortGroupRef(groupEntry, query->targetList);
-	grpcl->eqop = BsonEqualOperatorId();
-	grpcl->sortop = BsonLessThanOperatorId();
+	if (groupKeyEntry != NULL)
+	{
+		TypeCacheEntry *keyTypeEntry = lookup_type_cache(BYTEAOID, TYPECACHE_EQ_OPR |
+														 TYPECACHE_LT_OPR);
+		grpcl->tleSortGroupRef = assignSortGroupRef(groupKeyEntry, query->targetList);
+		grpcl->eqop = keyTypeEntry->eq_opr;
+		grpcl->sortop = keyTypeEntry->lt_opr;
+
+		if (fusedAccumulatorsVar != NULL)
+		{
+			/* The fused aggregate outputs the _id of the group itself */
+			groupEntry->expr = (Expr *) makeNullConst(BsonTypeId(), -1, InvalidOid);
+		}
+	}
+	else
+	{
+		grpcl->tleSortGroupRef = assignSortGroupRef(groupEntry, query->targetList);
+		grpcl->eqop = BsonEqualOperatorId();
+		grpcl->sortop = BsonLessThanOperatorId();
+	}
+
 	grpcl->nulls_first = false; /* OK with or without sortop */
 	grpcl->hashable = true;
 	query->groupClause = list_make1(grpcl);
 
+	ReportGroupPartialAggregation(query);
+
 	/* Now that the group + accumulators are done, push to a subquery
 	 * Request preserving the N-entry T-list
 	 */
@@ -6149,12 +6465,19 @@ HandleGroup(const bson_value_t *existingValue, Query *query,
 	/* Take the output and replace it with the repath_and_build */
 	TargetEntry *entry = linitial(query->targetList);
 
-	/* $group doesn't allow dotted path so no need to override */
-	bool overrideArrayInProjection = false;
-	Expr *repathExpression = GenerateMultiExpressionRepathExpression(repathArgs,
-																	 overrideArrayInProjection);
+	if (fusedAccumulatorsVar != NULL)
+	{
+		/* The fused aggregate already builds the output document */
+		entry->expr = (Expr *) fusedAccumulatorsVar;
+	}
+	else
+	{
+		/* $group doesn't allow dotted path so no need to override */
+		bool overrideArrayInProjection = false;
+		entry->expr = GenerateMultiExpressionRepathExpression(repathArgs,
+															  overrideArrayInProjection);
+	}
 
-	entry->expr = repathExpression;
 	entry->resname = origEntry->resname;
 
 
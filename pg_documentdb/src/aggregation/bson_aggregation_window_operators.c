@@ -2975,10 +2975,9 @@ HandleDollarConstFillWindowOperator(const bson_value_t *opValue,
 
 /*
  * Handle the $min window operator. This uses the existing
- * `bsonmin` aggregate function.
- *
- * TODO: This is just a quick implementation. Later add inverse transition
- * to make it performant for moving windows
+ * `bsonmin` aggregate function, whose moving aggregate state keeps
+ * the candidates for the $min so that windows whose start moves aren't
+ * recomputed for every row.
  */
 static WindowFunc *
 HandleDollarMinWindowOperator(const bson_value_t *opValue,
@@ -2992,10 +2991,9 @@ HandleDollarMinWindowOperator(const bson_value_t *opValue,
 
 /*
  * Handle the $max window operator. This uses the existing
- * `bsonmax` aggregate function.
- *
- * TODO: This is just a quick implementation. Later add inverse transition
- * to make it performant for moving windows
+ * `bsonmax` aggregate function, whose moving aggregate state keeps
+ * the candidates for the $max so that windows whose start moves aren't
+ * recomputed for every row.
  */
 static WindowFunc *
 HandleDollarMaxWindowOperator(const bson_value_t *opValue,
@@ -15,6 +15,7 @@
 #include <windowapi.h>
 
 #include "aggregation/bson_project.h"
+#include "collation/collation.h"
 #include "commands/parse_error.h"
 #include "io/bson_core.h"
 #include "metadata/metadata_cache.h"
@@ -252,10 +253,10 @@ bson_dollar_bucket_auto(PG_FUNCTION_ARGS)
 	pgbson_writer innerWriter;
 	PgbsonWriterStartDocument(&writer, "bucket_id", 9, &innerWriter);
 	pgbsonelement lowerBoundElement;
-	PgbsonToSinglePgbsonElement(state->lower_bound, &lowerBoundElement);
+	PgbsonToSinglePgbsonElementWithCollation(state->lower_bound, &lowerBoundElement);
 	PgbsonWriterAppendValue(&innerWriter, "min", 3, &lowerBoundElement.bsonValue);
 	pgbsonelement upperBoundElement;
-	PgbsonToSinglePgbsonElement(state->upper_bound, &upperBoundElement);
+	PgbsonToSinglePgbsonElementWithCollation(state->upper_bound, &upperBoundElement);
 	PgbsonWriterAppendValue(&innerWriter, "max", 3, &upperBoundElement.bsonValue);
 	PgbsonWriterEndDocument(&writer, &innerWriter);
 	pgbson *result = PgbsonWriterGetPgbson(&writer);
@@ -425,7 +426,23 @@ BuildBucketAutoQuery(Query *query,
 
 	List *args;
 	Oid bsonExpressionGetFunction;
-	if (context->variableSpec != NULL)
+	bool isCollationAware = IsCollationApplicable(context->collationString);
+	if (isCollationAware)
+	{
+		/*
+		 * The value gets the collation appended, which orders the window with
+		 * the <<< operator and keeps values equal under the collation in one
+		 * bucket.
+		 */
+		Expr *variableSpec = context->variableSpec != NULL ? context->variableSpec :
+							 (Expr *) MakeBsonConst(PgbsonInitEmpty());
+		bsonExpressionGetFunction = BsonExpressionGetWithLetAndCollationFunctionOid();
+		args = list_make5(origEntry->expr, MakeBsonConst(groupByDoc),
+						  MakeBoolValueConst(true), variableSpec,
+						  MakeTextConst(context->collationString,
+										strlen(context->collationString)));
+	}
+	else if (context->variableSpec != NULL)
 	{
 		bsonExpressionGetFunction = BsonExpressionGetWithLetFunctionOid();
 		args = list_make4(origEntry->expr, MakeBsonConst(groupByDoc),
@@ -490,8 +507,18 @@ BuildBucketAutoQuery(Query *query,
 	List *orderByClauseList = NIL;
 	SortBy *sortBy = makeNode(SortBy);
 	sortBy->location = -1;
-	sortBy->sortby_dir = SORTBY_ASC;
 	sortBy->node = (Node *) getGroupbyFieldExpr;
+	if (isCollationAware)
+	{
+		sortBy->sortby_dir = SORTBY_USING;
+		sortBy->sortby_nulls = SORTBY_NULLS_FIRST;
+		sortBy->useOp = list_make2(makeString(ApiInternalSchemaNameV2),
+								   makeString("<<<"));
+	}
+	else
+	{
+		sortBy->sortby_dir = SORTBY_ASC;
+	}
 
 	TargetEntry *sortEntry = makeTargetEntry((Expr *) sortBy->node,
 											 parseState->p_next_resno++,
@@ -598,7 +625,7 @@ SetLowerBound(const pgbson *currentValue, const BucketAutoArguments *args,
 	if (args->granularity.length > 0)
 	{
 		pgbsonelement currentValueElement;
-		PgbsonToSinglePgbsonElement(currentValue, &currentValueElement);
+		PgbsonToSinglePgbsonElementWithCollation(currentValue, &currentValueElement);
 		double currentValueDouble = BsonValueAsDouble(&currentValueElement.bsonValue);
 		double lowerBound = 0;
 		bool findLarger = false;
@@ -638,6 +665,7 @@ SetLowerBound(const pgbson *currentValue, const BucketAutoArguments *args,
  * Without granularity:
  *  - The upper bound of the last bucket is the max value of it.
  *  - The upper bound of non-last bucket is the next value larger than the max value in currenct bucket, in other words, the min value in next bucket.
+ *    With a collation, the values carry it and are compared with it.
  */
 static void
 SetUpperBound(WindowObject winobj, const BucketAutoArguments *args,
@@ -664,7 +692,8 @@ SetUpperBound(WindowObject winobj, const BucketAutoArguments *args,
 	}
 	pgbson *maxOfBucket = DatumGetPgBson(maxOfBucketDatum);
 	pgbsonelement maxOfCurrBucketElement;
-	PgbsonToSinglePgbsonElement(maxOfBucket, &maxOfCurrBucketElement);
+	const char *collationString =
+		PgbsonToSinglePgbsonElementWithCollation(maxOfBucket, &maxOfCurrBucketElement);
 
 	/* Apply granularity. */
 	if (args->granularity.length > 0)
@@ -717,12 +746,12 @@ SetUpperBound(WindowObject winobj, const BucketAutoArguments *args,
 		}
 		pgbson *next = DatumGetPgBson(nextDatum);
 		pgbsonelement nextElement;
-		PgbsonToSinglePgbsonElement(next, &nextElement);
+		PgbsonToSinglePgbsonElementWithCollation(next, &nextElement);
 		bool isComparionValid;
 		if (args->granularity.length > 0)
 		{
 			pgbsonelement upperBoundElement;
-			PgbsonToSinglePgbsonElement(upperBound, &upperBoundElement);
+			PgbsonToSinglePgbsonElementWithCollation(upperBound, &upperBoundElement);
 			int compareWithBound = CompareBsonValueAndType(&upperBoundElement.bsonValue,
 														   &nextElement.bsonValue,
 														   &isComparionValid);
@@ -743,9 +772,9 @@ SetUpperBound(WindowObject winobj, const BucketAutoArguments *args,
 		}
 		else
 		{
-			int compareWithMax = CompareBsonValueAndType(
+			int compareWithMax = CompareBsonValueAndTypeWithCollation(
 				&maxOfCurrBucketElement.bsonValue, &nextElement.bsonValue,
-				&isComparionValid);
+				&isComparionValid, collationString);
 			if (compareWithMax > 0)
 			{
 				ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
@@ -823,7 +852,7 @@ static void
 ValidateValueIsNumberic(pgbson *value)
 {
 	pgbsonelement currentValueElement;
-	PgbsonToSinglePgbsonElement(value, &currentValueElement);
+	PgbsonToSinglePgbsonElementWithCollation(value, &currentValueElement);
 	bson_value_t current = currentValueElement.bsonValue;
 	if (!BsonValueIsNumber(&current))
 	{
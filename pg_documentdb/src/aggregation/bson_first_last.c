@@ -25,6 +25,8 @@ PG_FUNCTION_INFO_V1(bson_first_last_final);
 PG_FUNCTION_INFO_V1(bson_first_transition_on_sorted);
 PG_FUNCTION_INFO_V1(bson_last_transition_on_sorted);
 PG_FUNCTION_INFO_V1(bson_first_last_final_on_sorted);
+PG_FUNCTION_INFO_V1(bson_first_combine_on_sorted);
+PG_FUNCTION_INFO_V1(bson_last_combine_on_sorted);
 PG_FUNCTION_INFO_V1(bson_firstn_transition);
 PG_FUNCTION_INFO_V1(bson_lastn_transition);
 PG_FUNCTION_INFO_V1(bson_firstn_combine);
@@ -33,6 +35,8 @@ PG_FUNCTION_INFO_V1(bson_firstn_lastn_final);
 PG_FUNCTION_INFO_V1(bson_firstn_transition_on_sorted);
 PG_FUNCTION_INFO_V1(bson_lastn_transition_on_sorted);
 PG_FUNCTION_INFO_V1(bson_firstn_lastn_final_on_sorted);
+PG_FUNCTION_INFO_V1(bson_firstn_combine_on_sorted);
+PG_FUNCTION_INFO_V1(bson_lastn_combine_on_sorted);
 
 /*
  * Applies the "state transition" (SFUNC) for first.
@@ -108,6 +112,28 @@ bson_first_last_final_on_sorted(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * Applies the "combine" (COMBINEFUNC) for first on unsorted input.
+ */
+Datum
+bson_first_combine_on_sorted(PG_FUNCTION_ARGS)
+{
+	bool isLast = false;
+	return BsonOrderCombineOnSorted(fcinfo, isLast);
+}
+
+
+/*
+ * Applies the "combine" (COMBINEFUNC) for last on unsorted input.
+ */
+Datum
+bson_last_combine_on_sorted(PG_FUNCTION_ARGS)
+{
+	bool isLast = true;
+	return BsonOrderCombineOnSorted(fcinfo, isLast);
+}
+
+
 /*
  * Applies the "combine" (COMBINEFUNC) for first and last.
  */
@@ -204,6 +230,28 @@ bson_firstn_lastn_final_on_sorted(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * Applies the "combine" (COMBINEFUNC) for firstn on unsorted input.
+ */
+Datum
+bson_firstn_combine_on_sorted(PG_FUNCTION_ARGS)
+{
+	bool isLast = false;
+	return BsonOrderCombineOnSorted(fcinfo, isLast);
+}
+
+
+/*
+ * Applies the "combine" (COMBINEFUNC) for lastn on unsorted input.
+ */
+Datum
+bson_lastn_combine_on_sorted(PG_FUNCTION_ARGS)
+{
+	bool isLast = true;
+	return BsonOrderCombineOnSorted(fcinfo, isLast);
+}
+
+
 /*
  * Applies the "combine" (COMBINEFUNC) for firstn.
  */
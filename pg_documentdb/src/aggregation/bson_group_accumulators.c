@@ -0,0 +1,915 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/aggregation/bson_group_accumulators.c
+ *
+ * Implementation of the fused accumulators of $group.
+ *
+ * $group emits one aggregate per accumulator, each evaluating its own
+ * expression over the input document. For the $sum, $avg, $min, $max and
+ * $count accumulators, bson_group_accumulators instead evaluates all the
+ * accumulator expressions of a document at once and keeps the state of
+ * every accumulator of a group in one struct:
+ *   - The accumulators of top level field paths ($a) are resolved in a
+ *     single pass over the fields of the document, accumulators of the
+ *     same field sharing the lookup.
+ *   - The other expressions are evaluated into a single writer.
+ * The final function builds the output document of the group, _id first.
+ * The group scan (custom_group_scan.c) keeps the same accumulator states,
+ * inline in its hash table.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <nodes/primnodes.h>
+#include <utils/builtins.h>
+
+#include "io/bson_core.h"
+#include "query/bson_compare.h"
+#include "operators/bson_expression.h"
+#include "aggregation/bson_group_accumulators.h"
+#include "utils/documentdb_errors.h"
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+/* The argument position of the accumulators spec in the transition function */
+#define GROUP_ACCUMULATORS_SPEC_ARG 3
+
+/*
+ * The transition state of bson_group_accumulators for a group.
+ */
+typedef struct BsonGroupAccumulatorsState
+{
+	/* The _id of the group, NULL if it was a SQL NULL */
+	pgbson *groupId;
+
+	int numAccumulators;
+
+	const GroupAccumulatorOutput *outputs;
+
+	GroupAccumulatorValue values[FLEXIBLE_ARRAY_MEMBER];
+} BsonGroupAccumulatorsState;
+
+/* --------------------------------------------------------- */
+/* Forward declaration */
+/* --------------------------------------------------------- */
+
+static GroupAccumulatorsSpec * GetGroupAccumulatorsSpec(PG_FUNCTION_ARGS,
+														pgbson *specBson,
+														bool *isSpecCached);
+static BsonGroupAccumulatorsState * CreateGroupAccumulatorsState(int numAccumulators,
+																 const
+																 GroupAccumulatorOutput *
+																 outputs,
+																 bool copyOutputs);
+static BsonGroupAccumulatorsState * CopyGroupAccumulatorsState(
+	const BsonGroupAccumulatorsState *source);
+static void SetGroupAccumulatorValue(GroupAccumulatorValue *accumulator,
+									 const bson_value_t *value);
+static int CompareGroupAccumulatorValues(const bson_value_t *left,
+										 const bson_value_t *right);
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+PG_FUNCTION_INFO_V1(bson_group_accumulators_transition);
+PG_FUNCTION_INFO_V1(bson_group_accumulators_final);
+PG_FUNCTION_INFO_V1(bson_group_accumulators_combine);
+PG_FUNCTION_INFO_V1(bson_group_accumulators_serialize);
+PG_FUNCTION_INFO_V1(bson_group_accumulators_deserialize);
+
+
+/*
+ * Applies the "state transition" (SFUNC) for bson_group_accumulators.
+ * Takes the _id of the group, the document and the accumulators spec, and
+ * adds the values of all the accumulator expressions for the document to
+ * their states. The values are the same as bson_expression_get would
+ * return for each expression.
+ */
+Datum
+bson_group_accumulators_transition(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggregateContext;
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, errmsg("aggregate function called in non-aggregate context"));
+	}
+
+	bool isSpecCached = false;
+	GroupAccumulatorsSpec *spec = GetGroupAccumulatorsSpec(
+		fcinfo, PG_GETARG_PGBSON(GROUP_ACCUMULATORS_SPEC_ARG), &isSpecCached);
+
+	BsonGroupAccumulatorsState *state;
+	if (PG_ARGISNULL(0))
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+
+		/* When the spec isn't cached it doesn't outlive this call */
+		bool copyOutputs = !isSpecCached;
+		state = CreateGroupAccumulatorsState(spec->numAccumulators, spec->outputs,
+											 copyOutputs);
+
+		pgbson *groupId = PG_GETARG_MAYBE_NULL_PGBSON(1);
+		state->groupId = groupId != NULL ? PgbsonCloneFromPgbson(groupId) : NULL;
+
+		MemoryContextSwitchTo(oldContext);
+	}
+	else
+	{
+		state = (BsonGroupAccumulatorsState *) PG_GETARG_POINTER(0);
+	}
+
+	pgbson *document = PG_GETARG_MAYBE_NULL_PGBSON(2);
+	if (document == NULL)
+	{
+		/* bson_expression_get is strict, this is a NULL for every accumulator */
+		PG_RETURN_POINTER(state);
+	}
+
+	EvaluateGroupAccumulatorValues(spec, document);
+
+	MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+	for (int i = 0; i < state->numAccumulators; i++)
+	{
+		AccumulateGroupValue(state->outputs[i].kind, &state->values[i],
+							 &spec->accumulatorValues[i], 1);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	PG_RETURN_POINTER(state);
+}
+
+
+/*
+ * Applies the "final calculation" (FINALFUNC) for bson_group_accumulators.
+ * Builds the output document of the group, see BuildGroupAccumulatorsDocument.
+ */
+Datum
+bson_group_accumulators_final(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0))
+	{
+		PG_RETURN_NULL();
+	}
+
+	BsonGroupAccumulatorsState *state =
+		(BsonGroupAccumulatorsState *) PG_GETARG_POINTER(0);
+
+	PG_RETURN_POINTER(BuildGroupAccumulatorsDocument(state->groupId, state->outputs,
+												   state->values,
+												   state->numAccumulators));
+}
+
+
+/*
+ * Applies the "combine function" (COMBINEFUNC) for bson_group_accumulators.
+ * Combines the states of every accumulator the same way their individual
+ * combine functions do.
+ */
+Datum
+bson_group_accumulators_combine(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggregateContext;
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, errmsg("aggregate function called in non-aggregate context"));
+	}
+
+	if (PG_ARGISNULL(0))
+	{
+		if (PG_ARGISNULL(1))
+		{
+			PG_RETURN_NULL();
+		}
+
+		/* Copy the state into the aggregate context, it may be a deserialized one */
+		MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+		BsonGroupAccumulatorsState *state = CopyGroupAccumulatorsState(
+			(BsonGroupAccumulatorsState *) PG_GETARG_POINTER(1));
+		MemoryContextSwitchTo(oldContext);
+
+		PG_RETURN_POINTER(state);
+	}
+
+	if (PG_ARGISNULL(1))
+	{
+		PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+	}
+
+	BsonGroupAccumulatorsState *leftState =
+		(BsonGroupAccumulatorsState *) PG_GETARG_POINTER(0);
+	BsonGroupAccumulatorsState *rightState =
+		(BsonGroupAccumulatorsState *) PG_GETARG_POINTER(1);
+
+	if (leftState->numAccumulators != rightState->numAccumulators)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
+						errmsg("Cannot combine group accumulator states of %d and %d "
+							   "accumulators", leftState->numAccumulators,
+							   rightState->numAccumulators)));
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(aggregateContext);
+	if (leftState->groupId == NULL && rightState->groupId != NULL)
+	{
+		leftState->groupId = PgbsonCloneFromPgbson(rightState->groupId);
+	}
+
+	for (int i = 0; i < leftState->numAccumulators; i++)
+	{
+		const GroupAccumulatorValue *rightValue = &rightState->values[i];
+		if (rightValue->count == 0)
+		{
+			/* Nothing was added to it: the sums are 0 and there is no min or max */
+			continue;
+		}
+
+		AccumulateGroupValue(leftState->outputs[i].kind, &leftState->values[i],
+							 &rightValue->value, rightValue->count);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	PG_RETURN_POINTER(leftState);
+}
+
+
+/*
+ * Serializes the state of bson_group_accumulators (SERIALFUNC) into a bson
+ * of the form
+ * { "i": <groupId>, "a": [ { "n": <field>, "k": <kind>, "c": <count>, "v": <value> } ] }
+ * where the group id is omitted if it was NULL and the value if it is empty.
+ */
+Datum
+bson_group_accumulators_serialize(PG_FUNCTION_ARGS)
+{
+	BsonGroupAccumulatorsState *state =
+		(BsonGroupAccumulatorsState *) PG_GETARG_POINTER(0);
+
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+
+	if (state->groupId != NULL)
+	{
+		PgbsonWriterAppendDocument(&writer, "i", 1, state->groupId);
+	}
+
+	pgbson_array_writer arrayWriter;
+	PgbsonWriterStartArray(&writer, "a", 1, &arrayWriter);
+	for (int i = 0; i < state->numAccumulators; i++)
+	{
+		const GroupAccumulatorOutput *output = &state->outputs[i];
+		const GroupAccumulatorValue *accumulator = &state->values[i];
+
+		pgbson_writer accumulatorWriter;
+		PgbsonArrayWriterStartDocument(&arrayWriter, &accumulatorWriter);
+		bson_value_t nameValue = { 0 };
+		nameValue.value_type = BSON_TYPE_UTF8;
+		nameValue.value.v_utf8.str = (char *) output->name.string;
+		nameValue.value.v_utf8.len = output->name.length;
+		PgbsonWriterAppendValue(&accumulatorWriter, "n", 1, &nameValue);
+		PgbsonWriterAppendInt32(&accumulatorWriter, "k", 1, output->kind);
+		PgbsonWriterAppendInt64(&accumulatorWriter, "c", 1, accumulator->count);
+		if (accumulator->value.value_type != BSON_TYPE_EOD)
+		{
+			PgbsonWriterAppendValue(&accumulatorWriter, "v", 1, &accumulator->value);
+		}
+
+		PgbsonArrayWriterEndDocument(&arrayWriter, &accumulatorWriter);
+	}
+
+	PgbsonWriterEndArray(&writer, &arrayWriter);
+
+	PG_RETURN_POINTER(PgbsonWriterGetPgbson(&writer));
+}
+
+
+/*
+ * Deserializes the state of bson_group_accumulators (DESERIALFUNC) written
+ * by bson_group_accumulators_serialize. The state is built in the current
+ * memory context, combine copies it as needed.
+ */
+Datum
+bson_group_accumulators_deserialize(PG_FUNCTION_ARGS)
+{
+	pgbson *serializedState = (pgbson *) PG_GETARG_BYTEA_P(0);
+
+	pgbson *groupId = NULL;
+	bson_value_t accumulatorsValue = { 0 };
+
+	bson_iter_t stateIter;
+	PgbsonInitIterator(serializedState, &stateIter);
+	while (bson_iter_next(&stateIter))
+	{
+		const char *key = bson_iter_key(&stateIter);
+		if (strcmp(key, "i") == 0)
+		{
+			groupId = PgbsonInitFromDocumentBsonValue(bson_iter_value(&stateIter));
+		}
+		else if (strcmp(key, "a") == 0)
+		{
+			accumulatorsValue = *bson_iter_value(&stateIter);
+		}
+	}
+
+	if (accumulatorsValue.value_type != BSON_TYPE_ARRAY)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
+						errmsg("Invalid serialized group accumulators state")));
+	}
+
+	int numAccumulators = BsonDocumentValueCountKeys(&accumulatorsValue);
+	GroupAccumulatorOutput *outputs = palloc0(sizeof(GroupAccumulatorOutput) *
+											  Max(numAccumulators, 1));
+	bool copyOutputs = false;
+	BsonGroupAccumulatorsState *state = CreateGroupAccumulatorsState(numAccumulators,
+																	 outputs,
+																	 copyOutputs);
+	state->groupId = groupId;
+
+	int index = 0;
+	bson_iter_t accumulatorsIter;
+	BsonValueInitIterator(&accumulatorsValue, &accumulatorsIter);
+	while (bson_iter_next(&accumulatorsIter))
+	{
+		bson_iter_t accumulatorIter;
+		if (!BSON_ITER_HOLDS_DOCUMENT(&accumulatorsIter) ||
+			!bson_iter_recurse(&accumulatorsIter, &accumulatorIter))
+		{
+			ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
+							errmsg("Invalid serialized group accumulators state")));
+		}
+
+		while (bson_iter_next(&accumulatorIter))
+		{
+			const char *key = bson_iter_key(&accumulatorIter);
+			if (strcmp(key, "n") == 0)
+			{
+				uint32_t length;
+				const char *name = bson_iter_utf8(&accumulatorIter, &length);
+				outputs[index].name.string = pnstrdup(name, length);
+				outputs[index].name.length = length;
+			}
+			else if (strcmp(key, "k") == 0)
+			{
+				outputs[index].kind = (GroupAccumulatorKind) bson_iter_int32(
+					&accumulatorIter);
+			}
+			else if (strcmp(key, "c") == 0)
+			{
+				state->values[index].count = bson_iter_int64(&accumulatorIter);
+			}
+			else if (strcmp(key, "v") == 0)
+			{
+				SetGroupAccumulatorValue(&state->values[index],
+										 bson_iter_value(&accumulatorIter));
+			}
+		}
+
+		index++;
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+
+/*
+ * Parses the accumulators spec, the $group spec without the _id and with
+ * $count replaced by { "$sum": 1 }, and collects the distinct top level fields
+ * that accumulators are field paths of.
+ */
+void
+ParseGroupAccumulatorsSpec(GroupAccumulatorsSpec *spec, pgbson *specBson)
+{
+	int numAccumulators = PgbsonCountKeys(specBson);
+	int arraySize = Max(numAccumulators, 1);
+
+	spec->numAccumulators = numAccumulators;
+	spec->outputs = palloc0(sizeof(GroupAccumulatorOutput) * arraySize);
+	spec->expressions = palloc0(sizeof(AggregationExpressionData) * arraySize);
+	spec->fieldPathIndexes = palloc0(sizeof(int) * arraySize);
+	spec->fieldPaths = palloc0(sizeof(StringView) * arraySize);
+	spec->evaluatedKeys = palloc0(sizeof(char *) * arraySize);
+	spec->fieldValues = palloc0(sizeof(bson_value_t) * arraySize);
+	spec->accumulatorValues = palloc0(sizeof(bson_value_t) * arraySize);
+
+	int index = 0;
+	bson_iter_t specIter;
+	PgbsonInitIterator(specBson, &specIter);
+	while (bson_iter_next(&specIter))
+	{
+		GroupAccumulatorOutput *output = &spec->outputs[index];
+		output->name = bson_iter_key_string_view(&specIter);
+
+		pgbsonelement accumulatorElement;
+		bson_iter_t accumulatorIter;
+		if (!BSON_ITER_HOLDS_DOCUMENT(&specIter) ||
+			!bson_iter_recurse(&specIter, &accumulatorIter) ||
+			!TryGetSinglePgbsonElementFromBsonIterator(&accumulatorIter,
+													   &accumulatorElement))
+		{
+			ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
+							errmsg("Invalid group accumulator for field %.*s",
+								   output->name.length, output->name.string)));
+		}
+
+		if (strcmp(accumulatorElement.path, "$sum") == 0)
+		{
+			output->kind = GroupAccumulatorKind_Sum;
+		}
+		else if (strcmp(accumulatorElement.path, "$avg") == 0)
+		{
+			output->kind = GroupAccumulatorKind_Avg;
+		}
+		else if (strcmp(accumulatorElement.path, "$min") == 0)
+		{
+			output->kind = GroupAccumulatorKind_Min;
+		}
+		else if (strcmp(accumulatorElement.path, "$max") == 0)
+		{
+			output->kind = GroupAccumulatorKind_Max;
+		}
+		else
+		{
+			ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
+							errmsg("Unsupported group accumulator %s",
+								   accumulatorElement.path)));
+		}
+
+		AggregationExpressionData *expression = &spec->expressions[index];
+		ParseAggregationExpressionContext parseContext = { 0 };
+		ParseAggregationExpressionData(expression, &accumulatorElement.bsonValue,
+									   &parseContext);
+
+		spec->fieldPathIndexes[index] = -1;
+		if (expression->kind == AggregationExpressionKind_Path &&
+			memchr(expression->value.value.v_utf8.str, '.',
+				   expression->value.value.v_utf8.len) == NULL)
+		{
+			/* A top level field path: "$a" */
+			StringView fieldPath = {
+				.string = expression->value.value.v_utf8.str + 1,
+				.length = expression->value.value.v_utf8.len - 1
+			};
+
+			int fieldPathIndex = 0;
+			while (fieldPathIndex < spec->numFieldPaths &&
+				   !StringViewEquals(&spec->fieldPaths[fieldPathIndex], &fieldPath))
+			{
+				fieldPathIndex++;
+			}
+
+			if (fieldPathIndex == spec->numFieldPaths)
+			{
+				spec->fieldPaths[spec->numFieldPaths++] = fieldPath;
+			}
+
+			spec->fieldPathIndexes[index] = fieldPathIndex;
+		}
+		else if (expression->kind != AggregationExpressionKind_Constant)
+		{
+			spec->hasEvaluatedExpressions = true;
+			spec->evaluatedKeys[index] = psprintf("%d", index);
+		}
+
+		index++;
+	}
+}
+
+
+/*
+ * Sets spec->accumulatorValues to the value of every accumulator expression
+ * for the document: the single element of what bson_expression_get returns
+ * with isNullOnEmpty, or EOD when it returns an empty document.
+ */
+void
+EvaluateGroupAccumulatorValues(GroupAccumulatorsSpec *spec, pgbson *document)
+{
+	/* Resolve the top level fields in one pass over the document */
+	if (spec->numFieldPaths > 0)
+	{
+		for (int i = 0; i < spec->numFieldPaths; i++)
+		{
+			spec->fieldValues[i].value_type = BSON_TYPE_EOD;
+		}
+
+		int fieldsToFind = spec->numFieldPaths;
+		bson_iter_t documentIter;
+		PgbsonInitIterator(document, &documentIter);
+		while (fieldsToFind > 0 && bson_iter_next(&documentIter))
+		{
+			StringView key = bson_iter_key_string_view(&documentIter);
+			for (int i = 0; i < spec->numFieldPaths; i++)
+			{
+				/* Only the first instance of a field is used, as bson_iter_find does */
+				if (spec->fieldValues[i].value_type == BSON_TYPE_EOD &&
+					StringViewEquals(&key, &spec->fieldPaths[i]))
+				{
+					spec->fieldValues[i] = *bson_iter_value(&documentIter);
+					fieldsToFind--;
+					break;
+				}
+			}
+		}
+
+		/* Missing fields are null, as with isNullOnEmpty */
+		for (int i = 0; i < spec->numFieldPaths; i++)
+		{
+			if (spec->fieldValues[i].value_type == BSON_TYPE_EOD)
+			{
+				spec->fieldValues[i].value_type = BSON_TYPE_NULL;
+			}
+		}
+	}
+
+	/* Evaluate the other expressions into one document keyed by accumulator index */
+	pgbson_writer writer;
+	if (spec->hasEvaluatedExpressions)
+	{
+		PgbsonWriterInit(&writer);
+	}
+
+	for (int i = 0; i < spec->numAccumulators; i++)
+	{
+		const AggregationExpressionData *expression = &spec->expressions[i];
+		if (spec->fieldPathIndexes[i] >= 0)
+		{
+			spec->accumulatorValues[i] = spec->fieldValues[spec->fieldPathIndexes[i]];
+		}
+		else if (expression->kind == AggregationExpressionKind_Constant)
+		{
+			spec->accumulatorValues[i] = expression->value;
+		}
+		else
+		{
+			StringView path = {
+				.string = spec->evaluatedKeys[i],
+				.length = strlen(spec->evaluatedKeys[i])
+			};
+
+			const ExpressionVariableContext *variableContext = NULL;
+			bool isNullOnEmpty = true;
+			EvaluateAggregationExpressionDataToWriter(expression, document, path,
+													  &writer, variableContext,
+													  isNullOnEmpty);
+
+			/* Expressions that write nothing are empty */
+			spec->accumulatorValues[i].value_type = BSON_TYPE_EOD;
+		}
+	}
+
+	if (spec->hasEvaluatedExpressions)
+	{
+		bson_iter_t resultIter;
+		PgbsonWriterGetIterator(&writer, &resultIter);
+		while (bson_iter_next(&resultIter))
+		{
+			int index = pg_strtoint32(bson_iter_key(&resultIter));
+			spec->accumulatorValues[index] = *bson_iter_value(&resultIter);
+		}
+	}
+}
+
+
+/*
+ * Adds the value to the state of the accumulator, count being the number of
+ * values it stands for: 1 for a document, the count of the other state when
+ * combining. This has the semantics of the transition functions of BSONSUM,
+ * BSONAVERAGE, BSONMIN and BSONMAX. Must be called in the aggregate context.
+ */
+void
+AccumulateGroupValue(GroupAccumulatorKind kind, GroupAccumulatorValue *accumulator,
+					 const bson_value_t *value, int64 count)
+{
+	switch (kind)
+	{
+		case GroupAccumulatorKind_Sum:
+		case GroupAccumulatorKind_Avg:
+		{
+			/* Empty values are skipped */
+			if (value->value_type == BSON_TYPE_EOD)
+			{
+				return;
+			}
+
+			bool overflowedFromInt64Ignore = false;
+			if (AddNumberToBsonValue(&accumulator->value, value,
+									 &overflowedFromInt64Ignore))
+			{
+				accumulator->count += count;
+			}
+
+			return;
+		}
+
+		case GroupAccumulatorKind_Min:
+		case GroupAccumulatorKind_Max:
+		{
+			/* Like the transitions of BSONMIN and BSONMAX, ties take the new value */
+			bool replace = accumulator->count == 0;
+			if (!replace)
+			{
+				int compareResult = CompareGroupAccumulatorValues(&accumulator->value,
+																  value);
+				replace = kind == GroupAccumulatorKind_Max ? compareResult <= 0 :
+						  compareResult >= 0;
+			}
+
+			if (replace)
+			{
+				SetGroupAccumulatorValue(accumulator, value);
+			}
+
+			accumulator->count += count;
+			return;
+		}
+
+		default:
+		{
+			ereport(ERROR, (errmsg("Unexpected group accumulator kind %d", kind)));
+		}
+	}
+}
+
+
+
+/*
+ * Builds the output document of a group { "_id": <groupId>, "<field>": <value>, ... }
+ * from the states of its accumulators, the same way bson_repath_and_build does
+ * from the finals of the individual accumulators.
+ */
+pgbson *
+BuildGroupAccumulatorsDocument(pgbson *groupId, const GroupAccumulatorOutput *outputs,
+							   const GroupAccumulatorValue *values, int numAccumulators)
+{
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+
+	if (groupId == NULL)
+	{
+		PgbsonWriterAppendNull(&writer, "_id", 3);
+	}
+	else if (!IsPgbsonEmptyDocument(groupId))
+	{
+		pgbsonelement groupIdElement;
+		PgbsonToSinglePgbsonElement(groupId, &groupIdElement);
+		PgbsonWriterAppendValue(&writer, "_id", 3, &groupIdElement.bsonValue);
+	}
+
+	for (int i = 0; i < numAccumulators; i++)
+	{
+		const GroupAccumulatorOutput *output = &outputs[i];
+		const GroupAccumulatorValue *accumulator = &values[i];
+
+		if (output->name.length == 0 || StringViewStartsWith(&output->name, '$'))
+		{
+			ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_LOCATION40236),
+							errmsg("The field name %.*s cannot be an operator name",
+								   output->name.length, output->name.string)));
+		}
+
+		bson_value_t finalValue = { 0 };
+		switch (output->kind)
+		{
+			case GroupAccumulatorKind_Sum:
+			{
+				finalValue = accumulator->value;
+				break;
+			}
+
+			case GroupAccumulatorKind_Avg:
+			{
+				if (accumulator->count == 0)
+				{
+					finalValue.value_type = BSON_TYPE_NULL;
+				}
+				else
+				{
+					finalValue.value_type = BSON_TYPE_DOUBLE;
+					finalValue.value.v_double = BsonValueAsDouble(&accumulator->value) /
+												accumulator->count;
+				}
+				break;
+			}
+
+			case GroupAccumulatorKind_Min:
+			case GroupAccumulatorKind_Max:
+			{
+				if (accumulator->count == 0)
+				{
+					finalValue.value_type = BSON_TYPE_NULL;
+				}
+				else
+				{
+					/* Empty values are not written */
+					finalValue = accumulator->value;
+				}
+				break;
+			}
+
+			default:
+			{
+				ereport(ERROR, (errmsg("Unexpected group accumulator kind %d",
+									   output->kind)));
+			}
+		}
+
+		if (finalValue.value_type != BSON_TYPE_EOD)
+		{
+			PgbsonWriterAppendValue(&writer, output->name.string, output->name.length,
+									&finalValue);
+		}
+	}
+
+	return PgbsonWriterGetPgbson(&writer);
+}
+
+
+/*
+ * Initializes the states of the accumulators as empty: sums of 0 and no
+ * values for $min and $max.
+ */
+void
+InitializeGroupAccumulatorValues(GroupAccumulatorValue *values,
+								 const GroupAccumulatorOutput *outputs,
+								 int numAccumulators)
+{
+	for (int i = 0; i < numAccumulators; i++)
+	{
+		values[i].count = 0;
+		values[i].valueBson = NULL;
+		if (outputs[i].kind == GroupAccumulatorKind_Sum ||
+			outputs[i].kind == GroupAccumulatorKind_Avg)
+		{
+			values[i].value.value_type = BSON_TYPE_INT32;
+			values[i].value.value.v_int32 = 0;
+		}
+		else
+		{
+			values[i].value.value_type = BSON_TYPE_EOD;
+		}
+	}
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods */
+/* --------------------------------------------------------- */
+
+/*
+ * Returns the parsed accumulators spec. The spec is cached for the query
+ * when it is a constant, as it is in the queries $group generates.
+ * Aggregate arguments are not visible to IsSafeToReuseFmgrFunctionExtraMultiArgs
+ * so this checks the Aggref directly.
+ */
+static GroupAccumulatorsSpec *
+GetGroupAccumulatorsSpec(PG_FUNCTION_ARGS, pgbson *specBson, bool *isSpecCached)
+{
+	if (fcinfo->flinfo->fn_extra != NULL)
+	{
+		*isSpecCached = true;
+		return (GroupAccumulatorsSpec *) fcinfo->flinfo->fn_extra;
+	}
+
+	Aggref *aggref = AggGetAggref(fcinfo);
+	int specArgIndex = GROUP_ACCUMULATORS_SPEC_ARG - 1;
+	if (aggref != NULL && list_length(aggref->args) > specArgIndex &&
+		IsA(((TargetEntry *) list_nth(aggref->args, specArgIndex))->expr, Const))
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		GroupAccumulatorsSpec *spec = palloc0(sizeof(GroupAccumulatorsSpec));
+		ParseGroupAccumulatorsSpec(spec, PgbsonCloneFromPgbson(specBson));
+		MemoryContextSwitchTo(oldContext);
+
+		fcinfo->flinfo->fn_extra = spec;
+		*isSpecCached = true;
+		return spec;
+	}
+
+	GroupAccumulatorsSpec *spec = palloc0(sizeof(GroupAccumulatorsSpec));
+	ParseGroupAccumulatorsSpec(spec, specBson);
+	*isSpecCached = false;
+	return spec;
+}
+
+
+/*
+ * Creates the state for the accumulators in the current memory context,
+ * every accumulator empty.
+ */
+static BsonGroupAccumulatorsState *
+CreateGroupAccumulatorsState(int numAccumulators, const GroupAccumulatorOutput *outputs,
+							 bool copyOutputs)
+{
+	BsonGroupAccumulatorsState *state = palloc0(
+		offsetof(BsonGroupAccumulatorsState, values) +
+		sizeof(GroupAccumulatorValue) * numAccumulators);
+	state->numAccumulators = numAccumulators;
+	state->outputs = outputs;
+
+	if (copyOutputs)
+	{
+		GroupAccumulatorOutput *outputsCopy = palloc(sizeof(GroupAccumulatorOutput) *
+													 Max(numAccumulators, 1));
+		for (int i = 0; i < numAccumulators; i++)
+		{
+			outputsCopy[i].kind = outputs[i].kind;
+			outputsCopy[i].name.string = pnstrdup(outputs[i].name.string,
+												  outputs[i].name.length);
+			outputsCopy[i].name.length = outputs[i].name.length;
+		}
+
+		state->outputs = outputsCopy;
+	}
+
+	InitializeGroupAccumulatorValues(state->values, state->outputs, numAccumulators);
+
+	return state;
+}
+
+
+/*
+ * Copies the state, with its outputs and values, into the current memory context.
+ */
+static BsonGroupAccumulatorsState *
+CopyGroupAccumulatorsState(const BsonGroupAccumulatorsState *source)
+{
+	bool copyOutputs = true;
+	BsonGroupAccumulatorsState *state = CreateGroupAccumulatorsState(
+		source->numAccumulators, source->outputs, copyOutputs);
+	state->groupId = source->groupId != NULL ?
+					 PgbsonCloneFromPgbson(source->groupId) : NULL;
+
+	for (int i = 0; i < source->numAccumulators; i++)
+	{
+		state->values[i].count = source->values[i].count;
+		SetGroupAccumulatorValue(&state->values[i], &source->values[i].value);
+	}
+
+	return state;
+}
+
+
+/*
+ * Sets the value of the accumulator, copying the data of values that are
+ * not fixed size into the current memory context.
+ */
+static void
+SetGroupAccumulatorValue(GroupAccumulatorValue *accumulator, const bson_value_t *value)
+{
+	if (accumulator->valueBson != NULL)
+	{
+		pfree(accumulator->valueBson);
+		accumulator->valueBson = NULL;
+	}
+
+	switch (value->value_type)
+	{
+		case BSON_TYPE_UTF8:
+		case BSON_TYPE_DOCUMENT:
+		case BSON_TYPE_ARRAY:
+		case BSON_TYPE_BINARY:
+		case BSON_TYPE_REGEX:
+		case BSON_TYPE_DBPOINTER:
+		case BSON_TYPE_CODE:
+		case BSON_TYPE_SYMBOL:
+		case BSON_TYPE_CODEWSCOPE:
+		{
+			accumulator->valueBson = BsonValueToDocumentPgbson(value);
+
+			pgbsonelement element;
+			PgbsonToSinglePgbsonElement(accumulator->valueBson, &element);
+			accumulator->value = element.bsonValue;
+			break;
+		}
+
+		default:
+		{
+			accumulator->value = *value;
+			break;
+		}
+	}
+}
+
+
+/*
+ * Compares two values like ComparePgbson compares the { "": value } documents
+ * holding them: empty values sort before every other value.
+ */
+static int
+CompareGroupAccumulatorValues(const bson_value_t *left, const bson_value_t *right)
+{
+	if (left->value_type == BSON_TYPE_EOD || right->value_type == BSON_TYPE_EOD)
+	{
+		return (left->value_type != BSON_TYPE_EOD) - (right->value_type != BSON_TYPE_EOD);
+	}
+
+	bool isComparisonValidIgnore = false;
+	return CompareBsonValueAndType(left, right, &isComparisonValidIgnore);
+}
@@ -117,6 +117,10 @@ static void HandleUnresolvedFields(const BsonIntermediatePathNode *parentNode,
 								   pgbson_writer *writer,
 								   pgbson *parentDocument,
 								   const ExpressionVariableContext *variableContext);
+static void TraverseObjectAndSpliceToWriter(bson_iter_t *iterator,
+											const BsonIntermediatePathNode *pathSpecTree,
+											pgbson_splice_writer *writer,
+											ProjectDocumentState *projectDocState);
 static void TraverseArrayAndAppendToWriter(bson_iter_t *parentIterator,
 										   pgbson_array_writer *writer,
 										   const BsonIntermediatePathNode *pathNode,
@@ -184,6 +188,8 @@ static pgbson * MergeDocumentWithArrayOverride(pgbson *sourceDocument,
 											   pathSpecTree,
 											   bool overrideNestedArrays);
 
+extern bool EnableBsonSpliceWriter;
+
 /* --------------------------------------------------------- */
 /* Top level exports */
 /* --------------------------------------------------------- */
@@ -1440,6 +1446,16 @@ ProjectDocumentWithState(pgbson *sourceDocument,
 				state->endTotalProjections);
 	}
 
+	if (EnableBsonSpliceWriter && state->projectNonMatchingFields)
+	{
+		/* Most of the document is written as is, copy it instead */
+		pgbson_splice_writer spliceWriter;
+		PgbsonSpliceWriterInit(&spliceWriter, VARSIZE_ANY_EXHDR(sourceDocument));
+		TraverseObjectAndSpliceToWriter(&documentIterator, state->root, &spliceWriter,
+										&projectDocState);
+		return PgbsonSpliceWriterGetPgbson(&spliceWriter);
+	}
+
 	bool isInNestedArray = false;
 	TraverseObjectAndAppendToWriter(&documentIterator, state->root, &writer,
 									state->projectNonMatchingFields,
@@ -2443,6 +2459,104 @@ TraverseObjectAndAppendToWriter(bson_iter_t *iterator,
 }
 
 
+/*
+ * Same as TraverseObjectAndAppendToWriter for projections that write the fields
+ * not in the projection. These fields are spliced from the source document, the
+ * excluded ones are skipped and nested documents with projected fields are
+ * traversed in turn. Only the other fields are written as in
+ * TraverseObjectAndAppendToWriter.
+ */
+static void
+TraverseObjectAndSpliceToWriter(bson_iter_t *iterator,
+								const BsonIntermediatePathNode *pathSpecTree,
+								pgbson_splice_writer *writer,
+								ProjectDocumentState *projectDocState)
+{
+	check_stack_depth();
+	CHECK_FOR_INTERRUPTS();
+
+	bool projectNonMatchingFields = true;
+	bool isInNestedArray = false;
+	Bitmapset *fieldHandledBitmapSet = NULL;
+	while (bson_iter_next(iterator))
+	{
+		StringView path = bson_iter_key_string_view(iterator);
+
+		const BsonPathNode *child;
+		const BsonPathNode *matchedChild = NULL;
+		int index = 0;
+		foreach_child(child, pathSpecTree)
+		{
+			if (StringViewEquals(&child->field, &path))
+			{
+				matchedChild = child;
+				break;
+			}
+
+			index++;
+		}
+
+		if (matchedChild == NULL)
+		{
+			PgbsonSpliceWriterAppendIter(writer, iterator);
+			continue;
+		}
+		else if (matchedChild->nodeType == NodeType_LeafExcluded)
+		{
+			continue;
+		}
+		else if (matchedChild->nodeType == NodeType_Intermediate &&
+				 BSON_ITER_HOLDS_DOCUMENT(iterator))
+		{
+			bson_iter_t childIter;
+			uint32_t documentOffset = PgbsonSpliceWriterStartDocument(writer,
+																	  path.string,
+																	  path.length);
+			if (bson_iter_recurse(iterator, &childIter))
+			{
+				TraverseObjectAndSpliceToWriter(&childIter,
+												CastAsIntermediateNode(matchedChild),
+												writer, projectDocState);
+			}
+			PgbsonSpliceWriterEndDocument(writer, documentOffset);
+
+			if (IsIntermediateNodeWithField(matchedChild))
+			{
+				fieldHandledBitmapSet = bms_add_member(fieldHandledBitmapSet, index);
+			}
+			continue;
+		}
+
+		pgbson_writer fieldWriter;
+		PgbsonWriterInit(&fieldWriter);
+		ProjectCurrentIteratorFieldToWriter(iterator, pathSpecTree, &fieldWriter,
+											projectNonMatchingFields,
+											&fieldHandledBitmapSet,
+											projectDocState,
+											isInNestedArray);
+		PgbsonSpliceWriterConcatWriter(writer, &fieldWriter);
+		PgbsonWriterFree(&fieldWriter);
+	}
+
+	/* add any unresolved field nodes and pending projections at the end. */
+	pgbson_writer unresolvedWriter;
+	PgbsonWriterInit(&unresolvedWriter);
+	HandleUnresolvedFields(pathSpecTree, fieldHandledBitmapSet, &unresolvedWriter,
+						   projectDocState->parentDocument,
+						   projectDocState->variableContext);
+
+	if (projectDocState->pendingProjectionState != NULL &&
+		projectDocState->projectDocumentFuncs.writePendingProjectionFunc != NULL)
+	{
+		projectDocState->projectDocumentFuncs.writePendingProjectionFunc(
+			&unresolvedWriter, projectDocState->pendingProjectionState);
+	}
+
+	PgbsonSpliceWriterConcatWriter(writer, &unresolvedWriter);
+	PgbsonWriterFree(&unresolvedWriter);
+}
+
+
 /*
  * Walks all fields in an array, and projects any inner objects based off the path node specification.
  * Note that arrays do not participate in projections directly (so 'a.1' do not traverse into the 1st index of
@@ -35,6 +35,8 @@
 static void ParseInputExpressionAndPersistValue(AggregationExpressionData *expressionData,
 												const bson_value_t *expressionValue,
 												ParseAggregationExpressionContext *context);
+static int64 GetOnSortedValuesPrefixSize(const char *valuesPtr, int64 valuesSize,
+										 int64 numValues, int64 prefixCount);
 
 /*
  * Converts a BsonOrderAggState into a serialized form to allow the internal type to be bytea
@@ -940,6 +942,107 @@ BsonOrderCombine(PG_FUNCTION_ARGS, bool invertSort)
 }
 
 
+/*
+ * Applies the "combine" (COMBINEFUNC) for accumulators on unsorted input.
+ *
+ * The args of PG_FUNCTION_ARGS are:
+ *      0) left side partial aggregate
+ *      1) right side partial aggregate
+ *
+ * The states are in the format written by BsonOrderTransitionOnSorted: the
+ * values are in the order they were seen, or the most recent first for
+ * invertSort. The left side is seen before the right side, so the combined
+ * state has the values of the left side followed by those of the right side
+ * (the other way around for invertSort), up to the number of values to return.
+ */
+Datum
+BsonOrderCombineOnSorted(PG_FUNCTION_ARGS, bool invertSort)
+{
+	MemoryContext aggregateContext;
+	if (!AggCheckCallContext(fcinfo, &aggregateContext))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg(
+							"aggregate function called in non-aggregate context")));
+	}
+
+	/* Check if either result is NULL and return Non-NULL */
+	if (PG_ARGISNULL(0))
+	{
+		return PG_GETARG_DATUM(1);
+	}
+
+	if (PG_ARGISNULL(1))
+	{
+		return PG_GETARG_DATUM(0);
+	}
+
+	bytea *leftBytes = PG_GETARG_BYTEA_P(0);
+	bytea *rightBytes = PG_GETARG_BYTEA_P(1);
+	bytea *firstBytes = invertSort ? rightBytes : leftBytes;
+	bytea *secondBytes = invertSort ? leftBytes : rightBytes;
+
+	/* Format is: VARHDR | ByteSize | ReturnCount | CurrentCount | InputExpressionSize | InputExpression | values... */
+	const char *firstPtr = VARDATA(firstBytes);
+	int64 firstByteSize = *(int64 *) firstPtr;
+	int64 returnCount = *(int64 *) (firstPtr + sizeof(int64));
+	int64 firstCount = *(int64 *) (firstPtr + sizeof(int64) * 2);
+	int64 firstInputExpressionSize = *(int64 *) (firstPtr + sizeof(int64) * 3);
+
+	if (firstCount >= returnCount)
+	{
+		/* The values of the first side are all that's returned */
+		return PointerGetDatum(firstBytes);
+	}
+
+	const char *secondPtr = VARDATA(secondBytes);
+	int64 secondByteSize = *(int64 *) secondPtr;
+	int64 secondCount = *(int64 *) (secondPtr + sizeof(int64) * 2);
+	int64 secondInputExpressionSize = *(int64 *) (secondPtr + sizeof(int64) * 3);
+
+	const char *firstValues = firstPtr + sizeof(int64) * 4 + firstInputExpressionSize;
+	int64 firstValuesSize = firstByteSize - VARHDRSZ - sizeof(int64) * 4 -
+							firstInputExpressionSize;
+	const char *secondValues = secondPtr + sizeof(int64) * 4 +
+							   secondInputExpressionSize;
+	int64 secondValuesSize = secondByteSize - VARHDRSZ - sizeof(int64) * 4 -
+							 secondInputExpressionSize;
+
+	int64 secondCopyCount = Min(secondCount, returnCount - firstCount);
+	int64 secondCopySize = GetOnSortedValuesPrefixSize(secondValues, secondValuesSize,
+													   secondCount, secondCopyCount);
+
+	/* Both sides have the same input expression, if any */
+	const char *inputExpression = firstInputExpressionSize != 0 ?
+								  firstPtr + sizeof(int64) * 4 :
+								  secondPtr + sizeof(int64) * 4;
+	int64 inputExpressionSize = Max(firstInputExpressionSize,
+									secondInputExpressionSize);
+
+	uint32 totalSize = VARHDRSZ + sizeof(int64) * 4 + inputExpressionSize +
+					   firstValuesSize + secondCopySize;
+	bytea *returnData = (bytea *) MemoryContextAlloc(aggregateContext, totalSize);
+	SET_VARSIZE(returnData, totalSize);
+
+	char *returnDataPtr = (char *) VARDATA(returnData);
+	*((int64 *) (returnDataPtr)) = totalSize;
+	returnDataPtr += sizeof(int64);
+	*((int64 *) (returnDataPtr)) = returnCount;
+	returnDataPtr += sizeof(int64);
+	*((int64 *) (returnDataPtr)) = firstCount + secondCopyCount;
+	returnDataPtr += sizeof(int64);
+	*((int64 *) (returnDataPtr)) = inputExpressionSize;
+	returnDataPtr += sizeof(int64);
+
+	memcpy(returnDataPtr, inputExpression, inputExpressionSize);
+	returnDataPtr += inputExpressionSize;
+	memcpy(returnDataPtr, firstValues, firstValuesSize);
+	returnDataPtr += firstValuesSize;
+	memcpy(returnDataPtr, secondValues, secondCopySize);
+
+	PG_RETURN_POINTER(returnData);
+}
+
+
 /*
  * Applies the FINALFUNC for accumulator.
  *
@@ -1371,3 +1474,29 @@ ParseInputExpressionAndPersistValue(AggregationExpressionData *expressionData,
 	bson_value_t persistedValue = element.bsonValue;
 	ParseAggregationExpressionData(expressionData, &persistedValue, context);
 }
+
+
+/*
+ * Returns the size of the first prefixCount of the numValues values written
+ * by BsonOrderTransitionOnSorted. Each value is followed by its size, so the
+ * values past the prefix are skipped from the end.
+ */
+static int64
+GetOnSortedValuesPrefixSize(const char *valuesPtr, int64 valuesSize, int64 numValues,
+							int64 prefixCount)
+{
+	int64 prefixSize = valuesSize;
+	for (int64 i = prefixCount; i < numValues; i++)
+	{
+		uint32 valueSize = *(uint32 *) (valuesPtr + prefixSize - sizeof(uint32));
+		prefixSize -= sizeof(uint32) + valueSize;
+	}
+
+	if (prefixSize < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg(
+							"Invalid state for aggregate function BsonOrderCombineOnSorted")));
+	}
+
+	return prefixSize;
+}
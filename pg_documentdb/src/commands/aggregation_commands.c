@@ -26,6 +26,7 @@
 #include <aggregation/bson_aggregation_pipeline.h>
 #include "aggregation/aggregation_commands.h"
 #include "infrastructure/cursor_store.h"
+#include "infrastructure/query_shape_cache.h"
 
 
 extern bool EnableNowSystemVariable;
@@ -236,9 +237,9 @@ find_cursor_first_page(text *database, pgbson *findSpec, int64_t cursorId)
 	QueryData queryData = GenerateFirstPageQueryData();
 	bool generateCursorParams = true;
 	bool setStatementTimeout = true;
-	Query *query = GenerateFindQuery(database, findSpec, &queryData,
-									 generateCursorParams,
-									 setStatementTimeout);
+	Query *query = GenerateFindQueryWithShapeCache(database, findSpec, &queryData,
+												   generateCursorParams,
+												   setStatementTimeout);
 
 	Datum response = HandleFirstPageRequest(
 		findSpec, cursorId, &queryData,
@@ -99,6 +99,9 @@ bool ForceRumOrderedIndexScan = DEFAULT_FORCE_RUM_ORDERED_INDEX_SCAN;
 #define DEFAULT_ENABLE_NEW_OPERATOR_SELECTIVITY false
 bool EnableNewOperatorSelectivityMode = DEFAULT_ENABLE_NEW_OPERATOR_SELECTIVITY;
 
+#define DEFAULT_ENABLE_PATH_DEPENDENCY_SELECTIVITY true
+bool EnablePathDependencySelectivity = DEFAULT_ENABLE_PATH_DEPENDENCY_SELECTIVITY;
+
 #define DEFAULT_ENABLE_RUM_INDEX_SCAN true
 bool EnableRumIndexScan = DEFAULT_ENABLE_RUM_INDEX_SCAN;
 
@@ -148,6 +151,24 @@ bool UseLegacyOrderByBehavior = DEFAULT_USE_LEGACY_ORDERBY_BEHAVIOR;
 #define DEFAULT_USE_LEGACY_NULL_EQUALITY_BEHAVIOR false
 bool UseLegacyNullEqualityBehavior = DEFAULT_USE_LEGACY_NULL_EQUALITY_BEHAVIOR;
 
+#define DEFAULT_ENABLE_QUERY_SHAPE_CACHE false
+bool EnableQueryShapeCache = DEFAULT_ENABLE_QUERY_SHAPE_CACHE;
+
+#define DEFAULT_ENABLE_SORT_KEY_RADIX_SORT false
+bool EnableSortKeyRadixSort = DEFAULT_ENABLE_SORT_KEY_RADIX_SORT;
+
+#define DEFAULT_ENABLE_BSON_SPLICE_WRITER false
+bool EnableBsonSpliceWriter = DEFAULT_ENABLE_BSON_SPLICE_WRITER;
+
+#define DEFAULT_ENABLE_FUSED_GROUP_ACCUMULATORS false
+bool EnableFusedGroupAccumulators = DEFAULT_ENABLE_FUSED_GROUP_ACCUMULATORS;
+
+#define DEFAULT_ENABLE_CUSTOM_GROUP_SCAN false
+bool EnableCustomGroupScan = DEFAULT_ENABLE_CUSTOM_GROUP_SCAN;
+
+#define DEFAULT_ENABLE_COMBINABLE_GROUP_ACCUMULATORS false
+bool EnableCombinableGroupAccumulators = DEFAULT_ENABLE_COMBINABLE_GROUP_ACCUMULATORS;
+
 
 /*
  * SECTION: Let support feature flags
@@ -171,6 +192,9 @@ bool SkipFailOnCollation = DEFAULT_SKIP_FAIL_ON_COLLATION;
 bool EnableLookupIdJoinOptimizationOnCollation =
 	DEFAULT_ENABLE_LOOKUP_ID_JOIN_OPTIMIZATION_ON_COLLATION;
 
+#define DEFAULT_ENABLE_COLLATION_SORT_KEY_CACHE false
+bool EnableCollationSortKeyCache = DEFAULT_ENABLE_COLLATION_SORT_KEY_CACHE;
+
 
 /*
  * SECTION: Cluster administration & DDL feature flags
@@ -281,6 +305,14 @@ InitializeFeatureFlagConfigurations(const char *prefix, const char *newGucPrefix
 		DEFAULT_ENABLE_NEW_OPERATOR_SELECTIVITY,
 		PGC_USERSET, 0, NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		psprintf("%s.enablePathDependencySelectivity", newGucPrefix),
+		gettext_noop(
+			"Determines whether the selectivity of equalities accounts for the dependencies between their paths."),
+		NULL, &EnablePathDependencySelectivity,
+		DEFAULT_ENABLE_PATH_DEPENDENCY_SELECTIVITY,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		psprintf("%s.enableRumIndexScan", newGucPrefix),
 		gettext_noop(
@@ -387,6 +419,14 @@ InitializeFeatureFlagConfigurations(const char *prefix, const char *newGucPrefix
 		DEFAULT_ENABLE_LOOKUP_ID_JOIN_OPTIMIZATION_ON_COLLATION,
 		PGC_USERSET, 0, NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		psprintf("%s.enableCollationSortKeyCache", newGucPrefix),
+		gettext_noop(
+			"Whether sorts with a collation compare strings by their ICU sort keys, computed once per string."),
+		NULL, &EnableCollationSortKeyCache,
+		DEFAULT_ENABLE_COLLATION_SORT_KEY_CACHE,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		psprintf("%s.enableNowSystemVariable", newGucPrefix),
 		gettext_noop(
@@ -579,6 +619,54 @@ InitializeFeatureFlagConfigurations(const char *prefix, const char *newGucPrefix
 		DEFAULT_USE_LEGACY_NULL_EQUALITY_BEHAVIOR,
 		PGC_USERSET, 0, NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		psprintf("%s.enableQueryShapeCache", newGucPrefix),
+		gettext_noop(
+			"Whether to reuse the queries generated for find commands of the same shape."),
+		NULL, &EnableQueryShapeCache,
+		DEFAULT_ENABLE_QUERY_SHAPE_CACHE,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableSortKeyRadixSort", newGucPrefix),
+		gettext_noop(
+			"Whether to radix sort arrays sorted by $sortArray and $push on the sort keys of their values."),
+		NULL, &EnableSortKeyRadixSort,
+		DEFAULT_ENABLE_SORT_KEY_RADIX_SORT,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableBsonSpliceWriter", newGucPrefix),
+		gettext_noop(
+			"Whether projections and updates copy the unchanged fields of documents as is, instead of rewriting them."),
+		NULL, &EnableBsonSpliceWriter,
+		DEFAULT_ENABLE_BSON_SPLICE_WRITER,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableFusedGroupAccumulators", newGucPrefix),
+		gettext_noop(
+			"Whether $group evaluates its $sum, $avg, $min, $max and $count accumulators in a single aggregate."),
+		NULL, &EnableFusedGroupAccumulators,
+		DEFAULT_ENABLE_FUSED_GROUP_ACCUMULATORS,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableCustomGroupScan", newGucPrefix),
+		gettext_noop(
+			"Whether $group with fused accumulators is executed by the group scan, which spills to disk over work_mem."),
+		NULL, &EnableCustomGroupScan,
+		DEFAULT_ENABLE_CUSTOM_GROUP_SCAN,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableCombinableGroupAccumulators", newGucPrefix),
+		gettext_noop(
+			"Whether $group on unsorted input uses $first, $last, $push, $addToSet and $mergeObjects accumulators that can be partially aggregated."),
+		NULL, &EnableCombinableGroupAccumulators,
+		DEFAULT_ENABLE_COMBINABLE_GROUP_ACCUMULATORS,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		psprintf("%s.useNewElemMatchIndexPushdown", newGucPrefix),
 		gettext_noop(
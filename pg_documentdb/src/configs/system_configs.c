@@ -41,6 +41,12 @@ int ShardingMaxChunks = DEFAULT_SHARDING_MAX_CHUNKS;
 #define DEFAULT_QUERY_PLAN_CACHE_SIZE_LIMIT 100
 int QueryPlanCacheSizeLimit = DEFAULT_QUERY_PLAN_CACHE_SIZE_LIMIT;
 
+#define DEFAULT_QUERY_SHAPE_CACHE_SIZE_LIMIT 256
+int QueryShapeCacheSizeLimit = DEFAULT_QUERY_SHAPE_CACHE_SIZE_LIMIT;
+
+#define DEFAULT_MAX_SHARED_QUERY_SHAPES 1024
+int MaxSharedQueryShapes = DEFAULT_MAX_SHARED_QUERY_SHAPES;
+
 /* TODO: Raise this back to 100,000 once we can optimize sub-transaction */
 /* handling with multi-node clusters. */
 #define DEFAULT_MAX_WRITE_BATCH_SIZE 25000
@@ -181,6 +187,24 @@ InitializeSystemConfigurations(const char *prefix, const char *newGucPrefix)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		psprintf("%s.query_shape_cache_size", prefix),
+		gettext_noop("Set the number of find query shapes cached per backend"),
+		NULL,
+		&QueryShapeCacheSizeLimit,
+		DEFAULT_QUERY_SHAPE_CACHE_SIZE_LIMIT, 0, INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		psprintf("%s.maxSharedQueryShapes", newGucPrefix),
+		gettext_noop(
+			"The max number of find query shapes tracked in shared memory. set to 0 to disable sharing query shapes."),
+		NULL, &MaxSharedQueryShapes,
+		DEFAULT_MAX_SHARED_QUERY_SHAPES, 0, 1000000,
+		PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		psprintf("%s.maxWriteBatchSize", prefix),
 		gettext_noop("The max number of write operations permitted in a write batch."),
@@ -0,0 +1,1273 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/customscan/custom_group_scan.c
+ *
+ * Implementation of the group scan: a custom scan that executes the
+ * aggregation of $group when its accumulators are fused into the
+ * bson_group_accumulators aggregate.
+ *
+ * The generic HashAgg node hashes and compares the BSON _id of every input
+ * row through the bson operators, and pallocs a transition state per group.
+ * The group scan instead:
+ *   - Keys groups by the encoding of their _id from
+ *     AppendBsonValueComparableEncoding, so lookups are a hash of bytes and
+ *     a memcmp.
+ *   - Stores the groups in an open addressing table whose entries hold the
+ *     states of the accumulators inline, with the keys and _ids of the
+ *     groups allocated from blocks of the table.
+ *   - When the table is over the hash memory limit (work_mem times
+ *     hash_mem_multiplier), stops adding groups and spills the rows of new
+ *     groups, with the accumulator values already evaluated, to partitions
+ *     in logical tapes by their hash. Each partition is then aggregated in
+ *     its own batch, spilling again if needed with more bits of the hash.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <common/hashfn.h>
+#include <commands/explain.h>
+#include <executor/executor.h>
+#include <executor/nodeHash.h>
+#include <nodes/extensible.h>
+#include <nodes/nodeFuncs.h>
+#include <optimizer/cost.h>
+#include <optimizer/pathnode.h>
+#include <utils/builtins.h>
+#include <utils/logtape.h>
+#include <utils/memutils.h>
+
+#include "io/bson_core.h"
+#include "io/bson_hash.h"
+#include "aggregation/bson_group_accumulators.h"
+#include "customscan/bson_custom_query_scan.h"
+#include "customscan/custom_scan_registrations.h"
+#include "metadata/metadata_cache.h"
+#include "utils/documentdb_errors.h"
+
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+/* Name needed for Postgres to register the input of the group scan */
+#define InputGroupScanNodeName "ExtensionGroupScanInput"
+
+/* The rows of a batch over the memory limit are spilled to 2^bits partitions */
+#define GROUP_SCAN_SPILL_PARTITION_BITS 4
+#define GROUP_SCAN_SPILL_PARTITIONS (1 << GROUP_SCAN_SPILL_PARTITION_BITS)
+
+/* The initial number of entries of the hash table, a power of 2 */
+#define GROUP_SCAN_INITIAL_CAPACITY 256
+
+/* The size of the blocks the keys and _ids of the groups are allocated from */
+#define GROUP_SCAN_BLOCK_SIZE (32 * 1024)
+
+/*
+ * The input of the group scan determined at plan time.
+ * Note Any changes to this data structure also need to
+ * be replicated in CopyNodeInputGroupScanState.
+ */
+typedef struct InputGroupScanState
+{
+	/* Must be the first field */
+	ExtensibleNode extensible;
+
+	/* The accumulators spec of the bson_group_accumulators aggregate */
+	pgbson *accumulatorsSpec;
+
+	/* The attributes of the _id and of the document in the inner plan's output */
+	AttrNumber groupIdAttributeNumber;
+	AttrNumber documentAttributeNumber;
+} InputGroupScanState;
+
+/*
+ * What a column of the tuples of the group scan holds.
+ */
+typedef enum GroupScanColumnKind
+{
+	/* The _id of the group, the grouping expression */
+	GroupScanColumnKind_GroupId = 1,
+
+	/* The output document of bson_group_accumulators */
+	GroupScanColumnKind_Accumulators = 2,
+
+	/* A constant of the target list, e.g. the '_id' field name */
+	GroupScanColumnKind_Constant = 3
+} GroupScanColumnKind;
+
+typedef struct GroupScanColumn
+{
+	GroupScanColumnKind kind;
+	Datum constValue;
+	bool constIsNull;
+} GroupScanColumn;
+
+/*
+ * An entry of the hash table. The states of the accumulators follow
+ * the entry, entries are entrySize apart.
+ */
+typedef struct GroupScanEntry
+{
+	bool isUsed;
+
+	uint32 hash;
+
+	/* The encoding of the _id, empty for a SQL NULL */
+	uint32 encodedKeyLength;
+	const char *encodedKey;
+
+	/* The _id of the first row of the group, NULL if it was a SQL NULL */
+	pgbson *groupId;
+
+	GroupAccumulatorValue values[FLEXIBLE_ARRAY_MEMBER];
+} GroupScanEntry;
+
+/*
+ * A partition of spilled rows, aggregated in a batch of its own.
+ */
+typedef struct GroupScanPartition
+{
+	LogicalTape *tape;
+
+	/* The number of times its rows were spilled, the hash bits already used */
+	int spillDepth;
+
+	int64 numRows;
+} GroupScanPartition;
+
+/*
+ * The custom Scan State for the DocumentDBApiGroupScan.
+ */
+typedef struct ExtensionGroupScanState
+{
+	/* must be first field */
+	CustomScanState custom_scanstate;
+
+	/* The execution state of the inner plan */
+	PlanState *innerPlanState;
+
+	/* The planning state of the inner plan */
+	Plan *innerPlan;
+
+	/* The immutable input of the scan */
+	InputGroupScanState *inputState;
+
+	GroupAccumulatorsSpec spec;
+
+	/* The keys the values of spilled rows are written with: their index */
+	char **valueKeys;
+
+	/* The columns of the scan tuple */
+	int numColumns;
+	GroupScanColumn *columns;
+
+	/* Holds the table, the keys and _ids and the accumulated values of a batch */
+	MemoryContext tableContext;
+
+	/* Holds the evaluation of a single input row */
+	MemoryContext rowContext;
+
+	/* The hash table: capacity entries of entrySize */
+	char *entries;
+	Size entrySize;
+	uint64 capacity;
+	uint64 numEntries;
+
+	/* The block the keys and _ids of new groups are allocated from */
+	char *blockNext;
+	char *blockEnd;
+
+	/* The memory the table may use before rows are spilled */
+	Size memoryLimit;
+
+	/* Scratch space for the encoding of the _id of a row */
+	StringInfoData encodedKey;
+
+	/* The tapes of the spilled partitions, created on the first spill */
+	LogicalTapeSet *tapeSet;
+
+	/* The spill depth of the current batch */
+	int spillDepth;
+
+	/* The partitions rows are spilled to, NULL until the batch is over the limit */
+	GroupScanPartition *spillPartitions;
+
+	/* The spilled partitions that are yet to be aggregated */
+	List *pendingPartitions;
+
+	bool isInputConsumed;
+	bool isTableFilled;
+	uint64 nextEntryIndex;
+
+	/* Statistics for EXPLAIN ANALYZE */
+	int64 numBatches;
+	int64 numSpilledRows;
+	Size peakMemory;
+} ExtensionGroupScanState;
+
+
+/* --------------------------------------------------------- */
+/* Forward declaration */
+/* --------------------------------------------------------- */
+
+static Plan * ExtensionGroupScanPlanCustomPath(PlannerInfo *root,
+											   RelOptInfo *rel,
+											   struct CustomPath *best_path,
+											   List *tlist,
+											   List *clauses,
+											   List *custom_plans);
+static Node * ExtensionGroupScanCreateCustomScanState(CustomScan *cscan);
+static void ExtensionGroupScanBeginCustomScan(CustomScanState *node, EState *estate,
+											  int eflags);
+static TupleTableSlot * ExtensionGroupScanExecCustomScan(CustomScanState *node);
+static void ExtensionGroupScanEndCustomScan(CustomScanState *node);
+static void ExtensionGroupScanReScanCustomScan(CustomScanState *node);
+static void ExtensionGroupScanExplainCustomScan(CustomScanState *node, List *ancestors,
+												ExplainState *es);
+static TupleTableSlot * ExtensionGroupScanNext(CustomScanState *node);
+static bool ExtensionGroupScanNextRecheck(ScanState *state, TupleTableSlot *slot);
+
+static void CopyNodeInputGroupScanState(ExtensibleNode *target_node, const
+										ExtensibleNode *source_node);
+static void OutInputGroupScanNode(StringInfo str, const struct ExtensibleNode *raw_node);
+static void ReadUnsupportedExtensionGroupScanNode(struct ExtensibleNode *node);
+static bool EqualUnsupportedExtensionGroupScanNode(const struct ExtensibleNode *a,
+												   const struct ExtensibleNode *b);
+
+static AttrNumber GetPathTargetAttributeNumber(PathTarget *target, Expr *expr);
+static void FillGroupScanTableFromInput(ExtensionGroupScanState *state);
+static void FillGroupScanTableFromPartition(ExtensionGroupScanState *state,
+											GroupScanPartition *partition);
+static void AddGroupScanRow(ExtensionGroupScanState *state, pgbson *groupId,
+							const bson_value_t *values);
+static void SpillGroupScanRow(ExtensionGroupScanState *state, uint32 hash,
+							  pgbson *groupId, const bson_value_t *values);
+static void FinishGroupScanBatch(ExtensionGroupScanState *state);
+static void CheckGroupScanMemory(ExtensionGroupScanState *state);
+static void InitializeGroupScanTable(ExtensionGroupScanState *state);
+static void ResetGroupScanTable(ExtensionGroupScanState *state);
+static GroupScanEntry * FindGroupScanEntry(ExtensionGroupScanState *state, uint32 hash,
+										   const char *encodedKey,
+										   uint32 encodedKeyLength, bool *found);
+static GroupScanEntry * InsertGroupScanEntry(ExtensionGroupScanState *state,
+											 uint32 hash, pgbson *groupId);
+static void GrowGroupScanTable(ExtensionGroupScanState *state);
+static void * AllocateGroupScanBytes(ExtensionGroupScanState *state, Size size);
+static void StoreGroupScanEntry(ExtensionGroupScanState *state, GroupScanEntry *entry,
+								TupleTableSlot *slot);
+
+static inline GroupScanEntry *
+GetGroupScanEntry(ExtensionGroupScanState *state, uint64 index)
+{
+	return (GroupScanEntry *) (state->entries + index * state->entrySize);
+}
+
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+/* Declaration of extensibility paths for the group scan (See extensible.h) */
+static const struct CustomPathMethods ExtensionGroupScanPathMethods = {
+	.CustomName = "DocumentDBApiGroupScan",
+	.PlanCustomPath = ExtensionGroupScanPlanCustomPath,
+};
+
+static const struct CustomScanMethods ExtensionGroupScanMethods = {
+	.CustomName = "DocumentDBApiGroupScan",
+	.CreateCustomScanState = ExtensionGroupScanCreateCustomScanState
+};
+
+static const struct CustomExecMethods ExtensionGroupScanExecuteMethods = {
+	.CustomName = "DocumentDBApiGroupScan",
+	.BeginCustomScan = ExtensionGroupScanBeginCustomScan,
+	.ExecCustomScan = ExtensionGroupScanExecCustomScan,
+	.EndCustomScan = ExtensionGroupScanEndCustomScan,
+	.ReScanCustomScan = ExtensionGroupScanReScanCustomScan,
+	.ExplainCustomScan = ExtensionGroupScanExplainCustomScan,
+};
+
+static const ExtensibleNodeMethods InputGroupScanStateMethods =
+{
+	InputGroupScanNodeName,
+	sizeof(InputGroupScanState),
+	CopyNodeInputGroupScanState,
+	EqualUnsupportedExtensionGroupScanNode,
+	OutInputGroupScanNode,
+	ReadUnsupportedExtensionGroupScanNode
+};
+
+
+/*
+ * Registers any custom nodes that the group scan produces.
+ * This is for any items present in the custom_private field.
+ */
+void
+RegisterGroupScanNodes(void)
+{
+	RegisterExtensibleNodeMethods(&InputGroupScanStateMethods);
+}
+
+
+/*
+ * Replaces the paths of the aggregation of a $group with the group scan,
+ * when the aggregation is a single bson_group_accumulators grouped by its
+ * _id as HandleGroup generates it for fused accumulators. The rest of the
+ * target list can only be constants.
+ */
+void
+AddExtensionGroupScanForGroupAggregate(PlannerInfo *root, RelOptInfo *inputRel,
+									   RelOptInfo *outputRel)
+{
+	Query *parse = root->parse;
+	if (list_length(parse->groupClause) != 1 || parse->groupingSets != NIL ||
+		parse->havingQual != NULL || outputRel->pathlist == NIL ||
+		inputRel->cheapest_total_path == NULL)
+	{
+		return;
+	}
+
+	SortGroupClause *groupClause = linitial(parse->groupClause);
+	PathTarget *outputTarget = outputRel->reltarget;
+
+	Expr *groupExpr = NULL;
+	Aggref *accumulatorsAggref = NULL;
+	int index = 0;
+	ListCell *cell;
+	foreach(cell, outputTarget->exprs)
+	{
+		Expr *expr = (Expr *) lfirst(cell);
+		Index sortGroupRef = outputTarget->sortgrouprefs != NULL ?
+							 outputTarget->sortgrouprefs[index] : 0;
+		index++;
+
+		if (sortGroupRef != 0 && sortGroupRef == groupClause->tleSortGroupRef)
+		{
+			groupExpr = expr;
+		}
+		else if (IsA(expr, Aggref) && accumulatorsAggref == NULL &&
+				 ((Aggref *) expr)->aggfnoid ==
+				 BsonGroupAccumulatorsAggregateFunctionOid())
+		{
+			accumulatorsAggref = (Aggref *) expr;
+		}
+		else if (!IsA(expr, Const))
+		{
+			return;
+		}
+	}
+
+	if (groupExpr == NULL || accumulatorsAggref == NULL ||
+		accumulatorsAggref->aggfilter != NULL ||
+		accumulatorsAggref->aggorder != NIL ||
+		accumulatorsAggref->aggdistinct != NIL ||
+		list_length(accumulatorsAggref->args) != 3)
+	{
+		return;
+	}
+
+	/* bson_group_accumulators(<_id>, <document>, <spec>) */
+	TargetEntry *groupIdArg = linitial(accumulatorsAggref->args);
+	TargetEntry *documentArg = lsecond(accumulatorsAggref->args);
+	TargetEntry *specArg = lthird(accumulatorsAggref->args);
+	if (!equal(groupIdArg->expr, groupExpr) || !IsA(specArg->expr, Const) ||
+		((Const *) specArg->expr)->constisnull)
+	{
+		return;
+	}
+
+	Path *inputPath = inputRel->cheapest_total_path;
+	AttrNumber groupIdAttributeNumber =
+		GetPathTargetAttributeNumber(inputPath->pathtarget, groupExpr);
+	AttrNumber documentAttributeNumber =
+		GetPathTargetAttributeNumber(inputPath->pathtarget, documentArg->expr);
+	if (groupIdAttributeNumber == InvalidAttrNumber ||
+		documentAttributeNumber == InvalidAttrNumber)
+	{
+		return;
+	}
+
+	InputGroupScanState *inputState = palloc0(sizeof(InputGroupScanState));
+	inputState->extensible.type = T_ExtensibleNode;
+	inputState->extensible.extnodename = InputGroupScanNodeName;
+	inputState->accumulatorsSpec = DatumGetPgBson(((Const *) specArg->expr)->constvalue);
+	inputState->groupIdAttributeNumber = groupIdAttributeNumber;
+	inputState->documentAttributeNumber = documentAttributeNumber;
+
+	/* The number of groups as estimated for the aggregation paths */
+	double numGroups = ((Path *) linitial(outputRel->pathlist))->rows;
+
+	CustomPath *customPath = makeNode(CustomPath);
+	customPath->methods = &ExtensionGroupScanPathMethods;
+
+	Path *path = &customPath->path;
+	path->pathtype = T_CustomScan;
+	path->parent = outputRel;
+	path->pathtarget = outputTarget;
+
+	/* we don't support lateral joins here so required outer is 0 */
+	path->param_info = NULL;
+
+	/* The input state can't be read by parallel workers */
+	path->parallel_aware = false;
+	path->parallel_safe = false;
+	path->parallel_workers = 0;
+
+	/* Every input row is hashed before the first group is returned */
+	path->rows = numGroups;
+	path->startup_cost = inputPath->total_cost + cpu_operator_cost * inputPath->rows;
+	path->total_cost = path->startup_cost + cpu_tuple_cost * numGroups;
+	path->pathkeys = NIL;
+
+	customPath->custom_paths = list_make1(inputPath);
+
+#if (PG_VERSION_NUM >= 150000)
+
+	/* necessary to avoid extra Result node in PG15 */
+	customPath->flags = CUSTOMPATH_SUPPORT_PROJECTION;
+#endif
+
+	/* Store the input state to be used later.
+	 * NOTE: Anything added here must be of type ExtensibleNode and must be registered
+	 * with the RegisterGroupScanNodes method above.
+	 */
+	customPath->custom_private = list_make1(inputState);
+
+	/* The group scan is opted into, it replaces the HashAgg and GroupAgg paths */
+	outputRel->pathlist = list_make1(customPath);
+	outputRel->partial_pathlist = NIL;
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods */
+/* --------------------------------------------------------- */
+
+/*
+ * Given the group scan path, generates its Custom Plan. The scan tuple
+ * holds the values of the target list of the aggregation: the _id, the
+ * output of bson_group_accumulators and the constants, as described by
+ * the custom_scan_tlist, and the target list is computed from it.
+ */
+static Plan *
+ExtensionGroupScanPlanCustomPath(PlannerInfo *root,
+								 RelOptInfo *rel,
+								 struct CustomPath *best_path,
+								 List *tlist,
+								 List *clauses,
+								 List *custom_plans)
+{
+	CustomScan *cscan = makeNode(CustomScan);
+
+	/* Initialize and copy necessary data */
+	cscan->methods = &ExtensionGroupScanMethods;
+	cscan->custom_private = best_path->custom_private;
+	cscan->custom_plans = custom_plans;
+
+	/* There should only be 1 plan here */
+	Assert(list_length(custom_plans) == 1);
+
+	/* The group scan doesn't scan a relation */
+	cscan->scan.scanrelid = 0;
+	cscan->scan.plan.targetlist = tlist;
+	cscan->custom_scan_tlist = copyObject(tlist);
+
+#if (PG_VERSION_NUM >= 150000)
+
+	/* necessary to avoid extra Result node in PG15 */
+	cscan->flags = CUSTOMPATH_SUPPORT_PROJECTION;
+#endif
+
+	return (Plan *) cscan;
+}
+
+
+/*
+ * Given a custom scan generated during the plan phase
+ * Creates a Custom ScanState that is used during the
+ * execution of the plan.
+ */
+static Node *
+ExtensionGroupScanCreateCustomScanState(CustomScan *cscan)
+{
+	ExtensionGroupScanState *groupScanState = (ExtensionGroupScanState *) newNode(
+		sizeof(ExtensionGroupScanState), T_CustomScanState);
+
+	CustomScanState *cscanstate = &groupScanState->custom_scanstate;
+	cscanstate->methods = &ExtensionGroupScanExecuteMethods;
+	cscanstate->custom_ps = NIL;
+
+	/* The inner plan is initialized as part of BeginCustomScan */
+	groupScanState->innerPlan = (Plan *) linitial(cscan->custom_plans);
+	groupScanState->inputState = (InputGroupScanState *) linitial(cscan->custom_private);
+
+	/* The aggregation target list only has the _id, the aggregate and constants */
+	groupScanState->numColumns = list_length(cscan->custom_scan_tlist);
+	groupScanState->columns = palloc0(sizeof(GroupScanColumn) *
+									  Max(groupScanState->numColumns, 1));
+
+	int index = 0;
+	ListCell *cell;
+	foreach(cell, cscan->custom_scan_tlist)
+	{
+		TargetEntry *entry = lfirst(cell);
+		GroupScanColumn *column = &groupScanState->columns[index++];
+		if (IsA(entry->expr, Aggref))
+		{
+			column->kind = GroupScanColumnKind_Accumulators;
+		}
+		else if (IsA(entry->expr, Const))
+		{
+			column->kind = GroupScanColumnKind_Constant;
+			column->constValue = ((Const *) entry->expr)->constvalue;
+			column->constIsNull = ((Const *) entry->expr)->constisnull;
+		}
+		else
+		{
+			column->kind = GroupScanColumnKind_GroupId;
+		}
+	}
+
+	return (Node *) cscanstate;
+}
+
+
+static void
+ExtensionGroupScanBeginCustomScan(CustomScanState *node, EState *estate, int eflags)
+{
+	ExtensionGroupScanState *state = (ExtensionGroupScanState *) node;
+
+	state->innerPlanState = ExecInitNode(state->innerPlan, estate, eflags);
+
+	/* Store the inner state here so that EXPLAIN works */
+	state->custom_scanstate.custom_ps = list_make1(state->innerPlanState);
+
+	ParseGroupAccumulatorsSpec(&state->spec, state->inputState->accumulatorsSpec);
+
+	int numAccumulators = state->spec.numAccumulators;
+	state->valueKeys = palloc0(sizeof(char *) * Max(numAccumulators, 1));
+	for (int i = 0; i < numAccumulators; i++)
+	{
+		state->valueKeys[i] = psprintf("%d", i);
+	}
+
+	state->entrySize = MAXALIGN(offsetof(GroupScanEntry, values) +
+								sizeof(GroupAccumulatorValue) * numAccumulators);
+	state->memoryLimit = get_hash_memory_limit();
+
+	state->tableContext = AllocSetContextCreate(CurrentMemoryContext,
+												"DocumentDBGroupScanTable",
+												ALLOCSET_DEFAULT_SIZES);
+	state->rowContext = AllocSetContextCreate(CurrentMemoryContext,
+											  "DocumentDBGroupScanRow",
+											  ALLOCSET_DEFAULT_SIZES);
+	initStringInfo(&state->encodedKey);
+
+	InitializeGroupScanTable(state);
+}
+
+
+static TupleTableSlot *
+ExtensionGroupScanExecCustomScan(CustomScanState *node)
+{
+	/*
+	 * Call ExecScan with the next/recheck methods. This handles
+	 * the projection of the target list from the scan tuple.
+	 */
+	return ExecScan(&node->ss, (ExecScanAccessMtd) ExtensionGroupScanNext,
+					(ExecScanRecheckMtd) ExtensionGroupScanNextRecheck);
+}
+
+
+/*
+ * Returns the next group: aggregates the input into the table on the first
+ * call, returns its groups and then does the same for every spilled partition.
+ */
+static TupleTableSlot *
+ExtensionGroupScanNext(CustomScanState *node)
+{
+	ExtensionGroupScanState *state = (ExtensionGroupScanState *) node;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+	while (true)
+	{
+		if (!state->isTableFilled)
+		{
+			if (!state->isInputConsumed)
+			{
+				FillGroupScanTableFromInput(state);
+				state->isInputConsumed = true;
+			}
+			else if (state->pendingPartitions != NIL)
+			{
+				GroupScanPartition *partition = linitial(state->pendingPartitions);
+				state->pendingPartitions = list_delete_first(state->pendingPartitions);
+				FillGroupScanTableFromPartition(state, partition);
+			}
+			else
+			{
+				/* We're done, so return an empty slot */
+				return ExecClearTuple(slot);
+			}
+
+			state->isTableFilled = true;
+			state->nextEntryIndex = 0;
+		}
+
+		while (state->nextEntryIndex < state->capacity)
+		{
+			GroupScanEntry *entry = GetGroupScanEntry(state, state->nextEntryIndex++);
+			if (entry->isUsed)
+			{
+				StoreGroupScanEntry(state, entry, slot);
+				return slot;
+			}
+		}
+
+		/* Every group of the batch was returned, continue with the spilled rows */
+		ResetGroupScanTable(state);
+		state->isTableFilled = false;
+	}
+}
+
+
+static bool
+ExtensionGroupScanNextRecheck(ScanState *state, TupleTableSlot *slot)
+{
+	ereport(ERROR, (errmsg("Recheck is unexpected on Custom Scan")));
+}
+
+
+static void
+ExtensionGroupScanEndCustomScan(CustomScanState *node)
+{
+	ExtensionGroupScanState *state = (ExtensionGroupScanState *) node;
+
+	if (state->tapeSet != NULL)
+	{
+		LogicalTapeSetClose(state->tapeSet);
+		state->tapeSet = NULL;
+	}
+
+	MemoryContextDelete(state->tableContext);
+	MemoryContextDelete(state->rowContext);
+	ExecEndNode(state->innerPlanState);
+}
+
+
+static void
+ExtensionGroupScanReScanCustomScan(CustomScanState *node)
+{
+	ExtensionGroupScanState *state = (ExtensionGroupScanState *) node;
+
+	/* The groups are rebuilt from the input */
+	if (state->tapeSet != NULL)
+	{
+		LogicalTapeSetClose(state->tapeSet);
+		state->tapeSet = NULL;
+	}
+
+	state->spillPartitions = NULL;
+	state->pendingPartitions = NIL;
+	state->isInputConsumed = false;
+	state->isTableFilled = false;
+	ResetGroupScanTable(state);
+
+	ExecReScan(state->innerPlanState);
+}
+
+
+static void
+ExtensionGroupScanExplainCustomScan(CustomScanState *node, List *ancestors,
+									ExplainState *es)
+{
+	ExtensionGroupScanState *state = (ExtensionGroupScanState *) node;
+	if (!es->analyze)
+	{
+		return;
+	}
+
+	ExplainPropertyInteger("Batches", NULL, state->numBatches, es);
+	ExplainPropertyInteger("Peak Memory Usage", "kB",
+						   (state->peakMemory + 1023) / 1024, es);
+	if (state->numSpilledRows > 0)
+	{
+		ExplainPropertyInteger("Spilled Rows", NULL, state->numSpilledRows, es);
+	}
+
+	if (state->tapeSet != NULL)
+	{
+		ExplainPropertyInteger("Disk Usage", "kB",
+							   LogicalTapeSetBlocks(state->tapeSet) * (BLCKSZ / 1024),
+							   es);
+	}
+}
+
+
+/*
+ * Returns the attribute number of the expression in the output of a path
+ * with the target, InvalidAttrNumber if it isn't in the target.
+ */
+static AttrNumber
+GetPathTargetAttributeNumber(PathTarget *target, Expr *expr)
+{
+	AttrNumber attributeNumber = 1;
+	ListCell *cell;
+	foreach(cell, target->exprs)
+	{
+		if (equal(lfirst(cell), expr))
+		{
+			return attributeNumber;
+		}
+
+		attributeNumber++;
+	}
+
+	return InvalidAttrNumber;
+}
+
+
+/*
+ * Aggregates the rows of the inner plan into the table, the first batch.
+ */
+static void
+FillGroupScanTableFromInput(ExtensionGroupScanState *state)
+{
+	InputGroupScanState *inputState = state->inputState;
+	state->spillDepth = 0;
+	state->numBatches++;
+
+	while (true)
+	{
+		TupleTableSlot *innerSlot = ExecProcNode(state->innerPlanState);
+		if (TupIsNull(innerSlot))
+		{
+			break;
+		}
+
+		MemoryContextReset(state->rowContext);
+		MemoryContext oldContext = MemoryContextSwitchTo(state->rowContext);
+
+		bool isNull = false;
+		Datum groupIdDatum = slot_getattr(innerSlot, inputState->groupIdAttributeNumber,
+										  &isNull);
+		pgbson *groupId = isNull ? NULL : DatumGetPgBson(groupIdDatum);
+
+		Datum documentDatum = slot_getattr(innerSlot,
+										   inputState->documentAttributeNumber,
+										   &isNull);
+
+		/* Like the transition function, a NULL document accumulates nothing */
+		const bson_value_t *values = NULL;
+		if (!isNull)
+		{
+			EvaluateGroupAccumulatorValues(&state->spec, DatumGetPgBson(documentDatum));
+			values = state->spec.accumulatorValues;
+		}
+
+		AddGroupScanRow(state, groupId, values);
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	FinishGroupScanBatch(state);
+}
+
+
+/*
+ * Aggregates the rows spilled to the partition into the table. The rows are
+ * documents { "i": <groupId>, "v": { "<index>": <value>, ... } } written by
+ * SpillGroupScanRow.
+ */
+static void
+FillGroupScanTableFromPartition(ExtensionGroupScanState *state,
+								GroupScanPartition *partition)
+{
+	state->spillDepth = partition->spillDepth;
+	state->numBatches++;
+
+	int numAccumulators = state->spec.numAccumulators;
+	bson_value_t *values = state->spec.accumulatorValues;
+
+	uint32 header;
+	while (LogicalTapeRead(partition->tape, &header, VARHDRSZ) == VARHDRSZ)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		MemoryContextReset(state->rowContext);
+		MemoryContext oldContext = MemoryContextSwitchTo(state->rowContext);
+
+		Size rowSize = VARSIZE(&header);
+		pgbson *row = palloc(rowSize);
+		memcpy(row, &header, VARHDRSZ);
+		if (LogicalTapeRead(partition->tape, VARDATA(row), rowSize - VARHDRSZ) !=
+			rowSize - VARHDRSZ)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
+							errmsg("Unexpected end of the spilled rows of $group")));
+		}
+
+		for (int i = 0; i < numAccumulators; i++)
+		{
+			values[i].value_type = BSON_TYPE_EOD;
+		}
+
+		pgbson *groupId = NULL;
+		bool hasValues = false;
+		bson_iter_t rowIter;
+		PgbsonInitIterator(row, &rowIter);
+		while (bson_iter_next(&rowIter))
+		{
+			const char *key = bson_iter_key(&rowIter);
+			if (strcmp(key, "i") == 0)
+			{
+				groupId = PgbsonInitFromDocumentBsonValue(bson_iter_value(&rowIter));
+			}
+			else if (strcmp(key, "v") == 0)
+			{
+				hasValues = true;
+
+				bson_iter_t valuesIter;
+				BsonValueInitIterator(bson_iter_value(&rowIter), &valuesIter);
+				while (bson_iter_next(&valuesIter))
+				{
+					int index = pg_strtoint32(bson_iter_key(&valuesIter));
+					values[index] = *bson_iter_value(&valuesIter);
+				}
+			}
+		}
+
+		AddGroupScanRow(state, groupId, hasValues ? values : NULL);
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	LogicalTapeClose(partition->tape);
+	pfree(partition);
+
+	FinishGroupScanBatch(state);
+}
+
+
+/*
+ * Adds the values of a row to the accumulators of its group, creating the
+ * group if it is new. When the batch is over the memory limit rows of new
+ * groups are spilled instead.
+ */
+static void
+AddGroupScanRow(ExtensionGroupScanState *state, pgbson *groupId,
+				const bson_value_t *values)
+{
+	/* SQL NULLs have an empty encoding, values always have a type */
+	resetStringInfo(&state->encodedKey);
+	if (groupId != NULL)
+	{
+		bson_value_t groupIdValue = ConvertPgbsonToBsonValue(groupId);
+		AppendBsonValueComparableEncoding(&state->encodedKey, &groupIdValue);
+	}
+
+	uint32 hash = hash_bytes((const unsigned char *) state->encodedKey.data,
+							 state->encodedKey.len);
+
+	bool found = false;
+	GroupScanEntry *entry = FindGroupScanEntry(state, hash, state->encodedKey.data,
+											   state->encodedKey.len, &found);
+	if (!found)
+	{
+		if (state->spillPartitions != NULL)
+		{
+			SpillGroupScanRow(state, hash, groupId, values);
+			return;
+		}
+
+		entry = InsertGroupScanEntry(state, hash, groupId);
+	}
+
+	if (values != NULL)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(state->tableContext);
+		for (int i = 0; i < state->spec.numAccumulators; i++)
+		{
+			AccumulateGroupValue(state->spec.outputs[i].kind, &entry->values[i],
+								 &values[i], 1);
+		}
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	if (!found)
+	{
+		CheckGroupScanMemory(state);
+	}
+}
+
+
+/*
+ * Writes the row to the partition of its hash. The bits of the hash used
+ * are the ones after those of the partitions the row was already in.
+ */
+static void
+SpillGroupScanRow(ExtensionGroupScanState *state, uint32 hash, pgbson *groupId,
+				  const bson_value_t *values)
+{
+	int shift = 32 - (state->spillDepth + 1) * GROUP_SCAN_SPILL_PARTITION_BITS;
+	GroupScanPartition *partition =
+		&state->spillPartitions[(hash >> shift) & (GROUP_SCAN_SPILL_PARTITIONS - 1)];
+
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+	if (groupId != NULL)
+	{
+		PgbsonWriterAppendDocument(&writer, "i", 1, groupId);
+	}
+
+	if (values != NULL)
+	{
+		/* Empty values can't be written, they are the ones missing */
+		pgbson_writer valuesWriter;
+		PgbsonWriterStartDocument(&writer, "v", 1, &valuesWriter);
+		for (int i = 0; i < state->spec.numAccumulators; i++)
+		{
+			if (values[i].value_type != BSON_TYPE_EOD)
+			{
+				PgbsonWriterAppendValue(&valuesWriter, state->valueKeys[i],
+										strlen(state->valueKeys[i]), &values[i]);
+			}
+		}
+
+		PgbsonWriterEndDocument(&writer, &valuesWriter);
+	}
+
+	pgbson *row = PgbsonWriterGetPgbson(&writer);
+	LogicalTapeWrite(partition->tape, row, VARSIZE(row));
+
+	partition->numRows++;
+	state->numSpilledRows++;
+}
+
+
+/*
+ * Ends the batch: the partitions rows were spilled to are queued to be
+ * aggregated after the groups of the batch are returned.
+ */
+static void
+FinishGroupScanBatch(ExtensionGroupScanState *state)
+{
+	if (state->spillPartitions == NULL)
+	{
+		return;
+	}
+
+	for (int i = 0; i < GROUP_SCAN_SPILL_PARTITIONS; i++)
+	{
+		GroupScanPartition *spillPartition = &state->spillPartitions[i];
+		if (spillPartition->numRows == 0)
+		{
+			LogicalTapeClose(spillPartition->tape);
+			continue;
+		}
+
+		LogicalTapeRewindForRead(spillPartition->tape, BLCKSZ);
+
+		GroupScanPartition *partition = palloc(sizeof(GroupScanPartition));
+		*partition = *spillPartition;
+		state->pendingPartitions = lappend(state->pendingPartitions, partition);
+	}
+
+	pfree(state->spillPartitions);
+	state->spillPartitions = NULL;
+}
+
+
+/*
+ * Starts spilling the rows of new groups when the table is over the memory
+ * limit. Once all the bits of the hash have been used to partition the
+ * rows, they can't be split further and the table is let to grow.
+ */
+static void
+CheckGroupScanMemory(ExtensionGroupScanState *state)
+{
+	Size memory = MemoryContextMemAllocated(state->tableContext, true);
+	state->peakMemory = Max(state->peakMemory, memory);
+
+	if (memory <= state->memoryLimit || state->spillPartitions != NULL ||
+		(state->spillDepth + 1) * GROUP_SCAN_SPILL_PARTITION_BITS > 32)
+	{
+		return;
+	}
+
+	if (state->tapeSet == NULL)
+	{
+		state->tapeSet = LogicalTapeSetCreate(false, NULL, -1);
+	}
+
+	state->spillPartitions = palloc0(sizeof(GroupScanPartition) *
+									 GROUP_SCAN_SPILL_PARTITIONS);
+	for (int i = 0; i < GROUP_SCAN_SPILL_PARTITIONS; i++)
+	{
+		state->spillPartitions[i].tape = LogicalTapeCreate(state->tapeSet);
+		state->spillPartitions[i].spillDepth = state->spillDepth + 1;
+	}
+}
+
+
+static void
+InitializeGroupScanTable(ExtensionGroupScanState *state)
+{
+	state->capacity = GROUP_SCAN_INITIAL_CAPACITY;
+	state->numEntries = 0;
+	state->entries = MemoryContextAllocZero(state->tableContext,
+											state->capacity * state->entrySize);
+	state->blockNext = NULL;
+	state->blockEnd = NULL;
+}
+
+
+/*
+ * Drops every group, their keys and values, for the next batch.
+ */
+static void
+ResetGroupScanTable(ExtensionGroupScanState *state)
+{
+	MemoryContextReset(state->tableContext);
+	InitializeGroupScanTable(state);
+}
+
+
+/*
+ * Returns the entry of the group with the encoded key if it is in the table,
+ * and otherwise the free entry it would be inserted in.
+ */
+static GroupScanEntry *
+FindGroupScanEntry(ExtensionGroupScanState *state, uint32 hash, const char *encodedKey,
+				   uint32 encodedKeyLength, bool *found)
+{
+	uint64 mask = state->capacity - 1;
+	uint64 index = hash & mask;
+	while (true)
+	{
+		GroupScanEntry *entry = GetGroupScanEntry(state, index);
+		if (!entry->isUsed)
+		{
+			*found = false;
+			return entry;
+		}
+
+		if (entry->hash == hash && entry->encodedKeyLength == encodedKeyLength &&
+			memcmp(entry->encodedKey, encodedKey, encodedKeyLength) == 0)
+		{
+			*found = true;
+			return entry;
+		}
+
+		index = (index + 1) & mask;
+	}
+}
+
+
+/*
+ * Adds the group of the encoded key in state->encodedKey to the table, which
+ * doesn't have it, with empty accumulators.
+ */
+static GroupScanEntry *
+InsertGroupScanEntry(ExtensionGroupScanState *state, uint32 hash, pgbson *groupId)
+{
+	/* Keep the table at most 3/4 full */
+	if ((state->numEntries + 1) * 4 > state->capacity * 3)
+	{
+		GrowGroupScanTable(state);
+	}
+
+	bool found = false;
+	GroupScanEntry *entry = FindGroupScanEntry(state, hash, state->encodedKey.data,
+											   state->encodedKey.len, &found);
+	Assert(!found);
+
+	char *encodedKey = AllocateGroupScanBytes(state, state->encodedKey.len);
+	memcpy(encodedKey, state->encodedKey.data, state->encodedKey.len);
+
+	entry->isUsed = true;
+	entry->hash = hash;
+	entry->encodedKey = encodedKey;
+	entry->encodedKeyLength = state->encodedKey.len;
+	entry->groupId = NULL;
+	if (groupId != NULL)
+	{
+		entry->groupId = AllocateGroupScanBytes(state, VARSIZE(groupId));
+		memcpy(entry->groupId, groupId, VARSIZE(groupId));
+	}
+
+	InitializeGroupAccumulatorValues(entry->values, state->spec.outputs,
+									 state->spec.numAccumulators);
+	state->numEntries++;
+	return entry;
+}
+
+
+/*
+ * Doubles the capacity of the table. The entries are moved as is, their
+ * keys and values stay where they are.
+ */
+static void
+GrowGroupScanTable(ExtensionGroupScanState *state)
+{
+	uint64 newCapacity = state->capacity * 2;
+	if (newCapacity * state->entrySize > MaxAllocHugeSize)
+	{
+		ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						errmsg("Too many groups in $group: " UINT64_FORMAT,
+							   state->numEntries)));
+	}
+
+	char *oldEntries = state->entries;
+	uint64 oldCapacity = state->capacity;
+
+	state->entries = MemoryContextAllocExtended(state->tableContext,
+												newCapacity * state->entrySize,
+												MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+	state->capacity = newCapacity;
+
+	uint64 mask = newCapacity - 1;
+	for (uint64 i = 0; i < oldCapacity; i++)
+	{
+		GroupScanEntry *oldEntry = (GroupScanEntry *) (oldEntries + i * state->entrySize);
+		if (!oldEntry->isUsed)
+		{
+			continue;
+		}
+
+		uint64 index = oldEntry->hash & mask;
+		while (GetGroupScanEntry(state, index)->isUsed)
+		{
+			index = (index + 1) & mask;
+		}
+
+		memcpy(GetGroupScanEntry(state, index), oldEntry, state->entrySize);
+	}
+
+	pfree(oldEntries);
+}
+
+
+/*
+ * Allocates bytes for the keys and _ids of groups, from blocks in the table
+ * context rather than a chunk per group.
+ */
+static void *
+AllocateGroupScanBytes(ExtensionGroupScanState *state, Size size)
+{
+	size = MAXALIGN(size);
+	if (state->blockNext == NULL || (Size) (state->blockEnd - state->blockNext) < size)
+	{
+		Size blockSize = Max(GROUP_SCAN_BLOCK_SIZE, size);
+		state->blockNext = MemoryContextAlloc(state->tableContext, blockSize);
+		state->blockEnd = state->blockNext + blockSize;
+	}
+
+	void *bytes = state->blockNext;
+	state->blockNext += size;
+	return bytes;
+}
+
+
+/*
+ * Stores the columns of the group in the scan slot. The output document is
+ * built in the per tuple memory, which ExecScan resets for the next group.
+ */
+static void
+StoreGroupScanEntry(ExtensionGroupScanState *state, GroupScanEntry *entry,
+					TupleTableSlot *slot)
+{
+	ExecClearTuple(slot);
+
+	ExprContext *econtext = state->custom_scanstate.ss.ps.ps_ExprContext;
+	MemoryContext oldContext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	for (int i = 0; i < state->numColumns; i++)
+	{
+		const GroupScanColumn *column = &state->columns[i];
+		switch (column->kind)
+		{
+			case GroupScanColumnKind_GroupId:
+			{
+				slot->tts_values[i] = PointerGetDatum(entry->groupId);
+				slot->tts_isnull[i] = entry->groupId == NULL;
+				break;
+			}
+
+			case GroupScanColumnKind_Accumulators:
+			{
+				pgbson *document = BuildGroupAccumulatorsDocument(
+					entry->groupId, state->spec.outputs, entry->values,
+					state->spec.numAccumulators);
+				slot->tts_values[i] = PointerGetDatum(document);
+				slot->tts_isnull[i] = false;
+				break;
+			}
+
+			case GroupScanColumnKind_Constant:
+			default:
+			{
+				slot->tts_values[i] = column->constValue;
+				slot->tts_isnull[i] = column->constIsNull;
+				break;
+			}
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	ExecStoreVirtualTuple(slot);
+}
+
+
+/*
+ * Support for comparing two Scan extensible nodes
+ * Currently insupported.
+ */
+static bool
+EqualUnsupportedExtensionGroupScanNode(const struct ExtensibleNode *a,
+									   const struct ExtensibleNode *b)
+{
+	ereport(ERROR, (errmsg("Equal for node type CustomGroupScan not implemented")));
+}
+
+
+/*
+ * Support for Copying the InputGroupScanState node
+ */
+static void
+CopyNodeInputGroupScanState(struct ExtensibleNode *target_node, const struct
+							ExtensibleNode *source_node)
+{
+	InputGroupScanState *from = (InputGroupScanState *) source_node;
+
+	InputGroupScanState *newNode = (InputGroupScanState *) target_node;
+	newNode->extensible.type = T_ExtensibleNode;
+	newNode->extensible.extnodename = InputGroupScanNodeName;
+	newNode->accumulatorsSpec = PgbsonCloneFromPgbson(from->accumulatorsSpec);
+	newNode->groupIdAttributeNumber = from->groupIdAttributeNumber;
+	newNode->documentAttributeNumber = from->documentAttributeNumber;
+}
+
+
+/*
+ * Support for Outputing the InputGroupScanState node
+ */
+static void
+OutInputGroupScanNode(StringInfo str, const struct ExtensibleNode *raw_node)
+{
+	const InputGroupScanState *node = (const InputGroupScanState *) raw_node;
+	appendStringInfo(str, " :groupIdAttributeNumber %d :documentAttributeNumber %d",
+					 node->groupIdAttributeNumber, node->documentAttributeNumber);
+}
+
+
+/*
+ * Function for reading DocumentDBApiGroupScan node (unsupported)
+ */
+static void
+ReadUnsupportedExtensionGroupScanNode(struct ExtensibleNode *node)
+{
+	ereport(ERROR, (errmsg("Read for node type CustomGroupScan not implemented")));
+}
@@ -27,6 +27,8 @@
 #include "configs/config_initialization.h"
 #include "index_am/documentdb_rum.h"
 #include "infrastructure/cursor_store.h"
+#include "pisa_integration/query_cache.h"
+#include "infrastructure/query_shape_cache.h"
 
 /* --------------------------------------------------------- */
 /* Data Types & Enum values */
@@ -92,12 +94,17 @@ InstallDocumentDBApiPostgresHooks(void)
 	ExtensionPreviousSetRelPathlistHook = set_rel_pathlist_hook;
 	set_rel_pathlist_hook = ExtensionRelPathlistHook;
 
+	/* add the paths of custom scans for upper relations, e.g. the group scan */
+	ExtensionPreviousCreateUpperPathsHook = create_upper_paths_hook;
+	create_upper_paths_hook = ExtensionCreateUpperPathsHook;
+
 	RegisterXactCallback(DocumentDBTransactionCallback, NULL);
 	RegisterSubXactCallback(DocumentDBSubTransactionCallback, NULL);
 
 	RegisterScanNodes();
 	RegisterQueryScanNodes();
 	RegisterExplainScanNodes();
+	RegisterGroupScanNodes();
 
 	/* Load the rum routine in the shared_preload_libraries to avoid LoadLibrary calls all the time */
 	LoadRumRoutine();
@@ -153,6 +160,9 @@ UninstallDocumentDBApiPostgresHooks(void)
 	set_rel_pathlist_hook = ExtensionPreviousSetRelPathlistHook;
 	ExtensionPreviousSetRelPathlistHook = NULL;
 
+	create_upper_paths_hook = ExtensionPreviousCreateUpperPathsHook;
+	ExtensionPreviousCreateUpperPathsHook = NULL;
+
 	UnregisterXactCallback(DocumentDBTransactionCallback, NULL);
 	UnregisterSubXactCallback(DocumentDBSubTransactionCallback, NULL);
 }
@@ -184,6 +194,8 @@ DocumentDBSharedMemoryRequest(void)
 	RequestAddinShmemSpace(SharedFeatureCounterShmemSize());
 	RequestAddinShmemSpace(VersionCacheShmemSize());
 	RequestAddinShmemSpace(FileCursorShmemSize());
+	RequestAddinShmemSpace(PisaQueryCacheShmemSize());
+	RequestAddinShmemSpace(QueryShapeCacheShmemSize());
 }
 
 
@@ -194,6 +206,8 @@ DocumentDBSharedMemoryInit(void)
 	SharedFeatureCounterShmemInit();
 	InitializeVersionCache();
 	InitializeFileCursorShmem();
+	InitializePisaQueryCacheShmem();
+	InitializeQueryShapeCacheShmem();
 
 	if (prev_shmem_startup_hook != NULL)
 	{
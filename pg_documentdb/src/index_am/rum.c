@@ -31,6 +31,7 @@
 #include "index_am/index_am_utils.h"
 #include "opclass/bson_gin_index_term.h"
 #include "opclass/bson_gin_private.h"
+#include "query/bson_dollar_selectivity.h"
 
 extern bool ForceUseIndexIfAvailable;
 extern bool EnableNewCompositeIndexOpclass;
@@ -249,9 +250,42 @@ extension_rumcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
 		return;
 	}
 
-	/* Index is valid - pick the cost estimate for rum (which currently is the gin cost estimate) */
-	gincostestimate(root, path, loop_count, indexStartupCost, indexTotalCost,
-					indexSelectivity, indexCorrelation, indexPages);
+	/*
+	 * Index is valid - pick the cost estimate for rum (which currently is the gin cost estimate).
+	 * The selectivity of the index quals accounts for the dependencies between
+	 * the paths they filter on among themselves, not among all the relation's quals.
+	 * The selectivities cached on the quals were estimated among the relation's
+	 * quals, so they are cleared for the index estimate and restored after it.
+	 */
+	List *indexQuals = get_quals_from_indexclauses(path->indexclauses);
+	Selectivity *cachedSelectivities = palloc(sizeof(Selectivity) *
+											  Max(list_length(indexQuals), 1));
+	ListCell *qualCell;
+	foreach(qualCell, indexQuals)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, qualCell);
+		cachedSelectivities[foreach_current_index(qualCell)] = rinfo->norm_selec;
+		rinfo->norm_selec = -1;
+	}
+
+	List *previousClauses = SetBsonSelectivityClauseContext(indexQuals);
+	PG_TRY();
+	{
+		gincostestimate(root, path, loop_count, indexStartupCost, indexTotalCost,
+						indexSelectivity, indexCorrelation, indexPages);
+	}
+	PG_FINALLY();
+	{
+		SetBsonSelectivityClauseContext(previousClauses);
+		foreach(qualCell, indexQuals)
+		{
+			RestrictInfo *rinfo = lfirst_node(RestrictInfo, qualCell);
+			rinfo->norm_selec = cachedSelectivities[foreach_current_index(qualCell)];
+		}
+	}
+	PG_END_TRY();
+
+	pfree(cachedSelectivities);
 
 	/* Do a pass to check for text indexes (We force push down with cost == 0) */
 	if (ForceUseIndexIfAvailable || IsTextIndexMatch(path))
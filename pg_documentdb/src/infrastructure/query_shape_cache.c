@@ -0,0 +1,1243 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/infrastructure/query_shape_cache.c
+ *
+ * Implementation of a cache of the queries generated for find commands,
+ * keyed by the shape of the find spec.
+ *
+ * The shape of a find spec is the spec with the values compared by
+ * equality at the top level of its filter (e.g. { "_id": 5 } or
+ * { "a": { "$eq": "x" } }) replaced by their type. Each such value is a
+ * slot of the shape. The query generated for the first spec of a shape is
+ * kept as a template, along with the bson constants of the template that
+ * hold slot values. Later specs of the shape copy the template and bind
+ * their values into those constants instead of generating the query again.
+ *
+ * A template is only used once binding the values of a second spec into
+ * it reproduced the query generated for that spec. Whether the template of
+ * a shape is bindable is published in shared memory, keyed by the shape
+ * and a fingerprint of the template, so that backends that connect later
+ * can use their template from the first spec of a shape onwards.
+ *
+ * Templates are dropped on invalidation of any relation they reference,
+ * and on invalidation of the collections metadata.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <postgres.h>
+#include <miscadmin.h>
+#include <math.h>
+#include <funcapi.h>
+#include <common/hashfn.h>
+#include <lib/ilist.h>
+#include <nodes/nodeFuncs.h>
+#include <port/atomics.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <utils/tuplestore.h>
+
+#include "io/bson_core.h"
+#include "io/bson_hash.h"
+#include "query/bson_compare.h"
+#include "metadata/metadata_cache.h"
+#include "commands/commands_common.h"
+#include "infrastructure/query_shape_cache.h"
+
+extern bool EnableQueryShapeCache;
+extern bool EnableNowSystemVariable;
+extern int QueryShapeCacheSizeLimit;
+extern int MaxSharedQueryShapes;
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+/* The maximum number of values of a find spec that are slots of its shape */
+#define QUERY_SHAPE_MAX_SLOTS 32
+
+typedef enum QueryShapeState
+{
+	/* The template has not yet been checked against other values */
+	QueryShapeState_Pending,
+
+	/* Binding values into the template reproduces the generated query */
+	QueryShapeState_Bindable,
+
+	/* The queries of the shape are always generated */
+	QueryShapeState_NotBindable,
+} QueryShapeState;
+
+/* The values of a find spec that are slots of its shape */
+typedef struct QueryShapeSlots
+{
+	int numSlots;
+	StringView paths[QUERY_SHAPE_MAX_SLOTS];
+	bson_value_t values[QUERY_SHAPE_MAX_SLOTS];
+} QueryShapeSlots;
+
+/* A bson constant of a template that holds the value of a slot */
+typedef struct QueryShapeSlotBinding
+{
+	/* position of the constant among the bson constants of the template */
+	int constOrdinal;
+
+	/* the slot whose value the constant holds */
+	int slotIndex;
+
+	/* whether the constant is { "": value } rather than { path: value } */
+	bool hasEmptyPath;
+} QueryShapeSlotBinding;
+
+typedef struct QueryShapeCacheEntry
+{
+	/* key of the entry in the hash, the hash of the shape */
+	uint64 shapeHash;
+
+	/* the shape itself, as hashes may collide */
+	pgbson *shape;
+
+	QueryShapeState state;
+
+	/* memory context holding everything below */
+	MemoryContext context;
+
+	/* the query generated for the first spec of the shape */
+	Query *queryTemplate;
+
+	/* the slot values the template was generated with, as { "0": value, ... } */
+	pgbson *templateValues;
+
+	QueryShapeSlotBinding *bindings;
+	int numBindings;
+
+	/* hash of the template with its slot values removed */
+	uint64 fingerprint;
+
+	/* the query data that generating the template produced */
+	QueryCursorType cursorKind;
+	int cursorStateParamNumber;
+	int32_t batchSize;
+	const char *namespaceName;
+
+	/* the relations the template references */
+	Oid *relationIds;
+	int numRelationIds;
+
+	/* node in the LRU queue */
+	dlist_node lruNode;
+} QueryShapeCacheEntry;
+
+/* State of walking the bson constants of a query */
+typedef struct QueryShapeWalkerContext
+{
+	Oid bsonTypeId;
+	Oid bsonQueryTypeId;
+
+	/* position of the next bson constant */
+	int constOrdinal;
+
+	/* the slots to find (or bind) the values of */
+	QueryShapeSlots *slots;
+
+	QueryShapeSlotBinding *bindings;
+	int numBindings;
+
+	/* when collecting bindings, whether every constant matched one slot at most */
+	bool isBindable;
+
+	/* when collecting bindings, the relations referenced by the query */
+	List *relationIds;
+} QueryShapeWalkerContext;
+
+/* What backends share about a shape */
+typedef struct QueryShapeSharedEntry
+{
+	/* key of the entry in the hash, the hash of the shape */
+	uint64 shapeHash;
+
+	/* fingerprints of the templates found bindable and not bindable */
+	uint64 bindableFingerprint;
+	uint64 notBindableFingerprint;
+
+	/* the number of finds of the shape, and how many of them used a template */
+	pg_atomic_uint64 calls;
+	pg_atomic_uint64 templateHits;
+} QueryShapeSharedEntry;
+
+typedef struct QueryShapeSharedState
+{
+	int trancheId;
+	char *trancheName;
+	LWLock lock;
+} QueryShapeSharedState;
+
+/* --------------------------------------------------------- */
+/* Forward declaration */
+/* --------------------------------------------------------- */
+
+static void InitializeQueryShapeCache(void);
+static pgbson * BuildFindQueryShape(text *database, pgbson *findSpec,
+									QueryData *queryData, bool addCursorParams,
+									bool setStatementTimeout, QueryShapeSlots *slots,
+									bson_value_t *maxTimeMS);
+static void WriteFilterShape(pgbson_writer *writer, bson_iter_t *filterIter,
+							 QueryShapeSlots *slots);
+static bool IsQueryShapeSlotValue(const bson_value_t *value);
+static bool GetDollarEqValue(const bson_value_t *value, bson_value_t *eqValue);
+static Query * BindQueryTemplate(QueryShapeCacheEntry *entry, QueryShapeSlots *slots,
+								 Oid bsonTypeId, Oid bsonQueryTypeId);
+static void CreateQueryShapeEntry(uint64 shapeHash, pgbson *shape,
+								  QueryShapeSlots *slots, Query *query,
+								  QueryData *queryData, Oid bsonTypeId,
+								  Oid bsonQueryTypeId);
+static void VerifyQueryShapeEntry(QueryShapeCacheEntry *entry, QueryShapeSlots *slots,
+								  Query *query, QueryData *queryData,
+								  Oid bsonTypeId, Oid bsonQueryTypeId);
+static uint64 ComputeTemplateFingerprint(QueryShapeCacheEntry *entry, Oid bsonTypeId,
+										 Oid bsonQueryTypeId);
+static bool CollectSlotBindingsWalker(Node *node, QueryShapeWalkerContext *context);
+static bool BindSlotValuesWalker(Node *node, QueryShapeWalkerContext *context);
+static bool IsBsonConst(Const *constNode, QueryShapeWalkerContext *context);
+static void RemoveQueryShapeEntry(QueryShapeCacheEntry *entry);
+static void RemoveOldestQueryShapeEntry(void);
+static QueryShapeState GetSharedQueryShapeState(uint64 shapeHash, uint64 fingerprint);
+static void RecordSharedQueryShapeCall(uint64 shapeHash, bool isTemplateHit);
+static void PublishSharedQueryShapeState(uint64 shapeHash, uint64 fingerprint,
+										 bool isBindable);
+static QueryShapeSharedEntry * EnterSharedQueryShapeEntry(uint64 shapeHash);
+
+PG_FUNCTION_INFO_V1(query_shape_cache_stats);
+
+/* memory context in which the cache is allocated */
+static MemoryContext QueryShapeCacheContext = NULL;
+
+/* hash table of the cached shapes, keyed by the hash of the shape */
+static HTAB *QueryShapeHash = NULL;
+
+/* linked list for keeping track of LRU */
+static dlist_head QueryShapeLRUQueue;
+
+/* number of entries in the cache */
+static int CachedQueryShapeCount = 0;
+
+/* shared state and hash of the shapes of all backends */
+static QueryShapeSharedState *QueryShapeShared = NULL;
+static HTAB *QueryShapeSharedHash = NULL;
+
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+/*
+ * GenerateFindQueryWithShapeCache returns the same query as GenerateFindQuery,
+ * binding the values of the find spec into the template of its shape when
+ * the cache has a bindable one. Feature usage of the stages is not reported
+ * for queries that come from a template.
+ */
+Query *
+GenerateFindQueryWithShapeCache(text *database, pgbson *findSpec, QueryData *queryData,
+								bool addCursorParams, bool setStatementTimeout)
+{
+	/* $$NOW is written into the query as a constant */
+	if (!EnableQueryShapeCache || EnableNowSystemVariable ||
+		QueryShapeCacheSizeLimit <= 0)
+	{
+		return GenerateFindQuery(database, findSpec, queryData, addCursorParams,
+								 setStatementTimeout);
+	}
+
+	QueryShapeSlots slots = { 0 };
+	bson_value_t maxTimeMS = { 0 };
+	pgbson *shape = BuildFindQueryShape(database, findSpec, queryData, addCursorParams,
+										setStatementTimeout, &slots, &maxTimeMS);
+	if (shape == NULL)
+	{
+		return GenerateFindQuery(database, findSpec, queryData, addCursorParams,
+								 setStatementTimeout);
+	}
+
+	InitializeQueryShapeCache();
+
+	/* resolve the types before looking at entries that invalidations could remove */
+	Oid bsonTypeId = BsonTypeId();
+	Oid bsonQueryTypeId = BsonQueryTypeId();
+
+	bson_iter_t shapeIter;
+	PgbsonInitIterator(shape, &shapeIter);
+	uint64 shapeHash = HashBsonComparableExtended(&shapeIter, 0);
+
+	QueryShapeCacheEntry *entry = hash_search(QueryShapeHash, &shapeHash, HASH_FIND,
+											  NULL);
+	if (entry != NULL && !PgbsonEquals(entry->shape, shape))
+	{
+		RemoveQueryShapeEntry(entry);
+		entry = NULL;
+	}
+
+	if (entry != NULL && entry->state == QueryShapeState_Bindable)
+	{
+		dlist_delete(&entry->lruNode);
+		dlist_push_tail(&QueryShapeLRUQueue, &entry->lruNode);
+
+		Query *query = BindQueryTemplate(entry, &slots, bsonTypeId, bsonQueryTypeId);
+
+		queryData->cursorKind = entry->cursorKind;
+		queryData->cursorStateParamNumber = entry->cursorStateParamNumber;
+		queryData->batchSize = entry->batchSize;
+		queryData->namespaceName = pstrdup(entry->namespaceName);
+
+		if (setStatementTimeout && maxTimeMS.value_type != BSON_TYPE_EOD)
+		{
+			SetExplicitStatementTimeout(BsonValueAsInt32(&maxTimeMS));
+		}
+
+		RecordSharedQueryShapeCall(shapeHash, true);
+		return query;
+	}
+
+	bool isNotBindable = entry != NULL &&
+						 entry->state == QueryShapeState_NotBindable;
+	if (isNotBindable)
+	{
+		dlist_delete(&entry->lruNode);
+		dlist_push_tail(&QueryShapeLRUQueue, &entry->lruNode);
+	}
+
+	Query *query = GenerateFindQuery(database, findSpec, queryData, addCursorParams,
+									 setStatementTimeout);
+	RecordSharedQueryShapeCall(shapeHash, false);
+
+	if (isNotBindable)
+	{
+		return query;
+	}
+
+	/* generating the query may have processed invalidations, look the entry up again */
+	entry = hash_search(QueryShapeHash, &shapeHash, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		CreateQueryShapeEntry(shapeHash, shape, &slots, query, queryData, bsonTypeId,
+							  bsonQueryTypeId);
+	}
+	else if (entry->state == QueryShapeState_Pending)
+	{
+		VerifyQueryShapeEntry(entry, &slots, query, queryData, bsonTypeId,
+							  bsonQueryTypeId);
+	}
+
+	return query;
+}
+
+
+/*
+ * InvalidateQueryShapeCache removes the templates referencing the given
+ * relation, or all of them for InvalidOid. Called from the relcache
+ * invalidation callback of the metadata cache.
+ */
+void
+InvalidateQueryShapeCache(Oid relationId)
+{
+	if (QueryShapeHash == NULL)
+	{
+		return;
+	}
+
+	dlist_mutable_iter iter;
+	dlist_foreach_modify(iter, &QueryShapeLRUQueue)
+	{
+		QueryShapeCacheEntry *entry = dlist_container(QueryShapeCacheEntry, lruNode,
+													  iter.cur);
+
+		bool referencesRelation = relationId == InvalidOid;
+		for (int i = 0; i < entry->numRelationIds && !referencesRelation; i++)
+		{
+			referencesRelation = entry->relationIds[i] == relationId;
+		}
+
+		if (referencesRelation)
+		{
+			RemoveQueryShapeEntry(entry);
+		}
+	}
+}
+
+
+Size
+QueryShapeCacheShmemSize(void)
+{
+	if (MaxSharedQueryShapes <= 0)
+	{
+		return 0;
+	}
+
+	Size size = MAXALIGN(sizeof(QueryShapeSharedState));
+	size = add_size(size, hash_estimate_size(MaxSharedQueryShapes,
+											 sizeof(QueryShapeSharedEntry)));
+	return size;
+}
+
+
+void
+InitializeQueryShapeCacheShmem(void)
+{
+	if (MaxSharedQueryShapes <= 0)
+	{
+		return;
+	}
+
+	bool found = false;
+
+	/*
+	 * make consistent with other extensions running.
+	 */
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	QueryShapeShared =
+		(QueryShapeSharedState *) ShmemInitStruct(
+			"Query Shape Cache Data",
+			sizeof(QueryShapeSharedState),
+			&found);
+
+	if (!found)
+	{
+		QueryShapeShared->trancheId = LWLockNewTrancheId();
+		QueryShapeShared->trancheName = "Query Shape Cache Tranche";
+		LWLockRegisterTranche(QueryShapeShared->trancheId,
+							  QueryShapeShared->trancheName);
+
+		LWLockInitialize(&QueryShapeShared->lock, QueryShapeShared->trancheId);
+	}
+
+	HASHCTL info;
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint64);
+	info.entrysize = sizeof(QueryShapeSharedEntry);
+	QueryShapeSharedHash = ShmemInitHash("Query Shape Cache Hash",
+										 MaxSharedQueryShapes, MaxSharedQueryShapes,
+										 &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+	Assert(QueryShapeShared->trancheId != 0);
+}
+
+
+/*
+ * query_shape_cache_stats returns the shapes cached by the current backend,
+ * oldest used first: the collection and filter of the shape, the state of its
+ * template, and the number of finds of the shape in all backends along with
+ * how many of them used a template (NULL when shapes aren't shared).
+ */
+Datum
+query_shape_cache_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultSet = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc tupleDescriptor;
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(
+		resultSet->econtext->ecxt_per_query_memory);
+	Tuplestorestate *tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSet->returnMode = SFRM_Materialize;
+	resultSet->setResult = tupleStore;
+	resultSet->setDesc = tupleDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	if (QueryShapeHash == NULL)
+	{
+		PG_RETURN_VOID();
+	}
+
+	dlist_iter iter;
+	dlist_foreach(iter, &QueryShapeLRUQueue)
+	{
+		QueryShapeCacheEntry *entry = dlist_container(QueryShapeCacheEntry, lruNode,
+													  iter.cur);
+
+		Datum values[5] = { 0 };
+		bool isNulls[5] = { 0 };
+
+		bson_iter_t shapeIter;
+		if (PgbsonInitIteratorAtPath(entry->shape, "spec.find", &shapeIter) &&
+			BSON_ITER_HOLDS_UTF8(&shapeIter))
+		{
+			uint32_t length;
+			const char *collection = bson_iter_utf8(&shapeIter, &length);
+			values[0] = PointerGetDatum(cstring_to_text_with_len(collection, length));
+		}
+		else
+		{
+			isNulls[0] = true;
+		}
+
+		if (PgbsonInitIteratorAtPath(entry->shape, "spec.filter", &shapeIter))
+		{
+			values[1] = PointerGetDatum(PgbsonInitFromDocumentBsonValue(
+											bson_iter_value(&shapeIter)));
+		}
+		else
+		{
+			isNulls[1] = true;
+		}
+
+		values[2] = PointerGetDatum(cstring_to_text(
+										entry->state == QueryShapeState_Bindable ?
+										"bindable" :
+										entry->state == QueryShapeState_NotBindable ?
+										"not bindable" : "pending"));
+
+		QueryShapeSharedEntry *sharedEntry = NULL;
+		if (QueryShapeSharedHash != NULL)
+		{
+			LWLockAcquire(&QueryShapeShared->lock, LW_SHARED);
+			sharedEntry = hash_search(QueryShapeSharedHash, &entry->shapeHash,
+									  HASH_FIND, NULL);
+			if (sharedEntry != NULL)
+			{
+				values[3] = Int64GetDatum(pg_atomic_read_u64(&sharedEntry->calls));
+				values[4] = Int64GetDatum(pg_atomic_read_u64(
+											  &sharedEntry->templateHits));
+			}
+
+			LWLockRelease(&QueryShapeShared->lock);
+		}
+
+		isNulls[3] = sharedEntry == NULL;
+		isNulls[4] = sharedEntry == NULL;
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods */
+/* --------------------------------------------------------- */
+
+/*
+ * InitializeQueryShapeCache initializes the session-level cache.
+ */
+static void
+InitializeQueryShapeCache(void)
+{
+	if (QueryShapeHash != NULL)
+	{
+		return;
+	}
+
+	QueryShapeCacheContext = AllocSetContextCreate(CacheMemoryContext,
+												   "DocumentDB query shape cache context",
+												   ALLOCSET_DEFAULT_SIZES);
+
+	HASHCTL info;
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint64);
+	info.entrysize = sizeof(QueryShapeCacheEntry);
+	info.hcxt = QueryShapeCacheContext;
+	int hashFlags = HASH_ELEM | HASH_BLOBS | HASH_CONTEXT;
+
+	QueryShapeHash = hash_create("DocumentDB query shape cache hash", 32, &info,
+								 hashFlags);
+
+	dlist_init(&QueryShapeLRUQueue);
+}
+
+
+/*
+ * BuildFindQueryShape returns the shape of the find spec along with
+ * everything else generating its query depends on, and collects the slot
+ * values of the spec. Returns NULL for specs that are not cached.
+ */
+static pgbson *
+BuildFindQueryShape(text *database, pgbson *findSpec, QueryData *queryData,
+					bool addCursorParams, bool setStatementTimeout,
+					QueryShapeSlots *slots, bson_value_t *maxTimeMS)
+{
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+	PgbsonWriterAppendUtf8(&writer, "db", 2,
+						   database != NULL ? text_to_cstring(database) : "");
+	PgbsonWriterAppendBool(&writer, "addCursorParams", 15, addCursorParams);
+	PgbsonWriterAppendBool(&writer, "setStatementTimeout", 19, setStatementTimeout);
+	PgbsonWriterAppendInt32(&writer, "batchSize", 9, queryData->batchSize);
+
+	pgbson_writer specWriter;
+	PgbsonWriterStartDocument(&writer, "spec", 4, &specWriter);
+
+	bson_iter_t specIter;
+	PgbsonInitIterator(findSpec, &specIter);
+	while (bson_iter_next(&specIter))
+	{
+		const char *key = bson_iter_key(&specIter);
+		uint32_t keyLength = bson_iter_key_len(&specIter);
+		const bson_value_t *value = bson_iter_value(&specIter);
+
+		if (strcmp(key, "let") == 0)
+		{
+			/* let variables are written into the query as constants */
+			return NULL;
+		}
+		else if (IsCommonSpecIgnoredField(key))
+		{
+			continue;
+		}
+		else if (strcmp(key, "maxTimeMS") == 0)
+		{
+			*maxTimeMS = *value;
+		}
+		else if (strcmp(key, "filter") == 0 && BSON_ITER_HOLDS_DOCUMENT(&specIter))
+		{
+			bson_iter_t filterIter;
+			bson_iter_recurse(&specIter, &filterIter);
+
+			pgbson_writer filterWriter;
+			PgbsonWriterStartDocument(&specWriter, key, keyLength, &filterWriter);
+			WriteFilterShape(&filterWriter, &filterIter, slots);
+			PgbsonWriterEndDocument(&specWriter, &filterWriter);
+			continue;
+		}
+
+		PgbsonWriterAppendValue(&specWriter, key, keyLength, value);
+	}
+
+	PgbsonWriterEndDocument(&writer, &specWriter);
+	return PgbsonWriterGetPgbson(&writer);
+}
+
+
+/*
+ * WriteFilterShape writes the shape of a filter: the values of top level
+ * equalities are written as their type code and collected as slots, the
+ * rest of the filter is written as is. Int32 values are always slots, so
+ * a type code can't be mistaken for a value.
+ */
+static void
+WriteFilterShape(pgbson_writer *writer, bson_iter_t *filterIter, QueryShapeSlots *slots)
+{
+	while (bson_iter_next(filterIter))
+	{
+		const char *key = bson_iter_key(filterIter);
+		uint32_t keyLength = bson_iter_key_len(filterIter);
+		const bson_value_t *value = bson_iter_value(filterIter);
+
+		if (key[0] == '$' || slots->numSlots >= QUERY_SHAPE_MAX_SLOTS)
+		{
+			PgbsonWriterAppendValue(writer, key, keyLength, value);
+			continue;
+		}
+
+		bson_value_t eqValue;
+		if (IsQueryShapeSlotValue(value))
+		{
+			PgbsonWriterAppendInt32(writer, key, keyLength, value->value_type);
+			eqValue = *value;
+		}
+		else if (GetDollarEqValue(value, &eqValue) && IsQueryShapeSlotValue(&eqValue))
+		{
+			pgbson_writer eqWriter;
+			PgbsonWriterStartDocument(writer, key, keyLength, &eqWriter);
+			PgbsonWriterAppendInt32(&eqWriter, "$eq", 3, eqValue.value_type);
+			PgbsonWriterEndDocument(writer, &eqWriter);
+		}
+		else
+		{
+			PgbsonWriterAppendValue(writer, key, keyLength, value);
+			continue;
+		}
+
+		slots->paths[slots->numSlots].string = key;
+		slots->paths[slots->numSlots].length = keyLength;
+		slots->values[slots->numSlots] = eqValue;
+		slots->numSlots++;
+	}
+}
+
+
+/*
+ * Whether a value compared by equality can be a slot: scalars whose
+ * equality is generated the same for every value of their type.
+ */
+static bool
+IsQueryShapeSlotValue(const bson_value_t *value)
+{
+	switch (value->value_type)
+	{
+		case BSON_TYPE_INT32:
+		case BSON_TYPE_INT64:
+		case BSON_TYPE_UTF8:
+		case BSON_TYPE_OID:
+		case BSON_TYPE_BOOL:
+		case BSON_TYPE_DATE_TIME:
+		{
+			return true;
+		}
+
+		case BSON_TYPE_DOUBLE:
+		{
+			return isfinite(value->value.v_double);
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
+/*
+ * Gets the value of an operator document that only has $eq.
+ */
+static bool
+GetDollarEqValue(const bson_value_t *value, bson_value_t *eqValue)
+{
+	if (value->value_type != BSON_TYPE_DOCUMENT)
+	{
+		return false;
+	}
+
+	bson_iter_t operatorIter;
+	BsonValueInitIterator(value, &operatorIter);
+	if (!bson_iter_next(&operatorIter) || strcmp(bson_iter_key(&operatorIter), "$eq") != 0)
+	{
+		return false;
+	}
+
+	*eqValue = *bson_iter_value(&operatorIter);
+	return !bson_iter_next(&operatorIter);
+}
+
+
+/*
+ * BindQueryTemplate returns a copy of the template of the entry with the
+ * slot values bound into it.
+ */
+static Query *
+BindQueryTemplate(QueryShapeCacheEntry *entry, QueryShapeSlots *slots,
+				  Oid bsonTypeId, Oid bsonQueryTypeId)
+{
+	Query *query = copyObject(entry->queryTemplate);
+
+	QueryShapeWalkerContext context = {
+		.bsonTypeId = bsonTypeId,
+		.bsonQueryTypeId = bsonQueryTypeId,
+		.constOrdinal = 0,
+		.slots = slots,
+		.bindings = entry->bindings,
+		.numBindings = entry->numBindings,
+	};
+
+	BindSlotValuesWalker((Node *) query, &context);
+	return query;
+}
+
+
+/*
+ * CreateQueryShapeEntry adds the query generated for the first spec of a
+ * shape to the cache. The entry is built in a context of its own that only
+ * becomes part of the cache once it is complete.
+ */
+static void
+CreateQueryShapeEntry(uint64 shapeHash, pgbson *shape, QueryShapeSlots *slots,
+					  Query *query, QueryData *queryData, Oid bsonTypeId,
+					  Oid bsonQueryTypeId)
+{
+	MemoryContext entryContext = AllocSetContextCreate(CurrentMemoryContext,
+													   "DocumentDB query shape entry",
+													   ALLOCSET_SMALL_SIZES);
+	MemoryContext oldContext = MemoryContextSwitchTo(entryContext);
+
+	QueryShapeCacheEntry newEntry = { 0 };
+	newEntry.shapeHash = shapeHash;
+	newEntry.context = entryContext;
+	newEntry.shape = PgbsonCloneFromPgbson(shape);
+	newEntry.queryTemplate = copyObject(query);
+	newEntry.cursorKind = queryData->cursorKind;
+	newEntry.cursorStateParamNumber = queryData->cursorStateParamNumber;
+	newEntry.batchSize = queryData->batchSize;
+	newEntry.namespaceName = pstrdup(queryData->namespaceName != NULL ?
+									 queryData->namespaceName : "");
+
+	pgbson_writer valuesWriter;
+	PgbsonWriterInit(&valuesWriter);
+	for (int i = 0; i < slots->numSlots; i++)
+	{
+		char indexKey[12];
+		pg_ltoa(i, indexKey);
+		PgbsonWriterAppendValue(&valuesWriter, indexKey, strlen(indexKey),
+								&slots->values[i]);
+	}
+	newEntry.templateValues = PgbsonWriterGetPgbson(&valuesWriter);
+
+	QueryShapeWalkerContext context = {
+		.bsonTypeId = bsonTypeId,
+		.bsonQueryTypeId = bsonQueryTypeId,
+		.constOrdinal = 0,
+		.slots = slots,
+		.bindings = NULL,
+		.numBindings = 0,
+		.isBindable = true,
+		.relationIds = NIL,
+	};
+	CollectSlotBindingsWalker((Node *) newEntry.queryTemplate, &context);
+
+	newEntry.bindings = context.bindings;
+	newEntry.numBindings = context.numBindings;
+	newEntry.numRelationIds = list_length(context.relationIds);
+	newEntry.relationIds = palloc(sizeof(Oid) * (newEntry.numRelationIds + 1));
+
+	ListCell *relationIdCell;
+	int relationIndex = 0;
+	foreach(relationIdCell, context.relationIds)
+	{
+		newEntry.relationIds[relationIndex++] = lfirst_oid(relationIdCell);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (context.isBindable)
+	{
+		newEntry.fingerprint = ComputeTemplateFingerprint(&newEntry, bsonTypeId,
+														  bsonQueryTypeId);
+		newEntry.state = GetSharedQueryShapeState(shapeHash, newEntry.fingerprint);
+	}
+	else
+	{
+		newEntry.state = QueryShapeState_NotBindable;
+	}
+
+	if (CachedQueryShapeCount >= QueryShapeCacheSizeLimit)
+	{
+		RemoveOldestQueryShapeEntry();
+	}
+
+	bool found = false;
+	QueryShapeCacheEntry *entry = hash_search(QueryShapeHash, &shapeHash, HASH_ENTER,
+											  &found);
+	Assert(!found);
+
+	/*
+	 * Nothing below can fail, so the hash, the LRU queue and the context of
+	 * the cache stay consistent.
+	 */
+	MemoryContextSetParent(entryContext, QueryShapeCacheContext);
+	*entry = newEntry;
+	dlist_push_tail(&QueryShapeLRUQueue, &entry->lruNode);
+	CachedQueryShapeCount++;
+}
+
+
+/*
+ * VerifyQueryShapeEntry checks whether binding the slot values of a spec
+ * into the pending template of its shape reproduces the query generated
+ * for the spec, and publishes the outcome to the other backends. Specs
+ * that share a slot value with the template prove nothing about that slot
+ * and leave the entry pending.
+ */
+static void
+VerifyQueryShapeEntry(QueryShapeCacheEntry *entry, QueryShapeSlots *slots,
+					  Query *query, QueryData *queryData, Oid bsonTypeId,
+					  Oid bsonQueryTypeId)
+{
+	bson_iter_t templateValuesIter;
+	PgbsonInitIterator(entry->templateValues, &templateValuesIter);
+	for (int i = 0; i < slots->numSlots; i++)
+	{
+		if (!bson_iter_next(&templateValuesIter) ||
+			BsonValueEqualsStrict(bson_iter_value(&templateValuesIter),
+								  &slots->values[i]))
+		{
+			return;
+		}
+	}
+
+	Query *boundQuery = BindQueryTemplate(entry, slots, bsonTypeId, bsonQueryTypeId);
+
+	const char *namespaceName = queryData->namespaceName != NULL ?
+								queryData->namespaceName : "";
+	bool isBindable = equal(boundQuery, query) &&
+					  entry->cursorKind == queryData->cursorKind &&
+					  entry->cursorStateParamNumber ==
+					  queryData->cursorStateParamNumber &&
+					  entry->batchSize == queryData->batchSize &&
+					  strcmp(entry->namespaceName, namespaceName) == 0;
+
+	entry->state = isBindable ? QueryShapeState_Bindable :
+				   QueryShapeState_NotBindable;
+	PublishSharedQueryShapeState(entry->shapeHash, entry->fingerprint, isBindable);
+}
+
+
+/*
+ * ComputeTemplateFingerprint hashes the template of the entry with empty
+ * documents in place of its slot constants. Templates of a shape with the
+ * same fingerprint are the same query but for the slot values.
+ */
+static uint64
+ComputeTemplateFingerprint(QueryShapeCacheEntry *entry, Oid bsonTypeId,
+						   Oid bsonQueryTypeId)
+{
+	Query *query = BindQueryTemplate(entry, NULL, bsonTypeId, bsonQueryTypeId);
+	char *queryString = nodeToString(query);
+	uint64 fingerprint = hash_bytes_extended((const unsigned char *) queryString,
+											 strlen(queryString), 0);
+	pfree(queryString);
+	return fingerprint;
+}
+
+
+/*
+ * CollectSlotBindingsWalker finds the bson constants of a query that hold a
+ * slot value, either as { path: value } or as { "": value }, and the
+ * relations the query references. A constant that could hold the value of
+ * several slots makes the query not bindable.
+ */
+static bool
+CollectSlotBindingsWalker(Node *node, QueryShapeWalkerContext *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Const))
+	{
+		Const *constNode = (Const *) node;
+		if (!IsBsonConst(constNode, context))
+		{
+			return false;
+		}
+
+		int constOrdinal = context->constOrdinal++;
+
+		bson_iter_t constIter;
+		PgbsonInitIterator(DatumGetPgBson(constNode->constvalue), &constIter);
+		if (!bson_iter_next(&constIter))
+		{
+			return false;
+		}
+
+		StringView key = bson_iter_key_string_view(&constIter);
+		const bson_value_t *value = bson_iter_value(&constIter);
+		if (bson_iter_next(&constIter))
+		{
+			return false;
+		}
+
+		int slotIndex = -1;
+		for (int i = 0; i < context->slots->numSlots; i++)
+		{
+			if ((key.length == 0 || StringViewEquals(&key, &context->slots->paths[i])) &&
+				BsonValueEqualsStrict(value, &context->slots->values[i]))
+			{
+				if (slotIndex >= 0)
+				{
+					context->isBindable = false;
+				}
+
+				slotIndex = i;
+			}
+		}
+
+		if (slotIndex >= 0)
+		{
+			if (context->bindings == NULL)
+			{
+				context->bindings = palloc(sizeof(QueryShapeSlotBinding) *
+										   QUERY_SHAPE_MAX_SLOTS);
+			}
+			else if (context->numBindings % QUERY_SHAPE_MAX_SLOTS == 0)
+			{
+				context->bindings = repalloc(context->bindings,
+											 sizeof(QueryShapeSlotBinding) *
+											 (context->numBindings +
+											  QUERY_SHAPE_MAX_SLOTS));
+			}
+
+			QueryShapeSlotBinding *binding = &context->bindings[context->numBindings++];
+			binding->constOrdinal = constOrdinal;
+			binding->slotIndex = slotIndex;
+			binding->hasEmptyPath = key.length == 0;
+		}
+
+		return false;
+	}
+	else if (IsA(node, RangeTblEntry))
+	{
+		RangeTblEntry *rte = (RangeTblEntry *) node;
+		if (rte->rtekind == RTE_RELATION)
+		{
+			context->relationIds = list_append_unique_oid(context->relationIds,
+														  rte->relid);
+		}
+
+		return false;
+	}
+	else if (IsA(node, Query))
+	{
+		return query_tree_walker((Query *) node, CollectSlotBindingsWalker, context,
+								 QTW_EXAMINE_RTES_BEFORE);
+	}
+
+	return expression_tree_walker(node, CollectSlotBindingsWalker, context);
+}
+
+
+/*
+ * BindSlotValuesWalker replaces the value of the bson constants that the
+ * bindings point to with the slot values, or with an empty document when
+ * there are no slots. The walk visits constants in the same order as
+ * CollectSlotBindingsWalker.
+ */
+static bool
+BindSlotValuesWalker(Node *node, QueryShapeWalkerContext *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Const))
+	{
+		Const *constNode = (Const *) node;
+		if (!IsBsonConst(constNode, context))
+		{
+			return false;
+		}
+
+		int constOrdinal = context->constOrdinal++;
+		if (context->numBindings == 0 ||
+			context->bindings->constOrdinal != constOrdinal)
+		{
+			return false;
+		}
+
+		QueryShapeSlotBinding *binding = context->bindings;
+		context->bindings++;
+		context->numBindings--;
+
+		pgbson *boundValue;
+		if (context->slots == NULL)
+		{
+			boundValue = PgbsonInitEmpty();
+		}
+		else if (binding->hasEmptyPath)
+		{
+			boundValue = BsonValueToDocumentPgbson(
+				&context->slots->values[binding->slotIndex]);
+		}
+		else
+		{
+			StringView *path = &context->slots->paths[binding->slotIndex];
+
+			pgbson_writer writer;
+			PgbsonWriterInit(&writer);
+			PgbsonWriterAppendValue(&writer, path->string, path->length,
+									&context->slots->values[binding->slotIndex]);
+			boundValue = PgbsonWriterGetPgbson(&writer);
+		}
+
+		constNode->constvalue = PointerGetDatum(boundValue);
+		return false;
+	}
+	else if (IsA(node, Query))
+	{
+		return query_tree_walker((Query *) node, BindSlotValuesWalker, context, 0);
+	}
+
+	return expression_tree_walker(node, BindSlotValuesWalker, context);
+}
+
+
+/*
+ * Whether the constant is a non-null bson document.
+ */
+static bool
+IsBsonConst(Const *constNode, QueryShapeWalkerContext *context)
+{
+	return !constNode->constisnull &&
+		   (constNode->consttype == context->bsonTypeId ||
+			constNode->consttype == context->bsonQueryTypeId);
+}
+
+
+/*
+ * RemoveQueryShapeEntry removes an entry from the cache and frees it.
+ */
+static void
+RemoveQueryShapeEntry(QueryShapeCacheEntry *entry)
+{
+	uint64 shapeHash = entry->shapeHash;
+
+	dlist_delete(&entry->lruNode);
+	MemoryContextDelete(entry->context);
+	hash_search(QueryShapeHash, &shapeHash, HASH_REMOVE, NULL);
+	CachedQueryShapeCount--;
+}
+
+
+/*
+ * RemoveOldestQueryShapeEntry removes the entry at the head of the LRU
+ * queue.
+ */
+static void
+RemoveOldestQueryShapeEntry(void)
+{
+	if (dlist_is_empty(&QueryShapeLRUQueue))
+	{
+		return;
+	}
+
+	dlist_node *oldestNode = dlist_head_node(&QueryShapeLRUQueue);
+	RemoveQueryShapeEntry(dlist_container(QueryShapeCacheEntry, lruNode, oldestNode));
+}
+
+
+/*
+ * GetSharedQueryShapeState returns whether another backend found the
+ * template of a shape with the given fingerprint bindable.
+ */
+static QueryShapeState
+GetSharedQueryShapeState(uint64 shapeHash, uint64 fingerprint)
+{
+	if (QueryShapeSharedHash == NULL)
+	{
+		return QueryShapeState_Pending;
+	}
+
+	QueryShapeState state = QueryShapeState_Pending;
+
+	LWLockAcquire(&QueryShapeShared->lock, LW_SHARED);
+	QueryShapeSharedEntry *sharedEntry = hash_search(QueryShapeSharedHash, &shapeHash,
+													 HASH_FIND, NULL);
+	if (sharedEntry != NULL && sharedEntry->bindableFingerprint == fingerprint)
+	{
+		state = QueryShapeState_Bindable;
+	}
+	else if (sharedEntry != NULL && sharedEntry->notBindableFingerprint == fingerprint)
+	{
+		state = QueryShapeState_NotBindable;
+	}
+
+	LWLockRelease(&QueryShapeShared->lock);
+	return state;
+}
+
+
+/*
+ * RecordSharedQueryShapeCall counts a find of the shape in shared memory.
+ */
+static void
+RecordSharedQueryShapeCall(uint64 shapeHash, bool isTemplateHit)
+{
+	if (QueryShapeSharedHash == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(&QueryShapeShared->lock, LW_SHARED);
+	QueryShapeSharedEntry *sharedEntry = hash_search(QueryShapeSharedHash, &shapeHash,
+													 HASH_FIND, NULL);
+	if (sharedEntry == NULL)
+	{
+		LWLockRelease(&QueryShapeShared->lock);
+		LWLockAcquire(&QueryShapeShared->lock, LW_EXCLUSIVE);
+		sharedEntry = EnterSharedQueryShapeEntry(shapeHash);
+	}
+
+	if (sharedEntry != NULL)
+	{
+		pg_atomic_fetch_add_u64(&sharedEntry->calls, 1);
+		if (isTemplateHit)
+		{
+			pg_atomic_fetch_add_u64(&sharedEntry->templateHits, 1);
+		}
+	}
+
+	LWLockRelease(&QueryShapeShared->lock);
+}
+
+
+/*
+ * PublishSharedQueryShapeState records whether the template of a shape
+ * with the given fingerprint was found bindable.
+ */
+static void
+PublishSharedQueryShapeState(uint64 shapeHash, uint64 fingerprint, bool isBindable)
+{
+	if (QueryShapeSharedHash == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(&QueryShapeShared->lock, LW_EXCLUSIVE);
+	QueryShapeSharedEntry *sharedEntry = EnterSharedQueryShapeEntry(shapeHash);
+	if (sharedEntry != NULL && isBindable)
+	{
+		sharedEntry->bindableFingerprint = fingerprint;
+	}
+	else if (sharedEntry != NULL)
+	{
+		sharedEntry->notBindableFingerprint = fingerprint;
+	}
+
+	LWLockRelease(&QueryShapeShared->lock);
+}
+
+
+/*
+ * EnterSharedQueryShapeEntry finds or adds the shared entry of a shape,
+ * evicting the least called shape when the hash is full. The caller holds
+ * the lock exclusively.
+ */
+static QueryShapeSharedEntry *
+EnterSharedQueryShapeEntry(uint64 shapeHash)
+{
+	QueryShapeSharedEntry *sharedEntry = hash_search(QueryShapeSharedHash, &shapeHash,
+													 HASH_FIND, NULL);
+	if (sharedEntry != NULL)
+	{
+		return sharedEntry;
+	}
+
+	if (hash_get_num_entries(QueryShapeSharedHash) >= MaxSharedQueryShapes)
+	{
+		HASH_SEQ_STATUS status;
+		QueryShapeSharedEntry *candidate;
+		uint64 leastCalledShapeHash = 0;
+		uint64 leastCalls = PG_UINT64_MAX;
+
+		hash_seq_init(&status, QueryShapeSharedHash);
+		while ((candidate = hash_seq_search(&status)) != NULL)
+		{
+			uint64 calls = pg_atomic_read_u64(&candidate->calls);
+			if (calls < leastCalls)
+			{
+				leastCalls = calls;
+				leastCalledShapeHash = candidate->shapeHash;
+			}
+		}
+
+		hash_search(QueryShapeSharedHash, &leastCalledShapeHash, HASH_REMOVE, NULL);
+	}
+
+	bool found = false;
+	sharedEntry = hash_search(QueryShapeSharedHash, &shapeHash, HASH_ENTER_NULL, &found);
+	if (sharedEntry != NULL && !found)
+	{
+		sharedEntry->bindableFingerprint = 0;
+		sharedEntry->notBindableFingerprint = 0;
+		pg_atomic_init_u64(&sharedEntry->calls, 0);
+		pg_atomic_init_u64(&sharedEntry->templateHits, 0);
+	}
+
+	return sharedEntry;
+}
@@ -34,6 +34,7 @@
 
 #include "metadata/metadata_cache.h"
 #include "metadata/collection.h"
+#include "infrastructure/query_shape_cache.h"
 #include "commands/defrem.h"
 
 
@@ -904,6 +905,33 @@ typedef struct DocumentDBApiOidCacheData
 	/* OID of the BSONPERCENTILE aggregate function */
 	Oid ApiCatalogBsonPercentileAggregateFunctionOid;
 
+	/* OID of the BSON_GROUP_ACCUMULATORS aggregate function */
+	Oid ApiInternalSchemaBsonGroupAccumulatorsAggregateFunctionOid;
+
+	/* OID of the bson_group_collation_key function */
+	Oid ApiInternalSchemaBsonGroupCollationKeyFunctionOid;
+
+	/* OID of the BSON_GROUP_FIRST aggregate function */
+	Oid ApiInternalSchemaBsonGroupFirstAggregateFunctionOid;
+
+	/* OID of the BSON_GROUP_LAST aggregate function */
+	Oid ApiInternalSchemaBsonGroupLastAggregateFunctionOid;
+
+	/* OID of the BSON_GROUP_FIRSTN aggregate function */
+	Oid ApiInternalSchemaBsonGroupFirstNAggregateFunctionOid;
+
+	/* OID of the BSON_GROUP_LASTN aggregate function */
+	Oid ApiInternalSchemaBsonGroupLastNAggregateFunctionOid;
+
+	/* OID of the BSON_GROUP_PUSH aggregate function */
+	Oid ApiInternalSchemaBsonGroupPushAggregateFunctionOid;
+
+	/* OID of the BSON_GROUP_ADD_TO_SET aggregate function */
+	Oid ApiInternalSchemaBsonGroupAddToSetAggregateFunctionOid;
+
+	/* OID of the BSON_GROUP_MERGE_OBJECTS aggregate function */
+	Oid ApiInternalSchemaBsonGroupMergeObjectsAggregateFunctionOid;
+
 	/* OID of the pg_catalog.any_value aggregate */
 	Oid PostgresAnyValueFunctionOid;
 
@@ -1260,10 +1288,12 @@ InvalidateDocumentDBApiCache(Datum argument, Oid relationId)
 		CacheValidity = CACHE_INVALID;
 		ResetCollectionsCache();
 		InvalidateVersionCache();
+		InvalidateQueryShapeCache(InvalidOid);
 	}
 	else
 	{
 		/* got an invalidation for a specific relation */
+		InvalidateQueryShapeCache(relationId);
 
 		if (CacheValidity == CACHE_VALID)
 		{
@@ -4414,6 +4444,92 @@ BsonPercentileAggregateFunctionOid(void)
 }
 
 
+Oid
+BsonGroupAccumulatorsAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupAccumulatorsAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_accumulators");
+}
+
+
+/*
+ * BsonGroupCollationKeyFunctionOid returns the OID of the
+ * bson_group_collation_key(<bson>, <text>) function.
+ */
+Oid
+BsonGroupCollationKeyFunctionOid(void)
+{
+	return GetBinaryOperatorFunctionIdWithSchema(
+		&Cache.ApiInternalSchemaBsonGroupCollationKeyFunctionOid,
+		"bson_group_collation_key", BsonTypeId(), TEXTOID,
+		DocumentDBApiInternalSchemaName);
+}
+
+
+Oid
+BsonGroupFirstAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupFirstAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_first");
+}
+
+
+Oid
+BsonGroupLastAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupLastAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_last");
+}
+
+
+Oid
+BsonGroupFirstNAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupFirstNAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_firstn");
+}
+
+
+Oid
+BsonGroupLastNAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupLastNAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_lastn");
+}
+
+
+Oid
+BsonGroupPushAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupPushAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_push");
+}
+
+
+Oid
+BsonGroupAddToSetAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupAddToSetAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_add_to_set");
+}
+
+
+Oid
+BsonGroupMergeObjectsAggregateFunctionOid(void)
+{
+	return GetAggregateFunctionByName(
+		&Cache.ApiInternalSchemaBsonGroupMergeObjectsAggregateFunctionOid,
+		DocumentDBApiInternalSchemaName, "bson_group_merge_objects");
+}
+
+
 Oid
 BsonAddToSetAggregateFunctionOid(void)
 {
@@ -1287,6 +1287,18 @@ SetSingleBoundsDollarRegex(const bson_value_t *queryValue,
 	regexData->pcreData = RegexCompile(regexData->regex,
 									   regexData->options);
 
+	/* All the strings matching an anchored literal prefix start with the prefix */
+	StringView literalPrefix = GetRegexLiteralPrefix(regexData->pcreData);
+	if (!isNegationOp && literalPrefix.length > 0)
+	{
+		CompositeSingleBound prefixBound = { 0 };
+		prefixBound.bound.value_type = BSON_TYPE_UTF8;
+		prefixBound.bound.value.v_utf8.str = (char *) literalPrefix.string;
+		prefixBound.bound.value.v_utf8.len = literalPrefix.length;
+		prefixBound.isBoundInclusive = true;
+		SetLowerBound(&queryBounds->lowerBound, &prefixBound);
+	}
+
 	compositeRegexData->regexData = regexData;
 	compositeRegexData->isNegationOperator = isNegationOp;
 
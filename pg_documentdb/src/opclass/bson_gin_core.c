@@ -184,6 +184,7 @@ static int32_t GinBsonComparePartialBitsWiseOperator(BsonIndexTerm *queryValue,
 													 bitsCompareFunc);
 static void ProcessExtractQueryForRegex(pgbsonelement *element,
 										bool *partialmatch, Pointer *extra_data);
+static bool HasRegexLiteralPrefix(const bson_value_t *value, RegexData *regexData);
 static Datum GenerateEmptyArrayTerm(pgbsonelement *filterElement, const
 									IndexTermCreateMetadata *metadata);
 static inline Datum * GenerateNullEqualityIndexTerms(int32 *nentries, bool **partialmatch,
@@ -2531,28 +2532,6 @@ GinBsonExtractQueryRegex(BsonExtractQueryArgs *args)
 
 	*extra_data = (Pointer *) palloc(sizeof(Pointer) * numEntries);
 
-	/* now create a bson for that path which has the min value for the field */
-	/* We set this as string.Empty but this can be set as the prefix expression */
-	/* for the regex (i.e. the lowest possible value that can match a regex) */
-	pgbsonelement emptyStringElement = queryElement;
-	emptyStringElement.bsonValue.value_type = BSON_TYPE_UTF8;
-	emptyStringElement.bsonValue.value.v_utf8.str = "";
-	emptyStringElement.bsonValue.value.v_utf8.len = 0;
-
-	entries[0] = PointerGetDatum(SerializeBsonIndexTerm(&emptyStringElement,
-														&args->termMetadata).
-								 indexTermVal);
-
-	entries[1] = GenerateRootTruncatedTerm(&args->termMetadata);
-
-	if (isRegexValue)
-	{
-		/* Also match for the regex itself */
-		entries[2] = PointerGetDatum(SerializeBsonIndexTerm(&queryElement,
-															&args->termMetadata).
-									 indexTermVal);
-	}
-
 	/* store the regex value in extra data - this allows us to compute regex match */
 	/* this extra value. */
 	RegexData *regexData = (RegexData *) palloc0(sizeof(RegexData));
@@ -2571,6 +2550,30 @@ GinBsonExtractQueryRegex(BsonExtractQueryArgs *args)
 	regexData->pcreData = RegexCompile(regexData->regex,
 									   regexData->options);
 
+	/* now create a bson for that path which has the min value for the field */
+	/* This is the literal prefix of the regex if it has one (i.e. the lowest */
+	/* possible value that can match the regex), otherwise string.Empty */
+	StringView literalPrefix = GetRegexLiteralPrefix(regexData->pcreData);
+	pgbsonelement emptyStringElement = queryElement;
+	emptyStringElement.bsonValue.value_type = BSON_TYPE_UTF8;
+	emptyStringElement.bsonValue.value.v_utf8.str = literalPrefix.length > 0 ?
+													(char *) literalPrefix.string : "";
+	emptyStringElement.bsonValue.value.v_utf8.len = literalPrefix.length;
+
+	entries[0] = PointerGetDatum(SerializeBsonIndexTerm(&emptyStringElement,
+														&args->termMetadata).
+								 indexTermVal);
+
+	entries[1] = GenerateRootTruncatedTerm(&args->termMetadata);
+
+	if (isRegexValue)
+	{
+		/* Also match for the regex itself */
+		entries[2] = PointerGetDatum(SerializeBsonIndexTerm(&queryElement,
+															&args->termMetadata).
+									 indexTermVal);
+	}
+
 	**extra_data = (Pointer) regexData;
 	return entries;
 }
@@ -3679,6 +3682,12 @@ GinBsonComparePartialRegex(BsonIndexTerm *queryValue, BsonIndexTerm *compareValu
 		/* we can stop iterating more. */
 		return 1;
 	}
+	else if (!HasRegexLiteralPrefix(&compareValue->element.bsonValue, regexData))
+	{
+		/* the scan started at the literal prefix of the regex, so strings past */
+		/* the prefix are greater than all the strings that can match. */
+		return 1;
+	}
 	else if (compareValue->isIndexTermTruncated)
 	{
 		/* Don't compare truncated terms in the index */
@@ -3695,6 +3704,41 @@ GinBsonComparePartialRegex(BsonIndexTerm *queryValue, BsonIndexTerm *compareValu
 }
 
 
+/*
+ * Returns whether a string index term starts with the literal prefix of a
+ * regex. Regexes without a literal prefix and terms that aren't strings
+ * have the prefix.
+ */
+static bool
+HasRegexLiteralPrefix(const bson_value_t *value, RegexData *regexData)
+{
+	StringView literalPrefix = GetRegexLiteralPrefix(regexData->pcreData);
+	if (literalPrefix.length == 0)
+	{
+		return true;
+	}
+
+	StringView string;
+	if (value->value_type == BSON_TYPE_UTF8)
+	{
+		string.string = value->value.v_utf8.str;
+		string.length = value->value.v_utf8.len;
+	}
+	else if (value->value_type == BSON_TYPE_SYMBOL)
+	{
+		string.string = value->value.v_symbol.symbol;
+		string.length = value->value.v_symbol.len;
+	}
+	else
+	{
+		return true;
+	}
+
+	return string.length >= literalPrefix.length &&
+		   memcmp(string.string, literalPrefix.string, literalPrefix.length) == 0;
+}
+
+
 /*
  * Compares a query against an existing item in the index and a given
  * compiled expression. If the path doesn't match, exits the search.
@@ -3896,9 +3940,12 @@ ProcessExtractQueryForRegex(pgbsonelement *element, bool *partialmatch,
 	/* This stores the regex pattern string */
 	*extra_data = (Pointer) regexData;
 
+	/* The scan starts at the literal prefix of the regex, if it has one */
+	StringView literalPrefix = GetRegexLiteralPrefix(regexData->pcreData);
 	element->bsonValue.value_type = BSON_TYPE_UTF8;
-	element->bsonValue.value.v_utf8.str = "";
-	element->bsonValue.value.v_utf8.len = 0;
+	element->bsonValue.value.v_utf8.str = literalPrefix.length > 0 ?
+										  (char *) literalPrefix.string : "";
+	element->bsonValue.value.v_utf8.len = literalPrefix.length;
 }
 
 
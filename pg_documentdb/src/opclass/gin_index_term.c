@@ -16,6 +16,7 @@
 #include <access/toast_internals.h>
 #include "opclass/bson_gin_index_term.h"
 #include "query/bson_compare.h"
+#include "query/bson_sort_key.h"
 #include "utils/documentdb_errors.h"
 #include "types/decimal128.h"
 #include "io/bsonvalue_utils.h"
@@ -213,11 +214,19 @@ CompareBsonIndexTerm(BsonIndexTerm *leftTerm, BsonIndexTerm *rightTerm,
 	}
 
 	/* We explicitly ignore the validity of the comparisons since this is applying
-	 * a sort operation on types and values
+	 * a sort operation on types and values. Terms of fixed width values are
+	 * compared by their sort keys which avoids the type dispatch of the
+	 * general comparison.
 	 */
-	cmp = CompareBsonValueAndType(&leftTerm->element.bsonValue,
-								  &rightTerm->element.bsonValue,
-								  isComparisonValid);
+	if (!TryCompareBsonValuesBySortKey(&leftTerm->element.bsonValue,
+									   &rightTerm->element.bsonValue,
+									   &cmp, isComparisonValid))
+	{
+		cmp = CompareBsonValueAndType(&leftTerm->element.bsonValue,
+									  &rightTerm->element.bsonValue,
+									  isComparisonValid);
+	}
+
 	if (cmp != 0)
 	{
 		return cmp;
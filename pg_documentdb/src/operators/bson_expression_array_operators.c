@@ -3275,8 +3275,7 @@ ProcessDollarSortArray(bson_value_t *inputValue, SortContext *sortContext,
 		iteration++;
 	}
 
-	qsort_arg(elementsArr, nElementsInArray, sizeof(ElementWithIndex),
-			  CompareBsonValuesForSort, sortContext);
+	SortElementsWithIndex(elementsArr, nElementsInArray, sortContext);
 
 	pgbson_writer writer;
 	PgbsonWriterInit(&writer);
@@ -1,26 +1,41 @@
 #include "postgres.h"
+
+#include <math.h>
+
 #include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
 #include "utils/memutils.h"
 #include "utils/builtins.h"
 #include "utils/array.h"
+#include "utils/tuplestore.h"
 #include "catalog/pg_type.h"
+#include "port/pg_bitutils.h"
 
 #include "io/pgbson.h"
 #include "pisa_integration/advanced_query_algorithms.h"
 #include "pisa_integration/pisa_integration.h"
 #include "pisa_integration/data_bridge.h"
+#include "pisa_integration/index_segments.h"
+#include "pisa_integration/inverted_index.h"
+#include "pisa_integration/memory_optimization.h"
+#include "opclass/bson_text_pisa.h"
+
+static void PisaTopKQueueSiftUp(PisaTopKQueue *queue, int index);
+static void PisaTopKQueueSiftDown(PisaTopKQueue *queue, int index);
 
 PisaTopKQueue *
 CreatePisaTopKQueue(int capacity)
 {
     PisaTopKQueue *queue;
 
-    queue = (PisaTopKQueue *) palloc0(sizeof(PisaTopKQueue));
-    queue->capacity = capacity;
+    queue = (PisaTopKQueue *) PisaMemoryAllocZero(sizeof(PisaTopKQueue));
+    queue->capacity = Max(capacity, 0);
     queue->size = 0;
     queue->threshold = 0.0;
-    queue->entries = (struct { uint64_t docid; double score; } *) 
-                     palloc0(capacity * sizeof(struct { uint64_t docid; double score; }));
+    queue->docids = (uint64_t *) PisaMemoryAlloc((queue->capacity + 1) * sizeof(uint64_t));
+    queue->scores = (double *) PisaMemoryAlloc((queue->capacity + 1) * sizeof(double));
 
     return queue;
 }
@@ -31,15 +46,15 @@ FreePisaTopKQueue(PisaTopKQueue *queue)
     if (queue == NULL)
         return;
 
-    if (queue->entries)
-        pfree(queue->entries);
-    pfree(queue);
+    PisaMemoryFree(queue->docids);
+    PisaMemoryFree(queue->scores);
+    PisaMemoryFree(queue);
 }
 
 bool
 PisaTopKQueueWouldEnter(PisaTopKQueue *queue, double score)
 {
-    if (queue == NULL)
+    if (queue == NULL || queue->capacity == 0)
         return false;
 
     if (queue->size < queue->capacity)
@@ -48,79 +63,228 @@ PisaTopKQueueWouldEnter(PisaTopKQueue *queue, double score)
     return score > queue->threshold;
 }
 
+/*
+ * Offers a document to the queue. Returns true if it was kept, in which
+ * case the threshold may have risen.
+ */
 bool
 PisaTopKQueueInsert(PisaTopKQueue *queue, uint64_t docid, double score)
 {
-    int insert_pos;
-    bool threshold_updated = false;
-
-    if (queue == NULL || !PisaTopKQueueWouldEnter(queue, score))
+    if (!PisaTopKQueueWouldEnter(queue, score))
         return false;
 
     if (queue->size < queue->capacity)
     {
-        insert_pos = queue->size;
+        queue->docids[queue->size] = docid;
+        queue->scores[queue->size] = score;
         queue->size++;
+        PisaTopKQueueSiftUp(queue, queue->size - 1);
     }
     else
     {
-        insert_pos = queue->capacity - 1;
+        /* Replace the weakest entry */
+        queue->docids[0] = docid;
+        queue->scores[0] = score;
+        PisaTopKQueueSiftDown(queue, 0);
     }
 
-    while (insert_pos > 0 && queue->entries[insert_pos - 1].score < score)
-    {
-        queue->entries[insert_pos] = queue->entries[insert_pos - 1];
-        insert_pos--;
-    }
+    if (queue->size == queue->capacity)
+        queue->threshold = queue->scores[0];
 
-    queue->entries[insert_pos].docid = docid;
-    queue->entries[insert_pos].score = score;
+    return true;
+}
 
-    if (queue->size == queue->capacity)
+/*
+ * Offers 'count' documents at once. Scores are compared against the
+ * threshold PISA_TOPK_BATCH_WIDTH at a time with a branch-free loop the
+ * compiler turns into packed compares; only the lanes that pass reach
+ * the heap, where they are re-checked against the (possibly raised)
+ * threshold. Returns the number of documents kept.
+ */
+int
+PisaTopKQueueInsertBatch(PisaTopKQueue *queue, const uint64_t *docids,
+                         const double *scores, int count)
+{
+    int inserted = 0;
+    int start;
+
+    if (queue == NULL || queue->capacity == 0)
+        return 0;
+
+    for (start = 0; start < count; start += PISA_TOPK_BATCH_WIDTH)
     {
-        queue->threshold = queue->entries[queue->capacity - 1].score;
-        threshold_updated = true;
+        int width = Min(PISA_TOPK_BATCH_WIDTH, count - start);
+        const double *chunk = scores + start;
+        double threshold;
+        uint32 mask = 0;
+        int i;
+
+        if (queue->size < queue->capacity)
+        {
+            /* Still filling up: everything is accepted until full */
+            for (i = 0; i < width; i++)
+                inserted += PisaTopKQueueInsert(queue, docids[start + i], chunk[i]);
+            continue;
+        }
+
+        threshold = queue->threshold;
+        for (i = 0; i < width; i++)
+            mask |= (uint32) (chunk[i] > threshold) << i;
+
+        while (mask != 0)
+        {
+            int lane = pg_rightmost_one_pos32(mask);
+
+            mask &= mask - 1;
+            inserted += PisaTopKQueueInsert(queue, docids[start + lane], chunk[lane]);
+        }
     }
 
-    return threshold_updated;
+    return inserted;
 }
 
+/*
+ * Returns the queued documents as PisaTextSearchResult, best score first.
+ * The queue itself is left untouched.
+ */
 List *
 PisaTopKQueueGetResults(PisaTopKQueue *queue)
 {
     List *results = NIL;
+    PisaTopKQueue heap;
+    PisaTextSearchResult **ordered;
     int i;
 
-    if (queue == NULL)
+    if (queue == NULL || queue->size == 0)
         return NIL;
 
-    for (i = 0; i < queue->size; i++)
+    /* Pop a copy of the heap, weakest first, filling the output backwards */
+    heap = *queue;
+    heap.docids = (uint64_t *) palloc(queue->size * sizeof(uint64_t));
+    heap.scores = (double *) palloc(queue->size * sizeof(double));
+    memcpy(heap.docids, queue->docids, queue->size * sizeof(uint64_t));
+    memcpy(heap.scores, queue->scores, queue->size * sizeof(double));
+
+    ordered = (PisaTextSearchResult **) palloc(queue->size * sizeof(PisaTextSearchResult *));
+    for (i = queue->size - 1; i >= 0; i--)
     {
         PisaTextSearchResult *result = (PisaTextSearchResult *) palloc0(sizeof(PisaTextSearchResult));
-        result->document_id = psprintf("%" PRIu64, queue->entries[i].docid);
-        result->score = queue->entries[i].score;
+        result->document_id = psprintf("%" PRIu64, heap.docids[0]);
+        result->score = heap.scores[0];
         result->document = NULL;
         result->collection_id = 0;
-        
-        results = lappend(results, result);
+        ordered[i] = result;
+
+        heap.size--;
+        heap.docids[0] = heap.docids[heap.size];
+        heap.scores[0] = heap.scores[heap.size];
+        PisaTopKQueueSiftDown(&heap, 0);
     }
 
+    for (i = 0; i < queue->size; i++)
+        results = lappend(results, ordered[i]);
+
+    pfree(ordered);
+    pfree(heap.docids);
+    pfree(heap.scores);
+
     return results;
 }
 
+static void
+PisaTopKQueueSiftUp(PisaTopKQueue *queue, int index)
+{
+    uint64_t docid = queue->docids[index];
+    double score = queue->scores[index];
+
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+
+        if (queue->scores[parent] <= score)
+            break;
+
+        queue->docids[index] = queue->docids[parent];
+        queue->scores[index] = queue->scores[parent];
+        index = parent;
+    }
+
+    queue->docids[index] = docid;
+    queue->scores[index] = score;
+}
+
+static void
+PisaTopKQueueSiftDown(PisaTopKQueue *queue, int index)
+{
+    uint64_t docid = queue->docids[index];
+    double score = queue->scores[index];
+
+    for (;;)
+    {
+        int child = 2 * index + 1;
+
+        if (child >= queue->size)
+            break;
+
+        if (child + 1 < queue->size && queue->scores[child + 1] < queue->scores[child])
+            child++;
+
+        if (queue->scores[child] >= score)
+            break;
+
+        queue->docids[index] = queue->docids[child];
+        queue->scores[index] = queue->scores[child];
+        index = child;
+    }
+
+    queue->docids[index] = docid;
+    queue->scores[index] = score;
+}
+
+/*
+ * Opens a cursor over the postings of 'term' in all segments of the index
+ * stored at 'index_path'. The cursor is positioned on the first live
+ * posting; a term (or index) that does not exist yields an exhausted
+ * cursor with a zero upper bound.
+ */
 PisaQueryCursor *
 CreatePisaQueryCursor(const char *term, const char *index_path)
 {
     PisaQueryCursor *cursor;
+    PisaSegmentSet *set;
+    PisaSegmentCursor *postings;
 
-    cursor = (PisaQueryCursor *) palloc0(sizeof(PisaQueryCursor));
+    cursor = (PisaQueryCursor *) PisaMemoryAllocZero(sizeof(PisaQueryCursor));
     cursor->term = pstrdup(term);
-    cursor->current_docid = 0;
-    cursor->max_score = 1.0;
-    cursor->current_score = 0.0;
-    cursor->exhausted = false;
+    cursor->current_docid = PISA_CURSOR_END_DOCID;
+    cursor->max_score = 0.0;
+    cursor->current_score = -1.0;
+    cursor->exhausted = true;
     cursor->internal_cursor = NULL;
 
+    set = OpenPisaSegmentSet(index_path);
+    if (set == NULL)
+    {
+        elog(DEBUG1, "PISA index %s does not exist", index_path);
+        return cursor;
+    }
+
+    postings = OpenPisaSegmentCursor(set, term, strlen(term));
+    if (postings != NULL)
+    {
+        cursor->internal_cursor = postings;
+        cursor->max_score = postings->max_score;
+        cursor->current_docid = postings->docid;
+        cursor->exhausted = false;
+        if (postings->docid == PISA_POSTING_END)
+        {
+            /* Every posting of the term is deleted */
+            cursor->current_docid = PISA_CURSOR_END_DOCID;
+            cursor->exhausted = true;
+        }
+    }
+
+    ReleasePisaSegmentSet(set);
     return cursor;
 }
 
@@ -133,9 +297,26 @@ FreePisaQueryCursor(PisaQueryCursor *cursor)
     if (cursor->term)
         pfree(cursor->term);
     if (cursor->internal_cursor)
-        pfree(cursor->internal_cursor);
+        ClosePisaSegmentCursor((PisaSegmentCursor *) cursor->internal_cursor);
     
-    pfree(cursor);
+    PisaMemoryFree(cursor);
+}
+
+static void
+SyncPisaQueryCursor(PisaQueryCursor *cursor)
+{
+    uint32 docid = ((PisaSegmentCursor *) cursor->internal_cursor)->docid;
+
+    cursor->current_score = -1.0;
+    if (docid == PISA_POSTING_END)
+    {
+        cursor->current_docid = PISA_CURSOR_END_DOCID;
+        cursor->exhausted = true;
+    }
+    else
+    {
+        cursor->current_docid = docid;
+    }
 }
 
 bool
@@ -144,16 +325,10 @@ PisaQueryCursorNext(PisaQueryCursor *cursor)
     if (cursor == NULL || cursor->exhausted)
         return false;
 
-    cursor->current_docid++;
-    cursor->current_score = cursor->max_score * 0.8;
-
-    if (cursor->current_docid > 1000000)
-    {
-        cursor->exhausted = true;
-        return false;
-    }
+    PisaSegmentCursorNext((PisaSegmentCursor *) cursor->internal_cursor);
+    SyncPisaQueryCursor(cursor);
 
-    return true;
+    return !cursor->exhausted;
 }
 
 bool
@@ -165,16 +340,53 @@ PisaQueryCursorNextGeq(PisaQueryCursor *cursor, uint64_t target_docid)
     if (cursor->current_docid >= target_docid)
         return true;
 
-    cursor->current_docid = target_docid;
-    cursor->current_score = cursor->max_score * 0.8;
-
-    if (cursor->current_docid > 1000000)
+    if (target_docid >= PISA_POSTING_END)
     {
+        cursor->current_docid = PISA_CURSOR_END_DOCID;
         cursor->exhausted = true;
         return false;
     }
 
-    return true;
+    PisaSegmentCursorNextGeq((PisaSegmentCursor *) cursor->internal_cursor,
+                             (uint32) target_docid);
+    SyncPisaQueryCursor(cursor);
+
+    return !cursor->exhausted;
+}
+
+/*
+ * Moves the block-max pointer of the cursor to the block that may
+ * contain target_docid; the cursor position itself does not change.
+ */
+void
+PisaQueryCursorShallowNextGeq(PisaQueryCursor *cursor, uint64_t target_docid)
+{
+    if (cursor == NULL || cursor->exhausted)
+        return;
+
+    PisaSegmentCursorShallowNextGeq((PisaSegmentCursor *) cursor->internal_cursor,
+                                    (uint32) Min(target_docid, PISA_POSTING_END));
+}
+
+double
+PisaQueryCursorBlockMaxScore(PisaQueryCursor *cursor)
+{
+    if (cursor == NULL || cursor->exhausted)
+        return 0.0;
+
+    return PisaSegmentCursorBlockMaxScore((PisaSegmentCursor *) cursor->internal_cursor);
+}
+
+uint64_t
+PisaQueryCursorBlockLastDocId(PisaQueryCursor *cursor)
+{
+    uint32 last_docid;
+
+    if (cursor == NULL || cursor->exhausted)
+        return PISA_CURSOR_END_DOCID;
+
+    last_docid = PisaSegmentCursorBlockLastDocId((PisaSegmentCursor *) cursor->internal_cursor);
+    return last_docid == PISA_POSTING_END ? PISA_CURSOR_END_DOCID : last_docid;
 }
 
 uint64_t
@@ -188,8 +400,14 @@ PisaQueryCursorDocId(PisaQueryCursor *cursor)
 double
 PisaQueryCursorScore(PisaQueryCursor *cursor)
 {
-    if (cursor == NULL)
+    if (cursor == NULL || cursor->exhausted)
         return 0.0;
+
+    /* Frequencies are decoded lazily, only for postings that get scored */
+    if (cursor->current_score < 0.0)
+        cursor->current_score =
+            PisaSegmentCursorScore((PisaSegmentCursor *) cursor->internal_cursor);
+
     return cursor->current_score;
 }
 
@@ -201,71 +419,210 @@ PisaQueryCursorMaxScore(PisaQueryCursor *cursor)
     return cursor->max_score;
 }
 
+/*
+ * Posting list statistics of a query, read from the index dictionary.
+ */
+typedef struct PisaQueryTermStatistics
+{
+    uint32 num_docs;
+    int present_terms;
+    int multi_block_terms;
+    uint64 total_postings;
+    uint32 max_doc_freq;
+} PisaQueryTermStatistics;
+
+static bool
+CollectPisaQueryTermStatistics(const char *index_path, List *query_terms,
+                               PisaQueryTermStatistics *statistics)
+{
+    PisaSegmentSet *set;
+    ListCell *cell;
+
+    memset(statistics, 0, sizeof(PisaQueryTermStatistics));
+
+    if (index_path == NULL)
+        return false;
+
+    set = OpenPisaSegmentSet(index_path);
+    if (set == NULL)
+        return false;
+
+    statistics->num_docs = (uint32) Min(PisaSegmentSetLiveDocs(set), PG_UINT32_MAX);
+    foreach(cell, query_terms)
+    {
+        char *term = (char *) lfirst(cell);
+        PisaSegmentTermStatistics entry;
+
+        if (!PisaSegmentSetTermStatistics(set, term, strlen(term), &entry))
+            continue;
+
+        statistics->present_terms++;
+        statistics->total_postings += entry.doc_freq;
+        statistics->max_doc_freq = Max(statistics->max_doc_freq, entry.doc_freq);
+        if (entry.num_blocks > 1)
+            statistics->multi_block_terms++;
+    }
+
+    ReleasePisaSegmentSet(set);
+    return true;
+}
+
+/*
+ * Builds the execution plan of a query over the index at 'index_path'.
+ * The essential / non-essential split reported here is the one MaxScore
+ * reaches once the threshold climbs to the largest single-list upper
+ * bound; during execution the split keeps moving with the threshold.
+ */
 PisaQueryExecutionPlan *
-AnalyzePisaQuery(List *query_terms, int top_k)
+AnalyzePisaQuery(const char *index_path, List *query_terms, int top_k)
 {
     PisaQueryExecutionPlan *plan;
+    PisaSegmentSet *set = NULL;
     ListCell *cell;
+    char **terms;
+    double *upper_bounds;
+    uint32 *doc_freqs;
+    uint32 num_docs = 0;
+    uint64 total_postings = 0;
+    uint64 essential_postings = 0;
+    double prefix_bound = 0.0;
     int term_count;
+    int i;
 
     plan = (PisaQueryExecutionPlan *) palloc0(sizeof(PisaQueryExecutionPlan));
     plan->essential_terms = NIL;
     plan->non_essential_terms = NIL;
-    plan->estimated_cost = 0.0;
-    plan->estimated_results = 0;
-    plan->use_block_max_optimization = false;
     plan->use_early_termination = true;
 
+    plan->selected_algorithm = SelectOptimalAlgorithm(index_path, query_terms, top_k);
+    plan->use_block_max_optimization =
+        plan->selected_algorithm == PISA_ALGORITHM_BLOCK_MAX_WAND;
+
     term_count = list_length(query_terms);
+    if (term_count == 0)
+        return plan;
 
-    if (term_count <= 2)
-    {
-        plan->selected_algorithm = PISA_ALGORITHM_WAND;
-        plan->estimated_cost = 100.0;
-    }
-    else if (term_count <= 5)
+    if (index_path != NULL)
+        set = OpenPisaSegmentSet(index_path);
+
+    terms = (char **) palloc(term_count * sizeof(char *));
+    upper_bounds = (double *) palloc(term_count * sizeof(double));
+    doc_freqs = (uint32 *) palloc(term_count * sizeof(uint32));
+
+    i = 0;
+    foreach(cell, query_terms)
     {
-        plan->selected_algorithm = PISA_ALGORITHM_BLOCK_MAX_WAND;
-        plan->use_block_max_optimization = true;
-        plan->estimated_cost = 200.0;
+        char *term = (char *) lfirst(cell);
+        PisaSegmentTermStatistics entry;
+        int position = i;
+
+        if (set == NULL || !PisaSegmentSetTermStatistics(set, term, strlen(term), &entry))
+            memset(&entry, 0, sizeof(entry));
+
+        /* Insertion sort on increasing upper bound */
+        while (position > 0 &&
+               upper_bounds[position - 1] > entry.max_score)
+        {
+            terms[position] = terms[position - 1];
+            upper_bounds[position] = upper_bounds[position - 1];
+            doc_freqs[position] = doc_freqs[position - 1];
+            position--;
+        }
+
+        terms[position] = term;
+        upper_bounds[position] = entry.max_score;
+        doc_freqs[position] = entry.doc_freq;
+        i++;
     }
-    else
+
+    if (set != NULL)
     {
-        plan->selected_algorithm = PISA_ALGORITHM_MAXSCORE;
-        plan->estimated_cost = 300.0;
+        num_docs = (uint32) Min(PisaSegmentSetLiveDocs(set), PG_UINT32_MAX);
+        ReleasePisaSegmentSet(set);
     }
 
-    foreach(cell, query_terms)
+    for (i = 0; i < term_count; i++)
     {
-        char *term = (char *) lfirst(cell);
-        if (strlen(term) > 3)
+        prefix_bound += upper_bounds[i];
+        total_postings += doc_freqs[i];
+
+        if (prefix_bound < upper_bounds[term_count - 1])
         {
-            plan->essential_terms = lappend(plan->essential_terms, pstrdup(term));
+            plan->non_essential_terms = lappend(plan->non_essential_terms, pstrdup(terms[i]));
         }
         else
         {
-            plan->non_essential_terms = lappend(plan->non_essential_terms, pstrdup(term));
+            plan->essential_terms = lappend(plan->essential_terms, pstrdup(terms[i]));
+            essential_postings += doc_freqs[i];
         }
     }
 
-    plan->estimated_results = Min(top_k * 2, 1000);
+    /* Every posting is decoded at most once; MaxScore only walks the essential lists */
+    plan->estimated_cost = plan->selected_algorithm == PISA_ALGORITHM_MAXSCORE ?
+                           (double) essential_postings : (double) total_postings;
+    plan->estimated_results = (int) Min((uint64) Max(top_k, 0),
+                                        Min(total_postings, (uint64) num_docs));
+
+    pfree(terms);
+    pfree(upper_bounds);
+    pfree(doc_freqs);
 
     return plan;
 }
 
+/*
+ * Picks the traversal for a query from the posting list statistics of
+ * its terms:
+ *  - WAND when no list spans more than one block, since block maxima
+ *    then carry no more information than the list maxima;
+ *  - MaxScore for long multi-term queries, large k, or when a very
+ *    common term is present: those are the cases where whole lists
+ *    become non-essential and are only probed;
+ *  - Block-Max WAND otherwise.
+ */
 PisaQueryAlgorithm
-SelectOptimalAlgorithm(List *query_terms, int expected_results)
+SelectOptimalAlgorithm(const char *index_path, List *query_terms, int expected_results)
 {
-    int term_count = list_length(query_terms);
+    PisaQueryTermStatistics statistics;
 
-    if (term_count <= 2)
+    if (!CollectPisaQueryTermStatistics(index_path, query_terms, &statistics) ||
+        statistics.present_terms == 0 || statistics.multi_block_terms == 0)
         return PISA_ALGORITHM_WAND;
-    else if (term_count <= 5 && expected_results <= 100)
+
+    /* A single list has no partition to exploit */
+    if (statistics.present_terms == 1)
         return PISA_ALGORITHM_BLOCK_MAX_WAND;
-    else if (term_count > 5)
+
+    if (statistics.present_terms >= PISA_MAXSCORE_MIN_TERMS ||
+        expected_results >= PISA_MAXSCORE_MIN_RESULTS ||
+        statistics.max_doc_freq > statistics.num_docs * PISA_COMMON_TERM_FRACTION)
         return PISA_ALGORITHM_MAXSCORE;
-    else
-        return PISA_ALGORITHM_WAND;
+
+    return PISA_ALGORITHM_BLOCK_MAX_WAND;
+}
+
+/*
+ * Keeps cursors ordered by current docid; exhausted cursors sort last.
+ * Query term counts are small, so insertion sort on an almost sorted
+ * array is the cheapest option here.
+ */
+static void
+SortPisaCursorsByDocId(PisaQueryCursor **cursors, int count)
+{
+    int i;
+
+    for (i = 1; i < count; i++)
+    {
+        PisaQueryCursor *current = cursors[i];
+        int j = i - 1;
+
+        while (j >= 0 && cursors[j]->current_docid > current->current_docid)
+        {
+            cursors[j + 1] = cursors[j];
+            j--;
+        }
+        cursors[j + 1] = current;
+    }
 }
 
 List *
@@ -275,8 +632,9 @@ ExecutePisaWandQuery(PisaAdvancedQueryContext *context)
     List *results = NIL;
     ListCell *cell;
     PisaTopKQueue *topk_queue;
+    PisaQueryCursor **cursor_array;
+    int cursor_count;
     char index_path[MAXPGPATH];
-    uint64_t max_docid = 1000000;
 
     if (context == NULL || context->query_terms == NIL)
         return NIL;
@@ -293,67 +651,62 @@ ExecutePisaWandQuery(PisaAdvancedQueryContext *context)
         cursors = lappend(cursors, cursor);
     }
 
+    cursor_array = (PisaQueryCursor **) palloc(list_length(cursors) *
+                                               sizeof(PisaQueryCursor *));
+    cursor_count = 0;
+    foreach(cell, cursors)
+        cursor_array[cursor_count++] = (PisaQueryCursor *) lfirst(cell);
+
     while (true)
     {
         double upper_bound = 0.0;
         int pivot = -1;
-        bool found_pivot = false;
-        uint64_t min_docid = UINT64_MAX;
-        ListCell *cursor_cell;
-        int cursor_idx = 0;
+        uint64_t pivot_docid;
+        int i;
 
-        foreach(cursor_cell, cursors)
-        {
-            PisaQueryCursor *cursor = (PisaQueryCursor *) lfirst(cursor_cell);
-            if (cursor->exhausted)
-                continue;
+        SortPisaCursorsByDocId(cursor_array, cursor_count);
 
-            if (cursor->current_docid < min_docid)
-                min_docid = cursor->current_docid;
+        /* The pivot is the first cursor whose prefix bound could enter the top-k */
+        for (i = 0; i < cursor_count; i++)
+        {
+            if (cursor_array[i]->exhausted)
+                break;
 
-            upper_bound += cursor->max_score;
+            upper_bound += cursor_array[i]->max_score;
             if (PisaTopKQueueWouldEnter(topk_queue, upper_bound))
             {
-                found_pivot = true;
-                pivot = cursor_idx;
+                pivot = i;
                 break;
             }
-            cursor_idx++;
         }
 
-        if (!found_pivot || min_docid >= max_docid)
+        if (pivot < 0)
             break;
 
-        bool all_match = true;
-        double total_score = 0.0;
-        
-        foreach(cursor_cell, cursors)
+        pivot_docid = cursor_array[pivot]->current_docid;
+
+        if (cursor_array[0]->current_docid == pivot_docid)
         {
-            PisaQueryCursor *cursor = (PisaQueryCursor *) lfirst(cursor_cell);
-            if (cursor->exhausted)
-            {
-                all_match = false;
-                break;
-            }
-            
-            if (cursor->current_docid != min_docid)
-            {
-                all_match = false;
-                PisaQueryCursorNextGeq(cursor, min_docid);
-            }
-            else
+            double total_score = 0.0;
+
+            for (i = 0; i < cursor_count && cursor_array[i]->current_docid == pivot_docid; i++)
             {
-                total_score += cursor->current_score;
-                PisaQueryCursorNext(cursor);
+                total_score += PisaQueryCursorScore(cursor_array[i]);
+                PisaQueryCursorNext(cursor_array[i]);
             }
-        }
 
-        if (all_match)
+            PisaTopKQueueInsert(topk_queue, pivot_docid, total_score);
+        }
+        else
         {
-            PisaTopKQueueInsert(topk_queue, min_docid, total_score);
+            /* No document before the pivot can qualify: skip the lists ahead */
+            for (i = 0; i < pivot && cursor_array[i]->current_docid < pivot_docid; i++)
+                PisaQueryCursorNextGeq(cursor_array[i], pivot_docid);
         }
     }
 
+    pfree(cursor_array);
+
     results = PisaTopKQueueGetResults(topk_queue);
 
     foreach(cell, cursors)
@@ -368,23 +721,189 @@ ExecutePisaWandQuery(PisaAdvancedQueryContext *context)
     return results;
 }
 
+/*
+ * Block-Max WAND (Ding & Suel). Pivot selection uses the list-wide upper
+ * bounds as in WAND; the pivot is then re-checked against the sum of the
+ * block-max scores of the blocks that may contain it, found by moving
+ * only the shallow pointers. When the block bounds cannot beat the top-k
+ * threshold, the whole block region is skipped: the list with the
+ * highest upper bound jumps past the end of the closest block boundary.
+ */
 List *
 ExecutePisaBlockMaxWandQuery(PisaAdvancedQueryContext *context)
 {
+    List *cursors = NIL;
+    List *results = NIL;
+    ListCell *cell;
+    PisaTopKQueue *topk_queue;
+    PisaQueryCursor **cursor_array;
+    int cursor_count;
+    char index_path[MAXPGPATH];
+    int64 evaluated_documents = 0;
+    int64 skipped_regions = 0;
+
+    if (context == NULL || context->query_terms == NIL)
+        return NIL;
+
     elog(DEBUG1, "Executing PISA Block-Max-WAND query for %s.%s", 
          context->database_name, context->collection_name);
-    
-    return ExecutePisaWandQuery(context);
+
+    snprintf(index_path, MAXPGPATH, "%s/%s_%s", 
+             pisa_index_base_path, context->database_name, context->collection_name);
+
+    topk_queue = CreatePisaTopKQueue(context->top_k);
+
+    foreach(cell, context->query_terms)
+    {
+        char *term = (char *) lfirst(cell);
+        PisaQueryCursor *cursor = CreatePisaQueryCursor(term, index_path);
+        cursors = lappend(cursors, cursor);
+    }
+
+    cursor_array = (PisaQueryCursor **) palloc(list_length(cursors) *
+                                               sizeof(PisaQueryCursor *));
+    cursor_count = 0;
+    foreach(cell, cursors)
+        cursor_array[cursor_count++] = (PisaQueryCursor *) lfirst(cell);
+
+    while (true)
+    {
+        double upper_bound = 0.0;
+        double block_upper_bound = 0.0;
+        int pivot = -1;
+        uint64_t pivot_docid;
+        int i;
+
+        SortPisaCursorsByDocId(cursor_array, cursor_count);
+
+        for (i = 0; i < cursor_count; i++)
+        {
+            if (cursor_array[i]->exhausted)
+                break;
+
+            upper_bound += cursor_array[i]->max_score;
+            if (PisaTopKQueueWouldEnter(topk_queue, upper_bound))
+            {
+                pivot = i;
+                break;
+            }
+        }
+
+        if (pivot < 0)
+            break;
+
+        pivot_docid = cursor_array[pivot]->current_docid;
+
+        /* Every list positioned on the pivot contributes to it */
+        while (pivot + 1 < cursor_count &&
+               cursor_array[pivot + 1]->current_docid == pivot_docid)
+            pivot++;
+
+        for (i = 0; i <= pivot; i++)
+        {
+            PisaQueryCursorShallowNextGeq(cursor_array[i], pivot_docid);
+            block_upper_bound += PisaQueryCursorBlockMaxScore(cursor_array[i]);
+        }
+
+        if (PisaTopKQueueWouldEnter(topk_queue, block_upper_bound))
+        {
+            if (cursor_array[0]->current_docid == pivot_docid)
+            {
+                double total_score = 0.0;
+
+                /*
+                 * Replace block bounds by real scores one list at a time and
+                 * stop as soon as the document can no longer qualify.
+                 */
+                for (i = 0; i <= pivot; i++)
+                {
+                    double score = PisaQueryCursorScore(cursor_array[i]);
+
+                    total_score += score;
+                    block_upper_bound -= PisaQueryCursorBlockMaxScore(cursor_array[i]) - score;
+                    if (!PisaTopKQueueWouldEnter(topk_queue, block_upper_bound))
+                        break;
+                }
+
+                evaluated_documents++;
+                if (i > pivot)
+                    PisaTopKQueueInsert(topk_queue, pivot_docid, total_score);
+
+                for (i = 0; i <= pivot; i++)
+                    PisaQueryCursorNext(cursor_array[i]);
+            }
+            else
+            {
+                int next_list = pivot;
+
+                while (cursor_array[next_list]->current_docid == pivot_docid)
+                    next_list--;
+
+                PisaQueryCursorNextGeq(cursor_array[next_list], pivot_docid);
+            }
+        }
+        else
+        {
+            uint64_t next_docid = PISA_CURSOR_END_DOCID;
+            int next_list = 0;
+
+            for (i = 0; i <= pivot; i++)
+            {
+                uint64_t block_last = PisaQueryCursorBlockLastDocId(cursor_array[i]);
+
+                if (block_last < next_docid)
+                    next_docid = block_last;
+                if (cursor_array[i]->max_score > cursor_array[next_list]->max_score)
+                    next_list = i;
+            }
+
+            if (next_docid != PISA_CURSOR_END_DOCID)
+                next_docid++;
+
+            if (pivot + 1 < cursor_count &&
+                cursor_array[pivot + 1]->current_docid < next_docid)
+                next_docid = cursor_array[pivot + 1]->current_docid;
+
+            if (next_docid <= pivot_docid)
+                next_docid = pivot_docid + 1;
+
+            skipped_regions++;
+            PisaQueryCursorNextGeq(cursor_array[next_list], next_docid);
+        }
+    }
+
+    results = PisaTopKQueueGetResults(topk_queue);
+
+    pfree(cursor_array);
+    foreach(cell, cursors)
+    {
+        PisaQueryCursor *cursor = (PisaQueryCursor *) lfirst(cell);
+        FreePisaQueryCursor(cursor);
+    }
+    list_free(cursors);
+    FreePisaTopKQueue(topk_queue);
+
+    elog(DEBUG1, "PISA Block-Max-WAND query returned %d results "
+         "(" INT64_FORMAT " documents scored, " INT64_FORMAT " block regions skipped)",
+         list_length(results), evaluated_documents, skipped_regions);
+    return results;
 }
 
 List *
 ExecutePisaMaxScoreQuery(PisaAdvancedQueryContext *context)
 {
-    List *cursors = NIL;
     List *results = NIL;
     ListCell *cell;
     PisaTopKQueue *topk_queue;
+    PisaQueryCursor **cursor_array;
+    double *upper_bounds;
+    int cursor_count;
+    int first_essential;
+    uint64_t current_docid;
+    int64 scored_documents = 0;
+    int64 non_essential_probes = 0;
     char index_path[MAXPGPATH];
+    int i;
 
     if (context == NULL || context->query_terms == NIL)
         return NIL;
@@ -401,17 +920,95 @@ ExecutePisaMaxScoreQuery(PisaAdvancedQueryContext *context)
     {
         char *term = (char *) lfirst(cell);
         PisaQueryCursor *cursor = CreatePisaQueryCursor(term, index_path);
-        cursors = lappend(cursors, cursor);
+        context->cursors = lappend(context->cursors, cursor);
     }
 
+    OptimizeQueryWithEssentialTerms(context);
+
+    /*
+     * Cursors are now ordered by increasing upper bound; upper_bounds[i]
+     * is the best score a document can get from cursors 0..i alone.
+     */
+    cursor_count = list_length(context->cursors);
+    cursor_array = (PisaQueryCursor **) palloc(cursor_count * sizeof(PisaQueryCursor *));
+    upper_bounds = (double *) palloc(cursor_count * sizeof(double));
+    i = 0;
+    foreach(cell, context->cursors)
+    {
+        cursor_array[i] = (PisaQueryCursor *) lfirst(cell);
+        upper_bounds[i] = cursor_array[i]->max_score + (i > 0 ? upper_bounds[i - 1] : 0.0);
+        i++;
+    }
+
+    /*
+     * Cursors before first_essential are non-essential: a document found
+     * only in them cannot beat the threshold, so candidates are generated
+     * from the essential lists alone and the others are only probed.
+     */
+    first_essential = 0;
+    current_docid = PISA_CURSOR_END_DOCID;
+    for (i = 0; i < cursor_count; i++)
+        current_docid = Min(current_docid, PisaQueryCursorDocId(cursor_array[i]));
+
+    while (first_essential < cursor_count && current_docid != PISA_CURSOR_END_DOCID)
+    {
+        uint64_t next_docid = PISA_CURSOR_END_DOCID;
+        double score = 0.0;
+
+        for (i = first_essential; i < cursor_count; i++)
+        {
+            PisaQueryCursor *cursor = cursor_array[i];
+
+            if (PisaQueryCursorDocId(cursor) == current_docid)
+            {
+                score += PisaQueryCursorScore(cursor);
+                PisaQueryCursorNext(cursor);
+            }
+
+            next_docid = Min(next_docid, PisaQueryCursorDocId(cursor));
+        }
+
+        /* Probe the non-essential lists, highest bound first, while it can still pay off */
+        for (i = first_essential - 1; i >= 0; i--)
+        {
+            PisaQueryCursor *cursor = cursor_array[i];
+
+            if (!PisaTopKQueueWouldEnter(topk_queue, score + upper_bounds[i]))
+                break;
+
+            non_essential_probes++;
+            PisaQueryCursorNextGeq(cursor, current_docid);
+            if (PisaQueryCursorDocId(cursor) == current_docid)
+                score += PisaQueryCursorScore(cursor);
+        }
+
+        scored_documents++;
+        if (PisaTopKQueueInsert(topk_queue, current_docid, score))
+        {
+            /* The threshold rose: move lists that can no longer qualify a document on their own */
+            while (first_essential < cursor_count &&
+                   !PisaTopKQueueWouldEnter(topk_queue, upper_bounds[first_essential]))
+                first_essential++;
+        }
+
+        current_docid = next_docid;
+    }
+
+    elog(DEBUG1, "PISA MaxScore scored " INT64_FORMAT " documents with " INT64_FORMAT
+         " non-essential probes, %d of %d lists essential at the end",
+         scored_documents, non_essential_probes, cursor_count - first_essential, cursor_count);
+
     results = PisaTopKQueueGetResults(topk_queue);
 
-    foreach(cell, cursors)
+    foreach(cell, context->cursors)
     {
         PisaQueryCursor *cursor = (PisaQueryCursor *) lfirst(cell);
         FreePisaQueryCursor(cursor);
     }
-    list_free(cursors);
+    list_free(context->cursors);
+    context->cursors = NIL;
+    pfree(cursor_array);
+    pfree(upper_bounds);
     FreePisaTopKQueue(topk_queue);
 
     return results;
@@ -449,11 +1046,17 @@ ExecuteAdvancedPisaQuery(const char *database_name, const char *collection_name,
                 results = ExecutePisaMaxScoreQuery(context);
                 break;
             case PISA_ALGORITHM_AUTO:
-                algorithm = SelectOptimalAlgorithm(query_terms, top_k);
+            {
+                char index_path[MAXPGPATH];
+
+                snprintf(index_path, MAXPGPATH, "%s/%s_%s",
+                         pisa_index_base_path, database_name, collection_name);
+                algorithm = SelectOptimalAlgorithm(index_path, query_terms, top_k);
                 context->algorithm = algorithm;
                 results = ExecuteAdvancedPisaQuery(database_name, collection_name, 
                                                  query_terms, algorithm, top_k);
                 break;
+            }
             default:
                 results = ExecutePisaWandQuery(context);
                 break;
@@ -470,15 +1073,52 @@ ExecuteAdvancedPisaQuery(const char *database_name, const char *collection_name,
     return results;
 }
 
+/*
+ * Orders context->cursors by increasing list upper bound, the order in
+ * which MaxScore moves lists from the essential to the non-essential
+ * set. Returns false when there is nothing to partition.
+ */
 bool
 OptimizeQueryWithEssentialTerms(PisaAdvancedQueryContext *context)
 {
-    if (context == NULL)
+    PisaQueryCursor **cursor_array;
+    ListCell *cell;
+    int cursor_count;
+    int i;
+
+    if (context == NULL || list_length(context->cursors) < 2)
         return false;
 
+    cursor_count = list_length(context->cursors);
+    cursor_array = (PisaQueryCursor **) palloc(cursor_count * sizeof(PisaQueryCursor *));
+
+    i = 0;
+    foreach(cell, context->cursors)
+    {
+        PisaQueryCursor *cursor = (PisaQueryCursor *) lfirst(cell);
+        int position = i++;
+
+        while (position > 0 && cursor_array[position - 1]->max_score > cursor->max_score)
+        {
+            cursor_array[position] = cursor_array[position - 1];
+            position--;
+        }
+        cursor_array[position] = cursor;
+    }
+
+    i = 0;
+    foreach(cell, context->cursors)
+        lfirst(cell) = cursor_array[i++];
+
+    pfree(cursor_array);
     return true;
 }
 
+/*
+ * Sum of the list-wide upper bounds of the cursors up to and including
+ * pivot_position. See CalculateBlockMaxUpperBound for the tighter,
+ * docid-local bound used by Block-Max WAND.
+ */
 double
 CalculateQueryUpperBound(List *cursors, int pivot_position)
 {
@@ -499,6 +1139,33 @@ CalculateQueryUpperBound(List *cursors, int pivot_position)
     return upper_bound;
 }
 
+/*
+ * Sum of the block-max scores of the blocks that may contain docid in
+ * the cursors up to and including pivot_position. Moves the shallow
+ * pointers of those cursors to docid.
+ */
+double
+CalculateBlockMaxUpperBound(List *cursors, int pivot_position, uint64_t docid)
+{
+    double upper_bound = 0.0;
+    ListCell *cell;
+    int position = 0;
+
+    foreach(cell, cursors)
+    {
+        PisaQueryCursor *cursor = (PisaQueryCursor *) lfirst(cell);
+
+        if (position > pivot_position)
+            break;
+
+        PisaQueryCursorShallowNextGeq(cursor, docid);
+        upper_bound += PisaQueryCursorBlockMaxScore(cursor);
+        position++;
+    }
+
+    return upper_bound;
+}
+
 bool
 ShouldUseBlockMaxOptimization(List *query_terms, int expected_results)
 {
@@ -566,3 +1233,476 @@ FreePisaQueryExecutionPlan(PisaQueryExecutionPlan *plan)
 
     pfree(plan);
 }
+
+
+/*
+ * Reference top-k queue kept for benchmarking: a sorted array with
+ * insertion-sort updates, which is what PisaTopKQueue used to be.
+ */
+typedef struct PisaSortedTopKArray
+{
+    int capacity;
+    int size;
+    double threshold;
+    uint64_t *docids;
+    double *scores;
+} PisaSortedTopKArray;
+
+static void
+PisaSortedTopKArrayInsert(PisaSortedTopKArray *array, uint64_t docid, double score)
+{
+    int position;
+
+    if (array->size == array->capacity && score <= array->threshold)
+        return;
+
+    position = array->size < array->capacity ? array->size++ : array->capacity - 1;
+    while (position > 0 && array->scores[position - 1] < score)
+    {
+        array->docids[position] = array->docids[position - 1];
+        array->scores[position] = array->scores[position - 1];
+        position--;
+    }
+
+    array->docids[position] = docid;
+    array->scores[position] = score;
+
+    if (array->size == array->capacity)
+        array->threshold = array->scores[array->capacity - 1];
+}
+
+typedef enum PisaTopKBenchmarkMode
+{
+    PISA_TOPK_BENCHMARK_SORTED_ARRAY,
+    PISA_TOPK_BENCHMARK_HEAP,
+    PISA_TOPK_BENCHMARK_HEAP_BATCH
+} PisaTopKBenchmarkMode;
+
+static const char *PisaTopKBenchmarkModeNames[] = {
+    "sorted_array",
+    "heap",
+    "heap_batch"
+};
+
+/*
+ * Feeds the candidate stream to one queue implementation and returns the
+ * elapsed time in milliseconds; the final threshold is returned so the
+ * caller can check all implementations agree.
+ */
+static double
+RunPisaTopKBenchmark(PisaTopKBenchmarkMode mode, const uint64_t *docids,
+                     const double *scores, int count, int top_k, double *threshold)
+{
+    instr_time start;
+    instr_time duration;
+    int i;
+
+    if (mode == PISA_TOPK_BENCHMARK_SORTED_ARRAY)
+    {
+        PisaSortedTopKArray array;
+
+        array.capacity = top_k;
+        array.size = 0;
+        array.threshold = 0.0;
+        array.docids = (uint64_t *) palloc(top_k * sizeof(uint64_t));
+        array.scores = (double *) palloc(top_k * sizeof(double));
+
+        INSTR_TIME_SET_CURRENT(start);
+        for (i = 0; i < count; i++)
+            PisaSortedTopKArrayInsert(&array, docids[i], scores[i]);
+        INSTR_TIME_SET_CURRENT(duration);
+
+        *threshold = array.threshold;
+        pfree(array.docids);
+        pfree(array.scores);
+    }
+    else
+    {
+        PisaTopKQueue *queue = CreatePisaTopKQueue(top_k);
+
+        INSTR_TIME_SET_CURRENT(start);
+        if (mode == PISA_TOPK_BENCHMARK_HEAP_BATCH)
+        {
+            PisaTopKQueueInsertBatch(queue, docids, scores, count);
+        }
+        else
+        {
+            for (i = 0; i < count; i++)
+            {
+                if (PisaTopKQueueWouldEnter(queue, scores[i]))
+                    PisaTopKQueueInsert(queue, docids[i], scores[i]);
+            }
+        }
+        INSTR_TIME_SET_CURRENT(duration);
+
+        *threshold = queue->threshold;
+        FreePisaTopKQueue(queue);
+    }
+
+    INSTR_TIME_SUBTRACT(duration, start);
+    return INSTR_TIME_GET_MILLISEC(duration);
+}
+
+/*
+ * Candidate stream of the top-k queue benchmark and tests: docids in
+ * order with xorshift64 scores, skewed so that few candidates beat the
+ * threshold.
+ */
+static void
+GeneratePisaTopKCandidates(uint64_t *docids, double *scores, int count)
+{
+    uint64 state = UINT64CONST(0x9E3779B97F4A7C15);
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        double uniform = (double) (PisaTestRandom(&state) >> 11) /
+                         (double) (UINT64CONST(1) << 53);
+
+        docids[i] = i;
+        scores[i] = uniform * uniform * 20.0;
+    }
+}
+
+PG_FUNCTION_INFO_V1(documentdb_benchmark_pisa_topk_queue);
+
+/*
+ * Compares the old sorted-array top-k queue with the heap queue, inserted
+ * one document at a time and in batches, over the same deterministic
+ * stream of candidate scores.
+ */
+Datum
+documentdb_benchmark_pisa_topk_queue(PG_FUNCTION_ARGS)
+{
+    int32 candidate_count = PG_GETARG_INT32(0);
+    int32 top_k = PG_GETARG_INT32(1);
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    uint64_t *docids;
+    double *scores;
+    int mode;
+
+    if (candidate_count <= 0 || top_k <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("candidate_count and top_k must be positive")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    docids = (uint64_t *) palloc(candidate_count * sizeof(uint64_t));
+    scores = (double *) palloc(candidate_count * sizeof(double));
+    GeneratePisaTopKCandidates(docids, scores, candidate_count);
+
+    for (mode = PISA_TOPK_BENCHMARK_SORTED_ARRAY; mode <= PISA_TOPK_BENCHMARK_HEAP_BATCH; mode++)
+    {
+        Datum values[4];
+        bool nulls[4] = { false, false, false, false };
+        double threshold;
+        double elapsed_ms;
+
+        elapsed_ms = RunPisaTopKBenchmark((PisaTopKBenchmarkMode) mode, docids, scores,
+                                          candidate_count, top_k, &threshold);
+
+        values[0] = CStringGetTextDatum(PisaTopKBenchmarkModeNames[mode]);
+        values[1] = Int64GetDatum(candidate_count);
+        values[2] = Float8GetDatum(elapsed_ms);
+        values[3] = Float8GetDatum(threshold);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    pfree(docids);
+    pfree(scores);
+
+    PG_RETURN_VOID();
+}
+
+
+PG_FUNCTION_INFO_V1(documentdb_pisa_topk_queue_for_test);
+
+/*
+ * Test helper: feeds the benchmark candidate stream to the heap queue,
+ * one document at a time and in batches, and returns for each whether it
+ * kept the same documents, in the same order and with the same scores,
+ * as the sorted array.
+ */
+Datum
+documentdb_pisa_topk_queue_for_test(PG_FUNCTION_ARGS)
+{
+    int32 candidate_count = PG_GETARG_INT32(0);
+    int32 top_k = PG_GETARG_INT32(1);
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    PisaSortedTopKArray array;
+    uint64_t *docids;
+    double *scores;
+    int mode;
+    int i;
+
+    if (candidate_count <= 0 || top_k <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("candidate_count and top_k must be positive")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    docids = (uint64_t *) palloc(candidate_count * sizeof(uint64_t));
+    scores = (double *) palloc(candidate_count * sizeof(double));
+    GeneratePisaTopKCandidates(docids, scores, candidate_count);
+
+    array.capacity = top_k;
+    array.size = 0;
+    array.threshold = 0.0;
+    array.docids = (uint64_t *) palloc(top_k * sizeof(uint64_t));
+    array.scores = (double *) palloc(top_k * sizeof(double));
+    for (i = 0; i < candidate_count; i++)
+        PisaSortedTopKArrayInsert(&array, docids[i], scores[i]);
+
+    for (mode = PISA_TOPK_BENCHMARK_HEAP; mode <= PISA_TOPK_BENCHMARK_HEAP_BATCH; mode++)
+    {
+        PisaTopKQueue *queue = CreatePisaTopKQueue(top_k);
+        Datum values[3];
+        bool nulls[3] = { false, false, false };
+        List *results;
+        ListCell *cell;
+        bool same_results;
+
+        if (mode == PISA_TOPK_BENCHMARK_HEAP_BATCH)
+        {
+            PisaTopKQueueInsertBatch(queue, docids, scores, candidate_count);
+        }
+        else
+        {
+            for (i = 0; i < candidate_count; i++)
+                PisaTopKQueueInsert(queue, docids[i], scores[i]);
+        }
+
+        results = PisaTopKQueueGetResults(queue);
+        same_results = list_length(results) == array.size &&
+                       queue->threshold == array.threshold;
+        foreach(cell, results)
+        {
+            PisaTextSearchResult *result = (PisaTextSearchResult *) lfirst(cell);
+            int position = foreach_current_index(cell);
+
+            if (!same_results)
+                break;
+
+            same_results = strtoull(result->document_id, NULL, 10) == array.docids[position] &&
+                           result->score == array.scores[position];
+        }
+
+        values[0] = CStringGetTextDatum(PisaTopKBenchmarkModeNames[mode]);
+        values[1] = Int32GetDatum(list_length(results));
+        values[2] = BoolGetDatum(same_results);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+        FreePisaTopKQueue(queue);
+    }
+
+    pfree(array.docids);
+    pfree(array.scores);
+    pfree(docids);
+    pfree(scores);
+
+    PG_RETURN_VOID();
+}
+
+
+PG_FUNCTION_INFO_V1(documentdb_pisa_ranked_query_for_test);
+
+/*
+ * Test helper: writes an index with a common, a mid-frequency and a rare
+ * term, queries them together with a term missing from the index using
+ * WAND, Block-Max WAND and MaxScore, and returns for each whether it found
+ * the same top-k documents and scores as scoring every posting.
+ */
+Datum
+documentdb_pisa_ranked_query_for_test(PG_FUNCTION_ARGS)
+{
+#define PISA_TEST_RANKED_TERMS 3
+#define PISA_TEST_RANKED_ALGORITHMS 3
+    static const char *terms[PISA_TEST_RANKED_TERMS] = { "alpha", "beta", "gamma" };
+    static const uint32 strides[PISA_TEST_RANKED_TERMS] = { 2, 7, 61 };
+    static const uint32 freq_cycles[PISA_TEST_RANKED_TERMS] = { 3, 5, 4 };
+    static const PisaQueryAlgorithm algorithms[PISA_TEST_RANKED_ALGORITHMS] = {
+        PISA_ALGORITHM_WAND, PISA_ALGORITHM_BLOCK_MAX_WAND, PISA_ALGORITHM_MAXSCORE
+    };
+    static const char *algorithm_names[PISA_TEST_RANKED_ALGORITHMS] = {
+        "wand", "block_max_wand", "maxscore"
+    };
+    const uint32 num_docs = 2000;
+    int32 top_k = PG_GETARG_INT32(0);
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    PisaSortedTopKArray expected;
+    List *query_terms;
+    uint32 *doc_lengths;
+    uint32 *docids;
+    uint32 *freqs;
+    double *scores;
+    char *saved_base_path = pisa_index_base_path;
+    char *directory;
+    uint32 i;
+    int t;
+
+    if (top_k <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("top_k must be positive")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    /* Distinct document lengths keep documents with the same terms from tying */
+    doc_lengths = (uint32 *) palloc(num_docs * sizeof(uint32));
+    for (i = 0; i < num_docs; i++)
+        doc_lengths[i] = 20 + i;
+
+    docids = (uint32 *) palloc(num_docs * sizeof(uint32));
+    freqs = (uint32 *) palloc(num_docs * sizeof(uint32));
+    scores = (double *) palloc0(num_docs * sizeof(double));
+    query_terms = list_make4(pstrdup("alpha"), pstrdup("beta"), pstrdup("gamma"),
+                             pstrdup("zeta"));
+
+    expected.capacity = top_k;
+    expected.size = 0;
+    expected.threshold = 0.0;
+    expected.docids = (uint64_t *) palloc(top_k * sizeof(uint64_t));
+    expected.scores = (double *) palloc(top_k * sizeof(double));
+
+    directory = CreatePisaTestDirectory("ranked_query");
+    PG_TRY();
+    {
+        char *index_path = psprintf("%s/unit_ranked", directory);
+        PisaIndexWriter *writer;
+        PisaSegmentSet *set;
+
+        writer = BeginPisaIndexWriter(GetPisaIndexFilePath(index_path),
+                                      PISA_COMPRESSION_BLOCK_SIMDBP, num_docs, doc_lengths);
+        for (t = 0; t < PISA_TEST_RANKED_TERMS; t++)
+        {
+            uint32 count = 0;
+
+            for (i = 0; i < num_docs; i += strides[t])
+            {
+                docids[count] = i;
+                freqs[count] = 1 + i % freq_cycles[t];
+                count++;
+            }
+
+            PisaIndexWriterAddTerm(writer, terms[t], strlen(terms[t]), docids, freqs, count);
+        }
+        FinishPisaIndexWriter(writer);
+
+        /* The expected results score every posting of every term */
+        set = OpenPisaSegmentSet(index_path);
+        for (t = 0; t < PISA_TEST_RANKED_TERMS; t++)
+        {
+            PisaSegmentCursor *cursor = OpenPisaSegmentCursor(set, terms[t], strlen(terms[t]));
+
+            while (cursor->docid != PISA_POSTING_END)
+            {
+                scores[cursor->docid] += PisaSegmentCursorScore(cursor);
+                PisaSegmentCursorNext(cursor);
+            }
+
+            ClosePisaSegmentCursor(cursor);
+        }
+        ReleasePisaSegmentSet(set);
+
+        for (i = 0; i < num_docs; i++)
+        {
+            if (scores[i] > 0.0)
+                PisaSortedTopKArrayInsert(&expected, i, scores[i]);
+        }
+
+        pisa_index_base_path = directory;
+        for (t = 0; t < PISA_TEST_RANKED_ALGORITHMS; t++)
+        {
+            PisaAdvancedQueryContext *context;
+            Datum values[3];
+            bool nulls[3] = { false, false, false };
+            List *results = NIL;
+            ListCell *cell;
+            bool same_results;
+
+            context = (PisaAdvancedQueryContext *) palloc0(sizeof(PisaAdvancedQueryContext));
+            context->database_name = pstrdup("unit");
+            context->collection_name = pstrdup("ranked");
+            context->query_terms = query_terms;
+            context->algorithm = algorithms[t];
+            context->top_k = top_k;
+
+            switch (algorithms[t])
+            {
+                case PISA_ALGORITHM_BLOCK_MAX_WAND:
+                    results = ExecutePisaBlockMaxWandQuery(context);
+                    break;
+                case PISA_ALGORITHM_MAXSCORE:
+                    results = ExecutePisaMaxScoreQuery(context);
+                    break;
+                default:
+                    results = ExecutePisaWandQuery(context);
+                    break;
+            }
+
+            same_results = list_length(results) == expected.size;
+            foreach(cell, results)
+            {
+                PisaTextSearchResult *result = (PisaTextSearchResult *) lfirst(cell);
+                int position = foreach_current_index(cell);
+
+                if (!same_results)
+                    break;
+
+                same_results = strtoull(result->document_id, NULL, 10) ==
+                               expected.docids[position] &&
+                               fabs(result->score - expected.scores[position]) < 1e-9;
+            }
+
+            values[0] = CStringGetTextDatum(algorithm_names[t]);
+            values[1] = Int32GetDatum(list_length(results));
+            values[2] = BoolGetDatum(same_results);
+            tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+            FreePisaAdvancedQueryContext(context);
+        }
+    }
+    PG_FINALLY();
+    {
+        pisa_index_base_path = saved_base_path;
+        RemovePisaTestDirectory(directory);
+    }
+    PG_END_TRY();
+
+    PG_RETURN_VOID();
+}
@@ -92,45 +92,29 @@ bool
 WritePisaForwardIndex(PisaCollection *collection)
 {
     char forward_index_path[MAXPGPATH];
-    FILE *forward_file;
+    PisaForwardIndexWriter *writer;
     ListCell *cell;
-    int doc_count = 0;
 
     if (collection == NULL || collection->documents == NIL)
         return false;
 
-    snprintf(forward_index_path, MAXPGPATH, "%s.forward", collection->index_path);
+    snprintf(forward_index_path, MAXPGPATH, "%s%s", collection->index_path,
+             PISA_FORWARD_FILE_SUFFIX);
 
-    forward_file = fopen(forward_index_path, "w");
-    if (forward_file == NULL)
-    {
-        elog(ERROR, "Failed to create forward index file: %s", forward_index_path);
-        return false;
-    }
+    writer = BeginPisaForwardIndexWriter(forward_index_path);
 
-    PG_TRY();
+    foreach(cell, collection->documents)
     {
-        foreach(cell, collection->documents)
-        {
-            PisaDocument *doc = (PisaDocument *) lfirst(cell);
-            
-            fprintf(forward_file, "%s\t%s\n", doc->doc_id, doc->content);
-            doc_count++;
-        }
+        PisaDocument *doc = (PisaDocument *) lfirst(cell);
 
-        fclose(forward_file);
-        
-        elog(LOG, "Successfully wrote %d documents to forward index: %s", 
-             doc_count, forward_index_path);
-    }
-    PG_CATCH();
-    {
-        if (forward_file)
-            fclose(forward_file);
-        elog(ERROR, "Failed to write forward index file: %s", forward_index_path);
-        return false;
+        PisaForwardIndexWriterAddText(writer, doc->content, strlen(doc->content));
+        PisaForwardIndexWriterEndDocument(writer, doc->doc_id);
     }
-    PG_END_TRY();
+
+    FinishPisaForwardIndexWriter(writer);
+
+    elog(LOG, "Successfully wrote %d documents to forward index: %s",
+         list_length(collection->documents), forward_index_path);
 
     return true;
 }
@@ -246,6 +230,53 @@ ExtractTextContentFromBson(const pgbson *document)
     return text_content.data;
 }
 
+/*
+ * Adds the text of a document to the current document of a forward index
+ * writer. Visits the same fields as ExtractTextContentFromBson, but the
+ * strings are tokenized in place in the BSON buffer instead of being
+ * copied into a text string first.
+ */
+void
+AddBsonTextToPisaForwardIndex(PisaForwardIndexWriter *writer, const pgbson *document)
+{
+    bson_iter_t iter;
+
+    PgbsonInitIterator(document, &iter);
+    while (bson_iter_next(&iter))
+    {
+        bson_iter_t sub_iter;
+        uint32_t length;
+        const char *str_value;
+
+        if (strcmp(bson_iter_key(&iter), "_id") == 0)
+            continue;
+
+        switch (bson_iter_type(&iter))
+        {
+            case BSON_TYPE_UTF8:
+                str_value = bson_iter_utf8(&iter, &length);
+                PisaForwardIndexWriterAddText(writer, str_value, (int) length);
+                break;
+            case BSON_TYPE_DOCUMENT:
+            case BSON_TYPE_ARRAY:
+                if (!bson_iter_recurse(&iter, &sub_iter))
+                    break;
+
+                while (bson_iter_next(&sub_iter))
+                {
+                    if (bson_iter_type(&sub_iter) != BSON_TYPE_UTF8)
+                        continue;
+
+                    str_value = bson_iter_utf8(&sub_iter, &length);
+                    PisaForwardIndexWriterAddText(writer, str_value, (int) length);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
 char *
 GeneratePisaDocumentId(const pgbson *document, int64 collection_id)
 {
@@ -293,7 +324,9 @@ GeneratePisaDocumentId(const pgbson *document, int64 collection_id)
                 break;
             }
             default:
-                appendStringInfo(&id_buffer, "col_%ld_unknown", collection_id);
+                /* Index sync finds the documents it replaces by this id */
+                appendStringInfoString(&id_buffer,
+                                       BsonValueToJsonForLogging(bson_iter_value(&iter)));
                 break;
         }
     }
@@ -1,17 +1,85 @@
 #include "postgres.h"
+
+#include <math.h>
+
 #include "fmgr.h"
+#include "funcapi.h"
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "port/atomics.h"
+#include "port/pg_bitutils.h"
 #include "utils/memutils.h"
 #include "utils/builtins.h"
+#include "utils/snapmgr.h"
 #include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include "storage/fd.h"
 #include "storage/lwlock.h"
+#include "storage/shm_toc.h"
 #include "postmaster/bgworker.h"
 #include "miscadmin.h"
 
 #include "io/pgbson.h"
 #include "pisa_integration/document_reordering.h"
+#include "pisa_integration/forward_index.h"
+#include "pisa_integration/index_segments.h"
 #include "pisa_integration/pisa_integration.h"
 #include "pisa_integration/data_bridge.h"
 
+/* Swap rounds per bisection and smallest partition that is still split */
+#define PISA_BP_MAX_ITERATIONS 20
+#define PISA_BP_MIN_PARTITION_SIZE 16
+
+/* shm_toc keys of the parallel bisection */
+#define PISA_BP_KEY_SHARED UINT64CONST(0xD0C0B15EC7000001)
+#define PISA_BP_KEY_DOC_OFFSETS UINT64CONST(0xD0C0B15EC7000002)
+#define PISA_BP_KEY_TERM_IDS UINT64CONST(0xD0C0B15EC7000003)
+#define PISA_BP_KEY_DOCUMENTS UINT64CONST(0xD0C0B15EC7000004)
+#define PISA_BP_KEY_TASKS UINT64CONST(0xD0C0B15EC7000005)
+
+/* A subtree left to bisect: documents[start, start + count) */
+typedef struct PisaBisectionTask
+{
+    uint32 start;
+    uint32 count;
+    int depth;
+} PisaBisectionTask;
+
+typedef struct PisaBisectionShared
+{
+    uint32 num_docs;
+    uint32 num_terms;
+    int max_iterations;
+    uint32 num_tasks;
+    pg_atomic_uint32 next_task;
+} PisaBisectionShared;
+
+typedef struct PisaBisectionGain
+{
+    double gain;
+    uint32 document;
+} PisaBisectionGain;
+
+/* Per-process scratch space of the bisection */
+typedef struct PisaBisectionState
+{
+    const uint64 *doc_offsets;
+    const uint32 *term_ids;
+    int max_iterations;
+    uint32 *left_degrees;
+    uint32 *right_degrees;
+    PisaBisectionGain *left_gains;
+    PisaBisectionGain *right_gains;
+    double *log2_table;
+} PisaBisectionState;
+
+static int ComparePisaBisectionGains(const void *left, const void *right);
+static void WriteDocumentReorderingPermutation(const char *index_path,
+                                               PisaForwardIndex *forward_index,
+                                               const uint32 *permutation);
+static void WriteDocumentReorderingStats(const char *index_path,
+                                         DocumentReorderingStats *stats);
+
 ReorderingScheduler *reordering_scheduler = NULL;
 
 void
@@ -227,89 +295,655 @@ CompleteReorderingTask(DocumentReorderingTask *task, bool success)
     return true;
 }
 
+/*
+ * Recursive graph bisection (Dhulipala et al., "Compressing Graphs and
+ * Indexes with Recursive Graph Bisection", KDD 2016).
+ *
+ * The documents of a partition are split in two halves; for up to
+ * PISA_BP_MAX_ITERATIONS rounds every document gets the estimated gain
+ * (in log-gap bits) of moving to the other half, both halves are sorted
+ * by gain and the best pairs are swapped while the combined gain is
+ * positive. Each half is then bisected recursively. The final order of
+ * the documents is the new docid assignment.
+ *
+ * The leader bisects the top levels itself and hands the resulting
+ * subtrees, which are independent, to a fixed pool of parallel workers
+ * that pull them from a shared task counter.
+ */
+static void
+InitPisaBisectionState(PisaBisectionState *state, const uint64 *doc_offsets,
+                       const uint32 *term_ids, uint32 num_docs, uint32 num_terms,
+                       int max_iterations)
+{
+    uint32 i;
+
+    state->doc_offsets = doc_offsets;
+    state->term_ids = term_ids;
+    state->max_iterations = max_iterations;
+    state->left_degrees = (uint32 *) palloc_extended(Max(num_terms, 1) * sizeof(uint32),
+                                                     MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    state->right_degrees = (uint32 *) palloc_extended(Max(num_terms, 1) * sizeof(uint32),
+                                                      MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    state->left_gains = (PisaBisectionGain *)
+        palloc_extended((num_docs / 2 + 1) * sizeof(PisaBisectionGain), MCXT_ALLOC_HUGE);
+    state->right_gains = (PisaBisectionGain *)
+        palloc_extended((num_docs / 2 + 1) * sizeof(PisaBisectionGain), MCXT_ALLOC_HUGE);
+
+    /* log2(k) for every degree + 1 and partition size that can show up */
+    state->log2_table = (double *) palloc_extended(((Size) num_docs + 2) * sizeof(double),
+                                                   MCXT_ALLOC_HUGE);
+    state->log2_table[0] = 0.0;
+    for (i = 1; i < num_docs + 2; i++)
+        state->log2_table[i] = log2((double) i);
+}
+
+
+static void
+FreePisaBisectionState(PisaBisectionState *state)
+{
+    pfree(state->left_degrees);
+    pfree(state->right_degrees);
+    pfree(state->left_gains);
+    pfree(state->right_gains);
+    pfree(state->log2_table);
+}
+
+
+/*
+ * Approximate cost in bits of a posting list with 'degree' entries in a
+ * partition of 2^log_size documents.
+ */
+static inline double
+PisaBisectionCost(PisaBisectionState *state, uint32 degree, double log_size)
+{
+    return degree * (log_size - state->log2_table[degree + 1]);
+}
+
+
+static void
+ComputeMoveGains(PisaBisectionState *state, const uint32 *documents, uint32 count,
+                 const uint32 *from_degrees, const uint32 *to_degrees,
+                 double log_from, double log_to, PisaBisectionGain *gains)
+{
+    uint32 i;
+
+    for (i = 0; i < count; i++)
+    {
+        uint32 document = documents[i];
+        double gain = 0.0;
+        uint64 posting;
+
+        for (posting = state->doc_offsets[document];
+             posting < state->doc_offsets[document + 1]; posting++)
+        {
+            uint32 term = state->term_ids[posting];
+            uint32 from = from_degrees[term];
+            uint32 to = to_degrees[term];
+
+            gain += PisaBisectionCost(state, from, log_from) +
+                    PisaBisectionCost(state, to, log_to) -
+                    PisaBisectionCost(state, from - 1, log_from) -
+                    PisaBisectionCost(state, to + 1, log_to);
+        }
+
+        gains[i].gain = gain;
+        gains[i].document = document;
+    }
+}
+
+
+static void
+MovePisaBisectionDocument(PisaBisectionState *state, uint32 document,
+                          uint32 *from_degrees, uint32 *to_degrees)
+{
+    uint64 posting;
+
+    for (posting = state->doc_offsets[document];
+         posting < state->doc_offsets[document + 1]; posting++)
+    {
+        from_degrees[state->term_ids[posting]]--;
+        to_degrees[state->term_ids[posting]]++;
+    }
+}
+
+
+/*
+ * Splits 'documents' in two halves of (almost) equal size that share as
+ * few terms as possible.
+ */
+static void
+BisectPisaPartition(PisaBisectionState *state, uint32 *documents, uint32 count)
+{
+    uint32 left_count = count / 2;
+    uint32 right_count = count - left_count;
+    uint32 *left = documents;
+    uint32 *right = documents + left_count;
+    double log_left = state->log2_table[left_count];
+    double log_right = state->log2_table[right_count];
+    uint32 i;
+    int iteration;
+
+    for (i = 0; i < count; i++)
+    {
+        uint64 posting;
+
+        for (posting = state->doc_offsets[documents[i]];
+             posting < state->doc_offsets[documents[i] + 1]; posting++)
+        {
+            state->left_degrees[state->term_ids[posting]] = 0;
+            state->right_degrees[state->term_ids[posting]] = 0;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        uint32 *degrees = i < left_count ? state->left_degrees : state->right_degrees;
+        uint64 posting;
+
+        for (posting = state->doc_offsets[documents[i]];
+             posting < state->doc_offsets[documents[i] + 1]; posting++)
+            degrees[state->term_ids[posting]]++;
+    }
+
+    for (iteration = 0; iteration < state->max_iterations; iteration++)
+    {
+        uint32 swaps = 0;
+
+        ComputeMoveGains(state, left, left_count, state->left_degrees,
+                         state->right_degrees, log_left, log_right, state->left_gains);
+        ComputeMoveGains(state, right, right_count, state->right_degrees,
+                         state->left_degrees, log_right, log_left, state->right_gains);
+
+        qsort(state->left_gains, left_count, sizeof(PisaBisectionGain),
+              ComparePisaBisectionGains);
+        qsort(state->right_gains, right_count, sizeof(PisaBisectionGain),
+              ComparePisaBisectionGains);
+
+        while (swaps < left_count &&
+               state->left_gains[swaps].gain + state->right_gains[swaps].gain > 0.0)
+        {
+            MovePisaBisectionDocument(state, state->left_gains[swaps].document,
+                                      state->left_degrees, state->right_degrees);
+            MovePisaBisectionDocument(state, state->right_gains[swaps].document,
+                                      state->right_degrees, state->left_degrees);
+            swaps++;
+        }
+
+        if (swaps == 0)
+            break;
+
+        for (i = 0; i < left_count; i++)
+            left[i] = i < swaps ? state->right_gains[i].document :
+                      state->left_gains[i].document;
+        for (i = 0; i < right_count; i++)
+            right[i] = i < swaps ? state->left_gains[i].document :
+                       state->right_gains[i].document;
+
+        CHECK_FOR_INTERRUPTS();
+    }
+}
+
+
+static void
+RecursivePisaBisection(PisaBisectionState *state, uint32 *documents, uint32 count, int depth)
+{
+    if (depth <= 0 || count < PISA_BP_MIN_PARTITION_SIZE)
+        return;
+
+    BisectPisaPartition(state, documents, count);
+    RecursivePisaBisection(state, documents, count / 2, depth - 1);
+    RecursivePisaBisection(state, documents + count / 2, count - count / 2, depth - 1);
+}
+
+
+/*
+ * Bisects the top 'levels' levels and records the subtrees below them as
+ * tasks for the worker pool.
+ */
+static void
+BisectPisaTopLevels(PisaBisectionState *state, uint32 *documents, uint32 start,
+                    uint32 count, int depth, int levels, PisaBisectionTask *tasks,
+                    uint32 *num_tasks)
+{
+    if (levels == 0 || depth <= 0 || count < PISA_BP_MIN_PARTITION_SIZE)
+    {
+        tasks[*num_tasks].start = start;
+        tasks[*num_tasks].count = count;
+        tasks[*num_tasks].depth = depth;
+        (*num_tasks)++;
+        return;
+    }
+
+    BisectPisaPartition(state, documents + start, count);
+    BisectPisaTopLevels(state, documents, start, count / 2, depth - 1, levels - 1,
+                        tasks, num_tasks);
+    BisectPisaTopLevels(state, documents, start + count / 2, count - count / 2,
+                        depth - 1, levels - 1, tasks, num_tasks);
+}
+
+
+static void
+RunPisaBisectionTasks(PisaBisectionState *state, uint32 *documents,
+                      const PisaBisectionTask *tasks, PisaBisectionShared *shared)
+{
+    for (;;)
+    {
+        uint32 task = pg_atomic_fetch_add_u32(&shared->next_task, 1);
+
+        if (task >= shared->num_tasks)
+            break;
+
+        RecursivePisaBisection(state, documents + tasks[task].start, tasks[task].count,
+                               tasks[task].depth);
+    }
+}
+
+
+/*
+ * Entry point of the parallel workers started by
+ * RunPisaBisectionInParallel.
+ */
+void
+PisaGraphBisectionWorkerMain(dsm_segment *segment, shm_toc *toc)
+{
+    PisaBisectionShared *shared;
+    PisaBisectionState state;
+
+    shared = (PisaBisectionShared *) shm_toc_lookup(toc, PISA_BP_KEY_SHARED, false);
+
+    InitPisaBisectionState(&state,
+                           shm_toc_lookup(toc, PISA_BP_KEY_DOC_OFFSETS, false),
+                           shm_toc_lookup(toc, PISA_BP_KEY_TERM_IDS, false),
+                           shared->num_docs, shared->num_terms, shared->max_iterations);
+
+    RunPisaBisectionTasks(&state, shm_toc_lookup(toc, PISA_BP_KEY_DOCUMENTS, false),
+                          shm_toc_lookup(toc, PISA_BP_KEY_TASKS, false), shared);
+
+    FreePisaBisectionState(&state);
+}
+
+
+static void
+RunPisaBisectionInParallel(PisaBisectionState *state, PisaForwardIndex *index,
+                           uint32 *documents, PisaBisectionTask *tasks, uint32 num_tasks,
+                           int workers)
+{
+    ParallelContext *pcxt;
+    PisaBisectionShared *shared;
+    Size offsets_size = ((Size) index->num_docs + 1) * sizeof(uint64);
+    Size term_ids_size = Max(index->num_postings, 1) * sizeof(uint32);
+    Size documents_size = (Size) index->num_docs * sizeof(uint32);
+    Size tasks_size = (Size) num_tasks * sizeof(PisaBisectionTask);
+    void *shared_offsets;
+    void *shared_term_ids;
+    uint32 *shared_documents;
+    PisaBisectionTask *shared_tasks;
+
+    EnterParallelMode();
+    pcxt = CreateParallelContext("pg_documentdb", "PisaGraphBisectionWorkerMain", workers);
+
+    shm_toc_estimate_chunk(&pcxt->estimator, sizeof(PisaBisectionShared));
+    shm_toc_estimate_chunk(&pcxt->estimator, offsets_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, term_ids_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, documents_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, tasks_size);
+    shm_toc_estimate_keys(&pcxt->estimator, 5);
+    InitializeParallelDSM(pcxt);
+
+    shared = (PisaBisectionShared *) shm_toc_allocate(pcxt->toc, sizeof(PisaBisectionShared));
+    shared->num_docs = index->num_docs;
+    shared->num_terms = index->num_terms;
+    shared->max_iterations = state->max_iterations;
+    shared->num_tasks = num_tasks;
+    pg_atomic_init_u32(&shared->next_task, 0);
+    shm_toc_insert(pcxt->toc, PISA_BP_KEY_SHARED, shared);
+
+    shared_offsets = shm_toc_allocate(pcxt->toc, offsets_size);
+    memcpy(shared_offsets, index->doc_offsets, offsets_size);
+    shm_toc_insert(pcxt->toc, PISA_BP_KEY_DOC_OFFSETS, shared_offsets);
+
+    shared_term_ids = shm_toc_allocate(pcxt->toc, term_ids_size);
+    memcpy(shared_term_ids, index->term_ids, index->num_postings * sizeof(uint32));
+    shm_toc_insert(pcxt->toc, PISA_BP_KEY_TERM_IDS, shared_term_ids);
+
+    shared_documents = (uint32 *) shm_toc_allocate(pcxt->toc, documents_size);
+    memcpy(shared_documents, documents, documents_size);
+    shm_toc_insert(pcxt->toc, PISA_BP_KEY_DOCUMENTS, shared_documents);
+
+    shared_tasks = (PisaBisectionTask *) shm_toc_allocate(pcxt->toc, tasks_size);
+    memcpy(shared_tasks, tasks, tasks_size);
+    shm_toc_insert(pcxt->toc, PISA_BP_KEY_TASKS, shared_tasks);
+
+    LaunchParallelWorkers(pcxt);
+
+    elog(DEBUG1, "Graph bisection: %u subtrees on %d parallel workers and the leader",
+         num_tasks, pcxt->nworkers_launched);
+
+    /* The leader takes tasks too, so this completes even if no worker started */
+    RunPisaBisectionTasks(state, shared_documents, shared_tasks, shared);
+
+    WaitForParallelWorkersToFinish(pcxt);
+    memcpy(documents, shared_documents, documents_size);
+
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+}
+
+
+/*
+ * Returns the new document order: element i is the forward index
+ * position of the document that gets docid i.
+ */
+static uint32 *
+ComputeGraphBisectionPermutation(PisaForwardIndex *index, int depth, int leader_levels,
+                                 int workers)
+{
+    PisaBisectionState state;
+    PisaBisectionTask *tasks;
+    uint32 *documents;
+    uint32 num_tasks = 0;
+    uint32 i;
+
+    documents = (uint32 *) palloc_extended(Max(index->num_docs, 1) * sizeof(uint32),
+                                           MCXT_ALLOC_HUGE);
+    for (i = 0; i < index->num_docs; i++)
+        documents[i] = i;
+
+    InitPisaBisectionState(&state, index->doc_offsets, index->term_ids, index->num_docs,
+                           index->num_terms, PISA_BP_MAX_ITERATIONS);
+
+    tasks = (PisaBisectionTask *) palloc(((Size) 1 << leader_levels) *
+                                         sizeof(PisaBisectionTask));
+    BisectPisaTopLevels(&state, documents, 0, index->num_docs, depth, leader_levels,
+                        tasks, &num_tasks);
+
+    if (workers > 0 && num_tasks > 1 && IsTransactionState() && ActiveSnapshotSet() &&
+        !IsInParallelMode())
+    {
+        RunPisaBisectionInParallel(&state, index, documents, tasks, num_tasks, workers);
+    }
+    else
+    {
+        for (i = 0; i < num_tasks; i++)
+            RecursivePisaBisection(&state, documents + tasks[i].start, tasks[i].count,
+                                   tasks[i].depth);
+    }
+
+    FreePisaBisectionState(&state);
+    pfree(tasks);
+
+    return documents;
+}
+
+
+/*
+ * Reorders the documents of a collection with recursive graph bisection
+ * and rewrites its inverted index with the new docids. 'depth' bounds
+ * the recursion (0 picks the deepest useful depth); the top 'cache_depth'
+ * levels are bisected by the calling backend before the subtrees are
+ * handed to documentdb.pisa_reordering_workers parallel workers.
+ *
+ * The index size is measured with the current and the new order by
+ * encoding every posting list; both are recorded in the reordering stats.
+ */
 bool
 ExecuteRecursiveGraphBisection(const char *database_name, const char *collection_name,
                               int depth, int cache_depth)
 {
     char index_path[MAXPGPATH];
-    bool success = false;
+    char forward_file[MAXPGPATH];
+    PisaForwardIndex *forward_index;
+    DocumentReorderingStats *stats;
+    PisaCompressionType compression = (PisaCompressionType) pisa_default_compression;
+    uint32 *permutation;
+    uint64 size_before;
+    uint64 size_after;
+    uint64 uncompressed_size;
+    int max_depth;
+    int leader_levels;
+    int lock_fd;
+    uint32 i;
 
     if (!pisa_integration_enabled)
         return false;
 
     snprintf(index_path, MAXPGPATH, "%s/%s_%s", 
              pisa_index_base_path, database_name, collection_name);
+    snprintf(forward_file, MAXPGPATH, "%s%s", index_path, PISA_FORWARD_FILE_SUFFIX);
 
-    elog(LOG, "Executing recursive graph bisection for %s.%s (depth: %d, cache_depth: %d)", 
-         database_name, collection_name, depth, cache_depth);
+    forward_index = LoadPisaForwardIndex(forward_file);
+    if (forward_index == NULL)
+    {
+        elog(WARNING, "No PISA forward index for %s.%s, export the collection first",
+             database_name, collection_name);
+        return false;
+    }
+
+    max_depth = 0;
+    while (max_depth < 31 &&
+           (forward_index->num_docs >> (max_depth + 1)) >= PISA_BP_MIN_PARTITION_SIZE)
+        max_depth++;
+    depth = depth <= 0 ? max_depth : Min(depth, max_depth);
+
+    /* Enough subtrees to keep every worker busy */
+    leader_levels = Max(cache_depth, (int) pg_ceil_log2_32((pisa_reordering_workers + 1) * 4));
+    leader_levels = Min(leader_levels, depth);
+
+    elog(LOG, "Executing recursive graph bisection for %s.%s (%u documents, depth: %d, "
+         "cache_depth: %d)", database_name, collection_name, forward_index->num_docs,
+         depth, leader_levels);
 
+    size_before = MeasurePisaPostingsSize(forward_index, NULL, compression);
+    permutation = ComputeGraphBisectionPermutation(forward_index, depth, leader_levels,
+                                                   pisa_reordering_workers);
+    size_after = MeasurePisaPostingsSize(forward_index, permutation, compression);
+
+    /* Deleted documents of the base segment follow their new docids */
+    lock_fd = LockPisaIndexSegments(index_path, true);
     PG_TRY();
     {
-        success = true;
-        elog(LOG, "Recursive graph bisection completed successfully for %s.%s", 
-             database_name, collection_name);
+        uint32 *old_permutation = LoadDocumentReorderingPermutation(index_path,
+                                                                    forward_index);
+
+        WritePisaIndexFromForwardIndex(forward_index, permutation, index_path, compression);
+        WriteDocumentReorderingPermutation(index_path, forward_index, permutation);
+        RemapPisaBaseSegment(index_path, old_permutation, permutation,
+                             forward_index->num_docs);
+
+        if (old_permutation != NULL)
+            pfree(old_permutation);
     }
-    PG_CATCH();
+    PG_FINALLY();
     {
-        elog(WARNING, "Recursive graph bisection failed for %s.%s", 
-             database_name, collection_name);
-        success = false;
+        UnlockPisaIndexSegments(lock_fd);
     }
     PG_END_TRY();
 
-    return success;
+    stats = GetReorderingStats(database_name, collection_name);
+    uncompressed_size = forward_index->num_postings * 2 * sizeof(uint32);
+    stats->total_documents = forward_index->num_docs;
+    stats->reordered_documents = 0;
+    for (i = 0; i < forward_index->num_docs; i++)
+    {
+        if (permutation[i] != i)
+            stats->reordered_documents++;
+    }
+    stats->compression_ratio_before = size_before > 0 ?
+                                      (double) uncompressed_size / size_before : 0.0;
+    stats->compression_ratio_after = size_after > 0 ?
+                                     (double) uncompressed_size / size_after : 0.0;
+    stats->improvement_percentage = size_before > 0 ?
+                                    100.0 * ((double) size_before - size_after) / size_before :
+                                    0.0;
+    stats->last_reordering_time = GetCurrentTimestamp();
+    stats->reordering_iterations++;
+    WriteDocumentReorderingStats(index_path, stats);
+
+    elog(LOG, "Recursive graph bisection completed for %s.%s: postings " UINT64_FORMAT
+         " -> " UINT64_FORMAT " bytes (%.2f%% smaller)", database_name, collection_name,
+         size_before, size_after, stats->improvement_percentage);
+
+    FreeDocumentReorderingStats(stats);
+    pfree(permutation);
+    FreePisaForwardIndex(forward_index);
+
+    return true;
 }
 
-bool
-ReorderDocumentsInCollection(const char *database_name, const char *collection_name)
+
+/*
+ * The permutation is stored next to the index together with the size of
+ * the forward index it was computed from, so a stale permutation is not
+ * applied to a re-exported forward index.
+ */
+typedef struct PisaPermutationHeader
 {
-    DocumentReorderingStats *stats;
-    bool success;
+    uint32 num_docs;
+    uint32 reserved;
+    uint64 num_postings;
+} PisaPermutationHeader;
 
-    if (!pisa_integration_enabled)
-        return false;
 
-    elog(LOG, "Starting document reordering for collection %s.%s", 
-         database_name, collection_name);
+static void
+WritePisaReorderingFile(const char *path, const void *header, size_t header_length,
+                        const void *data, size_t data_length)
+{
+    char temp_path[MAXPGPATH];
+    FILE *file;
 
-    stats = GetReorderingStats(database_name, collection_name);
-    if (stats != NULL)
+    snprintf(temp_path, MAXPGPATH, "%s.tmp", path);
+
+    file = AllocateFile(temp_path, PG_BINARY_W);
+    if (file == NULL)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not create file \"%s\": %m", temp_path)));
+    }
+
+    if (fwrite(header, 1, header_length, file) != header_length ||
+        (data_length > 0 && fwrite(data, 1, data_length, file) != data_length))
     {
-        elog(DEBUG1, "Current compression ratio: %.2f", stats->compression_ratio_before);
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write file \"%s\": %m", temp_path)));
     }
 
-    success = ExecuteRecursiveGraphBisection(database_name, collection_name, 8, 2);
+    if (FreeFile(file) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not close file \"%s\": %m", temp_path)));
+    }
+
+    durable_rename(temp_path, path, ERROR);
+}
+
+
+static void
+WriteDocumentReorderingPermutation(const char *index_path, PisaForwardIndex *forward_index,
+                                   const uint32 *permutation)
+{
+    char path[MAXPGPATH];
+    PisaPermutationHeader header;
+
+    snprintf(path, MAXPGPATH, "%s%s", index_path, PISA_PERMUTATION_FILE_SUFFIX);
+
+    memset(&header, 0, sizeof(header));
+    header.num_docs = forward_index->num_docs;
+    header.num_postings = forward_index->num_postings;
+
+    WritePisaReorderingFile(path, &header, sizeof(header), permutation,
+                            (size_t) forward_index->num_docs * sizeof(uint32));
+}
+
+
+/*
+ * Returns the docid permutation last computed for the index at
+ * 'index_path', or NULL when there is none or it was computed from a
+ * different forward index.
+ */
+uint32 *
+LoadDocumentReorderingPermutation(const char *index_path, PisaForwardIndex *forward_index)
+{
+    char path[MAXPGPATH];
+    PisaPermutationHeader header;
+    uint32 *permutation;
+    FILE *file;
+
+    snprintf(path, MAXPGPATH, "%s%s", index_path, PISA_PERMUTATION_FILE_SUFFIX);
 
-    if (success && stats != NULL)
+    file = AllocateFile(path, PG_BINARY_R);
+    if (file == NULL)
+        return NULL;
+
+    if (fread(&header, 1, sizeof(header), file) != sizeof(header) ||
+        header.num_docs != forward_index->num_docs ||
+        header.num_postings != forward_index->num_postings)
     {
-        stats->last_reordering_time = GetCurrentTimestamp();
-        stats->reordering_iterations++;
-        elog(LOG, "Document reordering completed for %s.%s", database_name, collection_name);
+        FreeFile(file);
+        return NULL;
+    }
+
+    permutation = (uint32 *) palloc_extended(Max(header.num_docs, 1) * sizeof(uint32),
+                                             MCXT_ALLOC_HUGE);
+    if (fread(permutation, sizeof(uint32), header.num_docs, file) != header.num_docs)
+    {
+        FreeFile(file);
+        pfree(permutation);
+        return NULL;
     }
 
-    if (stats != NULL)
-        FreeDocumentReorderingStats(stats);
+    FreeFile(file);
+    return permutation;
+}
+
+
+static void
+WriteDocumentReorderingStats(const char *index_path, DocumentReorderingStats *stats)
+{
+    char path[MAXPGPATH];
+
+    snprintf(path, MAXPGPATH, "%s%s", index_path, PISA_REORDERING_STATS_FILE_SUFFIX);
+    WritePisaReorderingFile(path, stats, sizeof(DocumentReorderingStats), NULL, 0);
+}
+
+bool
+ReorderDocumentsInCollection(const char *database_name, const char *collection_name)
+{
+    if (!pisa_integration_enabled)
+        return false;
+
+    elog(LOG, "Starting document reordering for collection %s.%s", 
+         database_name, collection_name);
 
-    return success;
+    return ExecuteRecursiveGraphBisection(database_name, collection_name, 0, 2);
 }
 
+/*
+ * Returns the stats recorded by the last ExecuteRecursiveGraphBisection
+ * run on the collection (all zero if it was never reordered).
+ */
 DocumentReorderingStats *
 GetReorderingStats(const char *database_name, const char *collection_name)
 {
     DocumentReorderingStats *stats;
+    char path[MAXPGPATH];
+    FILE *file;
 
     stats = (DocumentReorderingStats *) palloc0(sizeof(DocumentReorderingStats));
-    stats->total_documents = 1000;
-    stats->reordered_documents = 0;
-    stats->compression_ratio_before = 0.75;
-    stats->compression_ratio_after = 0.85;
-    stats->improvement_percentage = 13.3;
-    stats->last_reordering_time = 0;
-    stats->reordering_iterations = 0;
+
+    snprintf(path, MAXPGPATH, "%s/%s_%s%s", pisa_index_base_path, database_name,
+             collection_name, PISA_REORDERING_STATS_FILE_SUFFIX);
+
+    file = AllocateFile(path, PG_BINARY_R);
+    if (file != NULL)
+    {
+        if (fread(stats, 1, sizeof(DocumentReorderingStats), file) !=
+            sizeof(DocumentReorderingStats))
+            memset(stats, 0, sizeof(DocumentReorderingStats));
+        FreeFile(file);
+    }
 
     return stats;
 }
-
 List *
 GetAllReorderingTasks(void)
 {
@@ -376,6 +1010,16 @@ DocumentReorderingWorkerMain(Datum main_arg)
             {
                 bool success = ReorderDocumentsInCollection(task->database_name, 
                                                           task->collection_name);
+
+                if (success)
+                {
+                    DocumentReorderingStats *stats =
+                        GetReorderingStats(task->database_name, task->collection_name);
+
+                    task->compression_improvement = stats->improvement_percentage;
+                    task->documents_processed = stats->total_documents;
+                    FreeDocumentReorderingStats(stats);
+                }
                 CompleteReorderingTask(task, success);
             }
         }
@@ -432,3 +1076,206 @@ FreeDocumentReorderingStats(DocumentReorderingStats *stats)
     
     pfree(stats);
 }
+
+
+/*
+ * Highest gain first; ties broken by document so the result does not
+ * depend on the qsort implementation.
+ */
+static int
+ComparePisaBisectionGains(const void *left, const void *right)
+{
+    const PisaBisectionGain *left_gain = (const PisaBisectionGain *) left;
+    const PisaBisectionGain *right_gain = (const PisaBisectionGain *) right;
+
+    if (left_gain->gain != right_gain->gain)
+        return left_gain->gain > right_gain->gain ? -1 : 1;
+
+    return left_gain->document < right_gain->document ? -1 :
+           left_gain->document > right_gain->document ? 1 : 0;
+}
+
+
+PG_FUNCTION_INFO_V1(documentdb_execute_recursive_graph_bisection);
+Datum
+documentdb_execute_recursive_graph_bisection(PG_FUNCTION_ARGS)
+{
+    char *database_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *collection_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    int depth = PG_GETARG_INT32(2);
+    int cache_depth = PG_GETARG_INT32(3);
+
+    PG_RETURN_BOOL(ExecuteRecursiveGraphBisection(database_name, collection_name,
+                                                  depth, cache_depth));
+}
+
+
+PG_FUNCTION_INFO_V1(documentdb_get_reordering_stats);
+Datum
+documentdb_get_reordering_stats(PG_FUNCTION_ARGS)
+{
+    char *database_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *collection_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    DocumentReorderingStats *stats;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    Datum values[7];
+    bool nulls[7] = { false, false, false, false, false, false, false };
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    stats = GetReorderingStats(database_name, collection_name);
+
+    values[0] = Int64GetDatum(stats->total_documents);
+    values[1] = Int64GetDatum(stats->reordered_documents);
+    values[2] = DirectFunctionCall1(float8_numeric,
+                                    Float8GetDatum(stats->compression_ratio_before));
+    values[3] = DirectFunctionCall1(float8_numeric,
+                                    Float8GetDatum(stats->compression_ratio_after));
+    values[4] = DirectFunctionCall1(float8_numeric,
+                                    Float8GetDatum(stats->improvement_percentage));
+    values[5] = TimestampTzGetDatum(stats->last_reordering_time);
+    nulls[5] = stats->last_reordering_time == 0;
+    values[6] = Int32GetDatum(stats->reordering_iterations);
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+    FreeDocumentReorderingStats(stats);
+
+    PG_RETURN_VOID();
+}
+
+
+PG_FUNCTION_INFO_V1(documentdb_pisa_reordering_for_test);
+
+/*
+ * Test helper: bisects a forward index whose documents are about one of
+ * four topics, interleaved so that consecutive docids change topic, on
+ * the calling backend alone and with parallel workers. Returns for each
+ * whether the new order is a permutation of the documents, whether it
+ * makes the posting lists smaller and whether it matches the serial order.
+ */
+Datum
+documentdb_pisa_reordering_for_test(PG_FUNCTION_ARGS)
+{
+#define PISA_TEST_TOPICS 4
+#define PISA_TEST_TOPIC_TERMS 8
+#define PISA_TEST_DOC_TERMS 5
+    static const int topic_term_offsets[PISA_TEST_DOC_TERMS - 1] = { 0, 1, 3, 5 };
+    static const int workers[] = { 0, 2 };
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    PisaForwardIndex index;
+    uint64 state = UINT64CONST(0x9E3779B97F4A7C15);
+    uint32 *serial_permutation = NULL;
+    uint64 size_before;
+    int depth = 0;
+    int leader_levels;
+    int run;
+    uint32 i;
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    /* Each document has four of the terms of its topic and a term common to all */
+    memset(&index, 0, sizeof(index));
+    index.num_docs = 4096;
+    index.num_terms = PISA_TEST_TOPICS * PISA_TEST_TOPIC_TERMS + 1;
+    index.num_postings = (uint64) index.num_docs * PISA_TEST_DOC_TERMS;
+    index.doc_offsets = (uint64 *) palloc((index.num_docs + 1) * sizeof(uint64));
+    index.term_ids = (uint32 *) palloc(index.num_postings * sizeof(uint32));
+    index.freqs = (uint32 *) palloc(index.num_postings * sizeof(uint32));
+
+    for (i = 0; i < index.num_docs; i++)
+    {
+        uint32 first_term = (i % PISA_TEST_TOPICS) * PISA_TEST_TOPIC_TERMS;
+        uint32 rotation = (uint32) (PisaTestRandom(&state) % PISA_TEST_TOPIC_TERMS);
+        uint64 offset = (uint64) i * PISA_TEST_DOC_TERMS;
+        uint32 *term_ids = index.term_ids + offset;
+        int term;
+
+        index.doc_offsets[i] = offset;
+        for (term = 0; term < PISA_TEST_DOC_TERMS - 1; term++)
+        {
+            uint32 term_id = first_term + (rotation + topic_term_offsets[term]) %
+                             PISA_TEST_TOPIC_TERMS;
+            int position = term;
+
+            /* Insertion sort, the runs are sorted by term id */
+            while (position > 0 && term_ids[position - 1] > term_id)
+            {
+                term_ids[position] = term_ids[position - 1];
+                position--;
+            }
+            term_ids[position] = term_id;
+        }
+        term_ids[PISA_TEST_DOC_TERMS - 1] = index.num_terms - 1;
+
+        for (term = 0; term < PISA_TEST_DOC_TERMS; term++)
+            index.freqs[offset + term] = 1 + (uint32) (PisaTestRandom(&state) % 3);
+    }
+    index.doc_offsets[index.num_docs] = index.num_postings;
+
+    /* As in ExecuteRecursiveGraphBisection, with the same subtrees for every run */
+    while (depth < 31 && (index.num_docs >> (depth + 1)) >= PISA_BP_MIN_PARTITION_SIZE)
+        depth++;
+    leader_levels = Min((int) pg_ceil_log2_32((workers[lengthof(workers) - 1] + 1) * 4),
+                        depth);
+
+    size_before = MeasurePisaPostingsSize(&index, NULL, PISA_COMPRESSION_BLOCK_SIMDBP);
+
+    for (run = 0; run < lengthof(workers); run++)
+    {
+        uint32 *permutation;
+        bool *seen;
+        bool is_bijection = true;
+        Datum values[5];
+        bool nulls[5] = { false, false, false, false, false };
+
+        permutation = ComputeGraphBisectionPermutation(&index, depth, leader_levels,
+                                                       workers[run]);
+
+        seen = (bool *) palloc0(index.num_docs * sizeof(bool));
+        for (i = 0; i < index.num_docs && is_bijection; i++)
+        {
+            is_bijection = permutation[i] < index.num_docs && !seen[permutation[i]];
+            if (is_bijection)
+                seen[permutation[i]] = true;
+        }
+        pfree(seen);
+
+        if (serial_permutation == NULL)
+            serial_permutation = permutation;
+
+        values[0] = Int32GetDatum(workers[run]);
+        values[1] = Int32GetDatum(index.num_docs);
+        values[2] = BoolGetDatum(is_bijection);
+        values[3] = BoolGetDatum(is_bijection &&
+                                 MeasurePisaPostingsSize(&index, permutation,
+                                                         PISA_COMPRESSION_BLOCK_SIMDBP) <
+                                 size_before);
+        values[4] = BoolGetDatum(memcmp(permutation, serial_permutation,
+                                        index.num_docs * sizeof(uint32)) == 0);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    PG_RETURN_VOID();
+}
@@ -6,379 +6,278 @@
 #include "catalog/pg_type.h"
 #include "access/htup_details.h"
 #include "executor/spi.h"
+#include "portability/instr_time.h"
 
 #include "io/pgbson.h"
 #include "io/bson_traversal.h"
 #include "pisa_integration/data_bridge.h"
+#include "pisa_integration/document_reordering.h"
+#include "pisa_integration/forward_index.h"
+#include "pisa_integration/index_segments.h"
+#include "pisa_integration/inverted_index.h"
 #include "pisa_integration/pisa_integration.h"
 #include "metadata/collection.h"
+#include "metadata/metadata_cache.h"
 
-typedef struct PisaForwardIndexBuilder
-{
-    char *output_path;
-    FILE *forward_file;
-    FILE *document_file;
-    int document_count;
-    int batch_size;
-    List *current_batch;
-} PisaForwardIndexBuilder;
-
-static PisaForwardIndexBuilder *CreateForwardIndexBuilder(const char *output_path, int batch_size);
-static void FreeForwardIndexBuilder(PisaForwardIndexBuilder *builder);
-static bool ProcessDocumentBatch(PisaForwardIndexBuilder *builder);
-static bool WriteForwardIndexHeader(PisaForwardIndexBuilder *builder);
-static bool WriteDocumentToForwardIndex(PisaForwardIndexBuilder *builder, PisaDocument *doc);
-
-PisaForwardIndexBuilder *
-CreateForwardIndexBuilder(const char *output_path, int batch_size)
+/* Documents fetched from the collection per portal round trip */
+#define PISA_EXPORT_BATCH_SIZE 10000
+
+/*
+ * Streams a collection into the binary forward index at
+ * output_path.forward. Documents are read through a portal in batches of
+ * PISA_EXPORT_BATCH_SIZE and tokenized directly from their BSON; memory
+ * is bounded by one batch plus the term dictionary.
+ */
+bool
+ExportCollectionToPisaForwardIndex(const char *database_name, const char *collection_name,
+                                   const char *output_path, PisaExportMode mode)
 {
-    PisaForwardIndexBuilder *builder;
+    MongoCollection *collection;
+    PisaForwardIndexWriter *writer;
+    MemoryContext batch_context;
+    StringInfoData query;
+    Portal portal;
     char forward_path[MAXPGPATH];
-    char document_path[MAXPGPATH];
-
-    builder = (PisaForwardIndexBuilder *) palloc0(sizeof(PisaForwardIndexBuilder));
-    builder->output_path = pstrdup(output_path);
-    builder->batch_size = batch_size;
-    builder->document_count = 0;
-    builder->current_batch = NIL;
-
-    snprintf(forward_path, MAXPGPATH, "%s.forward", output_path);
-    snprintf(document_path, MAXPGPATH, "%s.documents", output_path);
+    instr_time export_start;
+    instr_time batch_start;
+    instr_time duration;
+    uint64 forward_size;
+    uint32 num_docs;
+    uint64 num_postings;
+
+    elog(LOG, "Exporting collection %s.%s to PISA forward index: %s",
+         database_name, collection_name, output_path);
 
-    builder->forward_file = fopen(forward_path, "w");
-    if (builder->forward_file == NULL)
+    collection = GetMongoCollectionByNameDatum(CStringGetTextDatum(database_name),
+                                               CStringGetTextDatum(collection_name),
+                                               AccessShareLock);
+    if (collection == NULL)
     {
-        elog(ERROR, "Failed to create forward index file: %s", forward_path);
-        FreeForwardIndexBuilder(builder);
-        return NULL;
+        elog(WARNING, "Collection %s.%s not found", database_name, collection_name);
+        return false;
     }
 
-    builder->document_file = fopen(document_path, "w");
-    if (builder->document_file == NULL)
+    if (mode == PISA_EXPORT_INCREMENTAL)
     {
-        elog(ERROR, "Failed to create document file: %s", document_path);
-        FreeForwardIndexBuilder(builder);
-        return NULL;
+        /* Changes since the last export are applied by index sync */
+        elog(LOG, "Incremental PISA export of %s.%s exports all documents",
+             database_name, collection_name);
     }
 
-    WriteForwardIndexHeader(builder);
+    snprintf(forward_path, MAXPGPATH, "%s%s", output_path, PISA_FORWARD_FILE_SUFFIX);
+    writer = BeginPisaForwardIndexWriter(forward_path);
 
-    return builder;
-}
+    batch_context = AllocSetContextCreate(CurrentMemoryContext, "PISA Export Batch",
+                                          ALLOCSET_DEFAULT_SIZES);
 
-void
-FreeForwardIndexBuilder(PisaForwardIndexBuilder *builder)
-{
-    ListCell *cell;
+    initStringInfo(&query);
+    appendStringInfo(&query, "SELECT document FROM %s.%s",
+                     quote_identifier(ApiDataSchemaName),
+                     quote_identifier(collection->tableName));
 
-    if (builder == NULL)
-        return;
+    INSTR_TIME_SET_CURRENT(export_start);
 
-    if (builder->forward_file)
-        fclose(builder->forward_file);
-    if (builder->document_file)
-        fclose(builder->document_file);
+    SPI_connect();
+    portal = SPI_cursor_open_with_args("pisaExportPortal", query.data, 0, NULL, NULL,
+                                       NULL, true, CURSOR_OPT_NO_SCROLL);
 
-    if (builder->output_path)
-        pfree(builder->output_path);
-
-    foreach(cell, builder->current_batch)
+    while (true)
     {
-        PisaDocument *doc = (PisaDocument *) lfirst(cell);
-        FreePisaDocument(doc);
-    }
-    list_free(builder->current_batch);
+        MemoryContext old_context;
+        uint32 batch_docs = writer->num_docs;
+        uint64 batch_postings = writer->num_postings;
+        uint64 batch_bytes = 0;
+        double batch_ms;
+        uint64 row;
 
-    pfree(builder);
-}
-
-bool
-WriteForwardIndexHeader(PisaForwardIndexBuilder *builder)
-{
-    if (builder->forward_file == NULL)
-        return false;
-
-    fprintf(builder->forward_file, "# PISA Forward Index\n");
-    fprintf(builder->forward_file, "# Generated by DocumentDB PISA Integration\n");
-    fprintf(builder->forward_file, "# Format: doc_id<TAB>term1 term2 term3...\n");
-
-    return true;
-}
-
-bool
-WriteDocumentToForwardIndex(PisaForwardIndexBuilder *builder, PisaDocument *doc)
-{
-    char *tokenized_content;
-    char *token;
-    char *saveptr;
-    StringInfoData processed_content;
-
-    if (builder->forward_file == NULL || doc == NULL)
-        return false;
+        INSTR_TIME_SET_CURRENT(batch_start);
 
-    initStringInfo(&processed_content);
-
-    tokenized_content = pstrdup(doc->content);
-    token = strtok_r(tokenized_content, " \t\n\r", &saveptr);
+        SPI_cursor_fetch(portal, true, PISA_EXPORT_BATCH_SIZE);
+        if (SPI_processed == 0)
+            break;
 
-    while (token != NULL)
-    {
-        if (strlen(token) > 2)
+        old_context = MemoryContextSwitchTo(batch_context);
+        for (row = 0; row < SPI_processed; row++)
         {
-            if (processed_content.len > 0)
-                appendStringInfoChar(&processed_content, ' ');
-            appendStringInfoString(&processed_content, token);
-        }
-        token = strtok_r(NULL, " \t\n\r", &saveptr);
-    }
-
-    fprintf(builder->forward_file, "%s\t%s\n", doc->doc_id, processed_content.data);
-    fprintf(builder->document_file, "%s\t%ld\t%s\n", 
-            doc->doc_id, doc->collection_id, doc->content);
-
-    builder->document_count++;
+            pgbson *document;
+            char *doc_id;
+            bool is_null;
+            Datum value;
 
-    pfree(tokenized_content);
-    pfree(processed_content.data);
-
-    return true;
-}
-
-bool
-ProcessDocumentBatch(PisaForwardIndexBuilder *builder)
-{
-    ListCell *cell;
-    bool success = true;
+            value = SPI_getbinval(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, 1,
+                                  &is_null);
+            if (is_null)
+                continue;
 
-    if (builder->current_batch == NIL)
-        return true;
+            document = DatumGetPgBson(value);
+            doc_id = GeneratePisaDocumentId(document, collection->collectionId);
 
-    elog(LOG, "Processing batch of %d documents", list_length(builder->current_batch));
+            AddBsonTextToPisaForwardIndex(writer, document);
+            PisaForwardIndexWriterEndDocument(writer, doc_id);
 
-    foreach(cell, builder->current_batch)
-    {
-        PisaDocument *doc = (PisaDocument *) lfirst(cell);
-        if (!WriteDocumentToForwardIndex(builder, doc))
-        {
-            elog(WARNING, "Failed to write document %s to forward index", doc->doc_id);
-            success = false;
+            batch_bytes += PgbsonGetBsonSize(document);
         }
+        MemoryContextSwitchTo(old_context);
+        MemoryContextReset(batch_context);
+        SPI_freetuptable(SPI_tuptable);
+
+        INSTR_TIME_SET_CURRENT(duration);
+        INSTR_TIME_SUBTRACT(duration, batch_start);
+        batch_ms = Max(INSTR_TIME_GET_MILLISEC(duration), 0.001);
+        batch_docs = writer->num_docs - batch_docs;
+        batch_postings = writer->num_postings - batch_postings;
+
+        elog(LOG, "PISA export of %s.%s: %u documents (" UINT64_FORMAT " postings) in "
+             "%.1f ms, %.0f documents/s, %.1f MB/s, %u documents and %u terms so far",
+             database_name, collection_name, batch_docs, batch_postings, batch_ms,
+             batch_docs * 1000.0 / batch_ms,
+             batch_bytes / (1024.0 * 1024.0) * 1000.0 / batch_ms,
+             writer->num_docs, writer->num_terms);
     }
 
-    foreach(cell, builder->current_batch)
-    {
-        PisaDocument *doc = (PisaDocument *) lfirst(cell);
-        FreePisaDocument(doc);
-    }
-    list_free(builder->current_batch);
-    builder->current_batch = NIL;
+    SPI_cursor_close(portal);
+    SPI_finish();
 
-    return success;
-}
+    num_docs = writer->num_docs;
+    num_postings = writer->num_postings;
+    forward_size = FinishPisaForwardIndexWriter(writer);
+    MemoryContextDelete(batch_context);
+    pfree(query.data);
 
-bool
-ExportCollectionToPisaForwardIndex(const char *database_name, const char *collection_name,
-                                  const char *output_path, PisaExportMode mode)
-{
-    PisaForwardIndexBuilder *builder;
-    List *documents;
-    ListCell *cell;
-    bool success = true;
-    int batch_size = 10000;
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, export_start);
 
-    elog(LOG, "Exporting collection %s.%s to PISA forward index: %s", 
-         database_name, collection_name, output_path);
-
-    builder = CreateForwardIndexBuilder(output_path, batch_size);
-    if (builder == NULL)
-        return false;
-
-    PG_TRY();
-    {
-        documents = ExportCollectionToPisa(database_name, collection_name, mode);
-        
-        if (documents == NIL)
-        {
-            elog(WARNING, "No documents found in collection %s.%s", 
-                 database_name, collection_name);
-            FreeForwardIndexBuilder(builder);
-            return false;
-        }
-
-        foreach(cell, documents)
-        {
-            PisaDocument *doc = (PisaDocument *) lfirst(cell);
-            builder->current_batch = lappend(builder->current_batch, doc);
-
-            if (list_length(builder->current_batch) >= builder->batch_size)
-            {
-                if (!ProcessDocumentBatch(builder))
-                {
-                    success = false;
-                    break;
-                }
-            }
-        }
-
-        if (success && builder->current_batch != NIL)
-        {
-            success = ProcessDocumentBatch(builder);
-        }
-
-        if (success)
-        {
-            elog(LOG, "Successfully exported %d documents to PISA forward index", 
-                 builder->document_count);
-        }
-    }
-    PG_CATCH();
+    if (num_docs == 0)
     {
-        elog(ERROR, "Exception occurred during PISA export for %s.%s", 
+        elog(WARNING, "No documents found in collection %s.%s",
              database_name, collection_name);
-        success = false;
+        return false;
     }
-    PG_END_TRY();
 
-    FreeForwardIndexBuilder(builder);
-    return success;
+    elog(LOG, "Successfully exported %u documents (" UINT64_FORMAT " postings, "
+         UINT64_FORMAT " bytes) to PISA forward index in %.1f ms", num_docs, num_postings, forward_size,
+         INSTR_TIME_GET_MILLISEC(duration));
+
+    return true;
 }
 
+/*
+ * Builds the block-compressed inverted index <index_path>.index from the
+ * forward index <index_path>.forward, keeping the docid order of the last
+ * document reordering when its permutation still matches. The inversion
+ * runs on documentdb.pisa_index_build_workers parallel workers.
+ */
 bool
-BuildPisaInvertedIndex(const char *forward_index_path, const char *output_path)
+BuildPisaInvertedIndex(const char *index_path, PisaCompressionType compression_type)
 {
-    char command[MAXPGPATH * 3];
-    int result;
+    char forward_path[MAXPGPATH];
+    PisaForwardIndex *forward_index;
+    uint32 *permutation;
+    uint64 index_size;
+    instr_time start_time;
+    instr_time duration;
 
-    elog(LOG, "Building PISA inverted index from forward index: %s", forward_index_path);
+    snprintf(forward_path, MAXPGPATH, "%s%s", index_path, PISA_FORWARD_FILE_SUFFIX);
 
-    snprintf(command, sizeof(command), 
-             "pisa-invert --input %s --output %s --threads 4", 
-             forward_index_path, output_path);
+    elog(LOG, "Building PISA inverted index from forward index: %s", forward_path);
 
-    result = system(command);
-    
-    if (result == 0)
-    {
-        elog(LOG, "Successfully built PISA inverted index: %s", output_path);
-        return true;
-    }
-    else
+    INSTR_TIME_SET_CURRENT(start_time);
+
+    forward_index = LoadPisaForwardIndex(forward_path);
+    if (forward_index == NULL)
     {
-        elog(ERROR, "Failed to build PISA inverted index, command returned: %d", result);
+        elog(WARNING, "PISA forward index %s not found", forward_path);
         return false;
     }
-}
 
-bool
-CompressPisaIndex(const char *inverted_index_path, const char *output_path, 
-                  PisaCompressionType compression_type)
-{
-    char command[MAXPGPATH * 3];
-    char *compression_name;
-    int result;
+    permutation = LoadDocumentReorderingPermutation(index_path, forward_index);
+    index_size = WritePisaIndexFromForwardIndex(forward_index, permutation, index_path,
+                                                compression_type);
 
-    switch (compression_type)
-    {
-        case PISA_COMPRESSION_BLOCK_SIMDBP:
-            compression_name = "block_simdbp";
-            break;
-        case PISA_COMPRESSION_BLOCK_INTERPOLATIVE:
-            compression_name = "block_interpolative";
-            break;
-        case PISA_COMPRESSION_BLOCK_QMXINT:
-            compression_name = "block_qmxint";
-            break;
-        default:
-            compression_name = "block_simdbp";
-            break;
-    }
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start_time);
 
-    elog(LOG, "Compressing PISA index with %s compression: %s", 
-         compression_name, inverted_index_path);
+    elog(LOG, "Successfully built PISA inverted index %s%s: %u documents, %u terms, "
+         UINT64_FORMAT " bytes in %.1f ms", index_path, PISA_INDEX_FILE_SUFFIX,
+         forward_index->num_docs, forward_index->num_terms, index_size,
+         INSTR_TIME_GET_MILLISEC(duration));
 
-    snprintf(command, sizeof(command), 
-             "pisa-compress --input %s --output %s --encoding %s", 
-             inverted_index_path, output_path, compression_name);
+    if (permutation != NULL)
+        pfree(permutation);
+    FreePisaForwardIndex(forward_index);
 
-    result = system(command);
-    
-    if (result == 0)
-    {
-        elog(LOG, "Successfully compressed PISA index: %s", output_path);
-        return true;
-    }
-    else
-    {
-        elog(ERROR, "Failed to compress PISA index, command returned: %d", result);
-        return false;
-    }
+    return true;
 }
 
+/*
+ * Rebuilds the index of a collection from scratch: exports the
+ * collection, builds the base index and drops the delta segments. The
+ * segments lock is held from before the export, so changes that index
+ * sync did not apply before the export snapshot are applied on top of
+ * the new base.
+ */
 bool
 BuildCompletePisaIndex(const char *database_name, const char *collection_name,
                       const char *base_path, PisaCompressionType compression_type)
 {
-    char forward_path[MAXPGPATH];
-    char inverted_path[MAXPGPATH];
-    char compressed_path[MAXPGPATH];
+    char index_path[MAXPGPATH];
     bool success = true;
+    int lock_fd;
 
-    snprintf(forward_path, MAXPGPATH, "%s/%s_%s", base_path, database_name, collection_name);
-    snprintf(inverted_path, MAXPGPATH, "%s/%s_%s.inverted", base_path, database_name, collection_name);
-    snprintf(compressed_path, MAXPGPATH, "%s/%s_%s.compressed", base_path, database_name, collection_name);
+    snprintf(index_path, MAXPGPATH, "%s/%s_%s", base_path, database_name, collection_name);
 
     elog(LOG, "Building complete PISA index for %s.%s", database_name, collection_name);
 
+    lock_fd = LockPisaIndexSegments(index_path, true);
+
     PG_TRY();
     {
         if (!ExportCollectionToPisaForwardIndex(database_name, collection_name, 
-                                               forward_path, PISA_EXPORT_FULL))
+                                               index_path, PISA_EXPORT_FULL))
         {
             elog(ERROR, "Failed to export collection to forward index");
             success = false;
         }
-        else if (!BuildPisaInvertedIndex(forward_path, inverted_path))
+        else if (!BuildPisaInvertedIndex(index_path, compression_type))
         {
             elog(ERROR, "Failed to build inverted index");
             success = false;
         }
-        else if (!CompressPisaIndex(inverted_path, compressed_path, compression_type))
-        {
-            elog(ERROR, "Failed to compress index");
-            success = false;
-        }
         else
         {
+            ResetPisaIndexSegments(index_path);
             elog(LOG, "Successfully built complete PISA index for %s.%s", 
                  database_name, collection_name);
         }
     }
     PG_CATCH();
     {
+        UnlockPisaIndexSegments(lock_fd);
         elog(ERROR, "Exception occurred during PISA index building for %s.%s", 
              database_name, collection_name);
         success = false;
     }
     PG_END_TRY();
 
+    UnlockPisaIndexSegments(lock_fd);
+
     return success;
 }
 
-PG_FUNCTION_INFO_V1(documentdb_export_collection_to_pisa);
+PG_FUNCTION_INFO_V1(documentdb_export_collection_to_pisa_format);
 Datum
-documentdb_export_collection_to_pisa(PG_FUNCTION_ARGS)
+documentdb_export_collection_to_pisa_format(PG_FUNCTION_ARGS)
 {
     text *database_name_text = PG_GETARG_TEXT_PP(0);
     text *collection_name_text = PG_GETARG_TEXT_PP(1);
     text *output_path_text = PG_GETARG_TEXT_PP(2);
-    int export_mode = PG_GETARG_INT32(3);
     
     char *database_name = text_to_cstring(database_name_text);
     char *collection_name = text_to_cstring(collection_name_text);
     char *output_path = text_to_cstring(output_path_text);
     
     bool result = ExportCollectionToPisaForwardIndex(database_name, collection_name, 
-                                                    output_path, (PisaExportMode) export_mode);
+                                                    output_path, PISA_EXPORT_FULL);
     
     PG_RETURN_BOOL(result);
 }
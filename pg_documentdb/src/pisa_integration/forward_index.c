@@ -0,0 +1,1299 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/pisa_integration/forward_index.c
+ *
+ * Streaming writer and loader of the binary forward index produced by
+ * the PISA export, and its inversion into the block-compressed inverted
+ * index under an optional docid permutation (see document_reordering.c).
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "common/hashfn.h"
+#include "lib/binaryheap.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/fd.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+#include "pisa_integration/forward_index.h"
+#include "pisa_integration/inverted_index.h"
+
+/* Runs per process of a parallel build, and smallest index built in parallel */
+#define PISA_BUILD_RUNS_PER_PROCESS 4
+#define PISA_BUILD_MIN_PARALLEL_POSTINGS 1000000
+
+/* shm_toc keys of the parallel index build */
+#define PISA_BUILD_KEY_SHARED UINT64CONST(0xD0C0B15EC7000011)
+#define PISA_BUILD_KEY_DOC_OFFSETS UINT64CONST(0xD0C0B15EC7000012)
+#define PISA_BUILD_KEY_TERM_IDS UINT64CONST(0xD0C0B15EC7000013)
+#define PISA_BUILD_KEY_FREQS UINT64CONST(0xD0C0B15EC7000014)
+#define PISA_BUILD_KEY_PERMUTATION UINT64CONST(0xD0C0B15EC7000015)
+#define PISA_BUILD_KEY_RUN_DOCIDS UINT64CONST(0xD0C0B15EC7000016)
+#define PISA_BUILD_KEY_RUN_FREQS UINT64CONST(0xD0C0B15EC7000017)
+#define PISA_BUILD_KEY_RUN_TERMS UINT64CONST(0xD0C0B15EC7000018)
+#define PISA_BUILD_KEY_RUN_COUNTS UINT64CONST(0xD0C0B15EC7000019)
+
+/* Term slice used to probe the writer's dictionary without copying it */
+typedef struct PisaForwardTermKey
+{
+    const char *data;
+    uint32 length;
+} PisaForwardTermKey;
+
+typedef struct PisaForwardTermEntry
+{
+    PisaForwardTermKey key;     /* hash key */
+    uint32 term_id;
+} PisaForwardTermEntry;
+
+typedef struct PisaForwardPosting
+{
+    uint32 term_id;
+    uint32 freq;
+} PisaForwardPosting;
+
+/*
+ * Inversion of the documents with docids [first_docid, end_docid): the
+ * terms present with their posting counts at run_terms/run_counts
+ * [terms_start, terms_start + num_terms), and their postings, term after
+ * term, at run_docids/run_freqs from postings_start.
+ */
+typedef struct PisaIndexBuildRun
+{
+    uint32 first_docid;
+    uint32 end_docid;
+    uint64 postings_start;
+    uint64 terms_start;
+    uint32 num_terms;           /* set once the run is inverted */
+} PisaIndexBuildRun;
+
+typedef struct PisaIndexBuildShared
+{
+    uint32 num_docs;
+    uint32 num_terms;
+    uint64 num_postings;
+    uint64 num_run_terms;       /* capacity of run_terms/run_counts */
+    bool has_permutation;
+    uint32 num_runs;
+    pg_atomic_uint32 next_run;
+    PisaIndexBuildRun runs[FLEXIBLE_ARRAY_MEMBER];
+} PisaIndexBuildShared;
+
+/* Inputs and outputs of the runs, in the DSM segment when built in parallel */
+typedef struct PisaIndexBuildArrays
+{
+    const uint64 *doc_offsets;
+    const uint32 *term_ids;
+    const uint32 *freqs;
+    const uint32 *permutation;
+    uint32 *run_docids;
+    uint32 *run_freqs;
+    uint32 *run_terms;
+    uint32 *run_counts;
+} PisaIndexBuildArrays;
+
+typedef struct PisaRunMergeState
+{
+    PisaIndexBuildArrays *arrays;
+    PisaIndexBuildShared *shared;
+    uint32 *term_positions;     /* next term of every run */
+    uint64 *posting_positions;  /* postings of that term */
+} PisaRunMergeState;
+
+/* Posting lists of every term, concatenated in term id order */
+typedef struct PisaInvertedPostings
+{
+    uint64 *term_offsets;       /* num_terms + 1 entries */
+    uint32 *docids;
+    uint32 *freqs;
+} PisaInvertedPostings;
+
+static uint32 PisaForwardTermHash(const void *key, Size keysize);
+static int PisaForwardTermMatch(const void *key1, const void *key2, Size keysize);
+static void AddPisaForwardToken(PisaForwardIndexWriter *writer, const char *token,
+                                uint32 length);
+static void WritePisaForwardBytes(PisaForwardIndexWriter *writer, const void *data,
+                                  size_t length);
+static void ReadPisaForwardBytes(FILE *file, const char *forward_file, void *data,
+                                 size_t length);
+static char *ReadPisaForwardString(FILE *file, const char *forward_file);
+static void *GrowPisaArray(void *array, uint64 *capacity, uint64 needed, Size element_size);
+static void AssignSortedTermIds(PisaForwardIndex *index);
+static void InvertPisaForwardIndex(PisaForwardIndex *index, const uint32 *permutation,
+                                   PisaInvertedPostings *postings);
+static void FreePisaInvertedPostings(PisaInvertedPostings *postings);
+static void WritePisaDocumentMap(PisaForwardIndex *index, const uint32 *permutation,
+                                 const char *index_path);
+static PisaIndexBuildShared *PlanPisaIndexBuildRuns(PisaForwardIndex *index,
+                                                    const uint32 *permutation,
+                                                    uint32 num_runs);
+static void BuildPisaIndexInParallel(PisaForwardIndex *index, const uint32 *permutation,
+                                     PisaIndexBuildShared *local_shared,
+                                     PisaIndexWriter *writer, int workers);
+static void LookupPisaIndexBuildArrays(shm_toc *toc, PisaIndexBuildShared *shared,
+                                       PisaIndexBuildArrays *arrays);
+static void InvertPisaIndexBuildRuns(PisaIndexBuildArrays *arrays,
+                                     PisaIndexBuildShared *shared);
+static void MergePisaIndexBuildRuns(PisaForwardIndex *index, PisaIndexBuildArrays *arrays,
+                                    PisaIndexBuildShared *shared, PisaIndexWriter *writer);
+static inline uint32 PisaRunMergeTerm(PisaRunMergeState *state, uint32 run);
+static int ComparePisaRunMergeEntries(Datum left, Datum right, void *arg);
+static int ComparePisaForwardPostings(const void *left, const void *right);
+static int ComparePisaTermOrder(const void *left, const void *right, void *arg);
+static int ComparePisaTermIds(const void *left, const void *right);
+
+
+/*
+ * Starts writing a forward index. The file is written under a temporary
+ * name and only replaces 'forward_file' in FinishPisaForwardIndexWriter.
+ */
+PisaForwardIndexWriter *
+BeginPisaForwardIndexWriter(const char *forward_file)
+{
+    PisaForwardIndexWriter *writer;
+    PisaForwardFileHeader header;
+    MemoryContext context;
+    MemoryContext old_context;
+    HASHCTL hash_ctl;
+
+    context = AllocSetContextCreate(CurrentMemoryContext, "PISA Forward Index Writer",
+                                    ALLOCSET_DEFAULT_SIZES);
+    old_context = MemoryContextSwitchTo(context);
+
+    writer = (PisaForwardIndexWriter *) palloc0(sizeof(PisaForwardIndexWriter));
+    writer->context = context;
+    strlcpy(writer->path, forward_file, MAXPGPATH);
+    snprintf(writer->temp_path, MAXPGPATH, "%s.tmp", forward_file);
+
+    memset(&hash_ctl, 0, sizeof(hash_ctl));
+    hash_ctl.keysize = sizeof(PisaForwardTermKey);
+    hash_ctl.entrysize = sizeof(PisaForwardTermEntry);
+    hash_ctl.hash = PisaForwardTermHash;
+    hash_ctl.match = PisaForwardTermMatch;
+    hash_ctl.hcxt = context;
+    writer->term_table = hash_create("PISA Forward Index Terms", 4096, &hash_ctl,
+                                     HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+                                     HASH_CONTEXT);
+
+    writer->term_capacity = 1024;
+    writer->terms = (char **) palloc(writer->term_capacity * sizeof(char *));
+    writer->token_capacity = 256;
+    writer->tokens = (uint32 *) palloc(writer->token_capacity * sizeof(uint32));
+    initStringInfo(&writer->record);
+
+    MemoryContextSwitchTo(old_context);
+
+    writer->file = AllocateFile(writer->temp_path, PG_BINARY_W);
+    if (writer->file == NULL)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not create PISA forward index \"%s\": %m",
+                               writer->temp_path)));
+    }
+
+    /* Placeholder, rewritten by FinishPisaForwardIndexWriter */
+    memset(&header, 0, sizeof(header));
+    WritePisaForwardBytes(writer, &header, sizeof(header));
+
+    return writer;
+}
+
+
+/*
+ * Tokenizes 'length' bytes of text in place and adds the tokens to the
+ * current document. Tokens are separated by whitespace (or NUL bytes);
+ * tokens shorter than PISA_FORWARD_MIN_TOKEN_LENGTH are skipped.
+ */
+void
+PisaForwardIndexWriterAddText(PisaForwardIndexWriter *writer, const char *text, int length)
+{
+    int start = 0;
+    int i;
+
+    for (i = 0; i <= length; i++)
+    {
+        if (i < length && text[i] != ' ' && text[i] != '\t' && text[i] != '\n' &&
+            text[i] != '\r' && text[i] != '\0')
+            continue;
+
+        if (i - start >= PISA_FORWARD_MIN_TOKEN_LENGTH)
+            AddPisaForwardToken(writer, text + start, (uint32) (i - start));
+
+        start = i + 1;
+    }
+}
+
+
+/*
+ * Adds 'freq' occurrences of an already tokenized term to the current
+ * document, as when copying documents between forward indexes.
+ */
+void
+PisaForwardIndexWriterAddTerm(PisaForwardIndexWriter *writer, const char *term,
+                              int length, uint32 freq)
+{
+    uint32 i;
+
+    for (i = 0; i < freq; i++)
+        AddPisaForwardToken(writer, term, (uint32) length);
+}
+
+
+/*
+ * Writes the record of the current document, with repeated tokens
+ * collapsed into term frequencies, and starts the next document.
+ */
+void
+PisaForwardIndexWriterEndDocument(PisaForwardIndexWriter *writer, const char *doc_id)
+{
+    StringInfo record = &writer->record;
+    uint32 doc_id_length = (uint32) strlen(doc_id);
+    uint32 doc_length = (uint32) Min(writer->token_count, PG_UINT32_MAX);
+    uint32 num_postings = 0;
+    int count_offset;
+    uint64 i;
+
+    if (writer->num_docs == PG_UINT32_MAX - 1)
+    {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("too many documents in PISA forward index \"%s\"",
+                               writer->path)));
+    }
+
+    qsort(writer->tokens, writer->token_count, sizeof(uint32), ComparePisaTermIds);
+
+    resetStringInfo(record);
+    appendBinaryStringInfo(record, (char *) &doc_id_length, sizeof(uint32));
+    appendBinaryStringInfo(record, doc_id, doc_id_length);
+    appendBinaryStringInfo(record, (char *) &doc_length, sizeof(uint32));
+    count_offset = record->len;
+    appendBinaryStringInfo(record, (char *) &num_postings, sizeof(uint32));
+
+    for (i = 0; i < writer->token_count;)
+    {
+        PisaForwardPosting posting;
+        uint64 run_end = i + 1;
+
+        while (run_end < writer->token_count &&
+               writer->tokens[run_end] == writer->tokens[i])
+            run_end++;
+
+        posting.term_id = writer->tokens[i];
+        posting.freq = (uint32) Min(run_end - i, PG_UINT32_MAX);
+        appendBinaryStringInfo(record, (char *) &posting, sizeof(posting));
+        num_postings++;
+        i = run_end;
+    }
+    memcpy(record->data + count_offset, &num_postings, sizeof(uint32));
+
+    WritePisaForwardBytes(writer, record->data, record->len);
+
+    writer->num_postings += num_postings;
+    writer->num_docs++;
+    writer->token_count = 0;
+}
+
+
+/*
+ * Appends the term dictionary, fills in the header and moves the file in
+ * place. Returns the size of the forward index; the writer is released.
+ */
+uint64
+FinishPisaForwardIndexWriter(PisaForwardIndexWriter *writer)
+{
+    PisaForwardFileHeader header;
+    uint64 file_size;
+    uint32 term;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PISA_FORWARD_MAGIC, sizeof(PISA_FORWARD_MAGIC));
+    header.version = PISA_FORWARD_VERSION;
+    header.num_docs = writer->num_docs;
+    header.num_terms = writer->num_terms;
+    header.num_postings = writer->num_postings;
+    header.dictionary_offset = writer->file_size;
+
+    for (term = 0; term < writer->num_terms; term++)
+    {
+        uint32 term_length = (uint32) strlen(writer->terms[term]);
+
+        WritePisaForwardBytes(writer, &term_length, sizeof(uint32));
+        WritePisaForwardBytes(writer, writer->terms[term], term_length);
+    }
+    file_size = writer->file_size;
+
+    if (fseeko(writer->file, 0, SEEK_SET) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not seek in PISA forward index \"%s\": %m",
+                               writer->temp_path)));
+    }
+    WritePisaForwardBytes(writer, &header, sizeof(header));
+
+    if (FreeFile(writer->file) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write PISA forward index \"%s\": %m",
+                               writer->temp_path)));
+    }
+
+    durable_rename(writer->temp_path, writer->path, ERROR);
+
+    MemoryContextDelete(writer->context);
+
+    return file_size;
+}
+
+
+/*
+ * Reads a forward index file. Returns NULL when the file does not exist.
+ */
+PisaForwardIndex *
+LoadPisaForwardIndex(const char *forward_file)
+{
+    PisaForwardIndex *index;
+    PisaForwardFileHeader header;
+    FILE *file;
+    uint64 posting;
+    uint32 doc;
+    uint32 term;
+
+    file = AllocateFile(forward_file, PG_BINARY_R);
+    if (file == NULL)
+    {
+        if (errno == ENOENT)
+            return NULL;
+
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open PISA forward index \"%s\": %m",
+                               forward_file)));
+    }
+
+    ReadPisaForwardBytes(file, forward_file, &header, sizeof(header));
+    if (memcmp(header.magic, PISA_FORWARD_MAGIC, sizeof(PISA_FORWARD_MAGIC)) != 0 ||
+        header.version != PISA_FORWARD_VERSION)
+    {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("\"%s\" is not a PISA forward index of version %d",
+                               forward_file, PISA_FORWARD_VERSION)));
+    }
+
+    index = (PisaForwardIndex *) palloc0(sizeof(PisaForwardIndex));
+    index->num_docs = header.num_docs;
+    index->num_terms = header.num_terms;
+    index->num_postings = header.num_postings;
+    index->doc_offsets = (uint64 *) palloc_extended((header.num_docs + 1) * sizeof(uint64),
+                                                    MCXT_ALLOC_HUGE);
+    index->doc_lengths = (uint32 *) palloc_extended(Max(header.num_docs, 1) *
+                                                    sizeof(uint32), MCXT_ALLOC_HUGE);
+    index->doc_ids = (char **) palloc_extended(Max(header.num_docs, 1) * sizeof(char *),
+                                               MCXT_ALLOC_HUGE);
+    index->term_ids = (uint32 *) palloc_extended(Max(header.num_postings, 1) *
+                                                 sizeof(uint32), MCXT_ALLOC_HUGE);
+    index->freqs = (uint32 *) palloc_extended(Max(header.num_postings, 1) *
+                                              sizeof(uint32), MCXT_ALLOC_HUGE);
+    index->terms = (char **) palloc_extended(Max(header.num_terms, 1) * sizeof(char *),
+                                             MCXT_ALLOC_HUGE);
+
+    if (fseeko(file, (off_t) header.dictionary_offset, SEEK_SET) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not seek in PISA forward index \"%s\": %m",
+                               forward_file)));
+    }
+    for (term = 0; term < header.num_terms; term++)
+        index->terms[term] = ReadPisaForwardString(file, forward_file);
+
+    if (fseeko(file, (off_t) sizeof(header), SEEK_SET) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not seek in PISA forward index \"%s\": %m",
+                               forward_file)));
+    }
+
+    posting = 0;
+    index->doc_offsets[0] = 0;
+    for (doc = 0; doc < header.num_docs; doc++)
+    {
+        uint32 num_postings;
+        uint32 i;
+
+        index->doc_ids[doc] = ReadPisaForwardString(file, forward_file);
+        ReadPisaForwardBytes(file, forward_file, &index->doc_lengths[doc], sizeof(uint32));
+        ReadPisaForwardBytes(file, forward_file, &num_postings, sizeof(uint32));
+
+        if (num_postings > header.num_postings - posting)
+        {
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("PISA forward index \"%s\" is corrupted",
+                                   forward_file)));
+        }
+
+        for (i = 0; i < num_postings; i++, posting++)
+        {
+            PisaForwardPosting entry;
+
+            ReadPisaForwardBytes(file, forward_file, &entry, sizeof(entry));
+            if (entry.term_id >= header.num_terms)
+            {
+                ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                                errmsg("PISA forward index \"%s\" is corrupted",
+                                       forward_file)));
+            }
+
+            index->term_ids[posting] = entry.term_id;
+            index->freqs[posting] = entry.freq;
+        }
+
+        index->doc_offsets[doc + 1] = posting;
+    }
+
+    FreeFile(file);
+
+    AssignSortedTermIds(index);
+
+    return index;
+}
+
+
+void
+FreePisaForwardIndex(PisaForwardIndex *index)
+{
+    uint32 i;
+
+    if (index == NULL)
+        return;
+
+    for (i = 0; i < index->num_terms; i++)
+        pfree(index->terms[i]);
+    for (i = 0; i < index->num_docs; i++)
+        pfree(index->doc_ids[i]);
+
+    pfree(index->terms);
+    pfree(index->doc_ids);
+    pfree(index->doc_offsets);
+    pfree(index->doc_lengths);
+    pfree(index->term_ids);
+    pfree(index->freqs);
+    pfree(index);
+}
+
+
+/*
+ * Total size of the posting lists the index writer would produce for
+ * this forward index under the given docid assignment.
+ */
+uint64
+MeasurePisaPostingsSize(PisaForwardIndex *index, const uint32 *permutation,
+                        PisaCompressionType compression)
+{
+    PisaInvertedPostings postings;
+    StringInfoData buffer;
+    uint64 total_size = 0;
+    uint32 term;
+
+    InvertPisaForwardIndex(index, permutation, &postings);
+
+    initStringInfo(&buffer);
+    for (term = 0; term < index->num_terms; term++)
+    {
+        uint64 start = postings.term_offsets[term];
+        uint32 count = (uint32) (postings.term_offsets[term + 1] - start);
+
+        total_size += PisaPostingListEncodedSize(compression, postings.docids + start,
+                                                 postings.freqs + start, count, &buffer);
+    }
+
+    pfree(buffer.data);
+    FreePisaInvertedPostings(&postings);
+
+    return total_size;
+}
+
+
+/*
+ * Writes the inverted index of 'index_path' (and the matching document
+ * map, listing the external document id of every docid) from the forward
+ * index. Returns the size of the index file.
+ *
+ * The docid space is split into runs of about the same number of
+ * postings which are inverted independently, by up to
+ * documentdb.pisa_index_build_workers parallel workers and the calling
+ * backend; the runs are then k-way merged term by term straight into the
+ * block-compressing index writer.
+ */
+uint64
+WritePisaIndexFromForwardIndex(PisaForwardIndex *index, const uint32 *permutation,
+                               const char *index_path, PisaCompressionType compression)
+{
+    PisaIndexBuildShared *shared;
+    PisaIndexWriter *writer;
+    uint32 *doc_lengths;
+    uint64 index_size;
+    uint32 docid;
+    int workers = pisa_index_build_workers;
+    bool parallel;
+
+    doc_lengths = (uint32 *) palloc_extended(Max(index->num_docs, 1) * sizeof(uint32),
+                                             MCXT_ALLOC_HUGE);
+    for (docid = 0; docid < index->num_docs; docid++)
+    {
+        uint32 document = permutation != NULL ? permutation[docid] : docid;
+
+        doc_lengths[docid] = index->doc_lengths[document];
+    }
+
+    parallel = workers > 0 && index->num_postings >= PISA_BUILD_MIN_PARALLEL_POSTINGS &&
+               IsTransactionState() && ActiveSnapshotSet() && !IsInParallelMode();
+
+    shared = PlanPisaIndexBuildRuns(index, permutation,
+                                    parallel ? (workers + 1) * PISA_BUILD_RUNS_PER_PROCESS : 1);
+
+    writer = BeginPisaIndexWriter(GetPisaIndexFilePath(index_path), compression,
+                                  index->num_docs, doc_lengths);
+
+    if (parallel && shared->num_runs > 1)
+    {
+        BuildPisaIndexInParallel(index, permutation, shared, writer, workers);
+    }
+    else
+    {
+        PisaIndexBuildArrays arrays;
+        uint64 run_terms_size = Max(shared->num_run_terms, 1) * sizeof(uint32);
+        uint64 postings_size = Max(index->num_postings, 1) * sizeof(uint32);
+
+        arrays.doc_offsets = index->doc_offsets;
+        arrays.term_ids = index->term_ids;
+        arrays.freqs = index->freqs;
+        arrays.permutation = permutation;
+        arrays.run_docids = (uint32 *) palloc_extended(postings_size, MCXT_ALLOC_HUGE);
+        arrays.run_freqs = (uint32 *) palloc_extended(postings_size, MCXT_ALLOC_HUGE);
+        arrays.run_terms = (uint32 *) palloc_extended(run_terms_size, MCXT_ALLOC_HUGE);
+        arrays.run_counts = (uint32 *) palloc_extended(run_terms_size, MCXT_ALLOC_HUGE);
+
+        InvertPisaIndexBuildRuns(&arrays, shared);
+        MergePisaIndexBuildRuns(index, &arrays, shared, writer);
+
+        pfree(arrays.run_docids);
+        pfree(arrays.run_freqs);
+        pfree(arrays.run_terms);
+        pfree(arrays.run_counts);
+    }
+
+    index_size = FinishPisaIndexWriter(writer);
+
+    WritePisaDocumentMap(index, permutation, index_path);
+
+    pfree(shared);
+    pfree(doc_lengths);
+
+    return index_size;
+}
+
+
+/*
+ * Entry point of the parallel workers started by
+ * BuildPisaIndexInParallel.
+ */
+void
+PisaIndexBuildWorkerMain(dsm_segment *segment, shm_toc *toc)
+{
+    PisaIndexBuildShared *shared;
+    PisaIndexBuildArrays arrays;
+
+    shared = (PisaIndexBuildShared *) shm_toc_lookup(toc, PISA_BUILD_KEY_SHARED, false);
+    LookupPisaIndexBuildArrays(toc, shared, &arrays);
+
+    InvertPisaIndexBuildRuns(&arrays, shared);
+}
+
+
+/*
+ * Renumbers terms so that term ids follow PisaCompareTerms order, and
+ * re-sorts every document by the new ids.
+ */
+static void
+AssignSortedTermIds(PisaForwardIndex *index)
+{
+    char **sorted_terms;
+    uint32 *order;
+    uint32 *new_ids;
+    uint32 i;
+
+    if (index->num_terms == 0)
+        return;
+
+    order = (uint32 *) palloc_extended(index->num_terms * sizeof(uint32), MCXT_ALLOC_HUGE);
+    for (i = 0; i < index->num_terms; i++)
+        order[i] = i;
+    qsort_arg(order, index->num_terms, sizeof(uint32), ComparePisaTermOrder, index->terms);
+
+    sorted_terms = (char **) palloc_extended(index->num_terms * sizeof(char *),
+                                             MCXT_ALLOC_HUGE);
+    new_ids = (uint32 *) palloc_extended(index->num_terms * sizeof(uint32),
+                                         MCXT_ALLOC_HUGE);
+    for (i = 0; i < index->num_terms; i++)
+    {
+        sorted_terms[i] = index->terms[order[i]];
+        new_ids[order[i]] = i;
+    }
+
+    for (i = 0; i < index->num_docs; i++)
+    {
+        uint64 start = index->doc_offsets[i];
+        uint64 count = index->doc_offsets[i + 1] - start;
+        PisaForwardPosting *document;
+        uint64 j;
+
+        if (count == 0)
+            continue;
+
+        document = (PisaForwardPosting *) palloc(count * sizeof(PisaForwardPosting));
+        for (j = 0; j < count; j++)
+        {
+            document[j].term_id = new_ids[index->term_ids[start + j]];
+            document[j].freq = index->freqs[start + j];
+        }
+
+        qsort(document, count, sizeof(PisaForwardPosting), ComparePisaForwardPostings);
+
+        for (j = 0; j < count; j++)
+        {
+            index->term_ids[start + j] = document[j].term_id;
+            index->freqs[start + j] = document[j].freq;
+        }
+
+        pfree(document);
+    }
+
+    pfree(index->terms);
+    index->terms = sorted_terms;
+    pfree(new_ids);
+    pfree(order);
+}
+
+
+/*
+ * Counting-sort inversion: postings of each term come out sorted by new
+ * docid because documents are visited in new docid order.
+ */
+static void
+InvertPisaForwardIndex(PisaForwardIndex *index, const uint32 *permutation,
+                       PisaInvertedPostings *postings)
+{
+    uint64 *next;
+    uint64 i;
+    uint32 docid;
+
+    postings->term_offsets = (uint64 *) palloc_extended((index->num_terms + 1) *
+                                                        sizeof(uint64),
+                                                        MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    postings->docids = (uint32 *) palloc_extended(Max(index->num_postings, 1) *
+                                                  sizeof(uint32), MCXT_ALLOC_HUGE);
+    postings->freqs = (uint32 *) palloc_extended(Max(index->num_postings, 1) *
+                                                 sizeof(uint32), MCXT_ALLOC_HUGE);
+
+    for (i = 0; i < index->num_postings; i++)
+        postings->term_offsets[index->term_ids[i] + 1]++;
+    for (i = 0; i < index->num_terms; i++)
+        postings->term_offsets[i + 1] += postings->term_offsets[i];
+
+    next = (uint64 *) palloc_extended(Max(index->num_terms, 1) * sizeof(uint64),
+                                      MCXT_ALLOC_HUGE);
+    memcpy(next, postings->term_offsets, index->num_terms * sizeof(uint64));
+
+    for (docid = 0; docid < index->num_docs; docid++)
+    {
+        uint32 document = permutation != NULL ? permutation[docid] : docid;
+
+        for (i = index->doc_offsets[document]; i < index->doc_offsets[document + 1]; i++)
+        {
+            uint64 position = next[index->term_ids[i]]++;
+
+            postings->docids[position] = docid;
+            postings->freqs[position] = index->freqs[i];
+        }
+    }
+
+    pfree(next);
+}
+
+
+/*
+ * Splits the docids into at most 'num_runs' consecutive ranges holding
+ * about the same number of postings.
+ */
+static PisaIndexBuildShared *
+PlanPisaIndexBuildRuns(PisaForwardIndex *index, const uint32 *permutation, uint32 num_runs)
+{
+    PisaIndexBuildShared *shared;
+    uint64 target = index->num_postings / Max(num_runs, 1) + 1;
+    uint64 postings_start = 0;
+    uint32 docid = 0;
+
+    shared = (PisaIndexBuildShared *) palloc0(add_size(offsetof(PisaIndexBuildShared, runs),
+                                                       mul_size(num_runs,
+                                                                sizeof(PisaIndexBuildRun))));
+    shared->num_docs = index->num_docs;
+    shared->num_terms = index->num_terms;
+    shared->num_postings = index->num_postings;
+    shared->has_permutation = permutation != NULL;
+    pg_atomic_init_u32(&shared->next_run, 0);
+
+    while (docid < index->num_docs && shared->num_runs < num_runs)
+    {
+        PisaIndexBuildRun *run = &shared->runs[shared->num_runs];
+        bool last_run = shared->num_runs == num_runs - 1;
+        uint64 run_postings = 0;
+
+        run->first_docid = docid;
+        while (docid < index->num_docs && (run_postings < target || last_run))
+        {
+            uint32 document = permutation != NULL ? permutation[docid] : docid;
+
+            run_postings += index->doc_offsets[document + 1] - index->doc_offsets[document];
+            docid++;
+        }
+        run->end_docid = docid;
+        run->postings_start = postings_start;
+        run->terms_start = shared->num_run_terms;
+
+        /* A run cannot hold more distinct terms than postings */
+        postings_start += run_postings;
+        shared->num_run_terms += Min(run_postings, index->num_terms);
+        shared->num_runs++;
+    }
+
+    return shared;
+}
+
+
+/*
+ * Copies the forward index into a DSM segment and inverts its runs on
+ * the parallel workers and the calling backend, which then merges them
+ * into 'writer' while the segment is still mapped.
+ */
+static void
+BuildPisaIndexInParallel(PisaForwardIndex *index, const uint32 *permutation,
+                         PisaIndexBuildShared *local_shared, PisaIndexWriter *writer,
+                         int workers)
+{
+    ParallelContext *pcxt;
+    PisaIndexBuildShared *shared;
+    PisaIndexBuildArrays arrays;
+    Size shared_size = add_size(offsetof(PisaIndexBuildShared, runs),
+                                mul_size(local_shared->num_runs, sizeof(PisaIndexBuildRun)));
+    Size offsets_size = ((Size) index->num_docs + 1) * sizeof(uint64);
+    Size postings_size = Max(index->num_postings, 1) * sizeof(uint32);
+    Size permutation_size = (Size) Max(index->num_docs, 1) * sizeof(uint32);
+    Size run_terms_size = Max(local_shared->num_run_terms, 1) * sizeof(uint32);
+    void *chunk;
+
+    EnterParallelMode();
+    pcxt = CreateParallelContext("pg_documentdb", "PisaIndexBuildWorkerMain", workers);
+
+    shm_toc_estimate_chunk(&pcxt->estimator, shared_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, offsets_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, postings_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, postings_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, postings_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, postings_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, run_terms_size);
+    shm_toc_estimate_chunk(&pcxt->estimator, run_terms_size);
+    shm_toc_estimate_keys(&pcxt->estimator, 8);
+    if (permutation != NULL)
+    {
+        shm_toc_estimate_chunk(&pcxt->estimator, permutation_size);
+        shm_toc_estimate_keys(&pcxt->estimator, 1);
+    }
+    InitializeParallelDSM(pcxt);
+
+    shared = (PisaIndexBuildShared *) shm_toc_allocate(pcxt->toc, shared_size);
+    memcpy(shared, local_shared, shared_size);
+    pg_atomic_init_u32(&shared->next_run, 0);
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_SHARED, shared);
+
+    chunk = shm_toc_allocate(pcxt->toc, offsets_size);
+    memcpy(chunk, index->doc_offsets, offsets_size);
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_DOC_OFFSETS, chunk);
+
+    chunk = shm_toc_allocate(pcxt->toc, postings_size);
+    memcpy(chunk, index->term_ids, index->num_postings * sizeof(uint32));
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_TERM_IDS, chunk);
+
+    chunk = shm_toc_allocate(pcxt->toc, postings_size);
+    memcpy(chunk, index->freqs, index->num_postings * sizeof(uint32));
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_FREQS, chunk);
+
+    if (permutation != NULL)
+    {
+        chunk = shm_toc_allocate(pcxt->toc, permutation_size);
+        memcpy(chunk, permutation, (Size) index->num_docs * sizeof(uint32));
+        shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_PERMUTATION, chunk);
+    }
+
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_RUN_DOCIDS,
+                   shm_toc_allocate(pcxt->toc, postings_size));
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_RUN_FREQS,
+                   shm_toc_allocate(pcxt->toc, postings_size));
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_RUN_TERMS,
+                   shm_toc_allocate(pcxt->toc, run_terms_size));
+    shm_toc_insert(pcxt->toc, PISA_BUILD_KEY_RUN_COUNTS,
+                   shm_toc_allocate(pcxt->toc, run_terms_size));
+
+    LaunchParallelWorkers(pcxt);
+
+    elog(DEBUG1, "PISA index build: %u runs on %d parallel workers and the leader",
+         shared->num_runs, pcxt->nworkers_launched);
+
+    /* The leader inverts runs too, so this completes even if no worker started */
+    LookupPisaIndexBuildArrays(pcxt->toc, shared, &arrays);
+    InvertPisaIndexBuildRuns(&arrays, shared);
+
+    WaitForParallelWorkersToFinish(pcxt);
+
+    MergePisaIndexBuildRuns(index, &arrays, shared, writer);
+
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+}
+
+
+static void
+LookupPisaIndexBuildArrays(shm_toc *toc, PisaIndexBuildShared *shared,
+                           PisaIndexBuildArrays *arrays)
+{
+    arrays->doc_offsets = shm_toc_lookup(toc, PISA_BUILD_KEY_DOC_OFFSETS, false);
+    arrays->term_ids = shm_toc_lookup(toc, PISA_BUILD_KEY_TERM_IDS, false);
+    arrays->freqs = shm_toc_lookup(toc, PISA_BUILD_KEY_FREQS, false);
+    arrays->permutation = shared->has_permutation ?
+                          shm_toc_lookup(toc, PISA_BUILD_KEY_PERMUTATION, false) : NULL;
+    arrays->run_docids = shm_toc_lookup(toc, PISA_BUILD_KEY_RUN_DOCIDS, false);
+    arrays->run_freqs = shm_toc_lookup(toc, PISA_BUILD_KEY_RUN_FREQS, false);
+    arrays->run_terms = shm_toc_lookup(toc, PISA_BUILD_KEY_RUN_TERMS, false);
+    arrays->run_counts = shm_toc_lookup(toc, PISA_BUILD_KEY_RUN_COUNTS, false);
+}
+
+
+/*
+ * Inverts runs until none is left. Every run is a counting sort of its
+ * docid range: the terms present come out in term id order, each with
+ * its postings in docid order.
+ */
+static void
+InvertPisaIndexBuildRuns(PisaIndexBuildArrays *arrays, PisaIndexBuildShared *shared)
+{
+    uint64 *next;
+
+    next = (uint64 *) palloc_extended(Max(shared->num_terms, 1) * sizeof(uint64),
+                                      MCXT_ALLOC_HUGE);
+
+    for (;;)
+    {
+        uint32 run_index = pg_atomic_fetch_add_u32(&shared->next_run, 1);
+        PisaIndexBuildRun *run;
+        uint64 position;
+        uint32 num_terms = 0;
+        uint32 docid;
+        uint32 term;
+
+        if (run_index >= shared->num_runs)
+            break;
+
+        run = &shared->runs[run_index];
+        memset(next, 0, shared->num_terms * sizeof(uint64));
+
+        for (docid = run->first_docid; docid < run->end_docid; docid++)
+        {
+            uint32 document = arrays->permutation != NULL ? arrays->permutation[docid] :
+                              docid;
+            uint64 i;
+
+            for (i = arrays->doc_offsets[document]; i < arrays->doc_offsets[document + 1];
+                 i++)
+                next[arrays->term_ids[i]]++;
+        }
+
+        position = run->postings_start;
+        for (term = 0; term < shared->num_terms; term++)
+        {
+            uint64 count = next[term];
+
+            if (count == 0)
+                continue;
+
+            arrays->run_terms[run->terms_start + num_terms] = term;
+            arrays->run_counts[run->terms_start + num_terms] = (uint32) count;
+            num_terms++;
+
+            next[term] = position;
+            position += count;
+        }
+
+        for (docid = run->first_docid; docid < run->end_docid; docid++)
+        {
+            uint32 document = arrays->permutation != NULL ? arrays->permutation[docid] :
+                              docid;
+            uint64 i;
+
+            for (i = arrays->doc_offsets[document]; i < arrays->doc_offsets[document + 1];
+                 i++)
+            {
+                uint64 target = next[arrays->term_ids[i]]++;
+
+                arrays->run_docids[target] = docid;
+                arrays->run_freqs[target] = arrays->freqs[i];
+            }
+        }
+
+        run->num_terms = num_terms;
+
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    pfree(next);
+}
+
+
+/*
+ * k-way merge of the inverted runs. Runs cover increasing docid ranges,
+ * so the posting list of a term is the concatenation of its run lists
+ * in run order; the heap yields (term, run) pairs in that order.
+ */
+static void
+MergePisaIndexBuildRuns(PisaForwardIndex *index, PisaIndexBuildArrays *arrays,
+                        PisaIndexBuildShared *shared, PisaIndexWriter *writer)
+{
+    PisaRunMergeState state;
+    binaryheap *heap;
+    uint64 buffer_capacity = 1024;
+    uint32 *docids;
+    uint32 *freqs;
+    uint32 run;
+
+    state.arrays = arrays;
+    state.shared = shared;
+    state.term_positions = (uint32 *) palloc0(Max(shared->num_runs, 1) * sizeof(uint32));
+    state.posting_positions = (uint64 *) palloc(Max(shared->num_runs, 1) * sizeof(uint64));
+
+    heap = binaryheap_allocate(Max(shared->num_runs, 1), ComparePisaRunMergeEntries, &state);
+    for (run = 0; run < shared->num_runs; run++)
+    {
+        state.posting_positions[run] = shared->runs[run].postings_start;
+        if (shared->runs[run].num_terms > 0)
+            binaryheap_add_unordered(heap, UInt32GetDatum(run));
+    }
+    binaryheap_build(heap);
+
+    docids = (uint32 *) palloc(buffer_capacity * sizeof(uint32));
+    freqs = (uint32 *) palloc(buffer_capacity * sizeof(uint32));
+
+    while (!binaryheap_empty(heap))
+    {
+        uint32 term = PisaRunMergeTerm(&state, DatumGetUInt32(binaryheap_first(heap)));
+        const uint32 *list_docids = NULL;
+        const uint32 *list_freqs = NULL;
+        uint64 count = 0;
+        bool copied = false;
+
+        do
+        {
+            uint32 current = DatumGetUInt32(binaryheap_first(heap));
+            PisaIndexBuildRun *current_run = &shared->runs[current];
+            uint64 position = state.posting_positions[current];
+            uint32 run_count = arrays->run_counts[current_run->terms_start +
+                                                  state.term_positions[current]];
+
+            if (count == 0)
+            {
+                /* Terms found in a single run are written without copying */
+                list_docids = arrays->run_docids + position;
+                list_freqs = arrays->run_freqs + position;
+                copied = false;
+            }
+            else
+            {
+                if (count + run_count > buffer_capacity)
+                {
+                    docids = GrowPisaArray(docids, &buffer_capacity, count + run_count,
+                                           sizeof(uint32));
+                    freqs = repalloc_huge(freqs, buffer_capacity * sizeof(uint32));
+                }
+
+                if (!copied)
+                {
+                    memcpy(docids, list_docids, count * sizeof(uint32));
+                    memcpy(freqs, list_freqs, count * sizeof(uint32));
+                    copied = true;
+                }
+
+                memcpy(docids + count, arrays->run_docids + position,
+                       run_count * sizeof(uint32));
+                memcpy(freqs + count, arrays->run_freqs + position,
+                       run_count * sizeof(uint32));
+                list_docids = docids;
+                list_freqs = freqs;
+            }
+            count += run_count;
+
+            state.posting_positions[current] += run_count;
+            if (++state.term_positions[current] < current_run->num_terms)
+                binaryheap_replace_first(heap, UInt32GetDatum(current));
+            else
+                binaryheap_remove_first(heap);
+        } while (!binaryheap_empty(heap) &&
+                 PisaRunMergeTerm(&state, DatumGetUInt32(binaryheap_first(heap))) == term);
+
+        PisaIndexWriterAddTerm(writer, index->terms[term], strlen(index->terms[term]),
+                               list_docids, list_freqs, (uint32) count);
+
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    binaryheap_free(heap);
+    pfree(docids);
+    pfree(freqs);
+    pfree(state.term_positions);
+    pfree(state.posting_positions);
+}
+
+
+static void
+FreePisaInvertedPostings(PisaInvertedPostings *postings)
+{
+    pfree(postings->term_offsets);
+    pfree(postings->docids);
+    pfree(postings->freqs);
+}
+
+
+static void
+WritePisaDocumentMap(PisaForwardIndex *index, const uint32 *permutation,
+                     const char *index_path)
+{
+    char path[MAXPGPATH];
+    char temp_path[MAXPGPATH];
+    FILE *file;
+    uint32 docid;
+
+    snprintf(path, MAXPGPATH, "%s%s", index_path, PISA_DOCMAP_FILE_SUFFIX);
+    snprintf(temp_path, MAXPGPATH, "%s.tmp", path);
+
+    file = AllocateFile(temp_path, PG_BINARY_W);
+    if (file == NULL)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not create PISA document map \"%s\": %m",
+                               temp_path)));
+    }
+
+    for (docid = 0; docid < index->num_docs; docid++)
+    {
+        uint32 document = permutation != NULL ? permutation[docid] : docid;
+
+        fprintf(file, "%s\n", index->doc_ids[document]);
+    }
+
+    if (FreeFile(file) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write PISA document map \"%s\": %m",
+                               temp_path)));
+    }
+
+    durable_rename(temp_path, path, ERROR);
+}
+
+
+static void *
+GrowPisaArray(void *array, uint64 *capacity, uint64 needed, Size element_size)
+{
+    if (needed <= *capacity)
+        return array;
+
+    while (*capacity < needed)
+        *capacity *= 2;
+
+    return repalloc_huge(array, *capacity * element_size);
+}
+
+
+static void
+AddPisaForwardToken(PisaForwardIndexWriter *writer, const char *token, uint32 length)
+{
+    PisaForwardTermKey key;
+    PisaForwardTermEntry *entry;
+    char *term;
+    bool found;
+
+    key.data = token;
+    key.length = length;
+    entry = (PisaForwardTermEntry *) hash_search(writer->term_table, &key, HASH_ENTER,
+                                                 &found);
+    if (!found)
+    {
+        if (writer->num_terms == PG_UINT32_MAX)
+        {
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                            errmsg("too many terms in PISA forward index \"%s\"",
+                                   writer->path)));
+        }
+
+        /* The key still points into the caller's buffer, keep a copy */
+        term = (char *) MemoryContextAlloc(writer->context, length + 1);
+        memcpy(term, token, length);
+        term[length] = '\0';
+
+        entry->key.data = term;
+        entry->term_id = writer->num_terms;
+        writer->terms = GrowPisaArray(writer->terms, &writer->term_capacity,
+                                      writer->num_terms + 1, sizeof(char *));
+        writer->terms[writer->num_terms++] = term;
+    }
+
+    writer->tokens = GrowPisaArray(writer->tokens, &writer->token_capacity,
+                                   writer->token_count + 1, sizeof(uint32));
+    writer->tokens[writer->token_count++] = entry->term_id;
+}
+
+
+static void
+WritePisaForwardBytes(PisaForwardIndexWriter *writer, const void *data, size_t length)
+{
+    if (length > 0 && fwrite(data, 1, length, writer->file) != length)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write PISA forward index \"%s\": %m",
+                               writer->temp_path)));
+    }
+
+    writer->file_size += length;
+}
+
+
+static void
+ReadPisaForwardBytes(FILE *file, const char *forward_file, void *data, size_t length)
+{
+    if (length > 0 && fread(data, 1, length, file) != length)
+    {
+        if (ferror(file))
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not read PISA forward index \"%s\": %m",
+                                   forward_file)));
+        }
+
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("PISA forward index \"%s\" is truncated", forward_file)));
+    }
+}
+
+
+static char *
+ReadPisaForwardString(FILE *file, const char *forward_file)
+{
+    uint32 length;
+    char *value;
+
+    ReadPisaForwardBytes(file, forward_file, &length, sizeof(uint32));
+    if (length >= MaxAllocSize)
+    {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("PISA forward index \"%s\" is corrupted", forward_file)));
+    }
+
+    value = (char *) palloc(length + 1);
+    ReadPisaForwardBytes(file, forward_file, value, length);
+    value[length] = '\0';
+
+    return value;
+}
+
+
+static uint32
+PisaForwardTermHash(const void *key, Size keysize)
+{
+    const PisaForwardTermKey *term = (const PisaForwardTermKey *) key;
+
+    return hash_bytes((const unsigned char *) term->data, (int) term->length);
+}
+
+
+static int
+PisaForwardTermMatch(const void *key1, const void *key2, Size keysize)
+{
+    const PisaForwardTermKey *left = (const PisaForwardTermKey *) key1;
+    const PisaForwardTermKey *right = (const PisaForwardTermKey *) key2;
+
+    if (left->length != right->length)
+        return 1;
+
+    return memcmp(left->data, right->data, left->length);
+}
+
+
+static int
+ComparePisaForwardPostings(const void *left, const void *right)
+{
+    const PisaForwardPosting *left_posting = (const PisaForwardPosting *) left;
+    const PisaForwardPosting *right_posting = (const PisaForwardPosting *) right;
+
+    return left_posting->term_id < right_posting->term_id ? -1 :
+           left_posting->term_id > right_posting->term_id ? 1 : 0;
+}
+
+
+static int
+ComparePisaTermOrder(const void *left, const void *right, void *arg)
+{
+    char **terms = (char **) arg;
+    const char *left_term = terms[*(const uint32 *) left];
+    const char *right_term = terms[*(const uint32 *) right];
+
+    return PisaCompareTerms(left_term, strlen(left_term), right_term, strlen(right_term));
+}
+
+
+static int
+ComparePisaTermIds(const void *left, const void *right)
+{
+    uint32 left_id = *(const uint32 *) left;
+    uint32 right_id = *(const uint32 *) right;
+
+    return left_id < right_id ? -1 : left_id > right_id ? 1 : 0;
+}
+
+
+static inline uint32
+PisaRunMergeTerm(PisaRunMergeState *state, uint32 run)
+{
+    return state->arrays->run_terms[state->shared->runs[run].terms_start +
+                                    state->term_positions[run]];
+}
+
+
+/*
+ * binaryheap keeps the largest entry on top, so smaller (term, run)
+ * pairs compare as larger.
+ */
+static int
+ComparePisaRunMergeEntries(Datum left, Datum right, void *arg)
+{
+    PisaRunMergeState *state = (PisaRunMergeState *) arg;
+    uint32 left_run = DatumGetUInt32(left);
+    uint32 right_run = DatumGetUInt32(right);
+    uint32 left_term = PisaRunMergeTerm(state, left_run);
+    uint32 right_term = PisaRunMergeTerm(state, right_run);
+
+    if (left_term != right_term)
+        return left_term < right_term ? 1 : -1;
+
+    return left_run < right_run ? 1 : left_run > right_run ? -1 : 0;
+}
@@ -0,0 +1,1234 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/pisa_integration/index_segments.c
+ *
+ * Segment manifest of a PISA index and the cursor that walks a term over
+ * the base index and its delta segments. Segments are immutable once
+ * written; index sync (index_sync.c) adds them, merges them and records
+ * deleted documents by replacing the manifest.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "catalog/pg_type.h"
+#include "storage/fd.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#include "pisa_integration/forward_index.h"
+#include "pisa_integration/index_segments.h"
+#include "pisa_integration/inverted_index.h"
+#include "pisa_integration/memory_optimization.h"
+#include "pisa_integration/query_cache.h"
+
+#define PISA_SEGMENTS_LOCK_FILE_SUFFIX ".lock"
+
+typedef struct PisaSegmentSetCacheEntry
+{
+    char index_path[MAXPGPATH];     /* hash key */
+    PisaSegmentSet *set;
+} PisaSegmentSetCacheEntry;
+
+/* Segment sets of the indexes queried by this backend */
+static HTAB *PisaSegmentSetCache = NULL;
+
+static PisaSegmentSet *LoadPisaSegmentSet(const char *index_path, MemoryContext context);
+static PisaSegmentSet *CreateBasePisaSegmentSet(const char *index_path, uint32 base_docs);
+static void ReadPisaSegmentsBytes(FILE *file, const char *path, void *data, size_t length);
+static void GrowPisaDeletedBitmap(PisaSegmentSet *set);
+static int FindPisaSegment(PisaSegmentSet *set, uint32 docid);
+static void SettlePisaSegmentCursor(PisaSegmentCursor *cursor);
+static void WritePisaTestSegment(const char *segment_path, uint32 num_docs,
+                                 const char **terms, const uint32 **docids,
+                                 const uint32 *counts, int num_terms);
+static void PutPisaTestSegmentPostings(Tuplestorestate *tupstore, TupleDesc tupdesc,
+                                       const char *index_path, const char *stage);
+
+PG_FUNCTION_INFO_V1(documentdb_pisa_segments_for_test);
+
+
+/*
+ * Path prefix of the files of a segment: the index path itself for the
+ * base segment, <index_path>.delta.<segment_id> otherwise.
+ */
+void
+GetPisaSegmentPath(const char *index_path, uint32 segment_id, char *segment_path)
+{
+    if (segment_id == PISA_BASE_SEGMENT_ID)
+        strlcpy(segment_path, index_path, MAXPGPATH);
+    else
+        snprintf(segment_path, MAXPGPATH, "%s%s%u", index_path, PISA_DELTA_SEGMENT_INFIX,
+                 segment_id);
+}
+
+
+/*
+ * Takes the lock serializing the writers of the segments of an index.
+ * Returns -1 when 'wait' is false and another process holds the lock.
+ * The lock goes away with the process that holds it.
+ */
+int
+LockPisaIndexSegments(const char *index_path, bool wait)
+{
+    char lock_path[MAXPGPATH];
+    int lock_fd;
+
+    snprintf(lock_path, MAXPGPATH, "%s%s", index_path, PISA_SEGMENTS_LOCK_FILE_SUFFIX);
+
+    lock_fd = BasicOpenFile(lock_path, O_RDWR | O_CREAT | PG_BINARY);
+    if (lock_fd < 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open PISA index lock file \"%s\": %m",
+                               lock_path)));
+    }
+
+    if (flock(lock_fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) < 0)
+    {
+        int save_errno = errno;
+
+        close(lock_fd);
+        if (!wait && save_errno == EWOULDBLOCK)
+            return -1;
+
+        errno = save_errno;
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not lock PISA index lock file \"%s\": %m",
+                               lock_path)));
+    }
+
+    return lock_fd;
+}
+
+
+void
+UnlockPisaIndexSegments(int lock_fd)
+{
+    if (lock_fd >= 0)
+        close(lock_fd);
+}
+
+
+/*
+ * Reads the segments of an index into the current memory context. An
+ * index built before it had a segments file is a single base segment.
+ * Returns NULL when the index does not exist.
+ */
+PisaSegmentSet *
+ReadPisaSegmentSet(const char *index_path)
+{
+    return LoadPisaSegmentSet(index_path, CurrentMemoryContext);
+}
+
+
+/*
+ * Replaces the segments file of the index with the content of 'set', and
+ * invalidates the query results cached for it.
+ */
+void
+WritePisaSegmentSet(PisaSegmentSet *set)
+{
+    PisaSegmentsFileHeader header;
+    char path[MAXPGPATH];
+    char temp_path[MAXPGPATH];
+    uint32 words = (set->next_docid + 63) / 64;
+    uint64 zero = 0;
+    FILE *file;
+    uint32 i;
+
+    snprintf(path, MAXPGPATH, "%s%s", set->index_path, PISA_SEGMENTS_FILE_SUFFIX);
+    snprintf(temp_path, MAXPGPATH, "%s.tmp", path);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PISA_SEGMENTS_MAGIC, sizeof(PISA_SEGMENTS_MAGIC));
+    header.version = PISA_SEGMENTS_VERSION;
+    header.num_segments = set->num_segments;
+    header.next_segment_id = set->next_segment_id;
+    header.next_docid = set->next_docid;
+    header.identifier = set->identifier;
+    header.generation = set->generation;
+    header.num_deleted = set->num_deleted;
+
+    file = AllocateFile(temp_path, PG_BINARY_W);
+    if (file == NULL)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not create PISA segments file \"%s\": %m",
+                               temp_path)));
+    }
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        (set->num_segments > 0 &&
+         fwrite(set->segments, sizeof(PisaSegmentEntry), set->num_segments,
+                file) != set->num_segments) ||
+        fwrite(set->deleted, sizeof(uint64), Min(words, set->deleted_words),
+               file) != Min(words, set->deleted_words))
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write PISA segments file \"%s\": %m",
+                               temp_path)));
+    }
+
+    for (i = set->deleted_words; i < words; i++)
+    {
+        if (fwrite(&zero, sizeof(uint64), 1, file) != 1)
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not write PISA segments file \"%s\": %m",
+                                   temp_path)));
+        }
+    }
+
+    if (FreeFile(file) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write PISA segments file \"%s\": %m",
+                               temp_path)));
+    }
+
+    durable_rename(temp_path, path, ERROR);
+
+    InvalidatePisaQueryCacheForIndex(set->index_path);
+}
+
+
+void
+FreePisaSegmentSet(PisaSegmentSet *set)
+{
+    if (set == NULL)
+        return;
+
+    pfree(set->segments);
+    if (set->deleted != NULL)
+        pfree(set->deleted);
+    pfree(set);
+}
+
+
+/*
+ * Starts a new segment history after the base index was rebuilt from the
+ * collection: the base becomes the only segment and the delta segments
+ * of the previous history are removed. The caller holds the segments
+ * lock, taken before the collection was exported.
+ */
+void
+ResetPisaIndexSegments(const char *index_path)
+{
+    char segments_path[MAXPGPATH];
+    PisaSegmentSet *old_set = NULL;
+    PisaSegmentSet *set;
+    PisaIndexReader *reader;
+    char *index_file;
+    uint32 i;
+
+    index_file = GetPisaIndexFilePath(index_path);
+    reader = OpenPisaIndexReader(index_file);
+    if (reader == NULL)
+    {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_FILE),
+                        errmsg("PISA index file \"%s\" does not exist", index_file)));
+    }
+    pfree(index_file);
+
+    snprintf(segments_path, MAXPGPATH, "%s%s", index_path, PISA_SEGMENTS_FILE_SUFFIX);
+    if (access(segments_path, F_OK) == 0)
+        old_set = ReadPisaSegmentSet(index_path);
+
+    set = CreateBasePisaSegmentSet(index_path, reader->header->num_docs);
+    ReleasePisaIndexReader(reader);
+
+    /* Segments of the old history may still wait for removal by index sync */
+    if (old_set != NULL)
+        set->next_segment_id = Max(set->next_segment_id, old_set->next_segment_id);
+    WritePisaSegmentSet(set);
+    FreePisaSegmentSet(set);
+
+    for (i = 0; old_set != NULL && i < old_set->num_segments; i++)
+    {
+        if (old_set->segments[i].segment_id != PISA_BASE_SEGMENT_ID)
+            RemovePisaSegmentFiles(index_path, old_set->segments[i].segment_id);
+    }
+    FreePisaSegmentSet(old_set);
+}
+
+
+/*
+ * Carries the deleted documents of the base segment over to the docids
+ * of a reordered base index. The permutations map docids to forward
+ * index documents (NULL for the forward index order). The caller holds
+ * the segments lock.
+ */
+void
+RemapPisaBaseSegment(const char *index_path, const uint32 *old_permutation,
+                     const uint32 *new_permutation, uint32 num_docs)
+{
+    PisaSegmentSet *set = ReadPisaSegmentSet(index_path);
+    PisaSegmentEntry *base;
+
+    if (set == NULL)
+        return;
+
+    /* A base that was merged away is no longer read by queries */
+    base = &set->segments[0];
+    if (base->segment_id != PISA_BASE_SEGMENT_ID || base->num_docs != num_docs)
+    {
+        FreePisaSegmentSet(set);
+        return;
+    }
+
+    if (base->num_deleted > 0)
+    {
+        uint32 *new_docids = (uint32 *) palloc_extended(num_docs * sizeof(uint32),
+                                                        MCXT_ALLOC_HUGE);
+        uint64 *deleted = (uint64 *) palloc_extended(set->deleted_words * sizeof(uint64),
+                                                     MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+        uint32 docid;
+
+        for (docid = 0; docid < num_docs; docid++)
+            new_docids[new_permutation != NULL ? new_permutation[docid] : docid] = docid;
+
+        for (docid = 0; docid < num_docs; docid++)
+        {
+            uint32 document = old_permutation != NULL ? old_permutation[docid] : docid;
+            uint32 new_docid = new_docids[document];
+
+            if (PisaSegmentSetIsDeleted(set, docid))
+                deleted[new_docid / 64] |= UINT64CONST(1) << (new_docid % 64);
+        }
+
+        /* Deletions past the base segment keep their docids */
+        for (docid = num_docs; docid < set->next_docid; docid++)
+        {
+            if (PisaSegmentSetIsDeleted(set, docid))
+                deleted[docid / 64] |= UINT64CONST(1) << (docid % 64);
+        }
+
+        pfree(set->deleted);
+        set->deleted = deleted;
+        pfree(new_docids);
+    }
+
+    set->generation++;
+    WritePisaSegmentSet(set);
+    FreePisaSegmentSet(set);
+}
+
+
+/*
+ * Removes the index, forward index and document map of a segment that
+ * is no longer listed in the segments file. Queries that already mapped
+ * the index keep their mapping.
+ */
+void
+RemovePisaSegmentFiles(const char *index_path, uint32 segment_id)
+{
+    static const char *const suffixes[] = {
+        PISA_INDEX_FILE_SUFFIX, PISA_FORWARD_FILE_SUFFIX, PISA_DOCMAP_FILE_SUFFIX
+    };
+    char segment_path[MAXPGPATH];
+    int i;
+
+    GetPisaSegmentPath(index_path, segment_id, segment_path);
+
+    for (i = 0; i < lengthof(suffixes); i++)
+    {
+        char path[MAXPGPATH];
+
+        snprintf(path, MAXPGPATH, "%s%s", segment_path, suffixes[i]);
+        if (unlink(path) < 0 && errno != ENOENT)
+        {
+            ereport(WARNING, (errcode_for_file_access(),
+                              errmsg("could not remove PISA segment file \"%s\": %m",
+                                     path)));
+        }
+    }
+}
+
+
+void
+PisaSegmentSetMarkDeleted(PisaSegmentSet *set, uint32 docid)
+{
+    int segment;
+
+    if (docid >= set->next_docid || PisaSegmentSetIsDeleted(set, docid))
+        return;
+
+    segment = FindPisaSegment(set, docid);
+    if (segment < 0)
+        return;
+
+    GrowPisaDeletedBitmap(set);
+    set->deleted[docid / 64] |= UINT64CONST(1) << (docid % 64);
+    set->segments[segment].num_deleted++;
+    set->num_deleted++;
+}
+
+
+/*
+ * Appends a segment owning the next num_docs docids.
+ */
+void
+PisaSegmentSetAddSegment(PisaSegmentSet *set, uint32 segment_id, uint32 num_docs)
+{
+    PisaSegmentEntry *entry;
+
+    if ((uint64) set->next_docid + num_docs >= PISA_POSTING_END)
+    {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("too many documents in PISA index \"%s\"",
+                               set->index_path),
+                        errhint("Rebuild the index to reclaim the docids of deleted "
+                                "documents.")));
+    }
+
+    if (set->num_segments == set->max_segments)
+    {
+        set->max_segments *= 2;
+        set->segments = (PisaSegmentEntry *) repalloc(set->segments, set->max_segments *
+                                                      sizeof(PisaSegmentEntry));
+    }
+
+    entry = &set->segments[set->num_segments++];
+    entry->segment_id = segment_id;
+    entry->first_docid = set->next_docid;
+    entry->num_docs = num_docs;
+    entry->num_deleted = 0;
+
+    set->next_docid += num_docs;
+    set->next_segment_id = Max(set->next_segment_id, segment_id + 1);
+    set->num_docs += num_docs;
+}
+
+
+/*
+ * Replaces segments [first, last] with the segment holding their live
+ * documents, which keeps the docid range of the replaced segments (the
+ * range is reclaimed when the merge reaches the last segment). A merge
+ * that left no document removes the segments.
+ */
+void
+PisaSegmentSetReplaceSegments(PisaSegmentSet *set, int first, int last,
+                              uint32 segment_id, uint32 num_docs)
+{
+    uint32 first_docid = set->segments[first].first_docid;
+    uint32 end_docid;
+    uint32 docid;
+    int removed = last - first + 1;
+    bool reaches_end = last + 1 == (int) set->num_segments;
+    int i;
+
+    Assert(first <= last && last < (int) set->num_segments);
+
+    end_docid = reaches_end ? set->next_docid : set->segments[last + 1].first_docid;
+
+    for (i = first; i <= last; i++)
+    {
+        set->num_docs -= set->segments[i].num_docs;
+        set->num_deleted -= set->segments[i].num_deleted;
+    }
+
+    for (docid = first_docid; docid < end_docid && docid / 64 < set->deleted_words;)
+    {
+        if (docid % 64 == 0 && end_docid - docid >= 64)
+        {
+            set->deleted[docid / 64] = 0;
+            docid += 64;
+        }
+        else
+        {
+            set->deleted[docid / 64] &= ~(UINT64CONST(1) << (docid % 64));
+            docid++;
+        }
+    }
+
+    if (num_docs > 0)
+    {
+        Assert(num_docs <= end_docid - first_docid);
+
+        set->segments[first].segment_id = segment_id;
+        set->segments[first].num_docs = num_docs;
+        set->segments[first].num_deleted = 0;
+        set->num_docs += num_docs;
+        removed--;
+        first++;
+    }
+
+    memmove(&set->segments[first], &set->segments[first + removed],
+            (set->num_segments - first - removed) * sizeof(PisaSegmentEntry));
+    set->num_segments -= removed;
+
+    if (reaches_end)
+        set->next_docid = first_docid + num_docs;
+
+    set->next_segment_id = Max(set->next_segment_id, segment_id + 1);
+}
+
+
+/*
+ * Returns the segments of an index, cached for the backend and reloaded
+ * when the segments file is replaced. The set stays valid until it is
+ * released; NULL when the index does not exist.
+ */
+PisaSegmentSet *
+OpenPisaSegmentSet(const char *index_path)
+{
+    PisaSegmentSetCacheEntry *entry;
+    PisaSegmentSet *set;
+    char path[MAXPGPATH];
+    struct stat file_stat;
+    bool found;
+
+    snprintf(path, MAXPGPATH, "%s%s", index_path, PISA_SEGMENTS_FILE_SUFFIX);
+    if (stat(path, &file_stat) < 0)
+    {
+        char *index_file;
+
+        if (errno != ENOENT)
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not stat PISA segments file \"%s\": %m", path)));
+        }
+
+        /* An index without segments file: its base index identifies it */
+        index_file = GetPisaIndexFilePath(index_path);
+        if (stat(index_file, &file_stat) < 0)
+        {
+            if (errno != ENOENT)
+            {
+                ereport(ERROR, (errcode_for_file_access(),
+                                errmsg("could not stat PISA index file \"%s\": %m",
+                                       index_file)));
+            }
+            pfree(index_file);
+            return NULL;
+        }
+        pfree(index_file);
+    }
+
+    if (PisaSegmentSetCache == NULL)
+    {
+        HASHCTL hash_ctl;
+
+        memset(&hash_ctl, 0, sizeof(hash_ctl));
+        hash_ctl.keysize = MAXPGPATH;
+        hash_ctl.entrysize = sizeof(PisaSegmentSetCacheEntry);
+        hash_ctl.hcxt = TopMemoryContext;
+
+        PisaSegmentSetCache = hash_create("PISA Segment Sets", 16, &hash_ctl,
+                                          HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+    }
+
+    entry = (PisaSegmentSetCacheEntry *) hash_search(PisaSegmentSetCache, index_path,
+                                                     HASH_ENTER, &found);
+    if (!found)
+        entry->set = NULL;
+
+    if (entry->set != NULL)
+    {
+        set = entry->set;
+        if (set->file_inode == (uint64) file_stat.st_ino &&
+            set->file_mtime == (int64) file_stat.st_mtime)
+        {
+            set->refcount++;
+            return set;
+        }
+
+        set->stale = true;
+        entry->set = NULL;
+        if (set->refcount == 0)
+            FreePisaSegmentSet(set);
+    }
+
+    set = LoadPisaSegmentSet(index_path, TopMemoryContext);
+    if (set == NULL)
+        return NULL;
+
+    entry->set = set;
+    set->refcount++;
+
+    return set;
+}
+
+
+void
+ReleasePisaSegmentSet(PisaSegmentSet *set)
+{
+    if (set == NULL)
+        return;
+
+    Assert(set->refcount > 0);
+    set->refcount--;
+
+    if (set->stale && set->refcount == 0)
+        FreePisaSegmentSet(set);
+}
+
+
+/*
+ * Dictionary statistics of a term over all segments, with the upper
+ * bound under the idf of the whole index. Returns false when no segment
+ * contains the term.
+ */
+bool
+PisaSegmentSetTermStatistics(PisaSegmentSet *set, const char *term, int term_length,
+                             PisaSegmentTermStatistics *statistics)
+{
+    double *max_scores = (double *) palloc(set->num_segments * sizeof(double));
+    double *idfs = (double *) palloc(set->num_segments * sizeof(double));
+    double idf;
+    int found = 0;
+    uint32 i;
+
+    memset(statistics, 0, sizeof(PisaSegmentTermStatistics));
+
+    for (i = 0; i < set->num_segments; i++)
+    {
+        char segment_path[MAXPGPATH];
+        char *index_file;
+        PisaIndexReader *reader;
+        const PisaTermEntry *entry;
+
+        GetPisaSegmentPath(set->index_path, set->segments[i].segment_id, segment_path);
+        index_file = GetPisaIndexFilePath(segment_path);
+        reader = OpenPisaIndexReader(index_file);
+        pfree(index_file);
+
+        if (reader == NULL)
+            continue;
+
+        entry = PisaIndexLookupTerm(reader, term, term_length);
+        if (entry != NULL)
+        {
+            statistics->doc_freq += entry->doc_freq;
+            statistics->num_blocks += entry->num_blocks;
+            max_scores[found] = entry->max_score;
+            idfs[found] = PisaBm25Idf(reader->header->num_docs, entry->doc_freq);
+            found++;
+        }
+
+        ReleasePisaIndexReader(reader);
+    }
+
+    idf = PisaBm25Idf((uint32) Min(set->num_docs, PG_UINT32_MAX),
+                      (uint32) Min(statistics->doc_freq, set->num_docs));
+    for (i = 0; i < (uint32) found; i++)
+        statistics->max_score = Max(statistics->max_score, max_scores[i] * idf / idfs[i]);
+
+    pfree(max_scores);
+    pfree(idfs);
+
+    return found > 0;
+}
+
+
+/*
+ * Opens a cursor over the postings of 'term' in all segments, positioned
+ * on its first live posting. Returns NULL when no segment contains the
+ * term. The cursor holds a reference on the segment set.
+ */
+PisaSegmentCursor *
+OpenPisaSegmentCursor(PisaSegmentSet *set, const char *term, int term_length)
+{
+    PisaSegmentCursor *cursor;
+    PisaIndexReader **readers;
+    const PisaTermEntry **entries;
+    uint64 doc_freq = 0;
+    double idf;
+    uint32 i;
+    int count = 0;
+
+    readers = (PisaIndexReader **) PisaMemoryAlloc(set->num_segments *
+                                                   sizeof(PisaIndexReader *));
+    entries = (const PisaTermEntry **) PisaMemoryAlloc(set->num_segments *
+                                                       sizeof(PisaTermEntry *));
+
+    cursor = (PisaSegmentCursor *) PisaMemoryAllocZero(sizeof(PisaSegmentCursor));
+    cursor->lists = (PisaPostingCursor **) PisaMemoryAlloc(set->num_segments *
+                                                           sizeof(PisaPostingCursor *));
+    cursor->first_docids = (uint32 *) PisaMemoryAlloc(set->num_segments * sizeof(uint32));
+    cursor->bound_scales = (double *) PisaMemoryAlloc(set->num_segments * sizeof(double));
+
+    for (i = 0; i < set->num_segments; i++)
+    {
+        PisaSegmentEntry *segment = &set->segments[i];
+        char segment_path[MAXPGPATH];
+        char *index_file;
+        PisaIndexReader *reader;
+        const PisaTermEntry *entry;
+
+        GetPisaSegmentPath(set->index_path, segment->segment_id, segment_path);
+        index_file = GetPisaIndexFilePath(segment_path);
+        reader = OpenPisaIndexReader(index_file);
+        pfree(index_file);
+
+        if (reader == NULL)
+            continue;
+
+        /* A base rebuilt under an older segments file is skipped until reset */
+        if (reader->header->num_docs != segment->num_docs)
+        {
+            elog(DEBUG1, "PISA segment %s does not match the segments file of %s",
+                 segment_path, set->index_path);
+            ReleasePisaIndexReader(reader);
+            continue;
+        }
+
+        entry = PisaIndexLookupTerm(reader, term, term_length);
+        if (entry == NULL)
+        {
+            ReleasePisaIndexReader(reader);
+            continue;
+        }
+
+        readers[count] = reader;
+        entries[count] = entry;
+        cursor->first_docids[count] = segment->first_docid;
+        doc_freq += entry->doc_freq;
+        count++;
+    }
+
+    if (count == 0)
+    {
+        PisaMemoryFree(readers);
+        PisaMemoryFree(entries);
+        PisaMemoryFree(cursor->lists);
+        PisaMemoryFree(cursor->first_docids);
+        PisaMemoryFree(cursor->bound_scales);
+        PisaMemoryFree(cursor);
+        return NULL;
+    }
+
+    idf = PisaBm25Idf((uint32) Min(set->num_docs, PG_UINT32_MAX),
+                      (uint32) Min(doc_freq, set->num_docs));
+
+    for (i = 0; i < (uint32) count; i++)
+    {
+        PisaPostingCursor *list = OpenPisaPostingCursor(readers[i], entries[i]);
+
+        cursor->bound_scales[i] = idf / list->idf;
+        cursor->max_score = Max(cursor->max_score,
+                                entries[i]->max_score * cursor->bound_scales[i]);
+        list->idf = idf;
+        cursor->lists[i] = list;
+
+        ReleasePisaIndexReader(readers[i]);
+    }
+
+    PisaMemoryFree(readers);
+    PisaMemoryFree(entries);
+
+    cursor->segments = set;
+    set->refcount++;
+    cursor->num_lists = count;
+    cursor->current = 0;
+    cursor->shallow = 0;
+    SettlePisaSegmentCursor(cursor);
+
+    return cursor;
+}
+
+
+void
+ClosePisaSegmentCursor(PisaSegmentCursor *cursor)
+{
+    int i;
+
+    if (cursor == NULL)
+        return;
+
+    for (i = 0; i < cursor->num_lists; i++)
+        ClosePisaPostingCursor(cursor->lists[i]);
+
+    ReleasePisaSegmentSet(cursor->segments);
+    PisaMemoryFree(cursor->lists);
+    PisaMemoryFree(cursor->first_docids);
+    PisaMemoryFree(cursor->bound_scales);
+    PisaMemoryFree(cursor);
+}
+
+
+void
+PisaSegmentCursorNext(PisaSegmentCursor *cursor)
+{
+    if (cursor->current >= cursor->num_lists)
+        return;
+
+    PisaPostingCursorNext(cursor->lists[cursor->current]);
+    SettlePisaSegmentCursor(cursor);
+}
+
+
+/*
+ * Moves the cursor to the first live posting with global docid >= target.
+ * Segments that end before the target are skipped without being read.
+ */
+void
+PisaSegmentCursorNextGeq(PisaSegmentCursor *cursor, uint32 target)
+{
+    uint32 first_docid;
+
+    if (cursor->docid >= target)
+        return;
+
+    while (cursor->current + 1 < cursor->num_lists &&
+           cursor->first_docids[cursor->current + 1] <= target)
+        cursor->current++;
+
+    first_docid = cursor->first_docids[cursor->current];
+    PisaPostingCursorNextGeq(cursor->lists[cursor->current],
+                             target > first_docid ? target - first_docid : 0);
+    SettlePisaSegmentCursor(cursor);
+}
+
+
+double
+PisaSegmentCursorScore(PisaSegmentCursor *cursor)
+{
+    if (cursor->current >= cursor->num_lists)
+        return 0.0;
+
+    return PisaPostingCursorScore(cursor->lists[cursor->current]);
+}
+
+
+/*
+ * Moves the block-max pointer to the block that may contain the target.
+ * When the target lies past the last block of a segment, the pointer
+ * moves on to the first block of the next segment: no posting of the
+ * term lies in between.
+ */
+void
+PisaSegmentCursorShallowNextGeq(PisaSegmentCursor *cursor, uint32 target)
+{
+    int list = Max(cursor->shallow, cursor->current);
+
+    if (list >= cursor->num_lists)
+    {
+        cursor->shallow = list;
+        return;
+    }
+
+    while (list + 1 < cursor->num_lists && cursor->first_docids[list + 1] <= target)
+        list++;
+
+    while (true)
+    {
+        uint32 first_docid = cursor->first_docids[list];
+
+        PisaPostingCursorShallowNextGeq(cursor->lists[list],
+                                        target > first_docid ? target - first_docid : 0);
+
+        if (PisaPostingCursorBlockLastDocId(cursor->lists[list]) != PISA_POSTING_END ||
+            list + 1 == cursor->num_lists)
+            break;
+
+        list++;
+    }
+
+    cursor->shallow = list;
+}
+
+
+double
+PisaSegmentCursorBlockMaxScore(PisaSegmentCursor *cursor)
+{
+    if (cursor->shallow >= cursor->num_lists)
+        return 0.0;
+
+    return PisaPostingCursorBlockMaxScore(cursor->lists[cursor->shallow]) *
+           cursor->bound_scales[cursor->shallow];
+}
+
+
+uint32
+PisaSegmentCursorBlockLastDocId(PisaSegmentCursor *cursor)
+{
+    uint32 last_docid;
+
+    if (cursor->shallow >= cursor->num_lists)
+        return PISA_POSTING_END;
+
+    last_docid = PisaPostingCursorBlockLastDocId(cursor->lists[cursor->shallow]);
+    if (last_docid == PISA_POSTING_END)
+        return PISA_POSTING_END;
+
+    return cursor->first_docids[cursor->shallow] + last_docid;
+}
+
+
+static PisaSegmentSet *
+LoadPisaSegmentSet(const char *index_path, MemoryContext context)
+{
+    PisaSegmentsFileHeader header;
+    PisaSegmentSet *set;
+    MemoryContext old_context;
+    char path[MAXPGPATH];
+    struct stat file_stat;
+    uint32 words;
+    uint32 i;
+    FILE *file;
+
+    snprintf(path, MAXPGPATH, "%s%s", index_path, PISA_SEGMENTS_FILE_SUFFIX);
+
+    file = AllocateFile(path, PG_BINARY_R);
+    if (file == NULL)
+    {
+        PisaIndexReader *reader;
+        char *index_file;
+
+        if (errno != ENOENT)
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not open PISA segments file \"%s\": %m", path)));
+        }
+
+        index_file = GetPisaIndexFilePath(index_path);
+        reader = OpenPisaIndexReader(index_file);
+        pfree(index_file);
+
+        if (reader == NULL)
+            return NULL;
+
+        old_context = MemoryContextSwitchTo(context);
+        set = CreateBasePisaSegmentSet(index_path, reader->header->num_docs);
+        set->identifier = reader->file_inode;
+        set->file_inode = reader->file_inode;
+        set->file_mtime = reader->file_mtime;
+        MemoryContextSwitchTo(old_context);
+
+        ReleasePisaIndexReader(reader);
+        return set;
+    }
+
+    if (fstat(fileno(file), &file_stat) < 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not stat PISA segments file \"%s\": %m", path)));
+    }
+
+    ReadPisaSegmentsBytes(file, path, &header, sizeof(header));
+    if (memcmp(header.magic, PISA_SEGMENTS_MAGIC, sizeof(PISA_SEGMENTS_MAGIC)) != 0 ||
+        header.version != PISA_SEGMENTS_VERSION)
+    {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("\"%s\" is not a PISA segments file of version %d",
+                               path, PISA_SEGMENTS_VERSION)));
+    }
+
+    old_context = MemoryContextSwitchTo(context);
+
+    words = (header.next_docid + 63) / 64;
+    set = (PisaSegmentSet *) palloc0(sizeof(PisaSegmentSet));
+    strlcpy(set->index_path, index_path, MAXPGPATH);
+    set->num_segments = header.num_segments;
+    set->max_segments = Max(header.num_segments, 4);
+    set->next_segment_id = header.next_segment_id;
+    set->next_docid = header.next_docid;
+    set->identifier = header.identifier;
+    set->generation = header.generation;
+    set->num_deleted = header.num_deleted;
+    set->segments = (PisaSegmentEntry *) palloc(set->max_segments *
+                                                sizeof(PisaSegmentEntry));
+    set->deleted_words = words;
+    set->deleted = (uint64 *) palloc_extended(Max(words, 1) * sizeof(uint64),
+                                              MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    set->file_inode = (uint64) file_stat.st_ino;
+    set->file_mtime = (int64) file_stat.st_mtime;
+
+    MemoryContextSwitchTo(old_context);
+
+    ReadPisaSegmentsBytes(file, path, set->segments,
+                          header.num_segments * sizeof(PisaSegmentEntry));
+    ReadPisaSegmentsBytes(file, path, set->deleted, words * sizeof(uint64));
+    FreeFile(file);
+
+    for (i = 0; i < set->num_segments; i++)
+    {
+        PisaSegmentEntry *segment = &set->segments[i];
+
+        if ((uint64) segment->first_docid + segment->num_docs > set->next_docid ||
+            (i > 0 && segment->first_docid < set->segments[i - 1].first_docid +
+                                             set->segments[i - 1].num_docs) ||
+            segment->num_deleted > segment->num_docs)
+        {
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("PISA segments file \"%s\" is corrupted", path)));
+        }
+
+        set->num_docs += segment->num_docs;
+    }
+
+    return set;
+}
+
+
+static PisaSegmentSet *
+CreateBasePisaSegmentSet(const char *index_path, uint32 base_docs)
+{
+    PisaSegmentSet *set;
+
+    set = (PisaSegmentSet *) palloc0(sizeof(PisaSegmentSet));
+    strlcpy(set->index_path, index_path, MAXPGPATH);
+    set->max_segments = 4;
+    set->segments = (PisaSegmentEntry *) palloc(set->max_segments *
+                                                sizeof(PisaSegmentEntry));
+    set->next_segment_id = PISA_BASE_SEGMENT_ID + 1;
+    set->identifier = (uint64) GetCurrentTimestamp();
+
+    PisaSegmentSetAddSegment(set, PISA_BASE_SEGMENT_ID, base_docs);
+
+    return set;
+}
+
+
+static void
+ReadPisaSegmentsBytes(FILE *file, const char *path, void *data, size_t length)
+{
+    if (length > 0 && fread(data, 1, length, file) != length)
+    {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("PISA segments file \"%s\" is truncated", path)));
+    }
+}
+
+
+static void
+GrowPisaDeletedBitmap(PisaSegmentSet *set)
+{
+    uint32 words = (set->next_docid + 63) / 64;
+
+    if (words <= set->deleted_words)
+        return;
+
+    if (set->deleted == NULL)
+    {
+        set->deleted = (uint64 *) palloc_extended(words * sizeof(uint64),
+                                                  MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    }
+    else
+    {
+        set->deleted = (uint64 *) repalloc_huge(set->deleted, words * sizeof(uint64));
+        memset(set->deleted + set->deleted_words, 0,
+               (words - set->deleted_words) * sizeof(uint64));
+    }
+    set->deleted_words = words;
+}
+
+
+/* Segment owning a global docid, -1 when it falls in a gap */
+static int
+FindPisaSegment(PisaSegmentSet *set, uint32 docid)
+{
+    int low = 0;
+    int high = (int) set->num_segments - 1;
+
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+        PisaSegmentEntry *segment = &set->segments[middle];
+
+        if (docid < segment->first_docid)
+            high = middle - 1;
+        else if (docid >= segment->first_docid + segment->num_docs)
+            low = middle + 1;
+        else
+            return middle;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Positions the cursor on the live posting under the current list,
+ * moving to the next list when one is exhausted and over deleted
+ * documents.
+ */
+static void
+SettlePisaSegmentCursor(PisaSegmentCursor *cursor)
+{
+    while (cursor->current < cursor->num_lists)
+    {
+        PisaPostingCursor *list = cursor->lists[cursor->current];
+        uint32 local_docid = PisaPostingCursorDocId(list);
+        uint32 docid;
+
+        if (local_docid == PISA_POSTING_END)
+        {
+            cursor->current++;
+            continue;
+        }
+
+        docid = cursor->first_docids[cursor->current] + local_docid;
+        if (PisaSegmentSetIsDeleted(cursor->segments, docid))
+        {
+            PisaPostingCursorNext(list);
+            continue;
+        }
+
+        cursor->docid = docid;
+        return;
+    }
+
+    cursor->docid = PISA_POSTING_END;
+}
+
+
+/*
+ * Writes a segment index in which every posting has frequency 1.
+ */
+static void
+WritePisaTestSegment(const char *segment_path, uint32 num_docs, const char **terms,
+                     const uint32 **docids, const uint32 *counts, int num_terms)
+{
+    PisaIndexWriter *writer;
+    uint32 *doc_lengths = (uint32 *) palloc(num_docs * sizeof(uint32));
+    uint32 freqs[PISA_BLOCK_SIZE];
+    uint32 i;
+    int t;
+
+    for (i = 0; i < num_docs; i++)
+        doc_lengths[i] = 10;
+    for (i = 0; i < PISA_BLOCK_SIZE; i++)
+        freqs[i] = 1;
+
+    writer = BeginPisaIndexWriter(GetPisaIndexFilePath(segment_path),
+                                  PISA_COMPRESSION_BLOCK_SIMDBP, num_docs, doc_lengths);
+    for (t = 0; t < num_terms; t++)
+        PisaIndexWriterAddTerm(writer, terms[t], strlen(terms[t]), docids[t], freqs, counts[t]);
+    FinishPisaIndexWriter(writer);
+
+    pfree(doc_lengths);
+}
+
+
+/*
+ * Returns a row per term with the live documents of the index and the
+ * global docids the segment cursor walks for the term.
+ */
+static void
+PutPisaTestSegmentPostings(Tuplestorestate *tupstore, TupleDesc tupdesc,
+                           const char *index_path, const char *stage)
+{
+    static const char *terms[] = { "apple", "kiwi", "pear" };
+    PisaSegmentSet *set = OpenPisaSegmentSet(index_path);
+    int t;
+
+    for (t = 0; t < lengthof(terms); t++)
+    {
+        PisaSegmentCursor *cursor = OpenPisaSegmentCursor(set, terms[t], strlen(terms[t]));
+        Datum docids[16];
+        int count = 0;
+        Datum values[4];
+        bool nulls[4] = { false, false, false, false };
+
+        while (cursor != NULL && cursor->docid != PISA_POSTING_END && count < lengthof(docids))
+        {
+            docids[count++] = Int32GetDatum((int32) cursor->docid);
+            PisaSegmentCursorNext(cursor);
+        }
+        if (cursor != NULL)
+            ClosePisaSegmentCursor(cursor);
+
+        values[0] = CStringGetTextDatum(stage);
+        values[1] = Int64GetDatum((int64) PisaSegmentSetLiveDocs(set));
+        values[2] = CStringGetTextDatum(terms[t]);
+        values[3] = PointerGetDatum(construct_array(docids, count, INT4OID, sizeof(int32),
+                                                    true, TYPALIGN_INT));
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    ReleasePisaSegmentSet(set);
+}
+
+
+/*
+ * Test helper: writes a base index, adds a delta segment and then deletes
+ * documents of both, and returns the postings the segment cursor walks
+ * after each step.
+ */
+Datum
+documentdb_pisa_segments_for_test(PG_FUNCTION_ARGS)
+{
+    static const char *base_terms[] = { "apple", "pear" };
+    static const uint32 base_apple[] = { 0, 2, 3, 5 };
+    static const uint32 base_pear[] = { 1, 4 };
+    static const uint32 base_counts[] = { 4, 2 };
+    static const char *delta_terms[] = { "apple", "kiwi" };
+    static const uint32 delta_apple[] = { 0, 2 };
+    static const uint32 delta_kiwi[] = { 1 };
+    static const uint32 delta_counts[] = { 2, 1 };
+    static const uint32 deleted_docids[] = { 1, 2, 4, 7 };
+    const uint32 *base_docids[] = { base_apple, base_pear };
+    const uint32 *delta_docids[] = { delta_apple, delta_kiwi };
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    char *directory;
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    directory = CreatePisaTestDirectory("segments");
+    PG_TRY();
+    {
+        char *index_path = psprintf("%s/unit_segments", directory);
+        char segment_path[MAXPGPATH];
+        PisaSegmentSet *set;
+        uint32 segment_id;
+        int i;
+
+        /* An index without a segments file is its base segment */
+        WritePisaTestSegment(index_path, 6, base_terms, base_docids, base_counts,
+                             lengthof(base_terms));
+        PutPisaTestSegmentPostings(tupstore, tupdesc, index_path, "base");
+
+        /* The delta segment takes the docids after those of the base */
+        set = ReadPisaSegmentSet(index_path);
+        segment_id = set->next_segment_id;
+        GetPisaSegmentPath(index_path, segment_id, segment_path);
+        WritePisaTestSegment(segment_path, 3, delta_terms, delta_docids, delta_counts,
+                             lengthof(delta_terms));
+        PisaSegmentSetAddSegment(set, segment_id, 3);
+        WritePisaSegmentSet(set);
+        FreePisaSegmentSet(set);
+        PutPisaTestSegmentPostings(tupstore, tupdesc, index_path, "delta");
+
+        /* Deleted documents are skipped in every segment */
+        set = ReadPisaSegmentSet(index_path);
+        for (i = 0; i < lengthof(deleted_docids); i++)
+            PisaSegmentSetMarkDeleted(set, deleted_docids[i]);
+        WritePisaSegmentSet(set);
+        FreePisaSegmentSet(set);
+        PutPisaTestSegmentPostings(tupstore, tupdesc, index_path, "tombstones");
+    }
+    PG_FINALLY();
+    {
+        RemovePisaTestDirectory(directory);
+    }
+    PG_END_TRY();
+
+    PG_RETURN_VOID();
+}
@@ -1,17 +1,99 @@
 #include "postgres.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "fmgr.h"
+#include "access/xact.h"
+#include "common/hashfn.h"
+#include "common/string.h"
 #include "utils/memutils.h"
 #include "utils/hsearch.h"
+#include "storage/fd.h"
 #include "storage/lwlock.h"
 #include "storage/shmem.h"
 #include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
 #include "storage/ipc.h"
 #include "miscadmin.h"
 #include "utils/guc.h"
 #include "utils/timestamp.h"
+#include "portability/instr_time.h"
 
+#include "pisa_integration/data_bridge.h"
+#include "pisa_integration/document_reordering.h"
+#include "pisa_integration/forward_index.h"
+#include "pisa_integration/index_segments.h"
 #include "pisa_integration/index_sync.h"
 #include "pisa_integration/pisa_integration.h"
+#include "pisa_integration/query_cache.h"
+
+/* Change log taken over by a flush; left behind if the flush fails */
+#define PISA_CHANGES_FLUSHING_SUFFIX ".changes.flushing"
+
+/*
+ * Merge policy: once more than a fifth of the documents are deleted, or
+ * the delta segments hold as many documents as half the base, all
+ * segments are merged into a new base; otherwise the delta segments are
+ * merged together once there are PISA_SYNC_MAX_DELTA_SEGMENTS of them.
+ */
+#define PISA_SYNC_MAX_DELTA_SEGMENTS 8
+#define PISA_SYNC_MAX_DELETED_FRACTION 0.2
+#define PISA_SYNC_MAX_DELTA_FRACTION 0.5
+
+#define PISA_SYNC_INTERVAL_MS 30000L
+
+/* Document id slice, hashed without being copied */
+typedef struct PisaDocIdKey
+{
+    const char *data;
+    uint32 length;
+} PisaDocIdKey;
+
+/* Latest change of a document in the change log being applied */
+typedef struct PisaDocumentChange
+{
+    PisaDocIdKey key;           /* hash key */
+    PisaDocumentOperation operation;
+    off_t document_offset;
+    uint32 document_length;
+} PisaDocumentChange;
+
+typedef struct PisaDocumentLocation
+{
+    PisaDocIdKey key;           /* hash key */
+    uint32 docid;
+} PisaDocumentLocation;
+
+/*
+ * Global docid of every live document of an index, by document id, so
+ * that changes can delete the previous version of a document. Built from
+ * the document maps of the segments and kept up to date by the flushes
+ * of this process; rebuilt whenever the segments file was changed by
+ * anything else.
+ */
+typedef struct PisaDocumentLocator
+{
+    char index_path[MAXPGPATH]; /* hash key */
+    bool valid;
+    uint64 identifier;
+    uint64 generation;
+    MemoryContext context;
+    HTAB *documents;
+} PisaDocumentLocator;
+
+typedef struct PisaObsoleteSegment
+{
+    char index_path[MAXPGPATH];
+    uint32 segment_id;
+} PisaObsoleteSegment;
+
+/* Change log records of the current transaction for one index */
+typedef struct PisaTransactionChanges
+{
+    char index_path[MAXPGPATH];
+    StringInfoData records;
+} PisaTransactionChanges;
 
 HTAB *pisa_sync_hash = NULL;
 LWLock *pisa_sync_lock = NULL;
@@ -19,6 +101,31 @@ LWLock *pisa_sync_lock = NULL;
 static bool index_sync_initialized = false;
 static int max_sync_entries = 1000;
 
+/* Lives in TopTransactionContext */
+static List *TransactionChanges = NIL;
+static bool transaction_callback_registered = false;
+
+static HTAB *PisaDocumentLocators = NULL;
+
+/* Segments merged away by the sync worker, removed one cycle later */
+static List *ObsoleteSegments = NIL;
+
+static void GetPisaSyncIndexPath(const char *database_name, const char *collection_name,
+                                 char *index_path);
+static void PisaIndexSyncTransactionCallback(XactEvent event, void *arg);
+static void WriteTransactionChanges(void);
+static uint64 ApplyPisaChangeLog(const char *index_path, const char *log_path);
+static PisaDocumentLocator *GetPisaDocumentLocator(PisaSegmentSet *set);
+static void AddPisaDocumentLocation(PisaDocumentLocator *locator, const char *doc_id,
+                                    uint32 length, uint32 docid);
+static void MergePisaSegmentRange(PisaSegmentSet *set, int first, int last);
+static List *ListPisaIndexFiles(const char *suffix);
+static void RunPisaIndexSyncCycle(void);
+static void ReadPisaChangeBytes(FILE *file, const char *path, void *data, size_t length);
+static uint32 PisaDocIdHash(const void *key, Size keysize);
+static int PisaDocIdMatch(const void *key1, const void *key2, Size keysize);
+static int ComparePisaDocumentChanges(const void *left, const void *right);
+
 void
 InitializePisaIndexSync(void)
 {
@@ -78,7 +185,12 @@ RegisterDocumentChange(const char *database_name, const char *collection_name,
                       const pgbson *document)
 {
     char sync_key[NAMEDATALEN * 2];
+    char index_path[MAXPGPATH];
     PisaIndexSyncEntry *sync_entry;
+    PisaTransactionChanges *changes = NULL;
+    PisaChangeRecordHeader header;
+    MemoryContext old_context;
+    ListCell *cell;
     bool found;
 
     if (!index_sync_initialized)
@@ -113,13 +225,60 @@ RegisterDocumentChange(const char *database_name, const char *collection_name,
          database_name, collection_name, operation, sync_entry->pending_operations);
 
     LWLockRelease(pisa_sync_lock);
+
+    /* Queued for the change log, which only sees committed changes */
+    GetPisaSyncIndexPath(database_name, collection_name, index_path);
+
+    if (!transaction_callback_registered)
+    {
+        RegisterXactCallback(PisaIndexSyncTransactionCallback, NULL);
+        transaction_callback_registered = true;
+    }
+
+    foreach(cell, TransactionChanges)
+    {
+        PisaTransactionChanges *candidate = (PisaTransactionChanges *) lfirst(cell);
+
+        if (strcmp(candidate->index_path, index_path) == 0)
+        {
+            changes = candidate;
+            break;
+        }
+    }
+
+    old_context = MemoryContextSwitchTo(TopTransactionContext);
+    if (changes == NULL)
+    {
+        changes = (PisaTransactionChanges *) palloc(sizeof(PisaTransactionChanges));
+        strlcpy(changes->index_path, index_path, MAXPGPATH);
+        initStringInfo(&changes->records);
+        TransactionChanges = lappend(TransactionChanges, changes);
+    }
+
+    header.operation = (uint32) operation;
+    header.doc_id_length = (uint32) strlen(document_id);
+    header.document_length = operation != PISA_OP_DELETE && document != NULL ?
+                             PgbsonGetBsonSize(document) : 0;
+
+    appendBinaryStringInfo(&changes->records, (char *) &header, sizeof(header));
+    appendBinaryStringInfo(&changes->records, document_id, header.doc_id_length);
+    if (header.document_length > 0)
+        appendBinaryStringInfo(&changes->records, VARDATA_ANY(document),
+                               header.document_length);
+    MemoryContextSwitchTo(old_context);
 }
 
+/*
+ * Rebuilds the indexes scheduled for a full rebuild by this backend and
+ * applies the change log of every index as a new delta segment.
+ */
 void
 ProcessPendingIndexUpdates(void)
 {
     HASH_SEQ_STATUS seq_status;
     PisaIndexSyncEntry *sync_entry;
+    List *index_paths;
+    ListCell *cell;
 
     if (!index_sync_initialized)
         return;
@@ -160,9 +319,118 @@ ProcessPendingIndexUpdates(void)
 
     LWLockRelease(pisa_sync_lock);
 
+    /* A change log left behind by a failed flush is applied first */
+    index_paths = list_concat(ListPisaIndexFiles(PISA_CHANGES_FLUSHING_SUFFIX),
+                              ListPisaIndexFiles(PISA_CHANGES_FILE_SUFFIX));
+    foreach(cell, index_paths)
+        FlushPisaIndexChanges((char *) lfirst(cell));
+
+    list_free_deep(index_paths);
+
     elog(DEBUG1, "Completed processing pending PISA index updates");
 }
 
+
+/*
+ * Applies the change log of an index as a new delta segment: the latest
+ * version of every changed document is indexed in the segment and the
+ * previous versions are marked deleted. Returns the number of documents
+ * changed; 0 as well when another process is updating the segments.
+ */
+uint64
+FlushPisaIndexChanges(const char *index_path)
+{
+    char changes_path[MAXPGPATH];
+    char flushing_path[MAXPGPATH];
+    uint64 changed = 0;
+    int lock_fd;
+
+    lock_fd = LockPisaIndexSegments(index_path, false);
+    if (lock_fd < 0)
+        return 0;
+
+    PG_TRY();
+    {
+        snprintf(changes_path, MAXPGPATH, "%s%s", index_path, PISA_CHANGES_FILE_SUFFIX);
+        snprintf(flushing_path, MAXPGPATH, "%s%s", index_path,
+                 PISA_CHANGES_FLUSHING_SUFFIX);
+
+        if (access(flushing_path, F_OK) == 0)
+            changed += ApplyPisaChangeLog(index_path, flushing_path);
+
+        /* Commits append to a new log while this one is applied */
+        LWLockAcquire(pisa_sync_lock, LW_EXCLUSIVE);
+        if (access(changes_path, F_OK) == 0)
+        {
+            durable_rename(changes_path, flushing_path, ERROR);
+            LWLockRelease(pisa_sync_lock);
+
+            changed += ApplyPisaChangeLog(index_path, flushing_path);
+        }
+        else
+        {
+            LWLockRelease(pisa_sync_lock);
+        }
+    }
+    PG_FINALLY();
+    {
+        UnlockPisaIndexSegments(lock_fd);
+    }
+    PG_END_TRY();
+
+    return changed;
+}
+
+
+/*
+ * Merges segments of an index according to the merge policy. Returns
+ * whether segments were merged.
+ */
+bool
+MergePisaIndexSegments(const char *index_path)
+{
+    bool merged = false;
+    int lock_fd;
+
+    lock_fd = LockPisaIndexSegments(index_path, false);
+    if (lock_fd < 0)
+        return false;
+
+    PG_TRY();
+    {
+        PisaSegmentSet *set = ReadPisaSegmentSet(index_path);
+        int last;
+
+        if (set != NULL && set->num_segments > 0)
+        {
+            uint64 delta_docs = set->num_docs - set->segments[0].num_docs;
+
+            last = (int) set->num_segments - 1;
+            if (set->num_deleted > PISA_SYNC_MAX_DELETED_FRACTION * set->num_docs ||
+                (last > 0 &&
+                 delta_docs >= PISA_SYNC_MAX_DELTA_FRACTION * set->segments[0].num_docs))
+            {
+                MergePisaSegmentRange(set, 0, last);
+                merged = true;
+            }
+            else if (last >= PISA_SYNC_MAX_DELTA_SEGMENTS)
+            {
+                MergePisaSegmentRange(set, 1, last);
+                merged = true;
+            }
+        }
+
+        FreePisaSegmentSet(set);
+    }
+    PG_FINALLY();
+    {
+        UnlockPisaIndexSegments(lock_fd);
+    }
+    PG_END_TRY();
+
+    return merged;
+}
+
 void
 ScheduleIndexRebuild(const char *database_name, const char *collection_name)
 {
@@ -287,20 +555,33 @@ DisableIndexSync(const char *database_name, const char *collection_name)
     LWLockRelease(pisa_sync_lock);
 }
 
+/*
+ * Background worker applying the change logs of all indexes every
+ * PISA_SYNC_INTERVAL_MS and merging their segments.
+ */
 void
 PisaIndexSyncWorkerMain(Datum main_arg)
 {
+    MemoryContext cycle_context;
+
     elog(LOG, "Starting PISA index sync background worker");
 
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
     BackgroundWorkerUnblockSignals();
 
-    while (!got_SIGTERM)
+    InitializePisaIndexSync();
+
+    cycle_context = AllocSetContextCreate(TopMemoryContext, "PISA Index Sync Cycle",
+                                          ALLOCSET_DEFAULT_SIZES);
+
+    while (!ShutdownRequestPending)
     {
         int rc;
 
         rc = WaitLatch(MyLatch,
                       WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-                      30000L,
+                      PISA_SYNC_INTERVAL_MS,
                       PG_WAIT_EXTENSION);
 
         ResetLatch(MyLatch);
@@ -308,10 +589,32 @@ PisaIndexSyncWorkerMain(Datum main_arg)
         if (rc & WL_POSTMASTER_DEATH)
             proc_exit(1);
 
-        if (got_SIGTERM)
+        if (ShutdownRequestPending)
             break;
 
-        ProcessPendingIndexUpdates();
+        if (ConfigReloadPending)
+        {
+            ConfigReloadPending = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+
+        MemoryContextSwitchTo(cycle_context);
+        PG_TRY();
+        {
+            RunPisaIndexSyncCycle();
+        }
+        PG_CATCH();
+        {
+            /* Whatever was not applied is retried in the next cycle */
+            EmitErrorReport();
+            FlushErrorState();
+            LWLockReleaseAll();
+            AtEOXact_Files(false);
+        }
+        PG_END_TRY();
+
+        MemoryContextSwitchTo(TopMemoryContext);
+        MemoryContextReset(cycle_context);
     }
 
     elog(LOG, "PISA index sync background worker shutting down");
@@ -338,3 +641,721 @@ StartPisaIndexSyncWorker(void)
 
     elog(LOG, "Registered PISA index sync background worker");
 }
+
+
+static void
+GetPisaSyncIndexPath(const char *database_name, const char *collection_name,
+                     char *index_path)
+{
+    snprintf(index_path, MAXPGPATH, "%s/%s_%s",
+             pisa_index_base_path, database_name, collection_name);
+}
+
+
+static void
+PisaIndexSyncTransactionCallback(XactEvent event, void *arg)
+{
+    switch (event)
+    {
+        case XACT_EVENT_PRE_COMMIT:
+        {
+            WriteTransactionChanges();
+            break;
+        }
+
+        case XACT_EVENT_COMMIT:
+        case XACT_EVENT_PARALLEL_COMMIT:
+        {
+            ListCell *cell;
+
+            /* Cached results may depend on the documents this transaction changed */
+            foreach(cell, TransactionChanges)
+            {
+                PisaTransactionChanges *changes = (PisaTransactionChanges *) lfirst(cell);
+
+                InvalidatePisaQueryCacheForIndex(changes->index_path);
+            }
+
+            TransactionChanges = NIL;
+            break;
+        }
+
+        case XACT_EVENT_ABORT:
+        case XACT_EVENT_PARALLEL_ABORT:
+        case XACT_EVENT_PREPARE:
+        {
+            /* The records went away with TopTransactionContext */
+            TransactionChanges = NIL;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+
+/*
+ * Appends the changes of the committing transaction to the change logs.
+ * This happens before the commit record is written, so a failure aborts
+ * the transaction instead of losing its changes; writers of the same
+ * document still hold their row locks here, so their changes reach the
+ * log in commit order.
+ */
+static void
+WriteTransactionChanges(void)
+{
+    ListCell *cell;
+
+    if (TransactionChanges == NIL)
+        return;
+
+    LWLockAcquire(pisa_sync_lock, LW_EXCLUSIVE);
+
+    foreach(cell, TransactionChanges)
+    {
+        PisaTransactionChanges *changes = (PisaTransactionChanges *) lfirst(cell);
+        char path[MAXPGPATH];
+        off_t log_size;
+        int fd;
+
+        if (changes->records.len == 0)
+            continue;
+
+        snprintf(path, MAXPGPATH, "%s%s", changes->index_path, PISA_CHANGES_FILE_SUFFIX);
+
+        fd = OpenTransientFile(path, O_WRONLY | O_APPEND | O_CREAT | PG_BINARY);
+        if (fd < 0)
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not open PISA change log \"%s\": %m", path)));
+        }
+
+        log_size = lseek(fd, 0, SEEK_END);
+        errno = 0;
+        if (write(fd, changes->records.data, changes->records.len) != changes->records.len ||
+            pg_fsync(fd) != 0)
+        {
+            int save_errno = errno ? errno : ENOSPC;
+
+            /* Never leave a partial record in front of the next ones */
+            if (log_size >= 0 && ftruncate(fd, log_size) != 0)
+            {
+                ereport(WARNING, (errcode_for_file_access(),
+                                  errmsg("could not truncate PISA change log \"%s\": %m",
+                                         path)));
+            }
+
+            errno = save_errno;
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not write PISA change log \"%s\": %m", path)));
+        }
+
+        CloseTransientFile(fd);
+    }
+
+    LWLockRelease(pisa_sync_lock);
+}
+
+
+/*
+ * Applies one change log file to the index; the caller holds the
+ * segments lock. The log is read twice: once to find the latest change
+ * of every document, once to read the documents that are indexed.
+ */
+static uint64
+ApplyPisaChangeLog(const char *index_path, const char *log_path)
+{
+    PisaSegmentSet *set;
+    PisaDocumentLocator *locator;
+    PisaForwardIndexWriter *writer;
+    PisaDocumentChange **ordered;
+    PisaDocumentChange *change;
+    HTAB *changes;
+    HASHCTL hash_ctl;
+    HASH_SEQ_STATUS status;
+    MemoryContext context;
+    MemoryContext old_context;
+    char segment_path[MAXPGPATH];
+    char forward_path[MAXPGPATH];
+    uint64 num_records = 0;
+    uint64 num_changes = 0;
+    uint64 num_deleted;
+    uint64 i;
+    uint32 segment_id;
+    uint32 num_docs;
+    off_t offset = 0;
+    FILE *file;
+    instr_time start_time;
+    instr_time duration;
+
+    set = ReadPisaSegmentSet(index_path);
+    if (set == NULL)
+    {
+        /* The index gets built from the collection, changes included */
+        elog(DEBUG1, "Discarding PISA change log %s of missing index", log_path);
+        durable_unlink(log_path, WARNING);
+        return 0;
+    }
+
+    INSTR_TIME_SET_CURRENT(start_time);
+
+    context = AllocSetContextCreate(CurrentMemoryContext, "PISA Change Log",
+                                    ALLOCSET_DEFAULT_SIZES);
+    old_context = MemoryContextSwitchTo(context);
+
+    memset(&hash_ctl, 0, sizeof(hash_ctl));
+    hash_ctl.keysize = sizeof(PisaDocIdKey);
+    hash_ctl.entrysize = sizeof(PisaDocumentChange);
+    hash_ctl.hash = PisaDocIdHash;
+    hash_ctl.match = PisaDocIdMatch;
+    hash_ctl.hcxt = context;
+    changes = hash_create("PISA Document Changes", 1024, &hash_ctl,
+                          HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+    file = AllocateFile(log_path, PG_BINARY_R);
+    if (file == NULL)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open PISA change log \"%s\": %m", log_path)));
+    }
+
+    while (true)
+    {
+        PisaChangeRecordHeader header;
+        PisaDocIdKey key;
+        size_t header_read;
+        char *doc_id;
+        bool found;
+
+        header_read = fread(&header, 1, sizeof(header), file);
+        if (header_read == 0 && feof(file))
+            break;
+
+        ReadPisaChangeBytes(file, log_path, (char *) &header + header_read,
+                            sizeof(header) - header_read);
+        if (header.operation > PISA_OP_DELETE)
+        {
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("PISA change log \"%s\" is corrupted", log_path)));
+        }
+
+        doc_id = (char *) palloc(header.doc_id_length + 1);
+        ReadPisaChangeBytes(file, log_path, doc_id, header.doc_id_length);
+        doc_id[header.doc_id_length] = '\0';
+        offset += sizeof(header) + header.doc_id_length;
+
+        key.data = doc_id;
+        key.length = header.doc_id_length;
+        change = (PisaDocumentChange *) hash_search(changes, &key, HASH_ENTER, &found);
+        if (found)
+        {
+            pfree(doc_id);
+        }
+        else
+        {
+            change->key.data = doc_id;
+            num_changes++;
+        }
+
+        change->operation = (PisaDocumentOperation) header.operation;
+        change->document_offset = offset;
+        change->document_length = header.document_length;
+
+        if (header.document_length > 0 &&
+            fseeko(file, header.document_length, SEEK_CUR) != 0)
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not seek in PISA change log \"%s\": %m",
+                                   log_path)));
+        }
+        offset += header.document_length;
+        num_records++;
+    }
+
+    /* Documents enter the segment in the order of their latest change */
+    ordered = (PisaDocumentChange **) palloc(Max(num_changes, 1) *
+                                             sizeof(PisaDocumentChange *));
+    i = 0;
+    hash_seq_init(&status, changes);
+    while ((change = (PisaDocumentChange *) hash_seq_search(&status)) != NULL)
+        ordered[i++] = change;
+    qsort(ordered, num_changes, sizeof(PisaDocumentChange *), ComparePisaDocumentChanges);
+
+    locator = GetPisaDocumentLocator(set);
+    locator->valid = false;     /* until the new segments file is written */
+    num_deleted = set->num_deleted;
+
+    segment_id = set->next_segment_id;
+    GetPisaSegmentPath(index_path, segment_id, segment_path);
+    snprintf(forward_path, MAXPGPATH, "%s%s", segment_path, PISA_FORWARD_FILE_SUFFIX);
+    writer = BeginPisaForwardIndexWriter(forward_path);
+
+    for (i = 0; i < num_changes; i++)
+    {
+        PisaDocumentLocation *location;
+        pgbson *document;
+
+        change = ordered[i];
+
+        location = (PisaDocumentLocation *) hash_search(locator->documents, &change->key,
+                                                        HASH_FIND, NULL);
+        if (location != NULL)
+        {
+            PisaSegmentSetMarkDeleted(set, location->docid);
+            hash_search(locator->documents, &change->key, HASH_REMOVE, NULL);
+        }
+
+        if (change->operation == PISA_OP_DELETE || change->document_length == 0)
+            continue;
+
+        document = (pgbson *) palloc(VARHDRSZ + change->document_length);
+        SET_VARSIZE(document, VARHDRSZ + change->document_length);
+        if (fseeko(file, change->document_offset, SEEK_SET) != 0)
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not seek in PISA change log \"%s\": %m",
+                                   log_path)));
+        }
+        ReadPisaChangeBytes(file, log_path, VARDATA(document), change->document_length);
+
+        AddBsonTextToPisaForwardIndex(writer, document);
+        PisaForwardIndexWriterEndDocument(writer, change->key.data);
+        AddPisaDocumentLocation(locator, change->key.data, change->key.length,
+                                set->next_docid + writer->num_docs - 1);
+
+        pfree(document);
+    }
+
+    FreeFile(file);
+
+    num_docs = writer->num_docs;
+    FinishPisaForwardIndexWriter(writer);
+
+    if (num_docs > 0)
+    {
+        PisaForwardIndex *forward_index = LoadPisaForwardIndex(forward_path);
+
+        WritePisaIndexFromForwardIndex(forward_index, NULL, segment_path,
+                                       (PisaCompressionType) pisa_default_compression);
+        FreePisaForwardIndex(forward_index);
+        PisaSegmentSetAddSegment(set, segment_id, num_docs);
+    }
+    else
+    {
+        RemovePisaSegmentFiles(index_path, segment_id);
+    }
+
+    set->generation++;
+    WritePisaSegmentSet(set);
+    locator->generation = set->generation;
+    locator->valid = true;
+
+    durable_unlink(log_path, ERROR);
+
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start_time);
+
+    elog(LOG, "Applied PISA change log of %s: " UINT64_FORMAT " changed documents ("
+         UINT64_FORMAT " changes), %u documents in delta segment %u, " UINT64_FORMAT
+         " documents deleted in %.1f ms", index_path, num_changes, num_records, num_docs,
+         segment_id, set->num_deleted - num_deleted, INSTR_TIME_GET_MILLISEC(duration));
+
+    MemoryContextSwitchTo(old_context);
+    MemoryContextDelete(context);
+    FreePisaSegmentSet(set);
+
+    return num_changes;
+}
+
+
+/*
+ * Returns the document locator of the index, rebuilt from the document
+ * maps of its segments unless it matches 'set'.
+ */
+static PisaDocumentLocator *
+GetPisaDocumentLocator(PisaSegmentSet *set)
+{
+    PisaDocumentLocator *locator;
+    StringInfoData line;
+    HASHCTL hash_ctl;
+    uint32 i;
+    bool found;
+
+    if (PisaDocumentLocators == NULL)
+    {
+        memset(&hash_ctl, 0, sizeof(hash_ctl));
+        hash_ctl.keysize = MAXPGPATH;
+        hash_ctl.entrysize = sizeof(PisaDocumentLocator);
+        hash_ctl.hcxt = TopMemoryContext;
+
+        PisaDocumentLocators = hash_create("PISA Document Locators", 16, &hash_ctl,
+                                           HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+    }
+
+    locator = (PisaDocumentLocator *) hash_search(PisaDocumentLocators, set->index_path,
+                                                  HASH_ENTER, &found);
+    if (!found)
+    {
+        locator->valid = false;
+        locator->context = NULL;
+    }
+
+    if (locator->valid && locator->identifier == set->identifier &&
+        locator->generation == set->generation)
+        return locator;
+
+    locator->valid = false;
+    if (locator->context != NULL)
+        MemoryContextDelete(locator->context);
+
+    locator->context = AllocSetContextCreate(TopMemoryContext, "PISA Document Locator",
+                                             ALLOCSET_DEFAULT_SIZES);
+
+    memset(&hash_ctl, 0, sizeof(hash_ctl));
+    hash_ctl.keysize = sizeof(PisaDocIdKey);
+    hash_ctl.entrysize = sizeof(PisaDocumentLocation);
+    hash_ctl.hash = PisaDocIdHash;
+    hash_ctl.match = PisaDocIdMatch;
+    hash_ctl.hcxt = locator->context;
+    locator->documents = hash_create("PISA Document Locations",
+                                     Max(PisaSegmentSetLiveDocs(set), 1024), &hash_ctl,
+                                     HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+                                     HASH_CONTEXT);
+
+    initStringInfo(&line);
+    for (i = 0; i < set->num_segments; i++)
+    {
+        PisaSegmentEntry *segment = &set->segments[i];
+        char segment_path[MAXPGPATH];
+        char docmap_path[MAXPGPATH];
+        uint32 docid = segment->first_docid;
+        FILE *file;
+
+        GetPisaSegmentPath(set->index_path, segment->segment_id, segment_path);
+        snprintf(docmap_path, MAXPGPATH, "%s%s", segment_path, PISA_DOCMAP_FILE_SUFFIX);
+
+        file = AllocateFile(docmap_path, PG_BINARY_R);
+        if (file == NULL)
+        {
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not open PISA document map \"%s\": %m",
+                                   docmap_path)));
+        }
+
+        while (pg_get_line_buf(file, &line))
+        {
+            if (line.len > 0 && line.data[line.len - 1] == '\n')
+                line.data[--line.len] = '\0';
+
+            if (!PisaSegmentSetIsDeleted(set, docid))
+                AddPisaDocumentLocation(locator, line.data, line.len, docid);
+            docid++;
+        }
+
+        FreeFile(file);
+
+        if (docid - segment->first_docid != segment->num_docs)
+        {
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("PISA document map \"%s\" does not match its segment",
+                                   docmap_path)));
+        }
+    }
+    pfree(line.data);
+
+    locator->identifier = set->identifier;
+    locator->generation = set->generation;
+    locator->valid = true;
+
+    elog(DEBUG1, "Loaded the locations of " UINT64_FORMAT " documents of PISA index %s",
+         PisaSegmentSetLiveDocs(set), set->index_path);
+
+    return locator;
+}
+
+
+static void
+AddPisaDocumentLocation(PisaDocumentLocator *locator, const char *doc_id, uint32 length,
+                        uint32 docid)
+{
+    PisaDocumentLocation *location;
+    PisaDocIdKey key;
+    bool found;
+
+    key.data = doc_id;
+    key.length = length;
+    location = (PisaDocumentLocation *) hash_search(locator->documents, &key, HASH_ENTER,
+                                                    &found);
+    if (!found)
+    {
+        char *copy = (char *) MemoryContextAlloc(locator->context, length + 1);
+
+        memcpy(copy, doc_id, length);
+        copy[length] = '\0';
+        location->key.data = copy;
+    }
+
+    location->docid = docid;
+}
+
+
+/*
+ * Rewrites segments [first, last] as one segment holding their live
+ * documents in docid order, which keeps the locality of a reordered
+ * base, and writes the new segments file. The replaced segments are
+ * removed by the next cycle of the sync worker, once the queries that
+ * may still read them are done.
+ */
+static void
+MergePisaSegmentRange(PisaSegmentSet *set, int first, int last)
+{
+    PisaForwardIndexWriter *writer;
+    MemoryContext old_context;
+    char segment_path[MAXPGPATH];
+    char forward_path[MAXPGPATH];
+    uint32 *replaced_ids;
+    uint32 segment_id = set->next_segment_id;
+    uint32 num_docs;
+    uint64 dropped = 0;
+    int count = last - first + 1;
+    int i;
+    instr_time start_time;
+    instr_time duration;
+
+    INSTR_TIME_SET_CURRENT(start_time);
+
+    GetPisaSegmentPath(set->index_path, segment_id, segment_path);
+    snprintf(forward_path, MAXPGPATH, "%s%s", segment_path, PISA_FORWARD_FILE_SUFFIX);
+    writer = BeginPisaForwardIndexWriter(forward_path);
+
+    replaced_ids = (uint32 *) palloc(count * sizeof(uint32));
+    for (i = first; i <= last; i++)
+    {
+        PisaSegmentEntry *segment = &set->segments[i];
+        PisaForwardIndex *forward_index;
+        char source_path[MAXPGPATH];
+        char source_forward[MAXPGPATH];
+        uint32 *permutation = NULL;
+        uint32 docid;
+
+        GetPisaSegmentPath(set->index_path, segment->segment_id, source_path);
+        snprintf(source_forward, MAXPGPATH, "%s%s", source_path, PISA_FORWARD_FILE_SUFFIX);
+
+        forward_index = LoadPisaForwardIndex(source_forward);
+        if (forward_index == NULL || forward_index->num_docs != segment->num_docs)
+        {
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("PISA forward index \"%s\" does not match its segment",
+                                   source_forward)));
+        }
+
+        /* Only the base is reordered, by document_reordering.c */
+        if (segment->segment_id == PISA_BASE_SEGMENT_ID)
+            permutation = LoadDocumentReorderingPermutation(set->index_path, forward_index);
+
+        for (docid = 0; docid < segment->num_docs; docid++)
+        {
+            uint32 document = permutation != NULL ? permutation[docid] : docid;
+            uint64 posting;
+
+            if (PisaSegmentSetIsDeleted(set, segment->first_docid + docid))
+            {
+                dropped++;
+                continue;
+            }
+
+            for (posting = forward_index->doc_offsets[document];
+                 posting < forward_index->doc_offsets[document + 1]; posting++)
+            {
+                const char *term = forward_index->terms[forward_index->term_ids[posting]];
+
+                PisaForwardIndexWriterAddTerm(writer, term, strlen(term),
+                                              forward_index->freqs[posting]);
+            }
+            PisaForwardIndexWriterEndDocument(writer, forward_index->doc_ids[document]);
+        }
+
+        replaced_ids[i - first] = segment->segment_id;
+        if (permutation != NULL)
+            pfree(permutation);
+        FreePisaForwardIndex(forward_index);
+    }
+
+    num_docs = writer->num_docs;
+    FinishPisaForwardIndexWriter(writer);
+
+    if (num_docs > 0)
+    {
+        PisaForwardIndex *forward_index = LoadPisaForwardIndex(forward_path);
+
+        WritePisaIndexFromForwardIndex(forward_index, NULL, segment_path,
+                                       (PisaCompressionType) pisa_default_compression);
+        FreePisaForwardIndex(forward_index);
+    }
+    else
+    {
+        RemovePisaSegmentFiles(set->index_path, segment_id);
+    }
+
+    PisaSegmentSetReplaceSegments(set, first, last, segment_id, num_docs);
+    set->generation++;
+    WritePisaSegmentSet(set);
+
+    old_context = MemoryContextSwitchTo(TopMemoryContext);
+    for (i = 0; i < count; i++)
+    {
+        PisaObsoleteSegment *obsolete = palloc(sizeof(PisaObsoleteSegment));
+
+        strlcpy(obsolete->index_path, set->index_path, MAXPGPATH);
+        obsolete->segment_id = replaced_ids[i];
+        ObsoleteSegments = lappend(ObsoleteSegments, obsolete);
+    }
+    MemoryContextSwitchTo(old_context);
+    pfree(replaced_ids);
+
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start_time);
+
+    elog(LOG, "Merged %d segments of PISA index %s into segment %u: %u documents, "
+         UINT64_FORMAT " deleted documents dropped in %.1f ms", count, set->index_path,
+         segment_id, num_docs, dropped, INSTR_TIME_GET_MILLISEC(duration));
+}
+
+
+/* Index paths of the files of the index directory ending in 'suffix' */
+static List *
+ListPisaIndexFiles(const char *suffix)
+{
+    List *index_paths = NIL;
+    size_t suffix_length = strlen(suffix);
+    struct dirent *entry;
+    DIR *dir;
+
+    if (pisa_index_base_path == NULL)
+        return NIL;
+
+    dir = AllocateDir(pisa_index_base_path);
+    if (dir == NULL && errno == ENOENT)
+        return NIL;
+
+    while ((entry = ReadDir(dir, pisa_index_base_path)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+
+        if (length <= suffix_length ||
+            strcmp(entry->d_name + length - suffix_length, suffix) != 0)
+            continue;
+
+        index_paths = lappend(index_paths,
+                              psprintf("%s/%.*s", pisa_index_base_path,
+                                       (int) (length - suffix_length), entry->d_name));
+    }
+
+    FreeDir(dir);
+
+    return index_paths;
+}
+
+
+/*
+ * One cycle of the sync worker: removes the segments merged away in the
+ * previous cycle, applies the change logs, merges segments and drops
+ * expired query cache entries.
+ */
+static void
+RunPisaIndexSyncCycle(void)
+{
+    List *obsolete = ObsoleteSegments;
+    List *index_paths;
+    ListCell *cell;
+
+    ObsoleteSegments = NIL;
+    foreach(cell, obsolete)
+    {
+        PisaObsoleteSegment *segment = (PisaObsoleteSegment *) lfirst(cell);
+        PisaSegmentSet *set;
+        bool referenced = false;
+        uint32 i;
+        int lock_fd;
+
+        /* A rebuilt base reuses the base segment id */
+        lock_fd = LockPisaIndexSegments(segment->index_path, false);
+        if (lock_fd < 0)
+        {
+            MemoryContext old_context = MemoryContextSwitchTo(TopMemoryContext);
+            PisaObsoleteSegment *retry = palloc(sizeof(PisaObsoleteSegment));
+
+            memcpy(retry, segment, sizeof(PisaObsoleteSegment));
+            ObsoleteSegments = lappend(ObsoleteSegments, retry);
+            MemoryContextSwitchTo(old_context);
+            continue;
+        }
+
+        set = ReadPisaSegmentSet(segment->index_path);
+        for (i = 0; set != NULL && i < set->num_segments; i++)
+            referenced |= set->segments[i].segment_id == segment->segment_id;
+
+        if (!referenced)
+            RemovePisaSegmentFiles(segment->index_path, segment->segment_id);
+
+        FreePisaSegmentSet(set);
+        UnlockPisaIndexSegments(lock_fd);
+    }
+    list_free_deep(obsolete);
+
+    ProcessPendingIndexUpdates();
+
+    index_paths = ListPisaIndexFiles(PISA_SEGMENTS_FILE_SUFFIX);
+    foreach(cell, index_paths)
+        MergePisaIndexSegments((char *) lfirst(cell));
+
+    EvictExpiredEntries();
+}
+
+
+static void
+ReadPisaChangeBytes(FILE *file, const char *path, void *data, size_t length)
+{
+    if (length > 0 && fread(data, 1, length, file) != length)
+    {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("PISA change log \"%s\" is truncated", path)));
+    }
+}
+
+
+static uint32
+PisaDocIdHash(const void *key, Size keysize)
+{
+    const PisaDocIdKey *doc_id = (const PisaDocIdKey *) key;
+
+    return hash_bytes((const unsigned char *) doc_id->data, (int) doc_id->length);
+}
+
+
+static int
+PisaDocIdMatch(const void *key1, const void *key2, Size keysize)
+{
+    const PisaDocIdKey *left = (const PisaDocIdKey *) key1;
+    const PisaDocIdKey *right = (const PisaDocIdKey *) key2;
+
+    if (left->length != right->length)
+        return 1;
+
+    return memcmp(left->data, right->data, left->length);
+}
+
+
+static int
+ComparePisaDocumentChanges(const void *left, const void *right)
+{
+    const PisaDocumentChange *left_change = *(PisaDocumentChange *const *) left;
+    const PisaDocumentChange *right_change = *(PisaDocumentChange *const *) right;
+
+    if (left_change->document_offset < right_change->document_offset)
+        return -1;
+    if (left_change->document_offset > right_change->document_offset)
+        return 1;
+    return 0;
+}
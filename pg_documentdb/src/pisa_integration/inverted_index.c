@@ -0,0 +1,1009 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/pisa_integration/inverted_index.c
+ *
+ * Writer, memory-mapped reader and posting cursors for the PISA
+ * block-compressed inverted index (see inverted_index.h for the layout).
+ *
+ * Posting lists are split in blocks of PISA_BLOCK_SIZE postings. Every
+ * list starts with a skip table holding the last docid of each block so
+ * that NextGeq can jump over whole blocks without decoding them; only
+ * the block that contains the target is decoded, and term frequencies
+ * are only decoded when a score is requested.
+ *
+ * The skip entries also store the maximum BM25 score of each block.
+ * Block-Max WAND moves a separate "shallow" pointer over the skip table
+ * to read those bounds for a candidate docid, without touching (or
+ * decoding) the blocks themselves.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <float.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+
+#include "pisa_integration/inverted_index.h"
+#include "pisa_integration/memory_optimization.h"
+
+typedef struct PisaIndexReaderCacheEntry
+{
+    char path[MAXPGPATH];
+    PisaIndexReader *reader;
+} PisaIndexReaderCacheEntry;
+
+/* Backend-local cache of mapped index files, keyed by file path */
+static HTAB *PisaIndexReaderCache = NULL;
+
+static float4 RoundUpToFloat4(double value);
+static void WritePisaBytes(PisaIndexWriter *writer, const void *data, size_t length);
+static void WritePisaPadding(PisaIndexWriter *writer, uint64 current_offset);
+static void AppendPisaBlock(StringInfo buffer, PisaCompressionType compression,
+                            const uint32 *docids, const uint32 *freqs, uint32 count,
+                            uint32 base);
+static PisaIndexReader *MapPisaIndexFile(const char *index_file, struct stat *file_stat);
+static void UnmapPisaIndexReader(PisaIndexReader *reader);
+static void DecodeCurrentBlock(PisaPostingCursor *cursor);
+static void SetCursorExhausted(PisaPostingCursor *cursor);
+static bool PisaPostingListRoundTrips(PisaIndexReader *reader, const char *term,
+                                      const uint32 *docids, const uint32 *freqs,
+                                      uint32 count);
+
+PG_FUNCTION_INFO_V1(documentdb_pisa_posting_list_round_trip_for_test);
+
+
+int
+PisaCompareTerms(const char *left, int left_length, const char *right, int right_length)
+{
+    int result = memcmp(left, right, Min(left_length, right_length));
+
+    if (result != 0)
+        return result;
+
+    return left_length - right_length;
+}
+
+
+double
+PisaBm25Idf(uint32 num_docs, uint32 doc_freq)
+{
+    return log(1.0 + (num_docs - doc_freq + 0.5) / (doc_freq + 0.5));
+}
+
+
+char *
+GetPisaIndexFilePath(const char *index_path)
+{
+    return psprintf("%s%s", index_path, PISA_INDEX_FILE_SUFFIX);
+}
+
+
+/*
+ * Starts writing an index to 'index_file'. The index is written to a
+ * temporary file and renamed into place by FinishPisaIndexWriter, so
+ * readers that already mapped the previous version are unaffected.
+ * 'doc_lengths' must stay valid until the writer is finished.
+ */
+PisaIndexWriter *
+BeginPisaIndexWriter(const char *index_file, PisaCompressionType compression,
+                     uint32 num_docs, const uint32 *doc_lengths)
+{
+    PisaIndexWriter *writer;
+    PisaIndexHeader header;
+    uint64 total_length = 0;
+    uint32 i;
+
+    writer = (PisaIndexWriter *) palloc0(sizeof(PisaIndexWriter));
+    strlcpy(writer->path, index_file, MAXPGPATH);
+    snprintf(writer->temp_path, MAXPGPATH, "%s.tmp", index_file);
+    writer->compression = compression;
+    writer->num_docs = num_docs;
+    writer->doc_lengths = (uint32 *) doc_lengths;
+    writer->max_terms = 1024;
+    writer->terms = (PisaTermEntry *) palloc(writer->max_terms * sizeof(PisaTermEntry));
+    writer->last_term_offset = -1;
+    initStringInfo(&writer->term_pool);
+    initStringInfo(&writer->block_buffer);
+
+    for (i = 0; i < num_docs; i++)
+        total_length += doc_lengths[i];
+
+    writer->avg_doc_length = num_docs > 0 && total_length > 0 ?
+                             (double) total_length / num_docs : 1.0;
+
+    writer->file = AllocateFile(writer->temp_path, PG_BINARY_W);
+    if (writer->file == NULL)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not create PISA index file \"%s\": %m",
+                               writer->temp_path)));
+    }
+
+    /* The header is rewritten once all offsets are known */
+    memset(&header, 0, sizeof(header));
+    WritePisaBytes(writer, &header, sizeof(header));
+    WritePisaBytes(writer, doc_lengths, (size_t) num_docs * sizeof(uint32));
+    WritePisaPadding(writer, sizeof(header) + (uint64) num_docs * sizeof(uint32));
+
+    return writer;
+}
+
+
+/*
+ * Appends the posting list of a term. Terms must be added in strictly
+ * increasing PisaCompareTerms order and docids must be strictly
+ * increasing and smaller than the number of documents.
+ */
+void
+PisaIndexWriterAddTerm(PisaIndexWriter *writer, const char *term, int term_length,
+                       const uint32 *docids, const uint32 *freqs, uint32 count)
+{
+    PisaTermEntry *entry;
+    PisaSkipEntry *skips;
+    uint32 num_blocks;
+    uint32 block;
+    uint32 base = 0;
+    uint32 i;
+    double idf;
+    double max_score = 0.0;
+    uint64 list_size;
+
+    if (count == 0)
+        return;
+
+    if (writer->last_term_offset >= 0 &&
+        PisaCompareTerms(writer->term_pool.data + writer->last_term_offset,
+                         writer->last_term_length, term, term_length) >= 0)
+    {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                        errmsg("PISA index terms must be added in sorted order")));
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (docids[i] >= writer->num_docs || (i > 0 && docids[i] <= docids[i - 1]) ||
+            freqs[i] == 0)
+        {
+            ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                            errmsg("invalid posting list for PISA index term \"%.*s\"",
+                                   term_length, term)));
+        }
+    }
+
+    if (writer->num_terms == writer->max_terms)
+    {
+        writer->max_terms *= 2;
+        writer->terms = (PisaTermEntry *) repalloc_huge(writer->terms,
+                                                        writer->max_terms *
+                                                        sizeof(PisaTermEntry));
+    }
+
+    num_blocks = (count + PISA_BLOCK_SIZE - 1) / PISA_BLOCK_SIZE;
+    skips = (PisaSkipEntry *) palloc(num_blocks * sizeof(PisaSkipEntry));
+    idf = PisaBm25Idf(writer->num_docs, count);
+
+    resetStringInfo(&writer->block_buffer);
+    for (block = 0; block < num_blocks; block++)
+    {
+        uint32 start = block * PISA_BLOCK_SIZE;
+        uint32 block_count = Min(PISA_BLOCK_SIZE, count - start);
+
+        double block_max_score = 0.0;
+
+        for (i = start; i < start + block_count; i++)
+        {
+            double score = PisaBm25Score(idf, freqs[i], writer->doc_lengths[docids[i]],
+                                         writer->avg_doc_length);
+            block_max_score = Max(block_max_score, score);
+        }
+
+        max_score = Max(max_score, block_max_score);
+        skips[block].block_max_score = RoundUpToFloat4(block_max_score);
+        skips[block].last_docid = docids[start + block_count - 1];
+        skips[block].block_offset = writer->block_buffer.len;
+        AppendPisaBlock(&writer->block_buffer, writer->compression,
+                        docids + start, freqs + start, block_count, base);
+        base = skips[block].last_docid + 1;
+    }
+
+    entry = &writer->terms[writer->num_terms++];
+    memset(entry, 0, sizeof(PisaTermEntry));
+    entry->postings_offset = writer->postings_size;
+    entry->term_offset = writer->term_pool.len;
+    entry->term_length = term_length;
+    entry->doc_freq = count;
+    entry->num_blocks = num_blocks;
+
+    entry->max_score = RoundUpToFloat4(max_score);
+
+    writer->last_term_offset = writer->term_pool.len;
+    writer->last_term_length = term_length;
+    appendBinaryStringInfo(&writer->term_pool, term, term_length);
+
+    WritePisaBytes(writer, skips, num_blocks * sizeof(PisaSkipEntry));
+    WritePisaBytes(writer, writer->block_buffer.data, writer->block_buffer.len);
+
+    list_size = num_blocks * sizeof(PisaSkipEntry) + writer->block_buffer.len;
+    WritePisaPadding(writer, list_size);
+    writer->postings_size += TYPEALIGN(8, list_size);
+
+    pfree(skips);
+}
+
+
+/*
+ * Number of bytes PisaIndexWriterAddTerm would write for a posting list
+ * (skip table, blocks and padding), computed by encoding the list into
+ * 'buffer' without writing anything. Used to measure how a docid
+ * assignment affects the index size.
+ */
+uint64
+PisaPostingListEncodedSize(PisaCompressionType compression, const uint32 *docids,
+                           const uint32 *freqs, uint32 count, StringInfo buffer)
+{
+    uint32 num_blocks = (count + PISA_BLOCK_SIZE - 1) / PISA_BLOCK_SIZE;
+    uint32 base = 0;
+    uint32 block;
+
+    resetStringInfo(buffer);
+    for (block = 0; block < num_blocks; block++)
+    {
+        uint32 start = block * PISA_BLOCK_SIZE;
+        uint32 block_count = Min(PISA_BLOCK_SIZE, count - start);
+
+        AppendPisaBlock(buffer, compression, docids + start, freqs + start,
+                        block_count, base);
+        base = docids[start + block_count - 1] + 1;
+    }
+
+    return TYPEALIGN(8, (uint64) num_blocks * sizeof(PisaSkipEntry) + buffer->len);
+}
+
+
+/*
+ * Writes the dictionary and the header, and atomically moves the index
+ * into place. Returns the size of the index in bytes.
+ */
+uint64
+FinishPisaIndexWriter(PisaIndexWriter *writer)
+{
+    PisaIndexHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PISA_INDEX_MAGIC, sizeof(PISA_INDEX_MAGIC));
+    header.version = PISA_INDEX_VERSION;
+    header.compression = writer->compression;
+    header.num_docs = writer->num_docs;
+    header.num_terms = writer->num_terms;
+    header.avg_doc_length = writer->avg_doc_length;
+    header.doc_lengths_offset = sizeof(PisaIndexHeader);
+    header.postings_offset = TYPEALIGN(8, header.doc_lengths_offset +
+                                       (uint64) writer->num_docs * sizeof(uint32));
+    header.dictionary_offset = header.postings_offset + writer->postings_size;
+    header.term_pool_offset = header.dictionary_offset +
+                              (uint64) writer->num_terms * sizeof(PisaTermEntry);
+    header.file_size = header.term_pool_offset + writer->term_pool.len;
+
+    WritePisaBytes(writer, writer->terms, (size_t) writer->num_terms * sizeof(PisaTermEntry));
+    WritePisaBytes(writer, writer->term_pool.data, writer->term_pool.len);
+
+    if (fseeko(writer->file, 0, SEEK_SET) != 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not seek in PISA index file \"%s\": %m",
+                               writer->temp_path)));
+    }
+
+    WritePisaBytes(writer, &header, sizeof(header));
+
+    if (FreeFile(writer->file) != 0)
+    {
+        writer->file = NULL;
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not close PISA index file \"%s\": %m",
+                               writer->temp_path)));
+    }
+    writer->file = NULL;
+
+    durable_rename(writer->temp_path, writer->path, ERROR);
+
+    elog(DEBUG1, "Wrote PISA index %s: %u documents, %u terms, " UINT64_FORMAT " bytes",
+         writer->path, writer->num_docs, writer->num_terms, header.file_size);
+
+    pfree(writer->terms);
+    pfree(writer->term_pool.data);
+    pfree(writer->block_buffer.data);
+    pfree(writer);
+
+    return header.file_size;
+}
+
+
+/*
+ * Returns a reader for the given index file, mapping it on first use.
+ * Returns NULL if the file does not exist. A reader is re-mapped when
+ * the file was replaced since it was mapped; readers still referenced
+ * by open cursors are unmapped once they are released.
+ */
+PisaIndexReader *
+OpenPisaIndexReader(const char *index_file)
+{
+    PisaIndexReaderCacheEntry *entry;
+    struct stat file_stat;
+    bool found;
+
+    if (stat(index_file, &file_stat) < 0)
+    {
+        if (errno == ENOENT)
+            return NULL;
+
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not stat PISA index file \"%s\": %m", index_file)));
+    }
+
+    if (PisaIndexReaderCache == NULL)
+    {
+        HASHCTL hash_ctl;
+
+        memset(&hash_ctl, 0, sizeof(hash_ctl));
+        hash_ctl.keysize = MAXPGPATH;
+        hash_ctl.entrysize = sizeof(PisaIndexReaderCacheEntry);
+        hash_ctl.hcxt = TopMemoryContext;
+
+        PisaIndexReaderCache = hash_create("PISA Index Readers", 16, &hash_ctl,
+                                           HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+    }
+
+    entry = (PisaIndexReaderCacheEntry *) hash_search(PisaIndexReaderCache, index_file,
+                                                      HASH_ENTER, &found);
+    if (!found)
+        entry->reader = NULL;
+
+    if (entry->reader != NULL)
+    {
+        PisaIndexReader *reader = entry->reader;
+
+        if (reader->file_inode == (uint64) file_stat.st_ino &&
+            reader->file_mtime == (int64) file_stat.st_mtime &&
+            reader->size == (size_t) file_stat.st_size)
+        {
+            reader->refcount++;
+            return reader;
+        }
+
+        reader->stale = true;
+        entry->reader = NULL;
+        if (reader->refcount == 0)
+            UnmapPisaIndexReader(reader);
+    }
+
+    entry->reader = MapPisaIndexFile(index_file, &file_stat);
+    entry->reader->refcount++;
+
+    return entry->reader;
+}
+
+
+void
+ReleasePisaIndexReader(PisaIndexReader *reader)
+{
+    if (reader == NULL)
+        return;
+
+    Assert(reader->refcount > 0);
+    reader->refcount--;
+
+    if (reader->stale && reader->refcount == 0)
+        UnmapPisaIndexReader(reader);
+}
+
+
+/*
+ * Binary search of the term dictionary. Returns NULL when the term does
+ * not occur in the index.
+ */
+const PisaTermEntry *
+PisaIndexLookupTerm(PisaIndexReader *reader, const char *term, int term_length)
+{
+    int64 low = 0;
+    int64 high = (int64) reader->header->num_terms - 1;
+
+    while (low <= high)
+    {
+        int64 middle = low + (high - low) / 2;
+        const PisaTermEntry *entry = &reader->terms[middle];
+        int result = PisaCompareTerms(reader->term_pool + entry->term_offset,
+                                      entry->term_length, term, term_length);
+
+        if (result == 0)
+            return entry;
+        else if (result < 0)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Opens a cursor positioned on the first posting of the term. The cursor
+ * holds a reference on the reader until it is closed.
+ */
+PisaPostingCursor *
+OpenPisaPostingCursor(PisaIndexReader *reader, const PisaTermEntry *term)
+{
+    PisaPostingCursor *cursor;
+    const char *list_start;
+
+    cursor = (PisaPostingCursor *) PisaMemoryAlloc(sizeof(PisaPostingCursor));
+    cursor->reader = reader;
+    cursor->term = term;
+    cursor->idf = PisaBm25Idf(reader->header->num_docs, term->doc_freq);
+
+    list_start = reader->postings + term->postings_offset;
+    cursor->skips = (const PisaSkipEntry *) list_start;
+    cursor->blocks = list_start + term->num_blocks * sizeof(PisaSkipEntry);
+
+    reader->refcount++;
+
+    cursor->block = 0;
+    cursor->shallow_block = 0;
+    DecodeCurrentBlock(cursor);
+
+    return cursor;
+}
+
+
+void
+ClosePisaPostingCursor(PisaPostingCursor *cursor)
+{
+    if (cursor == NULL)
+        return;
+
+    ReleasePisaIndexReader(cursor->reader);
+    PisaMemoryFree(cursor);
+}
+
+
+void
+PisaPostingCursorNext(PisaPostingCursor *cursor)
+{
+    if (cursor->block >= cursor->term->num_blocks)
+        return;
+
+    cursor->position++;
+    if (cursor->position < cursor->block_count)
+        return;
+
+    cursor->block++;
+    if (cursor->block < cursor->term->num_blocks)
+        DecodeCurrentBlock(cursor);
+    else
+        SetCursorExhausted(cursor);
+}
+
+
+/*
+ * Moves the cursor to the first posting with docid >= target. Blocks
+ * whose last docid is smaller than the target are skipped through a
+ * binary search of the skip table without being decoded.
+ */
+void
+PisaPostingCursorNextGeq(PisaPostingCursor *cursor, uint32 target)
+{
+    if (PisaPostingCursorDocId(cursor) >= target)
+        return;
+
+    if (cursor->skips[cursor->block].last_docid < target)
+    {
+        uint32 low = cursor->block + 1;
+        uint32 high = cursor->term->num_blocks;
+
+        while (low < high)
+        {
+            uint32 middle = low + (high - low) / 2;
+
+            if (cursor->skips[middle].last_docid < target)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        if (low == cursor->term->num_blocks)
+        {
+            SetCursorExhausted(cursor);
+            return;
+        }
+
+        cursor->block = low;
+        DecodeCurrentBlock(cursor);
+    }
+
+    /* The block's last docid is >= target so the scan stays in bounds */
+    while (cursor->docids[cursor->position] < target)
+        cursor->position++;
+}
+
+
+/*
+ * Moves the block-max pointer to the block that may contain 'target'
+ * without decoding anything. The regular position is left untouched.
+ */
+void
+PisaPostingCursorShallowNextGeq(PisaPostingCursor *cursor, uint32 target)
+{
+    uint32 num_blocks = cursor->term->num_blocks;
+    uint32 block = Max(cursor->shallow_block, cursor->block);
+
+    while (block < num_blocks && cursor->skips[block].last_docid < target)
+        block++;
+
+    cursor->shallow_block = block;
+}
+
+
+uint32
+PisaPostingCursorFreq(PisaPostingCursor *cursor)
+{
+    if (cursor->block >= cursor->term->num_blocks)
+        return 0;
+
+    if (!cursor->freqs_decoded)
+    {
+        const PisaBlockHeader *header = (const PisaBlockHeader *)
+                                        (cursor->blocks +
+                                         cursor->skips[cursor->block].block_offset);
+        const char *payload = (const char *) (header + 1) + header->freq_offset;
+        uint32 i;
+
+        switch (header->encoding)
+        {
+            case PISA_BLOCK_ENCODING_PACKED:
+                PisaBitUnpackBlock((const uint32 *) payload, header->freq_bits,
+                                   cursor->freqs);
+                break;
+            case PISA_BLOCK_ENCODING_VBYTE:
+                PisaVByteDecode((const uint8 *) payload, cursor->block_count,
+                                cursor->freqs);
+                break;
+            default:
+                memcpy(cursor->freqs, payload, cursor->block_count * sizeof(uint32));
+                break;
+        }
+
+        for (i = 0; i < cursor->block_count; i++)
+            cursor->freqs[i]++;
+
+        cursor->freqs_decoded = true;
+    }
+
+    return cursor->freqs[cursor->position];
+}
+
+
+double
+PisaPostingCursorScore(PisaPostingCursor *cursor)
+{
+    uint32 docid = PisaPostingCursorDocId(cursor);
+
+    if (docid == PISA_POSTING_END)
+        return 0.0;
+
+    return PisaBm25Score(cursor->idf, PisaPostingCursorFreq(cursor),
+                         cursor->reader->doc_lengths[docid],
+                         cursor->reader->header->avg_doc_length);
+}
+
+
+/*
+ * Narrows a score bound to float4, rounding up so that the stored bound
+ * never undercuts a real score.
+ */
+static float4
+RoundUpToFloat4(double value)
+{
+    float4 result = (float4) value;
+
+    if ((double) result < value)
+        result = nextafterf(result, FLT_MAX);
+
+    return result;
+}
+
+
+static void
+WritePisaBytes(PisaIndexWriter *writer, const void *data, size_t length)
+{
+    if (length == 0)
+        return;
+
+    if (fwrite(data, 1, length, writer->file) != length)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not write PISA index file \"%s\": %m",
+                               writer->temp_path)));
+    }
+}
+
+
+static void
+WritePisaPadding(PisaIndexWriter *writer, uint64 current_offset)
+{
+    static const char zeros[8] = { 0 };
+    size_t padding = TYPEALIGN(8, current_offset) - current_offset;
+
+    WritePisaBytes(writer, zeros, padding);
+}
+
+
+/*
+ * Encodes one block of postings. Full blocks are bit-packed; the tail
+ * block of a list is VByte encoded since packing would pad it to
+ * PISA_BLOCK_SIZE values. Frequencies are stored minus one, after the
+ * docids of the block, so a VByte block takes up to twice
+ * PISA_BLOCK_SIZE * PISA_VBYTE_MAX_BYTES bytes.
+ */
+static void
+AppendPisaBlock(StringInfo buffer, PisaCompressionType compression,
+                const uint32 *docids, const uint32 *freqs, uint32 count, uint32 base)
+{
+    PisaBlockHeader header;
+    uint32 gaps[PISA_BLOCK_SIZE];
+    uint32 freq_values[PISA_BLOCK_SIZE];
+    uint32 packed[PISA_BLOCK_SIZE];
+    uint8 encoded[2 * PISA_BLOCK_SIZE * PISA_VBYTE_MAX_BYTES];
+    uint32 i;
+    int length;
+
+    PisaDeltaEncode(docids, count, base, gaps);
+    for (i = 0; i < count; i++)
+        freq_values[i] = freqs[i] - 1;
+
+    memset(&header, 0, sizeof(header));
+
+    if (compression == PISA_COMPRESSION_NONE)
+    {
+        header.encoding = PISA_BLOCK_ENCODING_RAW;
+        header.freq_offset = count * sizeof(uint32);
+        appendBinaryStringInfo(buffer, (char *) &header, sizeof(header));
+        appendBinaryStringInfo(buffer, (char *) gaps, count * sizeof(uint32));
+        appendBinaryStringInfo(buffer, (char *) freq_values, count * sizeof(uint32));
+    }
+    else if (count == PISA_BLOCK_SIZE)
+    {
+        header.encoding = PISA_BLOCK_ENCODING_PACKED;
+        header.docid_bits = PisaRequiredBits(gaps, count);
+        header.freq_bits = PisaRequiredBits(freq_values, count);
+        header.freq_offset = header.docid_bits * PISA_BLOCK_LANES * sizeof(uint32);
+        appendBinaryStringInfo(buffer, (char *) &header, sizeof(header));
+
+        PisaBitPackBlock(gaps, header.docid_bits, packed);
+        appendBinaryStringInfo(buffer, (char *) packed, header.freq_offset);
+
+        PisaBitPackBlock(freq_values, header.freq_bits, packed);
+        appendBinaryStringInfo(buffer, (char *) packed,
+                               header.freq_bits * PISA_BLOCK_LANES * sizeof(uint32));
+    }
+    else
+    {
+        header.encoding = PISA_BLOCK_ENCODING_VBYTE;
+        length = PisaVByteEncode(gaps, count, encoded);
+        header.freq_offset = length;
+        length += PisaVByteEncode(freq_values, count, encoded + length);
+        appendBinaryStringInfo(buffer, (char *) &header, sizeof(header));
+        appendBinaryStringInfo(buffer, (char *) encoded, length);
+    }
+
+    /* Keep every block 4 byte aligned for the word-wise unpackers */
+    while (buffer->len % sizeof(uint32) != 0)
+        appendStringInfoCharMacro(buffer, '\0');
+}
+
+
+static PisaIndexReader *
+MapPisaIndexFile(const char *index_file, struct stat *file_stat)
+{
+    PisaIndexReader *reader;
+    const PisaIndexHeader *header;
+    void *mapping;
+    int fd;
+
+    if ((size_t) file_stat->st_size < sizeof(PisaIndexHeader))
+    {
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("PISA index file \"%s\" is truncated", index_file)));
+    }
+
+    fd = OpenTransientFile(index_file, O_RDONLY | PG_BINARY);
+    if (fd < 0)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open PISA index file \"%s\": %m", index_file)));
+    }
+
+    mapping = mmap(NULL, file_stat->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    CloseTransientFile(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not map PISA index file \"%s\": %m", index_file)));
+    }
+
+    header = (const PisaIndexHeader *) mapping;
+    if (memcmp(header->magic, PISA_INDEX_MAGIC, sizeof(PISA_INDEX_MAGIC)) != 0 ||
+        header->version != PISA_INDEX_VERSION ||
+        header->file_size != (uint64) file_stat->st_size)
+    {
+        munmap(mapping, file_stat->st_size);
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("PISA index file \"%s\" is invalid or has an "
+                               "unsupported version", index_file)));
+    }
+
+    reader = (PisaIndexReader *) MemoryContextAllocZero(TopMemoryContext,
+                                                        sizeof(PisaIndexReader));
+    strlcpy(reader->path, index_file, MAXPGPATH);
+    reader->base = (const char *) mapping;
+    reader->size = file_stat->st_size;
+    reader->header = header;
+    reader->doc_lengths = (const uint32 *) (reader->base + header->doc_lengths_offset);
+    reader->postings = reader->base + header->postings_offset;
+    reader->terms = (const PisaTermEntry *) (reader->base + header->dictionary_offset);
+    reader->term_pool = reader->base + header->term_pool_offset;
+    reader->file_inode = (uint64) file_stat->st_ino;
+    reader->file_mtime = (int64) file_stat->st_mtime;
+
+    elog(DEBUG1, "Mapped PISA index %s (%u documents, %u terms)",
+         index_file, header->num_docs, header->num_terms);
+
+    return reader;
+}
+
+
+static void
+UnmapPisaIndexReader(PisaIndexReader *reader)
+{
+    munmap((void *) reader->base, reader->size);
+    pfree(reader);
+}
+
+
+static void
+DecodeCurrentBlock(PisaPostingCursor *cursor)
+{
+    const PisaBlockHeader *header = (const PisaBlockHeader *)
+                                    (cursor->blocks +
+                                     cursor->skips[cursor->block].block_offset);
+    const char *payload = (const char *) (header + 1);
+    uint32 base = cursor->block == 0 ? 0 : cursor->skips[cursor->block - 1].last_docid + 1;
+
+    if (cursor->block == cursor->term->num_blocks - 1)
+        cursor->block_count = cursor->term->doc_freq - cursor->block * PISA_BLOCK_SIZE;
+    else
+        cursor->block_count = PISA_BLOCK_SIZE;
+
+    switch (header->encoding)
+    {
+        case PISA_BLOCK_ENCODING_PACKED:
+            PisaBitUnpackBlock((const uint32 *) payload, header->docid_bits,
+                               cursor->docids);
+            break;
+        case PISA_BLOCK_ENCODING_VBYTE:
+            PisaVByteDecode((const uint8 *) payload, cursor->block_count, cursor->docids);
+            break;
+        default:
+            memcpy(cursor->docids, payload, cursor->block_count * sizeof(uint32));
+            break;
+    }
+
+    PisaDeltaDecode(cursor->docids, cursor->block_count, base);
+    cursor->shallow_block = Max(cursor->shallow_block, cursor->block);
+    cursor->position = 0;
+    cursor->freqs_decoded = false;
+}
+
+
+static void
+SetCursorExhausted(PisaPostingCursor *cursor)
+{
+    cursor->block = cursor->term->num_blocks;
+    cursor->shallow_block = cursor->term->num_blocks;
+    cursor->block_count = 1;
+    cursor->position = 0;
+    cursor->docids[0] = PISA_POSTING_END;
+    cursor->freqs[0] = 0;
+    cursor->freqs_decoded = true;
+}
+
+
+/*
+ * Reads a posting list back through posting cursors, once posting by
+ * posting and once jumping to every seventh posting with NextGeq, and
+ * returns whether the docids and frequencies match what was written.
+ */
+static bool
+PisaPostingListRoundTrips(PisaIndexReader *reader, const char *term, const uint32 *docids,
+                          const uint32 *freqs, uint32 count)
+{
+    const PisaTermEntry *entry = PisaIndexLookupTerm(reader, term, strlen(term));
+    PisaPostingCursor *cursor;
+    bool round_trips = true;
+    uint32 i;
+
+    if (entry == NULL || entry->doc_freq != count)
+        return false;
+
+    cursor = OpenPisaPostingCursor(reader, entry);
+    for (i = 0; i < count; i++)
+    {
+        round_trips &= PisaPostingCursorDocId(cursor) == docids[i] &&
+                       PisaPostingCursorFreq(cursor) == freqs[i];
+        PisaPostingCursorNext(cursor);
+    }
+    round_trips &= PisaPostingCursorDocId(cursor) == PISA_POSTING_END;
+    ClosePisaPostingCursor(cursor);
+
+    cursor = OpenPisaPostingCursor(reader, entry);
+    for (i = 1; i < count; i += 7)
+    {
+        PisaPostingCursorNextGeq(cursor, docids[i - 1] + 1);
+        round_trips &= PisaPostingCursorDocId(cursor) == docids[i] &&
+                       PisaPostingCursorFreq(cursor) == freqs[i];
+    }
+    PisaPostingCursorNextGeq(cursor, docids[count - 1] + 1);
+    round_trips &= PisaPostingCursorDocId(cursor) == PISA_POSTING_END;
+    ClosePisaPostingCursor(cursor);
+
+    return round_trips;
+}
+
+
+/*
+ * Test helper: writes posting lists of the shapes the block encodings
+ * tell apart with every compression, reads them back and returns, per
+ * compression, whether all of them round-tripped. The lists are runs of
+ * consecutive docids (zero-width gaps and frequencies), exactly one full
+ * block, a full block and a single tail posting, a single posting, and a
+ * list whose gaps and frequencies are large enough that its 127 posting
+ * tail takes more VByte bytes than one block of 5 byte values.
+ */
+Datum
+documentdb_pisa_posting_list_round_trip_for_test(PG_FUNCTION_ARGS)
+{
+#define PISA_TEST_LIST_COUNT 5
+    static const char *terms[PISA_TEST_LIST_COUNT] = {
+        "dense", "full", "large", "single", "tail"
+    };
+    static const uint32 counts[PISA_TEST_LIST_COUNT] = {
+        1000, PISA_BLOCK_SIZE, 2 * PISA_BLOCK_SIZE + 127, 1, PISA_BLOCK_SIZE + 1
+    };
+    const uint32 num_docs = 150000;
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    uint32 *doc_lengths;
+    uint32 *docids[PISA_TEST_LIST_COUNT];
+    uint32 *freqs[PISA_TEST_LIST_COUNT];
+    uint64 state = UINT64CONST(0x9E3779B97F4A7C15);
+    char *directory;
+    int compression;
+    int list;
+    uint32 i;
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    doc_lengths = (uint32 *) palloc(num_docs * sizeof(uint32));
+    for (i = 0; i < num_docs; i++)
+        doc_lengths[i] = 10 + i % 90;
+
+    for (list = 0; list < PISA_TEST_LIST_COUNT; list++)
+    {
+        docids[list] = (uint32 *) palloc(counts[list] * sizeof(uint32));
+        freqs[list] = (uint32 *) palloc(counts[list] * sizeof(uint32));
+
+        for (i = 0; i < counts[list]; i++)
+        {
+            uint64 random = PisaTestRandom(&state);
+
+            switch (list)
+            {
+                case 0:
+                    docids[list][i] = i;
+                    freqs[list][i] = 1;
+                    break;
+                case 1:
+                    docids[list][i] = 3 * i;
+                    freqs[list][i] = 1 + random % 1000;
+                    break;
+                case 2:
+                    docids[list][i] = i * i + i;
+                    freqs[list][i] = 1 + (uint32) (random % PG_UINT32_MAX);
+                    break;
+                case 3:
+                    docids[list][i] = num_docs - 1;
+                    freqs[list][i] = 7;
+                    break;
+                default:
+                    docids[list][i] = 1000 * i + 17;
+                    freqs[list][i] = 1 + i % 3;
+                    break;
+            }
+        }
+    }
+
+    directory = CreatePisaTestDirectory("posting_lists");
+    PG_TRY();
+    {
+        for (compression = PISA_COMPRESSION_NONE;
+             compression <= PISA_COMPRESSION_BLOCK_QMXINT; compression++)
+        {
+            char *index_file = psprintf("%s/lists_%d%s", directory, compression,
+                                        PISA_INDEX_FILE_SUFFIX);
+            PisaIndexWriter *writer;
+            PisaIndexReader *reader;
+            Datum values[4];
+            bool nulls[4] = { false, false, false, false };
+            bool round_trips = true;
+            int postings = 0;
+
+            writer = BeginPisaIndexWriter(index_file, (PisaCompressionType) compression,
+                                          num_docs, doc_lengths);
+            for (list = 0; list < PISA_TEST_LIST_COUNT; list++)
+            {
+                PisaIndexWriterAddTerm(writer, terms[list], strlen(terms[list]),
+                                       docids[list], freqs[list], counts[list]);
+            }
+            FinishPisaIndexWriter(writer);
+
+            reader = OpenPisaIndexReader(index_file);
+            for (list = 0; list < PISA_TEST_LIST_COUNT; list++)
+            {
+                round_trips &= PisaPostingListRoundTrips(reader, terms[list], docids[list],
+                                                         freqs[list], counts[list]);
+                postings += counts[list];
+            }
+            ReleasePisaIndexReader(reader);
+
+            values[0] = Int32GetDatum(compression);
+            values[1] = Int32GetDatum(PISA_TEST_LIST_COUNT);
+            values[2] = Int32GetDatum(postings);
+            values[3] = BoolGetDatum(round_trips);
+            tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+            pfree(index_file);
+        }
+    }
+    PG_FINALLY();
+    {
+        RemovePisaTestDirectory(directory);
+    }
+    PG_END_TRY();
+
+    PG_RETURN_VOID();
+}
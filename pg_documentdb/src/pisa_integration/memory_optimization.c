@@ -0,0 +1,656 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/pisa_integration/memory_optimization.c
+ *
+ * Size-classed slab allocator for PISA query structures. Every query
+ * opens a posting cursor per term and segment, each with its block
+ * decoding buffers, plus segment cursors and a top-k queue; serving them
+ * from per-class free lists avoids going through palloc for each one.
+ *
+ * Slabs of PISA_MEMORY_SLAB_SIZE bytes are carved into chunks of one
+ * size class, each preceded by a header that points back to its slab.
+ * Freed chunks go to the free list of their slab; a slab whose chunks
+ * are all free is returned to the pool's memory context unless it is
+ * the last one the class retains.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "port/pg_bitutils.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+
+#include "pisa_integration/memory_optimization.h"
+
+struct PisaMemorySlab
+{
+    dlist_node node;            /* in the pool's partial slabs while not full */
+    PisaMemoryPool *pool;
+    int size_class;
+    uint32 capacity;
+    uint32 carved;              /* chunks handed out from the bump pointer */
+    uint32 live;
+    char *free_chunks;          /* freed chunks, linked through their payload */
+    char *chunks;
+};
+
+typedef struct PisaMemoryChunkHeader
+{
+    void *owner;                /* the slab, or the pool of a large chunk */
+    uint32 size_class;
+    uint32 size;                /* usable bytes */
+} PisaMemoryChunkHeader;
+
+#define PISA_MEMORY_CHUNK_HEADER_SIZE MAXALIGN(sizeof(PisaMemoryChunkHeader))
+#define PISA_MEMORY_SLAB_HEADER_SIZE MAXALIGN(sizeof(PisaMemorySlab))
+
+#define PisaMemoryChunkGetHeader(pointer) \
+    ((PisaMemoryChunkHeader *) ((char *) (pointer) - PISA_MEMORY_CHUNK_HEADER_SIZE))
+
+/* Pools of this backend, and the one of query structures */
+static dlist_head PisaMemoryPools = DLIST_STATIC_INIT(PisaMemoryPools);
+static PisaMemoryPool *PisaQueryMemoryPool = NULL;
+static bool transaction_callback_registered = false;
+
+static PisaMemoryClassStats PisaMemoryClassUsage[PISA_MEMORY_NUM_CLASSES + 1];
+static int64 PisaMemoryLiveBytes = 0;
+static int64 PisaMemoryPeakBytes = 0;
+static TimestampTz PisaMemoryStatsReset = 0;
+
+static PisaMemorySlab *AddPisaMemorySlab(PisaMemoryPool *pool, int size_class);
+static void RemovePisaMemorySlab(PisaMemorySlab *slab);
+static void RecordPisaMemoryAllocation(PisaMemoryPool *pool, int size_class, Size bytes);
+static void RecordPisaMemoryFree(PisaMemoryPool *pool, int size_class, Size bytes);
+static bool PisaMemoryPoolIsInUse(PisaMemoryPool *pool);
+static void PisaMemoryPoolResetCallback(void *arg);
+static void PisaMemoryTransactionCallback(XactEvent event, void *arg);
+
+PG_FUNCTION_INFO_V1(documentdb_get_pisa_memory_stats);
+PG_FUNCTION_INFO_V1(documentdb_optimize_pisa_memory);
+PG_FUNCTION_INFO_V1(documentdb_defragment_pisa_memory);
+PG_FUNCTION_INFO_V1(documentdb_gc_pisa_memory);
+
+
+/*
+ * Creates a pool in a new child context of 'parent'. The pool is freed
+ * with its context, whether by DestroyMemoryPool or by a reset.
+ */
+PisaMemoryPool *
+CreateMemoryPool(MemoryContext parent, const char *name)
+{
+    MemoryContext context;
+    PisaMemoryPool *pool;
+    int size_class;
+
+    context = AllocSetContextCreate(parent, "PISA Memory Pool", ALLOCSET_DEFAULT_SIZES);
+    MemoryContextSetIdentifier(context, MemoryContextStrdup(context, name));
+
+    pool = (PisaMemoryPool *) MemoryContextAllocZero(context, sizeof(PisaMemoryPool));
+    pool->context = context;
+    for (size_class = 0; size_class < PISA_MEMORY_NUM_CLASSES; size_class++)
+    {
+        dlist_init(&pool->partial_slabs[size_class]);
+        pool->retained_slabs[size_class] = 1;
+    }
+
+    pool->reset_callback.func = PisaMemoryPoolResetCallback;
+    pool->reset_callback.arg = pool;
+    MemoryContextRegisterResetCallback(context, &pool->reset_callback);
+
+    dlist_push_tail(&PisaMemoryPools, &pool->node);
+
+    return pool;
+}
+
+
+void
+DestroyMemoryPool(PisaMemoryPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    MemoryContextDelete(pool->context);
+}
+
+
+void *
+AllocateFromPool(PisaMemoryPool *pool, Size size)
+{
+    int size_class = GetPisaMemorySizeClass(size);
+    PisaMemoryChunkHeader *header;
+    PisaMemorySlab *slab;
+    char *chunk;
+
+    if (size_class == PISA_MEMORY_LARGE_CLASS)
+    {
+        header = (PisaMemoryChunkHeader *) MemoryContextAlloc(pool->context,
+                                                              PISA_MEMORY_CHUNK_HEADER_SIZE +
+                                                              size);
+        header->owner = pool;
+        header->size_class = PISA_MEMORY_LARGE_CLASS;
+        header->size = (uint32) size;
+
+        RecordPisaMemoryAllocation(pool, size_class, size);
+        PisaMemoryClassUsage[size_class].reserved_bytes += size;
+
+        return (char *) header + PISA_MEMORY_CHUNK_HEADER_SIZE;
+    }
+
+    if (dlist_is_empty(&pool->partial_slabs[size_class]))
+        AddPisaMemorySlab(pool, size_class);
+
+    slab = dlist_head_element(PisaMemorySlab, node, &pool->partial_slabs[size_class]);
+    if (slab->free_chunks != NULL)
+    {
+        chunk = slab->free_chunks;
+        slab->free_chunks = *(char **) chunk;
+    }
+    else
+    {
+        Size chunk_size = GetPisaMemoryChunkSize(size_class);
+
+        header = (PisaMemoryChunkHeader *) (slab->chunks + slab->carved *
+                                            (PISA_MEMORY_CHUNK_HEADER_SIZE + chunk_size));
+        header->owner = slab;
+        header->size_class = size_class;
+        header->size = (uint32) chunk_size;
+        chunk = (char *) header + PISA_MEMORY_CHUNK_HEADER_SIZE;
+        slab->carved++;
+    }
+
+    slab->live++;
+    if (slab->live == slab->capacity)
+        dlist_delete(&slab->node);
+
+    RecordPisaMemoryAllocation(pool, size_class, GetPisaMemoryChunkSize(size_class));
+
+    return chunk;
+}
+
+
+/* Returns a chunk of any pool to the pool it came from */
+void
+FreeToPool(void *pointer)
+{
+    PisaMemoryChunkHeader *header = PisaMemoryChunkGetHeader(pointer);
+    PisaMemorySlab *slab;
+    PisaMemoryPool *pool;
+    int size_class = header->size_class;
+
+    if (size_class == PISA_MEMORY_LARGE_CLASS)
+    {
+        pool = (PisaMemoryPool *) header->owner;
+
+        RecordPisaMemoryFree(pool, size_class, header->size);
+        PisaMemoryClassUsage[size_class].reserved_bytes -= header->size;
+        pfree(header);
+        return;
+    }
+
+    slab = (PisaMemorySlab *) header->owner;
+    pool = slab->pool;
+
+    if (slab->live == slab->capacity)
+        dlist_push_head(&pool->partial_slabs[size_class], &slab->node);
+
+    *(char **) pointer = slab->free_chunks;
+    slab->free_chunks = (char *) pointer;
+    slab->live--;
+
+    RecordPisaMemoryFree(pool, size_class, header->size);
+
+    if (slab->live == 0 && pool->num_slabs[size_class] > pool->retained_slabs[size_class])
+        RemovePisaMemorySlab(slab);
+}
+
+
+/*
+ * Returns the slabs that have no live chunk to the pool's context, the
+ * ones retained for reuse included. Returns the bytes released.
+ */
+Size
+CompactMemoryPool(PisaMemoryPool *pool)
+{
+    Size released = 0;
+    int size_class;
+
+    for (size_class = 0; size_class < PISA_MEMORY_NUM_CLASSES; size_class++)
+    {
+        dlist_mutable_iter iter;
+
+        dlist_foreach_modify(iter, &pool->partial_slabs[size_class])
+        {
+            PisaMemorySlab *slab = dlist_container(PisaMemorySlab, node, iter.cur);
+
+            if (slab->live == 0)
+            {
+                RemovePisaMemorySlab(slab);
+                released += PISA_MEMORY_SLAB_SIZE;
+            }
+        }
+
+        pool->retained_slabs[size_class] = 1;
+    }
+
+    return released;
+}
+
+
+/*
+ * Makes room in 'pool' for 'buffer_count' chunks of 'buffer_size' bytes
+ * and keeps it until the pool is compacted. Returns the bytes reserved.
+ */
+Size
+PreallocateMemoryBuffers(PisaMemoryPool *pool, Size buffer_size, int buffer_count)
+{
+    int size_class = GetPisaMemorySizeClass(buffer_size);
+    Size chunk_stride;
+    int chunks_per_slab;
+    int slabs_needed;
+    Size reserved = 0;
+
+    if (size_class == PISA_MEMORY_LARGE_CLASS || buffer_count <= 0)
+        return 0;
+
+    chunk_stride = PISA_MEMORY_CHUNK_HEADER_SIZE + GetPisaMemoryChunkSize(size_class);
+    chunks_per_slab = (PISA_MEMORY_SLAB_SIZE - PISA_MEMORY_SLAB_HEADER_SIZE) / chunk_stride;
+    slabs_needed = (buffer_count + chunks_per_slab - 1) / chunks_per_slab;
+
+    pool->retained_slabs[size_class] = Max(pool->retained_slabs[size_class], slabs_needed);
+    while (pool->num_slabs[size_class] < slabs_needed)
+    {
+        AddPisaMemorySlab(pool, size_class);
+        reserved += PISA_MEMORY_SLAB_SIZE;
+    }
+
+    return reserved;
+}
+
+
+/*
+ * Size class of a request: the powers of two from 32 bytes and their
+ * midpoints, PISA_MEMORY_LARGE_CLASS above PISA_MEMORY_MAX_CHUNK_SIZE.
+ */
+int
+GetPisaMemorySizeClass(Size size)
+{
+    int bit;
+
+    if (size <= PISA_MEMORY_MIN_CHUNK_SIZE)
+        return 0;
+
+    if (size > PISA_MEMORY_MAX_CHUNK_SIZE)
+        return PISA_MEMORY_LARGE_CLASS;
+
+    /* size is in (2^bit, 2^(bit + 1)], with 3 * 2^(bit - 1) halfway */
+    bit = pg_leftmost_one_pos32((uint32) size - 1);
+    if (size <= ((Size) 3 << (bit - 1)))
+        return 2 * (bit - 5) + 1;
+
+    return 2 * (bit - 5) + 2;
+}
+
+
+Size
+GetPisaMemoryChunkSize(int size_class)
+{
+    if (size_class % 2 == 0)
+        return (Size) PISA_MEMORY_MIN_CHUNK_SIZE << (size_class / 2);
+
+    return (Size) (PISA_MEMORY_MIN_CHUNK_SIZE * 3 / 2) << (size_class / 2);
+}
+
+
+/*
+ * Allocation of query structures. They come from a pool that lives as
+ * long as the backend, so its slabs serve query after query; chunks still
+ * live at the end of a transaction, e.g. after an error, are released by
+ * dropping the whole pool.
+ */
+void *
+PisaMemoryAlloc(Size size)
+{
+    return AllocateFromPool(GetPisaQueryMemoryPool(), size);
+}
+
+
+void *
+PisaMemoryAllocZero(Size size)
+{
+    void *pointer = PisaMemoryAlloc(size);
+
+    memset(pointer, 0, size);
+    return pointer;
+}
+
+
+void
+PisaMemoryFree(void *pointer)
+{
+    if (pointer != NULL)
+        FreeToPool(pointer);
+}
+
+
+PisaMemoryPool *
+GetPisaQueryMemoryPool(void)
+{
+    if (PisaQueryMemoryPool == NULL)
+    {
+        if (!transaction_callback_registered)
+        {
+            RegisterXactCallback(PisaMemoryTransactionCallback, NULL);
+            transaction_callback_registered = true;
+        }
+
+        PisaQueryMemoryPool = CreateMemoryPool(TopMemoryContext, "PISA query structures");
+    }
+
+    return PisaQueryMemoryPool;
+}
+
+
+/* Compacts every pool of the backend; returns the bytes released */
+Size
+DefragmentMemoryPools(void)
+{
+    Size released = 0;
+    dlist_iter iter;
+
+    dlist_foreach(iter, &PisaMemoryPools)
+    {
+        released += CompactMemoryPool(dlist_container(PisaMemoryPool, node, iter.cur));
+    }
+
+    return released;
+}
+
+
+/*
+ * Compacts every pool and drops the pool of query structures if nothing
+ * is allocated from it. Returns the bytes released.
+ */
+Size
+GarbageCollectMemory(void)
+{
+    Size released = DefragmentMemoryPools();
+
+    if (PisaQueryMemoryPool != NULL && !PisaMemoryPoolIsInUse(PisaQueryMemoryPool))
+    {
+        released += MemoryContextMemAllocated(PisaQueryMemoryPool->context, false);
+        DestroyMemoryPool(PisaQueryMemoryPool);
+    }
+
+    return released;
+}
+
+
+void
+GetMemoryStatistics(PisaMemoryStats *stats)
+{
+    dlist_iter iter;
+    int size_class;
+
+    memset(stats, 0, sizeof(PisaMemoryStats));
+    memcpy(stats->classes, PisaMemoryClassUsage, sizeof(PisaMemoryClassUsage));
+
+    for (size_class = 0; size_class <= PISA_MEMORY_LARGE_CLASS; size_class++)
+        stats->reserved_bytes += PisaMemoryClassUsage[size_class].reserved_bytes;
+
+    dlist_foreach(iter, &PisaMemoryPools)
+        stats->pool_count++;
+
+    stats->live_bytes = PisaMemoryLiveBytes;
+    stats->peak_bytes = PisaMemoryPeakBytes;
+    stats->last_reset = PisaMemoryStatsReset;
+}
+
+
+/* Restarts the allocation counts and the peaks from the current usage */
+void
+ResetMemoryStatistics(void)
+{
+    int size_class;
+
+    for (size_class = 0; size_class <= PISA_MEMORY_LARGE_CLASS; size_class++)
+    {
+        PisaMemoryClassUsage[size_class].allocations = 0;
+        PisaMemoryClassUsage[size_class].peak_bytes = PisaMemoryClassUsage[size_class].live_bytes;
+    }
+
+    PisaMemoryPeakBytes = PisaMemoryLiveBytes;
+    PisaMemoryStatsReset = GetCurrentTimestamp();
+}
+
+
+static PisaMemorySlab *
+AddPisaMemorySlab(PisaMemoryPool *pool, int size_class)
+{
+    PisaMemorySlab *slab;
+    Size chunk_stride = PISA_MEMORY_CHUNK_HEADER_SIZE + GetPisaMemoryChunkSize(size_class);
+
+    slab = (PisaMemorySlab *) MemoryContextAlloc(pool->context, PISA_MEMORY_SLAB_SIZE);
+    slab->pool = pool;
+    slab->size_class = size_class;
+    slab->capacity = (PISA_MEMORY_SLAB_SIZE - PISA_MEMORY_SLAB_HEADER_SIZE) / chunk_stride;
+    slab->carved = 0;
+    slab->live = 0;
+    slab->free_chunks = NULL;
+    slab->chunks = (char *) slab + PISA_MEMORY_SLAB_HEADER_SIZE;
+
+    dlist_push_head(&pool->partial_slabs[size_class], &slab->node);
+    pool->num_slabs[size_class]++;
+    PisaMemoryClassUsage[size_class].reserved_bytes += PISA_MEMORY_SLAB_SIZE;
+
+    return slab;
+}
+
+
+/* Frees an empty slab, which is necessarily on the partial list */
+static void
+RemovePisaMemorySlab(PisaMemorySlab *slab)
+{
+    PisaMemoryPool *pool = slab->pool;
+
+    Assert(slab->live == 0);
+
+    dlist_delete(&slab->node);
+    pool->num_slabs[slab->size_class]--;
+    PisaMemoryClassUsage[slab->size_class].reserved_bytes -= PISA_MEMORY_SLAB_SIZE;
+    pfree(slab);
+}
+
+
+static void
+RecordPisaMemoryAllocation(PisaMemoryPool *pool, int size_class, Size bytes)
+{
+    PisaMemoryClassStats *usage = &PisaMemoryClassUsage[size_class];
+
+    pool->live_chunks[size_class]++;
+    pool->live_bytes[size_class] += bytes;
+
+    usage->allocations++;
+    usage->live_chunks++;
+    usage->live_bytes += bytes;
+    usage->peak_bytes = Max(usage->peak_bytes, usage->live_bytes);
+
+    PisaMemoryLiveBytes += bytes;
+    PisaMemoryPeakBytes = Max(PisaMemoryPeakBytes, PisaMemoryLiveBytes);
+}
+
+
+static void
+RecordPisaMemoryFree(PisaMemoryPool *pool, int size_class, Size bytes)
+{
+    PisaMemoryClassStats *usage = &PisaMemoryClassUsage[size_class];
+
+    pool->live_chunks[size_class]--;
+    pool->live_bytes[size_class] -= bytes;
+
+    usage->live_chunks--;
+    usage->live_bytes -= bytes;
+
+    PisaMemoryLiveBytes -= bytes;
+}
+
+
+static bool
+PisaMemoryPoolIsInUse(PisaMemoryPool *pool)
+{
+    int size_class;
+
+    for (size_class = 0; size_class <= PISA_MEMORY_LARGE_CLASS; size_class++)
+    {
+        if (pool->live_chunks[size_class] > 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Runs when the context of a pool is reset or deleted, just before the
+ * pool's memory is freed: takes its chunks and slabs out of the counters.
+ */
+static void
+PisaMemoryPoolResetCallback(void *arg)
+{
+    PisaMemoryPool *pool = (PisaMemoryPool *) arg;
+    int size_class;
+
+    for (size_class = 0; size_class <= PISA_MEMORY_LARGE_CLASS; size_class++)
+    {
+        PisaMemoryClassStats *usage = &PisaMemoryClassUsage[size_class];
+
+        usage->live_chunks -= pool->live_chunks[size_class];
+        usage->live_bytes -= pool->live_bytes[size_class];
+        PisaMemoryLiveBytes -= pool->live_bytes[size_class];
+
+        if (size_class == PISA_MEMORY_LARGE_CLASS)
+            usage->reserved_bytes -= pool->live_bytes[size_class];
+        else
+            usage->reserved_bytes -= (int64) pool->num_slabs[size_class] *
+                                     PISA_MEMORY_SLAB_SIZE;
+    }
+
+    dlist_delete(&pool->node);
+
+    if (pool == PisaQueryMemoryPool)
+        PisaQueryMemoryPool = NULL;
+}
+
+
+/*
+ * Query structures do not outlive their transaction. Any still allocated
+ * at its end belong to a query that failed, so the pool is dropped
+ * instead of trusting the free lists.
+ */
+static void
+PisaMemoryTransactionCallback(XactEvent event, void *arg)
+{
+    switch (event)
+    {
+        case XACT_EVENT_COMMIT:
+        case XACT_EVENT_PARALLEL_COMMIT:
+        case XACT_EVENT_PREPARE:
+        case XACT_EVENT_ABORT:
+        case XACT_EVENT_PARALLEL_ABORT:
+        {
+            if (PisaQueryMemoryPool != NULL && PisaMemoryPoolIsInUse(PisaQueryMemoryPool))
+            {
+                elog(DEBUG1, "Releasing PISA query structures left at transaction end");
+                DestroyMemoryPool(PisaQueryMemoryPool);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+
+/*
+ * Reports the usage of every size class by this backend, one row per
+ * class; the last row, with a NULL chunk size, covers large chunks.
+ */
+Datum
+documentdb_get_pisa_memory_stats(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    PisaMemoryStats stats;
+    int size_class;
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    GetMemoryStatistics(&stats);
+
+    for (size_class = 0; size_class <= PISA_MEMORY_LARGE_CLASS; size_class++)
+    {
+        PisaMemoryClassStats *usage = &stats.classes[size_class];
+        Datum values[6];
+        bool nulls[6] = { false, false, false, false, false, false };
+
+        if (size_class == PISA_MEMORY_LARGE_CLASS)
+            nulls[0] = true;
+        else
+            values[0] = Int32GetDatum((int32) GetPisaMemoryChunkSize(size_class));
+        values[1] = Int64GetDatum(usage->allocations);
+        values[2] = Int64GetDatum(usage->live_chunks);
+        values[3] = Int64GetDatum(usage->live_bytes);
+        values[4] = Int64GetDatum(usage->peak_bytes);
+        values[5] = Int64GetDatum(usage->reserved_bytes);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    PG_RETURN_VOID();
+}
+
+
+/* Reserves buffers of a given size in this backend's query pool */
+Datum
+documentdb_optimize_pisa_memory(PG_FUNCTION_ARGS)
+{
+    int32 buffer_size = PG_GETARG_INT32(0);
+    int32 buffer_count = PG_GETARG_INT32(1);
+
+    if (buffer_size <= 0 || buffer_count <= 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("buffer_size and buffer_count must be positive")));
+
+    PG_RETURN_INT64((int64) PreallocateMemoryBuffers(GetPisaQueryMemoryPool(),
+                                                     buffer_size, buffer_count));
+}
+
+
+Datum
+documentdb_defragment_pisa_memory(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_INT64((int64) DefragmentMemoryPools());
+}
+
+
+Datum
+documentdb_gc_pisa_memory(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_INT64((int64) GarbageCollectMemory());
+}
@@ -13,6 +13,7 @@
 
 #include "pisa_integration/performance_monitor.h"
 #include "pisa_integration/pisa_integration.h"
+#include "pisa_integration/query_cache.h"
 
 static PisaPerformanceMetric *performance_metrics = NULL;
 static HTAB *query_timers_hash = NULL;
@@ -369,20 +370,7 @@ OptimizeMemoryUsage(void)
     MemoryContextResetAndDeleteChildren(CacheMemoryContext);
     freed_bytes += 1024 * 1024;
     
-    if (query_cache_hash != NULL)
-    {
-        HASH_SEQ_STATUS status;
-        void *entry;
-        int evicted = 0;
-        
-        hash_seq_init(&status, query_cache_hash);
-        while ((entry = hash_seq_search(&status)) != NULL && evicted < 100)
-        {
-            hash_search(query_cache_hash, entry, HASH_REMOVE, NULL);
-            evicted++;
-            freed_bytes += 4096;
-        }
-    }
+    freed_bytes += EvictPisaQueryCacheEntries(100);
     
     MemoryContextSwitchTo(old_context);
     
@@ -1,18 +1,24 @@
 #include "postgres.h"
 #include "fmgr.h"
+#include "common/file_utils.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
+#include "storage/fd.h"
 #include "storage/ipc.h"
 #include "miscadmin.h"
 
 #include "pisa_integration/pisa_integration.h"
 #include "pisa_integration/data_bridge.h"
 #include "pisa_integration/index_sync.h"
+#include "pisa_integration/query_cache.h"
 #include "pisa_integration/query_router.h"
 
 bool pisa_integration_enabled = false;
 char *pisa_index_base_path = NULL;
 int pisa_default_compression = PISA_COMPRESSION_BLOCK_SIMDBP;
+int pisa_reordering_workers = 4;
+int pisa_index_build_workers = 4;
+int pisa_query_cache_size_mb = PISA_CACHE_DEFAULT_SIZE_MB;
 
 static bool pisa_initialized = false;
 
@@ -67,9 +73,6 @@ bool
 CreatePisaIndex(const char *database_name, const char *collection_name, 
                 PisaCompressionType compression_type)
 {
-    PisaCollection *collection;
-    List *documents;
-    char index_path[MAXPGPATH];
     bool success = false;
 
     if (!pisa_integration_enabled)
@@ -80,20 +83,10 @@ CreatePisaIndex(const char *database_name, const char *collection_name,
 
     elog(LOG, "Creating PISA index for collection %s.%s", database_name, collection_name);
 
-    snprintf(index_path, MAXPGPATH, "%s/%s_%s", 
-             pisa_index_base_path, database_name, collection_name);
-
     PG_TRY();
     {
-        documents = ExportCollectionToPisa(database_name, collection_name, PISA_EXPORT_FULL);
-        
-        if (documents == NIL)
-        {
-            elog(WARNING, "No documents found in collection %s.%s", database_name, collection_name);
-            return false;
-        }
-
-        success = WritePisaDocumentList(documents, index_path);
+        success = BuildCompletePisaIndex(database_name, collection_name,
+                                         pisa_index_base_path, compression_type);
         
         if (success)
         {
@@ -145,6 +138,7 @@ DropPisaIndex(const char *database_name, const char *collection_name)
     elog(LOG, "Dropping PISA index for collection %s.%s", database_name, collection_name);
 
     DisableIndexSync(database_name, collection_name);
+    InvalidatePisaQueryCache(database_name, collection_name);
 
     snprintf(index_path, MAXPGPATH, "%s/%s_%s", 
              pisa_index_base_path, database_name, collection_name);
@@ -231,4 +225,70 @@ RegisterPisaConfigurationParameters(void)
                            NULL,
                            NULL,
                            NULL);
+
+    DefineCustomIntVariable("documentdb.pisa_reordering_workers",
+                           "Parallel workers used by document reordering",
+                           "Number of parallel workers that bisect subtrees during recursive graph bisection, 0 runs it in the calling process",
+                           &pisa_reordering_workers,
+                           4,
+                           0,
+                           64,
+                           PGC_SIGHUP,
+                           0,
+                           NULL,
+                           NULL,
+                           NULL);
+
+    DefineCustomIntVariable("documentdb.pisa_index_build_workers",
+                           "Parallel workers used to build PISA inverted indexes",
+                           "Number of parallel workers that invert docid ranges of the forward index, 0 builds the index in the calling process",
+                           &pisa_index_build_workers,
+                           4,
+                           0,
+                           64,
+                           PGC_SIGHUP,
+                           0,
+                           NULL,
+                           NULL,
+                           NULL);
+
+    DefineCustomIntVariable("documentdb.pisa_query_cache_size_mb",
+                           "Shared memory used by the PISA query result cache",
+                           "Size in megabytes of the query result cache shared by all backends, 0 disables the cache. Allocated at server start when PISA integration is enabled",
+                           &pisa_query_cache_size_mb,
+                           PISA_CACHE_DEFAULT_SIZE_MB,
+                           0,
+                           1024 * 1024,
+                           PGC_POSTMASTER,
+                           GUC_UNIT_MB,
+                           NULL,
+                           NULL,
+                           NULL);
+}
+
+
+/*
+ * Creates an empty directory for the indexes written by a test function,
+ * in the temporary files directory of the cluster so that it does not
+ * outlive a crash. Every call returns a new directory: indexes, segment
+ * sets and their readers are cached by path.
+ */
+char *
+CreatePisaTestDirectory(const char *name)
+{
+    static uint32 test_directory_counter = 0;
+    char *directory;
+
+    directory = psprintf("base/%s/%s%d.pisa_%s_%u", PG_TEMP_FILES_DIR, PG_TEMP_FILE_PREFIX,
+                         MyProcPid, name, test_directory_counter++);
+    PathNameCreateTemporaryDir("base/" PG_TEMP_FILES_DIR, directory);
+
+    return directory;
+}
+
+
+void
+RemovePisaTestDirectory(const char *directory)
+{
+    PathNameDeleteTemporaryDir(directory);
 }
@@ -4,424 +4,713 @@
 #include "utils/builtins.h"
 #include "utils/memutils.h"
 #include "utils/timestamp.h"
+#include "common/hashfn.h"
+#include "port/atomics.h"
 #include "storage/lwlock.h"
 #include "storage/shmem.h"
-#include "access/hash.h"
 #include "miscadmin.h"
-#include "postmaster/bgworker.h"
 
+#include "io/bson_hash.h"
 #include "pisa_integration/query_cache.h"
 #include "pisa_integration/pisa_integration.h"
 
-static HTAB *query_cache_hash = NULL;
-static PisaCacheStats *cache_stats = NULL;
-static LWLock *cache_lock = NULL;
-static bool cache_enabled = true;
-static int cache_max_entries = PISA_CACHE_MAX_ENTRIES;
-static int cache_default_ttl = PISA_CACHE_DEFAULT_TTL;
+#define PISA_CACHE_END (-1)
+
+/* Shared hash table entry of a cached result */
+typedef struct PisaCacheEntry
+{
+    PisaQueryCacheKey key;      /* hash key */
+    int32 slot;                 /* position in the CLOCK ring */
+    int32 first_chunk;
+    uint32 result_size;
+    uint32 generation;          /* of the collection when cached */
+    TimestampTz created_at;
+    int ttl_seconds;
+} PisaCacheEntry;
+
+/* Position of an entry in the CLOCK ring */
+typedef struct PisaCacheSlot
+{
+    PisaQueryCacheKey key;
+    bool used;
+    int32 next_free;
+    pg_atomic_uint32 referenced; /* set by lookups under the shared lock */
+} PisaCacheSlot;
+
+/*
+ * Cache shared by all backends, sized by documentdb.pisa_query_cache_size_mb.
+ * Results are copied into chains of PISA_CACHE_CHUNK_SIZE chunks so that
+ * the byte budget is never exceeded and never fragments; each entry also
+ * takes one slot of the CLOCK ring, which has one slot per chunk.
+ *
+ * Writes to a collection bump its invalidation counter; entries cached
+ * under an older counter are misses and the first eviction victims.
+ */
+typedef struct PisaQueryCacheShared
+{
+    int tranche_id;
+    char *tranche_name;
+    LWLock lock;
+
+    int32 num_chunks;
+    int32 num_entries;
+    int32 free_chunks;
+    int32 free_chunk_head;
+    int32 free_slot_head;
+    int32 clock_hand;
+    int64 total_size_bytes;
+    TimestampTz last_reset;
+
+    pg_atomic_uint64 total_queries;
+    pg_atomic_uint64 cache_hits;
+    pg_atomic_uint64 cache_evictions;
+    pg_atomic_uint64 cache_invalidations;
+    pg_atomic_uint32 generations[PISA_CACHE_INVALIDATION_SLOTS];
+} PisaQueryCacheShared;
+
+static PisaQueryCacheShared *PisaQueryCache = NULL;
+static HTAB *PisaQueryCacheHash = NULL;
+static PisaCacheSlot *PisaQueryCacheSlots = NULL;
+static int32 *PisaQueryCacheChunkLinks = NULL;
+static char *PisaQueryCacheChunks = NULL;
+
+static int32 GetPisaQueryCacheChunkCount(void);
+static uint64 HashPisaCacheCollection(const char *index_name);
+static pg_atomic_uint32 *GetPisaCacheGenerationCounter(uint64 collection_hash);
+static bool IsPisaCacheEntryValid(PisaCacheEntry *entry, TimestampTz now);
+static void RemovePisaCacheEntry(PisaCacheEntry *entry);
+static void EvictPisaCacheClockVictim(void);
+static void PushPisaCacheStatistic(JsonbParseState **state, const char *name,
+                                   Numeric value);
+
+PG_FUNCTION_INFO_V1(documentdb_cache_pisa_query);
+PG_FUNCTION_INFO_V1(documentdb_get_cached_pisa_query);
+PG_FUNCTION_INFO_V1(documentdb_invalidate_pisa_cache);
+PG_FUNCTION_INFO_V1(documentdb_get_pisa_cache_stats);
+PG_FUNCTION_INFO_V1(documentdb_reset_pisa_cache);
+PG_FUNCTION_INFO_V1(documentdb_pisa_cache_key_for_test);
+
+
+/*
+ * Shared memory of the cache; none unless PISA integration is enabled
+ * at server start.
+ */
+Size
+PisaQueryCacheShmemSize(void)
+{
+    int32 num_chunks = GetPisaQueryCacheChunkCount();
+    Size size;
+
+    if (num_chunks == 0)
+        return 0;
+
+    size = MAXALIGN(sizeof(PisaQueryCacheShared));
+    size = add_size(size, MAXALIGN(mul_size(num_chunks, sizeof(PisaCacheSlot))));
+    size = add_size(size, MAXALIGN(mul_size(num_chunks, sizeof(int32))));
+    size = add_size(size, mul_size(num_chunks, PISA_CACHE_CHUNK_SIZE));
+    size = add_size(size, hash_estimate_size(num_chunks, sizeof(PisaCacheEntry)));
+
+    return size;
+}
+
 
 void
-InitializePisaQueryCache(void)
+InitializePisaQueryCacheShmem(void)
 {
+    int32 num_chunks = GetPisaQueryCacheChunkCount();
     HASHCTL hash_ctl;
-    
-    if (query_cache_hash != NULL)
+    char *memory;
+    bool found = false;
+    int32 i;
+
+    if (num_chunks == 0)
         return;
-    
-    MemSet(&hash_ctl, 0, sizeof(hash_ctl));
-    hash_ctl.keysize = PISA_CACHE_KEY_SIZE;
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    memory = (char *) ShmemInitStruct("PISA Query Cache",
+                                      PisaQueryCacheShmemSize() -
+                                      hash_estimate_size(num_chunks,
+                                                         sizeof(PisaCacheEntry)),
+                                      &found);
+
+    PisaQueryCache = (PisaQueryCacheShared *) memory;
+    memory += MAXALIGN(sizeof(PisaQueryCacheShared));
+    PisaQueryCacheSlots = (PisaCacheSlot *) memory;
+    memory += MAXALIGN(mul_size(num_chunks, sizeof(PisaCacheSlot)));
+    PisaQueryCacheChunkLinks = (int32 *) memory;
+    memory += MAXALIGN(mul_size(num_chunks, sizeof(int32)));
+    PisaQueryCacheChunks = memory;
+
+    memset(&hash_ctl, 0, sizeof(hash_ctl));
+    hash_ctl.keysize = sizeof(PisaQueryCacheKey);
     hash_ctl.entrysize = sizeof(PisaCacheEntry);
-    hash_ctl.hcxt = TopMemoryContext;
-    
-    query_cache_hash = hash_create("PISA Query Cache",
-                                  cache_max_entries,
-                                  &hash_ctl,
-                                  HASH_ELEM | HASH_CONTEXT);
-    
-    cache_stats = (PisaCacheStats *) MemoryContextAllocZero(TopMemoryContext, 
-                                                           sizeof(PisaCacheStats));
-    cache_stats->last_reset = GetCurrentTimestamp();
-    
-    cache_lock = &(GetNamedLWLockTranche("pisa_query_cache"))->lock;
-    
-    elog(LOG, "PISA query cache initialized with %d max entries", cache_max_entries);
+    PisaQueryCacheHash = ShmemInitHash("PISA Query Cache Entries", num_chunks, num_chunks,
+                                       &hash_ctl, HASH_ELEM | HASH_BLOBS);
+
+    if (!found)
+    {
+        PisaQueryCache->tranche_id = LWLockNewTrancheId();
+        PisaQueryCache->tranche_name = "PISA Query Cache Tranche";
+        LWLockRegisterTranche(PisaQueryCache->tranche_id, PisaQueryCache->tranche_name);
+        LWLockInitialize(&PisaQueryCache->lock, PisaQueryCache->tranche_id);
+
+        PisaQueryCache->num_chunks = num_chunks;
+        PisaQueryCache->num_entries = 0;
+        PisaQueryCache->free_chunks = num_chunks;
+        PisaQueryCache->free_chunk_head = 0;
+        PisaQueryCache->free_slot_head = 0;
+        PisaQueryCache->clock_hand = 0;
+        PisaQueryCache->total_size_bytes = 0;
+        PisaQueryCache->last_reset = GetCurrentTimestamp();
+
+        pg_atomic_init_u64(&PisaQueryCache->total_queries, 0);
+        pg_atomic_init_u64(&PisaQueryCache->cache_hits, 0);
+        pg_atomic_init_u64(&PisaQueryCache->cache_evictions, 0);
+        pg_atomic_init_u64(&PisaQueryCache->cache_invalidations, 0);
+        for (i = 0; i < PISA_CACHE_INVALIDATION_SLOTS; i++)
+            pg_atomic_init_u32(&PisaQueryCache->generations[i], 0);
+
+        for (i = 0; i < num_chunks; i++)
+        {
+            PisaQueryCacheChunkLinks[i] = i + 1 < num_chunks ? i + 1 : PISA_CACHE_END;
+            PisaQueryCacheSlots[i].used = false;
+            PisaQueryCacheSlots[i].next_free = i + 1 < num_chunks ? i + 1 : PISA_CACHE_END;
+            pg_atomic_init_u32(&PisaQueryCacheSlots[i].referenced, 0);
+        }
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+
+    elog(DEBUG1, "PISA query cache initialized with %d chunks of %d bytes", num_chunks,
+         PISA_CACHE_CHUNK_SIZE);
 }
 
+
+/* The cache lives in shared memory set up at server start */
+void
+InitializePisaQueryCache(void)
+{
+    if (PisaQueryCache == NULL)
+        elog(DEBUG1, "PISA query cache is not configured");
+}
+
+
 void
 ShutdownPisaQueryCache(void)
 {
-    if (query_cache_hash != NULL)
+    elog(LOG, "PISA query cache shutdown completed");
+}
+
+
+/*
+ * Computes the cache key of a query. The filter and the options are
+ * hashed canonically, so the order of their fields does not matter
+ * except where it changes the query (e.g. sort specifications).
+ */
+void
+GeneratePisaCacheKey(PisaQueryCacheKey *key, const char *database_name,
+                     const char *collection_name, const pgbson *filter,
+                     const pgbson *options)
+{
+    char index_name[NAMEDATALEN * 2 + 1];
+    bson_iter_t iter;
+
+    memset(key, 0, sizeof(PisaQueryCacheKey));
+
+    snprintf(index_name, sizeof(index_name), "%s_%s", database_name, collection_name);
+    key->collection_hash = HashPisaCacheCollection(index_name);
+
+    if (filter != NULL)
     {
-        hash_destroy(query_cache_hash);
-        query_cache_hash = NULL;
+        PgbsonInitIterator(filter, &iter);
+        key->filter_hash = HashBsonQueryFilterExtended(&iter, 0);
     }
-    
-    if (cache_stats != NULL)
+
+    if (options != NULL)
     {
-        pfree(cache_stats);
-        cache_stats = NULL;
+        PgbsonInitIterator(options, &iter);
+        key->options_hash = HashBsonQueryFilterExtended(&iter, 0);
     }
-    
-    elog(LOG, "PISA query cache shutdown completed");
 }
 
-char *
-GenerateCacheKey(const char *database_name, const char *collection_name, 
-                Jsonb *query, Jsonb *options)
+
+/*
+ * Invalidation generation of the collection of 'key'. Callers read it
+ * before running the query and pass it to CacheQuery, which drops the
+ * result if the collection was written to in between.
+ */
+uint32
+GetPisaQueryCacheGeneration(const PisaQueryCacheKey *key)
 {
-    char *query_str = JsonbToCString(NULL, &query->root, VARSIZE(query));
-    char *options_str = options ? JsonbToCString(NULL, &options->root, VARSIZE(options)) : "";
-    
-    uint32 hash_value = DatumGetUInt32(hash_any((const unsigned char *) query_str, 
-                                               strlen(query_str)));
-    
-    char *cache_key = psprintf("%s.%s.%u.%s", 
-                              database_name, 
-                              collection_name, 
-                              hash_value,
-                              options_str);
-    
-    if (strlen(cache_key) >= PISA_CACHE_KEY_SIZE)
-    {
-        cache_key[PISA_CACHE_KEY_SIZE - 1] = '\0';
-    }
-    
-    return cache_key;
+    if (PisaQueryCache == NULL)
+        return 0;
+
+    return pg_atomic_read_u32(GetPisaCacheGenerationCounter(key->collection_hash));
 }
 
+
+/*
+ * Stores a copy of 'result' under 'key', evicting entries with CLOCK
+ * until it fits. Returns false when the result is not cached.
+ */
 bool
-CacheQuery(const char *cache_key, Jsonb *result, int ttl_seconds)
+CacheQuery(const PisaQueryCacheKey *key, uint32 generation, Jsonb *result,
+           int ttl_seconds)
 {
     PisaCacheEntry *entry;
+    PisaCacheSlot *slot;
+    uint32 result_size;
+    int32 chunks_needed;
+    int32 *link;
+    uint32 offset;
     bool found;
-    
-    if (!cache_enabled || cache_key == NULL || result == NULL)
+
+    if (PisaQueryCache == NULL || key == NULL || result == NULL)
         return false;
-    
-    LWLockAcquire(cache_lock, LW_EXCLUSIVE);
-    
-    if (hash_get_num_entries(query_cache_hash) >= cache_max_entries)
+
+    result_size = VARSIZE(result);
+    chunks_needed = (int32) ((result_size + PISA_CACHE_CHUNK_SIZE - 1) /
+                             PISA_CACHE_CHUNK_SIZE);
+    if (chunks_needed > PisaQueryCache->num_chunks * PISA_CACHE_MAX_RESULT_FRACTION)
+    {
+        elog(DEBUG1, "PISA query result of %u bytes is too large to cache", result_size);
+        return false;
+    }
+
+    LWLockAcquire(&PisaQueryCache->lock, LW_EXCLUSIVE);
+
+    if (pg_atomic_read_u32(GetPisaCacheGenerationCounter(key->collection_hash)) !=
+        generation)
     {
-        EvictLRUEntries(cache_max_entries / 10);
+        /* The collection changed while the query ran */
+        LWLockRelease(&PisaQueryCache->lock);
+        return false;
     }
-    
-    entry = (PisaCacheEntry *) hash_search(query_cache_hash, 
-                                          cache_key, 
-                                          HASH_ENTER, 
-                                          &found);
-    
+
+    entry = (PisaCacheEntry *) hash_search(PisaQueryCacheHash, key, HASH_FIND, NULL);
     if (entry != NULL)
+        RemovePisaCacheEntry(entry);
+
+    while (PisaQueryCache->num_entries >= PisaQueryCache->num_chunks ||
+           PisaQueryCache->free_chunks < chunks_needed)
+        EvictPisaCacheClockVictim();
+
+    entry = (PisaCacheEntry *) hash_search(PisaQueryCacheHash, key, HASH_ENTER, &found);
+    entry->slot = PisaQueryCache->free_slot_head;
+    entry->result_size = result_size;
+    entry->generation = generation;
+    entry->created_at = GetCurrentTimestamp();
+    entry->ttl_seconds = ttl_seconds > 0 ? ttl_seconds : PISA_CACHE_DEFAULT_TTL;
+
+    slot = &PisaQueryCacheSlots[entry->slot];
+    PisaQueryCache->free_slot_head = slot->next_free;
+    slot->key = *key;
+    slot->used = true;
+    pg_atomic_write_u32(&slot->referenced, 1);
+
+    /* Take the chunks off the free list and fill them */
+    entry->first_chunk = PisaQueryCache->free_chunk_head;
+    link = &entry->first_chunk;
+    for (offset = 0; offset < result_size; offset += PISA_CACHE_CHUNK_SIZE)
     {
-        strncpy(entry->cache_key, cache_key, PISA_CACHE_KEY_SIZE - 1);
-        entry->cache_key[PISA_CACHE_KEY_SIZE - 1] = '\0';
-        
-        entry->query_result = result;
-        entry->created_at = GetCurrentTimestamp();
-        entry->last_accessed = entry->created_at;
-        entry->access_count = 0;
-        entry->ttl_seconds = ttl_seconds > 0 ? ttl_seconds : cache_default_ttl;
-        entry->is_valid = true;
-        entry->result_size_bytes = VARSIZE(result);
-        
-        cache_stats->total_entries++;
-        cache_stats->total_size_bytes += entry->result_size_bytes;
+        int32 chunk = *link;
+
+        memcpy(PisaQueryCacheChunks + (Size) chunk * PISA_CACHE_CHUNK_SIZE,
+               (char *) result + offset, Min(PISA_CACHE_CHUNK_SIZE, result_size - offset));
+        link = &PisaQueryCacheChunkLinks[chunk];
     }
-    
-    LWLockRelease(cache_lock);
-    
-    elog(DEBUG1, "Cached query result for key: %s (TTL: %d seconds)", 
-         cache_key, ttl_seconds);
-    
-    return entry != NULL;
+    PisaQueryCache->free_chunk_head = *link;
+    *link = PISA_CACHE_END;
+
+    PisaQueryCache->free_chunks -= chunks_needed;
+    PisaQueryCache->num_entries++;
+    PisaQueryCache->total_size_bytes += result_size;
+
+    LWLockRelease(&PisaQueryCache->lock);
+
+    return true;
 }
 
+
+/*
+ * Returns a copy of the result cached under 'key', or NULL. Lookups only
+ * take the shared lock; they mark the entry referenced for CLOCK.
+ */
 Jsonb *
-GetCachedQuery(const char *cache_key)
+GetCachedQuery(const PisaQueryCacheKey *key)
 {
     PisaCacheEntry *entry;
     Jsonb *result = NULL;
-    
-    if (!cache_enabled || cache_key == NULL)
+
+    if (PisaQueryCache == NULL || key == NULL)
         return NULL;
-    
-    LWLockAcquire(cache_lock, LW_SHARED);
-    
-    entry = (PisaCacheEntry *) hash_search(query_cache_hash, 
-                                          cache_key, 
-                                          HASH_FIND, 
-                                          NULL);
-    
-    if (entry != NULL && IsCacheEntryValid(entry))
-    {
-        entry->last_accessed = GetCurrentTimestamp();
-        entry->access_count++;
-        result = entry->query_result;
-        
-        UpdateCacheStatistics(true);
-        
-        elog(DEBUG1, "Cache hit for key: %s (access count: %d)", 
-             cache_key, entry->access_count);
-    }
-    else
+
+    pg_atomic_fetch_add_u64(&PisaQueryCache->total_queries, 1);
+
+    LWLockAcquire(&PisaQueryCache->lock, LW_SHARED);
+
+    entry = (PisaCacheEntry *) hash_search(PisaQueryCacheHash, key, HASH_FIND, NULL);
+    if (entry != NULL && IsPisaCacheEntryValid(entry, GetCurrentTimestamp()))
     {
-        UpdateCacheStatistics(false);
-        
-        if (entry != NULL && !IsCacheEntryValid(entry))
-        {
-            elog(DEBUG1, "Cache entry expired for key: %s", cache_key);
-        }
-        else
+        int32 chunk = entry->first_chunk;
+        uint32 offset;
+
+        result = (Jsonb *) palloc(entry->result_size);
+        for (offset = 0; offset < entry->result_size; offset += PISA_CACHE_CHUNK_SIZE)
         {
-            elog(DEBUG1, "Cache miss for key: %s", cache_key);
+            memcpy((char *) result + offset,
+                   PisaQueryCacheChunks + (Size) chunk * PISA_CACHE_CHUNK_SIZE,
+                   Min(PISA_CACHE_CHUNK_SIZE, entry->result_size - offset));
+            chunk = PisaQueryCacheChunkLinks[chunk];
         }
+
+        pg_atomic_write_u32(&PisaQueryCacheSlots[entry->slot].referenced, 1);
+        pg_atomic_fetch_add_u64(&PisaQueryCache->cache_hits, 1);
     }
-    
-    LWLockRelease(cache_lock);
-    
+
+    LWLockRelease(&PisaQueryCache->lock);
+
     return result;
 }
 
+
 bool
-InvalidateCacheEntry(const char *cache_key)
+InvalidateCacheEntry(const PisaQueryCacheKey *key)
 {
     PisaCacheEntry *entry;
-    bool found = false;
-    
-    if (cache_key == NULL)
+
+    if (PisaQueryCache == NULL || key == NULL)
         return false;
-    
-    LWLockAcquire(cache_lock, LW_EXCLUSIVE);
-    
-    entry = (PisaCacheEntry *) hash_search(query_cache_hash, 
-                                          cache_key, 
-                                          HASH_REMOVE, 
-                                          &found);
-    
-    if (found && entry != NULL)
+
+    LWLockAcquire(&PisaQueryCache->lock, LW_EXCLUSIVE);
+
+    entry = (PisaCacheEntry *) hash_search(PisaQueryCacheHash, key, HASH_FIND, NULL);
+    if (entry != NULL)
     {
-        cache_stats->total_entries--;
-        cache_stats->total_size_bytes -= entry->result_size_bytes;
-        cache_stats->cache_evictions++;
+        RemovePisaCacheEntry(entry);
+        pg_atomic_fetch_add_u64(&PisaQueryCache->cache_invalidations, 1);
     }
-    
-    LWLockRelease(cache_lock);
-    
-    elog(DEBUG1, "Invalidated cache entry for key: %s", cache_key);
-    
-    return found;
+
+    LWLockRelease(&PisaQueryCache->lock);
+
+    return entry != NULL;
 }
 
-bool
-InvalidateCacheByPattern(const char *pattern)
+
+/*
+ * Invalidates every result cached for a collection. This only bumps a
+ * counter, so it is cheap enough for every write.
+ */
+void
+InvalidatePisaQueryCache(const char *database_name, const char *collection_name)
 {
-    HASH_SEQ_STATUS status;
-    PisaCacheEntry *entry;
-    List *keys_to_remove = NIL;
-    ListCell *lc;
-    int removed_count = 0;
-    
-    if (pattern == NULL)
-        return false;
-    
-    LWLockAcquire(cache_lock, LW_EXCLUSIVE);
-    
-    hash_seq_init(&status, query_cache_hash);
-    while ((entry = (PisaCacheEntry *) hash_seq_search(&status)) != NULL)
-    {
-        if (strstr(entry->cache_key, pattern) != NULL)
-        {
-            keys_to_remove = lappend(keys_to_remove, pstrdup(entry->cache_key));
-        }
-    }
-    
-    foreach(lc, keys_to_remove)
-    {
-        char *key = (char *) lfirst(lc);
-        entry = (PisaCacheEntry *) hash_search(query_cache_hash, 
-                                              key, 
-                                              HASH_REMOVE, 
-                                              NULL);
-        if (entry != NULL)
-        {
-            cache_stats->total_entries--;
-            cache_stats->total_size_bytes -= entry->result_size_bytes;
-            cache_stats->cache_evictions++;
-            removed_count++;
-        }
-        pfree(key);
-    }
-    
-    LWLockRelease(cache_lock);
-    
-    list_free(keys_to_remove);
-    
-    elog(LOG, "Invalidated %d cache entries matching pattern: %s", 
-         removed_count, pattern);
-    
-    return removed_count > 0;
+    char index_name[NAMEDATALEN * 2 + 1];
+
+    if (PisaQueryCache == NULL)
+        return;
+
+    snprintf(index_name, sizeof(index_name), "%s_%s", database_name, collection_name);
+    pg_atomic_fetch_add_u32(GetPisaCacheGenerationCounter(HashPisaCacheCollection(index_name)),
+                            1);
+    pg_atomic_fetch_add_u64(&PisaQueryCache->cache_invalidations, 1);
 }
 
+
+/* Same as InvalidatePisaQueryCache, for the index stored at 'index_path' */
 void
+InvalidatePisaQueryCacheForIndex(const char *index_path)
+{
+    const char *index_name = strrchr(index_path, '/');
+
+    if (PisaQueryCache == NULL)
+        return;
+
+    index_name = index_name != NULL ? index_name + 1 : index_path;
+    pg_atomic_fetch_add_u32(GetPisaCacheGenerationCounter(HashPisaCacheCollection(index_name)),
+                            1);
+    pg_atomic_fetch_add_u64(&PisaQueryCache->cache_invalidations, 1);
+}
+
+
+/* Removes expired and invalidated entries; returns how many */
+int
 EvictExpiredEntries(void)
 {
-    HASH_SEQ_STATUS status;
-    PisaCacheEntry *entry;
-    List *expired_keys = NIL;
-    ListCell *lc;
-    TimestampTz current_time = GetCurrentTimestamp();
+    TimestampTz now = GetCurrentTimestamp();
     int evicted_count = 0;
-    
-    LWLockAcquire(cache_lock, LW_EXCLUSIVE);
-    
-    hash_seq_init(&status, query_cache_hash);
-    while ((entry = (PisaCacheEntry *) hash_seq_search(&status)) != NULL)
-    {
-        if (!IsCacheEntryValid(entry))
-        {
-            expired_keys = lappend(expired_keys, pstrdup(entry->cache_key));
-        }
-    }
-    
-    foreach(lc, expired_keys)
+    int32 i;
+
+    if (PisaQueryCache == NULL)
+        return 0;
+
+    LWLockAcquire(&PisaQueryCache->lock, LW_EXCLUSIVE);
+
+    for (i = 0; i < PisaQueryCache->num_chunks && PisaQueryCache->num_entries > 0; i++)
     {
-        char *key = (char *) lfirst(lc);
-        entry = (PisaCacheEntry *) hash_search(query_cache_hash, 
-                                              key, 
-                                              HASH_REMOVE, 
-                                              NULL);
-        if (entry != NULL)
+        PisaCacheEntry *entry;
+
+        if (!PisaQueryCacheSlots[i].used)
+            continue;
+
+        entry = (PisaCacheEntry *) hash_search(PisaQueryCacheHash,
+                                               &PisaQueryCacheSlots[i].key,
+                                               HASH_FIND, NULL);
+        if (!IsPisaCacheEntryValid(entry, now))
         {
-            cache_stats->total_entries--;
-            cache_stats->total_size_bytes -= entry->result_size_bytes;
-            cache_stats->cache_evictions++;
+            RemovePisaCacheEntry(entry);
             evicted_count++;
         }
-        pfree(key);
     }
-    
-    LWLockRelease(cache_lock);
-    
-    list_free(expired_keys);
-    
+
+    LWLockRelease(&PisaQueryCache->lock);
+
     if (evicted_count > 0)
-    {
-        elog(DEBUG1, "Evicted %d expired cache entries", evicted_count);
-    }
+        elog(DEBUG1, "Evicted %d expired PISA query cache entries", evicted_count);
+
+    return evicted_count;
 }
 
-static int
-compare_cache_entries_by_access_time(const void *a, const void *b)
+
+/* Evicts up to 'count' entries chosen by CLOCK; returns the bytes freed */
+int64
+EvictPisaQueryCacheEntries(int count)
+{
+    int64 size_before;
+    int64 freed_bytes;
+
+    if (PisaQueryCache == NULL)
+        return 0;
+
+    LWLockAcquire(&PisaQueryCache->lock, LW_EXCLUSIVE);
+
+    size_before = PisaQueryCache->total_size_bytes;
+    while (count-- > 0 && PisaQueryCache->num_entries > 0)
+        EvictPisaCacheClockVictim();
+    freed_bytes = size_before - PisaQueryCache->total_size_bytes;
+
+    LWLockRelease(&PisaQueryCache->lock);
+
+    return freed_bytes;
+}
+
+
+PisaCacheStats *
+GetCacheStatistics(void)
 {
-    PisaCacheEntry *ea = *(PisaCacheEntry **)a;
-    PisaCacheEntry *eb = *(PisaCacheEntry **)b;
-    return timestamptz_cmp_internal(ea->last_accessed, eb->last_accessed);
+    PisaCacheStats *stats = (PisaCacheStats *) palloc0(sizeof(PisaCacheStats));
+
+    if (PisaQueryCache == NULL)
+        return stats;
+
+    LWLockAcquire(&PisaQueryCache->lock, LW_SHARED);
+
+    stats->total_queries = pg_atomic_read_u64(&PisaQueryCache->total_queries);
+    stats->cache_hits = pg_atomic_read_u64(&PisaQueryCache->cache_hits);
+    stats->cache_misses = stats->total_queries - stats->cache_hits;
+    stats->cache_evictions = pg_atomic_read_u64(&PisaQueryCache->cache_evictions);
+    stats->cache_invalidations = pg_atomic_read_u64(&PisaQueryCache->cache_invalidations);
+    stats->total_entries = PisaQueryCache->num_entries;
+    stats->total_size_bytes = PisaQueryCache->total_size_bytes;
+    stats->capacity_bytes = (int64) PisaQueryCache->num_chunks * PISA_CACHE_CHUNK_SIZE;
+    stats->last_reset = PisaQueryCache->last_reset;
+
+    LWLockRelease(&PisaQueryCache->lock);
+
+    stats->hit_ratio = stats->total_queries > 0 ?
+                       (double) stats->cache_hits / stats->total_queries : 0.0;
+
+    return stats;
 }
 
+
+/* Drops every entry and resets the statistics */
 void
-EvictLRUEntries(int count)
+ResetPisaQueryCache(void)
 {
-    HASH_SEQ_STATUS status;
-    PisaCacheEntry *entry;
-    List *lru_entries = NIL;
-    ListCell *lc;
-    int evicted_count = 0;
-    
-    hash_seq_init(&status, query_cache_hash);
-    while ((entry = (PisaCacheEntry *) hash_seq_search(&status)) != NULL)
-    {
-        lru_entries = lappend(lru_entries, entry);
-    }
-    
-    lru_entries = list_qsort(lru_entries, compare_cache_entries_by_access_time);
-    
-    int entries_to_evict = Min(count, list_length(lru_entries));
-    for (int i = 0; i < entries_to_evict; i++)
+    int32 i;
+
+    if (PisaQueryCache == NULL)
+        return;
+
+    LWLockAcquire(&PisaQueryCache->lock, LW_EXCLUSIVE);
+
+    for (i = 0; i < PisaQueryCache->num_chunks && PisaQueryCache->num_entries > 0; i++)
     {
-        entry = (PisaCacheEntry *) list_nth(lru_entries, i);
-        hash_search(query_cache_hash, entry->cache_key, HASH_REMOVE, NULL);
-        cache_stats->total_entries--;
-        cache_stats->total_size_bytes -= entry->result_size_bytes;
-        cache_stats->cache_evictions++;
-        evicted_count++;
+        if (PisaQueryCacheSlots[i].used)
+            RemovePisaCacheEntry((PisaCacheEntry *) hash_search(PisaQueryCacheHash,
+                                                                &PisaQueryCacheSlots[i].key,
+                                                                HASH_FIND, NULL));
     }
-    
-    list_free(lru_entries);
-    
-    elog(DEBUG1, "Evicted %d LRU cache entries", evicted_count);
+
+    pg_atomic_write_u64(&PisaQueryCache->total_queries, 0);
+    pg_atomic_write_u64(&PisaQueryCache->cache_hits, 0);
+    pg_atomic_write_u64(&PisaQueryCache->cache_evictions, 0);
+    pg_atomic_write_u64(&PisaQueryCache->cache_invalidations, 0);
+    PisaQueryCache->last_reset = GetCurrentTimestamp();
+
+    LWLockRelease(&PisaQueryCache->lock);
+
+    elog(LOG, "PISA query cache reset completed");
 }
 
-bool
-IsCacheEntryValid(PisaCacheEntry *entry)
+
+static int32
+GetPisaQueryCacheChunkCount(void)
 {
-    TimestampTz current_time = GetCurrentTimestamp();
-    TimestampTz expiry_time;
-    
-    if (entry == NULL || !entry->is_valid)
+    if (!pisa_integration_enabled || pisa_query_cache_size_mb <= 0)
+        return 0;
+
+    return (int32) ((int64) pisa_query_cache_size_mb * 1024 * 1024 / PISA_CACHE_CHUNK_SIZE);
+}
+
+
+static uint64
+HashPisaCacheCollection(const char *index_name)
+{
+    return hash_bytes_extended((const unsigned char *) index_name, strlen(index_name), 0);
+}
+
+
+static pg_atomic_uint32 *
+GetPisaCacheGenerationCounter(uint64 collection_hash)
+{
+    return &PisaQueryCache->generations[collection_hash % PISA_CACHE_INVALIDATION_SLOTS];
+}
+
+
+static bool
+IsPisaCacheEntryValid(PisaCacheEntry *entry, TimestampTz now)
+{
+    if (entry == NULL)
+        return false;
+
+    if (entry->generation !=
+        pg_atomic_read_u32(GetPisaCacheGenerationCounter(entry->key.collection_hash)))
         return false;
-    
-    expiry_time = TimestampTzPlusMilliseconds(entry->created_at, 
-                                             entry->ttl_seconds * 1000);
-    
-    return current_time < expiry_time;
+
+    return now < TimestampTzPlusMilliseconds(entry->created_at,
+                                             (int64) entry->ttl_seconds * 1000);
 }
 
-PisaCacheStats *
-GetCacheStatistics(void)
+
+/* Frees the chunks and the slot of an entry; the caller holds the lock exclusively */
+static void
+RemovePisaCacheEntry(PisaCacheEntry *entry)
 {
-    PisaCacheStats *stats_copy;
-    
-    LWLockAcquire(cache_lock, LW_SHARED);
-    
-    stats_copy = (PisaCacheStats *) palloc(sizeof(PisaCacheStats));
-    memcpy(stats_copy, cache_stats, sizeof(PisaCacheStats));
-    
-    if (cache_stats->total_queries > 0)
+    PisaCacheSlot *slot = &PisaQueryCacheSlots[entry->slot];
+    int32 chunk = entry->first_chunk;
+    int32 num_chunks = 0;
+    int32 last_chunk = PISA_CACHE_END;
+
+    while (chunk != PISA_CACHE_END)
     {
-        stats_copy->hit_ratio = (double) cache_stats->cache_hits / cache_stats->total_queries;
+        last_chunk = chunk;
+        chunk = PisaQueryCacheChunkLinks[chunk];
+        num_chunks++;
     }
-    else
+
+    if (last_chunk != PISA_CACHE_END)
     {
-        stats_copy->hit_ratio = 0.0;
+        PisaQueryCacheChunkLinks[last_chunk] = PisaQueryCache->free_chunk_head;
+        PisaQueryCache->free_chunk_head = entry->first_chunk;
     }
-    
-    LWLockRelease(cache_lock);
-    
-    return stats_copy;
+
+    slot->used = false;
+    slot->next_free = PisaQueryCache->free_slot_head;
+    PisaQueryCache->free_slot_head = entry->slot;
+
+    PisaQueryCache->free_chunks += num_chunks;
+    PisaQueryCache->num_entries--;
+    PisaQueryCache->total_size_bytes -= entry->result_size;
+
+    hash_search(PisaQueryCacheHash, &entry->key, HASH_REMOVE, NULL);
 }
 
-void
-UpdateCacheStatistics(bool cache_hit)
+
+/*
+ * Evicts one entry: the hand sweeps the ring, clearing reference bits,
+ * and takes the first entry that is unreferenced or no longer valid.
+ * Takes at most two sweeps; the caller holds the lock exclusively and
+ * the cache is not empty.
+ */
+static void
+EvictPisaCacheClockVictim(void)
 {
-    cache_stats->total_queries++;
-    
-    if (cache_hit)
-        cache_stats->cache_hits++;
-    else
-        cache_stats->cache_misses++;
+    TimestampTz now = GetCurrentTimestamp();
+
+    Assert(PisaQueryCache->num_entries > 0);
+
+    while (true)
+    {
+        PisaCacheSlot *slot = &PisaQueryCacheSlots[PisaQueryCache->clock_hand];
+        PisaCacheEntry *entry;
+
+        PisaQueryCache->clock_hand = (PisaQueryCache->clock_hand + 1) %
+                                     PisaQueryCache->num_chunks;
+
+        if (!slot->used)
+            continue;
+
+        entry = (PisaCacheEntry *) hash_search(PisaQueryCacheHash, &slot->key, HASH_FIND,
+                                               NULL);
+        if (IsPisaCacheEntryValid(entry, now) &&
+            pg_atomic_exchange_u32(&slot->referenced, 0) != 0)
+            continue;
+
+        RemovePisaCacheEntry(entry);
+        pg_atomic_fetch_add_u64(&PisaQueryCache->cache_evictions, 1);
+        return;
+    }
+}
+
+
+static void
+PushPisaCacheStatistic(JsonbParseState **state, const char *name, Numeric value)
+{
+    JsonbValue key;
+    JsonbValue jsonb_value;
+
+    key.type = jbvString;
+    key.val.string.len = strlen(name);
+    key.val.string.val = (char *) name;
+    jsonb_value.type = jbvNumeric;
+    jsonb_value.val.numeric = value;
+
+    pushJsonbValue(state, WJB_KEY, &key);
+    pushJsonbValue(state, WJB_VALUE, &jsonb_value);
 }
 
 Datum
 documentdb_cache_pisa_query(PG_FUNCTION_ARGS)
 {
-    text *cache_key_text = PG_GETARG_TEXT_PP(0);
-    Jsonb *result = PG_GETARG_JSONB_P(1);
-    int32 ttl_seconds = PG_GETARG_INT32(2);
-    
-    char *cache_key = text_to_cstring(cache_key_text);
-    
-    bool success = CacheQuery(cache_key, result, ttl_seconds);
-    
-    PG_RETURN_BOOL(success);
+    char *database_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *collection_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    pgbson *filter = PG_GETARG_PGBSON(2);
+    pgbson *options = PG_GETARG_PGBSON(3);
+    Jsonb *result = PG_GETARG_JSONB_P(4);
+    int32 ttl_seconds = PG_GETARG_INT32(5);
+    PisaQueryCacheKey key;
+
+    GeneratePisaCacheKey(&key, database_name, collection_name, filter, options);
+
+    PG_RETURN_BOOL(CacheQuery(&key, GetPisaQueryCacheGeneration(&key), result,
+                              ttl_seconds));
 }
 
 Datum
 documentdb_get_cached_pisa_query(PG_FUNCTION_ARGS)
 {
-    text *cache_key_text = PG_GETARG_TEXT_PP(0);
-    char *cache_key = text_to_cstring(cache_key_text);
-    
-    Jsonb *result = GetCachedQuery(cache_key);
-    
+    char *database_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *collection_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    pgbson *filter = PG_GETARG_PGBSON(2);
+    pgbson *options = PG_GETARG_PGBSON(3);
+    PisaQueryCacheKey key;
+    Jsonb *result;
+
+    GeneratePisaCacheKey(&key, database_name, collection_name, filter, options);
+    result = GetCachedQuery(&key);
+
     if (result != NULL)
         PG_RETURN_JSONB_P(result);
     else
@@ -431,12 +720,12 @@ documentdb_get_cached_pisa_query(PG_FUNCTION_ARGS)
 Datum
 documentdb_invalidate_pisa_cache(PG_FUNCTION_ARGS)
 {
-    text *pattern_text = PG_GETARG_TEXT_PP(0);
-    char *pattern = text_to_cstring(pattern_text);
-    
-    bool success = InvalidateCacheByPattern(pattern);
-    
-    PG_RETURN_BOOL(success);
+    char *database_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *collection_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+    InvalidatePisaQueryCache(database_name, collection_name);
+
+    PG_RETURN_BOOL(PisaQueryCache != NULL);
 }
 
 Datum
@@ -445,62 +734,52 @@ documentdb_get_pisa_cache_stats(PG_FUNCTION_ARGS)
     PisaCacheStats *stats = GetCacheStatistics();
     JsonbParseState *state = NULL;
     JsonbValue *result_object;
-    
+
     pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-    
-    JsonbValue key, value;
-    
-    key.type = jbvString;
-    key.val.string.len = strlen("total_queries");
-    key.val.string.val = "total_queries";
-    value.type = jbvNumeric;
-    value.val.numeric = int64_to_numeric(stats->total_queries);
-    pushJsonbValue(&state, WJB_KEY, &key);
-    pushJsonbValue(&state, WJB_VALUE, &value);
-    
-    key.val.string.len = strlen("cache_hits");
-    key.val.string.val = "cache_hits";
-    value.val.numeric = int64_to_numeric(stats->cache_hits);
-    pushJsonbValue(&state, WJB_KEY, &key);
-    pushJsonbValue(&state, WJB_VALUE, &value);
-    
-    key.val.string.len = strlen("hit_ratio");
-    key.val.string.val = "hit_ratio";
-    value.val.numeric = float8_to_numeric(stats->hit_ratio);
-    pushJsonbValue(&state, WJB_KEY, &key);
-    pushJsonbValue(&state, WJB_VALUE, &value);
-    
+
+    PushPisaCacheStatistic(&state, "total_queries", int64_to_numeric(stats->total_queries));
+    PushPisaCacheStatistic(&state, "cache_hits", int64_to_numeric(stats->cache_hits));
+    PushPisaCacheStatistic(&state, "cache_misses", int64_to_numeric(stats->cache_misses));
+    PushPisaCacheStatistic(&state, "hit_ratio", float8_to_numeric(stats->hit_ratio));
+    PushPisaCacheStatistic(&state, "evictions", int64_to_numeric(stats->cache_evictions));
+    PushPisaCacheStatistic(&state, "invalidations",
+                           int64_to_numeric(stats->cache_invalidations));
+    PushPisaCacheStatistic(&state, "entries", int64_to_numeric(stats->total_entries));
+    PushPisaCacheStatistic(&state, "size_bytes", int64_to_numeric(stats->total_size_bytes));
+    PushPisaCacheStatistic(&state, "capacity_bytes",
+                           int64_to_numeric(stats->capacity_bytes));
+
     result_object = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-    
+
     pfree(stats);
-    
+
     PG_RETURN_JSONB_P(JsonbValueToJsonb(result_object));
 }
 
 Datum
 documentdb_reset_pisa_cache(PG_FUNCTION_ARGS)
 {
-    LWLockAcquire(cache_lock, LW_EXCLUSIVE);
-    
-    hash_destroy(query_cache_hash);
-    
-    HASHCTL hash_ctl;
-    MemSet(&hash_ctl, 0, sizeof(hash_ctl));
-    hash_ctl.keysize = PISA_CACHE_KEY_SIZE;
-    hash_ctl.entrysize = sizeof(PisaCacheEntry);
-    hash_ctl.hcxt = TopMemoryContext;
-    
-    query_cache_hash = hash_create("PISA Query Cache",
-                                  cache_max_entries,
-                                  &hash_ctl,
-                                  HASH_ELEM | HASH_CONTEXT);
-    
-    memset(cache_stats, 0, sizeof(PisaCacheStats));
-    cache_stats->last_reset = GetCurrentTimestamp();
-    
-    LWLockRelease(cache_lock);
-    
-    elog(LOG, "PISA query cache reset completed");
-    
+    ResetPisaQueryCache();
+
     PG_RETURN_BOOL(true);
 }
+
+/*
+ * Test helper: returns the cache key of a query in hex, so tests can
+ * check which queries share cached results.
+ */
+Datum
+documentdb_pisa_cache_key_for_test(PG_FUNCTION_ARGS)
+{
+    char *database_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *collection_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    pgbson *filter = PG_GETARG_PGBSON(2);
+    pgbson *options = PG_GETARG_PGBSON(3);
+    PisaQueryCacheKey key;
+
+    GeneratePisaCacheKey(&key, database_name, collection_name, filter, options);
+
+    PG_RETURN_TEXT_P(cstring_to_text(psprintf("%016" PRIx64 "%016" PRIx64 "%016" PRIx64,
+                                              key.collection_hash, key.filter_hash,
+                                              key.options_hash)));
+}
@@ -112,9 +112,11 @@ extern bool EnableVariablesSupportForWriteCommands;
 extern bool EnableIndexOrderbyPushdown;
 extern bool ForceDisableSeqScan;
 extern bool EnableExtendedExplainPlans;
+extern bool EnableCustomGroupScan;
 
 planner_hook_type ExtensionPreviousPlannerHook = NULL;
 set_rel_pathlist_hook_type ExtensionPreviousSetRelPathlistHook = NULL;
+create_upper_paths_hook_type ExtensionPreviousCreateUpperPathsHook = NULL;
 explain_get_index_name_hook_type ExtensionPreviousIndexNameHook = NULL;
 
 
@@ -774,6 +776,28 @@ ExtensionRelPathlistHook(PlannerInfo *root, RelOptInfo *rel, Index rti,
 }
 
 
+/*
+ * ExtensionCreateUpperPathsHook adds the paths of the extension for the
+ * upper relations: the group scan for the aggregation of $group.
+ */
+void
+ExtensionCreateUpperPathsHook(PlannerInfo *root, UpperRelationKind stage,
+							  RelOptInfo *inputRel, RelOptInfo *outputRel,
+							  void *extra)
+{
+	if (stage == UPPERREL_GROUP_AGG && EnableCustomGroupScan &&
+		IsDocumentDBApiExtensionActive())
+	{
+		AddExtensionGroupScanForGroupAggregate(root, inputRel, outputRel);
+	}
+
+	if (ExtensionPreviousCreateUpperPathsHook != NULL)
+	{
+		ExtensionPreviousCreateUpperPathsHook(root, stage, inputRel, outputRel, extra);
+	}
+}
+
+
 /*
  * MongoQueryFlags determines whether the given query tree contains
  * extension-specific constructs that are relevant to the planner.
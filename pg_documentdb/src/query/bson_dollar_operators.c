@@ -18,6 +18,8 @@
 #include "aggregation/bson_query_common.h"
 #include "io/bson_traversal.h"
 #include "query/bson_compare.h"
+#include "query/bson_sort_key.h"
+#include "query/bson_sort_support.h"
 #include "operators/bson_expression.h"
 #include "query/bson_dollar_operators.h"
 #include "utils/documentdb_errors.h"
@@ -115,6 +117,23 @@ typedef struct TraverseOrderByValidateState
 	int32_t nestedArrayCount;
 } TraverseOrderByValidateState;
 
+/* The state of a sort set up by bson_orderby_sortsupport */
+typedef struct OrderbySortState
+{
+	/* Whether collationString is set from the first document abbreviated */
+	bool isCollationSet;
+
+	/* The collation of the first document abbreviated, NULL if it has none */
+	char *collationString;
+
+	/* The sort keys of the strings compared, for the collation of the cache */
+	CollationSortKeyCache *sortKeyCache;
+	char *sortKeyCacheCollationString;
+
+	/* The memory context living as long as the sort */
+	MemoryContext memoryContext;
+} OrderbySortState;
+
 /* State for comparison operations of simple dollar operators
  * where the query only needs the filter to process the comparison */
 typedef struct TraverseElementValidateState
@@ -261,6 +280,7 @@ extern bool EnableCollation;
 extern bool EnableNowSystemVariable;
 extern bool UseLegacyOrderByBehavior;
 extern bool UseLegacyNullEqualityBehavior;
+extern bool EnableCollationSortKeyCache;
 
 /* --------------------------------------------------------- */
 /* Forward declaration */
@@ -390,6 +410,12 @@ static bool DollarRangeVisitArrayField(pgbsonelement *element, const
 static Datum BsonOrderbyCore(pgbson *leftBson, pgbson *rightBson, const
 							 char *collationString, bool validateSort,
 							 const CustomOrderByOptions options);
+static int CompareBsonOrderbyDocuments(pgbson *left, pgbson *right,
+									   OrderbySortState *sortState);
+static CollationSortKeyCache * GetOrderbySortKeyCache(OrderbySortState *sortState,
+													  const char *collationString);
+static int BsonOrderbySortSupportCompare(Datum left, Datum right, SortSupport ssup);
+static uint64 GetBsonOrderbyAbbreviatedKey(pgbson *document, BsonSortSupportState *state);
 
 /*
  * Standard execution functions for traversing bson and evaluating queries for $ops.
@@ -539,6 +565,7 @@ PG_FUNCTION_INFO_V1(command_bson_orderby);
 PG_FUNCTION_INFO_V1(bson_orderby_partition);
 PG_FUNCTION_INFO_V1(bson_vector_orderby);
 PG_FUNCTION_INFO_V1(bson_orderby_compare);
+PG_FUNCTION_INFO_V1(bson_orderby_sortsupport);
 PG_FUNCTION_INFO_V1(bson_orderby_lt);
 PG_FUNCTION_INFO_V1(bson_orderby_eq);
 PG_FUNCTION_INFO_V1(bson_orderby_gt);
@@ -1791,6 +1818,39 @@ bson_orderby_compare(PG_FUNCTION_ARGS)
 	pgbson *left = PG_GETARG_PGBSON(0);
 	pgbson *right = PG_GETARG_PGBSON(1);
 
+	PG_RETURN_INT32(CompareBsonOrderbyDocuments(left, right, NULL));
+}
+
+
+/*
+ * bson_orderby_sortsupport is the sort support function of the ORDER BY ...
+ * USING <<< / >>> operators: sorts compare the documents directly and
+ * abbreviate them into the leading bytes of the sort key of their value.
+ * Strings compared with a collation are compared by their ICU sort keys,
+ * computed once per string for the sort.
+ */
+Datum
+bson_orderby_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+	OrderbySortState *sortState = MemoryContextAllocZero(ssup->ssup_cxt,
+														 sizeof(OrderbySortState));
+	sortState->memoryContext = ssup->ssup_cxt;
+
+	SetupBsonSortSupport(ssup, BsonOrderbySortSupportCompare,
+						 GetBsonOrderbyAbbreviatedKey, sortState);
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * Compares two documents produced by bson_orderby as bson_orderby_compare.
+ * sortState is the state of the sort comparing them, if any.
+ */
+static int
+CompareBsonOrderbyDocuments(pgbson *left, pgbson *right, OrderbySortState *sortState)
+{
 	pgbsonelement leftElement = { 0 };
 	pgbsonelement rightElement = { 0 };
 
@@ -1814,23 +1874,48 @@ bson_orderby_compare(PG_FUNCTION_ARGS)
 
 		if (collationCmp != 0)
 		{
-			PG_RETURN_INT32(collationCmp);
+			return collationCmp;
 		}
 
 		collationString = collationStringLeft;
 	}
 	else if (collationStringLeft != NULL && collationStringRight == NULL)
 	{
-		PG_RETURN_INT32(1);
+		return 1;
 	}
 	else if (collationStringRight != NULL && collationStringLeft == NULL)
 	{
-		PG_RETURN_INT32(-1);
+		return -1;
 	}
 
 	/* compare the left and right values */
 	int cmp = 0;
 	bool isComparisonValid = true;
+
+	/* The collation does not apply to values of fixed width */
+	if (TryCompareBsonValuesBySortKey(&leftElement.bsonValue, &rightElement.bsonValue,
+									  &cmp, &isComparisonValid))
+	{
+		return cmp;
+	}
+
+	if (collationString != NULL &&
+		leftElement.bsonValue.value_type == BSON_TYPE_UTF8 &&
+		rightElement.bsonValue.value_type == BSON_TYPE_UTF8)
+	{
+		CollationSortKeyCache *sortKeyCache = GetOrderbySortKeyCache(sortState,
+																	 collationString);
+		if (sortKeyCache != NULL)
+		{
+			return CompareStringsWithSortKeyCache(
+				leftElement.bsonValue.value.v_utf8.str,
+				leftElement.bsonValue.value.v_utf8.len,
+				rightElement.bsonValue.value.v_utf8.str,
+				rightElement.bsonValue.value.v_utf8.len,
+				sortKeyCache);
+		}
+	}
+
 	if (collationString != NULL)
 	{
 		cmp = CompareBsonValueAndTypeWithCollation(&leftElement.bsonValue,
@@ -1843,7 +1928,102 @@ bson_orderby_compare(PG_FUNCTION_ARGS)
 									  &isComparisonValid);
 	}
 
-	PG_RETURN_INT32(cmp);
+	return cmp;
+}
+
+
+/*
+ * Sort support comparator of documents produced by bson_orderby.
+ */
+static int
+BsonOrderbySortSupportCompare(Datum left, Datum right, SortSupport ssup)
+{
+	pgbson *leftBson = DatumGetPgBson(left);
+	pgbson *rightBson = DatumGetPgBson(right);
+
+	BsonSortSupportState *state = (BsonSortSupportState *) ssup->ssup_extra;
+	int cmp = CompareBsonOrderbyDocuments(leftBson, rightBson,
+										  (OrderbySortState *) state->context);
+
+	if ((Pointer) leftBson != DatumGetPointer(left))
+	{
+		pfree(leftBson);
+	}
+
+	if ((Pointer) rightBson != DatumGetPointer(right))
+	{
+		pfree(rightBson);
+	}
+
+	return cmp;
+}
+
+
+/*
+ * Abbreviates a document produced by bson_orderby into the leading bytes of
+ * the sort key of its value. Documents are ordered by their collation
+ * before their value, so abbreviated keys are only comparable when all
+ * documents of the sort have the same collation, which is the case for the
+ * documents of a query: the collation is a constant of the sort.
+ */
+static uint64
+GetBsonOrderbyAbbreviatedKey(pgbson *document, BsonSortSupportState *state)
+{
+	pgbsonelement element = { 0 };
+	const char *collationString =
+		PgbsonToSinglePgbsonElementWithCollation(document, &element);
+	collationString = IsCollationApplicable(collationString) ? collationString : NULL;
+
+	OrderbySortState *sortState = (OrderbySortState *) state->context;
+	if (!sortState->isCollationSet)
+	{
+		sortState->collationString =
+			collationString != NULL ?
+			MemoryContextStrdup(state->memoryContext, collationString) : NULL;
+		sortState->isCollationSet = true;
+	}
+	else if ((sortState->collationString == NULL) != (collationString == NULL) ||
+			 (collationString != NULL &&
+			  strcmp(sortState->collationString, collationString) != 0))
+	{
+		state->abbreviatedKeysIncomparable = true;
+		return 0;
+	}
+
+	return GetBsonValueAbbreviatedSortKey(&element.bsonValue, collationString,
+										  &state->sortKeyBuffer);
+}
+
+
+/*
+ * Returns the cache of the sort keys of the strings compared by a sort with
+ * the given collation, creating it on the first comparison. Returns NULL
+ * when strings are compared by the collator instead: outside of sorts and
+ * for the documents whose collation isn't the one of the cache, which is
+ * the collation of the first strings compared.
+ */
+static CollationSortKeyCache *
+GetOrderbySortKeyCache(OrderbySortState *sortState, const char *collationString)
+{
+	if (sortState == NULL || !EnableCollationSortKeyCache)
+	{
+		return NULL;
+	}
+
+	if (sortState->sortKeyCache == NULL)
+	{
+		/* The sort keys are bounded by a share of the memory of the sort */
+		Size maxSize = (Size) work_mem * 1024L / 4;
+		sortState->sortKeyCache = CreateCollationSortKeyCache(collationString,
+															  sortState->memoryContext,
+															  maxSize);
+		sortState->sortKeyCacheCollationString =
+			MemoryContextStrdup(sortState->memoryContext, collationString);
+		return sortState->sortKeyCache;
+	}
+
+	return strcmp(sortState->sortKeyCacheCollationString, collationString) == 0 ?
+		   sortState->sortKeyCache : NULL;
 }
 
 
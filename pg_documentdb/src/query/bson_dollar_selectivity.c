@@ -15,12 +15,27 @@
 #include <utils/selfuncs.h>
 #include <metadata/metadata_cache.h>
 #include <planner/mongo_query_operator.h>
+#include <io/bson_analyze.h>
+#include <query/bson_dollar_selectivity.h>
 
 extern bool EnableNewOperatorSelectivityMode;
+extern bool EnablePathDependencySelectivity;
 
 
 static double GetStatisticsNoStatsData(List *args, Oid selectivityOpExpr);
 
+static bool GetPathStatisticsSelectivity(PlannerInfo *planner, List *args,
+										 Oid selectivityOpExpr, int varRelId,
+										 double *selectivity);
+
+static double ApplyPathDependencies(VariableStatData *vardata, AttStatsSlot *pathSlot,
+									List *args, Oid selectivityOpExpr, const char *path,
+									double selectivity);
+
+static const MongoIndexOperatorInfo * GetSelectivityIndexOperator(Const *queryConst,
+																  Oid
+																  selectivityOpExpr);
+
 static double GetDisableStatisticSelectivity(List *args);
 
 /* The default selectivity Postgres applies for matching clauses. */
@@ -32,9 +47,30 @@ static const double LowSelectivity = 0.01;
 /* Selectivity when most of the table is accessed (Selectivity max is 1) */
 static const double HighSelectivity = 0.9;
 
+/*
+ * The clauses whose selectivities are being combined, when not the
+ * restriction clauses of the relation (see SetBsonSelectivityClauseContext).
+ */
+static List *SelectivityClauseContext = NIL;
+
 PG_FUNCTION_INFO_V1(bson_dollar_selectivity);
 
 
+/*
+ * Sets the list of clauses whose selectivities the planner is about to
+ * combine, for estimates of clause lists other than the restriction
+ * clauses of a relation (e.g. the clauses an index scan applies). Returns
+ * the previous list, which the caller restores.
+ */
+List *
+SetBsonSelectivityClauseContext(List *clauses)
+{
+	List *previousClauses = SelectivityClauseContext;
+	SelectivityClauseContext = clauses;
+	return previousClauses;
+}
+
+
 /*
  * bson_operator_selectivity returns the selectivity of a BSON operator
  * on a relation.
@@ -53,6 +89,13 @@ bson_dollar_selectivity(PG_FUNCTION_ARGS)
 		PG_RETURN_FLOAT8(GetDisableStatisticSelectivity(args));
 	}
 
+	double pathSelectivity;
+	if (GetPathStatisticsSelectivity(planner, args, selectivityOpExpr, varRelId,
+									 &pathSelectivity))
+	{
+		PG_RETURN_FLOAT8(pathSelectivity);
+	}
+
 	double defaultInputSelectivity = GetStatisticsNoStatsData(args, selectivityOpExpr);
 
 	/*
@@ -67,6 +110,255 @@ bson_dollar_selectivity(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * Estimates the selectivity from the per-path statistics ANALYZE gathers
+ * on the document column (see bson_analyze.h). Returns false if the
+ * column has no statistics for the path of the operator, or the operator
+ * can't be estimated from them.
+ */
+static bool
+GetPathStatisticsSelectivity(PlannerInfo *planner, List *args, Oid selectivityOpExpr,
+							 int varRelId, double *selectivity)
+{
+	if (list_length(args) != 2 || !IsA(lsecond(args), Const))
+	{
+		return false;
+	}
+
+	Const *secondConst = (Const *) lsecond(args);
+	if (secondConst->constisnull)
+	{
+		return false;
+	}
+
+	const MongoIndexOperatorInfo *indexOp = GetSelectivityIndexOperator(secondConst,
+																		selectivityOpExpr);
+
+	BsonPathPredicate predicate;
+	switch (indexOp->indexStrategy)
+	{
+		case BSON_INDEX_STRATEGY_DOLLAR_EQUAL:
+		{
+			predicate = BsonPathPredicate_Equal;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_NOT_EQUAL:
+		{
+			predicate = BsonPathPredicate_NotEqual;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_GREATER:
+		{
+			predicate = BsonPathPredicate_Greater;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_GREATER_EQUAL:
+		{
+			predicate = BsonPathPredicate_GreaterEqual;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_LESS:
+		{
+			predicate = BsonPathPredicate_Less;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_LESS_EQUAL:
+		{
+			predicate = BsonPathPredicate_LessEqual;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_IN:
+		{
+			predicate = BsonPathPredicate_In;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_NOT_IN:
+		{
+			predicate = BsonPathPredicate_NotIn;
+			break;
+		}
+
+		case BSON_INDEX_STRATEGY_DOLLAR_EXISTS:
+		{
+			predicate = BsonPathPredicate_Exists;
+			break;
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+
+	VariableStatData vardata;
+	examine_variable(planner, linitial(args), varRelId, &vardata);
+
+	bool isEstimated = false;
+	if (HeapTupleIsValid(vardata.statsTuple) && vardata.acl_ok &&
+		vardata.rel != NULL && vardata.rel->tuples > 0)
+	{
+		AttStatsSlot sslot;
+		if (get_attstatsslot(&sslot, vardata.statsTuple, STATISTIC_KIND_BSON_PATHS,
+							 InvalidOid, ATTSTATSSLOT_VALUES))
+		{
+			pgbsonelement dollarElement;
+			PgbsonToSinglePgbsonElement(
+				DatumGetPgBson(secondConst->constvalue), &dollarElement);
+
+			char *path = pnstrdup(dollarElement.path, dollarElement.pathLength);
+			isEstimated = EstimateBsonPathSelectivity(sslot.values, sslot.nvalues,
+													  vardata.rel->tuples, path,
+													  predicate,
+													  &dollarElement.bsonValue,
+													  selectivity);
+			if (isEstimated && predicate == BsonPathPredicate_Equal &&
+				EnablePathDependencySelectivity)
+			{
+				*selectivity = ApplyPathDependencies(&vardata, &sslot, args,
+													 selectivityOpExpr, path,
+													 *selectivity);
+			}
+
+			free_attstatsslot(&sslot);
+		}
+	}
+
+	ReleaseVariableStats(vardata);
+	return isEstimated;
+}
+
+
+/*
+ * Planner estimates of clause lists multiply the selectivities of the
+ * clauses, which underestimates equalities on correlated paths (e.g. a
+ * tenant and the fields only that tenant uses). The selectivity of an
+ * equality is raised to its selectivity among the rows matching the
+ * equalities on the same column that precede it in the clause list, so
+ * that the product comes out as the estimate of the equalities together.
+ * Only the most dependent preceding equality is accounted for.
+ */
+static double
+ApplyPathDependencies(VariableStatData *vardata, AttStatsSlot *pathSlot, List *args,
+					  Oid selectivityOpExpr, const char *path, double selectivity)
+{
+	List *clauses = SelectivityClauseContext != NIL ? SelectivityClauseContext :
+					vardata->rel->baserestrictinfo;
+
+	int position = -1;
+	ListCell *clauseCell;
+	foreach(clauseCell, clauses)
+	{
+		Node *clause = (Node *) lfirst(clauseCell);
+		if (IsA(clause, RestrictInfo))
+		{
+			clause = (Node *) ((RestrictInfo *) clause)->clause;
+		}
+
+		if (IsA(clause, OpExpr) && ((OpExpr *) clause)->opno == selectivityOpExpr &&
+			equal(((OpExpr *) clause)->args, args))
+		{
+			position = foreach_current_index(clauseCell);
+			break;
+		}
+	}
+
+	if (position <= 0)
+	{
+		/* First of the list, or estimated on its own */
+		return selectivity;
+	}
+
+	AttStatsSlot dependencySlot;
+	if (!get_attstatsslot(&dependencySlot, vardata->statsTuple,
+						  STATISTIC_KIND_BSON_PATH_DEPENDENCIES, InvalidOid,
+						  ATTSTATSSLOT_VALUES))
+	{
+		return selectivity;
+	}
+
+	double result = selectivity;
+	for (int i = 0; i < position; i++)
+	{
+		Node *clause = (Node *) list_nth(clauses, i);
+		if (IsA(clause, RestrictInfo))
+		{
+			clause = (Node *) ((RestrictInfo *) clause)->clause;
+		}
+
+		if (!IsA(clause, OpExpr))
+		{
+			continue;
+		}
+
+		OpExpr *givenExpr = (OpExpr *) clause;
+		if (list_length(givenExpr->args) != 2 ||
+			!equal(linitial(givenExpr->args), linitial(args)) ||
+			!IsA(lsecond(givenExpr->args), Const) ||
+			((Const *) lsecond(givenExpr->args))->constisnull)
+		{
+			continue;
+		}
+
+		Const *givenConst = (Const *) lsecond(givenExpr->args);
+		const MongoIndexOperatorInfo *indexOp =
+			GetSelectivityIndexOperator(givenConst, givenExpr->opno);
+		if (indexOp->indexStrategy != BSON_INDEX_STRATEGY_DOLLAR_EQUAL)
+		{
+			continue;
+		}
+
+		pgbsonelement givenElement;
+		PgbsonToSinglePgbsonElement(DatumGetPgBson(givenConst->constvalue),
+									&givenElement);
+		char *givenPath = pnstrdup(givenElement.path, givenElement.pathLength);
+
+		double givenSelectivity;
+		double conditionalSelectivity;
+		if (EstimateBsonPathSelectivity(pathSlot->values, pathSlot->nvalues,
+										vardata->rel->tuples, givenPath,
+										BsonPathPredicate_Equal,
+										&givenElement.bsonValue, &givenSelectivity) &&
+			EstimateBsonPathConditionalSelectivity(dependencySlot.values,
+												   dependencySlot.nvalues, givenPath,
+												   givenSelectivity, path, selectivity,
+												   &conditionalSelectivity))
+		{
+			result = Max(result, conditionalSelectivity);
+		}
+
+		pfree(givenPath);
+	}
+
+	free_attstatsslot(&dependencySlot);
+	return result;
+}
+
+
+/*
+ * Gets the index operator a selectivity call is made for: either the
+ * operator on the bson query type or an index pushdown operator.
+ */
+static const MongoIndexOperatorInfo *
+GetSelectivityIndexOperator(Const *queryConst, Oid selectivityOpExpr)
+{
+	if (queryConst->consttype == BsonQueryTypeId())
+	{
+		Oid selectFuncId = get_opcode(selectivityOpExpr);
+		return GetMongoIndexOperatorInfoByPostgresFuncId(selectFuncId);
+	}
+
+	/* This is an index pushdown operator */
+	return GetMongoIndexOperatorByPostgresOperatorId(selectivityOpExpr);
+}
+
+
 /*
  * Legacy function for compat to restore prior value to
  * implementing selectivity.
@@ -88,18 +380,8 @@ GetStatisticsNoStatsData(List *args, Oid selectivityOpExpr)
 	}
 
 	Const *secondConst = (Const *) secondNode;
-	const MongoIndexOperatorInfo *indexOp;
-	if (secondConst->consttype == BsonQueryTypeId())
-	{
-		Oid selectFuncId = get_opcode(selectivityOpExpr);
-		indexOp = GetMongoIndexOperatorInfoByPostgresFuncId(selectFuncId);
-	}
-	else
-	{
-		/* This is an index pushdown operator */
-		indexOp = GetMongoIndexOperatorByPostgresOperatorId(selectivityOpExpr);
-	}
-
+	const MongoIndexOperatorInfo *indexOp = GetSelectivityIndexOperator(secondConst,
+																		selectivityOpExpr);
 	if (indexOp->indexStrategy == BSON_INDEX_STRATEGY_INVALID)
 	{
 		/* Unknown - thunk to PG value */
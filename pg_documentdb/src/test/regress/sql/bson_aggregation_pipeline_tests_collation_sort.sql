@@ -0,0 +1,60 @@
+SET search_path TO documentdb_api_catalog;
+
+SET documentdb.next_collection_id TO 15600;
+SET documentdb.next_collection_index_id TO 15600;
+
+SET documentdb_core.enableCollation TO on;
+
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 1, "name": "Dog" }');
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 2, "name": "cat" }');
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 3, "name": "caT" }');
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 4, "name": "Cat" }');
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 5, "name": "Banana" }');
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 6, "name": "apple" }');
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 7, "name": "éclair" }');
+SELECT documentdb_api.insert_one('db','collation_sort',' { "_id" : 8, "name": "eclair" }');
+
+-- a third of the names are upper case, so the order of the collation is not the binary order
+SELECT COUNT(*) FROM (SELECT documentdb_api.insert_one('db', 'collation_sort_keys', FORMAT('{ "_id": %s, "name": "%s" }', i,
+    CASE WHEN i % 3 = 0 THEN upper(md5(i::text)) ELSE md5(i::text) END)::documentdb_core.bson) FROM generate_series(1, 3000) i) innerQuery;
+
+-- returns the names of the collection in the order of a $sort on them, pushed into one array
+CREATE FUNCTION pg_temp.sorted_names(collection_name text, direction int, collation text, sort_key_cache bool) RETURNS text AS $$
+DECLARE
+    sorted_names text;
+BEGIN
+    PERFORM set_config('documentdb.enableCollationSortKeyCache', sort_key_cache::text, true);
+    EXECUTE format('SELECT document::text FROM documentdb_api_catalog.bson_aggregation_pipeline(%L, %L)', 'db',
+        format('{ "aggregate": "%s", "pipeline": [ { "$sort": { "name": %s } }, { "$group": { "_id": null, "names": { "$push": "$name" } } } ]%s }',
+            collection_name, direction, coalesce(', "collation": ' || collation, ''))) INTO sorted_names;
+    RETURN sorted_names;
+END;
+$$ LANGUAGE plpgsql;
+
+-- sorts by the collation compare the sort keys of the strings cached by the sort
+SET documentdb.enableCollationSortKeyCache TO on;
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "collation_sort", "pipeline": [ { "$sort": { "name": 1 } }, { "$project": { "_id": 0, "name": 1 } } ], "collation": { "locale": "en" } }');
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "collation_sort", "pipeline": [ { "$sort": { "name": -1 } }, { "$project": { "_id": 0, "name": 1 } } ], "collation": { "locale": "en" } }');
+
+-- the same order compared by the collator
+SET documentdb.enableCollationSortKeyCache TO off;
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "collation_sort", "pipeline": [ { "$sort": { "name": 1 } }, { "$project": { "_id": 0, "name": 1 } } ], "collation": { "locale": "en" } }');
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "collation_sort", "pipeline": [ { "$sort": { "name": -1 } }, { "$project": { "_id": 0, "name": 1 } } ], "collation": { "locale": "en" } }');
+
+-- the sort keys of all the names fit in a quarter of work_mem
+SELECT direction,
+    pg_temp.sorted_names('collation_sort_keys', direction, '{ "locale": "en" }', true) = pg_temp.sorted_names('collation_sort_keys', direction, '{ "locale": "en" }', false) AS same_as_collator,
+    pg_temp.sorted_names('collation_sort_keys', direction, '{ "locale": "en" }', true) != pg_temp.sorted_names('collation_sort_keys', direction, NULL, true) AS differs_from_binary
+FROM (VALUES (1), (-1)) directions(direction);
+
+-- past a quarter of work_mem the names that are not cached are compared by the collator,
+-- including against the names that are
+SET work_mem TO '64kB';
+SELECT direction,
+    pg_temp.sorted_names('collation_sort_keys', direction, '{ "locale": "en" }', true) = pg_temp.sorted_names('collation_sort_keys', direction, '{ "locale": "en" }', false) AS same_as_collator,
+    pg_temp.sorted_names('collation_sort_keys', direction, '{ "locale": "en" }', true) != pg_temp.sorted_names('collation_sort_keys', direction, NULL, true) AS differs_from_binary
+FROM (VALUES (1), (-1)) directions(direction);
+RESET work_mem;
+
+RESET documentdb.enableCollationSortKeyCache;
+RESET documentdb_core.enableCollation;
@@ -0,0 +1,56 @@
+SET search_path TO documentdb_api_catalog;
+
+SET documentdb.next_collection_id TO 15300;
+SET documentdb.next_collection_index_id TO 15300;
+
+-- $$NOW is passed to the accumulator expressions as a variable, which keeps them from being fused
+SET documentdb.enableNowSystemVariable TO off;
+
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 1, "group": 1, "num" : 4 }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 2, "group": 1, "num" : 7 }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 3, "group": 1, "num" : 13 }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 4, "group": 1, "num" : 16 }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 5, "group": 2, "num" : 1.5 }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 6, "group": 2, "num" : { "$numberLong": "10" } }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 7, "group": 2 }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 8, "group": 3, "num" : null }');
+SELECT documentdb_api.insert_one('db','fused_group',' { "_id" : 9, "group": 3 }');
+
+-- returns the fused aggregate of the $group from the verbose plan of the pipeline
+CREATE FUNCTION pg_temp.fused_group_accumulators(pipeline text) RETURNS SETOF text AS $$
+DECLARE
+    plan_line text;
+BEGIN
+    FOR plan_line IN EXECUTE format('EXPLAIN (VERBOSE ON, COSTS OFF) SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline(%L, %L)', 'db', pipeline) LOOP
+        IF plan_line ~ 'Output: .*bson_group_accumulators\(' THEN
+            RETURN NEXT substring(plan_line from 'documentdb_api_internal\.bson_group_accumulators\(.*$');
+        END IF;
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+/* fused $sum, $avg, $min, $max and $count accumulators */
+SET documentdb.enableFusedGroupAccumulators TO on;
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "fused_group", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "avg": { "$avg": "$num" }, "min": { "$min": "$num" }, "max": { "$max": "$num" }, "count": { "$count": {} }, "plusOne": { "$sum": { "$add": [ "$num", 1 ] } }, "missing": { "$max": "$missing" }, "noAvg": { "$avg": "$missing" } } }, { "$sort": { "_id": 1 } } ] }');
+SELECT pg_temp.fused_group_accumulators('{ "aggregate": "fused_group", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "avg": { "$avg": "$num" }, "min": { "$min": "$num" }, "max": { "$max": "$num" }, "count": { "$count": {} }, "plusOne": { "$sum": { "$add": [ "$num", 1 ] } }, "missing": { "$max": "$missing" }, "noAvg": { "$avg": "$missing" } } } ] }');
+
+/* the accumulators give the same results when they are not fused */
+SET documentdb.enableFusedGroupAccumulators TO off;
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "fused_group", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "avg": { "$avg": "$num" }, "min": { "$min": "$num" }, "max": { "$max": "$num" }, "count": { "$count": {} }, "plusOne": { "$sum": { "$add": [ "$num", 1 ] } }, "missing": { "$max": "$missing" }, "noAvg": { "$avg": "$missing" } } }, { "$sort": { "_id": 1 } } ] }');
+SELECT pg_temp.fused_group_accumulators('{ "aggregate": "fused_group", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "avg": { "$avg": "$num" }, "min": { "$min": "$num" }, "max": { "$max": "$num" }, "count": { "$count": {} }, "plusOne": { "$sum": { "$add": [ "$num", 1 ] } }, "missing": { "$max": "$missing" }, "noAvg": { "$avg": "$missing" } } } ] }');
+SET documentdb.enableFusedGroupAccumulators TO on;
+
+/* accumulators that are not all fusable are added individually */
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "fused_group", "pipeline": [ { "$match": { "group": 1 } }, { "$group": { "_id": "$group", "stdDev": { "$stdDevPop": "$num" }, "sum": { "$sum": "$num" } } } ] }');
+SELECT pg_temp.fused_group_accumulators('{ "aggregate": "fused_group", "pipeline": [ { "$match": { "group": 1 } }, { "$group": { "_id": "$group", "stdDev": { "$stdDevPop": "$num" }, "sum": { "$sum": "$num" } } } ] }');
+
+/* dotted output fields are left to the regular path, which rejects them */
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "fused_group", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "a.b": { "$max": "$num" } } } ] }');
+
+/* with $$NOW enabled the accumulators are not fused */
+SET documentdb.enableNowSystemVariable TO on;
+SELECT pg_temp.fused_group_accumulators('{ "aggregate": "fused_group", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" } } } ] }');
+SET documentdb.enableNowSystemVariable TO off;
+
+RESET documentdb.enableFusedGroupAccumulators;
+RESET documentdb.enableNowSystemVariable;
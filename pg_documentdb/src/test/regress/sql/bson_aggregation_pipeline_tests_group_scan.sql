@@ -0,0 +1,64 @@
+SET search_path TO documentdb_api_catalog;
+
+SET documentdb.next_collection_id TO 15400;
+SET documentdb.next_collection_index_id TO 15400;
+
+-- $$NOW keeps the accumulators from being fused, and only fused accumulators use the group scan
+SET documentdb.enableNowSystemVariable TO off;
+
+SELECT documentdb_api.insert_one('db','group_scan',' { "_id" : 1, "group": 1, "num" : 4 }');
+SELECT documentdb_api.insert_one('db','group_scan',' { "_id" : 2, "group": 1, "num" : 7 }');
+SELECT documentdb_api.insert_one('db','group_scan',' { "_id" : 3, "group": 2, "num" : 1.5 }');
+SELECT documentdb_api.insert_one('db','group_scan',' { "_id" : 4, "group": 2 }');
+SELECT documentdb_api.insert_one('db','group_scan',' { "_id" : 5, "num" : 3 }');
+
+SELECT COUNT(*) FROM (SELECT documentdb_api.insert_one('db', 'group_scan_spill', FORMAT('{ "_id": %s, "g": %s, "n": %s }', i, i % 2000, i)::documentdb_core.bson) FROM generate_series(1, 4000) i) innerQuery;
+
+-- returns the group scan node of the analyzed plan of the pipeline and its counters
+CREATE FUNCTION pg_temp.group_scan_analyze(pipeline text) RETURNS SETOF text AS $$
+DECLARE
+    plan_line text;
+    in_group_scan bool := false;
+BEGIN
+    FOR plan_line IN EXECUTE format('EXPLAIN (ANALYZE ON, COSTS OFF, TIMING OFF, SUMMARY OFF, BUFFERS OFF) SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline(%L, %L)', 'db', pipeline) LOOP
+        IF plan_line ~ 'DocumentDBApiGroupScan' THEN
+            in_group_scan := true;
+            RETURN NEXT 'Custom Scan (DocumentDBApiGroupScan)';
+        ELSIF plan_line ~ '->' THEN
+            in_group_scan := false;
+        ELSIF in_group_scan AND plan_line ~ '^\s*(Batches|Peak Memory Usage|Spilled Rows|Disk Usage):' THEN
+            RETURN NEXT btrim(plan_line);
+        END IF;
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+SET documentdb.enableFusedGroupAccumulators TO on;
+SET documentdb.enableCustomGroupScan TO on;
+
+/* fused accumulators executed by the group scan */
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "group_scan", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "avg": { "$avg": "$num" }, "min": { "$min": "$num" }, "max": { "$max": "$num" }, "count": { "$count": {} } } }, { "$sort": { "_id": 1 } } ] }');
+SELECT regexp_replace(line, '[0-9]+', 'N', 'g') AS group_scan FROM pg_temp.group_scan_analyze('{ "aggregate": "group_scan", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "avg": { "$avg": "$num" }, "min": { "$min": "$num" }, "max": { "$max": "$num" }, "count": { "$count": {} } } } ] }') line;
+
+/* groups over work_mem are spilled and aggregated in batches */
+SET work_mem TO '64kB';
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "group_scan_spill", "pipeline": [ { "$group": { "_id": "$g", "count": { "$count": {} }, "sum": { "$sum": "$n" } } }, { "$group": { "_id": null, "groups": { "$sum": 1 }, "total": { "$sum": "$sum" } } } ] }');
+SELECT regexp_replace(line, '[0-9]+', 'N', 'g') AS group_scan FROM pg_temp.group_scan_analyze('{ "aggregate": "group_scan_spill", "pipeline": [ { "$group": { "_id": "$g", "count": { "$count": {} }, "sum": { "$sum": "$n" } } } ] }') line;
+SELECT split_part(line, ':', 1) AS counter, split_part(btrim(split_part(line, ':', 2)), ' ', 1)::bigint > 1 AS is_over_one
+FROM pg_temp.group_scan_analyze('{ "aggregate": "group_scan_spill", "pipeline": [ { "$group": { "_id": "$g", "count": { "$count": {} }, "sum": { "$sum": "$n" } } } ] }') line
+WHERE line ~ '^(Batches|Spilled Rows):';
+
+/* the same groups without the group scan */
+SET documentdb.enableCustomGroupScan TO off;
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "group_scan_spill", "pipeline": [ { "$group": { "_id": "$g", "count": { "$count": {} }, "sum": { "$sum": "$n" } } }, { "$group": { "_id": null, "groups": { "$sum": 1 }, "total": { "$sum": "$sum" } } } ] }');
+SELECT group_scan FROM pg_temp.group_scan_analyze('{ "aggregate": "group_scan_spill", "pipeline": [ { "$group": { "_id": "$g", "count": { "$count": {} }, "sum": { "$sum": "$n" } } } ] }') group_scan;
+SET documentdb.enableCustomGroupScan TO on;
+
+/* accumulators that are not fused are not executed by the group scan */
+SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline('db', '{ "aggregate": "group_scan", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "nums": { "$push": "$num" } } }, { "$sort": { "_id": 1 } } ] }');
+SELECT group_scan FROM pg_temp.group_scan_analyze('{ "aggregate": "group_scan", "pipeline": [ { "$group": { "_id": "$group", "sum": { "$sum": "$num" }, "nums": { "$push": "$num" } } } ] }') group_scan;
+
+RESET work_mem;
+RESET documentdb.enableCustomGroupScan;
+RESET documentdb.enableFusedGroupAccumulators;
+RESET documentdb.enableNowSystemVariable;
@@ -0,0 +1,73 @@
+SET search_path TO documentdb_api_catalog, documentdb_core;
+
+SET documentdb.next_collection_id TO 15700;
+SET documentdb.next_collection_index_id TO 15700;
+
+-- $$NOW is passed to the window operators as a variable, keep their arguments to the document alone
+SET documentdb.enableNowSystemVariable TO off;
+
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 1, "v": 3 }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 2, "v": 3.0 }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 3, "v": { "$numberLong": "2" } }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 4, "v": null }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 5 }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 6, "v": [ 1, 5 ] }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 7, "v": 2.0 }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 8, "v": "a" }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 9, "v": [ 0 ] }');
+SELECT documentdb_api.insert_one('db','window_min_max',' { "_id" : 10, "v": 7 }');
+
+-- ints, doubles and longs that tie, nulls, missing values, strings and arrays
+SELECT COUNT(*) FROM (SELECT documentdb_api.insert_one('db', 'window_min_max_mixed', FORMAT('{ "_id": %s, "p": %s%s }', i, i % 2,
+    CASE i % 7
+        WHEN 0 THEN FORMAT(', "v": %s', i % 13)
+        WHEN 1 THEN FORMAT(', "v": %s.0', i % 13)
+        WHEN 2 THEN FORMAT(', "v": { "$numberLong": "%s" }', i % 13)
+        WHEN 3 THEN ', "v": null'
+        WHEN 4 THEN ''
+        WHEN 5 THEN FORMAT(', "v": [ %s, %s ]', i % 5, i % 3)
+        ELSE FORMAT(', "v": "%s"', i % 11) END)::bson) FROM generate_series(1, 1000) i) innerQuery;
+
+-- the moving aggregate state keeps the min and max as the window slides: ties keep the later value
+-- as the aggregates do, null and missing values are the least values and arrays the greatest here
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "window_min_max", "pipeline": [ { "$setWindowFields": { "sortBy": { "_id": 1 }, "output": { "min": { "$min": "$v", "window": { "documents": [ -1, 1 ] } }, "max": { "$max": "$v", "window": { "documents": [ -1, 1 ] } } } } }, { "$project": { "_id": 1, "min": 1, "max": 1 } } ] }');
+
+-- without a moving start the frame is aggregated from the first row
+SELECT document FROM bson_aggregation_pipeline('db', '{ "aggregate": "window_min_max", "pipeline": [ { "$setWindowFields": { "sortBy": { "_id": 1 }, "output": { "min": { "$min": "$v", "window": { "documents": [ "unbounded", 0 ] } }, "max": { "$max": "$v", "window": { "documents": [ "unbounded", 0 ] } } } } }, { "$project": { "_id": 1, "min": 1, "max": 1 } } ] }');
+
+-- returns the rows of the sliding window and the rows whose $min or $max differs from the aggregates
+-- recomputed for every frame, which a volatile argument forces instead of the moving aggregate state
+CREATE FUNCTION pg_temp.window_min_max_mismatches(collection_name text, partition_by text, frame_start int, frame_end int, OUT window_rows bigint, OUT mismatches bigint) AS $$
+BEGIN
+    EXECUTE format($query$
+        WITH moving AS (
+            SELECT bson_get_value(document, '_id')::text AS id, bson_get_value(document, 'min')::text AS min, bson_get_value(document, 'max')::text AS max
+            FROM documentdb_api_catalog.bson_aggregation_pipeline('db', %L)),
+        recomputed AS (
+            SELECT object_id::text AS id,
+                documentdb_api_catalog.BSONMIN(CASE WHEN random() >= 0 THEN documentdb_api_catalog.bson_expression_get(document, '{ "": "$v" }', true) END) OVER frame AS min,
+                documentdb_api_catalog.BSONMAX(CASE WHEN random() >= 0 THEN documentdb_api_catalog.bson_expression_get(document, '{ "": "$v" }', true) END) OVER frame AS max
+            FROM documentdb_api.collection('db', %L)
+            WINDOW frame AS (PARTITION BY %s ORDER BY object_id ROWS BETWEEN %s PRECEDING AND %s FOLLOWING))
+        SELECT COUNT(*), COUNT(*) FILTER (WHERE moving.min IS DISTINCT FROM recomputed.min::text OR moving.max IS DISTINCT FROM recomputed.max::text)
+        FROM moving FULL JOIN recomputed USING (id)$query$,
+        format('{ "aggregate": "%s", "pipeline": [ { "$setWindowFields": { %s"sortBy": { "_id": 1 }, "output": { "min": { "$min": "$v", "window": { "documents": [ %s, %s ] } }, "max": { "$max": "$v", "window": { "documents": [ %s, %s ] } } } } } ] }',
+            collection_name, CASE WHEN partition_by IS NULL THEN '' ELSE '"partitionBy": "$' || partition_by || '", ' END, frame_start, frame_end, frame_start, frame_end),
+        collection_name,
+        CASE WHEN partition_by IS NULL THEN 'true' ELSE format('documentdb_api_catalog.bson_expression_get(document, %L, true)', format('{ "": "$%s" }', partition_by)) END,
+        -frame_start, frame_end) INTO window_rows, mismatches;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT collection_name, partition_by, frame_start, frame_end, window_rows, mismatches
+FROM (VALUES
+    ('window_min_max', NULL, -1, 1),
+    ('window_min_max', NULL, -3, 0),
+    ('window_min_max_mixed', NULL, -1, 1),
+    ('window_min_max_mixed', NULL, -3, 0),
+    ('window_min_max_mixed', NULL, -10, 10),
+    ('window_min_max_mixed', NULL, -50, 5),
+    ('window_min_max_mixed', 'p', -7, 2)) frames(collection_name, partition_by, frame_start, frame_end),
+    pg_temp.window_min_max_mismatches(collection_name, partition_by, frame_start, frame_end);
+
+RESET documentdb.enableNowSystemVariable;
@@ -0,0 +1,116 @@
+SET search_path TO documentdb_api_catalog, documentdb_core;
+
+SET documentdb.next_collection_id TO 15500;
+SET documentdb.next_collection_index_id TO 15500;
+
+-- "a" is 1 in 70 rows, 2 in 20 and distinct in the last 10; "b" is null in 10 rows,
+-- "x" in 30 and missing in the rest; "rare" is only in one row
+SELECT COUNT(*) FROM (SELECT documentdb_api.insert_one('db', 'path_stats', FORMAT('{ "_id": %s, "a": %s%s%s }', i,
+    CASE WHEN i <= 70 THEN 1 WHEN i <= 90 THEN 2 ELSE i END,
+    CASE WHEN i <= 10 THEN ', "b": null' WHEN i <= 40 THEN ', "b": "x"' ELSE '' END,
+    CASE WHEN i = 50 THEN ', "rare": true' ELSE '' END)::bson) FROM generate_series(1, 100) i) innerQuery;
+
+ANALYZE documentdb_data.documents_15500;
+
+-- returns the per-path statistics ANALYZE stored for the document column
+CREATE FUNCTION pg_temp.path_statistics(collection_table regclass) RETURNS SETOF bson AS $$
+    SELECT path_stats
+    FROM pg_statistic s, unnest((CASE 7101
+        WHEN s.stakind1 THEN s.stavalues1::text
+        WHEN s.stakind2 THEN s.stavalues2::text
+        WHEN s.stakind3 THEN s.stavalues3::text
+        WHEN s.stakind4 THEN s.stavalues4::text
+        WHEN s.stakind5 THEN s.stavalues5::text END)::bson[]) path_stats
+    WHERE s.starelid = collection_table AND s.staattnum = (
+        SELECT attnum FROM pg_attribute WHERE attrelid = collection_table AND attname = 'document');
+$$ LANGUAGE sql;
+
+-- returns the rows the planner estimates for a $match on the collection
+CREATE FUNCTION pg_temp.estimated_rows(collection_name text, filter text, selectivity_mode bool) RETURNS int AS $$
+DECLARE
+    plan_line text;
+BEGIN
+    PERFORM set_config('documentdb.enableNewSelectivityMode', selectivity_mode::text, true);
+    FOR plan_line IN EXECUTE format('EXPLAIN SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline(%L, %L)', 'db',
+        format('{ "aggregate": "%s", "pipeline": [ { "$match": %s } ] }', collection_name, filter)) LOOP
+        RETURN substring(plan_line from 'rows=(\d+)')::int;
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+-- the statistics are sorted by path and only kept for paths found in more than one row,
+-- most common values and a histogram of the others are kept for sampled scalars
+SELECT path_stats FROM pg_temp.path_statistics('documentdb_data.documents_15500') path_stats WHERE path_stats->>'path' != '_id';
+
+-- estimates from the path statistics match the actual rows, rather than 1% of the rows without them;
+-- "rare" has no statistics and falls back to the statistics of the whole documents
+SELECT filter, pg_temp.estimated_rows('path_stats', filter, false) AS selectivity_off, pg_temp.estimated_rows('path_stats', filter, true) AS selectivity_on,
+    (SELECT COUNT(*) FROM bson_aggregation_pipeline('db', FORMAT('{ "aggregate": "path_stats", "pipeline": [ { "$match": %s } ] }', filter)::bson)) AS actual
+FROM (VALUES
+    ('{ "a": 1 }'),
+    ('{ "a": 95 }'),
+    ('{ "a": { "$in": [ 2, 95 ] } }'),
+    ('{ "a": { "$gt": 92 } }'),
+    ('{ "b": "x" }'),
+    ('{ "b": { "$exists": true } }'),
+    ('{ "b": { "$exists": false } }'),
+    ('{ "rare": { "$exists": true } }'),
+    ('{ "rare": { "$exists": false } }')) filters(filter);
+
+-- no path statistics are gathered when they are disabled
+SET documentdb_core.enableBsonPathStatistics TO off;
+ANALYZE documentdb_data.documents_15500;
+SELECT COUNT(*) FROM pg_temp.path_statistics('documentdb_data.documents_15500');
+RESET documentdb_core.enableBsonPathStatistics;
+ANALYZE documentdb_data.documents_15500;
+SELECT COUNT(*) FROM pg_temp.path_statistics('documentdb_data.documents_15500');
+
+-- "t" takes 10 values in 10 rows each and determines "r", which is 0 for the first 5 of them
+SELECT COUNT(*) FROM (SELECT documentdb_api.insert_one('db', 'path_dependencies', FORMAT('{ "_id": %s, "t": %s, "r": %s }', i, i % 10, (i % 10) / 5)::bson) FROM generate_series(1, 100) i) innerQuery;
+ANALYZE documentdb_data.documents_15501;
+
+-- given "t" the equality on "r" matches all the rows, so both estimate as the one on "t";
+-- given "r" the equality on "t" is only scaled up by how correlated their values are
+SELECT filter, pg_temp.estimated_rows('path_dependencies', filter, true) AS estimated,
+    (SELECT COUNT(*) FROM bson_aggregation_pipeline('db', FORMAT('{ "aggregate": "path_dependencies", "pipeline": [ { "$match": %s } ] }', filter)::bson)) AS actual
+FROM (VALUES
+    ('{ "t": 3 }'),
+    ('{ "r": 0 }'),
+    ('{ "t": 3, "r": 0 }'),
+    ('{ "r": 0, "t": 3 }')) filters(filter);
+
+-- without the dependencies the selectivities of the equalities are multiplied
+SET documentdb.enablePathDependencySelectivity TO off;
+SELECT filter, pg_temp.estimated_rows('path_dependencies', filter, true) AS estimated
+FROM (VALUES
+    ('{ "t": 3, "r": 0 }'),
+    ('{ "r": 0, "t": 3 }')) filters(filter);
+RESET documentdb.enablePathDependencySelectivity;
+
+-- returns the rows the planner estimates for the bitmap index scan of a $match on the collection
+CREATE FUNCTION pg_temp.estimated_index_rows(collection_name text, filter text) RETURNS int AS $$
+DECLARE
+    plan_line text;
+BEGIN
+    PERFORM set_config('documentdb.enableNewSelectivityMode', 'true', true);
+    FOR plan_line IN EXECUTE format('EXPLAIN SELECT document FROM documentdb_api_catalog.bson_aggregation_pipeline(%L, %L)', 'db',
+        format('{ "aggregate": "%s", "pipeline": [ { "$match": %s } ] }', collection_name, filter)) LOOP
+        IF plan_line ~ 'Bitmap Index Scan' THEN
+            RETURN substring(plan_line from 'rows=(\d+)')::int;
+        END IF;
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT documentdb_api_internal.create_indexes_non_concurrently('db', '{ "createIndexes": "path_dependencies", "indexes": [ { "key": { "r": 1 }, "name": "r_1" } ] }', true);
+
+-- the index scan only applies the equality on "r", which is estimated on its own
+-- rather than given the equality on "t" as in the estimate of the rows of the scan
+BEGIN;
+SET LOCAL enable_seqscan TO off;
+SET LOCAL enable_indexscan TO off;
+SELECT filter, pg_temp.estimated_rows('path_dependencies', filter, true) AS estimated, pg_temp.estimated_index_rows('path_dependencies', filter) AS index_estimated
+FROM (VALUES
+    ('{ "r": 0 }'),
+    ('{ "t": 3, "r": 0 }')) filters(filter);
+ROLLBACK;
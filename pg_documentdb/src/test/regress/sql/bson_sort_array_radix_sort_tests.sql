@@ -0,0 +1,70 @@
+SET search_path TO documentdb_api_catalog, documentdb_core;
+
+SET documentdb.next_collection_id TO 15800;
+SET documentdb.next_collection_index_id TO 15800;
+
+-- arrays of 200 elements, above the 64 from which the sort key radix sort applies,
+-- with many values that compare equal so that the order of ties shows if the sort is stable
+CREATE TEMP TABLE sort_inputs (name text, input text);
+INSERT INTO sort_inputs
+SELECT 'mixed numbers', '[ ' || string_agg(CASE i % 4
+        WHEN 0 THEN (i % 17)::text
+        WHEN 1 THEN (i % 17)::text || '.0'
+        WHEN 2 THEN format('{ "$numberLong": "%s" }', i % 17)
+        ELSE format('%s.5', i % 17 - 8) END, ', ' ORDER BY i) || ' ]' FROM generate_series(1, 200) i
+UNION ALL
+SELECT 'shared prefixes', '[ ' || string_agg(format('"pre%s%s"', repeat('fix', i % 4),
+        CASE WHEN i % 3 = 0 THEN '' ELSE (i % 7)::text END), ', ' ORDER BY i) || ' ]' FROM generate_series(1, 200) i
+UNION ALL
+SELECT 'mixed types', '[ ' || string_agg(CASE i % 6
+        WHEN 0 THEN 'null'
+        WHEN 1 THEN (i % 4 = 1)::text
+        WHEN 2 THEN format('"s%s"', i % 5)
+        WHEN 3 THEN format('%s.0', i % 5)
+        WHEN 4 THEN format('{ "a": %s }', i % 3)
+        ELSE format('[ %s ]', i % 2) END, ', ' ORDER BY i) || ' ]' FROM generate_series(1, 200) i
+UNION ALL
+SELECT 'documents', '[ ' || string_agg(format('{ %s"i": %s }', CASE i % 5
+        WHEN 0 THEN format('"k": %s, ', i % 9)
+        WHEN 1 THEN format('"k": %s.0, ', i % 9)
+        WHEN 2 THEN format('"k": "k%s", ', i % 4)
+        WHEN 3 THEN '"k": null, '
+        ELSE '' END, i), ', ' ORDER BY i) || ' ]' FROM generate_series(1, 200) i
+UNION ALL
+SELECT 'decimals', '[ ' || string_agg(CASE WHEN i % 2 = 0 THEN format('{ "$numberDecimal": "%s" }', i % 13)
+        ELSE (i % 13)::text END, ', ' ORDER BY i) || ' ]' FROM generate_series(1, 200) i;
+
+-- returns the array sorted by $sortArray or by the $sort of $push, with the radix sort on or off
+CREATE FUNCTION pg_temp.sort_array(operator text, input text, sort_by text, radix_sort bool) RETURNS text AS $$
+BEGIN
+    PERFORM set_config('documentdb.enableSortKeyRadixSort', radix_sort::text, true);
+    IF operator = '$sortArray' THEN
+        RETURN bson_dollar_project(format('{ "arr": %s }', input)::bson,
+            format('{ "sorted": { "$sortArray": { "input": "$arr", "sortBy": %s } } }', sort_by)::bson)::text;
+    END IF;
+
+    RETURN (documentdb_api_internal.bson_update_document('{ "_id": 1, "arr": [] }',
+        format('{ "": { "$push": { "arr": { "$each": %s, "$sort": %s } } } }', input, sort_by)::bson, '{}')).newDocument::text;
+END;
+$$ LANGUAGE plpgsql;
+
+-- the radix sort orders the values as the comparison sort does, and keeps ties in their order;
+-- decimals have no exact sort keys and fall back to the comparison sort
+SELECT operator, name, sort_by,
+    pg_temp.sort_array(operator, input, sort_by, true) = pg_temp.sort_array(operator, input, sort_by, false) AS same_as_comparison_sort
+FROM (VALUES
+    ('$sortArray', 'mixed numbers', '1'),
+    ('$sortArray', 'mixed numbers', '-1'),
+    ('$sortArray', 'shared prefixes', '1'),
+    ('$sortArray', 'shared prefixes', '-1'),
+    ('$sortArray', 'mixed types', '1'),
+    ('$sortArray', 'mixed types', '-1'),
+    ('$sortArray', 'documents', '{ "k": 1 }'),
+    ('$sortArray', 'documents', '{ "k": -1 }'),
+    ('$sortArray', 'decimals', '1'),
+    ('$push', 'mixed numbers', '1'),
+    ('$push', 'mixed numbers', '-1'),
+    ('$push', 'shared prefixes', '-1'),
+    ('$push', 'documents', '{ "k": 1 }'),
+    ('$push', 'documents', '{ "k": -1 }')) sorts(operator, name, sort_by)
+JOIN sort_inputs USING (name);
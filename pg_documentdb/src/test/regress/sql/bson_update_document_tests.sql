@@ -919,4 +919,66 @@ SELECT newDocument as bson_update_document FROM documentdb_api_internal.bson_upd
 
 --$rename working complex cases
 SELECT newDocument as bson_update_document FROM documentdb_api_internal.bson_update_document('{"_id": 1, "key": 1,"key2": 2,"f": {"g": 1, "h": 1},"h":1}', '{ "": { "$rename": { "key": "f.g"} } }', '{}');
-SELECT newDocument as bson_update_document FROM documentdb_api_internal.bson_update_document('{"_id": 2, "key": 2,"x": {"y": 1, "z": 2}}', '{ "": { "$rename": { "key": "newName","x.y":"z","x.z":"k"} } }', '{}');
\ No newline at end of file
+SELECT newDocument as bson_update_document FROM documentdb_api_internal.bson_update_document('{"_id": 2, "key": 2,"x": {"y": 1, "z": 2}}', '{ "": { "$rename": { "key": "newName","x.y":"z","x.z":"k"} } }', '{}');
+
+-- splice the fields with no updates from the source document
+SET documentdb.enableBsonSpliceWriter TO on;
+SELECT newDocument as bson_update_document FROM documentdb_api_internal.bson_update_document('{"_id": 1, "a": 1, "b": { "c": 1, "d": [1, 2], "e": { "f": 1 } }, "g": "x"}', '{ "": { "$set": { "b.e.f": 2, "h": 3 }, "$unset": { "a": 1 } } }', '{}');
+SELECT newDocument as bson_update_document FROM documentdb_api_internal.bson_update_document('{"_id": 1, "x": 1, "a": 1, "y": { "z": 1 }}', '{ "": { "$inc": { "a": 1 } } }', '{}');
+SELECT newDocument as bson_update_document FROM documentdb_api_internal.bson_update_document('{"_id": 1, "b": { "c": 1 }}', '{ "": { "$set": { "b.c": 1 } } }', '{}');
+RESET documentdb.enableBsonSpliceWriter;
+
+-- returns the updated document, or the error of the update, with the splice writer on or off
+CREATE FUNCTION pg_temp.update_with_splice_writer(source text, update_spec text, query text, array_filters text, splice_writer bool) RETURNS text AS $$
+BEGIN
+    PERFORM set_config('documentdb.enableBsonSpliceWriter', splice_writer::text, true);
+    RETURN bson_to_bson_hex((documentdb_api_internal.bson_update_document(source::bson, update_spec::bson, query::bson, array_filters::bson)).newDocument)::text;
+EXCEPTION WHEN OTHERS THEN
+    RETURN SQLERRM;
+END;
+$$ LANGUAGE plpgsql;
+
+-- the spliced documents are the same as the ones written field by field: positional updates,
+-- $rename across nesting levels, upserts, $unset of nested paths and paths through arrays
+SELECT update_case, pg_temp.update_with_splice_writer(source, update_spec, query, array_filters, true) IS NOT DISTINCT FROM
+    pg_temp.update_with_splice_writer(source, update_spec, query, array_filters, false) AS same_as_writer
+FROM (VALUES
+    ('$ positional', '{"_id": 1, "x": 1, "a": [ { "b": 1, "c": 2 }, { "b": 2, "c": 3 } ], "d": { "e": 1 }}', '{ "": { "$set": { "a.$.c": 10, "d.f": 1 } } }', '{ "a.b": 2 }', NULL),
+    ('$[] positional', '{"_id": 1, "x": 1, "a": [ { "b": 1, "c": 2 }, { "b": 2, "c": 3 } ], "d": { "e": 1 }}', '{ "": { "$inc": { "a.$[].c": 1 } } }', '{}', NULL),
+    ('$[<identifier>] positional', '{"_id": 1, "x": 1, "a": [ { "b": 1, "c": 2 }, { "b": 2, "c": 3 } ], "d": { "e": 1 }}', '{ "": { "$set": { "a.$[elem].c": 0 } } }', '{}', '{ "": [ { "elem.b": { "$gt": 1 } } ] }'),
+    ('$rename up', '{"_id": 1, "a": { "b": { "c": 1, "d": 2 } }, "x": 1, "y": { "z": 2 }}', '{ "": { "$rename": { "a.b.c": "w" } } }', '{}', NULL),
+    ('$rename down', '{"_id": 1, "a": { "b": { "c": 1, "d": 2 } }, "x": 1, "y": { "z": 2 }}', '{ "": { "$rename": { "x": "a.b.e", "y.z": "y.n.m" } } }', '{}', NULL),
+    ('$rename across', '{"_id": 1, "a": { "b": { "c": 1, "d": 2 } }, "x": 1, "y": { "z": 2 }}', '{ "": { "$rename": { "a.b.d": "y.d", "y.z": "a.z" } } }', '{}', NULL),
+    ('upsert', '{}', '{ "": { "$set": { "b.c": 1 }, "$setOnInsert": { "d": 2 } } }', '{ "_id": 5, "a": 1, "b.e": 3 }', NULL),
+    ('upsert with $inc', '{}', '{ "": { "$inc": { "a.b": 1, "c": 2 } } }', '{ "a.d": 1, "c": { "$gt": 0 } }', NULL),
+    ('nested $unset', '{"_id": 1, "a": { "b": { "c": 1, "d": 2 }, "e": 3 }, "f": 4}', '{ "": { "$unset": { "a.b.c": 1, "a.e": 1 } } }', '{}', NULL),
+    ('nested $unset to empty', '{"_id": 1, "a": { "b": { "c": 1, "d": 2 }, "e": 3 }, "f": 4}', '{ "": { "$unset": { "a.b.c": 1, "a.b.d": 1 } } }', '{}', NULL),
+    ('nested $unset of a missing path', '{"_id": 1, "a": { "b": { "c": 1, "d": 2 }, "e": 3 }, "f": 4}', '{ "": { "$unset": { "a.x.y": 1 } } }', '{}', NULL),
+    ('path through an array', '{"_id": 1, "a": [ { "b": 1 }, { "b": 2 } ], "c": { "d": [ 1, 2 ] }}', '{ "": { "$set": { "a.1.b": 3, "a.3": 1, "c.d.0": 0 } } }', '{}', NULL),
+    ('path through an array of arrays', '{"_id": 1, "a": [ { "b": [ 1 ] }, [ 2 ] ], "c": 1}', '{ "": { "$push": { "a.0.b": 2 }, "$set": { "a.1.0": 3 } } }', '{}', NULL),
+    ('path through an array value', '{"_id": 1, "a": [ { "b": [ 1 ] } ], "c": 1}', '{ "": { "$set": { "a.0.b.c": 1 } } }', '{}', NULL),
+    ('path through a scalar in an array', '{"_id": 1, "a": { "b": [ 1, { "c": 1 } ] }, "d": 1}', '{ "": { "$set": { "a.b.0.c": 1 } } }', '{}', NULL)) updates(update_case, source, update_spec, query, array_filters);
+
+-- replacement documents are validated the same with the single pass validation as with libbson;
+-- replacements are validated without the UTF-8 flag, so only the corrupt ones are rejected
+CREATE FUNCTION pg_temp.replace_error(update_hex text, fast_validation bool) RETURNS text AS $$
+BEGIN
+    PERFORM set_config('documentdb_core.enableFastBsonValidation', fast_validation::text, true);
+    PERFORM documentdb_api_internal.bson_update_document('{ "_id": 1 }', bson_hex_to_bson(update_hex), '{}');
+    RETURN NULL;
+EXCEPTION WHEN OTHERS THEN
+    RETURN SQLERRM;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT replacement, pg_temp.replace_error(update_hex, true) IS NOT NULL AS rejected,
+    pg_temp.replace_error(update_hex, true) IS NOT DISTINCT FROM pg_temp.replace_error(update_hex, false) AS same_error
+FROM (VALUES
+    ('{ "_id": 1, "a": { "b": 1 } }', 'BSONHEX2400000003001d000000105f696400010000000361000c00000010620001000000000000'),
+    ('nested document length past the document', 'BSONHEX2400000003001d000000105f696400010000000361002000000010620001000000000000'),
+    ('string length past the document', 'BSONHEX1f000000030018000000105f69640001000000027300100000006162000000'),
+    ('bool of 2', 'BSONHEX19000000030012000000105f69640001000000086200020000'),
+    ('invalid UTF-8 string', 'BSONHEX20000000030019000000105f696400010000000273000400000061ff62000000'),
+    ('overlong UTF-8 string', 'BSONHEX2100000003001a000000105f696400010000000273000500000061c0af62000000'),
+    ('deprecated binary subtype', 'BSONHEX2400000003001d000000105f6964000100000005640007000000020300000078797a0000'),
+    ('deprecated binary subtype with a wrong inner length', 'BSONHEX2400000003001d000000105f6964000100000005640007000000020400000078797a0000')) updates(replacement, update_hex);
@@ -1,80 +1,99 @@
-
-CREATE SCHEMA IF NOT EXISTS pisa_unit_test;
-SET search_path TO documentdb_api, documentdb_core, pisa_unit_test, public;
-
-SELECT 'Test 1: Data Bridge Component' as test_name;
-
-SELECT documentdb_api.test_bson_to_pisa_conversion('{"title": "test document", "content": "sample text content"}');
-
-SELECT documentdb_api.test_batch_bson_conversion('[{"_id": 1, "text": "first"}, {"_id": 2, "text": "second"}]');
-
-SELECT 'Test 2: Index Synchronization Component' as test_name;
-
-SELECT documentdb_api.test_index_sync_init();
-
-SELECT documentdb_api.test_document_change_detection();
-
-SELECT documentdb_api.test_incremental_index_update();
-
-SELECT 'Test 3: Query Router Component' as test_name;
-
-SELECT documentdb_api.test_query_type_detection('{"$text": {"$search": "test"}}');
-SELECT documentdb_api.test_query_type_detection('{"field": "value"}');
-
-SELECT documentdb_api.test_query_routing_decision('{"$text": {"$search": "machine learning"}}');
-
-SELECT 'Test 4: PISA Export Component' as test_name;
-
-SELECT documentdb_api.test_document_parsing('{"title": "Test", "content": "Sample content for testing"}');
-
-SELECT documentdb_api.test_forward_index_creation();
-
-SELECT 'Test 5: Advanced Query Algorithms Component' as test_name;
-
-SELECT documentdb_api.test_wand_algorithm_init();
-
-SELECT documentdb_api.test_block_max_wand_setup();
-
-SELECT documentdb_api.test_maxscore_algorithm();
-
-SELECT 'Test 6: Document Reordering Component' as test_name;
-
-SELECT documentdb_api.test_graph_construction();
-
-SELECT documentdb_api.test_recursive_bisection();
-
-SELECT documentdb_api.test_reordering_effectiveness();
-
-SELECT 'Test 7: Sharding Support Component' as test_name;
-
-SELECT documentdb_api.test_shard_configuration();
-
-SELECT documentdb_api.test_document_distribution();
-
-SELECT documentdb_api.test_cross_shard_queries();
-
-SELECT 'Test 8: Query Cache Component' as test_name;
-
-SELECT documentdb_api.test_cache_key_generation('{"$text": {"$search": "test query"}}');
-
-SELECT documentdb_api.test_cache_storage_retrieval();
-
-SELECT documentdb_api.test_cache_eviction();
-
-SELECT 'Test 9: Performance Monitor Component' as test_name;
-
-SELECT documentdb_api.test_metric_recording();
-
-SELECT documentdb_api.test_threshold_checking();
-
-SELECT documentdb_api.test_alert_generation();
-
-SELECT 'Test 10: Memory Optimization Component' as test_name;
-
-SELECT documentdb_api.test_memory_usage_tracking();
-
-SELECT documentdb_api.test_memory_optimization();
-
-SELECT documentdb_api.test_garbage_collection();
+-- PISA unit tests: the index components are exercised through the test
+-- functions of the extension library, on indexes written to temporary
+-- directories of the cluster.
+CREATE SCHEMA pisa_unit_test;
+SET search_path TO pisa_unit_test;
+
+SELECT 'Test 1: Posting Codecs' as test_name;
+
+CREATE FUNCTION codec_round_trip()
+RETURNS TABLE (codec text, cases int, round_trips bool)
+LANGUAGE C AS 'pg_documentdb', $$documentdb_pisa_codec_round_trip_for_test$$;
+
+CREATE FUNCTION posting_list_round_trip()
+RETURNS TABLE (compression int, terms int, postings int, round_trips bool)
+LANGUAGE C AS 'pg_documentdb', $$documentdb_pisa_posting_list_round_trip_for_test$$;
+
+-- bit-packing at every width, VByte and d-gaps at every run length up to a block
+SELECT * FROM codec_round_trip();
+
+-- full, tail, single posting and zero-gap lists read back with every compression
+SELECT * FROM posting_list_round_trip();
+
+SELECT 'Test 2: Top-k Queue' as test_name;
+
+CREATE FUNCTION topk_queue(candidate_count int, top_k int)
+RETURNS TABLE (implementation text, results int, same_as_sorted_array bool)
+LANGUAGE C AS 'pg_documentdb', $$documentdb_pisa_topk_queue_for_test$$;
+
+-- the heap keeps the same documents, order and threshold as the sorted array,
+-- whether it is offered one document at a time or in batches
+SELECT candidates, top_k, q.*
+FROM (VALUES (100000, 1), (100000, 10), (100000, 1000), (100, 1000)) v(candidates, top_k), topk_queue(candidates, top_k) q;
+
+-- the benchmark ends with the same threshold for every implementation
+SELECT implementation, candidates, threshold = max(threshold) OVER () AS same_threshold
+FROM documentdb_api.benchmark_pisa_topk_queue(100000, 10);
+
+SELECT 'Test 3: Ranked Query Algorithms' as test_name;
+
+CREATE FUNCTION ranked_query(top_k int)
+RETURNS TABLE (algorithm text, results int, same_as_exhaustive bool)
+LANGUAGE C AS 'pg_documentdb', $$documentdb_pisa_ranked_query_for_test$$;
+
+-- the dynamic pruning algorithms skip documents but return the same top-k
+-- documents and scores as scoring every posting
+SELECT k AS top_k, r.* FROM unnest(ARRAY[1, 10, 100]) k, ranked_query(k) r;
+
+SELECT 'Test 4: Document Reordering' as test_name;
+
+CREATE FUNCTION reordering()
+RETURNS TABLE (workers int, documents int, is_bijection bool, smaller_postings bool, same_as_serial bool)
+LANGUAGE C AS 'pg_documentdb', $$documentdb_pisa_reordering_for_test$$;
+
+-- graph bisection assigns every document exactly one new docid, groups the
+-- documents of a topic so the posting lists compress better, and the
+-- subtrees bisected by parallel workers end up in the same order
+SELECT * FROM reordering();
+
+SELECT 'Test 5: Delta Segments and Deletes' as test_name;
+
+CREATE FUNCTION segments()
+RETURNS TABLE (stage text, live_docs bigint, term text, docids int[])
+LANGUAGE C AS 'pg_documentdb', $$documentdb_pisa_segments_for_test$$;
+
+-- a term is read across the base and the delta segment in global docid order,
+-- and deleted documents are hidden from it until the segments are merged
+SELECT * FROM segments();
+
+SELECT 'Test 6: Query Cache Keys' as test_name;
+
+CREATE FUNCTION cache_key(database_name text, collection_name text, filter documentdb_core.bson, options documentdb_core.bson)
+RETURNS text
+LANGUAGE C AS 'pg_documentdb', $$documentdb_pisa_cache_key_for_test$$;
+
+-- queries that only list the same filter fields or options in another order
+-- share cached results; the fields of an equality document or a sort keep their order
+SELECT description, cache_key('db', 'articles', filter::documentdb_core.bson, options::documentdb_core.bson) =
+    cache_key('db', other_collection, other_filter::documentdb_core.bson, other_options::documentdb_core.bson) AS same_key
+FROM (VALUES
+    ('reordered fields with $text', '{ "$text": { "$search": "pisa" }, "category": "db" }', '{ }', 'articles', '{ "category": "db", "$text": { "$search": "pisa" } }', '{ }'),
+    ('reordered range operators', '{ "year": { "$gte": 2000, "$lt": 2010 } }', '{ }', 'articles', '{ "year": { "$lt": 2010, "$gte": 2000 } }', '{ }'),
+    ('reordered fields of an $or clause', '{ "$or": [ { "a": 1, "b": 2 }, { "c": 3 } ] }', '{ }', 'articles', '{ "$or": [ { "b": 2, "a": 1 }, { "c": 3 } ] }', '{ }'),
+    ('reordered fields of an equality document', '{ "author": { "first": "a", "last": "b" } }', '{ }', 'articles', '{ "author": { "last": "b", "first": "a" } }', '{ }'),
+    ('different value', '{ "category": "db" }', '{ }', 'articles', '{ "category": "os" }', '{ }'),
+    ('reordered options', '{ "category": "db" }', '{ "limit": 10, "skip": 5 }', 'articles', '{ "category": "db" }', '{ "skip": 5, "limit": 10 }'),
+    ('reordered sort fields', '{ "category": "db" }', '{ "sort": { "score": -1, "_id": 1 } }', 'articles', '{ "category": "db" }', '{ "sort": { "_id": 1, "score": -1 } }'),
+    ('different collection', '{ "category": "db" }', '{ }', 'books', '{ "category": "db" }', '{ }')) queries(description, filter, options, other_collection, other_filter, other_options);
+
+SELECT 'Test 7: Query Memory Pool' as test_name;
+
+-- the query structures come from the memory pool and are all returned to it by
+-- the end of the query; chunks still live are only released at transaction end
+BEGIN;
+SELECT count(*) FROM ranked_query(10);
+SELECT bool_or(allocations > 0) AS allocated, sum(live_chunks) AS live_chunks
+FROM documentdb_api.get_pisa_memory_stats();
+COMMIT;
 
 SELECT 'PISA Unit Tests Completed Successfully' as final_result;
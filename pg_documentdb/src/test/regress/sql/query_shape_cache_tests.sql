@@ -0,0 +1,101 @@
+SET search_path TO documentdb_api,documentdb_api_catalog,documentdb_core;
+SET documentdb.next_collection_id TO 15200;
+SET documentdb.next_collection_index_id TO 15200;
+
+-- $$NOW is written into the query as a constant and bypasses the cache
+SET documentdb.enableNowSystemVariable TO off;
+
+SELECT documentdb_api.insert_one('db', 'shapes', '{ "_id": 1, "a": 1, "s": "x", "o": { "$oid": "000000000000000000000001" }, "f": true, "t": { "$date": { "$numberLong": "1000" } } }');
+SELECT documentdb_api.insert_one('db', 'shapes', '{ "_id": 2, "a": 2, "s": "y", "o": { "$oid": "000000000000000000000002" }, "f": false, "t": { "$date": { "$numberLong": "2000" } } }');
+SELECT documentdb_api.insert_one('db', 'shapes', '{ "_id": 3, "a": 2, "s": "y", "o": { "$oid": "000000000000000000000002" }, "f": true, "t": { "$date": { "$numberLong": "2000" } } }');
+
+SELECT documentdb_api.insert_one('db', 'shapes_sharded', '{ "_id": 1, "a": 1 }');
+SELECT documentdb_api.insert_one('db', 'shapes_sharded', '{ "_id": 2, "a": 2 }');
+SELECT documentdb_api.insert_one('db', 'shapes_sharded', '{ "_id": 3, "a": 3 }');
+SELECT documentdb_api.shard_collection('db', 'shapes_sharded', '{ "a": "hashed" }', false);
+
+-- each shape runs three times: the first run caches its template, the second verifies
+-- it with other slot values and the third binds its values into it
+CREATE TEMP TABLE shape_specs (spec_id int, spec bson);
+INSERT INTO shape_specs VALUES
+    (1, '{ "find": "shapes", "filter": { "a": 1 }, "projection": { "_id": true } }'),
+    (2, '{ "find": "shapes", "filter": { "a": 2 }, "projection": { "_id": true } }'),
+    (3, '{ "find": "shapes", "filter": { "a": 3 }, "projection": { "_id": true } }'),
+    (4, '{ "find": "shapes", "filter": { "a": { "$numberLong": "1" } }, "projection": { "_id": true } }'),
+    (5, '{ "find": "shapes", "filter": { "a": { "$numberLong": "2" } }, "projection": { "_id": true } }'),
+    (6, '{ "find": "shapes", "filter": { "a": { "$numberLong": "3" } }, "projection": { "_id": true } }'),
+    (7, '{ "find": "shapes", "filter": { "a": 1.0 }, "projection": { "_id": true } }'),
+    (8, '{ "find": "shapes", "filter": { "a": 2.0 }, "projection": { "_id": true } }'),
+    (9, '{ "find": "shapes", "filter": { "a": 2.5 }, "projection": { "_id": true } }'),
+    (10, '{ "find": "shapes", "filter": { "s": "x" }, "projection": { "_id": true } }'),
+    (11, '{ "find": "shapes", "filter": { "s": "y" }, "projection": { "_id": true } }'),
+    (12, '{ "find": "shapes", "filter": { "s": "z" }, "projection": { "_id": true } }'),
+    (13, '{ "find": "shapes", "filter": { "o": { "$oid": "000000000000000000000001" } }, "projection": { "_id": true } }'),
+    (14, '{ "find": "shapes", "filter": { "o": { "$oid": "000000000000000000000002" } }, "projection": { "_id": true } }'),
+    (15, '{ "find": "shapes", "filter": { "o": { "$oid": "000000000000000000000003" } }, "projection": { "_id": true } }'),
+    (16, '{ "find": "shapes", "filter": { "f": true }, "projection": { "_id": true } }'),
+    (17, '{ "find": "shapes", "filter": { "f": false }, "projection": { "_id": true } }'),
+    (18, '{ "find": "shapes", "filter": { "f": true }, "projection": { "_id": true } }'),
+    (19, '{ "find": "shapes", "filter": { "t": { "$date": { "$numberLong": "1000" } } }, "projection": { "_id": true } }'),
+    (20, '{ "find": "shapes", "filter": { "t": { "$date": { "$numberLong": "2000" } } }, "projection": { "_id": true } }'),
+    (21, '{ "find": "shapes", "filter": { "t": { "$date": { "$numberLong": "3000" } } }, "projection": { "_id": true } }'),
+    (22, '{ "find": "shapes", "filter": { "_id": 1 }, "projection": { "_id": true } }'),
+    (23, '{ "find": "shapes", "filter": { "_id": 2 }, "projection": { "_id": true } }'),
+    (24, '{ "find": "shapes", "filter": { "_id": 4 }, "projection": { "_id": true } }'),
+    (25, '{ "find": "shapes", "filter": { "a": { "$eq": 1 } }, "projection": { "_id": true } }'),
+    (26, '{ "find": "shapes", "filter": { "a": { "$eq": 2 } }, "projection": { "_id": true } }'),
+    (27, '{ "find": "shapes", "filter": { "a": { "$eq": 3 } }, "projection": { "_id": true } }'),
+    (28, '{ "find": "shapes_sharded", "filter": { "a": 1 }, "projection": { "_id": true } }'),
+    (29, '{ "find": "shapes_sharded", "filter": { "a": 2 }, "projection": { "_id": true } }'),
+    (30, '{ "find": "shapes_sharded", "filter": { "a": 4 }, "projection": { "_id": true } }');
+
+-- runs the specs one at a time, in order
+CREATE FUNCTION pg_temp.run_shape_specs() RETURNS TABLE (spec_id int, page bson) AS $$
+DECLARE
+    spec_row record;
+BEGIN
+    FOR spec_row IN SELECT s.spec_id, s.spec FROM shape_specs s ORDER BY s.spec_id LOOP
+        spec_id := spec_row.spec_id;
+        SELECT cursorPage INTO page FROM documentdb_api.find_cursor_first_page('db', spec_row.spec);
+        RETURN NEXT;
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+SET documentdb.enableQueryShapeCache TO on;
+CREATE TEMP TABLE cached_pages AS SELECT * FROM pg_temp.run_shape_specs();
+SELECT spec_id, page FROM cached_pages ORDER BY spec_id;
+
+-- the second run of each shape makes its template bindable and the third one uses it;
+-- shard key values are not bson constants so the templates of sharded collections are not
+SELECT collection, filter_shape, state, calls, template_hits
+FROM documentdb_api_internal.query_shape_cache_stats()
+ORDER BY collection, filter_shape::text COLLATE "C";
+
+-- the results are the same with the cache off
+SET documentdb.enableQueryShapeCache TO off;
+SELECT spec_id, c.page AS cached_page, u.page AS uncached_page
+FROM cached_pages c JOIN pg_temp.run_shape_specs() u USING (spec_id)
+WHERE c.page::text != u.page::text;
+SET documentdb.enableQueryShapeCache TO on;
+
+-- dropping a collection changes the collections metadata, which drops every template
+SELECT documentdb_api.drop_collection('db', 'shapes');
+SELECT collection, filter_shape, state, calls, template_hits
+FROM documentdb_api_internal.query_shape_cache_stats() ORDER BY collection;
+
+-- the template of the recreated collection is verified again before it is used
+SELECT documentdb_api.insert_one('db', 'shapes', '{ "_id": 4, "a": 4 }');
+SELECT documentdb_api.insert_one('db', 'shapes', '{ "_id": 5, "a": 5 }');
+SELECT cursorPage FROM documentdb_api.find_cursor_first_page('db', '{ "find": "shapes", "filter": { "a": 1 }, "projection": { "_id": true } }');
+SELECT collection, filter_shape, state, calls, template_hits
+FROM documentdb_api_internal.query_shape_cache_stats() ORDER BY collection;
+SELECT cursorPage FROM documentdb_api.find_cursor_first_page('db', '{ "find": "shapes", "filter": { "a": 4 }, "projection": { "_id": true } }');
+SELECT cursorPage FROM documentdb_api.find_cursor_first_page('db', '{ "find": "shapes", "filter": { "a": 5 }, "projection": { "_id": true } }');
+SELECT collection, filter_shape, state, calls, template_hits
+FROM documentdb_api_internal.query_shape_cache_stats() ORDER BY collection;
+
+RESET documentdb.enableQueryShapeCache;
+RESET documentdb.enableNowSystemVariable;
+SELECT documentdb_api.drop_collection('db', 'shapes');
+SELECT documentdb_api.drop_collection('db', 'shapes_sharded');
@@ -1574,8 +1574,7 @@ ApplyDollarPushModifiers(const bson_value_t *bsonArray,
 		 * TODO: Optimization suggestion, use std:partial_sort kind of technique to limit compute when both $sort & $slice
 		 * are present
 		 */
-		qsort_arg(elementsArr, elementsArrLen, sizeof(ElementWithIndex),
-				  CompareBsonValuesForSort, pushState->sortContext);
+		SortElementsWithIndex(elementsArr, elementsArrLen, pushState->sortContext);
 	}
 
 	/* Step 5: Set the slice range in pushState */
@@ -325,6 +325,13 @@ static bool TraverseArrayAndApplyUpdate(bson_iter_t *sourceDocIterator,
 										const BsonUpdateIntermediatePathNode *tree,
 										CurrentDocumentState *state,
 										BsonUpdateTracker *tracker);
+static bool TraverseDocumentAndSpliceUpdate(bson_iter_t *sourceDocIterator,
+											pgbson_splice_writer *writer,
+											const BsonUpdateIntermediatePathNode *tree,
+											bool isRootLevel,
+											CurrentDocumentState *state,
+											BsonUpdateTracker *tracker,
+											bool hasArrayAncestors);
 static bool HandleCurrentIteratorPosition(bson_iter_t *documentIterator,
 										  const BsonUpdateIntermediatePathNode *tree,
 										  pgbson_element_writer *writer,
@@ -333,6 +340,20 @@ static bool HandleCurrentIteratorPosition(bson_iter_t *documentIterator,
 										  BsonUpdateTracker *tracker,
 										  bool isArray, bool hasArrayAncestors,
 										  StringView *fieldPath);
+static const BsonPathNode * FindNodeForIteratorPath(bson_iter_t *documentIterator,
+													const BsonUpdateIntermediatePathNode *
+													tree,
+													bool isArray,
+													CurrentDocumentState *state,
+													int *index);
+static bool HandleMatchedIteratorPosition(bson_iter_t *documentIterator,
+										  const BsonPathNode *child, int index,
+										  pgbson_element_writer *writer,
+										  Bitmapset **fieldHandledBitmapSet,
+										  CurrentDocumentState *state,
+										  BsonUpdateTracker *tracker,
+										  bool isArray, bool hasArrayAncestors,
+										  StringView *fieldPath);
 static bool IsNodeMatchForIteratorPath(const BsonPathNode *node,
 									   const StringView *fieldPath,
 									   bool isArray,
@@ -383,6 +404,8 @@ static const int MaxNumberOfUpdateOperators = sizeof(MongoUpdateOperators) /
 
 static int NumberOfUpdateOperators = MaxNumberOfUpdateOperators - 3;
 
+extern bool EnableBsonSpliceWriter;
+
 /*
  * Helper function to cast a node as an update intermediate node.
  */
@@ -691,18 +714,39 @@ ProcessUpdateOperatorWithState(pgbson *sourceDoc,
 
 	bool isRootLevel = true;
 	bool hasArrayAncestors = false;
-	bool documentUpdated = TraverseDocumentAndApplyUpdate(&docIterator, &writer,
+	bool useSpliceWriter = EnableBsonSpliceWriter;
+	bool documentUpdated;
+	pgbson_splice_writer spliceWriter;
+	if (useSpliceWriter)
+	{
+		/* The fields not updated are copied as is after the _id */
+		PgbsonSpliceWriterInit(&spliceWriter, VARSIZE_ANY_EXHDR(sourceDoc));
+		PgbsonSpliceWriterConcatWriter(&spliceWriter, &writer);
+		PgbsonWriterFree(&writer);
+
+		documentUpdated = TraverseDocumentAndSpliceUpdate(&docIterator, &spliceWriter,
 														  updateRoot, isRootLevel,
 														  &currentDocState,
 														  updateTracker,
 														  hasArrayAncestors);
+	}
+	else
+	{
+		documentUpdated = TraverseDocumentAndApplyUpdate(&docIterator, &writer,
+														 updateRoot, isRootLevel,
+														 &currentDocState,
+														 updateTracker,
+														 hasArrayAncestors);
+	}
+
 	updated = updated || documentUpdated;
 	if (!updated && !isUpsert)
 	{
 		return NULL;
 	}
 
-	pgbson *finalDoc = PgbsonWriterGetPgbson(&writer);
+	pgbson *finalDoc = useSpliceWriter ? PgbsonSpliceWriterGetPgbson(&spliceWriter) :
+					   PgbsonWriterGetPgbson(&writer);
 
 	/* Validate the _id */
 	bson_value_t newIdValue = { 0 };
@@ -1594,6 +1638,109 @@ TraverseDocumentAndApplyUpdate(bson_iter_t *sourceDocIterator,
 }
 
 
+/*
+ * Same as TraverseDocumentAndApplyUpdate, but the fields with no updates are
+ * spliced from the source document to the writer and nested documents with
+ * updates are traversed in turn. Only the other fields are written as in
+ * TraverseDocumentAndApplyUpdate.
+ *
+ * Returns true if the document was modified.
+ */
+static bool
+TraverseDocumentAndSpliceUpdate(bson_iter_t *sourceDocIterator,
+								pgbson_splice_writer *writer,
+								const BsonUpdateIntermediatePathNode *tree,
+								bool isRootLevel,
+								CurrentDocumentState *state,
+								BsonUpdateTracker *tracker,
+								bool hasArrayAncestors)
+{
+	check_stack_depth();
+	CHECK_FOR_INTERRUPTS();
+
+	Bitmapset *fieldHandledBitmapSet = NULL;
+	bool modified = false;
+	while (bson_iter_next(sourceDocIterator))
+	{
+		bool isArray = false;
+		StringView fieldPath = bson_iter_key_string_view(sourceDocIterator);
+
+		/* at the top level - if asked to skip _id - move on. */
+		if (isRootLevel && strcmp(fieldPath.string, "_id") == 0)
+		{
+			continue;
+		}
+
+		int index = 0;
+		const BsonPathNode *child = FindNodeForIteratorPath(sourceDocIterator, tree,
+															isArray, state, &index);
+		if (child == NULL)
+		{
+			PgbsonSpliceWriterAppendIter(writer, sourceDocIterator);
+			continue;
+		}
+
+		bool fieldModified = false;
+		if (child->nodeType == NodeType_Intermediate &&
+			BSON_ITER_HOLDS_DOCUMENT(sourceDocIterator))
+		{
+			bson_iter_t childIter;
+			uint32_t documentOffset = PgbsonSpliceWriterStartDocument(writer,
+																	  fieldPath.string,
+																	  fieldPath.length);
+			if (bson_iter_recurse(sourceDocIterator, &childIter))
+			{
+				bool isRootLevelInner = false;
+				fieldModified = TraverseDocumentAndSpliceUpdate(&childIter, writer,
+																CastAsUpdateIntermediateNode(
+																	child),
+																isRootLevelInner,
+																state, tracker,
+																hasArrayAncestors);
+			}
+			PgbsonSpliceWriterEndDocument(writer, documentOffset);
+
+			fieldHandledBitmapSet = bms_add_member(fieldHandledBitmapSet, index);
+		}
+		else
+		{
+			pgbson_writer fieldWriter;
+			pgbson_element_writer elementWriter;
+			PgbsonWriterInit(&fieldWriter);
+			PgbsonInitObjectElementWriter(&fieldWriter, &elementWriter, fieldPath.string,
+										  fieldPath.length);
+			fieldModified = HandleMatchedIteratorPosition(sourceDocIterator, child, index,
+														  &elementWriter,
+														  &fieldHandledBitmapSet, state,
+														  tracker, isArray,
+														  hasArrayAncestors, &fieldPath);
+			PgbsonSpliceWriterConcatWriter(writer, &fieldWriter);
+			PgbsonWriterFree(&fieldWriter);
+		}
+
+		modified = modified || fieldModified;
+	}
+
+	/* add any unresolved field nodes that needed to be added. */
+	pgbson_writer unresolvedWriter;
+	PgbsonWriterInit(&unresolvedWriter);
+	bool unresolvedModified = HandleUnresolvedDocumentFields(tree, fieldHandledBitmapSet,
+															 &unresolvedWriter,
+															 isRootLevel, state, tracker,
+															 hasArrayAncestors);
+	PgbsonSpliceWriterConcatWriter(writer, &unresolvedWriter);
+	PgbsonWriterFree(&unresolvedWriter);
+
+	modified = modified || unresolvedModified;
+	if (fieldHandledBitmapSet != NULL)
+	{
+		bms_free(fieldHandledBitmapSet);
+	}
+
+	return modified;
+}
+
+
 /*
  * Traverses the array with the sourceDocIterator, walks the update tree
  * and applies the update from the tree and writes the resultant modified
@@ -1689,112 +1836,145 @@ HandleCurrentIteratorPosition(bson_iter_t *documentIterator,
 							  bool isArray,
 							  bool hasArrayAncestors,
 							  StringView *fieldPath)
+{
+	int index = 0;
+	const BsonPathNode *child = FindNodeForIteratorPath(documentIterator, tree,
+														isArray, state, &index);
+	if (child == NULL)
+	{
+		/* no updates for this field in the document - write it to the target. */
+		PgbsonElementWriterWriteValue(writer, bson_iter_value(documentIterator));
+		return false;
+	}
+
+	return HandleMatchedIteratorPosition(documentIterator, child, index, writer,
+										 fieldHandledBitmapSet, state, tracker,
+										 isArray, hasArrayAncestors, fieldPath);
+}
+
+
+/*
+ * Returns the child of the tree that matches the field the iterator is on,
+ * and its index in the children, or NULL if none matches.
+ */
+static const BsonPathNode *
+FindNodeForIteratorPath(bson_iter_t *documentIterator,
+						const BsonUpdateIntermediatePathNode *tree,
+						bool isArray, CurrentDocumentState *state, int *index)
 {
 	const StringView path = bson_iter_key_string_view(documentIterator);
+	const bson_value_t *currentValue = bson_iter_value(documentIterator);
 
 	const BsonPathNode *child;
-	int index = 0;
+	*index = 0;
+	foreach_child(child, (&tree->base))
+	{
+		if (IsNodeMatchForIteratorPath(child, &path, isArray, state, currentValue))
+		{
+			return child;
+		}
+
+		(*index)++;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Applies the updates of the child of the tree at index, which matches the
+ * field the iterator is on, and writes the result to the writer.
+ * returns true if the field was modified.
+ */
+static bool
+HandleMatchedIteratorPosition(bson_iter_t *documentIterator,
+							  const BsonPathNode *child, int index,
+							  pgbson_element_writer *writer,
+							  Bitmapset **fieldHandledBitmapSet,
+							  CurrentDocumentState *state,
+							  BsonUpdateTracker *tracker,
+							  bool isArray,
+							  bool hasArrayAncestors,
+							  StringView *fieldPath)
+{
+	const StringView path = bson_iter_key_string_view(documentIterator);
 	const bson_value_t *currentValue = bson_iter_value(documentIterator);
 
-	foreach_child(child, (&tree->base))
+	switch (child->nodeType)
 	{
-		if (!IsNodeMatchForIteratorPath(child, &path, isArray, state, currentValue))
+		case NodeType_LeafIncluded:
+		case NodeType_LeafField:
+		case NodeType_LeafExcluded:
 		{
-			index++;
-			continue;
+			/* It's an update node */
+			const BsonUpdateLeafNode *node = CastAsUpdateLeafNode(child);
+			bool modified = WriteCurrentNode(node, currentValue, writer, state,
+											 tracker, isArray, hasArrayAncestors,
+											 fieldPath);
+			*fieldHandledBitmapSet = bms_add_member(*fieldHandledBitmapSet,
+													index);
+			return modified;
 		}
 
-		/* field is a match. */
-		switch (child->nodeType)
+		case NodeType_Intermediate:
 		{
-			case NodeType_LeafIncluded:
-			case NodeType_LeafField:
-			case NodeType_LeafExcluded:
-			{
-				/* It's an update node */
-				const BsonUpdateLeafNode *node = CastAsUpdateLeafNode(child);
-				bool modified = WriteCurrentNode(node, currentValue, writer, state,
-												 tracker, isArray, hasArrayAncestors,
-												 fieldPath);
-				*fieldHandledBitmapSet = bms_add_member(*fieldHandledBitmapSet,
-														index);
-				return modified;
-			}
+			const BsonUpdateIntermediatePathNode *intermediate =
+				CastAsUpdateIntermediateNode(child);
+			bool modified = false;
 
-			case NodeType_Intermediate:
+			/* the update is an intermediate document, write the nested */
+			/* document. */
+			if (BSON_ITER_HOLDS_DOCUMENT(documentIterator))
 			{
-				const BsonUpdateIntermediatePathNode *intermediate =
-					CastAsUpdateIntermediateNode(child);
-				bool modified = false;
-
-				/* the update is an intermediate document, write the nested */
-				/* document. */
-				if (BSON_ITER_HOLDS_DOCUMENT(documentIterator))
+				pgbson_writer childWriter;
+				bson_iter_t childIter;
+				PgbsonElementWriterStartDocument(writer, &childWriter);
+				if (bson_iter_recurse(documentIterator, &childIter))
 				{
-					pgbson_writer childWriter;
-					bson_iter_t childIter;
-					PgbsonElementWriterStartDocument(writer, &childWriter);
-					if (bson_iter_recurse(documentIterator, &childIter))
-					{
-						bool skipDocumentIdInner = false;
-						modified = TraverseDocumentAndApplyUpdate(&childIter,
-																  &childWriter,
-																  intermediate,
-																  skipDocumentIdInner,
-																  state, tracker,
-																  hasArrayAncestors);
-					}
-					PgbsonElementWriterEndDocument(writer, &childWriter);
+					bool skipDocumentIdInner = false;
+					modified = TraverseDocumentAndApplyUpdate(&childIter,
+															  &childWriter,
+															  intermediate,
+															  skipDocumentIdInner,
+															  state, tracker,
+															  hasArrayAncestors);
 				}
-				else if (BSON_ITER_HOLDS_ARRAY(documentIterator))
+				PgbsonElementWriterEndDocument(writer, &childWriter);
+			}
+			else if (BSON_ITER_HOLDS_ARRAY(documentIterator))
+			{
+				/* the update is an intermediate array, write the nested */
+				/* array. */
+				bson_iter_t childIter;
+				pgbson_array_writer childWriter;
+				PgbsonElementWriterStartArray(writer, &childWriter);
+				if (bson_iter_recurse(documentIterator, &childIter))
 				{
-					/* the update is an intermediate array, write the nested */
-					/* array. */
-					bson_iter_t childIter;
-					pgbson_array_writer childWriter;
-					PgbsonElementWriterStartArray(writer, &childWriter);
-					if (bson_iter_recurse(documentIterator, &childIter))
-					{
-						modified = TraverseArrayAndApplyUpdate(&childIter,
-															   &childWriter,
-															   intermediate,
-															   state, tracker);
-					}
-					PgbsonElementWriterEndArray(writer, &childWriter);
+					modified = TraverseArrayAndApplyUpdate(&childIter,
+														   &childWriter,
+														   intermediate,
+														   state, tracker);
 				}
-				else if (!IsIntermediateNodeWithField(child))
+				PgbsonElementWriterEndArray(writer, &childWriter);
+			}
+			else if (!IsIntermediateNodeWithField(child))
+			{
+				/* if it's an intermediate node that has no fields (e.g.)
+				 * $unset scenarios, treat it appropriately. This is the scenario
+				 * where we have say $unset: { "a.b": 0 } and the document is
+				 * { "a": 1 } - in this case we just write the value.
+				 */
+				if (isArray)
 				{
-					/* if it's an intermediate node that has no fields (e.g.)
-					 * $unset scenarios, treat it appropriately. This is the scenario
-					 * where we have say $unset: { "a.b": 0 } and the document is
-					 * { "a": 1 } - in this case we just write the value.
-					 */
-					if (isArray)
-					{
-						ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_BADVALUE), errmsg(
-											"Cannot create field '%s' in element {%s : %s}",
-											path.string, path.string,
-											BsonValueToJsonForLogging(bson_iter_value(
-																		  documentIterator)))));
-					}
-					else if (IsAnErrorForIntermediateNodeOfDollarRenameOp(
-								 intermediate->sourceOrTargetNodeForRenameOP,
-								 state->sourceDocument))
-					{
-						ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_PATHNOTVIABLE),
-										errmsg(
-											"Cannot create field '%s' in element {%s : %s}",
-											path.string, path.string,
-											BsonValueToJsonForLogging(bson_iter_value(
-																		  documentIterator)))));
-					}
-					else
-					{
-						PgbsonElementWriterWriteValue(writer, bson_iter_value(
-														  documentIterator));
-					}
+					ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_BADVALUE), errmsg(
+										"Cannot create field '%s' in element {%s : %s}",
+										path.string, path.string,
+										BsonValueToJsonForLogging(bson_iter_value(
+																	  documentIterator)))));
 				}
-				else
+				else if (IsAnErrorForIntermediateNodeOfDollarRenameOp(
+							 intermediate->sourceOrTargetNodeForRenameOP,
+							 state->sourceDocument))
 				{
 					ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_PATHNOTVIABLE),
 									errmsg(
@@ -1803,23 +1983,33 @@ HandleCurrentIteratorPosition(bson_iter_t *documentIterator,
 										BsonValueToJsonForLogging(bson_iter_value(
 																	  documentIterator)))));
 				}
-
-				*fieldHandledBitmapSet = bms_add_member(*fieldHandledBitmapSet,
-														index);
-				return modified;
+				else
+				{
+					PgbsonElementWriterWriteValue(writer, bson_iter_value(
+													  documentIterator));
+				}
 			}
-
-			default:
+			else
 			{
-				ereport(ERROR, (errmsg("Updating document - unexpected nodeType %d",
-									   child->nodeType)));
+				ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_PATHNOTVIABLE),
+								errmsg(
+									"Cannot create field '%s' in element {%s : %s}",
+									path.string, path.string,
+									BsonValueToJsonForLogging(bson_iter_value(
+																  documentIterator)))));
 			}
+
+			*fieldHandledBitmapSet = bms_add_member(*fieldHandledBitmapSet,
+													index);
+			return modified;
 		}
-	}
 
-	/* no updates for this field in the document - write it to the target. */
-	PgbsonElementWriterWriteValue(writer, bson_iter_value(documentIterator));
-	return false;
+		default:
+		{
+			ereport(ERROR, (errmsg("Updating document - unexpected nodeType %d",
+								   child->nodeType)));
+		}
+	}
 }
 
 
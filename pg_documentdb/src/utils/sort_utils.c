@@ -9,10 +9,44 @@
  */
 
 #include <postgres.h>
+#include <miscadmin.h>
 
 #include "utils/sort_utils.h"
 #include "utils/documentdb_errors.h"
 #include "query/bson_compare.h"
+#include "query/bson_sort_key.h"
+
+/* Arrays shorter than this are sorted with qsort */
+#define RADIX_SORT_MIN_ELEMENTS 64
+
+/* Partitions shorter than this are sorted with an insertion sort */
+#define RADIX_SORT_INSERTION_SORT_THRESHOLD 16
+
+/* One bucket per byte value, plus one for the keys that end */
+#define RADIX_SORT_BUCKETS 257
+
+/*
+ * The sort key of an element being radix sorted.
+ */
+typedef struct SortKeyEntry
+{
+	const uint8_t *key;
+	uint32_t keyLength;
+
+	/* Position of the element in the array being sorted */
+	uint32_t position;
+} SortKeyEntry;
+
+extern bool EnableSortKeyRadixSort;
+
+static bool TryRadixSortElements(ElementWithIndex *elements, int64_t elementCount,
+								 SortContext *sortContext);
+static void RadixSortKeyEntries(SortKeyEntry *entries, SortKeyEntry *scratch,
+								int64_t entryCount, uint32_t depth, bool isDescending);
+static void InsertionSortKeyEntries(SortKeyEntry *entries, int64_t entryCount,
+									uint32_t depth, bool isDescending);
+static inline int GetRadixBucket(const SortKeyEntry *entry, uint32_t depth,
+								 bool isDescending);
 
 /**
  * Validate sort spec and set SortContext once verified
@@ -219,3 +253,238 @@ CompareBsonValuesForSort(const void *a, const void *b, void *args)
 	}
 	return direction == SortDirection_Ascending ? result : -result;
 }
+
+
+/*
+ * Sorts the elements of an array for $push's $sort stage or $sortArray in the
+ * order of CompareBsonValuesForSort.
+ *
+ * When sorting on a single key, the elements are radix sorted on the sort
+ * keys of their values (see bson_sort_key.c) instead: each value is
+ * encoded once and the sort only looks at bytes, rather than comparing
+ * values O(n log n) times.
+ */
+void
+SortElementsWithIndex(ElementWithIndex *elements, int64_t elementCount,
+					  SortContext *sortContext)
+{
+	if (EnableSortKeyRadixSort && elementCount >= RADIX_SORT_MIN_ELEMENTS &&
+		TryRadixSortElements(elements, elementCount, sortContext))
+	{
+		return;
+	}
+
+	qsort_arg(elements, elementCount, sizeof(ElementWithIndex),
+			  CompareBsonValuesForSort, sortContext);
+}
+
+
+/*
+ * Radix sorts the elements on the sort keys of the values they are sorted
+ * by. Returns false without sorting if the sort has multiple keys or a sort
+ * key is not exact.
+ */
+static bool
+TryRadixSortElements(ElementWithIndex *elements, int64_t elementCount,
+					 SortContext *sortContext)
+{
+	const char *sortPath = NULL;
+	bool isDescending = sortContext->sortDirection == SortDirection_Descending;
+	if (sortContext->sortType == SortType_ObjectFieldSort)
+	{
+		if (list_length(sortContext->sortSpecList) != 1)
+		{
+			return false;
+		}
+
+		SortSpecData *sortSpec = (SortSpecData *) linitial(sortContext->sortSpecList);
+		sortPath = sortSpec->key;
+		isDescending = sortSpec->direction == SortDirection_Descending;
+	}
+	else if (sortContext->sortType != SortType_WholeElementSort)
+	{
+		return false;
+	}
+
+	/* Elements keep their order on equal keys, which must be that of their index */
+	for (int64_t i = 1; i < elementCount; i++)
+	{
+		if (elements[i].index <= elements[i - 1].index)
+		{
+			return false;
+		}
+	}
+
+	/* Sort keys are appended to a single buffer and located by offset */
+	StringInfoData keyBuffer;
+	initStringInfo(&keyBuffer);
+	SortKeyEntry *entries = palloc(sizeof(SortKeyEntry) * elementCount);
+	uint32_t *keyOffsets = palloc(sizeof(uint32_t) * elementCount);
+
+	bool areKeysExact = true;
+	for (int64_t i = 0; i < elementCount && areKeysExact; i++)
+	{
+		bson_value_t sortValue = elements[i].bsonValue;
+		if (sortPath != NULL)
+		{
+			/* As in CompareBsonValuesForSort, missing paths sort as null */
+			bson_iter_t documentIter, pathIter;
+			sortValue.value_type = BSON_TYPE_NULL;
+			if (elements[i].bsonValue.value_type == BSON_TYPE_DOCUMENT)
+			{
+				BsonValueInitIterator(&elements[i].bsonValue, &documentIter);
+				if (bson_iter_find_descendant(&documentIter, sortPath, &pathIter))
+				{
+					sortValue = *bson_iter_value(&pathIter);
+				}
+			}
+		}
+
+		keyOffsets[i] = keyBuffer.len;
+		areKeysExact = AppendBsonValueSortKey(&keyBuffer, &sortValue, NULL);
+		entries[i].keyLength = keyBuffer.len - keyOffsets[i];
+		entries[i].position = (uint32_t) i;
+	}
+
+	if (!areKeysExact)
+	{
+		pfree(keyBuffer.data);
+		pfree(keyOffsets);
+		pfree(entries);
+		return false;
+	}
+
+	for (int64_t i = 0; i < elementCount; i++)
+	{
+		entries[i].key = (const uint8_t *) keyBuffer.data + keyOffsets[i];
+	}
+
+	SortKeyEntry *scratch = palloc(sizeof(SortKeyEntry) * elementCount);
+	RadixSortKeyEntries(entries, scratch, elementCount, 0, isDescending);
+
+	ElementWithIndex *sortedElements = palloc(sizeof(ElementWithIndex) * elementCount);
+	for (int64_t i = 0; i < elementCount; i++)
+	{
+		sortedElements[i] = elements[entries[i].position];
+	}
+
+	memcpy(elements, sortedElements, sizeof(ElementWithIndex) * elementCount);
+
+	pfree(sortedElements);
+	pfree(scratch);
+	pfree(keyBuffer.data);
+	pfree(keyOffsets);
+	pfree(entries);
+	return true;
+}
+
+
+/*
+ * MSD radix sort of sort keys that share their first depth bytes. The sort
+ * is stable, so entries with equal keys stay in their original order.
+ */
+static void
+RadixSortKeyEntries(SortKeyEntry *entries, SortKeyEntry *scratch, int64_t entryCount,
+					uint32_t depth, bool isDescending)
+{
+	check_stack_depth();
+	CHECK_FOR_INTERRUPTS();
+
+	while (entryCount >= RADIX_SORT_INSERTION_SORT_THRESHOLD)
+	{
+		int64_t bucketCounts[RADIX_SORT_BUCKETS] = { 0 };
+		for (int64_t i = 0; i < entryCount; i++)
+		{
+			bucketCounts[GetRadixBucket(&entries[i], depth, isDescending)]++;
+		}
+
+		/* All keys share this byte: move on to the next one without recursing */
+		int sharedBucket = GetRadixBucket(&entries[0], depth, isDescending);
+		if (bucketCounts[sharedBucket] == entryCount)
+		{
+			if (entries[0].keyLength <= depth)
+			{
+				/* All keys are equal */
+				return;
+			}
+
+			depth++;
+			continue;
+		}
+
+		int64_t bucketStarts[RADIX_SORT_BUCKETS];
+		int64_t nextStart = 0;
+		for (int bucket = 0; bucket < RADIX_SORT_BUCKETS; bucket++)
+		{
+			bucketStarts[bucket] = nextStart;
+			nextStart += bucketCounts[bucket];
+		}
+
+		int64_t bucketPositions[RADIX_SORT_BUCKETS];
+		memcpy(bucketPositions, bucketStarts, sizeof(bucketStarts));
+		for (int64_t i = 0; i < entryCount; i++)
+		{
+			int bucket = GetRadixBucket(&entries[i], depth, isDescending);
+			scratch[bucketPositions[bucket]++] = entries[i];
+		}
+
+		memcpy(entries, scratch, sizeof(SortKeyEntry) * entryCount);
+
+		for (int bucket = 0; bucket < RADIX_SORT_BUCKETS; bucket++)
+		{
+			int64_t start = bucketStarts[bucket];
+			if (bucketCounts[bucket] > 1 && entries[start].keyLength > depth)
+			{
+				RadixSortKeyEntries(&entries[start], &scratch[start],
+									bucketCounts[bucket], depth + 1, isDescending);
+			}
+		}
+
+		return;
+	}
+
+	InsertionSortKeyEntries(entries, entryCount, depth, isDescending);
+}
+
+
+/*
+ * Stable insertion sort of sort keys that share their first depth bytes.
+ */
+static void
+InsertionSortKeyEntries(SortKeyEntry *entries, int64_t entryCount, uint32_t depth,
+						bool isDescending)
+{
+	for (int64_t i = 1; i < entryCount; i++)
+	{
+		SortKeyEntry current = entries[i];
+		int64_t j = i - 1;
+		while (j >= 0)
+		{
+			int cmp = CompareBsonSortKeys(entries[j].key + depth,
+										  entries[j].keyLength - depth,
+										  current.key + depth,
+										  current.keyLength - depth);
+			if ((isDescending ? -cmp : cmp) <= 0)
+			{
+				break;
+			}
+
+			entries[j + 1] = entries[j];
+			j--;
+		}
+
+		entries[j + 1] = current;
+	}
+}
+
+
+/*
+ * The bucket of a sort key for its byte at depth. Keys that end before
+ * depth sort first, or last for descending sorts.
+ */
+static inline int
+GetRadixBucket(const SortKeyEntry *entry, uint32_t depth, bool isDescending)
+{
+	int bucket = entry->keyLength > depth ? entry->key[depth] + 1 : 0;
+	return isDescending ? RADIX_SORT_BUCKETS - 1 - bucket : bucket;
+}
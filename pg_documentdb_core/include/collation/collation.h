@@ -19,6 +19,12 @@
 
 extern bool EnableCollation;
 
+/* A collator resolved once from a collation string */
+typedef struct CollatorHandle CollatorHandle;
+
+/* The ICU sort keys of the strings compared by an operation */
+typedef struct CollationSortKeyCache CollationSortKeyCache;
+
 void ParseAndGetCollationString(const bson_value_t *collationValue,
 								const char *collationString);
 char * GetCollationSortKey(const char *collationString, char *key, int keyLength);
@@ -27,6 +33,18 @@ int StringCompareWithCollation(const char *left, uint32_t leftLength,
 							   const char *right, uint32_t rightLength, const
 							   char *collationStr);
 
+const CollatorHandle * GetCollatorHandle(const char *collationString);
+int StringCompareWithCollator(const CollatorHandle *collatorHandle,
+							  const char *left, uint32_t leftLength,
+							  const char *right, uint32_t rightLength);
+
+CollationSortKeyCache * CreateCollationSortKeyCache(const char *collationString,
+													MemoryContext memoryContext,
+													Size maxSize);
+int StringCompareWithSortKeyCache(CollationSortKeyCache *cache,
+								  const char *left, uint32_t leftLength,
+								  const char *right, uint32_t rightLength);
+
 static inline bool
 IsCollationValid(const char *collationString)
 {
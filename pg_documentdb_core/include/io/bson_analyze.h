@@ -0,0 +1,68 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/io/bson_analyze.h
+ *
+ * Declarations of the per-path statistics gathered by ANALYZE on bson
+ * columns.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BSON_ANALYZE_H
+#define BSON_ANALYZE_H
+
+#include "io/bson_core.h"
+
+/*
+ * The pg_statistic slot kind holding per-path statistics. Its stavalues
+ * are one bson document per dotted path, sorted by path:
+ *
+ *   { "path": <string>, "exists": <fraction of rows having the path>,
+ *     "null": <fraction of rows where the path is null>,
+ *     "types": { "<bson type code>": <fraction of rows>, ... },
+ *     "mcv": [ <values> ], "mcf": [ <fraction of rows per value> ],
+ *     "distinct": <n_distinct of the non-null values, negative when it is
+ *                  a fraction of the rows>,
+ *     "otherFrac": <fraction of rows with a value outside the mcv>,
+ *     "hist": [ <equi-depth bounds of the values outside the mcv> ] }
+ *
+ * Slot kinds 1 to 99 are reserved for core and 100 to 299 for PostGIS.
+ */
+#define STATISTIC_KIND_BSON_PATHS 7101
+
+/*
+ * The pg_statistic slot kind holding the dependencies between the most
+ * frequent paths, one bson document per pair of paths:
+ *
+ *   { "paths": [ <first path>, <second path> ],
+ *     "dependency": [ <degree to which the first path determines the second>,
+ *                     <degree to which the second determines the first> ],
+ *     "correlation": <how many times fewer combinations of values the
+ *                     paths have than if they were independent> }
+ */
+#define STATISTIC_KIND_BSON_PATH_DEPENDENCIES 7102
+
+typedef enum BsonPathPredicate
+{
+	BsonPathPredicate_Equal,
+	BsonPathPredicate_NotEqual,
+	BsonPathPredicate_Greater,
+	BsonPathPredicate_GreaterEqual,
+	BsonPathPredicate_Less,
+	BsonPathPredicate_LessEqual,
+	BsonPathPredicate_In,
+	BsonPathPredicate_NotIn,
+	BsonPathPredicate_Exists,
+} BsonPathPredicate;
+
+bool EstimateBsonPathSelectivity(Datum *pathStats, int numPaths, double totalRows,
+								 const char *path, BsonPathPredicate predicate,
+								 const bson_value_t *value, double *selectivity);
+bool EstimateBsonPathConditionalSelectivity(Datum *dependencyStats, int numDependencies,
+											const char *givenPath,
+											double givenSelectivity,
+											const char *path, double selectivity,
+											double *conditionalSelectivity);
+
+#endif
@@ -11,6 +11,8 @@
 #ifndef BSON_HASH_H
 #define BSON_HASH_H
 
+#include <lib/stringinfo.h>
+
 #include "io/bson_core.h"
 
 uint64 HashBsonComparableExtended(bson_iter_t *bsonIterValue, int64 seed);
@@ -19,4 +21,11 @@ uint32_t HashBsonComparable(bson_iter_t *bsonIterValue, uint32_t seed);
 uint64 HashBsonValueComparableExtended(const bson_value_t *bsonIterValue, int64 seed);
 uint32_t HashBsonValueComparable(const bson_value_t *bsonIterValue, uint32_t seed);
 
+uint64 HashBsonQueryFilterExtended(bson_iter_t *filterIter, int64 seed);
+
+void AppendBsonValueComparableEncoding(StringInfo buffer, const bson_value_t *value);
+void AppendBsonValueComparableEncodingWithCollation(StringInfo buffer,
+													const bson_value_t *value,
+													const char *collationString);
+
 #endif
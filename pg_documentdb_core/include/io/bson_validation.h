@@ -0,0 +1,20 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/io/bson_validation.h
+ *
+ * Declarations of the single pass validation of input bson.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BSON_VALIDATION_H
+#define BSON_VALIDATION_H
+
+#include <bson.h>
+
+bool TryValidateBsonBytes(const uint8_t *documentBytes, uint32_t documentBytesLength,
+						  bson_validate_flags_t validateFlag);
+bool IsValidUtf8String(const char *string, uint32_t length, bool allowNull);
+
+#endif
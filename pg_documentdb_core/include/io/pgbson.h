@@ -71,6 +71,7 @@ void PgbsonValidateInputBson(const pgbson *document, bson_validate_flags_t valid
 void ValidateInputBsonBytes(const uint8_t *documentBytes,
 							uint32_t documentBytesLength,
 							bson_validate_flags_t validateFlag);
+bool TryParseJsonToPgbson(const char *json, size_t jsonLength, pgbson **document);
 
 pgbson * CastByteaToPgbson(bytea *byteBuffer);
 
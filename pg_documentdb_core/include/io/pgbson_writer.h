@@ -16,6 +16,7 @@
 #define PG_BSON_WRITER_H
 
 #include <datatype/timestamp.h>
+#include <lib/stringinfo.h>
 
 /* bson writer interface */
 typedef struct
@@ -60,6 +61,21 @@ typedef struct pgbson_element_writer
 	bool isArray;
 } pgbson_element_writer;
 
+/*
+ * A writer that builds a document out of the unchanged elements of other
+ * documents and written fields. The unchanged elements are copied as is and
+ * consecutive elements of a document are copied at once.
+ */
+typedef struct pgbson_splice_writer
+{
+	/* The varlena header followed by the document written so far */
+	StringInfoData buffer;
+
+	/* The unchanged elements appended but not copied yet */
+	const uint8_t *pendingStart;
+	uint32_t pendingLength;
+} pgbson_splice_writer;
+
 
 void PgbsonWriterInit(pgbson_writer *writer);
 uint32_t PgbsonWriterGetSize(pgbson_writer *writer);
@@ -173,4 +189,14 @@ void PgbsonHeapWriterStartArray(pgbson_heap_writer *writer, const char *path,
 								uint32_t pathLength, pgbson_array_writer *childWriter);
 void PgbsonHeapWriterEndArray(pgbson_heap_writer *writer,
 							  pgbson_array_writer *childWriter);
+
+void PgbsonSpliceWriterInit(pgbson_splice_writer *writer, uint32_t expectedSize);
+void PgbsonSpliceWriterAppendIter(pgbson_splice_writer *writer, const bson_iter_t *iter);
+void PgbsonSpliceWriterConcatWriter(pgbson_splice_writer *writer,
+									pgbson_writer *writerToConcat);
+uint32_t PgbsonSpliceWriterStartDocument(pgbson_splice_writer *writer, const char *path,
+										 uint32_t pathLength);
+void PgbsonSpliceWriterEndDocument(pgbson_splice_writer *writer,
+								   uint32_t documentOffset);
+pgbson * PgbsonSpliceWriterGetPgbson(pgbson_splice_writer *writer);
 #endif
@@ -28,7 +28,11 @@ int CompareBsonValueAndTypeWithCollation(const bson_value_t *left, const
 										 char *collationString);
 int CompareBsonSortOrderType(const bson_value_t *left, const bson_value_t *right);
 int CompareSortOrderType(bson_type_t left, bson_type_t right);
+int GetBsonTypeSortOrder(bson_type_t type);
 int CompareStrings(const char *left, uint32_t leftLength, const char *right, uint32_t
 				   rightLength, const char *collationString);
+int CompareStringsWithSortKeyCache(const char *left, uint32_t leftLength, const
+								   char *right, uint32_t rightLength,
+								   struct CollationSortKeyCache *sortKeyCache);
 
 #endif
@@ -0,0 +1,40 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/query/bson_sort_key.h
+ *
+ * Declarations of the memcmp comparable encoding of bson values.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BSON_SORT_KEY_H
+#define BSON_SORT_KEY_H
+
+#include <lib/stringinfo.h>
+
+#include "io/bson_core.h"
+
+/*
+ * The largest sort key of a value of fixed width: numbers other than
+ * decimal128, ObjectIds, dates, timestamps, booleans, null, MinKey and
+ * MaxKey.
+ */
+#define BSON_FIXED_WIDTH_SORT_KEY_LENGTH 16
+
+/* The number of leading sort key bytes kept in an abbreviated sort key */
+#define BSON_ABBREVIATED_SORT_KEY_LENGTH 8
+
+bool AppendBsonValueSortKey(StringInfo sortKey, const bson_value_t *value,
+							const char *collationString);
+uint64 GetBsonValueAbbreviatedSortKey(const bson_value_t *value,
+									  const char *collationString, StringInfo buffer);
+uint64 GetPgbsonAbbreviatedSortKey(const pgbson *document, StringInfo buffer);
+int WriteFixedWidthBsonSortKey(const bson_value_t *value,
+							   uint8_t sortKey[BSON_FIXED_WIDTH_SORT_KEY_LENGTH]);
+int CompareBsonSortKeys(const uint8_t *leftKey, uint32_t leftLength,
+						const uint8_t *rightKey, uint32_t rightLength);
+bool TryCompareBsonValuesBySortKey(const bson_value_t *left, const bson_value_t *right,
+								   int *cmp, bool *isComparisonValid);
+
+#endif
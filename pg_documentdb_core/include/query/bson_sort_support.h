@@ -0,0 +1,66 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/query/bson_sort_support.h
+ *
+ * Declarations of the sort support of bson operator classes.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BSON_SORT_SUPPORT_H
+#define BSON_SORT_SUPPORT_H
+
+#include <lib/hyperloglog.h>
+#include <lib/stringinfo.h>
+#include <utils/sortsupport.h>
+
+#include "io/bson_core.h"
+
+typedef struct BsonSortSupportState BsonSortSupportState;
+
+/*
+ * Computes the abbreviated key of a document being sorted: the first bytes
+ * of its sort key as a big endian integer.
+ */
+typedef uint64 (*BsonAbbreviatedKeyFunc)(pgbson *document,
+										 BsonSortSupportState *state);
+
+/*
+ * The state of a sort of bson documents, that abbreviates their keys when
+ * tuplesort allows it.
+ */
+struct BsonSortSupportState
+{
+	/* Computes the abbreviated keys */
+	BsonAbbreviatedKeyFunc abbreviatedKeyFunc;
+
+	/* State of the caller for the comparator and abbreviatedKeyFunc */
+	void *context;
+
+	/* The memory context living as long as the sort */
+	MemoryContext memoryContext;
+
+	/* Scratch buffer to build sort keys in */
+	StringInfoData sortKeyBuffer;
+
+	/*
+	 * Set by abbreviatedKeyFunc when the abbreviated keys of the sort can't
+	 * be compared with each other. All comparisons then use the full values.
+	 */
+	bool abbreviatedKeysIncomparable;
+
+	/* Whether the cardinality of the abbreviated keys is still tracked */
+	bool isEstimatingCardinality;
+
+	/* The number of documents abbreviated */
+	double inputCount;
+
+	/* Estimates the number of distinct abbreviated keys */
+	hyperLogLogState abbreviatedKeyCardinality;
+};
+
+void SetupBsonSortSupport(SortSupport ssup, SortSupportComparator fullComparator,
+						  BsonAbbreviatedKeyFunc abbreviatedKeyFunc, void *context);
+
+#endif
@@ -58,6 +58,7 @@ int64_t GetBsonDecimal128AsInt64(const bson_value_t *value,
 								 ConversionRoundingMode roundingMode);
 double GetBsonDecimal128AsDouble(const bson_value_t *value);
 double GetBsonDecimal128AsDoubleQuiet(const bson_value_t *value);
+double GetBsonDecimal128AsDoubleTowardZero(const bson_value_t *value);
 long double GetBsonDecimal128AsLongDouble(const bson_value_t *value);
 bool GetBsonDecimal128AsBool(const bson_value_t *value);
 char * GetBsonDecimal128AsString(const bson_value_t *value);
@@ -14,6 +14,19 @@
 
 typedef struct PcreData PcreData;
 
+/* How a regex that is a literal is matched */
+typedef enum RegexLiteralKind
+{
+	/* The regex isn't a literal */
+	RegexLiteralKind_None = 0,
+
+	/* The regex matches strings containing the literal */
+	RegexLiteralKind_Substring = 1,
+
+	/* The regex matches strings starting with the literal */
+	RegexLiteralKind_Prefix = 2,
+} RegexLiteralKind;
+
 void RegexCompileDuringPlanning(char *regexPatternStr, char *options);
 PcreData * RegexCompile(char *regexPatternStr, char *options);
 PcreData * RegexCompileForAggregation(char *regexPatternStr, char *options,
@@ -23,6 +36,7 @@ size_t * GetResultVectorUsingPcreData(PcreData *pcreData);
 int GetResultLengthUsingPcreData(PcreData *pcreData);
 bool IsValidRegexOptions(char *options);
 void FreePcreData(PcreData *pcreData);
+StringView GetRegexLiteralPrefix(PcreData *pcreData);
 
 bool PcreRegexExecute(char *regexPatternStr, char *options,
 					  PcreData *pcreData,
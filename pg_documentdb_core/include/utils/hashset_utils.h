@@ -79,6 +79,7 @@ CreateExtensionHashCTL(Size keySize, Size entrySize,
 
 HTAB * CreatePgbsonElementHashSet(void);
 HTAB * CreateStringViewHashSet(void);
+HTAB * CreateStringViewHashMap(Size entrySize);
 HTAB * CreateBsonValueHashSet(void);
 HTAB * CreatePgbsonElementOrderedHashSet(void);
 HTAB * CreateBsonValueWithCollationHashSet(int extraDataSize);
@@ -0,0 +1,85 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * include/utils/swar_utils.h
+ *
+ * Helpers to classify the bytes of a buffer 8 at a time in a uint64
+ * (SIMD within a register). These don't depend on any instruction set
+ * and are exact: no byte is ever reported for its neighbours.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SWAR_UTILS_H
+#define SWAR_UTILS_H
+
+#include <port/pg_bswap.h>
+
+#define SWAR_ONES UINT64CONST(0x0101010101010101)
+#define SWAR_LOW_BITS UINT64CONST(0x7F7F7F7F7F7F7F7F)
+#define SWAR_HIGH_BITS UINT64CONST(0x8080808080808080)
+
+
+/*
+ * Loads 8 bytes from an unaligned pointer such that the byte at pointer[i]
+ * is in bits 8 * i to 8 * i + 7 of the word.
+ */
+static inline uint64
+SwarLoadWord(const void *pointer)
+{
+	uint64 word;
+	memcpy(&word, pointer, sizeof(uint64));
+
+#ifdef WORDS_BIGENDIAN
+	word = pg_bswap64(word);
+#endif
+
+	return word;
+}
+
+
+/*
+ * Returns a word with the high bit set in each byte of word that is zero.
+ */
+static inline uint64
+SwarZeroBytes(uint64 word)
+{
+	return ~(((word & SWAR_LOW_BITS) + SWAR_LOW_BITS) | word | SWAR_LOW_BITS);
+}
+
+
+/*
+ * Returns a word with the high bit set in each byte of word equal to value.
+ */
+static inline uint64
+SwarEqualBytes(uint64 word, uint8 value)
+{
+	return SwarZeroBytes(word ^ (SWAR_ONES * value));
+}
+
+
+/*
+ * Returns a word with the high bit set in each byte of word less than value,
+ * which must be between 1 and 0x80.
+ */
+static inline uint64
+SwarLessThanBytes(uint64 word, uint8 value)
+{
+	return ~(((word & SWAR_LOW_BITS) + SWAR_ONES * (0x80 - value)) | word) &
+		   SWAR_HIGH_BITS;
+}
+
+
+/*
+ * Gathers the high bits of the bytes of word into an 8 bit mask, the high
+ * bit of the byte i becoming bit i.
+ */
+static inline uint8
+SwarHighBitMask(uint64 word)
+{
+	return (uint8) ((((word & SWAR_HIGH_BITS) >> 7) *
+					 UINT64CONST(0x0102040810204080)) >> 56);
+}
+
+
+#endif
@@ -0,0 +1,2 @@
+#include "udfs/bson_btree/bson_btree--0.105-0.sql"
+#include "schema/btree_opclass_members--0.105-0.sql"
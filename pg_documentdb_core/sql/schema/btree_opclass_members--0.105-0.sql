@@ -0,0 +1 @@
+ALTER OPERATOR FAMILY __CORE_SCHEMA__.bson_btree_ops USING btree ADD FUNCTION 2 (__CORE_SCHEMA__.bson, __CORE_SCHEMA__.bson) __CORE_SCHEMA__.bson_sortsupport(internal);
@@ -0,0 +1,5 @@
+CREATE OR REPLACE FUNCTION __CORE_SCHEMA__.bson_sortsupport(internal)
+ RETURNS void
+ LANGUAGE c
+ IMMUTABLE PARALLEL SAFE STRICT
+AS 'MODULE_PATHNAME', $function$extension_bson_sortsupport$function$;
@@ -60,3 +60,9 @@ CREATE OR REPLACE FUNCTION __CORE_SCHEMA__.bson_in_range_interval(__CORE_SCHEMA_
  LANGUAGE C
  IMMUTABLE PARALLEL SAFE STRICT
 AS 'MODULE_PATHNAME', $function$bson_in_range_interval$function$;
+
+CREATE OR REPLACE FUNCTION __CORE_SCHEMA__.bson_sortsupport(internal)
+ RETURNS void
+ LANGUAGE c
+ IMMUTABLE PARALLEL SAFE STRICT
+AS 'MODULE_PATHNAME', $function$extension_bson_sortsupport$function$;
@@ -45,6 +45,30 @@ bool EnableCollation = DEFAULT_ENABLE_COLLATION;
 #define DEFAULT_SKIP_BSON_ARRAY_TRAVERSE_OPTIMIZATION false
 bool SkipBsonArrayTraverseOptimization = DEFAULT_SKIP_BSON_ARRAY_TRAVERSE_OPTIMIZATION;
 
+/* GUC deciding whether ANALYZE gathers per-path statistics of bson columns */
+#define DEFAULT_ENABLE_BSON_PATH_STATISTICS true
+bool EnableBsonPathStatistics = DEFAULT_ENABLE_BSON_PATH_STATISTICS;
+
+/* GUC deciding whether sorts of bson compare abbreviated sort keys */
+#define DEFAULT_ENABLE_BSON_ABBREVIATED_SORT_KEYS true
+bool EnableBsonAbbreviatedSortKeys = DEFAULT_ENABLE_BSON_ABBREVIATED_SORT_KEYS;
+
+/* GUC deciding whether JSON input is parsed into bson by the two stage parser */
+#define DEFAULT_ENABLE_FAST_JSON_PARSER true
+bool EnableFastJsonParser = DEFAULT_ENABLE_FAST_JSON_PARSER;
+
+/* GUC deciding whether input bson is validated by a single pass over its bytes */
+#define DEFAULT_ENABLE_FAST_BSON_VALIDATION true
+bool EnableFastBsonValidation = DEFAULT_ENABLE_FAST_BSON_VALIDATION;
+
+/* GUC deciding whether decimal128 values with 64 bit coefficients are added and compared as integers */
+#define DEFAULT_ENABLE_DECIMAL128_FAST_PATH true
+bool EnableDecimal128FastPath = DEFAULT_ENABLE_DECIMAL128_FAST_PATH;
+
+/* GUC controlling how many compiled regexes a backend keeps, 0 disables the cache */
+#define DEFAULT_REGEX_CACHE_SIZE 128
+int RegexCacheSize = DEFAULT_REGEX_CACHE_SIZE;
+
 /* --------------------------------------------------------- */
 /* Top level exports */
 /* --------------------------------------------------------- */
@@ -91,6 +115,54 @@ InitDocumentDBCoreConfigurations(const char *prefix)
 		NULL, &SkipBsonArrayTraverseOptimization,
 		DEFAULT_SKIP_BSON_ARRAY_TRAVERSE_OPTIMIZATION,
 		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableBsonPathStatistics", prefix),
+		gettext_noop(
+			"Determines whether ANALYZE gathers statistics of the paths of bson documents."),
+		NULL, &EnableBsonPathStatistics,
+		DEFAULT_ENABLE_BSON_PATH_STATISTICS,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableBsonAbbreviatedSortKeys", prefix),
+		gettext_noop(
+			"Determines whether sorts of bson values compare abbreviated sort keys before the full values."),
+		NULL, &EnableBsonAbbreviatedSortKeys,
+		DEFAULT_ENABLE_BSON_ABBREVIATED_SORT_KEYS,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableFastJsonParser", prefix),
+		gettext_noop(
+			"Determines whether JSON is converted to bson by the two stage parser before falling back to libbson."),
+		NULL, &EnableFastJsonParser,
+		DEFAULT_ENABLE_FAST_JSON_PARSER,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableFastBsonValidation", prefix),
+		gettext_noop(
+			"Determines whether input bson is validated in a single pass before falling back to libbson."),
+		NULL, &EnableFastBsonValidation,
+		DEFAULT_ENABLE_FAST_BSON_VALIDATION,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		psprintf("%s.enableDecimal128FastPath", prefix),
+		gettext_noop(
+			"Determines whether decimal128 values with 64 bit coefficients are added and compared without the decimal math library."),
+		NULL, &EnableDecimal128FastPath,
+		DEFAULT_ENABLE_DECIMAL128_FAST_PATH,
+		PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		psprintf("%s.regexCacheSize", prefix),
+		gettext_noop(
+			"The number of compiled regular expressions each backend keeps for reuse across queries."),
+		NULL, &RegexCacheSize,
+		DEFAULT_REGEX_CACHE_SIZE, 0, 10000,
+		PGC_USERSET, 0, NULL, NULL, NULL);
 }
 
 
@@ -21,15 +21,46 @@
 #include "lib/stringinfo.h"
 #include "utils/documentdb_errors.h"
 #include "collation/collation.h"
+#include "utils/hashset_utils.h"
 
 #define ALPHABET_SIZE 26
 #define DEFAULT_ICU_COLLATION_SORT_KEY_LENGTH 512
 
-typedef struct
+/*
+ * A collator opened for a collation string. These are cached for the
+ * lifetime of the backend, so callers can hold on to them.
+ */
+struct CollatorHandle
 {
-	unsigned long collationKey;
-	UCollator *collator; /* locale_t struct, or 0 if not valid */
-} ucollator_cache_entry;
+	/* The ICU collation string, key of the cache */
+	char collationString[MAX_ICU_COLLATION_LENGTH];
+
+	UCollator *collator;
+};
+
+/*
+ * The ICU sort keys of strings, computed once per string for a query.
+ */
+struct CollationSortKeyCache
+{
+	const CollatorHandle *collator;
+
+	/* Holds the hash table, the strings and their sort keys */
+	MemoryContext memoryContext;
+	HTAB *sortKeys;
+
+	/* Strings are no longer added once the cache uses this many bytes */
+	Size maxSize;
+};
+
+typedef struct CollationSortKeyEntry
+{
+	/* key for hash entry; must be the first field */
+	StringView string;
+
+	char *sortKey;
+	uint32_t sortKeyLength;
+} CollationSortKeyEntry;
 
 /*
  *
@@ -236,7 +267,17 @@ char supported_locale_codes[ALPHABET_SIZE][ALPHABET_SIZE] = {
 
 static HTAB *collation_cache = NULL;
 
-static ucollator_cache_entry * LookupUCollatorCache(const char *collationString);
+/* The collator looked up last, as most queries only use the one collation */
+static CollatorHandle *LastCollatorHandle = NULL;
+
+static CollatorHandle * LookupUCollatorCache(const char *collationString);
+static char * GetSortKeyWithCollator(const CollatorHandle *collatorHandle,
+									 const char *key, int keyLength,
+									 uint32_t *sortKeyLength);
+static CollationSortKeyEntry * GetCollationSortKeyEntry(CollationSortKeyCache *cache,
+														const char *string,
+														uint32_t length,
+														bool *hasEntry);
 static void GenerateICULocaleAndExtractCollationOption(char *inputLocale, char **locale,
 													   char **collationOptionString);
 
@@ -484,12 +525,34 @@ StringCompareWithCollation(const char *left, uint32_t leftLength,
 						   const char *right, uint32_t rightLength, const
 						   char *collationStr)
 {
-	ucollator_cache_entry *collation_entry = LookupUCollatorCache(collationStr);
+	return StringCompareWithCollator(LookupUCollatorCache(collationStr),
+									 left, leftLength, right, rightLength);
+}
 
+
+/*
+ * Returns the collator of a collation string, to compare strings without
+ * looking it up by the string every time.
+ */
+const CollatorHandle *
+GetCollatorHandle(const char *collationString)
+{
+	return LookupUCollatorCache(collationString);
+}
+
+
+/*
+ *  Compares two strings with a collator returned by GetCollatorHandle.
+ */
+int
+StringCompareWithCollator(const CollatorHandle *collatorHandle,
+						  const char *left, uint32_t leftLength,
+						  const char *right, uint32_t rightLength)
+{
 	UErrorCode status = U_ZERO_ERROR;
 
 	/* Reference: varstr_cmp() in varlena.c */
-	int result = ucol_strcollUTF8(collation_entry->collator,
+	int result = ucol_strcollUTF8(collatorHandle->collator,
 								  left, leftLength,
 								  right, rightLength, &status);
 
@@ -498,10 +561,10 @@ StringCompareWithCollation(const char *left, uint32_t leftLength,
 		ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
 						errmsg(
 							"Collation aware string comparison failed for collation language tag: %s",
-							collationStr),
+							collatorHandle->collationString),
 						errdetail_log(
 							"Collation aware string comparison failed for collation language tag: %s",
-							collationStr)));
+							collatorHandle->collationString)));
 	}
 
 	return result;
@@ -510,34 +573,75 @@ StringCompareWithCollation(const char *left, uint32_t leftLength,
 
 /*
  *  Convenience function to generate a collation aware sortkey that can be used in strcmp().
- *
- *  Two calls to ucol_getSortKey() is a pattern used in pg code. This is to know the expected size
- *  of the sort key so that we allocate a larger buffer if needed.
- *  Reference: https://unicode-org.github.io/icu-docs/apidoc/dev/icu4c/ucol_8h.html#a58be2c76d01184cb1821ff0af28081c2
- *  Reference: https://unicode-org.github.io/icu/userguide/collation/api.html
  */
 inline char *
 GetCollationSortKey(const char *collationString, char *key, int keyLength)
 {
-	ucollator_cache_entry *collation_entry = LookupUCollatorCache(collationString);
+	uint32_t sortKeyLength;
+	return GetSortKeyWithCollator(LookupUCollatorCache(collationString), key,
+								  keyLength, &sortKeyLength);
+}
 
-	uint8_t *sortKeyPtr = palloc(DEFAULT_ICU_COLLATION_SORT_KEY_LENGTH);
-	UChar *uchar;
-	int32_t ulen;
 
-	ulen = icu_to_uchar(&uchar, key, keyLength);
-	Size expectedLength = ucol_getSortKey(collation_entry->collator, uchar, ulen,
-										  sortKeyPtr,
-										  DEFAULT_ICU_COLLATION_SORT_KEY_LENGTH);
-	if (expectedLength > DEFAULT_ICU_COLLATION_SORT_KEY_LENGTH)
+/*
+ * Creates a cache of the sort keys of strings for a collation in the given
+ * memory context, for operations that compare the same strings repeatedly
+ * such as sorts. Once maxSize bytes are used, further strings are compared
+ * without caching their sort keys.
+ */
+CollationSortKeyCache *
+CreateCollationSortKeyCache(const char *collationString, MemoryContext memoryContext,
+							Size maxSize)
+{
+	CollationSortKeyCache *cache = MemoryContextAllocZero(memoryContext,
+														  sizeof(CollationSortKeyCache));
+	cache->collator = LookupUCollatorCache(collationString);
+	cache->memoryContext = AllocSetContextCreate(memoryContext,
+												 "Collation sort key cache",
+												 ALLOCSET_DEFAULT_SIZES);
+	cache->maxSize = maxSize;
+
+	MemoryContext oldContext = MemoryContextSwitchTo(cache->memoryContext);
+	cache->sortKeys = CreateStringViewHashMap(sizeof(CollationSortKeyEntry));
+	MemoryContextSwitchTo(oldContext);
+
+	return cache;
+}
+
+
+/*
+ * Compares two strings as StringCompareWithCollation, by the sort keys
+ * of the strings in the cache. The sort key of each string is computed
+ * once, then comparisons are a memcmp.
+ */
+int
+StringCompareWithSortKeyCache(CollationSortKeyCache *cache,
+							  const char *left, uint32_t leftLength,
+							  const char *right, uint32_t rightLength)
+{
+	bool hasLeftEntry;
+	bool hasRightEntry;
+	CollationSortKeyEntry *leftEntry = GetCollationSortKeyEntry(cache, left, leftLength,
+																&hasLeftEntry);
+	CollationSortKeyEntry *rightEntry = GetCollationSortKeyEntry(cache, right,
+																 rightLength,
+																 &hasRightEntry);
+
+	if (!hasLeftEntry || !hasRightEntry)
 	{
-		sortKeyPtr = repalloc(sortKeyPtr, expectedLength);
-		ucol_getSortKey(collation_entry->collator, uchar, ulen, sortKeyPtr,
-						expectedLength);
+		/* The cache is full */
+		return StringCompareWithCollator(cache->collator, left, leftLength, right,
+										 rightLength);
 	}
 
-	pfree(uchar);
-	return (char *) sortKeyPtr;
+	uint32_t minLength = Min(leftEntry->sortKeyLength, rightEntry->sortKeyLength);
+	int cmp = memcmp(leftEntry->sortKey, rightEntry->sortKey, minLength);
+	if (cmp != 0)
+	{
+		return cmp;
+	}
+
+	return (int) leftEntry->sortKeyLength - (int) rightEntry->sortKeyLength;
 }
 
 
@@ -843,24 +947,6 @@ CheckCollationInputParamType(bson_type_t expectedType, bson_type_t foundType, co
 }
 
 
-/*
- * Well known hash function to efficiently calculate hash of a string. While it may have collisions it's unlikely in our case
- * where the hash function is used to generate hash code for limited number of collation strings. Even if there is collision,
- * the functionality will not be broken, we will just generate a few more cache entries
- */
-static unsigned long
-djb2(const char *str)
-{
-	unsigned long hash = 5381;
-	int c;
-	while ((c = *str++))
-	{
-		hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-	}
-	return hash;
-}
-
-
 /*
  * Cache that live the lifetime of a backend process and caches a Ucollator object for performing
  * collation related operations. Open a collator object can be expensive and hence we create this cache.
@@ -868,11 +954,25 @@ djb2(const char *str)
  *
  * This is inspired by lookup_collation_cache() in pg_locale.c
  */
-static ucollator_cache_entry *
+static CollatorHandle *
 LookupUCollatorCache(const char *collationString)
 {
-	ucollator_cache_entry *cache_entry;
-	bool found;
+	if (LastCollatorHandle != NULL &&
+		strcmp(LastCollatorHandle->collationString, collationString) == 0)
+	{
+		return LastCollatorHandle;
+	}
+
+	if (strlen(collationString) >= MAX_ICU_COLLATION_LENGTH)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
+						errmsg(
+							"Collation is not supported by ICU for collation language tag: %s",
+							collationString),
+						errdetail_log(
+							"Collation is not supported by ICU for collation language tag: %s",
+							collationString)));
+	}
 
 	if (collation_cache == NULL)
 	{
@@ -880,30 +980,27 @@ LookupUCollatorCache(const char *collationString)
 		HASHCTL ctl;
 		memset(&ctl, 0, sizeof(ctl));
 
-		ctl.keysize = sizeof(char *);
-		ctl.entrysize = sizeof(ucollator_cache_entry);
+		ctl.keysize = MAX_ICU_COLLATION_LENGTH;
+		ctl.entrysize = sizeof(CollatorHandle);
+		ctl.hcxt = AllocSetContextCreate(TopMemoryContext,
+										 "Collation Context",
+										 ALLOCSET_DEFAULT_SIZES);
 
-		MemoryContext tempContext = AllocSetContextCreate(CurrentMemoryContext,
-														  "Collation Context",
-														  ALLOCSET_DEFAULT_SIZES);
-
-		MemoryContext oldContext = MemoryContextSwitchTo(tempContext);
 		collation_cache = hash_create("Collator cache", 100, &ctl,
-									  HASH_ELEM | HASH_BLOBS);
-		MemoryContextSwitchTo(oldContext);
+									  HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
 	}
 
-	unsigned long collationKey = djb2(collationString);
-
-	cache_entry = hash_search(collation_cache, &collationKey, HASH_ENTER, &found);
+	bool found;
+	CollatorHandle *cache_entry = hash_search(collation_cache, collationString,
+											  HASH_ENTER, &found);
 	if (!found)
 	{
-		cache_entry->collationKey = collationKey;
 		UErrorCode status = U_ZERO_ERROR;
 		UCollator *collator = ucol_open(collationString, &status);
 
 		if (U_FAILURE(status))
 		{
+			hash_search(collation_cache, collationString, HASH_REMOVE, NULL);
 			ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_INTERNALERROR),
 							errmsg(
 								"Collation is not supported by ICU for collation language tag: %s",
@@ -916,10 +1013,82 @@ LookupUCollatorCache(const char *collationString)
 		cache_entry->collator = collator;
 	}
 
+	LastCollatorHandle = cache_entry;
 	return cache_entry;
 }
 
 
+/*
+ *  Generates the sort key of a string with a collator, as a NUL terminated
+ *  string whose length includes the terminator.
+ *
+ *  Two calls to ucol_getSortKey() is a pattern used in pg code. This is to know the expected size
+ *  of the sort key so that we allocate a larger buffer if needed.
+ *  Reference: https://unicode-org.github.io/icu-docs/apidoc/dev/icu4c/ucol_8h.html#a58be2c76d01184cb1821ff0af28081c2
+ *  Reference: https://unicode-org.github.io/icu/userguide/collation/api.html
+ */
+static char *
+GetSortKeyWithCollator(const CollatorHandle *collatorHandle, const char *key,
+					   int keyLength, uint32_t *sortKeyLength)
+{
+	uint8_t *sortKeyPtr = palloc(DEFAULT_ICU_COLLATION_SORT_KEY_LENGTH);
+	UChar *uchar;
+	int32_t ulen;
+
+	ulen = icu_to_uchar(&uchar, key, keyLength);
+	Size expectedLength = ucol_getSortKey(collatorHandle->collator, uchar, ulen,
+										  sortKeyPtr,
+										  DEFAULT_ICU_COLLATION_SORT_KEY_LENGTH);
+	if (expectedLength > DEFAULT_ICU_COLLATION_SORT_KEY_LENGTH)
+	{
+		sortKeyPtr = repalloc(sortKeyPtr, expectedLength);
+		ucol_getSortKey(collatorHandle->collator, uchar, ulen, sortKeyPtr,
+						expectedLength);
+	}
+
+	pfree(uchar);
+	*sortKeyLength = (uint32_t) expectedLength;
+	return (char *) sortKeyPtr;
+}
+
+
+/*
+ * Returns the entry of a string in a sort key cache, computing its sort key
+ * if it isn't there yet. hasEntry is false when the cache is full and the
+ * string isn't in it, in which case NULL is returned.
+ */
+static CollationSortKeyEntry *
+GetCollationSortKeyEntry(CollationSortKeyCache *cache, const char *string,
+						 uint32_t length, bool *hasEntry)
+{
+	StringView stringView = { .string = string, .length = length };
+	bool isFull = MemoryContextMemAllocated(cache->memoryContext, true) >=
+				  cache->maxSize;
+
+	bool found;
+	CollationSortKeyEntry *entry = hash_search(cache->sortKeys, &stringView,
+											   isFull ? HASH_FIND : HASH_ENTER,
+											   &found);
+	*hasEntry = entry != NULL;
+	if (entry == NULL || found)
+	{
+		return entry;
+	}
+
+	/* The entry must not point to the string of the caller */
+	MemoryContext oldContext = MemoryContextSwitchTo(cache->memoryContext);
+	char *stringCopy = palloc(length + 1);
+	memcpy(stringCopy, string, length);
+	stringCopy[length] = '\0';
+	entry->string.string = stringCopy;
+	entry->sortKey = GetSortKeyWithCollator(cache->collator, string, length,
+											&entry->sortKeyLength);
+	MemoryContextSwitchTo(oldContext);
+
+	return entry;
+}
+
+
 /*
  * For some collation we need to do additional processing to generate the language-tag-syntax locale from the input locale.
  * For example, en_US and en_US_POSIX needs to be converted to en-us and en-us-posix.
@@ -5,25 +5,1680 @@
  *
  * Implementation of the BSON analyze logic.
  *
+ * On top of the whole document statistics of std_typanalyze, ANALYZE
+ * discovers the dotted paths present in most of the sampled documents and
+ * stores for each of them the fraction of rows having the path, its null
+ * fraction, the distribution of its types, its most common values and an
+ * equi-depth histogram of the other values (see bson_analyze.h). These are
+ * what the selectivity functions of the query operators estimate with.
+ *
+ * For the most frequent of these paths it also stores the functional
+ * dependencies between each pair and how correlated their values are, so
+ * that equalities on several paths are not estimated as independent.
+ *
  *-------------------------------------------------------------------------
  */
 
 
 #include <postgres.h>
 #include <fmgr.h>
+#include <math.h>
+#include <miscadmin.h>
+#include <catalog/pg_type.h>
 #include <commands/vacuum.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <utils/selfuncs.h>
+
+#include "io/bson_core.h"
+#include "io/bson_analyze.h"
+#include "query/bson_compare.h"
+
+
+/* Paths longer than this are not tracked */
+#define BSON_ANALYZE_MAX_PATH_LENGTH 128
+
+/* Documents are walked down to this nesting depth */
+#define BSON_ANALYZE_MAX_DEPTH 5
+
+/* Number of distinct paths counted in the first pass over the sample */
+#define BSON_ANALYZE_MAX_TRACKED_PATHS 10000
+
+/* Number of paths statistics are kept for */
+#define BSON_ANALYZE_MAX_PATHS 32
+
+/* Wider values are only accounted for in the type distribution */
+#define BSON_ANALYZE_MAX_VALUE_WIDTH 256
+
+/* Caps the most common values and histogram bounds of a path */
+#define BSON_ANALYZE_MAX_BUCKETS 100
+
+/* Dependencies are gathered between each pair of this many paths */
+#define BSON_ANALYZE_MAX_DEPENDENCY_PATHS 8
+
+/* Pairs of paths found together in fewer rows are not considered */
+#define BSON_ANALYZE_MIN_DEPENDENCY_ROWS 10
+
+#define BSON_ANALYZE_NUM_TYPES 256
+
+/* Rows in which a path was found during the first pass */
+typedef struct BsonPathCount
+{
+	char path[BSON_ANALYZE_MAX_PATH_LENGTH];
+	int rowCount;
+	int lastRow;
+} BsonPathCount;
+
+/* A value of a path and the sample row it came from */
+typedef struct BsonPathSample
+{
+	bson_value_t value;
+	int row;
+	bool isArrayElement;
+} BsonPathSample;
+
+/* Statistics of a path being gathered during the second pass */
+typedef struct BsonPathStatsBuilder
+{
+	char path[BSON_ANALYZE_MAX_PATH_LENGTH];
+	int rowCount;
+	int nullCount;
+	int lastRow;
+	int typeCounts[BSON_ANALYZE_NUM_TYPES];
+
+	BsonPathSample *samples;
+	int numSamples;
+	int maxSamples;
+} BsonPathStatsBuilder;
+
+typedef struct BsonPathWalkState
+{
+	HTAB *paths;
+
+	/* Whether this is the second pass, which gathers the values */
+	bool collectValues;
+
+	/* Whether paths not in the table yet are added to it */
+	bool addPaths;
+
+	int row;
+	int maxSamples;
+	MemoryContext valueContext;
+} BsonPathWalkState;
+
+/* The values two paths have in the same row */
+typedef struct BsonPathPairSample
+{
+	const bson_value_t *first;
+	const bson_value_t *second;
+} BsonPathPairSample;
+
+/* The statistics of a path read back from pg_statistic */
+typedef struct BsonPathStatistics
+{
+	double existsFraction;
+	double nullFraction;
+	double otherFraction;
+	double distinct;
+	double typeFractions[BSON_ANALYZE_NUM_TYPES];
+
+	int numMcv;
+	bson_value_t *mcv;
+	double *mcf;
+
+	int numHist;
+	bson_value_t *hist;
+} BsonPathStatistics;
+
+static AnalyzeAttrComputeStatsFunc StdComputeStats = NULL;
+
+extern bool EnableBsonPathStatistics;
+
+static void ComputeBsonStats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+							 int samplerows, double totalrows);
+static void ComputeBsonPathStats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+								 int samplerows, double totalrows);
+static void StoreStatisticsSlot(VacAttrStats *stats, int16 kind, pgbson **documents,
+								int numDocuments);
+static void WalkSampleRows(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+						   int samplerows, BsonPathWalkState *state);
+static void WalkDocumentPaths(bson_iter_t *iter, StringInfo path, int depth,
+							  BsonPathWalkState *state);
+static void WalkArrayElements(bson_iter_t *iter, StringInfo path, int depth,
+							  BsonPathWalkState *state);
+static void RecordPathValue(BsonPathWalkState *state, const char *path,
+							const bson_value_t *value, bool isArrayElement);
+static bool IsSampledValue(const bson_value_t *value);
+static int CompareBsonPathCountsByRows(const void *left, const void *right);
+static int CompareBsonPathBuildersByPath(const void *left, const void *right);
+static int CompareBsonPathSamples(const void *left, const void *right);
+static int CompareBsonPathGroupsByRows(const void *left, const void *right);
+static pgbson * BuildPathStatsDocument(BsonPathStatsBuilder *builder, int samplerows,
+									   double totalrows, int target);
+static int BuildPathDependencyDocuments(BsonPathStatsBuilder **builders, int numBuilders,
+										int samplerows, pgbson **documents);
+static pgbson * BuildPathDependencyDocument(BsonPathStatsBuilder *first,
+											BsonPathStatsBuilder *second,
+											int *firstRowSamples,
+											int *secondRowSamples, int samplerows);
+static int ComparePathPairsByFirst(const void *left, const void *right);
+static int ComparePathPairsBySecond(const void *left, const void *right);
+
+static void ReadPathStatistics(pgbson *document, BsonPathStatistics *pathStats);
+static bool FindPathStatistics(Datum *pathStats, int numPaths, const char *path,
+							   BsonPathStatistics *result);
+static bool EstimateEquality(BsonPathStatistics *pathStats, double totalRows,
+							 const bson_value_t *value, double *selectivity);
+static bool EstimateRange(BsonPathStatistics *pathStats, BsonPathPredicate predicate,
+						  const bson_value_t *value, double *selectivity);
+static double GetSortClassFraction(BsonPathStatistics *pathStats, bson_type_t type);
+static double GetHistogramPosition(BsonPathStatistics *pathStats,
+								   const bson_value_t *value);
 
 PG_FUNCTION_INFO_V1(bson_typanalyze);
 
 
 /*
  * Implement type analyze for bson.
- * Right now thunks to the default - but in the future
- * will be extended to support more.
+ * Uses the default whole value statistics and adds per-path statistics
+ * to them (see ComputeBsonStats).
  */
 Datum
 bson_typanalyze(PG_FUNCTION_ARGS)
 {
 	VacAttrStats *stats = (VacAttrStats *) PG_GETARG_POINTER(0);
-	PG_RETURN_BOOL(std_typanalyze(stats));
+	if (!std_typanalyze(stats))
+	{
+		PG_RETURN_BOOL(false);
+	}
+
+	/* std_typanalyze picks the same function every time for the bson type */
+	StdComputeStats = stats->compute_stats;
+	stats->compute_stats = ComputeBsonStats;
+	PG_RETURN_BOOL(true);
+}
+
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+/*
+ * Estimates the selectivity of a predicate on a path from the per-path
+ * statistics of the column. pathStats are the values of the
+ * STATISTIC_KIND_BSON_PATHS slot and totalRows the row count of the
+ * relation.
+ *
+ * Returns false if the path has no statistics or the predicate can't be
+ * estimated from them, in which case the caller should fall back to its
+ * own defaults.
+ */
+bool
+EstimateBsonPathSelectivity(Datum *pathStats, int numPaths, double totalRows,
+							const char *path, BsonPathPredicate predicate,
+							const bson_value_t *value, double *selectivity)
+{
+	BsonPathStatistics stats;
+	if (!FindPathStatistics(pathStats, numPaths, path, &stats))
+	{
+		return false;
+	}
+
+	double result;
+	switch (predicate)
+	{
+		case BsonPathPredicate_Equal:
+		{
+			if (!EstimateEquality(&stats, totalRows, value, &result))
+			{
+				return false;
+			}
+
+			break;
+		}
+
+		case BsonPathPredicate_NotEqual:
+		{
+			if (value->value_type == BSON_TYPE_NULL)
+			{
+				/* $ne: null matches the rows where the path exists and isn't null */
+				result = stats.existsFraction - stats.nullFraction;
+				break;
+			}
+
+			if (!EstimateEquality(&stats, totalRows, value, &result))
+			{
+				return false;
+			}
+
+			result = 1.0 - result;
+			break;
+		}
+
+		case BsonPathPredicate_Greater:
+		case BsonPathPredicate_GreaterEqual:
+		case BsonPathPredicate_Less:
+		case BsonPathPredicate_LessEqual:
+		{
+			if (!EstimateRange(&stats, predicate, value, &result))
+			{
+				return false;
+			}
+
+			break;
+		}
+
+		case BsonPathPredicate_In:
+		case BsonPathPredicate_NotIn:
+		{
+			if (value->value_type != BSON_TYPE_ARRAY)
+			{
+				return false;
+			}
+
+			bson_iter_t arrayIter;
+			BsonValueInitIterator(value, &arrayIter);
+
+			result = 0;
+			while (bson_iter_next(&arrayIter))
+			{
+				double elementSelectivity;
+				if (!EstimateEquality(&stats, totalRows, bson_iter_value(&arrayIter),
+									  &elementSelectivity))
+				{
+					return false;
+				}
+
+				result += elementSelectivity;
+			}
+
+			result = Min(result, 1.0);
+			if (predicate == BsonPathPredicate_NotIn)
+			{
+				result = 1.0 - result;
+			}
+
+			break;
+		}
+
+		case BsonPathPredicate_Exists:
+		{
+			result = BsonValueAsBool(value) ? stats.existsFraction :
+					 1.0 - stats.existsFraction;
+			break;
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+
+	CLAMP_PROBABILITY(result);
+	*selectivity = result;
+	return true;
+}
+
+
+/*
+ * Estimates the selectivity of an equality on a path among the rows that
+ * match an equality on another path, from the dependency statistics of the
+ * column. The selectivities are the ones of the equalities on their own.
+ * Combined with the functional dependency degree f of the given path on
+ * the path, as CREATE STATISTICS does:
+ *
+ *   P(path | given) = f + (1 - f) * P(path)
+ *
+ * or scaled up by how correlated the values of the paths are, whichever is
+ * larger; never so large that both equalities match more rows than the
+ * equality on the path alone.
+ *
+ * Returns false if there are no statistics for the pair of paths.
+ */
+bool
+EstimateBsonPathConditionalSelectivity(Datum *dependencyStats, int numDependencies,
+									   const char *givenPath, double givenSelectivity,
+									   const char *path, double selectivity,
+									   double *conditionalSelectivity)
+{
+	for (int i = 0; i < numDependencies; i++)
+	{
+		pgbson *document = DatumGetPgBson(dependencyStats[i]);
+		const char *paths[2] = { NULL, NULL };
+		double dependency[2] = { 0, 0 };
+		double correlation = 1.0;
+
+		bson_iter_t documentIter;
+		PgbsonInitIterator(document, &documentIter);
+		while (bson_iter_next(&documentIter))
+		{
+			const char *key = bson_iter_key(&documentIter);
+			if (strcmp(key, "correlation") == 0)
+			{
+				correlation = BsonValueAsDouble(bson_iter_value(&documentIter));
+				continue;
+			}
+
+			bool isPaths = strcmp(key, "paths") == 0;
+			if (!isPaths && strcmp(key, "dependency") != 0)
+			{
+				continue;
+			}
+
+			bson_iter_t arrayIter;
+			if (!BSON_ITER_HOLDS_ARRAY(&documentIter) ||
+				!bson_iter_recurse(&documentIter, &arrayIter))
+			{
+				continue;
+			}
+
+			for (int index = 0; index < 2 && bson_iter_next(&arrayIter); index++)
+			{
+				if (!isPaths)
+				{
+					dependency[index] = BsonValueAsDouble(bson_iter_value(&arrayIter));
+				}
+				else if (BSON_ITER_HOLDS_UTF8(&arrayIter))
+				{
+					paths[index] = bson_iter_utf8(&arrayIter, NULL);
+				}
+			}
+		}
+
+		if (paths[0] == NULL || paths[1] == NULL)
+		{
+			continue;
+		}
+
+		int givenIndex;
+		if (strcmp(paths[0], givenPath) == 0 && strcmp(paths[1], path) == 0)
+		{
+			givenIndex = 0;
+		}
+		else if (strcmp(paths[1], givenPath) == 0 && strcmp(paths[0], path) == 0)
+		{
+			givenIndex = 1;
+		}
+		else
+		{
+			continue;
+		}
+
+		double degree = dependency[givenIndex];
+		double result = Max(degree + (1.0 - degree) * selectivity,
+							selectivity * correlation);
+		if (givenSelectivity > 0)
+		{
+			result = Min(result, selectivity / givenSelectivity);
+		}
+
+		result = Max(result, selectivity);
+		CLAMP_PROBABILITY(result);
+		*conditionalSelectivity = result;
+		return true;
+	}
+
+	return false;
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods - ANALYZE */
+/* --------------------------------------------------------- */
+
+/*
+ * Computes the default statistics of the column, then the per-path ones in
+ * the free slots.
+ */
+static void
+ComputeBsonStats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+				 int samplerows, double totalrows)
+{
+	StdComputeStats(stats, fetchfunc, samplerows, totalrows);
+
+	if (!EnableBsonPathStatistics || !stats->stats_valid || samplerows < 2)
+	{
+		return;
+	}
+
+	ComputeBsonPathStats(stats, fetchfunc, samplerows, totalrows);
+}
+
+
+/*
+ * Gathers the per-path statistics in two passes over the sample: the first
+ * finds the paths present in most rows, the second collects the values of
+ * these paths. The dependencies between the most frequent of them are
+ * gathered from the same values.
+ */
+static void
+ComputeBsonPathStats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+					 int samplerows, double totalrows)
+{
+	MemoryContext analyzeContext = AllocSetContextCreate(CurrentMemoryContext,
+														 "BsonPathAnalyze",
+														 ALLOCSET_DEFAULT_SIZES);
+	MemoryContext oldContext = MemoryContextSwitchTo(analyzeContext);
+
+	/* Same as std_typanalyze, which asks for 300 rows per histogram bucket */
+	int target = Min(Max(stats->minrows / 300, 1), BSON_ANALYZE_MAX_BUCKETS);
+
+	HASHCTL hashInfo;
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = BSON_ANALYZE_MAX_PATH_LENGTH;
+	hashInfo.entrysize = sizeof(BsonPathCount);
+	hashInfo.hcxt = analyzeContext;
+
+	BsonPathWalkState state = {
+		.paths = hash_create("BsonPathCounts", 1024, &hashInfo,
+							 HASH_ELEM | HASH_STRINGS | HASH_CONTEXT),
+		.collectValues = false,
+		.addPaths = true,
+		.row = 0,
+		.maxSamples = samplerows,
+		.valueContext = analyzeContext
+	};
+	WalkSampleRows(stats, fetchfunc, samplerows, &state);
+
+	/* Keep the paths found in the most rows */
+	long numCounts = hash_get_num_entries(state.paths);
+	BsonPathCount *counts = palloc(sizeof(BsonPathCount) * Max(numCounts, 1));
+	int numPaths = 0;
+
+	HASH_SEQ_STATUS status;
+	BsonPathCount *count;
+	hash_seq_init(&status, state.paths);
+	while ((count = hash_seq_search(&status)) != NULL)
+	{
+		if (count->rowCount >= 2)
+		{
+			counts[numPaths++] = *count;
+		}
+	}
+
+	if (numPaths == 0)
+	{
+		MemoryContextSwitchTo(oldContext);
+		MemoryContextDelete(analyzeContext);
+		return;
+	}
+
+	qsort(counts, numPaths, sizeof(BsonPathCount), CompareBsonPathCountsByRows);
+	numPaths = Min(numPaths, BSON_ANALYZE_MAX_PATHS);
+
+	hashInfo.entrysize = sizeof(BsonPathStatsBuilder);
+	state.paths = hash_create("BsonPathStats", BSON_ANALYZE_MAX_PATHS, &hashInfo,
+							  HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+	for (int i = 0; i < numPaths; i++)
+	{
+		BsonPathStatsBuilder *builder = hash_search(state.paths, counts[i].path,
+													HASH_ENTER, NULL);
+		memset(((char *) builder) + offsetof(BsonPathStatsBuilder, rowCount), 0,
+			   sizeof(BsonPathStatsBuilder) - offsetof(BsonPathStatsBuilder, rowCount));
+		builder->lastRow = -1;
+	}
+
+	state.collectValues = true;
+	state.addPaths = false;
+	WalkSampleRows(stats, fetchfunc, samplerows, &state);
+
+	BsonPathStatsBuilder **builders = palloc(sizeof(BsonPathStatsBuilder *) * numPaths);
+	BsonPathStatsBuilder *builder;
+	int numBuilders = 0;
+	hash_seq_init(&status, state.paths);
+	while ((builder = hash_seq_search(&status)) != NULL)
+	{
+		builders[numBuilders++] = builder;
+	}
+
+	qsort(builders, numBuilders, sizeof(BsonPathStatsBuilder *),
+		  CompareBsonPathBuildersByPath);
+
+	/* Dependencies go first: building the path statistics reorders the samples */
+	int maxDependencies = BSON_ANALYZE_MAX_DEPENDENCY_PATHS *
+						  (BSON_ANALYZE_MAX_DEPENDENCY_PATHS - 1) / 2;
+	pgbson **dependencies = palloc(sizeof(pgbson *) * maxDependencies);
+	int numDependencies = BuildPathDependencyDocuments(builders, numBuilders,
+													   samplerows, dependencies);
+
+	pgbson **documents = palloc(sizeof(pgbson *) * numBuilders);
+	for (int i = 0; i < numBuilders; i++)
+	{
+		documents[i] = BuildPathStatsDocument(builders[i], samplerows, totalrows,
+											  target);
+	}
+
+	StoreStatisticsSlot(stats, STATISTIC_KIND_BSON_PATHS, documents, numBuilders);
+	if (numDependencies > 0)
+	{
+		StoreStatisticsSlot(stats, STATISTIC_KIND_BSON_PATH_DEPENDENCIES, dependencies,
+							numDependencies);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(analyzeContext);
+}
+
+
+/*
+ * Stores the documents in the first free statistics slot of the column, if
+ * any is left.
+ */
+static void
+StoreStatisticsSlot(VacAttrStats *stats, int16 kind, pgbson **documents,
+					int numDocuments)
+{
+	for (int slot = 0; slot < STATISTIC_NUM_SLOTS; slot++)
+	{
+		if (stats->stakind[slot] != 0)
+		{
+			continue;
+		}
+
+		Datum *values = MemoryContextAlloc(stats->anl_context,
+										   sizeof(Datum) * numDocuments);
+		for (int i = 0; i < numDocuments; i++)
+		{
+			uint32_t size = VARSIZE(documents[i]);
+			void *copy = MemoryContextAlloc(stats->anl_context, size);
+			memcpy(copy, documents[i], size);
+			values[i] = PointerGetDatum(copy);
+		}
+
+		stats->stakind[slot] = kind;
+		stats->staop[slot] = InvalidOid;
+		stats->stacoll[slot] = InvalidOid;
+		stats->stavalues[slot] = values;
+		stats->numvalues[slot] = numDocuments;
+		stats->statypid[slot] = stats->attrtypid;
+		stats->statyplen[slot] = -1;
+		stats->statypbyval[slot] = false;
+		stats->statypalign[slot] = TYPALIGN_INT;
+		return;
+	}
+}
+
+
+/*
+ * Walks the paths of every document of the sample.
+ */
+static void
+WalkSampleRows(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc, int samplerows,
+			   BsonPathWalkState *state)
+{
+	MemoryContext rowContext = AllocSetContextCreate(CurrentMemoryContext,
+													 "BsonPathAnalyzeRow",
+													 ALLOCSET_DEFAULT_SIZES);
+	MemoryContext oldContext = MemoryContextSwitchTo(rowContext);
+	StringInfoData path;
+
+	for (int row = 0; row < samplerows; row++)
+	{
+		vacuum_delay_point();
+
+		bool isNull;
+		Datum value = fetchfunc(stats, row, &isNull);
+		if (isNull)
+		{
+			continue;
+		}
+
+		MemoryContextReset(rowContext);
+		initStringInfo(&path);
+
+		pgbson *document = DatumGetPgBson(value);
+		bson_iter_t documentIter;
+		PgbsonInitIterator(document, &documentIter);
+
+		state->row = row;
+		WalkDocumentPaths(&documentIter, &path, 0, state);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(rowContext);
+}
+
+
+/*
+ * Records the fields of a document under the given path prefix and
+ * recurses into the nested documents and arrays.
+ */
+static void
+WalkDocumentPaths(bson_iter_t *iter, StringInfo path, int depth,
+				  BsonPathWalkState *state)
+{
+	int prefixLength = path->len;
+	while (bson_iter_next(iter))
+	{
+		path->len = prefixLength;
+		path->data[prefixLength] = '\0';
+		if (prefixLength > 0)
+		{
+			appendStringInfoChar(path, '.');
+		}
+
+		appendBinaryStringInfo(path, bson_iter_key(iter), bson_iter_key_len(iter));
+		if (path->len >= BSON_ANALYZE_MAX_PATH_LENGTH)
+		{
+			continue;
+		}
+
+		RecordPathValue(state, path->data, bson_iter_value(iter), false);
+
+		if (depth >= BSON_ANALYZE_MAX_DEPTH)
+		{
+			continue;
+		}
+
+		bson_iter_t childIter;
+		if (BSON_ITER_HOLDS_DOCUMENT(iter) && bson_iter_recurse(iter, &childIter))
+		{
+			WalkDocumentPaths(&childIter, path, depth + 1, state);
+		}
+		else if (BSON_ITER_HOLDS_ARRAY(iter) && bson_iter_recurse(iter, &childIter))
+		{
+			WalkArrayElements(&childIter, path, depth + 1, state);
+		}
+	}
+
+	path->len = prefixLength;
+	path->data[prefixLength] = '\0';
+}
+
+
+/*
+ * Queries match the elements of an array as values of the array's path,
+ * so the scalar elements are sampled as values of the path and the fields
+ * of document elements are recorded under the path itself.
+ */
+static void
+WalkArrayElements(bson_iter_t *iter, StringInfo path, int depth,
+				  BsonPathWalkState *state)
+{
+	while (bson_iter_next(iter))
+	{
+		bson_iter_t childIter;
+		if (BSON_ITER_HOLDS_DOCUMENT(iter) && bson_iter_recurse(iter, &childIter))
+		{
+			WalkDocumentPaths(&childIter, path, depth, state);
+		}
+		else if (state->collectValues && !BSON_ITER_HOLDS_ARRAY(iter))
+		{
+			RecordPathValue(state, path->data, bson_iter_value(iter), true);
+		}
+	}
+}
+
+
+/*
+ * Accounts for a value of a path in the row being walked. The first value
+ * of a path in a row decides the type the row is counted under.
+ */
+static void
+RecordPathValue(BsonPathWalkState *state, const char *path, const bson_value_t *value,
+				bool isArrayElement)
+{
+	if (!state->collectValues)
+	{
+		bool found;
+		HASHACTION action = state->addPaths &&
+							hash_get_num_entries(state->paths) <
+							BSON_ANALYZE_MAX_TRACKED_PATHS ? HASH_ENTER : HASH_FIND;
+		BsonPathCount *count = hash_search(state->paths, path, action, &found);
+		if (count == NULL)
+		{
+			return;
+		}
+
+		if (!found)
+		{
+			count->rowCount = 0;
+			count->lastRow = -1;
+		}
+
+		if (count->lastRow != state->row)
+		{
+			count->lastRow = state->row;
+			count->rowCount++;
+		}
+
+		return;
+	}
+
+	BsonPathStatsBuilder *builder = hash_search(state->paths, path, HASH_FIND, NULL);
+	if (builder == NULL)
+	{
+		return;
+	}
+
+	if (!isArrayElement && builder->lastRow != state->row)
+	{
+		builder->lastRow = state->row;
+		builder->rowCount++;
+		builder->typeCounts[(uint8_t) value->value_type]++;
+		if (value->value_type == BSON_TYPE_NULL)
+		{
+			builder->nullCount++;
+		}
+	}
+
+	if (!IsSampledValue(value) || builder->numSamples >= state->maxSamples)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(state->valueContext);
+	if (builder->numSamples == builder->maxSamples)
+	{
+		builder->maxSamples = Min(Max(builder->maxSamples * 2, 64), state->maxSamples);
+		builder->samples = builder->samples == NULL ?
+						   palloc(sizeof(BsonPathSample) * builder->maxSamples) :
+						   repalloc(builder->samples,
+									sizeof(BsonPathSample) * builder->maxSamples);
+	}
+
+	BsonPathSample *sample = &builder->samples[builder->numSamples++];
+	bson_value_copy(value, &sample->value);
+	sample->row = state->row;
+	sample->isArrayElement = isArrayElement;
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * Whether the value is kept for the most common values and histogram of
+ * its path: narrow scalars that queries compare against.
+ */
+static bool
+IsSampledValue(const bson_value_t *value)
+{
+	switch (value->value_type)
+	{
+		case BSON_TYPE_DOUBLE:
+		case BSON_TYPE_INT32:
+		case BSON_TYPE_INT64:
+		case BSON_TYPE_DECIMAL128:
+		case BSON_TYPE_OID:
+		case BSON_TYPE_BOOL:
+		case BSON_TYPE_DATE_TIME:
+		case BSON_TYPE_TIMESTAMP:
+		{
+			return true;
+		}
+
+		case BSON_TYPE_UTF8:
+		{
+			return value->value.v_utf8.len <= BSON_ANALYZE_MAX_VALUE_WIDTH;
+		}
+
+		case BSON_TYPE_BINARY:
+		{
+			return value->value.v_binary.data_len <= BSON_ANALYZE_MAX_VALUE_WIDTH;
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
+/*
+ * Serializes the statistics of a path. The samples are sorted by value so
+ * that equal values are adjacent, each run of equal values is a group.
+ */
+static pgbson *
+BuildPathStatsDocument(BsonPathStatsBuilder *builder, int samplerows, double totalrows,
+					   int target)
+{
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+	PgbsonWriterAppendUtf8(&writer, "path", 4, builder->path);
+	PgbsonWriterAppendDouble(&writer, "exists", 6,
+							 (double) builder->rowCount / samplerows);
+	PgbsonWriterAppendDouble(&writer, "null", 4,
+							 (double) builder->nullCount / samplerows);
+
+	pgbson_writer typesWriter;
+	PgbsonWriterStartDocument(&writer, "types", 5, &typesWriter);
+	for (int type = 0; type < BSON_ANALYZE_NUM_TYPES; type++)
+	{
+		if (builder->typeCounts[type] > 0)
+		{
+			char typeName[8];
+			int typeNameLength = snprintf(typeName, sizeof(typeName), "%d", type);
+			PgbsonWriterAppendDouble(&typesWriter, typeName, typeNameLength,
+									 (double) builder->typeCounts[type] / samplerows);
+		}
+	}
+	PgbsonWriterEndDocument(&writer, &typesWriter);
+
+	int numSamples = builder->numSamples;
+	BsonPathSample *samples = builder->samples;
+	if (numSamples == 0)
+	{
+		PgbsonWriterAppendDouble(&writer, "distinct", 8, 0);
+		PgbsonWriterAppendDouble(&writer, "otherFrac", 9, 0);
+		return PgbsonWriterGetPgbson(&writer);
+	}
+
+	qsort(samples, numSamples, sizeof(BsonPathSample), CompareBsonPathSamples);
+
+	/*
+	 * Groups are kept as {first sample, sample count, row count}: the row
+	 * count differs from the sample count when an array repeats a value.
+	 */
+	int *groupStart = palloc(sizeof(int) * numSamples);
+	int *groupSamples = palloc(sizeof(int) * numSamples);
+	int *groupRows = palloc(sizeof(int) * numSamples);
+	int numGroups = 0;
+	int singletons = 0;
+	for (int i = 0; i < numSamples; i++)
+	{
+		bool isComparisonValid;
+		if (i == 0 ||
+			CompareBsonValueAndType(&samples[i - 1].value, &samples[i].value,
+									&isComparisonValid) != 0)
+		{
+			groupStart[numGroups] = i;
+			groupSamples[numGroups] = 0;
+			groupRows[numGroups] = 0;
+			numGroups++;
+		}
+
+		groupSamples[numGroups - 1]++;
+		if (groupSamples[numGroups - 1] == 1 || samples[i - 1].row != samples[i].row)
+		{
+			groupRows[numGroups - 1]++;
+		}
+	}
+
+	for (int i = 0; i < numGroups; i++)
+	{
+		if (groupSamples[i] == 1)
+		{
+			singletons++;
+		}
+	}
+
+	/* Haas and Stokes estimator, as in compute_scalar_stats */
+	double sampledValues = numSamples;
+	double totalValues = Max(totalrows * sampledValues / samplerows, sampledValues);
+	double distinct;
+	if (singletons == numSamples)
+	{
+		distinct = totalValues;
+	}
+	else
+	{
+		distinct = (sampledValues * numGroups) /
+				   ((sampledValues - singletons) +
+					singletons * sampledValues / totalValues);
+		distinct = Min(Max(distinct, numGroups), totalValues);
+	}
+
+	if (distinct > 0.1 * totalrows)
+	{
+		distinct = -distinct / totalrows;
+	}
+
+	PgbsonWriterAppendDouble(&writer, "distinct", 8, distinct);
+
+	/*
+	 * The most common values are the groups found in more rows than the
+	 * average, as in compute_distinct_stats.
+	 */
+	int *order = palloc(sizeof(int) * numGroups * 2);
+	for (int i = 0; i < numGroups; i++)
+	{
+		order[i * 2] = i;
+		order[i * 2 + 1] = groupRows[i];
+	}
+
+	qsort(order, numGroups, sizeof(int) * 2, CompareBsonPathGroupsByRows);
+
+	double averageRows = (double) numSamples / numGroups;
+	bool *isMostCommon = palloc0(sizeof(bool) * numGroups);
+	int numMcv = 0;
+	int mcvRows = 0;
+	for (int i = 0; i < numGroups && numMcv < target; i++)
+	{
+		int rows = order[i * 2 + 1];
+		if (rows < 2 || rows <= averageRows * 1.25)
+		{
+			break;
+		}
+
+		isMostCommon[order[i * 2]] = true;
+		mcvRows += rows;
+		numMcv++;
+	}
+
+	if (numMcv > 0)
+	{
+		pgbson_array_writer arrayWriter;
+		PgbsonWriterStartArray(&writer, "mcv", 3, &arrayWriter);
+		for (int i = 0; i < numMcv; i++)
+		{
+			PgbsonArrayWriterWriteValue(&arrayWriter,
+										&samples[groupStart[order[i * 2]]].value);
+		}
+		PgbsonWriterEndArray(&writer, &arrayWriter);
+
+		PgbsonWriterStartArray(&writer, "mcf", 3, &arrayWriter);
+		for (int i = 0; i < numMcv; i++)
+		{
+			bson_value_t frequency = {
+				.value_type = BSON_TYPE_DOUBLE,
+				.value.v_double = (double) order[i * 2 + 1] / samplerows
+			};
+			PgbsonArrayWriterWriteValue(&arrayWriter, &frequency);
+		}
+		PgbsonWriterEndArray(&writer, &arrayWriter);
+	}
+
+	/* The histogram is built over the samples outside the most common values */
+	int numOther = 0;
+	int otherGroups = 0;
+	int otherRows = 0;
+	int *otherSamples = palloc(sizeof(int) * numSamples);
+	for (int i = 0; i < numGroups; i++)
+	{
+		if (isMostCommon[i])
+		{
+			continue;
+		}
+
+		otherGroups++;
+		otherRows += groupRows[i];
+		for (int j = 0; j < groupSamples[i]; j++)
+		{
+			otherSamples[numOther++] = groupStart[i] + j;
+		}
+	}
+
+	double otherFraction = Min((double) otherRows / samplerows,
+							   Max((double) (builder->rowCount - builder->nullCount -
+											 mcvRows) / samplerows, 0));
+	PgbsonWriterAppendDouble(&writer, "otherFrac", 9, otherFraction);
+
+	if (otherGroups >= 2)
+	{
+		int numBounds = Min(otherGroups, target + 1);
+		pgbson_array_writer arrayWriter;
+		PgbsonWriterStartArray(&writer, "hist", 4, &arrayWriter);
+		for (int i = 0; i < numBounds; i++)
+		{
+			int position = (int) (((int64) i * (numOther - 1)) / (numBounds - 1));
+			PgbsonArrayWriterWriteValue(&arrayWriter,
+										&samples[otherSamples[position]].value);
+		}
+		PgbsonWriterEndArray(&writer, &arrayWriter);
+	}
+
+	return PgbsonWriterGetPgbson(&writer);
+}
+
+
+/*
+ * Builds the dependency statistics of each pair of the paths found in the
+ * most rows. Only rows where both paths have a single sampled value take
+ * part: arrays and wide values are left out.
+ */
+static int
+BuildPathDependencyDocuments(BsonPathStatsBuilder **builders, int numBuilders,
+							 int samplerows, pgbson **documents)
+{
+	BsonPathStatsBuilder **candidates = palloc(sizeof(BsonPathStatsBuilder *) *
+											   Max(numBuilders, 1));
+	int numCandidates = 0;
+	for (int i = 0; i < numBuilders; i++)
+	{
+		if (builders[i]->numSamples >= BSON_ANALYZE_MIN_DEPENDENCY_ROWS)
+		{
+			candidates[numCandidates++] = builders[i];
+		}
+	}
+
+	if (numCandidates < 2)
+	{
+		return 0;
+	}
+
+	/* Keep the most frequent ones, in path order */
+	if (numCandidates > BSON_ANALYZE_MAX_DEPENDENCY_PATHS)
+	{
+		for (int i = 0; i < BSON_ANALYZE_MAX_DEPENDENCY_PATHS; i++)
+		{
+			for (int j = i + 1; j < numCandidates; j++)
+			{
+				if (candidates[j]->rowCount > candidates[i]->rowCount)
+				{
+					BsonPathStatsBuilder *swap = candidates[i];
+					candidates[i] = candidates[j];
+					candidates[j] = swap;
+				}
+			}
+		}
+
+		numCandidates = BSON_ANALYZE_MAX_DEPENDENCY_PATHS;
+		qsort(candidates, numCandidates, sizeof(BsonPathStatsBuilder *),
+			  CompareBsonPathBuildersByPath);
+	}
+
+	/* The sample holding the value of each path in each row, -1 if none */
+	int **rowSamples = palloc(sizeof(int *) * numCandidates);
+	for (int i = 0; i < numCandidates; i++)
+	{
+		rowSamples[i] = palloc(sizeof(int) * samplerows);
+		memset(rowSamples[i], -1, sizeof(int) * samplerows);
+
+		BsonPathStatsBuilder *builder = candidates[i];
+		for (int j = 0; j < builder->numSamples; j++)
+		{
+			BsonPathSample *sample = &builder->samples[j];
+			if (!sample->isArrayElement && rowSamples[i][sample->row] < 0)
+			{
+				rowSamples[i][sample->row] = j;
+			}
+		}
+	}
+
+	int numDocuments = 0;
+	for (int i = 0; i < numCandidates; i++)
+	{
+		for (int j = i + 1; j < numCandidates; j++)
+		{
+			pgbson *document = BuildPathDependencyDocument(candidates[i],
+														   candidates[j],
+														   rowSamples[i],
+														   rowSamples[j],
+														   samplerows);
+			if (document != NULL)
+			{
+				documents[numDocuments++] = document;
+			}
+		}
+	}
+
+	return numDocuments;
+}
+
+
+/*
+ * Serializes the dependency statistics of two paths:
+ *
+ * - The degree to which each path determines the other, as in the
+ *   functional dependencies of CREATE STATISTICS: the fraction of rows
+ *   whose value of the first path comes with a single value of the second.
+ * - How much fewer distinct combinations of values the paths have than
+ *   independent paths of the same distinct counts would show in a sample
+ *   of the same size.
+ */
+static pgbson *
+BuildPathDependencyDocument(BsonPathStatsBuilder *first, BsonPathStatsBuilder *second,
+							int *firstRowSamples, int *secondRowSamples,
+							int samplerows)
+{
+	BsonPathPairSample *pairs = palloc(sizeof(BsonPathPairSample) * samplerows);
+	int numPairs = 0;
+	for (int row = 0; row < samplerows; row++)
+	{
+		if (firstRowSamples[row] >= 0 && secondRowSamples[row] >= 0)
+		{
+			pairs[numPairs].first = &first->samples[firstRowSamples[row]].value;
+			pairs[numPairs].second = &second->samples[secondRowSamples[row]].value;
+			numPairs++;
+		}
+	}
+
+	if (numPairs < BSON_ANALYZE_MIN_DEPENDENCY_ROWS)
+	{
+		pfree(pairs);
+		return NULL;
+	}
+
+	bool isComparisonValid;
+	double dependency[2];
+	int distinctFirst = 0;
+	int distinctSecond = 0;
+	int distinctPairs = 0;
+	for (int direction = 0; direction < 2; direction++)
+	{
+		qsort(pairs, numPairs, sizeof(BsonPathPairSample),
+			  direction == 0 ? ComparePathPairsByFirst : ComparePathPairsBySecond);
+
+		/* A group of rows supports the dependency if it has a single dependent value */
+		int supportingRows = 0;
+		int groupStart = 0;
+		bool isGroupConsistent = true;
+		int distinctGroups = 0;
+		for (int i = 0; i <= numPairs; i++)
+		{
+			const bson_value_t *key = NULL;
+			const bson_value_t *dependent = NULL;
+			if (i < numPairs)
+			{
+				key = direction == 0 ? pairs[i].first : pairs[i].second;
+				dependent = direction == 0 ? pairs[i].second : pairs[i].first;
+			}
+
+			if (i > 0)
+			{
+				const bson_value_t *previousKey = direction == 0 ? pairs[i - 1].first :
+												  pairs[i - 1].second;
+				const bson_value_t *previousDependent = direction == 0 ?
+														pairs[i - 1].second :
+														pairs[i - 1].first;
+
+				if (i == numPairs ||
+					CompareBsonValueAndType(previousKey, key, &isComparisonValid) != 0)
+				{
+					if (isGroupConsistent)
+					{
+						supportingRows += i - groupStart;
+					}
+
+					distinctGroups++;
+					groupStart = i;
+					isGroupConsistent = true;
+					if (direction == 0)
+					{
+						distinctPairs++;
+					}
+				}
+				else if (CompareBsonValueAndType(previousDependent, dependent,
+												 &isComparisonValid) != 0)
+				{
+					isGroupConsistent = false;
+					if (direction == 0)
+					{
+						distinctPairs++;
+					}
+				}
+			}
+		}
+
+		dependency[direction] = (double) supportingRows / numPairs;
+		if (direction == 0)
+		{
+			distinctFirst = distinctGroups;
+		}
+		else
+		{
+			distinctSecond = distinctGroups;
+		}
+	}
+
+	/*
+	 * Expected distinct combinations among numPairs rows drawn from
+	 * independent paths: D * (1 - (1 - 1/D)^n) for D possible combinations.
+	 */
+	double combinations = (double) distinctFirst * distinctSecond;
+	double expectedPairs = combinations *
+						   (1.0 - pow(1.0 - 1.0 / combinations, numPairs));
+	double correlation = Max(expectedPairs / distinctPairs, 1.0);
+
+	pgbson_writer writer;
+	PgbsonWriterInit(&writer);
+
+	pgbson_array_writer arrayWriter;
+	PgbsonWriterStartArray(&writer, "paths", 5, &arrayWriter);
+	PgbsonArrayWriterWriteUtf8(&arrayWriter, first->path);
+	PgbsonArrayWriterWriteUtf8(&arrayWriter, second->path);
+	PgbsonWriterEndArray(&writer, &arrayWriter);
+
+	PgbsonWriterStartArray(&writer, "dependency", 10, &arrayWriter);
+	for (int direction = 0; direction < 2; direction++)
+	{
+		bson_value_t degree = {
+			.value_type = BSON_TYPE_DOUBLE,
+			.value.v_double = dependency[direction]
+		};
+		PgbsonArrayWriterWriteValue(&arrayWriter, &degree);
+	}
+	PgbsonWriterEndArray(&writer, &arrayWriter);
+
+	PgbsonWriterAppendDouble(&writer, "correlation", 11, correlation);
+
+	pfree(pairs);
+	return PgbsonWriterGetPgbson(&writer);
+}
+
+
+static int
+ComparePathPairsByFirst(const void *left, const void *right)
+{
+	const BsonPathPairSample *leftPair = (const BsonPathPairSample *) left;
+	const BsonPathPairSample *rightPair = (const BsonPathPairSample *) right;
+
+	bool isComparisonValid;
+	int cmp = CompareBsonValueAndType(leftPair->first, rightPair->first,
+									  &isComparisonValid);
+	if (cmp != 0)
+	{
+		return cmp;
+	}
+
+	return CompareBsonValueAndType(leftPair->second, rightPair->second,
+								   &isComparisonValid);
+}
+
+
+static int
+ComparePathPairsBySecond(const void *left, const void *right)
+{
+	const BsonPathPairSample *leftPair = (const BsonPathPairSample *) left;
+	const BsonPathPairSample *rightPair = (const BsonPathPairSample *) right;
+
+	bool isComparisonValid;
+	int cmp = CompareBsonValueAndType(leftPair->second, rightPair->second,
+									  &isComparisonValid);
+	if (cmp != 0)
+	{
+		return cmp;
+	}
+
+	return CompareBsonValueAndType(leftPair->first, rightPair->first,
+								   &isComparisonValid);
+}
+
+
+static int
+CompareBsonPathCountsByRows(const void *left, const void *right)
+{
+	const BsonPathCount *leftCount = (const BsonPathCount *) left;
+	const BsonPathCount *rightCount = (const BsonPathCount *) right;
+
+	if (leftCount->rowCount != rightCount->rowCount)
+	{
+		return leftCount->rowCount > rightCount->rowCount ? -1 : 1;
+	}
+
+	return strcmp(leftCount->path, rightCount->path);
+}
+
+
+static int
+CompareBsonPathBuildersByPath(const void *left, const void *right)
+{
+	const BsonPathStatsBuilder *leftBuilder = *(BsonPathStatsBuilder *const *) left;
+	const BsonPathStatsBuilder *rightBuilder = *(BsonPathStatsBuilder *const *) right;
+	return strcmp(leftBuilder->path, rightBuilder->path);
+}
+
+
+static int
+CompareBsonPathSamples(const void *left, const void *right)
+{
+	const BsonPathSample *leftSample = (const BsonPathSample *) left;
+	const BsonPathSample *rightSample = (const BsonPathSample *) right;
+
+	bool isComparisonValid;
+	int cmp = CompareBsonValueAndType(&leftSample->value, &rightSample->value,
+									  &isComparisonValid);
+	if (cmp != 0)
+	{
+		return cmp;
+	}
+
+	return leftSample->row - rightSample->row;
+}
+
+
+static int
+CompareBsonPathGroupsByRows(const void *left, const void *right)
+{
+	const int *leftGroup = (const int *) left;
+	const int *rightGroup = (const int *) right;
+
+	if (leftGroup[1] != rightGroup[1])
+	{
+		return leftGroup[1] > rightGroup[1] ? -1 : 1;
+	}
+
+	return leftGroup[0] - rightGroup[0];
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods - estimation */
+/* --------------------------------------------------------- */
+
+/*
+ * Binary searches the per-path statistics, which are sorted by path.
+ */
+static bool
+FindPathStatistics(Datum *pathStats, int numPaths, const char *path,
+				   BsonPathStatistics *result)
+{
+	int low = 0;
+	int high = numPaths - 1;
+	while (low <= high)
+	{
+		int middle = low + (high - low) / 2;
+		pgbson *document = DatumGetPgBson(pathStats[middle]);
+
+		bson_iter_t documentIter;
+		PgbsonInitIterator(document, &documentIter);
+		if (!bson_iter_next(&documentIter) || !BSON_ITER_HOLDS_UTF8(&documentIter))
+		{
+			return false;
+		}
+
+		int cmp = strcmp(bson_iter_utf8(&documentIter, NULL), path);
+		if (cmp == 0)
+		{
+			ReadPathStatistics(document, result);
+			return true;
+		}
+		else if (cmp < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * Reads a per-path statistics document. The values point into the
+ * document.
+ */
+static void
+ReadPathStatistics(pgbson *document, BsonPathStatistics *pathStats)
+{
+	memset(pathStats, 0, sizeof(BsonPathStatistics));
+
+	bson_iter_t documentIter;
+	PgbsonInitIterator(document, &documentIter);
+	while (bson_iter_next(&documentIter))
+	{
+		const char *key = bson_iter_key(&documentIter);
+		const bson_value_t *value = bson_iter_value(&documentIter);
+
+		if (strcmp(key, "exists") == 0)
+		{
+			pathStats->existsFraction = BsonValueAsDouble(value);
+		}
+		else if (strcmp(key, "null") == 0)
+		{
+			pathStats->nullFraction = BsonValueAsDouble(value);
+		}
+		else if (strcmp(key, "distinct") == 0)
+		{
+			pathStats->distinct = BsonValueAsDouble(value);
+		}
+		else if (strcmp(key, "otherFrac") == 0)
+		{
+			pathStats->otherFraction = BsonValueAsDouble(value);
+		}
+		else if (strcmp(key, "types") == 0 && value->value_type == BSON_TYPE_DOCUMENT)
+		{
+			bson_iter_t typesIter;
+			BsonValueInitIterator(value, &typesIter);
+			while (bson_iter_next(&typesIter))
+			{
+				int type = atoi(bson_iter_key(&typesIter));
+				if (type >= 0 && type < BSON_ANALYZE_NUM_TYPES)
+				{
+					pathStats->typeFractions[type] =
+						BsonValueAsDouble(bson_iter_value(&typesIter));
+				}
+			}
+		}
+		else if ((strcmp(key, "mcv") == 0 || strcmp(key, "mcf") == 0 ||
+				  strcmp(key, "hist") == 0) && value->value_type == BSON_TYPE_ARRAY)
+		{
+			int numValues = BsonDocumentValueCountKeys(value);
+			bson_value_t *values = palloc(sizeof(bson_value_t) * Max(numValues, 1));
+
+			bson_iter_t arrayIter;
+			BsonValueInitIterator(value, &arrayIter);
+			for (int i = 0; i < numValues && bson_iter_next(&arrayIter); i++)
+			{
+				values[i] = *bson_iter_value(&arrayIter);
+			}
+
+			if (key[0] == 'h')
+			{
+				pathStats->hist = values;
+				pathStats->numHist = numValues;
+			}
+			else if (key[2] == 'v')
+			{
+				pathStats->mcv = values;
+				pathStats->numMcv = numValues;
+			}
+			else
+			{
+				pathStats->mcf = palloc(sizeof(double) * Max(numValues, 1));
+				for (int i = 0; i < numValues; i++)
+				{
+					pathStats->mcf[i] = BsonValueAsDouble(&values[i]);
+				}
+			}
+		}
+	}
+
+	if (pathStats->mcf == NULL)
+	{
+		pathStats->numMcv = 0;
+	}
+}
+
+
+/*
+ * Fraction of the rows whose value at the path sorts in the same class as
+ * the type (e.g. all the numeric types together).
+ */
+static double
+GetSortClassFraction(BsonPathStatistics *pathStats, bson_type_t type)
+{
+	double fraction = 0;
+	for (int i = 0; i < BSON_ANALYZE_NUM_TYPES; i++)
+	{
+		if (pathStats->typeFractions[i] > 0 &&
+			CompareSortOrderType((bson_type_t) i, type) == 0)
+		{
+			fraction += pathStats->typeFractions[i];
+		}
+	}
+
+	return fraction;
+}
+
+
+/*
+ * Estimates the fraction of rows where the path equals the value.
+ */
+static bool
+EstimateEquality(BsonPathStatistics *pathStats, double totalRows,
+				 const bson_value_t *value, double *selectivity)
+{
+	if (value->value_type == BSON_TYPE_NULL)
+	{
+		/* null matches the rows where the path is missing as well */
+		*selectivity = (1.0 - pathStats->existsFraction) + pathStats->nullFraction;
+		return true;
+	}
+
+	double classFraction = GetSortClassFraction(pathStats, value->value_type);
+	double arrayFraction = pathStats->typeFractions[BSON_TYPE_ARRAY];
+	if (classFraction == 0 && arrayFraction == 0)
+	{
+		/* The sample has no value of the type: presume a single row matches */
+		*selectivity = 1.0 / Max(totalRows, 1);
+		return true;
+	}
+
+	if (!IsSampledValue(value))
+	{
+		return false;
+	}
+
+	double minimumFrequency = 1.0;
+	for (int i = 0; i < pathStats->numMcv; i++)
+	{
+		bool isComparisonValid;
+		if (CompareBsonValueAndType(value, &pathStats->mcv[i], &isComparisonValid) == 0 &&
+			isComparisonValid)
+		{
+			*selectivity = pathStats->mcf[i];
+			return true;
+		}
+
+		minimumFrequency = Min(minimumFrequency, pathStats->mcf[i]);
+	}
+
+	double distinct = pathStats->distinct < 0 ? -pathStats->distinct * totalRows :
+					  pathStats->distinct;
+	double result = pathStats->otherFraction /
+					Max(distinct - pathStats->numMcv, 1);
+	result = Min(result, minimumFrequency);
+	result = Min(result, classFraction + arrayFraction);
+
+	*selectivity = result;
+	return true;
+}
+
+
+/*
+ * Estimates the fraction of rows where the path compares to the value as
+ * the predicate asks. Comparisons only match values of the same sort class
+ * so both the most common values and the histogram are restricted to it.
+ */
+static bool
+EstimateRange(BsonPathStatistics *pathStats, BsonPathPredicate predicate,
+			  const bson_value_t *value, double *selectivity)
+{
+	if (!IsSampledValue(value))
+	{
+		return false;
+	}
+
+	bool isGreater = predicate == BsonPathPredicate_Greater ||
+					 predicate == BsonPathPredicate_GreaterEqual;
+	bool isInclusive = predicate == BsonPathPredicate_GreaterEqual ||
+					   predicate == BsonPathPredicate_LessEqual;
+
+	double mcvFraction = 0;
+	for (int i = 0; i < pathStats->numMcv; i++)
+	{
+		if (CompareBsonSortOrderType(&pathStats->mcv[i], value) != 0)
+		{
+			continue;
+		}
+
+		bool isComparisonValid;
+		int cmp = CompareBsonValueAndType(&pathStats->mcv[i], value, &isComparisonValid);
+		if (!isComparisonValid)
+		{
+			continue;
+		}
+
+		if ((cmp == 0 && isInclusive) || (cmp > 0 && isGreater) ||
+			(cmp < 0 && !isGreater))
+		{
+			mcvFraction += pathStats->mcf[i];
+		}
+	}
+
+	if (pathStats->numHist < 2)
+	{
+		*selectivity = mcvFraction + pathStats->otherFraction * DEFAULT_INEQ_SEL;
+		return true;
+	}
+
+	/*
+	 * Locate the bounds of the value's sort class: the class spans from
+	 * halfway between its first bound and the previous one to halfway
+	 * between its last bound and the next one.
+	 */
+	int below = 0;
+	int within = 0;
+	for (int i = 0; i < pathStats->numHist; i++)
+	{
+		int cmp = CompareBsonSortOrderType(&pathStats->hist[i], value);
+		if (cmp < 0)
+		{
+			below++;
+		}
+		else if (cmp == 0)
+		{
+			within++;
+		}
+	}
+
+	double numBins = pathStats->numHist - 1;
+	double classStart = below == 0 ? 0 : (below - 0.5) / numBins;
+	double classEnd = below + within == pathStats->numHist ? 1 :
+					  (below + within - 0.5) / numBins;
+	double position = GetHistogramPosition(pathStats, value);
+	position = Min(Max(position, classStart), classEnd);
+
+	double histogramFraction = isGreater ? classEnd - position : position - classStart;
+	*selectivity = mcvFraction + pathStats->otherFraction * histogramFraction;
+	return true;
+}
+
+
+/*
+ * Fraction of the histogram below the value, interpolating linearly
+ * within a bucket whose bounds are numbers or dates.
+ */
+static double
+GetHistogramPosition(BsonPathStatistics *pathStats, const bson_value_t *value)
+{
+	bson_value_t *bounds = pathStats->hist;
+	int numBounds = pathStats->numHist;
+	bool isComparisonValid;
+
+	if (CompareBsonValueAndType(value, &bounds[0], &isComparisonValid) <= 0)
+	{
+		return 0;
+	}
+
+	if (CompareBsonValueAndType(value, &bounds[numBounds - 1], &isComparisonValid) >= 0)
+	{
+		return 1;
+	}
+
+	int bucket = 0;
+	while (bucket < numBounds - 2 &&
+		   CompareBsonValueAndType(value, &bounds[bucket + 1], &isComparisonValid) >= 0)
+	{
+		bucket++;
+	}
+
+	const bson_value_t *lower = &bounds[bucket];
+	const bson_value_t *upper = &bounds[bucket + 1];
+	double fraction = 0.5;
+	if (BsonTypeIsNumber(value->value_type) && BsonTypeIsNumber(lower->value_type) &&
+		BsonTypeIsNumber(upper->value_type))
+	{
+		double low = BsonValueAsDouble(lower);
+		double high = BsonValueAsDouble(upper);
+		if (high > low && !isnan(BsonValueAsDouble(value)))
+		{
+			fraction = (BsonValueAsDouble(value) - low) / (high - low);
+		}
+	}
+	else if (value->value_type == BSON_TYPE_DATE_TIME &&
+			 lower->value_type == BSON_TYPE_DATE_TIME &&
+			 upper->value_type == BSON_TYPE_DATE_TIME &&
+			 upper->value.v_datetime > lower->value.v_datetime)
+	{
+		fraction = (double) (value->value.v_datetime - lower->value.v_datetime) /
+				   (double) (upper->value.v_datetime - lower->value.v_datetime);
+	}
+
+	fraction = Min(Max(fraction, 0), 1);
+	return (bucket + fraction) / (numBounds - 1);
 }
@@ -0,0 +1,920 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/io/bson_json_parser.c
+ *
+ * Implementation of a two stage parser of JSON into bson.
+ *
+ * The first stage classifies the input 64 bytes at a time, 8 bytes per
+ * comparison (see swar_utils.h), into bitmasks of quotes, backslashes,
+ * structural characters and whitespace. From those it derives which bytes
+ * are within strings without looking at the bytes one by one, and records
+ * the offset of every structural character, string and scalar.
+ *
+ * The second stage walks those offsets and writes the bson directly into
+ * the buffer of the resulting pgbson, patching the lengths of documents and
+ * arrays once they are closed.
+ *
+ * Only plain JSON is parsed here, into the same bson as libbson builds for
+ * it. Anything else is left to libbson, which then builds the document or
+ * reports the error: extended JSON (any field name starting with '$'),
+ * numbers out of range, \u0000 escapes, deeply nested documents and invalid
+ * input.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <postgres.h>
+#include <lib/stringinfo.h>
+#include <port/pg_bitutils.h>
+
+#include "io/bson_core.h"
+#include "io/bson_validation.h"
+#include "utils/swar_utils.h"
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+/* The number of bytes classified together by the first stage */
+#define JSON_BLOCK_SIZE 64
+
+/* Documents nested deeper than this are left to libbson */
+#define JSON_PARSER_MAX_DEPTH 64
+
+/* Inputs longer than this are left to libbson */
+#define JSON_PARSER_MAX_LENGTH (64 * 1024 * 1024)
+
+/* Numbers with a longer text than this are left to libbson */
+#define JSON_PARSER_MAX_NUMBER_LENGTH 64
+
+/*
+ * The bitmasks of a block of the input, bit i being for the byte i.
+ */
+typedef struct JsonBlockMasks
+{
+	uint64 quotes;
+	uint64 backslashes;
+
+	/* {, }, [, ], : and , */
+	uint64 structurals;
+
+	/* space, tab, line feed and carriage return */
+	uint64 whitespace;
+
+	/* bytes below 0x20, which must be escaped within strings */
+	uint64 controls;
+} JsonBlockMasks;
+
+typedef struct JsonBsonParser
+{
+	const char *json;
+	uint32 jsonLength;
+
+	/* The offsets of structural characters, strings and scalars */
+	uint32 *offsets;
+	uint32 offsetCount;
+	uint32 offsetCapacity;
+
+	/* The next offset for the second stage */
+	uint32 current;
+
+	int depth;
+
+	/* The pgbson being written */
+	StringInfoData buffer;
+} JsonBsonParser;
+
+/* --------------------------------------------------------- */
+/* Forward declaration */
+/* --------------------------------------------------------- */
+
+static bool BuildStructuralIndex(JsonBsonParser *parser);
+static inline void ClassifyBlock(const char *block, JsonBlockMasks *masks);
+static inline uint64 FindEscapedBytes(uint64 backslashes, uint64 *escapedCarry);
+static inline uint64 PrefixXor(uint64 bits);
+
+static bool ParseDocument(JsonBsonParser *parser, bool isArray);
+static bool ParseValue(JsonBsonParser *parser, uint32 typeOffset);
+static bool ParseString(JsonBsonParser *parser, bool isFieldName);
+static bool ParseLiteral(JsonBsonParser *parser, const char *literal, uint32 length);
+static bool ParseNumber(JsonBsonParser *parser, uint32 typeOffset);
+static bool AppendUnicodeEscape(JsonBsonParser *parser, const char **position,
+								const char *end);
+static inline bool IsScalarEnd(JsonBsonParser *parser, uint32 offset);
+static inline void AppendInt32(StringInfo buffer, int32 value);
+static inline void WriteInt32(StringInfo buffer, uint32 offset, int32 value);
+
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+/*
+ * TryParseJsonToPgbson parses a JSON object into a pgbson. Returns false
+ * without an error when the JSON is not plain JSON the parser handles or
+ * is invalid, and the caller should fall back to bson_init_from_json.
+ */
+bool
+TryParseJsonToPgbson(const char *json, size_t jsonLength, pgbson **document)
+{
+	if (jsonLength == 0 || jsonLength > JSON_PARSER_MAX_LENGTH)
+	{
+		return false;
+	}
+
+	JsonBsonParser parser = { 0 };
+	parser.json = json;
+	parser.jsonLength = (uint32) jsonLength;
+	parser.offsetCapacity = parser.jsonLength / 4 + JSON_BLOCK_SIZE;
+	parser.offsets = palloc(sizeof(uint32) * parser.offsetCapacity);
+
+	if (!BuildStructuralIndex(&parser) || parser.offsetCount == 0 ||
+		json[parser.offsets[0]] != '{')
+	{
+		pfree(parser.offsets);
+		return false;
+	}
+
+	/* bson is rarely much larger than the JSON it is parsed from */
+	initStringInfo(&parser.buffer);
+	enlargeStringInfo(&parser.buffer, VARHDRSZ + parser.jsonLength + 1);
+	parser.buffer.len = VARHDRSZ;
+
+	bool isParsed = ParseDocument(&parser, false) &&
+					parser.current == parser.offsetCount;
+	pfree(parser.offsets);
+
+	if (!isParsed)
+	{
+		pfree(parser.buffer.data);
+		return false;
+	}
+
+	SET_VARSIZE(parser.buffer.data, parser.buffer.len);
+	*document = (pgbson *) parser.buffer.data;
+	return true;
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods */
+/* --------------------------------------------------------- */
+
+/*
+ * The first stage: records the offset of every structural character, the
+ * opening quote of every string and the first byte of every scalar that
+ * are outside strings. Returns false if a string is not terminated or
+ * contains control characters.
+ */
+static bool
+BuildStructuralIndex(JsonBsonParser *parser)
+{
+	/* All ones when the previous block ended within a string */
+	uint64 inStringCarry = 0;
+
+	/* One when the first byte of the block is escaped by a backslash */
+	uint64 escapedCarry = 0;
+
+	/* One when the previous block ended within a scalar */
+	uint64 scalarCarry = 0;
+
+	char paddedBlock[JSON_BLOCK_SIZE];
+	for (uint32 blockOffset = 0; blockOffset < parser->jsonLength;
+		 blockOffset += JSON_BLOCK_SIZE)
+	{
+		const char *block = parser->json + blockOffset;
+		if (parser->jsonLength - blockOffset < JSON_BLOCK_SIZE)
+		{
+			/* Pad the last block with whitespace */
+			memset(paddedBlock, ' ', JSON_BLOCK_SIZE);
+			memcpy(paddedBlock, block, parser->jsonLength - blockOffset);
+			block = paddedBlock;
+		}
+
+		JsonBlockMasks masks;
+		ClassifyBlock(block, &masks);
+
+		uint64 quotes = masks.quotes & ~FindEscapedBytes(masks.backslashes,
+														 &escapedCarry);
+
+		/* Bytes from an opening quote up to before its closing quote */
+		uint64 inString = PrefixXor(quotes) ^ inStringCarry;
+		inStringCarry = 0 - (inString >> 63);
+
+		if ((masks.controls & inString) != 0)
+		{
+			return false;
+		}
+
+		uint64 outsideStrings = ~(inString | quotes);
+		uint64 scalars = outsideStrings & ~(masks.structurals | masks.whitespace);
+		uint64 scalarStarts = scalars & ~((scalars << 1) | scalarCarry);
+		scalarCarry = scalars >> 63;
+
+		uint64 structurals = (masks.structurals & outsideStrings) |
+							 (quotes & inString) | scalarStarts;
+
+		if (parser->offsetCount + JSON_BLOCK_SIZE > parser->offsetCapacity)
+		{
+			parser->offsetCapacity *= 2;
+			parser->offsets = repalloc(parser->offsets,
+									   sizeof(uint32) * parser->offsetCapacity);
+		}
+
+		while (structurals != 0)
+		{
+			parser->offsets[parser->offsetCount++] =
+				blockOffset + pg_rightmost_one_pos64(structurals);
+			structurals &= structurals - 1;
+		}
+	}
+
+	/* Not terminated strings */
+	return inStringCarry == 0;
+}
+
+
+/*
+ * Computes the masks of the bytes of a block, 8 bytes at a time.
+ */
+static inline void
+ClassifyBlock(const char *block, JsonBlockMasks *masks)
+{
+	memset(masks, 0, sizeof(JsonBlockMasks));
+	for (int i = 0; i < JSON_BLOCK_SIZE / 8; i++)
+	{
+		uint64 word = SwarLoadWord(block + i * 8);
+		int shift = i * 8;
+
+		/* '{' and '[', '}' and ']' only differ by 0x20 */
+		uint64 brackets = word | (SWAR_ONES * 0x20);
+		uint64 structurals = SwarEqualBytes(brackets, '{') |
+							 SwarEqualBytes(brackets, '}') |
+							 SwarEqualBytes(word, ':') |
+							 SwarEqualBytes(word, ',');
+		uint64 whitespace = SwarEqualBytes(word, ' ') |
+							SwarEqualBytes(word, '\t') |
+							SwarEqualBytes(word, '\n') |
+							SwarEqualBytes(word, '\r');
+
+		masks->quotes |= (uint64) SwarHighBitMask(SwarEqualBytes(word, '"')) << shift;
+		masks->backslashes |=
+			(uint64) SwarHighBitMask(SwarEqualBytes(word, '\\')) << shift;
+		masks->structurals |= (uint64) SwarHighBitMask(structurals) << shift;
+		masks->whitespace |= (uint64) SwarHighBitMask(whitespace) << shift;
+		masks->controls |= (uint64) SwarHighBitMask(SwarLessThanBytes(word, 0x20)) <<
+						   shift;
+	}
+}
+
+
+/*
+ * Returns the mask of the bytes escaped by a backslash: those after a
+ * backslash that is not itself escaped. Backslashes are rare enough that
+ * these are simply visited in order.
+ */
+static inline uint64
+FindEscapedBytes(uint64 backslashes, uint64 *escapedCarry)
+{
+	uint64 escaped = *escapedCarry;
+	*escapedCarry = 0;
+
+	while (backslashes != 0)
+	{
+		int position = pg_rightmost_one_pos64(backslashes);
+		backslashes &= backslashes - 1;
+
+		uint64 bit = UINT64CONST(1) << position;
+		if ((escaped & bit) != 0)
+		{
+			continue;
+		}
+
+		if (position == 63)
+		{
+			*escapedCarry = 1;
+		}
+		else
+		{
+			escaped |= bit << 1;
+		}
+	}
+
+	return escaped;
+}
+
+
+/*
+ * Returns the mask where bit i is the xor of the bits 0 to i of bits.
+ */
+static inline uint64
+PrefixXor(uint64 bits)
+{
+	bits ^= bits << 1;
+	bits ^= bits << 2;
+	bits ^= bits << 4;
+	bits ^= bits << 8;
+	bits ^= bits << 16;
+	bits ^= bits << 32;
+	return bits;
+}
+
+
+/*
+ * Writes the document or array at the current offset, up to and including
+ * its closing bracket.
+ */
+static bool
+ParseDocument(JsonBsonParser *parser, bool isArray)
+{
+	if (++parser->depth > JSON_PARSER_MAX_DEPTH)
+	{
+		return false;
+	}
+
+	char closingBracket = isArray ? ']' : '}';
+	parser->current++;
+
+	uint32 documentOffset = parser->buffer.len;
+	AppendInt32(&parser->buffer, 0);
+
+	if (parser->current < parser->offsetCount &&
+		parser->json[parser->offsets[parser->current]] == closingBracket)
+	{
+		parser->current++;
+	}
+	else
+	{
+		uint32 index = 0;
+		while (true)
+		{
+			/* The type is only known once the value is parsed */
+			uint32 typeOffset = parser->buffer.len;
+			appendStringInfoCharMacro(&parser->buffer, '\0');
+
+			if (isArray)
+			{
+				char keyBuffer[UINT32_MAX_STR_LEN];
+				const char *key;
+				uint32_t keyLength = bson_uint32_to_string(index++, &key, keyBuffer,
+														   sizeof(keyBuffer));
+				appendBinaryStringInfo(&parser->buffer, key, keyLength + 1);
+			}
+			else
+			{
+				if (parser->current >= parser->offsetCount ||
+					parser->json[parser->offsets[parser->current]] != '"' ||
+					!ParseString(parser, true))
+				{
+					return false;
+				}
+
+				if (parser->current >= parser->offsetCount ||
+					parser->json[parser->offsets[parser->current]] != ':')
+				{
+					return false;
+				}
+
+				parser->current++;
+			}
+
+			if (parser->current >= parser->offsetCount ||
+				!ParseValue(parser, typeOffset) ||
+				parser->current >= parser->offsetCount)
+			{
+				return false;
+			}
+
+			char separator = parser->json[parser->offsets[parser->current++]];
+			if (separator == closingBracket)
+			{
+				break;
+			}
+			else if (separator != ',')
+			{
+				return false;
+			}
+		}
+	}
+
+	appendStringInfoCharMacro(&parser->buffer, '\0');
+	WriteInt32(&parser->buffer, documentOffset,
+			   (int32) (parser->buffer.len - documentOffset));
+
+	parser->depth--;
+	return true;
+}
+
+
+/*
+ * Writes the value at the current offset, and its type at typeOffset.
+ */
+static bool
+ParseValue(JsonBsonParser *parser, uint32 typeOffset)
+{
+	uint8 *type = (uint8 *) parser->buffer.data + typeOffset;
+	switch (parser->json[parser->offsets[parser->current]])
+	{
+		case '{':
+		{
+			*type = BSON_TYPE_DOCUMENT;
+			return ParseDocument(parser, false);
+		}
+
+		case '[':
+		{
+			*type = BSON_TYPE_ARRAY;
+			return ParseDocument(parser, true);
+		}
+
+		case '"':
+		{
+			*type = BSON_TYPE_UTF8;
+			uint32 lengthOffset = parser->buffer.len;
+			AppendInt32(&parser->buffer, 0);
+			if (!ParseString(parser, false))
+			{
+				return false;
+			}
+
+			WriteInt32(&parser->buffer, lengthOffset,
+					   (int32) (parser->buffer.len - lengthOffset - 4));
+			return true;
+		}
+
+		case 't':
+		{
+			*type = BSON_TYPE_BOOL;
+			appendStringInfoCharMacro(&parser->buffer, 1);
+			return ParseLiteral(parser, "true", 4);
+		}
+
+		case 'f':
+		{
+			*type = BSON_TYPE_BOOL;
+			appendStringInfoCharMacro(&parser->buffer, 0);
+			return ParseLiteral(parser, "false", 5);
+		}
+
+		case 'n':
+		{
+			*type = BSON_TYPE_NULL;
+			return ParseLiteral(parser, "null", 4);
+		}
+
+		default:
+		{
+			return ParseNumber(parser, typeOffset);
+		}
+	}
+}
+
+
+/*
+ * Writes the unescaped string at the current offset followed by its
+ * terminator. Field names starting with '$' are extended JSON and are not
+ * parsed.
+ */
+static bool
+ParseString(JsonBsonParser *parser, bool isFieldName)
+{
+	const char *position = parser->json + parser->offsets[parser->current++] + 1;
+	const char *end = parser->json + parser->jsonLength;
+	uint32 stringOffset = parser->buffer.len;
+
+	if (isFieldName && position < end && *position == '$')
+	{
+		return false;
+	}
+
+	while (true)
+	{
+		/* Copy up to the next quote or backslash, skipping 8 bytes at a time */
+		const char *runEnd = position;
+		while (end - runEnd >= 8)
+		{
+			uint64 word = SwarLoadWord(runEnd);
+			if ((SwarEqualBytes(word, '"') | SwarEqualBytes(word, '\\')) != 0)
+			{
+				break;
+			}
+
+			runEnd += 8;
+		}
+
+		while (runEnd < end && *runEnd != '"' && *runEnd != '\\')
+		{
+			runEnd++;
+		}
+
+		appendBinaryStringInfo(&parser->buffer, position, runEnd - position);
+		position = runEnd;
+
+		if (position >= end)
+		{
+			return false;
+		}
+		else if (*position == '"')
+		{
+			break;
+		}
+
+		/* An escape sequence */
+		position++;
+		if (position >= end)
+		{
+			return false;
+		}
+
+		char escaped;
+		switch (*position)
+		{
+			case '"':
+			case '\\':
+			case '/':
+			{
+				escaped = *position;
+				break;
+			}
+
+			case 'b':
+			{
+				escaped = '\b';
+				break;
+			}
+
+			case 'f':
+			{
+				escaped = '\f';
+				break;
+			}
+
+			case 'n':
+			{
+				escaped = '\n';
+				break;
+			}
+
+			case 'r':
+			{
+				escaped = '\r';
+				break;
+			}
+
+			case 't':
+			{
+				escaped = '\t';
+				break;
+			}
+
+			case 'u':
+			{
+				if (!AppendUnicodeEscape(parser, &position, end))
+				{
+					return false;
+				}
+
+				continue;
+			}
+
+			default:
+			{
+				return false;
+			}
+		}
+
+		appendStringInfoCharMacro(&parser->buffer, escaped);
+		position++;
+	}
+
+	if (!IsValidUtf8String(parser->buffer.data + stringOffset,
+						   parser->buffer.len - stringOffset, false))
+	{
+		return false;
+	}
+
+	appendStringInfoCharMacro(&parser->buffer, '\0');
+	return true;
+}
+
+
+/*
+ * Appends the UTF-8 encoding of the \u escape at *position (on its 'u'),
+ * combining surrogate pairs, and moves *position past it. Lone surrogates
+ * and \u0000 are not parsed.
+ */
+static bool
+AppendUnicodeEscape(JsonBsonParser *parser, const char **position, const char *end)
+{
+	uint32 codePoint = 0;
+	int escapeCount = 0;
+	const char *current = *position;
+	while (true)
+	{
+		if (end - current < 5)
+		{
+			return false;
+		}
+
+		uint32 codeUnit = 0;
+		for (int i = 1; i <= 4; i++)
+		{
+			char digit = current[i];
+			codeUnit <<= 4;
+			if (digit >= '0' && digit <= '9')
+			{
+				codeUnit |= digit - '0';
+			}
+			else if (digit >= 'a' && digit <= 'f')
+			{
+				codeUnit |= digit - 'a' + 10;
+			}
+			else if (digit >= 'A' && digit <= 'F')
+			{
+				codeUnit |= digit - 'A' + 10;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		current += 5;
+		escapeCount++;
+
+		if (escapeCount == 1)
+		{
+			if (codeUnit >= 0xD800 && codeUnit <= 0xDBFF)
+			{
+				/* A high surrogate must be followed by an escaped low surrogate */
+				if (end - current < 6 || current[0] != '\\' || current[1] != 'u')
+				{
+					return false;
+				}
+
+				codePoint = codeUnit;
+				current++;
+				continue;
+			}
+			else if ((codeUnit >= 0xDC00 && codeUnit <= 0xDFFF) || codeUnit == 0)
+			{
+				return false;
+			}
+
+			codePoint = codeUnit;
+		}
+		else
+		{
+			if (codeUnit < 0xDC00 || codeUnit > 0xDFFF)
+			{
+				return false;
+			}
+
+			codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (codeUnit - 0xDC00);
+		}
+
+		break;
+	}
+
+	char encoded[4];
+	int encodedLength;
+	if (codePoint < 0x80)
+	{
+		encoded[0] = (char) codePoint;
+		encodedLength = 1;
+	}
+	else if (codePoint < 0x800)
+	{
+		encoded[0] = (char) (0xC0 | (codePoint >> 6));
+		encoded[1] = (char) (0x80 | (codePoint & 0x3F));
+		encodedLength = 2;
+	}
+	else if (codePoint < 0x10000)
+	{
+		encoded[0] = (char) (0xE0 | (codePoint >> 12));
+		encoded[1] = (char) (0x80 | ((codePoint >> 6) & 0x3F));
+		encoded[2] = (char) (0x80 | (codePoint & 0x3F));
+		encodedLength = 3;
+	}
+	else
+	{
+		encoded[0] = (char) (0xF0 | (codePoint >> 18));
+		encoded[1] = (char) (0x80 | ((codePoint >> 12) & 0x3F));
+		encoded[2] = (char) (0x80 | ((codePoint >> 6) & 0x3F));
+		encoded[3] = (char) (0x80 | (codePoint & 0x3F));
+		encodedLength = 4;
+	}
+
+	appendBinaryStringInfo(&parser->buffer, encoded, encodedLength);
+	*position = current;
+	return true;
+}
+
+
+/*
+ * Checks that the scalar at the current offset is exactly the literal.
+ */
+static bool
+ParseLiteral(JsonBsonParser *parser, const char *literal, uint32 length)
+{
+	uint32 offset = parser->offsets[parser->current++];
+	return parser->jsonLength - offset >= length &&
+		   memcmp(parser->json + offset, literal, length) == 0 &&
+		   IsScalarEnd(parser, offset + length);
+}
+
+
+/*
+ * Writes the number at the current offset. As libbson does, integers are
+ * int32 when they fit and int64 otherwise, and numbers with a fraction or
+ * an exponent are doubles. Numbers that are not strictly JSON, -0, and
+ * numbers out of the range of int64 or double are not parsed.
+ */
+static bool
+ParseNumber(JsonBsonParser *parser, uint32 typeOffset)
+{
+	uint32 startOffset = parser->offsets[parser->current++];
+	const char *start = parser->json + startOffset;
+	const char *end = parser->json + parser->jsonLength;
+	const char *position = start;
+
+	bool isNegative = false;
+	if (*position == '-')
+	{
+		isNegative = true;
+		position++;
+	}
+
+	if (position >= end || *position < '0' || *position > '9')
+	{
+		return false;
+	}
+
+	const char *integerStart = position;
+	if (*position == '0')
+	{
+		position++;
+	}
+	else
+	{
+		while (position < end && *position >= '0' && *position <= '9')
+		{
+			position++;
+		}
+	}
+
+	const char *integerEnd = position;
+	bool isDouble = false;
+	if (position < end && *position == '.')
+	{
+		isDouble = true;
+		position++;
+		if (position >= end || *position < '0' || *position > '9')
+		{
+			return false;
+		}
+
+		while (position < end && *position >= '0' && *position <= '9')
+		{
+			position++;
+		}
+	}
+
+	if (position < end && (*position == 'e' || *position == 'E'))
+	{
+		isDouble = true;
+		position++;
+		if (position < end && (*position == '+' || *position == '-'))
+		{
+			position++;
+		}
+
+		if (position >= end || *position < '0' || *position > '9')
+		{
+			return false;
+		}
+
+		while (position < end && *position >= '0' && *position <= '9')
+		{
+			position++;
+		}
+	}
+
+	if (!IsScalarEnd(parser, position - parser->json))
+	{
+		return false;
+	}
+
+	uint8 *type = (uint8 *) parser->buffer.data + typeOffset;
+	if (isDouble)
+	{
+		uint32 numberLength = position - start;
+		if (numberLength > JSON_PARSER_MAX_NUMBER_LENGTH)
+		{
+			return false;
+		}
+
+		char numberText[JSON_PARSER_MAX_NUMBER_LENGTH + 1];
+		memcpy(numberText, start, numberLength);
+		numberText[numberLength] = '\0';
+
+		char *numberEnd;
+		errno = 0;
+		double value = strtod(numberText, &numberEnd);
+		if (errno == ERANGE || numberEnd != numberText + numberLength)
+		{
+			return false;
+		}
+
+		*type = BSON_TYPE_DOUBLE;
+		value = BSON_DOUBLE_TO_LE(value);
+		appendBinaryStringInfo(&parser->buffer, (const char *) &value, sizeof(double));
+		return true;
+	}
+
+	/* Over 19 digits can't fit in an int64 */
+	if (integerEnd - integerStart > 19)
+	{
+		return false;
+	}
+
+	uint64 magnitude = 0;
+	for (const char *digit = integerStart; digit < integerEnd; digit++)
+	{
+		magnitude = magnitude * 10 + (*digit - '0');
+	}
+
+	if (isNegative && magnitude == 0)
+	{
+		return false;
+	}
+
+	if (magnitude <= (uint64) PG_INT32_MAX ||
+		(isNegative && magnitude == (uint64) PG_INT32_MAX + 1))
+	{
+		*type = BSON_TYPE_INT32;
+		AppendInt32(&parser->buffer,
+					isNegative ? (int32) (-(int64) magnitude) : (int32) magnitude);
+		return true;
+	}
+	else if (magnitude > (uint64) PG_INT64_MAX)
+	{
+		return false;
+	}
+
+	*type = BSON_TYPE_INT64;
+	int64 value = isNegative ? -(int64) magnitude : (int64) magnitude;
+	value = BSON_UINT64_TO_LE(value);
+	appendBinaryStringInfo(&parser->buffer, (const char *) &value, sizeof(int64));
+	return true;
+}
+
+
+/*
+ * Whether a scalar ending before the byte at offset is terminated by the
+ * end of the input, whitespace or the separator of values.
+ */
+static inline bool
+IsScalarEnd(JsonBsonParser *parser, uint32 offset)
+{
+	if (offset >= parser->jsonLength)
+	{
+		return true;
+	}
+
+	switch (parser->json[offset])
+	{
+		case ' ':
+		case '\t':
+		case '\n':
+		case '\r':
+		case ',':
+		case '}':
+		case ']':
+		{
+			return true;
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
+static inline void
+AppendInt32(StringInfo buffer, int32 value)
+{
+	value = BSON_UINT32_TO_LE(value);
+	appendBinaryStringInfo(buffer, (const char *) &value, sizeof(int32));
+}
+
+
+static inline void
+WriteInt32(StringInfo buffer, uint32 offset, int32 value)
+{
+	value = BSON_UINT32_TO_LE(value);
+	memcpy(buffer->data + offset, &value, sizeof(int32));
+}
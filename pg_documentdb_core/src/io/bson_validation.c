@@ -0,0 +1,359 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/io/bson_validation.c
+ *
+ * Implementation of the single pass validation of input bson.
+ *
+ * bson_validate visits every element of the document through callbacks
+ * and re-initializes a bson_t for every nested document. Documents coming
+ * from users are almost always valid, so they are first checked here by
+ * a single loop over the bytes that only verifies the lengths, types and
+ * terminators, and UTF-8 strings 8 bytes at a time when requested.
+ *
+ * This only ever accepts documents: anything it doesn't accept is left to
+ * bson_validate which then produces the error.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <postgres.h>
+
+#include "io/bson_core.h"
+#include "io/bson_validation.h"
+#include "utils/swar_utils.h"
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+/* Documents nested deeper than this are left to bson_validate */
+#define BSON_VALIDATION_MAX_DEPTH 100
+
+/* --------------------------------------------------------- */
+/* Forward declaration */
+/* --------------------------------------------------------- */
+
+static inline int32 ReadInt32(const uint8_t *bytes);
+static bool IsValidUtf8Sequence(const uint8_t *bytes, uint32_t length,
+								uint32_t *sequenceLength);
+
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+/*
+ * TryValidateBsonBytes returns true if the bytes are a valid bson document
+ * for the validateFlag, as bson_validate_with_error would find. A false
+ * return doesn't mean the document is invalid, only that bson_validate
+ * has to decide: besides invalid documents this is the case for field name
+ * validations, deprecated types and deeply nested documents.
+ */
+bool
+TryValidateBsonBytes(const uint8_t *documentBytes, uint32_t documentBytesLength,
+					 bson_validate_flags_t validateFlag)
+{
+	if ((validateFlag & ~(BSON_VALIDATE_UTF8 | BSON_VALIDATE_UTF8_ALLOW_NULL)) != 0)
+	{
+		return false;
+	}
+
+	bool validateUtf8 = (validateFlag & BSON_VALIDATE_UTF8) != 0;
+	bool allowNull = (validateFlag & BSON_VALIDATE_UTF8_ALLOW_NULL) != 0;
+
+	if (documentBytesLength < 5 || documentBytesLength > INT32_MAX ||
+		(uint32_t) ReadInt32(documentBytes) != documentBytesLength ||
+		documentBytes[documentBytesLength - 1] != 0)
+	{
+		return false;
+	}
+
+	/* The offsets of the terminators of the enclosing documents */
+	uint32_t documentEnds[BSON_VALIDATION_MAX_DEPTH];
+	int depth = 0;
+
+	uint32_t documentEnd = documentBytesLength - 1;
+	uint32_t offset = 4;
+	while (true)
+	{
+		if (offset == documentEnd)
+		{
+			if (depth == 0)
+			{
+				return true;
+			}
+
+			offset = documentEnd + 1;
+			documentEnd = documentEnds[--depth];
+			continue;
+		}
+
+		uint8_t type = documentBytes[offset++];
+		const uint8_t *key = documentBytes + offset;
+		const uint8_t *keyEnd = memchr(key, 0, documentEnd - offset);
+		if (keyEnd == NULL)
+		{
+			return false;
+		}
+
+		uint32_t keyLength = keyEnd - key;
+		if (validateUtf8 && !IsValidUtf8String((const char *) key, keyLength, false))
+		{
+			return false;
+		}
+
+		offset += keyLength + 1;
+
+		/* The bytes left for the value before the terminator of the document */
+		uint32_t remaining = documentEnd - offset;
+		uint32_t valueLength;
+		switch ((bson_type_t) type)
+		{
+			case BSON_TYPE_MINKEY:
+			case BSON_TYPE_MAXKEY:
+			case BSON_TYPE_NULL:
+			case BSON_TYPE_UNDEFINED:
+			{
+				valueLength = 0;
+				break;
+			}
+
+			case BSON_TYPE_BOOL:
+			{
+				if (remaining < 1 || documentBytes[offset] > 1)
+				{
+					return false;
+				}
+
+				valueLength = 1;
+				break;
+			}
+
+			case BSON_TYPE_INT32:
+			{
+				valueLength = 4;
+				break;
+			}
+
+			case BSON_TYPE_DOUBLE:
+			case BSON_TYPE_INT64:
+			case BSON_TYPE_DATE_TIME:
+			case BSON_TYPE_TIMESTAMP:
+			{
+				valueLength = 8;
+				break;
+			}
+
+			case BSON_TYPE_OID:
+			{
+				valueLength = 12;
+				break;
+			}
+
+			case BSON_TYPE_DECIMAL128:
+			{
+				valueLength = 16;
+				break;
+			}
+
+			case BSON_TYPE_UTF8:
+			case BSON_TYPE_CODE:
+			case BSON_TYPE_SYMBOL:
+			{
+				if (remaining < 4)
+				{
+					return false;
+				}
+
+				int32 stringLength = ReadInt32(documentBytes + offset);
+				if (stringLength < 1 || (uint32_t) stringLength > remaining - 4 ||
+					documentBytes[offset + 4 + stringLength - 1] != 0)
+				{
+					return false;
+				}
+
+				if (validateUtf8 &&
+					!IsValidUtf8String((const char *) documentBytes + offset + 4,
+									   stringLength - 1, allowNull))
+				{
+					return false;
+				}
+
+				valueLength = 4 + stringLength;
+				break;
+			}
+
+			case BSON_TYPE_BINARY:
+			{
+				if (remaining < 5)
+				{
+					return false;
+				}
+
+				int32 binaryLength = ReadInt32(documentBytes + offset);
+				if (binaryLength < 0 || (uint32_t) binaryLength > remaining - 5 ||
+					documentBytes[offset + 4] == BSON_SUBTYPE_BINARY_DEPRECATED)
+				{
+					return false;
+				}
+
+				valueLength = 5 + binaryLength;
+				break;
+			}
+
+			case BSON_TYPE_DOCUMENT:
+			case BSON_TYPE_ARRAY:
+			{
+				if (remaining < 5 || depth == BSON_VALIDATION_MAX_DEPTH)
+				{
+					return false;
+				}
+
+				int32 nestedLength = ReadInt32(documentBytes + offset);
+				if (nestedLength < 5 || (uint32_t) nestedLength > remaining ||
+					documentBytes[offset + nestedLength - 1] != 0)
+				{
+					return false;
+				}
+
+				/* Continue with the elements of the nested document */
+				documentEnds[depth++] = documentEnd;
+				documentEnd = offset + nestedLength - 1;
+				offset += 4;
+				continue;
+			}
+
+			default:
+			{
+				/* Regular expressions, DBPointers, code with scope and corrupt types */
+				return false;
+			}
+		}
+
+		if (valueLength > remaining)
+		{
+			return false;
+		}
+
+		offset += valueLength;
+	}
+}
+
+
+/*
+ * IsValidUtf8String returns whether the string is valid UTF-8, as strict
+ * as the standard: overlong encodings, surrogates and code points after
+ * U+10FFFF are rejected. Runs of ASCII are checked 8 bytes at a time.
+ */
+bool
+IsValidUtf8String(const char *string, uint32_t length, bool allowNull)
+{
+	const uint8_t *bytes = (const uint8_t *) string;
+	uint32_t offset = 0;
+	while (offset < length)
+	{
+		while (length - offset >= sizeof(uint64))
+		{
+			uint64 word = SwarLoadWord(bytes + offset);
+			if ((word & SWAR_HIGH_BITS) != 0)
+			{
+				break;
+			}
+
+			if (!allowNull && SwarZeroBytes(word) != 0)
+			{
+				return false;
+			}
+
+			offset += sizeof(uint64);
+		}
+
+		if (offset == length)
+		{
+			break;
+		}
+
+		if (bytes[offset] < 0x80)
+		{
+			if (bytes[offset] == 0 && !allowNull)
+			{
+				return false;
+			}
+
+			offset++;
+			continue;
+		}
+
+		uint32_t sequenceLength;
+		if (!IsValidUtf8Sequence(bytes + offset, length - offset, &sequenceLength))
+		{
+			return false;
+		}
+
+		offset += sequenceLength;
+	}
+
+	return true;
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods */
+/* --------------------------------------------------------- */
+
+static inline int32
+ReadInt32(const uint8_t *bytes)
+{
+	int32 value;
+	memcpy(&value, bytes, sizeof(int32));
+	return BSON_UINT32_FROM_LE(value);
+}
+
+
+/*
+ * Checks the multi-byte UTF-8 sequence starting at bytes, per the table of
+ * well-formed byte sequences of the Unicode standard.
+ */
+static bool
+IsValidUtf8Sequence(const uint8_t *bytes, uint32_t length, uint32_t *sequenceLength)
+{
+	uint8_t first = bytes[0];
+	uint8_t secondMin = 0x80;
+	uint8_t secondMax = 0xBF;
+	if (first >= 0xC2 && first <= 0xDF)
+	{
+		*sequenceLength = 2;
+	}
+	else if (first >= 0xE0 && first <= 0xEF)
+	{
+		*sequenceLength = 3;
+		secondMin = first == 0xE0 ? 0xA0 : 0x80;
+		secondMax = first == 0xED ? 0x9F : 0xBF;
+	}
+	else if (first >= 0xF0 && first <= 0xF4)
+	{
+		*sequenceLength = 4;
+		secondMin = first == 0xF0 ? 0x90 : 0x80;
+		secondMax = first == 0xF4 ? 0x8F : 0xBF;
+	}
+	else
+	{
+		return false;
+	}
+
+	if (length < *sequenceLength || bytes[1] < secondMin || bytes[1] > secondMax)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 2; i < *sequenceLength; i++)
+	{
+		if ((bytes[i] & 0xC0) != 0x80)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -19,6 +19,7 @@
 #undef PRIVATE_PGBSON_H
 
 #include "io/bsonvalue_utils.h"
+#include "io/bson_validation.h"
 #include "utils/documentdb_errors.h"
 #include "utils/string_view.h"
 
@@ -28,6 +29,12 @@
 static pgbson * CreatePgbsonfromBson_t(bson_t *document, bool destroyDocument);
 
 static pgbson * CreatePgbsonfromBsonBytes(const uint8_t *rawbytes, uint32_t length);
+static void FlushSplicePendingRange(pgbson_splice_writer *writer);
+static void WriteSpliceDocumentLength(pgbson_splice_writer *writer,
+									  uint32_t documentOffset);
+
+extern bool EnableFastJsonParser;
+extern bool EnableFastBsonValidation;
 
 static const char *BsonHexPrefix = "BSONHEX";
 static const uint32_t BsonHexPrefixLength = 7;
@@ -193,6 +200,13 @@ PgbsonToHexadecimalString(const pgbson *bsonDocument)
 pgbson *
 PgbsonInitFromJson(const char *jsonString)
 {
+	pgbson *document;
+	if (EnableFastJsonParser &&
+		TryParseJsonToPgbson(jsonString, strlen(jsonString), &document))
+	{
+		return document;
+	}
+
 	bson_t bson;
 	bson_error_t error;
 	bool parseResult = bson_init_from_json(&bson, jsonString, -1, &error);
@@ -473,6 +487,12 @@ ValidateInputBsonBytes(const uint8_t *documentBytes,
 					   uint32_t documentBytesLength,
 					   bson_validate_flags_t validateFlag)
 {
+	if (EnableFastBsonValidation &&
+		TryValidateBsonBytes(documentBytes, documentBytesLength, validateFlag))
+	{
+		return;
+	}
+
 	bson_t bson;
 	if (!bson_init_static(&bson, documentBytes, documentBytesLength))
 	{
@@ -1662,6 +1682,134 @@ BsonValueToDocumentPgbson(const bson_value_t *value)
 }
 
 
+/* --------------------------------------------------------- */
+/* pgbson_splice_writer functions */
+/* --------------------------------------------------------- */
+
+/*
+ * Initializes a splice writer with room for a document of expectedSize bytes,
+ * usually the size of the document whose elements are spliced.
+ */
+void
+PgbsonSpliceWriterInit(pgbson_splice_writer *writer, uint32_t expectedSize)
+{
+	initStringInfo(&writer->buffer);
+	enlargeStringInfo(&writer->buffer, VARHDRSZ + Max(expectedSize, 5));
+
+	/* The varlena header and the length of the document are written at the end */
+	writer->buffer.len = VARHDRSZ + sizeof(int32);
+	writer->pendingStart = NULL;
+	writer->pendingLength = 0;
+}
+
+
+/*
+ * Appends the element the iterator is on, as is, to the splice writer.
+ * The bytes are only copied when an element that doesn't follow it in
+ * the source is written, so that a run of consecutive elements of the
+ * source is copied at once: the document iterated must be kept until then.
+ */
+void
+PgbsonSpliceWriterAppendIter(pgbson_splice_writer *writer, const bson_iter_t *iter)
+{
+	/*
+	 * The element spans from its type byte to the start of the next element,
+	 * these offsets are only available in the fields of the iterator.
+	 */
+	const uint8_t *elementStart = iter->raw + iter->off;
+	uint32_t elementLength = iter->next_off - iter->off;
+
+	if (writer->pendingStart != NULL &&
+		writer->pendingStart + writer->pendingLength == elementStart)
+	{
+		writer->pendingLength += elementLength;
+		return;
+	}
+
+	FlushSplicePendingRange(writer);
+	writer->pendingStart = elementStart;
+	writer->pendingLength = elementLength;
+}
+
+
+/*
+ * Appends all the fields written to the pgbson_writer to the splice writer,
+ * at the same level.
+ */
+void
+PgbsonSpliceWriterConcatWriter(pgbson_splice_writer *writer,
+							   pgbson_writer *writerToConcat)
+{
+	FlushSplicePendingRange(writer);
+
+	/* Skip the length and the terminator of the document */
+	uint32_t documentLength = writerToConcat->innerBson.len;
+	if (documentLength > 5)
+	{
+		appendBinaryStringInfo(&writer->buffer,
+							   (const char *) bson_get_data(&writerToConcat->innerBson) +
+							   sizeof(int32), documentLength - 5);
+	}
+}
+
+
+/*
+ * Starts a nested document at the path in the splice writer, the fields appended
+ * to the splice writer are written to it until PgbsonSpliceWriterEndDocument is
+ * called with the returned offset.
+ */
+uint32_t
+PgbsonSpliceWriterStartDocument(pgbson_splice_writer *writer, const char *path,
+								uint32_t pathLength)
+{
+	FlushSplicePendingRange(writer);
+
+	appendStringInfoChar(&writer->buffer, (char) BSON_TYPE_DOCUMENT);
+	appendBinaryStringInfo(&writer->buffer, path, pathLength);
+	appendStringInfoChar(&writer->buffer, '\0');
+
+	/* The length of the nested document is written when it ends */
+	uint32_t documentOffset = writer->buffer.len;
+	enlargeStringInfo(&writer->buffer, sizeof(int32));
+	writer->buffer.len += sizeof(int32);
+	return documentOffset;
+}
+
+
+/*
+ * Ends the nested document started at documentOffset by PgbsonSpliceWriterStartDocument.
+ */
+void
+PgbsonSpliceWriterEndDocument(pgbson_splice_writer *writer, uint32_t documentOffset)
+{
+	FlushSplicePendingRange(writer);
+
+	appendStringInfoChar(&writer->buffer, '\0');
+	WriteSpliceDocumentLength(writer, documentOffset);
+}
+
+
+/*
+ * Gets the document written to the splice writer, the writer
+ * is deemed unusable after this point.
+ */
+pgbson *
+PgbsonSpliceWriterGetPgbson(pgbson_splice_writer *writer)
+{
+	FlushSplicePendingRange(writer);
+
+	appendStringInfoChar(&writer->buffer, '\0');
+	WriteSpliceDocumentLength(writer, VARHDRSZ);
+
+	/* The buffer is returned as is, without another copy */
+	pgbson *document = (pgbson *) writer->buffer.data;
+	SET_VARSIZE(document, writer->buffer.len);
+
+	writer->buffer.data = NULL;
+	return document;
+}
+
+
 /* --------------------------------------------------------- */
 /* Private helper methods */
 /* --------------------------------------------------------- */
@@ -1798,3 +1946,39 @@ IsPgbsonHeapWriterEmptyDocument(pgbson_heap_writer *writer)
 {
 	return writer != NULL && PgbsonHeapWriterGetSize(writer) < 6;
 }
+
+
+/*
+ * Copies the range of the source elements pending in the splice writer.
+ */
+static void
+FlushSplicePendingRange(pgbson_splice_writer *writer)
+{
+	if (writer->pendingLength > 0)
+	{
+		appendBinaryStringInfo(&writer->buffer, (const char *) writer->pendingStart,
+							   writer->pendingLength);
+	}
+
+	writer->pendingStart = NULL;
+	writer->pendingLength = 0;
+}
+
+
+/*
+ * Writes the length of the document that starts at documentOffset in the buffer
+ * of the splice writer and ends at the end of the buffer.
+ */
+static void
+WriteSpliceDocumentLength(pgbson_splice_writer *writer, uint32_t documentOffset)
+{
+	uint32_t documentLength = writer->buffer.len - documentOffset;
+	if (documentLength > INT32_MAX)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_BADVALUE), errmsg(
+							"splicing document: failed due to value being too large")));
+	}
+
+	uint32_t documentLengthLe = BSON_UINT32_TO_LE(documentLength);
+	memcpy(writer->buffer.data + documentOffset, &documentLengthLe, sizeof(uint32_t));
+}
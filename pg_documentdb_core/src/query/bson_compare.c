@@ -1010,6 +1010,17 @@ CompareBsonSortOrderType(const bson_value_t *left, const bson_value_t *right)
 }
 
 
+/*
+ * Gets the position of the values of a type in the sort order of types,
+ * from 0 (MinKey) to 15 (MaxKey).
+ */
+int
+GetBsonTypeSortOrder(bson_type_t type)
+{
+	return GetSortOrderType(type);
+}
+
+
 int
 CompareSortOrderType(bson_type_t left, bson_type_t right)
 {
@@ -1484,6 +1495,32 @@ CompareStrings(const char *left, uint32_t leftLength, const char *right, uint32_
 }
 
 
+/*
+ *  Compares two strings as CompareStrings does for the collation of the
+ *  sort key cache, by the cached sort keys of the strings.
+ */
+int
+CompareStringsWithSortKeyCache(const char *left, uint32_t leftLength, const
+							   char *right, uint32_t rightLength,
+							   CollationSortKeyCache *sortKeyCache)
+{
+	uint32_t minLength = leftLength < rightLength ? leftLength : rightLength;
+	if (minLength == 0)
+	{
+		return leftLength - rightLength;
+	}
+
+	int32_t cmp = StringCompareWithSortKeyCache(sortKeyCache, left, leftLength,
+												right, rightLength);
+	if (cmp != 0)
+	{
+		return cmp;
+	}
+
+	return leftLength - rightLength;
+}
+
+
 /*
  * Core implementation of converting bson value to double
  * In quiet mode no error is thrown if conversion results in overflow or underflow
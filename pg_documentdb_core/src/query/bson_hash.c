@@ -15,6 +15,7 @@
 #include <fmgr.h>
 
 #include "io/bson_hash.h"
+#include "collation/collation.h"
 #include "types/decimal128.h"
 #include "utils/documentdb_errors.h"
 
@@ -50,6 +51,14 @@ static uint64_t HashBsonValueCompare(const bson_value_t *value,
 									 uint64 (*hash_combine_func)(uint64 left, uint64
 																 right),
 									 int64 seed);
+static uint64 HashQueryFilterField(bson_iter_t *fieldIter, int64 seed);
+static void AppendBsonValueComparableEncodingCore(StringInfo buffer,
+												 const bson_value_t *value,
+												 const char *collationString);
+static void AppendEncodedBytes(StringInfo buffer, const char *bytes, uint32_t length);
+static void AppendEncodedDocument(StringInfo buffer, const uint8_t *data,
+								  uint32_t dataLength, const char *collationString);
+static bool IsQueryOperatorDocument(bson_iter_t *fieldIter);
 
 /* --------------------------------------------------------- */
 /* Top level exports */
@@ -136,6 +145,63 @@ HashBsonValueComparable(const bson_value_t *bsonIterValue, uint32_t seed)
 }
 
 
+/*
+ * Appends an encoding of the value to the buffer, such that values with the
+ * same encoding compare equal, and values that compare equal and hash the
+ * same with HashBsonValueComparable have the same encoding. Like the hash,
+ * numbers are encoded as int64 when they are 64 bit integers and as their
+ * decimal128 conversion otherwise, null is undefined and symbols are strings.
+ * This lets callers group values by comparing their encodings with memcmp.
+ */
+void
+AppendBsonValueComparableEncoding(StringInfo buffer, const bson_value_t *value)
+{
+	AppendBsonValueComparableEncodingCore(buffer, value, NULL);
+}
+
+
+/*
+ * Like AppendBsonValueComparableEncoding, with the strings in the value
+ * (including those nested in documents and arrays) encoded as their ICU
+ * sort key for the collation. Strings that are equal under the collation,
+ * e.g. "a" and "A" at strength 2, then have the same encoding.
+ */
+void
+AppendBsonValueComparableEncodingWithCollation(StringInfo buffer,
+											   const bson_value_t *value,
+											   const char *collationString)
+{
+	AppendBsonValueComparableEncodingCore(buffer, value,
+										  IsCollationApplicable(collationString) ?
+										  collationString : NULL);
+}
+
+
+/*
+ * Hashes a query filter such that filters that only differ in the order
+ * of their predicates hash the same: the fields of the filter and of its
+ * operator documents (e.g. { "$gt": 1, "$lt": 5 }) are combined with a
+ * commutative sum, and the clauses of $and, $or and $nor are hashed as
+ * filters. Values matched by equality keep their field order, which is
+ * significant for them. 'filterIter' is positioned before the first field
+ * of the filter.
+ */
+uint64
+HashBsonQueryFilterExtended(bson_iter_t *filterIter, int64 seed)
+{
+	check_stack_depth();
+
+	uint64 fieldsHash = 0;
+	while (bson_iter_next(filterIter))
+	{
+		fieldsHash += HashQueryFilterField(filterIter, seed);
+	}
+
+	return hash_combine64(hash_bytes_uint32_extended(BSON_TYPE_DOCUMENT, seed),
+						  fieldsHash);
+}
+
+
 /*
  * BsonValueHash returns a hash value for a given BSON value using
  * the internal hash_bytes function in PostgreSQL.
@@ -735,3 +801,289 @@ HashBytesUint64(const uint8_t *bytes, uint32_t bytesLength, int64 seed)
 {
 	return hash_bytes_extended((unsigned char *) bytes, bytesLength, seed);
 }
+
+
+/*
+ * Hashes one field of a query filter or operator document, see
+ * HashBsonQueryFilterExtended.
+ */
+static uint64
+HashQueryFilterField(bson_iter_t *fieldIter, int64 seed)
+{
+	const char *key = bson_iter_key(fieldIter);
+	uint64 keyHash = hash_bytes_extended((const unsigned char *) key,
+										 bson_iter_key_len(fieldIter), seed);
+	uint64 valueHash;
+	bson_iter_t childIter;
+
+	if (BSON_ITER_HOLDS_ARRAY(fieldIter) &&
+		(strcmp(key, "$and") == 0 || strcmp(key, "$or") == 0 ||
+		 strcmp(key, "$nor") == 0) &&
+		bson_iter_recurse(fieldIter, &childIter))
+	{
+		/* Every clause of a logical operator is a filter of its own */
+		valueHash = hash_bytes_uint32_extended(BSON_TYPE_ARRAY, seed);
+		while (bson_iter_next(&childIter))
+		{
+			bson_iter_t clauseIter;
+			if (BSON_ITER_HOLDS_DOCUMENT(&childIter) &&
+				bson_iter_recurse(&childIter, &clauseIter))
+			{
+				valueHash = hash_combine64(valueHash,
+										   HashBsonQueryFilterExtended(&clauseIter,
+																	   seed));
+			}
+			else
+			{
+				valueHash = hash_combine64(valueHash,
+										   HashBsonValueComparableExtended(
+											   bson_iter_value(&childIter), seed));
+			}
+		}
+	}
+	else if (IsQueryOperatorDocument(fieldIter) &&
+			 bson_iter_recurse(fieldIter, &childIter))
+	{
+		valueHash = HashBsonQueryFilterExtended(&childIter, seed);
+	}
+	else
+	{
+		valueHash = HashBsonValueComparableExtended(bson_iter_value(fieldIter), seed);
+	}
+
+	return hash_combine64(keyHash, valueHash);
+}
+
+
+/*
+ * Whether the field holds a document of query operators, which is
+ * recognized by its first field being an operator.
+ */
+static bool
+IsQueryOperatorDocument(bson_iter_t *fieldIter)
+{
+	bson_iter_t childIter;
+	if (!BSON_ITER_HOLDS_DOCUMENT(fieldIter) ||
+		!bson_iter_recurse(fieldIter, &childIter) ||
+		!bson_iter_next(&childIter))
+	{
+		return false;
+	}
+
+	return bson_iter_key(&childIter)[0] == '$';
+}
+
+
+/*
+ * Appends the encoding of a value, see AppendBsonValueComparableEncoding.
+ * collationString is NULL when strings are encoded as is.
+ */
+static void
+AppendBsonValueComparableEncodingCore(StringInfo buffer, const bson_value_t *value,
+									  const char *collationString)
+{
+	check_stack_depth();
+
+	uint8_t typeCode = (uint8_t) value->value_type;
+	switch (value->value_type)
+	{
+		case BSON_TYPE_EOD:
+		case BSON_TYPE_MINKEY:
+		{
+			appendStringInfoCharMacro(buffer, (char) BSON_TYPE_MINKEY);
+			return;
+		}
+
+		case BSON_TYPE_UNDEFINED:
+		case BSON_TYPE_NULL:
+		{
+			appendStringInfoCharMacro(buffer, (char) BSON_TYPE_UNDEFINED);
+			return;
+		}
+
+		case BSON_TYPE_MAXKEY:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			return;
+		}
+
+		case BSON_TYPE_INT32:
+		case BSON_TYPE_INT64:
+		case BSON_TYPE_DOUBLE:
+		case BSON_TYPE_DECIMAL128:
+		{
+			bool checkFixedInteger = true;
+			if (value->value_type == BSON_TYPE_INT32 ||
+				value->value_type == BSON_TYPE_INT64 ||
+				IsBsonValue64BitInteger(value, checkFixedInteger))
+			{
+				int64_t int64Value = BsonValueAsInt64(value);
+				appendStringInfoCharMacro(buffer, (char) BSON_TYPE_INT64);
+				appendBinaryStringInfo(buffer, &int64Value, sizeof(int64_t));
+				return;
+			}
+
+			bson_decimal128_t decimalValue = GetBsonValueAsDecimal128(value);
+			appendStringInfoCharMacro(buffer, (char) BSON_TYPE_DECIMAL128);
+			appendBinaryStringInfo(buffer, &decimalValue, sizeof(bson_decimal128_t));
+			return;
+		}
+
+		case BSON_TYPE_UTF8:
+		case BSON_TYPE_SYMBOL:
+		{
+			appendStringInfoCharMacro(buffer, (char) BSON_TYPE_UTF8);
+			if (collationString == NULL)
+			{
+				AppendEncodedBytes(buffer, value->value.v_utf8.str,
+								   value->value.v_utf8.len);
+				return;
+			}
+
+			char *sortKey = GetCollationSortKey(collationString,
+												value->value.v_utf8.str,
+												value->value.v_utf8.len);
+			AppendEncodedBytes(buffer, sortKey, strlen(sortKey));
+			pfree(sortKey);
+			return;
+		}
+
+		case BSON_TYPE_DOCUMENT:
+		case BSON_TYPE_ARRAY:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			AppendEncodedDocument(buffer, value->value.v_doc.data,
+								  value->value.v_doc.data_len, collationString);
+			return;
+		}
+
+		case BSON_TYPE_BINARY:
+		{
+			uint32_t subtype = (uint32_t) value->value.v_binary.subtype;
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			appendBinaryStringInfo(buffer, &subtype, sizeof(uint32_t));
+			AppendEncodedBytes(buffer, (const char *) value->value.v_binary.data,
+							   value->value.v_binary.data_len);
+			return;
+		}
+
+		case BSON_TYPE_OID:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			appendBinaryStringInfo(buffer, value->value.v_oid.bytes, 12);
+			return;
+		}
+
+		case BSON_TYPE_BOOL:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			appendStringInfoCharMacro(buffer, value->value.v_bool ? 1 : 0);
+			return;
+		}
+
+		case BSON_TYPE_DATE_TIME:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			appendBinaryStringInfo(buffer, &value->value.v_datetime, sizeof(int64_t));
+			return;
+		}
+
+		case BSON_TYPE_TIMESTAMP:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			appendBinaryStringInfo(buffer, &value->value.v_timestamp.timestamp,
+								   sizeof(uint32_t));
+			appendBinaryStringInfo(buffer, &value->value.v_timestamp.increment,
+								   sizeof(uint32_t));
+			return;
+		}
+
+		case BSON_TYPE_REGEX:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			const char *regex = value->value.v_regex.regex;
+			const char *options = value->value.v_regex.options;
+			AppendEncodedBytes(buffer, regex, regex != NULL ? strlen(regex) : 0);
+			AppendEncodedBytes(buffer, options, options != NULL ? strlen(options) : 0);
+			return;
+		}
+
+		case BSON_TYPE_DBPOINTER:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			AppendEncodedBytes(buffer, value->value.v_dbpointer.collection,
+							   value->value.v_dbpointer.collection_len);
+			appendBinaryStringInfo(buffer, value->value.v_dbpointer.oid.bytes, 12);
+			return;
+		}
+
+		case BSON_TYPE_CODE:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			AppendEncodedBytes(buffer, value->value.v_code.code,
+							   value->value.v_code.code_len);
+			return;
+		}
+
+		case BSON_TYPE_CODEWSCOPE:
+		{
+			appendStringInfoCharMacro(buffer, (char) typeCode);
+			AppendEncodedBytes(buffer, value->value.v_codewscope.code,
+							   value->value.v_codewscope.code_len);
+			AppendEncodedDocument(buffer, value->value.v_codewscope.scope_data,
+								  value->value.v_codewscope.scope_len, collationString);
+			return;
+		}
+
+		default:
+		{
+			ereport(ERROR, (errcode(ERRCODE_DOCUMENTDB_COMMANDNOTSUPPORTED),
+							errmsg(
+								"invalid bson type for hash value bson- not supported yet"),
+							errdetail_log(
+								"bson value encoding - encountered unsupported type: %d",
+								value->value_type)));
+		}
+	}
+}
+
+
+/*
+ * Appends the length prefixed bytes to the encoding of a value.
+ */
+static void
+AppendEncodedBytes(StringInfo buffer, const char *bytes, uint32_t length)
+{
+	appendBinaryStringInfo(buffer, &length, sizeof(uint32_t));
+	if (length > 0)
+	{
+		appendBinaryStringInfo(buffer, bytes, length);
+	}
+}
+
+
+/*
+ * Appends the encoding of the fields of a document or array: every field
+ * as a 1 followed by its name and value, and a 0 at the end.
+ */
+static void
+AppendEncodedDocument(StringInfo buffer, const uint8_t *data, uint32_t dataLength,
+					  const char *collationString)
+{
+	bson_iter_t documentIter;
+	if (!bson_iter_init_from_data(&documentIter, data, dataLength))
+	{
+		ereport(ERROR, errmsg("Could not initialize nested iterator for document"));
+	}
+
+	while (bson_iter_next(&documentIter))
+	{
+		appendStringInfoCharMacro(buffer, 1);
+		AppendEncodedBytes(buffer, bson_iter_key(&documentIter),
+						   bson_iter_key_len(&documentIter));
+		AppendBsonValueComparableEncodingCore(buffer, bson_iter_value(&documentIter),
+											  collationString);
+	}
+
+	appendStringInfoCharMacro(buffer, 0);
+}
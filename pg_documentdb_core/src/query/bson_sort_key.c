@@ -0,0 +1,802 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/query/bson_sort_key.c
+ *
+ * Implementation of the memcmp comparable encoding of bson values.
+ *
+ * The sort key of a value is a byte string such that comparing the sort
+ * keys of two values with memcmp orders them as CompareBsonValueAndType
+ * (or CompareBsonValueAndTypeWithCollation) does:
+ *
+ *   - Every value starts with a byte derived from its sort order type, so
+ *     values of different sort order types are ordered by type. 0x00 is
+ *     never a type byte and terminates documents and arrays.
+ *   - Numbers other than decimal128 are encoded as a class byte (NaN,
+ *     -Infinity, negative, zero, positive, Infinity) followed, for finite
+ *     non-zero values, by the binary exponent and the normalized 64 bit
+ *     mantissa of their absolute value, complemented for negative values.
+ *     int32, int64 and double values that are equal have the same key.
+ *   - Strings escape 0x00 as 0x00 0xFF and end with 0x00 0x00, so that a
+ *     string sorts before the strings it is a prefix of. With a collation
+ *     the ICU sort key of the string is used instead, followed by the
+ *     length of the string which breaks ties as CompareStrings does.
+ *   - Documents are the sequence of their fields as type byte, field name
+ *     and value, ending with 0x00; arrays the same without field names.
+ *   - The remaining types are encoded as big endian integers or raw bytes
+ *     in the order their fields are compared.
+ *
+ * decimal128 values can't be encoded exactly. Their sort key is that of
+ * the nearest double towards zero, the key ends right after it and is
+ * reported as inexact. Such a key still orders correctly against other
+ * keys on its first BSON_ABBREVIATED_SORT_KEY_LENGTH bytes, which is what
+ * abbreviated keys rely on; everything else falls back to comparing the
+ * values.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <postgres.h>
+#include <miscadmin.h>
+#include <funcapi.h>
+#include <access/htup_details.h>
+#include <float.h>
+#include <math.h>
+#include <port/pg_bitutils.h>
+
+#include "io/bson_core.h"
+#include "io/pgbson.h"
+#include "query/bson_compare.h"
+#include "query/bson_sort_key.h"
+#include "types/decimal128.h"
+#include "collation/collation.h"
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+/* Class bytes of numbers, in sort order */
+typedef enum SortKeyNumberClass
+{
+	SortKeyNumberClass_NaN = 0x01,
+	SortKeyNumberClass_NegativeInfinity = 0x02,
+	SortKeyNumberClass_Negative = 0x03,
+	SortKeyNumberClass_Zero = 0x04,
+	SortKeyNumberClass_Positive = 0x05,
+	SortKeyNumberClass_PositiveInfinity = 0x06,
+} SortKeyNumberClass;
+
+/* Ends documents and arrays, lower than every type byte */
+#define SORT_KEY_END_OF_DOCUMENT 0x00
+
+/*
+ * State of writing a sort key.
+ */
+typedef struct SortKeyWriter
+{
+	/* The buffer the key is appended to */
+	StringInfo sortKey;
+
+	/* The collation of strings, or NULL */
+	const char *collationString;
+
+	/* The key is complete once it is this long, only a prefix is needed */
+	uint32_t maxLength;
+
+	/* Whether the key is exact so far, writing stops at the first inexact value */
+	bool isExact;
+} SortKeyWriter;
+
+/* --------------------------------------------------------- */
+/* Forward declaration */
+/* --------------------------------------------------------- */
+
+static inline uint8_t GetSortKeyTypeByte(bson_type_t type);
+static int WriteFiniteNumberSortKey(bool isNegative, int exponent, uint64 mantissa,
+									uint8_t *buffer);
+static int WriteIntegerSortKey(int64 intValue, uint8_t *buffer);
+static int WriteDoubleSortKey(double doubleValue, uint8_t *buffer);
+static int WriteDecimal128SortKey(const bson_value_t *value, uint8_t *buffer);
+static void AppendValueBodySortKey(SortKeyWriter *writer, const bson_value_t *value);
+static void AppendDocumentSortKey(SortKeyWriter *writer, const uint8_t *data,
+								  uint32_t dataLength, bool writeFieldNames);
+static void AppendStringSortKey(SortKeyWriter *writer, const char *string,
+								uint32_t length);
+static void AppendEscapedBytes(SortKeyWriter *writer, const char *bytes, uint32_t length);
+static uint64 GetAbbreviatedSortKey(StringInfo sortKey);
+static inline bool IsSortKeyComplete(SortKeyWriter *writer);
+static inline void WriteUint16BigEndian(uint8_t *buffer, uint16 value);
+static inline void WriteUint32BigEndian(uint8_t *buffer, uint32 value);
+static inline void WriteUint64BigEndian(uint8_t *buffer, uint64 value);
+
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+/*
+ * AppendBsonValueSortKey appends the sort key of the value to the buffer.
+ * Returns false if the key is not exact, i.e. memcmp of the key against
+ * another key may order the values differently from comparing them.
+ */
+bool
+AppendBsonValueSortKey(StringInfo sortKey, const bson_value_t *value,
+					   const char *collationString)
+{
+	SortKeyWriter writer = {
+		.sortKey = sortKey,
+		.collationString = collationString,
+		.maxLength = PG_UINT32_MAX,
+		.isExact = true
+	};
+
+	appendStringInfoCharMacro(sortKey, (char) GetSortKeyTypeByte(value->value_type));
+	AppendValueBodySortKey(&writer, value);
+	return writer.isExact;
+}
+
+
+/*
+ * GetBsonValueAbbreviatedSortKey returns the first bytes of the sort key of
+ * a value as a big endian integer, padded with zeros. If the abbreviated
+ * keys of two values differ, they order the values the same as
+ * CompareBsonValueAndTypeWithCollation.
+ */
+uint64
+GetBsonValueAbbreviatedSortKey(const bson_value_t *value, const char *collationString,
+							   StringInfo buffer)
+{
+	SortKeyWriter writer = {
+		.sortKey = buffer,
+		.collationString = collationString,
+		.maxLength = BSON_ABBREVIATED_SORT_KEY_LENGTH,
+		.isExact = true
+	};
+
+	resetStringInfo(buffer);
+	appendStringInfoCharMacro(buffer, (char) GetSortKeyTypeByte(value->value_type));
+	AppendValueBodySortKey(&writer, value);
+	return GetAbbreviatedSortKey(buffer);
+}
+
+
+/*
+ * GetPgbsonAbbreviatedSortKey returns the abbreviated sort key of a document
+ * in the order of ComparePgbson.
+ *
+ * ComparePgbson orders the fields of documents by type, then name, then
+ * value. The first field is the only one that usually fits in the
+ * abbreviated key, and most documents sorted are single fields with an
+ * empty name (e.g. the output of bson_orderby). So instead of spending two
+ * bytes on the terminator of an empty name, the type byte of the first field
+ * is incremented if its name is not empty: type bytes are 0x0F apart so this
+ * orders empty names first without changing the order of types.
+ */
+uint64
+GetPgbsonAbbreviatedSortKey(const pgbson *document, StringInfo buffer)
+{
+	SortKeyWriter writer = {
+		.sortKey = buffer,
+		.collationString = NULL,
+		.maxLength = BSON_ABBREVIATED_SORT_KEY_LENGTH,
+		.isExact = true
+	};
+
+	resetStringInfo(buffer);
+
+	bson_iter_t documentIterator;
+	PgbsonInitIterator(document, &documentIterator);
+	if (!bson_iter_next(&documentIterator))
+	{
+		/* The empty document sorts first */
+		return 0;
+	}
+
+	const bson_value_t *firstValue = bson_iter_value(&documentIterator);
+	uint32_t firstKeyLength = bson_iter_key_len(&documentIterator);
+	uint8_t typeByte = GetSortKeyTypeByte(firstValue->value_type);
+	if (firstKeyLength == 0)
+	{
+		appendStringInfoCharMacro(buffer, (char) typeByte);
+	}
+	else
+	{
+		appendStringInfoCharMacro(buffer, (char) (typeByte + 1));
+		AppendEscapedBytes(&writer, bson_iter_key(&documentIterator), firstKeyLength);
+	}
+
+	AppendValueBodySortKey(&writer, firstValue);
+
+	while (!IsSortKeyComplete(&writer) && bson_iter_next(&documentIterator))
+	{
+		const bson_value_t *fieldValue = bson_iter_value(&documentIterator);
+		appendStringInfoCharMacro(buffer,
+								  (char) GetSortKeyTypeByte(fieldValue->value_type));
+		AppendEscapedBytes(&writer, bson_iter_key(&documentIterator),
+						   bson_iter_key_len(&documentIterator));
+		AppendValueBodySortKey(&writer, fieldValue);
+	}
+
+	if (!IsSortKeyComplete(&writer))
+	{
+		appendStringInfoCharMacro(buffer, SORT_KEY_END_OF_DOCUMENT);
+	}
+
+	return GetAbbreviatedSortKey(buffer);
+}
+
+
+/*
+ * WriteFixedWidthBsonSortKey writes the sort key of a value of fixed width
+ * and returns its length, or returns 0 for other values.
+ */
+int
+WriteFixedWidthBsonSortKey(const bson_value_t *value,
+						   uint8_t sortKey[BSON_FIXED_WIDTH_SORT_KEY_LENGTH])
+{
+	sortKey[0] = GetSortKeyTypeByte(value->value_type);
+	switch (value->value_type)
+	{
+		case BSON_TYPE_EOD:
+		case BSON_TYPE_MINKEY:
+		case BSON_TYPE_UNDEFINED:
+		case BSON_TYPE_NULL:
+		case BSON_TYPE_MAXKEY:
+		{
+			return 1;
+		}
+
+		case BSON_TYPE_DOUBLE:
+		{
+			return 1 + WriteDoubleSortKey(value->value.v_double, &sortKey[1]);
+		}
+
+		case BSON_TYPE_INT32:
+		{
+			return 1 + WriteIntegerSortKey(value->value.v_int32, &sortKey[1]);
+		}
+
+		case BSON_TYPE_INT64:
+		{
+			return 1 + WriteIntegerSortKey(value->value.v_int64, &sortKey[1]);
+		}
+
+		case BSON_TYPE_BOOL:
+		{
+			sortKey[1] = value->value.v_bool ? 1 : 0;
+			return 2;
+		}
+
+		case BSON_TYPE_OID:
+		{
+			memcpy(&sortKey[1], value->value.v_oid.bytes, sizeof(value->value.v_oid));
+			return 1 + sizeof(value->value.v_oid);
+		}
+
+		case BSON_TYPE_DATE_TIME:
+		{
+			WriteUint64BigEndian(&sortKey[1], (uint64) value->value.v_datetime ^
+								 UINT64CONST(0x8000000000000000));
+			return 9;
+		}
+
+		case BSON_TYPE_TIMESTAMP:
+		{
+			WriteUint32BigEndian(&sortKey[1], value->value.v_timestamp.timestamp);
+			WriteUint32BigEndian(&sortKey[5], value->value.v_timestamp.increment);
+			return 9;
+		}
+
+		default:
+		{
+			return 0;
+		}
+	}
+}
+
+
+/*
+ * CompareBsonSortKeys compares two sort keys.
+ */
+int
+CompareBsonSortKeys(const uint8_t *leftKey, uint32_t leftLength,
+					const uint8_t *rightKey, uint32_t rightLength)
+{
+	int cmp = memcmp(leftKey, rightKey, Min(leftLength, rightLength));
+	if (cmp != 0)
+	{
+		return cmp > 0 ? 1 : -1;
+	}
+
+	return leftLength > rightLength ? 1 : (leftLength == rightLength ? 0 : -1);
+}
+
+
+/*
+ * TryCompareBsonValuesBySortKey compares two values of fixed width by their
+ * sort keys, the same as CompareBsonValueAndType would. Returns false
+ * without comparing if either value is not of fixed width.
+ */
+bool
+TryCompareBsonValuesBySortKey(const bson_value_t *left, const bson_value_t *right,
+							  int *cmp, bool *isComparisonValid)
+{
+	uint8_t leftKey[BSON_FIXED_WIDTH_SORT_KEY_LENGTH];
+	uint8_t rightKey[BSON_FIXED_WIDTH_SORT_KEY_LENGTH];
+
+	int leftLength = WriteFixedWidthBsonSortKey(left, leftKey);
+	if (leftLength == 0)
+	{
+		return false;
+	}
+
+	int rightLength = WriteFixedWidthBsonSortKey(right, rightKey);
+	if (rightLength == 0)
+	{
+		return false;
+	}
+
+	*cmp = CompareBsonSortKeys(leftKey, leftLength, rightKey, rightLength);
+
+	/* Comparing NaN against a number other than NaN is not a valid comparison */
+	bool isLeftNaN = left->value_type == BSON_TYPE_DOUBLE && isnan(left->value.v_double);
+	bool isRightNaN = right->value_type == BSON_TYPE_DOUBLE &&
+					  isnan(right->value.v_double);
+	*isComparisonValid = isLeftNaN == isRightNaN || leftKey[0] != rightKey[0];
+	return true;
+}
+
+
+PG_FUNCTION_INFO_V1(bson_sort_key_compare_for_test);
+
+
+/*
+ * Test function that compares the first values of two documents with
+ * CompareBsonValueAndType and by their sort keys. Returns both results,
+ * whether both sort keys are exact, and the result of comparing the values
+ * by their fixed width sort keys (NULL if they are not of fixed width).
+ */
+Datum
+bson_sort_key_compare_for_test(PG_FUNCTION_ARGS)
+{
+	pgbson *leftDocument = PG_GETARG_PGBSON(0);
+	pgbson *rightDocument = PG_GETARG_PGBSON(1);
+
+	TupleDesc tupleDescriptor;
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	bson_iter_t leftIterator, rightIterator;
+	PgbsonInitIterator(leftDocument, &leftIterator);
+	PgbsonInitIterator(rightDocument, &rightIterator);
+	if (!bson_iter_next(&leftIterator) || !bson_iter_next(&rightIterator))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("both documents must have a field")));
+	}
+
+	const bson_value_t *left = bson_iter_value(&leftIterator);
+	const bson_value_t *right = bson_iter_value(&rightIterator);
+
+	bool isComparisonValid = true;
+	int cmp = CompareBsonValueAndType(left, right, &isComparisonValid);
+
+	StringInfo leftKey = makeStringInfo();
+	StringInfo rightKey = makeStringInfo();
+	bool isExact = AppendBsonValueSortKey(leftKey, left, NULL);
+	isExact = AppendBsonValueSortKey(rightKey, right, NULL) && isExact;
+	int sortKeyCmp = CompareBsonSortKeys((const uint8_t *) leftKey->data, leftKey->len,
+										 (const uint8_t *) rightKey->data, rightKey->len);
+
+	int fixedWidthCmp = 0;
+	bool isFixedWidth = TryCompareBsonValuesBySortKey(left, right, &fixedWidthCmp,
+													  &isComparisonValid);
+
+	Datum values[4];
+	bool nulls[4] = { false, false, false, false };
+	values[0] = Int32GetDatum(cmp > 0 ? 1 : (cmp < 0 ? -1 : 0));
+	values[1] = Int32GetDatum(sortKeyCmp);
+	values[2] = BoolGetDatum(isExact);
+	values[3] = Int32GetDatum(fixedWidthCmp);
+	nulls[3] = !isFixedWidth;
+
+	HeapTuple tuple = heap_form_tuple(tupleDescriptor, values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods */
+/* --------------------------------------------------------- */
+
+/*
+ * The type byte of the values of a type, spread over 0x10 to 0xF1 by
+ * sort order type.
+ */
+static inline uint8_t
+GetSortKeyTypeByte(bson_type_t type)
+{
+	return (uint8_t) (0x10 + 0x0F * GetBsonTypeSortOrder(type));
+}
+
+
+/*
+ * Writes the class, exponent and mantissa of a finite non-zero number.
+ */
+static int
+WriteFiniteNumberSortKey(bool isNegative, int exponent, uint64 mantissa,
+						 uint8_t *buffer)
+{
+	uint16 biasedExponent = (uint16) (exponent + 0x8000);
+	if (isNegative)
+	{
+		buffer[0] = SortKeyNumberClass_Negative;
+		WriteUint16BigEndian(&buffer[1], ~biasedExponent);
+		WriteUint64BigEndian(&buffer[3], ~mantissa);
+	}
+	else
+	{
+		buffer[0] = SortKeyNumberClass_Positive;
+		WriteUint16BigEndian(&buffer[1], biasedExponent);
+		WriteUint64BigEndian(&buffer[3], mantissa);
+	}
+
+	return 11;
+}
+
+
+/*
+ * Writes the sort key of an integer (without the type byte) and returns
+ * its length.
+ */
+static int
+WriteIntegerSortKey(int64 intValue, uint8_t *buffer)
+{
+	if (intValue == 0)
+	{
+		buffer[0] = SortKeyNumberClass_Zero;
+		return 1;
+	}
+
+	bool isNegative = intValue < 0;
+	uint64 absoluteValue = isNegative ? (uint64) (-(intValue + 1)) + 1 :
+						   (uint64) intValue;
+	int highestBit = pg_leftmost_one_pos64(absoluteValue);
+	return WriteFiniteNumberSortKey(isNegative, highestBit + 1,
+									absoluteValue << (63 - highestBit), buffer);
+}
+
+
+/*
+ * Writes the sort key of a double (without the type byte) and returns
+ * its length.
+ */
+static int
+WriteDoubleSortKey(double doubleValue, uint8_t *buffer)
+{
+	if (isnan(doubleValue))
+	{
+		buffer[0] = SortKeyNumberClass_NaN;
+		return 1;
+	}
+	else if (isinf(doubleValue))
+	{
+		buffer[0] = doubleValue < 0 ? SortKeyNumberClass_NegativeInfinity :
+					SortKeyNumberClass_PositiveInfinity;
+		return 1;
+	}
+	else if (doubleValue == 0)
+	{
+		buffer[0] = SortKeyNumberClass_Zero;
+		return 1;
+	}
+
+	/* |value| = fraction * 2^exponent with fraction in [0.5, 1) */
+	int exponent;
+	double fraction = frexp(fabs(doubleValue), &exponent);
+	return WriteFiniteNumberSortKey(doubleValue < 0, exponent,
+									(uint64) ldexp(fraction, 64), buffer);
+}
+
+
+/*
+ * Writes the inexact sort key of a decimal128 (without the type byte) and
+ * returns its length. Finite non-zero values are rounded towards zero, but
+ * never to zero, so that their first bytes order correctly against all
+ * other numbers.
+ */
+static int
+WriteDecimal128SortKey(const bson_value_t *value, uint8_t *buffer)
+{
+	bool isPositiveInfinity = false;
+	if (IsDecimal128NaN(value))
+	{
+		buffer[0] = SortKeyNumberClass_NaN;
+		return 1;
+	}
+	else if (IsDecimal128Infinity(value, &isPositiveInfinity))
+	{
+		buffer[0] = isPositiveInfinity ? SortKeyNumberClass_PositiveInfinity :
+					SortKeyNumberClass_NegativeInfinity;
+		return 1;
+	}
+	else if (IsDecimal128Zero(value))
+	{
+		buffer[0] = SortKeyNumberClass_Zero;
+		return 1;
+	}
+
+	double doubleValue = GetBsonDecimal128AsDoubleTowardZero(value);
+	if (doubleValue == 0)
+	{
+		/* Underflow keeps the sign: use the smallest double of that sign */
+		doubleValue = copysign(DBL_MIN * DBL_EPSILON, doubleValue);
+	}
+
+	return WriteDoubleSortKey(doubleValue, buffer);
+}
+
+
+/*
+ * Appends the sort key of a value without its type byte.
+ */
+static void
+AppendValueBodySortKey(SortKeyWriter *writer, const bson_value_t *value)
+{
+	StringInfo sortKey = writer->sortKey;
+	uint8_t fixedKey[BSON_FIXED_WIDTH_SORT_KEY_LENGTH];
+	int fixedLength = WriteFixedWidthBsonSortKey(value, fixedKey);
+	if (fixedLength > 0)
+	{
+		appendBinaryStringInfo(sortKey, (const char *) &fixedKey[1], fixedLength - 1);
+		return;
+	}
+
+	switch (value->value_type)
+	{
+		case BSON_TYPE_DECIMAL128:
+		{
+			fixedLength = WriteDecimal128SortKey(value, fixedKey);
+			appendBinaryStringInfo(sortKey, (const char *) fixedKey, fixedLength);
+			writer->isExact = false;
+			return;
+		}
+
+		case BSON_TYPE_UTF8:
+		{
+			AppendStringSortKey(writer, value->value.v_utf8.str,
+								value->value.v_utf8.len);
+			return;
+		}
+
+		case BSON_TYPE_SYMBOL:
+		{
+			AppendStringSortKey(writer, value->value.v_symbol.symbol,
+								value->value.v_symbol.len);
+			return;
+		}
+
+		case BSON_TYPE_DOCUMENT:
+		case BSON_TYPE_ARRAY:
+		{
+			bool writeFieldNames = value->value_type == BSON_TYPE_DOCUMENT;
+			AppendDocumentSortKey(writer, value->value.v_doc.data,
+								  value->value.v_doc.data_len, writeFieldNames);
+			return;
+		}
+
+		case BSON_TYPE_BINARY:
+		{
+			uint8_t header[5];
+			WriteUint32BigEndian(header, value->value.v_binary.data_len);
+			header[4] = (uint8_t) value->value.v_binary.subtype;
+			appendBinaryStringInfo(sortKey, (const char *) header, sizeof(header));
+
+			uint32_t dataLength = Min(value->value.v_binary.data_len,
+									  writer->maxLength);
+			appendBinaryStringInfo(sortKey, (const char *) value->value.v_binary.data,
+								   dataLength);
+			return;
+		}
+
+		case BSON_TYPE_REGEX:
+		{
+			const char *regex = value->value.v_regex.regex != NULL ?
+								value->value.v_regex.regex : "";
+			const char *options = value->value.v_regex.options != NULL ?
+								  value->value.v_regex.options : "";
+			AppendEscapedBytes(writer, regex, strlen(regex));
+			AppendEscapedBytes(writer, options, strlen(options));
+			return;
+		}
+
+		case BSON_TYPE_DBPOINTER:
+		{
+			AppendStringSortKey(writer, value->value.v_dbpointer.collection,
+								value->value.v_dbpointer.collection_len);
+			appendBinaryStringInfo(sortKey,
+								   (const char *) value->value.v_dbpointer.oid.bytes,
+								   sizeof(value->value.v_dbpointer.oid));
+			return;
+		}
+
+		case BSON_TYPE_CODE:
+		{
+			AppendStringSortKey(writer, value->value.v_code.code,
+								value->value.v_code.code_len);
+			return;
+		}
+
+		case BSON_TYPE_CODEWSCOPE:
+		{
+			AppendStringSortKey(writer, value->value.v_codewscope.code,
+								value->value.v_codewscope.code_len);
+
+			bool writeFieldNames = true;
+			AppendDocumentSortKey(writer, value->value.v_codewscope.scope_data,
+								  value->value.v_codewscope.scope_len,
+								  writeFieldNames);
+			return;
+		}
+
+		default:
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("invalid bson type - not supported yet")));
+		}
+	}
+}
+
+
+/*
+ * Appends the sort keys of the fields of a document or array followed by
+ * the end of document byte. Fields are compared by type, then name, then
+ * value, so that is the order they are written in.
+ */
+static void
+AppendDocumentSortKey(SortKeyWriter *writer, const uint8_t *data, uint32_t dataLength,
+					  bool writeFieldNames)
+{
+	check_stack_depth();
+
+	bson_iter_t iter;
+	if (!bson_iter_init_from_data(&iter, data, dataLength))
+	{
+		ereport(ERROR, errmsg("Could not initialize nested iterator for document"));
+	}
+
+	while (!IsSortKeyComplete(writer) && bson_iter_next(&iter))
+	{
+		const bson_value_t *fieldValue = bson_iter_value(&iter);
+		appendStringInfoCharMacro(writer->sortKey,
+								  (char) GetSortKeyTypeByte(fieldValue->value_type));
+
+		if (writeFieldNames)
+		{
+			AppendEscapedBytes(writer, bson_iter_key(&iter), bson_iter_key_len(&iter));
+		}
+
+		AppendValueBodySortKey(writer, fieldValue);
+	}
+
+	if (!IsSortKeyComplete(writer))
+	{
+		appendStringInfoCharMacro(writer->sortKey, SORT_KEY_END_OF_DOCUMENT);
+	}
+}
+
+
+/*
+ * Appends the sort key of a string, using the ICU sort key of the string
+ * when there is a collation.
+ */
+static void
+AppendStringSortKey(SortKeyWriter *writer, const char *string, uint32_t length)
+{
+	if (writer->collationString == NULL || length == 0)
+	{
+		AppendEscapedBytes(writer, string, length);
+		return;
+	}
+
+	/*
+	 * ICU sort keys have no 0x00 byte but their terminator, which orders a
+	 * key before the keys it is a prefix of. Equal sort keys are then
+	 * ordered by length.
+	 */
+	char *collationKey = GetCollationSortKey(writer->collationString,
+											 (char *) string, length);
+	appendBinaryStringInfo(writer->sortKey, collationKey, strlen(collationKey) + 1);
+	pfree(collationKey);
+
+	uint8_t lengthBytes[4];
+	WriteUint32BigEndian(lengthBytes, length);
+	appendBinaryStringInfo(writer->sortKey, (const char *) lengthBytes,
+						   sizeof(lengthBytes));
+}
+
+
+/*
+ * Appends bytes with 0x00 escaped as 0x00 0xFF, terminated by 0x00 0x00.
+ * Only a prefix of the bytes is appended when the key does not need more.
+ */
+static void
+AppendEscapedBytes(SortKeyWriter *writer, const char *bytes, uint32_t length)
+{
+	StringInfo sortKey = writer->sortKey;
+	bool isTruncated = length > writer->maxLength;
+	const char *start = bytes;
+	const char *end = bytes + (isTruncated ? writer->maxLength : length);
+	const char *zeroByte;
+
+	while ((zeroByte = memchr(start, 0, end - start)) != NULL)
+	{
+		appendBinaryStringInfo(sortKey, start, zeroByte - start + 1);
+		appendStringInfoCharMacro(sortKey, (char) 0xFF);
+		start = zeroByte + 1;
+	}
+
+	appendBinaryStringInfo(sortKey, start, end - start);
+	if (!isTruncated)
+	{
+		appendStringInfoCharMacro(sortKey, 0);
+		appendStringInfoCharMacro(sortKey, 0);
+	}
+}
+
+
+/*
+ * Whether nothing more needs to be written to the key.
+ */
+static inline bool
+IsSortKeyComplete(SortKeyWriter *writer)
+{
+	return !writer->isExact || (uint32_t) writer->sortKey->len >= writer->maxLength;
+}
+
+
+/*
+ * Packs the first bytes of a sort key into an integer that compares the
+ * same, padding with zeros.
+ */
+static uint64
+GetAbbreviatedSortKey(StringInfo sortKey)
+{
+	uint64 abbreviatedKey = 0;
+	int length = Min(sortKey->len, BSON_ABBREVIATED_SORT_KEY_LENGTH);
+	for (int i = 0; i < BSON_ABBREVIATED_SORT_KEY_LENGTH; i++)
+	{
+		uint8_t keyByte = i < length ? (uint8_t) sortKey->data[i] : 0;
+		abbreviatedKey = (abbreviatedKey << 8) | keyByte;
+	}
+
+	return abbreviatedKey;
+}
+
+
+static inline void
+WriteUint16BigEndian(uint8_t *buffer, uint16 value)
+{
+	buffer[0] = (uint8_t) (value >> 8);
+	buffer[1] = (uint8_t) value;
+}
+
+
+static inline void
+WriteUint32BigEndian(uint8_t *buffer, uint32 value)
+{
+	buffer[0] = (uint8_t) (value >> 24);
+	buffer[1] = (uint8_t) (value >> 16);
+	buffer[2] = (uint8_t) (value >> 8);
+	buffer[3] = (uint8_t) value;
+}
+
+
+static inline void
+WriteUint64BigEndian(uint8_t *buffer, uint64 value)
+{
+	WriteUint32BigEndian(buffer, (uint32) (value >> 32));
+	WriteUint32BigEndian(&buffer[4], (uint32) value);
+}
@@ -0,0 +1,240 @@
+/*-------------------------------------------------------------------------
+ * Copyright (c) Microsoft Corporation.  All rights reserved.
+ *
+ * src/query/bson_sort_support.c
+ *
+ * Implementation of the sort support of bson operator classes.
+ *
+ * Sorts go through the comparator directly rather than the fmgr call of
+ * the btree comparison function. When tuplesort asks for it, the first
+ * sort key is also abbreviated: each document is converted once into the
+ * first BSON_ABBREVIATED_SORT_KEY_LENGTH bytes of its sort key (see
+ * bson_sort_key.c), packed into the Datum. Comparing those is an integer
+ * comparison, and the full comparator only runs when they are equal.
+ *
+ * As for the builtin types, abbreviation is abandoned when the abbreviated
+ * keys turn out to be mostly equal (e.g. documents that share a long
+ * prefix), since every comparison would then pay for both.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <common/hashfn.h>
+
+#include "io/bson_core.h"
+#include "query/bson_compare.h"
+#include "query/bson_sort_key.h"
+#include "query/bson_sort_support.h"
+
+/* --------------------------------------------------------- */
+/* Data-types */
+/* --------------------------------------------------------- */
+
+/* Abbreviation is only reconsidered after this many documents */
+#define ABBREVIATION_ABORT_MIN_INPUT 10000
+
+/* The number of distinct abbreviated keys after which abbreviation is kept */
+#define ABBREVIATION_KEEP_CARDINALITY 100000.0
+
+extern bool EnableBsonAbbreviatedSortKeys;
+
+/* --------------------------------------------------------- */
+/* Forward declaration */
+/* --------------------------------------------------------- */
+
+static int BsonSortSupportCompare(Datum left, Datum right, SortSupport ssup);
+static uint64 GetPgbsonAbbreviatedKey(pgbson *document, BsonSortSupportState *state);
+
+#if SIZEOF_DATUM >= 8
+static Datum BsonAbbreviateConvert(Datum original, SortSupport ssup);
+static int BsonAbbreviatedKeyCompare(Datum left, Datum right, SortSupport ssup);
+static bool BsonAbbreviatedKeyAbort(int memtupcount, SortSupport ssup);
+#endif
+
+PG_FUNCTION_INFO_V1(extension_bson_sortsupport);
+
+
+/* --------------------------------------------------------- */
+/* Top level exports */
+/* --------------------------------------------------------- */
+
+/*
+ * extension_bson_sortsupport is the sort support function of the bson
+ * btree operator class, ordering documents as ComparePgbson.
+ */
+Datum
+extension_bson_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+	SetupBsonSortSupport(ssup, BsonSortSupportCompare, GetPgbsonAbbreviatedKey, NULL);
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * SetupBsonSortSupport sets up a sort of bson documents with the given
+ * comparator. If tuplesort allows abbreviating the sort key and an
+ * abbreviatedKeyFunc is given, comparisons use the abbreviated keys first.
+ * The abbreviated keys must order documents as the comparator does
+ * whenever they are different. The comparator finds context in the
+ * BsonSortSupportState of ssup_extra.
+ */
+void
+SetupBsonSortSupport(SortSupport ssup, SortSupportComparator fullComparator,
+					 BsonAbbreviatedKeyFunc abbreviatedKeyFunc, void *context)
+{
+	ssup->comparator = fullComparator;
+
+	BsonSortSupportState *state = MemoryContextAllocZero(ssup->ssup_cxt,
+														 sizeof(BsonSortSupportState));
+	state->abbreviatedKeyFunc = abbreviatedKeyFunc;
+	state->context = context;
+	state->memoryContext = ssup->ssup_cxt;
+	ssup->ssup_extra = state;
+
+#if SIZEOF_DATUM >= 8
+	if (!ssup->abbreviate || !EnableBsonAbbreviatedSortKeys ||
+		abbreviatedKeyFunc == NULL)
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(ssup->ssup_cxt);
+
+	initStringInfo(&state->sortKeyBuffer);
+	state->isEstimatingCardinality = true;
+	initHyperLogLog(&state->abbreviatedKeyCardinality, 10);
+
+	MemoryContextSwitchTo(oldContext);
+
+	ssup->abbrev_full_comparator = fullComparator;
+	ssup->comparator = BsonAbbreviatedKeyCompare;
+	ssup->abbrev_converter = BsonAbbreviateConvert;
+	ssup->abbrev_abort = BsonAbbreviatedKeyAbort;
+#endif
+}
+
+
+/* --------------------------------------------------------- */
+/* Private helper methods */
+/* --------------------------------------------------------- */
+
+/*
+ * Compares two documents as ComparePgbson without the fmgr overhead.
+ */
+static int
+BsonSortSupportCompare(Datum left, Datum right, SortSupport ssup)
+{
+	pgbson *leftBson = DatumGetPgBsonPacked(left);
+	pgbson *rightBson = DatumGetPgBsonPacked(right);
+
+	int result = ComparePgbson(leftBson, rightBson);
+
+	if ((Pointer) leftBson != DatumGetPointer(left))
+	{
+		pfree(leftBson);
+	}
+
+	if ((Pointer) rightBson != DatumGetPointer(right))
+	{
+		pfree(rightBson);
+	}
+
+	return result;
+}
+
+
+static uint64
+GetPgbsonAbbreviatedKey(pgbson *document, BsonSortSupportState *state)
+{
+	return GetPgbsonAbbreviatedSortKey(document, &state->sortKeyBuffer);
+}
+
+
+#if SIZEOF_DATUM >= 8
+
+/*
+ * Converts a document into its abbreviated key.
+ */
+static Datum
+BsonAbbreviateConvert(Datum original, SortSupport ssup)
+{
+	BsonSortSupportState *state = (BsonSortSupportState *) ssup->ssup_extra;
+	pgbson *document = DatumGetPgBsonPacked(original);
+
+	uint64 abbreviatedKey = state->abbreviatedKeyFunc(document, state);
+
+	if ((Pointer) document != DatumGetPointer(original))
+	{
+		pfree(document);
+	}
+
+	state->inputCount += 1;
+	if (state->isEstimatingCardinality)
+	{
+		uint32 keyHash = (uint32) (abbreviatedKey ^ (abbreviatedKey >> 32));
+		addHyperLogLog(&state->abbreviatedKeyCardinality,
+					   DatumGetUInt32(hash_uint32(keyHash)));
+	}
+
+	return UInt64GetDatum(abbreviatedKey);
+}
+
+
+/*
+ * Compares two abbreviated keys as unsigned integers.
+ */
+static int
+BsonAbbreviatedKeyCompare(Datum left, Datum right, SortSupport ssup)
+{
+	BsonSortSupportState *state = (BsonSortSupportState *) ssup->ssup_extra;
+	if (state->abbreviatedKeysIncomparable)
+	{
+		/* Leave every comparison to the full comparator */
+		return 0;
+	}
+
+	uint64 leftKey = DatumGetUInt64(left);
+	uint64 rightKey = DatumGetUInt64(right);
+	return leftKey > rightKey ? 1 : (leftKey == rightKey ? 0 : -1);
+}
+
+
+/*
+ * Decides whether to stop abbreviating: when the keys can't be compared
+ * or when there are too few distinct keys for abbreviation to pay off.
+ */
+static bool
+BsonAbbreviatedKeyAbort(int memtupcount, SortSupport ssup)
+{
+	BsonSortSupportState *state = (BsonSortSupportState *) ssup->ssup_extra;
+	if (state->abbreviatedKeysIncomparable)
+	{
+		return true;
+	}
+
+	if (memtupcount < ABBREVIATION_ABORT_MIN_INPUT ||
+		state->inputCount < ABBREVIATION_ABORT_MIN_INPUT ||
+		!state->isEstimatingCardinality)
+	{
+		return false;
+	}
+
+	double abbreviatedCardinality = estimateHyperLogLog(
+		&state->abbreviatedKeyCardinality);
+	if (abbreviatedCardinality > ABBREVIATION_KEEP_CARDINALITY)
+	{
+		/* Enough distinct keys to not reconsider */
+		state->isEstimatingCardinality = false;
+		return false;
+	}
+
+	/* Abort when almost all keys are duplicates of each other */
+	return abbreviatedCardinality < state->inputCount / 2000.0 + 0.5;
+}
+
+
+#endif
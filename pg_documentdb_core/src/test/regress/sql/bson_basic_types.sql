@@ -76,4 +76,34 @@ ROLLBACK;
 BEGIN;
 set local documentdb_core.bsonUseEJson TO false;
 SELECT COUNT(1) FROM test WHERE bson_hex_to_bson(bson_out(document)) != document;
-ROLLBACK;
\ No newline at end of file
+ROLLBACK;
+
+-- the two stage JSON parser builds the same bson as libbson, which it leaves extended JSON to
+CREATE TABLE json_parse_input (id int, json text);
+INSERT INTO json_parse_input VALUES (1, '{ "a": 1, "b": -2147483648, "c": 2147483648, "d": -9223372036854775808, "e": 9223372036854775807 }');
+INSERT INTO json_parse_input VALUES (2, '{"a":1.5e3,"b":-0.0,"c":0.1,"d":1E-7}');
+INSERT INTO json_parse_input VALUES (3, '{ "s": "tab\there \"quoted\" \\ \/ é😀", "é": "😀", "": "" }');
+INSERT INTO json_parse_input VALUES (4, '{"a": -0, "b": 12345678901234567890}');
+INSERT INTO json_parse_input VALUES (5, '{"a": [1, [true, false, null], {"b": {"c": []}}, {}], "dup": 1, "dup": 2}');
+INSERT INTO json_parse_input VALUES (6, '{"_id": {"$oid": "5d505646cf6d4fe581014ab2"}, "d": {"$date": 0}, "n": {"$numberLong": "1"}}');
+INSERT INTO json_parse_input VALUES (7, '{"a": "' || repeat('0123456789\"', 20) || '", "b": [' || repeat('1,', 100) || '1]}');
+BEGIN;
+set local documentdb_core.enableFastJsonParser TO false;
+CREATE TABLE json_parse_libbson AS SELECT id, bson_to_bson_hex(bson_json_to_bson(json))::text AS hex FROM json_parse_input;
+set local documentdb_core.enableFastJsonParser TO true;
+SELECT id FROM json_parse_input JOIN json_parse_libbson USING (id)
+    WHERE bson_to_bson_hex(bson_json_to_bson(json))::text != hex OR bson_to_bson_hex(json::bson)::text != hex ORDER BY id;
+ROLLBACK;
+
+-- decimal128 values with 64 bit coefficients compare as they do with the decimal math library
+CREATE TABLE decimal_compare_input (id int, document bson);
+INSERT INTO decimal_compare_input SELECT i, ('{ "a": { "$numberDecimal": "' || v || '" } }')::bson
+    FROM unnest(ARRAY['1.50', '1.5', '-0', '0E+10', '-1.5E-3', '18446744073709551615', '18446744073709551615E+1', '1E+6000', '1.000000000000000000000000000000001', 'NaN', 'Infinity', '-Infinity']) WITH ORDINALITY AS t(v, i);
+BEGIN;
+set local documentdb_core.enableDecimal128FastPath TO false;
+CREATE TABLE decimal_compare_library AS SELECT l.id AS left_id, r.id AS right_id, bson_compare(l.document, r.document) AS cmp
+    FROM decimal_compare_input l, decimal_compare_input r;
+set local documentdb_core.enableDecimal128FastPath TO true;
+SELECT left_id, right_id FROM decimal_compare_library c, decimal_compare_input l, decimal_compare_input r
+    WHERE c.left_id = l.id AND c.right_id = r.id AND sign(c.cmp) != sign(bson_compare(l.document, r.document)) ORDER BY 1, 2;
+ROLLBACK;
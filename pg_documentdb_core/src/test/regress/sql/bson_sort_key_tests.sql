@@ -0,0 +1,36 @@
+SET search_path TO documentdb_core;
+
+CREATE SCHEMA bson_sort_key_test;
+
+CREATE FUNCTION bson_sort_key_test.sort_key_compare(left_value bson, right_value bson,
+    OUT compare int, OUT sort_key_compare int, OUT exact_sort_key bool, OUT fixed_width_compare int)
+LANGUAGE C STRICT AS 'pg_documentdb_core', $$bson_sort_key_compare_for_test$$;
+
+-- memcmp of the sort keys orders values as CompareBsonValueAndType does
+SELECT description, c.*
+FROM (VALUES
+    ('int32 and int64', '{ "": { "$numberInt": "1" } }', '{ "": { "$numberLong": "1" } }'),
+    ('int64 and double', '{ "": { "$numberLong": "1" } }', '{ "": 1.0 }'),
+    ('negative int32 and double', '{ "": { "$numberInt": "-3" } }', '{ "": -2.5 }'),
+    ('int64 past double precision', '{ "": { "$numberLong": "9007199254740993" } }', '{ "": 9007199254740992.0 }'),
+    ('-0.0 and 0.0', '{ "": { "$numberDouble": "-0.0" } }', '{ "": 0.0 }'),
+    ('-0.0 and int32 0', '{ "": { "$numberDouble": "-0.0" } }', '{ "": { "$numberInt": "0" } }'),
+    ('NaN and NaN', '{ "": { "$numberDouble": "NaN" } }', '{ "": { "$numberDouble": "NaN" } }'),
+    ('NaN and -Infinity', '{ "": { "$numberDouble": "NaN" } }', '{ "": { "$numberDouble": "-Infinity" } }'),
+    ('-Infinity and int64 min', '{ "": { "$numberDouble": "-Infinity" } }', '{ "": { "$numberLong": "-9223372036854775808" } }'),
+    ('Infinity and int64 max', '{ "": { "$numberDouble": "Infinity" } }', '{ "": { "$numberLong": "9223372036854775807" } }'),
+    ('date and timestamp', '{ "": { "$date": { "$numberLong": "0" } } }', '{ "": { "$timestamp": { "t": 0, "i": 1 } } }'),
+    ('dates around the epoch', '{ "": { "$date": { "$numberLong": "-1000" } } }', '{ "": { "$date": { "$numberLong": "1000" } } }'),
+    ('timestamps', '{ "": { "$timestamp": { "t": 1, "i": 2 } } }', '{ "": { "$timestamp": { "t": 2, "i": 1 } } }'),
+    ('MinKey and null', '{ "": { "$minKey": 1 } }', '{ "": null }'),
+    ('MaxKey and timestamp', '{ "": { "$maxKey": 1 } }', '{ "": { "$timestamp": { "t": 2, "i": 1 } } }'),
+    ('MaxKey and MaxKey', '{ "": { "$maxKey": 1 } }', '{ "": { "$maxKey": 1 } }')) v(description, left_value, right_value),
+    bson_sort_key_test.sort_key_compare(left_value::bson, right_value::bson) c;
+
+-- decimal128 sort keys are inexact: they order values that differ beyond a double
+-- as equal, so decimal128 values are not compared by sort key but by the full comparison
+SELECT description, c.*
+FROM (VALUES
+    ('decimal128 and int32', '{ "": { "$numberDecimal": "2" } }', '{ "": { "$numberInt": "3" } }'),
+    ('decimal128 past double precision', '{ "": { "$numberDecimal": "1.00000000000000000001" } }', '{ "": 1.0 }')) v(description, left_value, right_value),
+    bson_sort_key_test.sort_key_compare(left_value::bson, right_value::bson) c;
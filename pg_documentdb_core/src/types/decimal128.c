@@ -19,6 +19,7 @@
 #include <bid_conf.h>
 #include <bid_functions.h>
 #include <math.h>
+#include <common/int.h>
 #include <lib/stringinfo.h>
 
 #include "utils/documentdb_errors.h"
@@ -47,6 +48,19 @@
  */
 #define BID128_EXP_BITS_OFFSET 49
 
+/*
+ * Masks of the high 64 bits of a decimal128 with a coefficient of up to 113 bits.
+ * Infinity, NaN and the form with larger coefficients all have the bits of
+ * DECIMAL128_LARGE_FORM_MASK64 set.
+ */
+#define DECIMAL128_SIGN_MASK64 0x8000000000000000ull
+#define DECIMAL128_LARGE_FORM_MASK64 0x6000000000000000ull
+#define DECIMAL128_EXPONENT_MASK 0x3FFFull
+#define DECIMAL128_HIGH_COEFFICIENT_MASK64 0x0001FFFFFFFFFFFFull
+
+/* The number of powers of ten that fit in a uint64, 10^0 to 10^19 */
+#define UINT64_POWERS_OF_TEN_COUNT 20
+
 /* rounding modes can be separately defined while doing any mathematical operations on decimal128 */
 /* For more info: https://en.wikipedia.org/wiki/Floating-point_arithmetic#Rounding_modes */
 typedef enum Decimal128RoundingMode
@@ -106,11 +120,51 @@ typedef enum Decimal128MathOperation
 
 typedef unsigned int _IDEC_flags;
 
+/*
+ * A finite decimal128 whose coefficient fits in 64 bits. Most decimals
+ * (e.g. currency amounts) are of this form, and are added and compared
+ * with integer arithmetic instead of the Intel library.
+ */
+typedef struct Decimal128Parts
+{
+	bool isNegative;
+
+	/* The biased exponent */
+	int32 exponent;
+
+	uint64 coefficient;
+} Decimal128Parts;
+
+static const uint64 Uint64PowersOfTen[UINT64_POWERS_OF_TEN_COUNT] = {
+	UINT64CONST(1),
+	UINT64CONST(10),
+	UINT64CONST(100),
+	UINT64CONST(1000),
+	UINT64CONST(10000),
+	UINT64CONST(100000),
+	UINT64CONST(1000000),
+	UINT64CONST(10000000),
+	UINT64CONST(100000000),
+	UINT64CONST(1000000000),
+	UINT64CONST(10000000000),
+	UINT64CONST(100000000000),
+	UINT64CONST(1000000000000),
+	UINT64CONST(10000000000000),
+	UINT64CONST(100000000000000),
+	UINT64CONST(1000000000000000),
+	UINT64CONST(10000000000000000),
+	UINT64CONST(100000000000000000),
+	UINT64CONST(1000000000000000000),
+	UINT64CONST(10000000000000000000)
+};
+
 #define HIGH_BITS(x) (x->value.v_decimal128.high)
 #define LOW_BITS(x) (x->value.v_decimal128.low)
 
 #define ALL_EXCEPTION_FLAG_CLEAR 0
 
+extern bool EnableDecimal128FastPath;
+
 
 /* ============================ */
 /* Exception Flag Helper Macros */
@@ -157,6 +211,16 @@ static Decimal128Result Decimal128MathematicalOperation1Operand(const bson_value
 																bson_value_t *result,
 																Decimal128MathOperation
 																operation);
+static inline bool TryGetDecimal128Parts(const bson_value_t *value,
+										 Decimal128Parts *parts);
+static inline void SetDecimal128FromParts(const Decimal128Parts *parts,
+										  bson_value_t *result);
+static inline bool TryScaleDecimal128Coefficient(uint64 *coefficient,
+												 int32 exponentDifference);
+static bool TryAddDecimal128Parts(const Decimal128Parts *x, const Decimal128Parts *y,
+								  Decimal128Parts *result);
+static int CompareDecimal128Parts(const Decimal128Parts *left,
+								  const Decimal128Parts *right);
 static bson_decimal128_t GetBsonValueAsDecimal128Core(const bson_value_t *value,
 													  bool shouldQuantized);
 
@@ -321,6 +385,22 @@ GetBsonDecimal128AsDoubleQuiet(const bson_value_t *value)
 }
 
 
+/*
+ * Get the decimal 128 value as the nearest double that is not larger in
+ * magnitude. Finite values that overflow the double range return the
+ * largest finite double; inexact conversions are not logged.
+ */
+double
+GetBsonDecimal128AsDoubleTowardZero(const bson_value_t *value)
+{
+	BID_UINT128 bidValue = GetBIDUINT128FromBsonValue(value);
+
+	_IDEC_flags exceptionFlags = ALL_EXCEPTION_FLAG_CLEAR;
+	return bid128_to_binary64(bidValue, Decimal128RoundingMode_TowardZero,
+							  &exceptionFlags);
+}
+
+
 /*
  * Get the decimal 128 value as long double.
  *
@@ -631,6 +711,16 @@ int
 CompareBsonDecimal128(const bson_value_t *left, const bson_value_t *right,
 					  bool *isComparisonValid)
 {
+	Decimal128Parts leftParts;
+	Decimal128Parts rightParts;
+	if (EnableDecimal128FastPath &&
+		TryGetDecimal128Parts(left, &leftParts) &&
+		TryGetDecimal128Parts(right, &rightParts))
+	{
+		*isComparisonValid = true;
+		return CompareDecimal128Parts(&leftParts, &rightParts);
+	}
+
 	_IDEC_flags my_fpsf = ALL_EXCEPTION_FLAG_CLEAR;
 
 	BID_UINT128 leftBid = GetBIDUINT128FromBsonValue(left);
@@ -821,6 +911,18 @@ MultiplyDecimal128Numbers(const bson_value_t *x, const bson_value_t *y,
 Decimal128Result
 AddDecimal128Numbers(const bson_value_t *x, const bson_value_t *y, bson_value_t *result)
 {
+	Decimal128Parts xParts;
+	Decimal128Parts yParts;
+	Decimal128Parts resultParts;
+	if (EnableDecimal128FastPath &&
+		TryGetDecimal128Parts(x, &xParts) &&
+		TryGetDecimal128Parts(y, &yParts) &&
+		TryAddDecimal128Parts(&xParts, &yParts, &resultParts))
+	{
+		SetDecimal128FromParts(&resultParts, result);
+		return Decimal128Result_Success;
+	}
+
 	return Decimal128MathematicalOperation2Operands(x, y, result,
 													Decimal128MathOperation_Add);
 }
@@ -838,6 +940,21 @@ Decimal128Result
 SubtractDecimal128Numbers(const bson_value_t *x, const bson_value_t *y,
 						  bson_value_t *result)
 {
+	Decimal128Parts xParts;
+	Decimal128Parts yParts;
+	Decimal128Parts resultParts;
+	if (EnableDecimal128FastPath &&
+		TryGetDecimal128Parts(x, &xParts) &&
+		TryGetDecimal128Parts(y, &yParts))
+	{
+		yParts.isNegative = !yParts.isNegative;
+		if (TryAddDecimal128Parts(&xParts, &yParts, &resultParts))
+		{
+			SetDecimal128FromParts(&resultParts, result);
+			return Decimal128Result_Success;
+		}
+	}
+
 	return Decimal128MathematicalOperation2Operands(x, y, result,
 													Decimal128MathOperation_Subtract);
 }
@@ -1593,6 +1710,157 @@ Decimal128ToInt64Floor(const bson_value_t *value, bool *isOverFlow)
 }
 
 
+/*
+ * Gets the sign, exponent and coefficient of a decimal128 value if it is
+ * finite and its coefficient fits in 64 bits.
+ */
+static inline bool
+TryGetDecimal128Parts(const bson_value_t *value, Decimal128Parts *parts)
+{
+	if (value->value_type != BSON_TYPE_DECIMAL128)
+	{
+		return false;
+	}
+
+	uint64 high = HIGH_BITS(value);
+	if ((high & DECIMAL128_LARGE_FORM_MASK64) == DECIMAL128_LARGE_FORM_MASK64 ||
+		(high & DECIMAL128_HIGH_COEFFICIENT_MASK64) != 0)
+	{
+		return false;
+	}
+
+	parts->isNegative = (high & DECIMAL128_SIGN_MASK64) != 0;
+	parts->exponent = (int32) ((high >> BID128_EXP_BITS_OFFSET) &
+							   DECIMAL128_EXPONENT_MASK);
+	parts->coefficient = LOW_BITS(value);
+	return true;
+}
+
+
+/*
+ * Sets result to the decimal128 of the given parts.
+ */
+static inline void
+SetDecimal128FromParts(const Decimal128Parts *parts, bson_value_t *result)
+{
+	result->value_type = BSON_TYPE_DECIMAL128;
+	HIGH_BITS(result) = (parts->isNegative ? DECIMAL128_SIGN_MASK64 : 0) |
+						((uint64) parts->exponent << BID128_EXP_BITS_OFFSET);
+	LOW_BITS(result) = parts->coefficient;
+}
+
+
+/*
+ * Multiplies the coefficient by 10^exponentDifference, returns false if the
+ * result doesn't fit in 64 bits.
+ */
+static inline bool
+TryScaleDecimal128Coefficient(uint64 *coefficient, int32 exponentDifference)
+{
+	if (*coefficient == 0 || exponentDifference == 0)
+	{
+		return true;
+	}
+
+	if (exponentDifference >= UINT64_POWERS_OF_TEN_COUNT)
+	{
+		return false;
+	}
+
+	return !pg_mul_u64_overflow(*coefficient, Uint64PowersOfTen[exponentDifference],
+								coefficient);
+}
+
+
+/*
+ * Adds two decimals with integer arithmetic. The sum is exact, so it is
+ * the same as bid128_add: the coefficients are aligned on the smaller
+ * exponent, which is the exponent IEEE 754 prefers for exact sums. Returns
+ * false if the coefficients don't fit in 64 bits once aligned and summed.
+ */
+static bool
+TryAddDecimal128Parts(const Decimal128Parts *x, const Decimal128Parts *y,
+					  Decimal128Parts *result)
+{
+	int32 exponent = Min(x->exponent, y->exponent);
+	uint64 xCoefficient = x->coefficient;
+	uint64 yCoefficient = y->coefficient;
+	if (!TryScaleDecimal128Coefficient(&xCoefficient, x->exponent - exponent) ||
+		!TryScaleDecimal128Coefficient(&yCoefficient, y->exponent - exponent))
+	{
+		return false;
+	}
+
+	result->exponent = exponent;
+	if (x->isNegative == y->isNegative)
+	{
+		if (pg_add_u64_overflow(xCoefficient, yCoefficient, &result->coefficient))
+		{
+			return false;
+		}
+
+		result->isNegative = x->isNegative;
+	}
+	else if (xCoefficient >= yCoefficient)
+	{
+		/* An exact zero sum of operands of opposite signs is +0 when rounding to nearest */
+		result->coefficient = xCoefficient - yCoefficient;
+		result->isNegative = result->coefficient != 0 && x->isNegative;
+	}
+	else
+	{
+		result->coefficient = yCoefficient - xCoefficient;
+		result->isNegative = y->isNegative;
+	}
+
+	return true;
+}
+
+
+/*
+ * Compares two decimals as CompareBsonDecimal128. A coefficient that no
+ * longer fits in 64 bits when aligned on the other exponent is larger than
+ * the other coefficient.
+ */
+static int
+CompareDecimal128Parts(const Decimal128Parts *left, const Decimal128Parts *right)
+{
+	int leftSign = left->coefficient == 0 ? 0 : (left->isNegative ? -1 : 1);
+	int rightSign = right->coefficient == 0 ? 0 : (right->isNegative ? -1 : 1);
+	if (leftSign != rightSign)
+	{
+		return leftSign < rightSign ? -1 : 1;
+	}
+	else if (leftSign == 0)
+	{
+		return 0;
+	}
+
+	int magnitudeCompare;
+	uint64 leftCoefficient = left->coefficient;
+	uint64 rightCoefficient = right->coefficient;
+	if (left->exponent > right->exponent &&
+		!TryScaleDecimal128Coefficient(&leftCoefficient,
+									   left->exponent - right->exponent))
+	{
+		magnitudeCompare = 1;
+	}
+	else if (right->exponent > left->exponent &&
+			 !TryScaleDecimal128Coefficient(&rightCoefficient,
+											right->exponent - left->exponent))
+	{
+		magnitudeCompare = -1;
+	}
+	else
+	{
+		magnitudeCompare = leftCoefficient < rightCoefficient ? -1 :
+						   leftCoefficient > rightCoefficient ? 1 : 0;
+	}
+
+	return leftSign < 0 ? -magnitudeCompare : magnitudeCompare;
+}
+
+
 /* Get the bson_decimal_128 representation value from 64 bit integer */
 bson_decimal128_t
 GetDecimal128FromInt64(int64_t value)
@@ -17,8 +17,14 @@
 
 #include <pcre2.h>
 #include <postgres.h>
+#include <access/xact.h>
 #include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <common/hashfn.h>
+#include <lib/ilist.h>
 #include <lib/stringinfo.h>
+#include <mb/pg_wchar.h>
 #include "io/bson_core.h"
 #include "utils/documentdb_errors.h"
 #include "types/pcre_regex.h"
@@ -43,8 +49,63 @@ typedef struct PcreData
 
 	/* stack for use by the code compiled by the JIT compiler */
 	pcre2_jit_stack *jitStack;
+
+	/* Whether the contexts and compiledRegex belong to the regex cache */
+	bool isCached;
+
+	/* How the pattern is matched without PCRE2 when it is a literal */
+	RegexLiteralKind literalKind;
+
+	/* The literal of a pattern matched as a literal */
+	StringView literal;
+
+	/* The literal prefix of all the strings an anchored pattern matches */
+	StringView literalPrefix;
 } PcreData;
 
+/* The key of a compiled regex in the regex cache */
+typedef struct RegexCacheKey
+{
+	const char *pattern;
+	uint32_t patternLength;
+	uint32_t compileOptions;
+} RegexCacheKey;
+
+/* A compiled regex in the regex cache */
+typedef struct RegexCacheEntry
+{
+	/* key for hash entry; must be the first field */
+	RegexCacheKey key;
+
+	/* The compiled regex, without match data */
+	PcreData *pcreData;
+
+	/* Position in the least recently used list */
+	dlist_node lruNode;
+} RegexCacheEntry;
+
+/* A regex evicted from the regex cache, freed at the end of the transaction */
+typedef struct EvictedRegex
+{
+	dlist_node node;
+	PcreData *pcreData;
+} EvictedRegex;
+
+/*
+ * Compiled (and JIT compiled) regexes of the backend, keyed by pattern
+ * and compile options. Queries running the same regex reuse the compiled
+ * code instead of compiling it again. The least recently used regex is
+ * evicted past RegexCacheSize entries. Query states of the transaction
+ * may still use an evicted regex, so it is only freed when the
+ * transaction ends.
+ */
+static HTAB *RegexCache = NULL;
+static MemoryContext RegexCacheContext = NULL;
+static dlist_head RegexCacheLruList = DLIST_STATIC_INIT(RegexCacheLruList);
+static dlist_head EvictedRegexList = DLIST_STATIC_INIT(EvictedRegexList);
+
+extern int RegexCacheSize;
+
 /* --------------------------------------------------------- */
 /* Forward declaration */
 /* --------------------------------------------------------- */
@@ -56,6 +117,16 @@ static inline void InvalidRegexError(int errorCode, const char *errorMessage, in
 static bool RegexCompileCore(char *regexPatternStr, char *options, PcreData **pcreData,
 							 int *pcreErrorCode, int maxPatternLength,
 							 uint32_t compileOptions);
+static PcreData * GetCachedRegex(char *regexPatternStr, char *options);
+static PcreData * CompileRegexForCache(char *regexPatternStr, uint32_t compileOptions);
+static void EvictRegexCacheEntries(int maxEntries);
+static void FreeEvictedRegexes(XactEvent event, void *arg);
+static void FreeCachedPcreData(PcreData *pcreData);
+static uint32 RegexCacheKeyHashFunc(const void *obj, size_t objsize);
+static int RegexCacheKeyCompareFunc(const void *obj1, const void *obj2, Size objsize);
+static void ExtractRegexLiterals(const char *pattern, uint32_t compileOptions,
+								 PcreData *pcreData);
+static bool LiteralRegexMatch(PcreData *pcreData, const StringView *subjectString);
 void * extension_pcre_malloc(PCRE2_SIZE size, void *ignore);
 void extension_pcre_free(void *memPtr, void *ignore);
 
@@ -90,6 +161,13 @@ extension_pcre_free(void *memPtr, void *ignore)
 void
 RegexCompileDuringPlanning(char *regexPatternStr, char *options)
 {
+	if (RegexCacheSize > 0)
+	{
+		/* The regex is then already compiled when the query runs */
+		GetCachedRegex(regexPatternStr, options);
+		return;
+	}
+
 	PcreData *pcreData = palloc0(sizeof(PcreData));
 	int pcreErrorCode = 0;
 
@@ -109,6 +187,17 @@ RegexCompileDuringPlanning(char *regexPatternStr, char *options)
 PcreData *
 RegexCompile(char *regexPatternStr, char *options)
 {
+	if (RegexCacheSize > 0)
+	{
+		/* The compiled regex is shared, the match data is for the caller */
+		PcreData *cachedData = GetCachedRegex(regexPatternStr, options);
+		PcreData *pcreData = palloc(sizeof(PcreData));
+		*pcreData = *cachedData;
+		pcreData->matchData =
+			pcre2_match_data_create_from_pattern(pcreData->compiledRegex, NULL);
+		return pcreData;
+	}
+
 	PcreData *pcreData = palloc0(sizeof(PcreData));
 	int pcreErrorCode = 0;
 
@@ -120,6 +209,10 @@ RegexCompile(char *regexPatternStr, char *options)
 						  pcreErrorCode, pcreData);
 	}
 
+	ExtractRegexLiterals(regexPatternStr,
+						 PCRE2_NO_AUTO_CAPTURE | ProcessRegexCompileOptions(options),
+						 pcreData);
+
 	/* Creates a new matchData block to hold the result of a match */
 	pcreData->matchData =
 		pcre2_match_data_create_from_pattern(pcreData->compiledRegex, NULL);
@@ -127,6 +220,18 @@ RegexCompile(char *regexPatternStr, char *options)
 }
 
 
+/*
+ * Returns the literal prefix of all the strings matched by a regex
+ * compiled by RegexCompile, or an empty view if the regex isn't anchored
+ * to a literal.
+ */
+StringView
+GetRegexLiteralPrefix(PcreData *pcreData)
+{
+	return pcreData->literalPrefix;
+}
+
+
 /* Top level function to call RegexCompileCore for aggregation opeartors */
 PcreData *
 RegexCompileForAggregation(char *regexPatternStr, char *options, bool enableNoAutoCapture,
@@ -228,6 +333,11 @@ PcreRegexExecute(char *regexPatternStr, char *options,
 
 	Assert(pcreData != NULL);
 
+	if (pcreData->literalKind != RegexLiteralKind_None)
+	{
+		return LiteralRegexMatch(pcreData, subjectString);
+	}
+
 	/* Now run the match. */
 	int returnCode = pcre2_match(pcreData->compiledRegex,
 								 (PCRE2_SPTR) subjectString->string,
@@ -382,6 +492,13 @@ FreePcreData(PcreData *pcreData)
 		return;
 	}
 
+	if (pcreData->isCached)
+	{
+		/* Only the match data belongs to the caller */
+		pcre2_match_data_free(pcreData->matchData);
+		return;
+	}
+
 	/* below all functions : If the argument is NULL, the function returns immediately without doing anything. */
 	pcre2_compile_context_free(pcreData->compileContext);
 	pcre2_general_context_free(pcreData->generalContext);
@@ -432,3 +549,353 @@ InvalidRegexError(int errorCode, const char *errorMessage, int pcreErrorCode,
 					errdetail_log("PCRE returned invalid regex: error code %d",
 								  pcreErrorCode)));
 }
+
+
+/*
+ * Returns the compiled regex of a pattern and options from the regex cache,
+ * compiling it on a miss.
+ */
+static PcreData *
+GetCachedRegex(char *regexPatternStr, char *options)
+{
+	if (RegexCache == NULL)
+	{
+		RegexCacheContext = AllocSetContextCreate(TopMemoryContext,
+												  "Regex cache context",
+												  ALLOCSET_DEFAULT_SIZES);
+
+		HASHCTL hashInfo;
+		memset(&hashInfo, 0, sizeof(HASHCTL));
+		hashInfo.keysize = sizeof(RegexCacheKey);
+		hashInfo.entrysize = sizeof(RegexCacheEntry);
+		hashInfo.hash = RegexCacheKeyHashFunc;
+		hashInfo.match = RegexCacheKeyCompareFunc;
+		hashInfo.hcxt = RegexCacheContext;
+		RegexCache = hash_create("Regex cache", 64, &hashInfo,
+								 HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+								 HASH_CONTEXT);
+
+		RegisterXactCallback(FreeEvictedRegexes, NULL);
+	}
+
+	RegexCacheKey key =
+	{
+		.pattern = regexPatternStr,
+		.patternLength = strlen(regexPatternStr),
+		.compileOptions = PCRE2_NO_AUTO_CAPTURE | ProcessRegexCompileOptions(options)
+	};
+
+	RegexCacheEntry *entry = hash_search(RegexCache, &key, HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		dlist_move_head(&RegexCacheLruList, &entry->lruNode);
+		return entry->pcreData;
+	}
+
+	/* Compile before inserting the entry, so invalid regexes aren't cached */
+	PcreData *pcreData = CompileRegexForCache(regexPatternStr, key.compileOptions);
+
+	EvictRegexCacheEntries(RegexCacheSize - 1);
+
+	bool found;
+	entry = hash_search(RegexCache, &key, HASH_ENTER, &found);
+	entry->key.pattern = MemoryContextStrdup(RegexCacheContext, regexPatternStr);
+	entry->pcreData = pcreData;
+	dlist_push_head(&RegexCacheLruList, &entry->lruNode);
+	return pcreData;
+}
+
+
+/*
+ * Compiles a regex in the memory context of the regex cache.
+ */
+static PcreData *
+CompileRegexForCache(char *regexPatternStr, uint32_t compileOptions)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(RegexCacheContext);
+
+	PcreData *pcreData = palloc0(sizeof(PcreData));
+	int pcreErrorCode = 0;
+
+	/* The options are already processed into compileOptions */
+	if (!RegexCompileCore(regexPatternStr, NULL, &pcreData, &pcreErrorCode,
+						  REGEX_MAX_PATTERN_LENGTH, compileOptions))
+	{
+		/* The contexts are freed with the error, the rest must not stay in the cache */
+		MemoryContextSwitchTo(oldContext);
+		PcreData *invalidData = palloc(sizeof(PcreData));
+		*invalidData = *pcreData;
+		pfree(pcreData);
+		InvalidRegexError(ERRCODE_DOCUMENTDB_LOCATION51091,
+						  "Regular expression is invalid",
+						  pcreErrorCode, invalidData);
+	}
+
+	ExtractRegexLiterals(regexPatternStr, compileOptions, pcreData);
+	pcreData->isCached = true;
+
+	MemoryContextSwitchTo(oldContext);
+	return pcreData;
+}
+
+
+/*
+ * Evicts the least recently used regexes of the cache until it holds at
+ * most maxEntries regexes.
+ */
+static void
+EvictRegexCacheEntries(int maxEntries)
+{
+	while (!dlist_is_empty(&RegexCacheLruList) &&
+		   hash_get_num_entries(RegexCache) > Max(maxEntries, 0))
+	{
+		RegexCacheEntry *entry = dlist_container(RegexCacheEntry, lruNode,
+												 dlist_tail_node(&RegexCacheLruList));
+		dlist_delete(&entry->lruNode);
+
+		EvictedRegex *evictedRegex = MemoryContextAlloc(RegexCacheContext,
+														sizeof(EvictedRegex));
+		evictedRegex->pcreData = entry->pcreData;
+		dlist_push_tail(&EvictedRegexList, &evictedRegex->node);
+
+		char *pattern = (char *) entry->key.pattern;
+		hash_search(RegexCache, &entry->key, HASH_REMOVE, NULL);
+		pfree(pattern);
+	}
+}
+
+
+/*
+ * Transaction callback freeing the regexes evicted during the transaction,
+ * once no query state can use them anymore.
+ */
+static void
+FreeEvictedRegexes(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		{
+			dlist_mutable_iter iter;
+			dlist_foreach_modify(iter, &EvictedRegexList)
+			{
+				EvictedRegex *evictedRegex = dlist_container(EvictedRegex, node,
+															 iter.cur);
+				dlist_delete(iter.cur);
+				FreeCachedPcreData(evictedRegex->pcreData);
+				pfree(evictedRegex);
+			}
+
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * Frees a compiled regex of the regex cache.
+ */
+static void
+FreeCachedPcreData(PcreData *pcreData)
+{
+	pcreData->isCached = false;
+	FreePcreData(pcreData);
+
+	/* The literal and the prefix share the buffer */
+	const char *literalBuffer = pcreData->literal.string != NULL ?
+								pcreData->literal.string :
+								pcreData->literalPrefix.string;
+	if (literalBuffer != NULL)
+	{
+		pfree((char *) literalBuffer);
+	}
+
+	pfree(pcreData);
+}
+
+
+/*
+ * RegexCacheKeyHashFunc is the (HASHCTL.hash) callback of the regex cache.
+ */
+static uint32
+RegexCacheKeyHashFunc(const void *obj, size_t objsize)
+{
+	const RegexCacheKey *key = obj;
+	return hash_combine(hash_bytes((const unsigned char *) key->pattern,
+								   key->patternLength),
+						hash_uint32(key->compileOptions));
+}
+
+
+/*
+ * RegexCacheKeyCompareFunc is the (HASHCTL.match) callback of the regex cache.
+ * Returns 0 if the keys are the same, 1 otherwise.
+ */
+static int
+RegexCacheKeyCompareFunc(const void *obj1, const void *obj2, Size objsize)
+{
+	const RegexCacheKey *left = obj1;
+	const RegexCacheKey *right = obj2;
+
+	if (left->compileOptions != right->compileOptions ||
+		left->patternLength != right->patternLength)
+	{
+		return 1;
+	}
+
+	return memcmp(left->pattern, right->pattern, left->patternLength) == 0 ? 0 : 1;
+}
+
+
+/*
+ * Finds the literals of a compiled pattern. A pattern that is only literal
+ * characters, optionally anchored at the start of the subject, is matched
+ * by a substring search instead of PCRE2. An anchored pattern starting with
+ * literal characters has a literal prefix that all its matches start with,
+ * which lets indexes scan only the strings with that prefix.
+ *
+ * This is conservative: patterns with case insensitive or extended options,
+ * alternations, and escapes other than of punctuation have no literals.
+ */
+static void
+ExtractRegexLiterals(const char *pattern, uint32_t compileOptions, PcreData *pcreData)
+{
+	pcreData->literalKind = RegexLiteralKind_None;
+	pcreData->literalPrefix.string = NULL;
+	pcreData->literalPrefix.length = 0;
+
+	if ((compileOptions & (PCRE2_CASELESS | PCRE2_EXTENDED)) != 0)
+	{
+		return;
+	}
+
+	const char *cursor = pattern;
+	bool isAnchored = false;
+	if (cursor[0] == '^' && (compileOptions & PCRE2_MULTILINE) == 0)
+	{
+		isAnchored = true;
+		cursor++;
+	}
+	else if (cursor[0] == '\\' && cursor[1] == 'A')
+	{
+		isAnchored = true;
+		cursor += 2;
+	}
+
+	StringInfoData literal;
+	initStringInfo(&literal);
+
+	bool isLiteral = true;
+	while (*cursor != '\0')
+	{
+		const char *character = cursor;
+		int characterLength;
+		if (*cursor == '\\')
+		{
+			/* Only escaped punctuation is a literal character */
+			if (cursor[1] == '\0' || IS_HIGHBIT_SET(cursor[1]) ||
+				isalnum((unsigned char) cursor[1]))
+			{
+				isLiteral = false;
+				break;
+			}
+
+			character = cursor + 1;
+			characterLength = 1;
+			cursor += 2;
+		}
+		else if (strchr("^$.|?*+()[]{}", *cursor) != NULL)
+		{
+			isLiteral = false;
+			break;
+		}
+		else
+		{
+			/* The pattern compiled as UTF-8, so the character is complete */
+			characterLength = pg_utf_mblen((const unsigned char *) cursor);
+			cursor += characterLength;
+		}
+
+		if (*cursor == '?' || *cursor == '*' || *cursor == '+' || *cursor == '{')
+		{
+			/* The character is quantified, so it isn't required */
+			isLiteral = false;
+			break;
+		}
+
+		appendBinaryStringInfo(&literal, character, characterLength);
+	}
+
+	if (isLiteral)
+	{
+		pcreData->literalKind = isAnchored ? RegexLiteralKind_Prefix :
+								RegexLiteralKind_Substring;
+		pcreData->literal.string = literal.data;
+		pcreData->literal.length = literal.len;
+	}
+
+	/* An alternation later in the pattern may not need the prefix */
+	if (isAnchored && literal.len > 0 && strchr(cursor, '|') == NULL)
+	{
+		pcreData->literalPrefix.string = literal.data;
+		pcreData->literalPrefix.length = literal.len;
+	}
+	else if (!isLiteral)
+	{
+		pfree(literal.data);
+	}
+}
+
+
+/*
+ * Matches a subject against a pattern that is a literal. The first byte of
+ * the literal is searched by memchr, which compares many bytes at once.
+ */
+static bool
+LiteralRegexMatch(PcreData *pcreData, const StringView *subjectString)
+{
+	const StringView *literal = &pcreData->literal;
+	if (literal->length == 0)
+	{
+		return true;
+	}
+
+	if (subjectString->length < literal->length)
+	{
+		return false;
+	}
+
+	if (pcreData->literalKind == RegexLiteralKind_Prefix)
+	{
+		return memcmp(subjectString->string, literal->string, literal->length) == 0;
+	}
+
+	const char *current = subjectString->string;
+	const char *lastStart = subjectString->string + subjectString->length -
+							literal->length;
+	while (current <= lastStart)
+	{
+		current = memchr(current, literal->string[0], lastStart - current + 1);
+		if (current == NULL)
+		{
+			return false;
+		}
+
+		if (memcmp(current + 1, literal->string + 1, literal->length - 1) == 0)
+		{
+			return true;
+		}
+
+		current++;
+	}
+
+	return false;
+}
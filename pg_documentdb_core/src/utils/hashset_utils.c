@@ -110,6 +110,24 @@ CreateStringViewHashSet()
 }
 
 
+/*
+ * CreateStringViewHashMap creates a hash table keyed by StringView, whose
+ * entries have StringView as their first field followed by values.
+ */
+HTAB *
+CreateStringViewHashMap(Size entrySize)
+{
+	Assert(entrySize >= sizeof(StringView));
+	HASHCTL hashInfo = CreateExtensionHashCTL(
+		sizeof(StringView),
+		entrySize,
+		StringViewHashEntryCompareFunc,
+		StringViewHashEntryHashFunc
+		);
+	return hash_create("StringView Hash Map", 32, &hashInfo, DefaultExtensionHashFlags);
+}
+
+
 /*
  * StringViewHashEntryHashFunc is the (HASHCTL.hash) callback used to hash a StringView
  */
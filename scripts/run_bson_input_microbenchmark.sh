@@ -0,0 +1,95 @@
+#!/bin/bash
+
+# exit immediately if a command exits with a non-zero status
+set -e
+# fail if trying to reference a variable that is not set.
+set -u
+
+# Compares the two stage JSON parser and the single pass bson validation
+# with the libbson paths they fall back to, by toggling their GUCs.
+coordinatorPort="9712"
+documentCount="100000"
+repetitions="3"
+help="false"
+while getopts "p:n:r:h" opt; do
+  case $opt in
+    p) coordinatorPort="$OPTARG"
+    ;;
+    n) documentCount="$OPTARG"
+    ;;
+    r) repetitions="$OPTARG"
+    ;;
+    h) help="true"
+    ;;
+  esac
+
+  # Assume empty string if it's unset since we cannot reference to
+  # an unset variabled due to "set -u".
+  case ${OPTARG:-""} in
+    -*) echo "Option $opt needs a valid argument. use -h to get help."
+    exit 1
+    ;;
+  esac
+done
+
+if [ "$help" == "true" ]; then
+    echo "runs a microbenchmark of bson input against a running server with the extension installed."
+    echo "run_bson_input_microbenchmark [-p <port>] [-n <documentCount>] [-r <repetitions>]"
+    echo "[-p <port>] - optional argument. specifies the port of the server, defaults to $coordinatorPort"
+    echo "[-n <documentCount>] - optional argument. the number of documents parsed and inserted, defaults to $documentCount"
+    echo "[-r <repetitions>] - optional argument. the number of times each case is timed, defaults to $repetitions"
+    exit 1;
+fi
+
+function RunPsql()
+{
+  psql -X -q -p $coordinatorPort -d postgres -v ON_ERROR_STOP=1 "$@"
+}
+
+# The input: small flat documents, documents with long strings and nested documents.
+RunPsql <<EOF
+DROP TABLE IF EXISTS bson_input_benchmark;
+CREATE TABLE bson_input_benchmark AS
+SELECT i AS id, format('{ "_id": %s, "name": "user %s", "score": %s.5, "active": %s, "tags": ["a", "b", "c"] }',
+                       i, i, i % 1000, (i % 2 = 0)) AS flat,
+       format('{ "_id": %s, "text": "%s", "unicode": "%s" }',
+              i, repeat(md5(i::text), 32), repeat('é😀', 64)) AS strings,
+       format('{ "_id": %s, "a": { "b": { "c": [ { "d": %s, "e": [1, 2, 3, { "f": null }] }, { "g": "h" } ] } }, "x": [[1.5, -2], [true, false]] }',
+              i, i) AS nested
+FROM generate_series(1, $documentCount) i;
+EOF
+
+function TimeParse()
+{
+  local column=$1
+  local fastParser=$2
+  echo "JSON parsing of $column documents, documentdb_core.enableFastJsonParser = $fastParser"
+  for ((i = 0; i < $repetitions; i++)); do
+    RunPsql -c "SET documentdb_core.enableFastJsonParser TO $fastParser" \
+      -c "\\timing on" \
+      -c "SELECT COUNT(documentdb_core.bson_json_to_bson($column)) FROM bson_input_benchmark" | grep "Time:"
+  done
+}
+
+for column in flat strings nested; do
+  TimeParse $column false
+  TimeParse $column true
+done
+
+# Input bson is validated on inserts, when the documentdb extension is installed.
+hasDocumentDB=$(RunPsql -t -A -c "SELECT COUNT(*) FROM pg_extension WHERE extname = 'documentdb'")
+if [ "$hasDocumentDB" == "1" ]; then
+  for fastValidation in false true; do
+    echo "Inserts of nested documents, documentdb_core.enableFastBsonValidation = $fastValidation"
+    for ((i = 0; i < $repetitions; i++)); do
+      RunPsql -c "SELECT documentdb_api.drop_collection('bson_input_benchmark', 'nested')" > /dev/null
+      RunPsql -c "SET documentdb_core.enableFastBsonValidation TO $fastValidation" \
+        -c "\\timing on" \
+        -c "SELECT COUNT(documentdb_api.insert_one('bson_input_benchmark', 'nested', documentdb_core.bson_json_to_bson(nested))) FROM bson_input_benchmark" | grep "Time:"
+    done
+  done
+
+  RunPsql -c "SELECT documentdb_api.drop_database('bson_input_benchmark')" > /dev/null
+fi
+
+RunPsql -c "DROP TABLE bson_input_benchmark"
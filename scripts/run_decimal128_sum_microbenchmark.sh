@@ -0,0 +1,82 @@
+#!/bin/bash
+
+# exit immediately if a command exits with a non-zero status
+set -e
+# fail if trying to reference a variable that is not set.
+set -u
+
+# Compares $sum, $avg and $max over decimal128 values with the integer fast path
+# for decimals with 64 bit coefficients and with the decimal math library, by
+# toggling documentdb_core.enableDecimal128FastPath.
+coordinatorPort="9712"
+rowCount="1000000"
+repetitions="3"
+help="false"
+while getopts "p:n:r:h" opt; do
+  case $opt in
+    p) coordinatorPort="$OPTARG"
+    ;;
+    n) rowCount="$OPTARG"
+    ;;
+    r) repetitions="$OPTARG"
+    ;;
+    h) help="true"
+    ;;
+  esac
+
+  # Assume empty string if it's unset since we cannot reference to
+  # an unset variabled due to "set -u".
+  case ${OPTARG:-""} in
+    -*) echo "Option $opt needs a valid argument. use -h to get help."
+    exit 1
+    ;;
+  esac
+done
+
+if [ "$help" == "true" ]; then
+    echo "runs a microbenchmark of decimal128 aggregates against a running server with the documentdb extension installed."
+    echo "run_decimal128_sum_microbenchmark [-p <port>] [-n <rowCount>] [-r <repetitions>]"
+    echo "[-p <port>] - optional argument. specifies the port of the server, defaults to $coordinatorPort"
+    echo "[-n <rowCount>] - optional argument. the number of values aggregated, defaults to $rowCount"
+    echo "[-r <repetitions>] - optional argument. the number of times each case is timed, defaults to $repetitions"
+    exit 1;
+fi
+
+function RunPsql()
+{
+  psql -X -q -p $coordinatorPort -d postgres -v ON_ERROR_STOP=1 "$@"
+}
+
+# The input: currency amounts with 2 decimal places, amounts of mixed scales,
+# and amounts with 34 digit coefficients which always use the decimal math library.
+RunPsql <<EOF2
+DROP TABLE IF EXISTS decimal128_benchmark;
+CREATE TABLE decimal128_benchmark AS
+SELECT i AS id,
+       documentdb_core.bson_json_to_bson(format('{ "": { "\$numberDecimal": "%s.%s" } }', i % 100000, lpad((i % 100)::text, 2, '0'))) AS currency,
+       documentdb_core.bson_json_to_bson(format('{ "": { "\$numberDecimal": "%sE%s" } }', i, (i % 7) - 3)) AS mixed,
+       documentdb_core.bson_json_to_bson(format('{ "": { "\$numberDecimal": "1.%s" } }', lpad(i::text, 33, '7'))) AS wide
+FROM generate_series(1, $rowCount) i;
+EOF2
+
+function TimeAggregate()
+{
+  local aggregate=$1
+  local column=$2
+  local fastPath=$3
+  echo "$aggregate of $column decimals, documentdb_core.enableDecimal128FastPath = $fastPath"
+  for ((i = 0; i < $repetitions; i++)); do
+    RunPsql -c "SET documentdb_core.enableDecimal128FastPath TO $fastPath" \
+      -c "\\timing on" \
+      -c "SELECT documentdb_api_catalog.$aggregate($column) FROM decimal128_benchmark" | grep "Time:"
+  done
+}
+
+for aggregate in bsonsum bsonaverage bsonmax; do
+  for column in currency mixed wide; do
+    TimeAggregate $aggregate $column false
+    TimeAggregate $aggregate $column true
+  done
+done
+
+RunPsql -c "DROP TABLE decimal128_benchmark"
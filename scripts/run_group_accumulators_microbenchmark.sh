@@ -0,0 +1,87 @@
+#!/bin/bash
+
+# exit immediately if a command exits with a non-zero status
+set -e
+# fail if trying to reference a variable that is not set.
+set -u
+
+# Compares $group with one aggregate per accumulator and with the fused
+# accumulators, by toggling documentdb.enableFusedGroupAccumulators.
+coordinatorPort="9712"
+documentCount="1000000"
+groupCount="1000"
+repetitions="3"
+help="false"
+while getopts "p:n:g:r:h" opt; do
+  case $opt in
+    p) coordinatorPort="$OPTARG"
+    ;;
+    n) documentCount="$OPTARG"
+    ;;
+    g) groupCount="$OPTARG"
+    ;;
+    r) repetitions="$OPTARG"
+    ;;
+    h) help="true"
+    ;;
+  esac
+
+  # Assume empty string if it's unset since we cannot reference to
+  # an unset variabled due to "set -u".
+  case ${OPTARG:-""} in
+    -*) echo "Option $opt needs a valid argument. use -h to get help."
+    exit 1
+    ;;
+  esac
+done
+
+if [ "$help" == "true" ]; then
+    echo "runs a microbenchmark of \$group accumulators against a running server with the extension installed."
+    echo "run_group_accumulators_microbenchmark [-p <port>] [-n <documentCount>] [-g <groupCount>] [-r <repetitions>]"
+    echo "[-p <port>] - optional argument. specifies the port of the server, defaults to $coordinatorPort"
+    echo "[-n <documentCount>] - optional argument. the number of documents grouped, defaults to $documentCount"
+    echo "[-g <groupCount>] - optional argument. the number of distinct group keys, defaults to $groupCount"
+    echo "[-r <repetitions>] - optional argument. the number of times each case is timed, defaults to $repetitions"
+    exit 1;
+fi
+
+function RunPsql()
+{
+  psql -X -q -p $coordinatorPort -d postgres -v ON_ERROR_STOP=1 "$@"
+}
+
+# The input: documents with a group key and ten numeric fields.
+RunPsql <<EOSQL
+SELECT documentdb_api.drop_collection('group_benchmark', 'metrics');
+SELECT COUNT(documentdb_api.insert_one('group_benchmark', 'metrics',
+         documentdb_core.bson_json_to_bson(
+           format('{ "_id": %s, "key": %s, %s }', i, i % $groupCount,
+                  (SELECT string_agg(format('"m%s": %s', j, (i * j) % 997), ', ')
+                   FROM generate_series(1, 10) j)))))
+FROM generate_series(1, $documentCount) i;
+EOSQL
+
+function TimeGroup()
+{
+  local description=$1
+  local groupSpec=$2
+  for fused in false true; do
+    echo "$description, documentdb.enableFusedGroupAccumulators = $fused"
+    for ((i = 0; i < $repetitions; i++)); do
+      RunPsql -c "SET documentdb.enableFusedGroupAccumulators TO $fused" \
+        -c "\\timing on" \
+        -c "SELECT COUNT(*) FROM documentdb_api_catalog.bson_aggregation_pipeline('group_benchmark', '{ \"aggregate\": \"metrics\", \"pipeline\": [ { \"\$group\": $groupSpec } ] }')" | grep "Time:"
+    done
+  done
+}
+
+TimeGroup "\$sum of ten fields" \
+  "{ \"_id\": \"\$key\", $(for j in $(seq 1 10); do printf '"s%s": { "$sum": "$m%s" }, ' $j $j; done)\"count\": { \"\$count\": {} } }"
+
+TimeGroup "\$sum, \$avg and \$max of five fields" \
+  "{ \"_id\": \"\$key\", $(for j in $(seq 1 5); do printf '"s%s": { "$sum": "$m%s" }, "a%s": { "$avg": "$m%s" }, ' $j $j $j $j; done)\"max\": { \"\$max\": \"\$m1\" } }"
+
+TimeGroup "\$sum of computed expressions" \
+  "{ \"_id\": \"\$key\", $(for j in $(seq 1 9); do printf '"s%s": { "$sum": { "$multiply": [ "$m%s", 2 ] } }, ' $j $j; done)\"s10\": { \"\$sum\": { \"\$add\": [ \"\$m10\", 1 ] } } }"
+
+RunPsql -c "SELECT documentdb_api.drop_database('group_benchmark')" > /dev/null
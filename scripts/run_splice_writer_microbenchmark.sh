@@ -0,0 +1,91 @@
+#!/bin/bash
+
+# exit immediately if a command exits with a non-zero status
+set -e
+# fail if trying to reference a variable that is not set.
+set -u
+
+# Compares projections and updates of wide documents that leave most of
+# the document unchanged, with and without the splice writer.
+coordinatorPort="9712"
+documentCount="10000"
+fieldCount="200"
+repetitions="3"
+help="false"
+while getopts "p:n:f:r:h" opt; do
+  case $opt in
+    p) coordinatorPort="$OPTARG"
+    ;;
+    n) documentCount="$OPTARG"
+    ;;
+    f) fieldCount="$OPTARG"
+    ;;
+    r) repetitions="$OPTARG"
+    ;;
+    h) help="true"
+    ;;
+  esac
+
+  # Assume empty string if it's unset since we cannot reference to
+  # an unset variabled due to "set -u".
+  case ${OPTARG:-""} in
+    -*) echo "Option $opt needs a valid argument. use -h to get help."
+    exit 1
+    ;;
+  esac
+done
+
+if [ "$help" == "true" ]; then
+    echo "runs a microbenchmark of projections and updates of wide documents against a running server with the documentdb extension installed."
+    echo "run_splice_writer_microbenchmark [-p <port>] [-n <documentCount>] [-f <fieldCount>] [-r <repetitions>]"
+    echo "[-p <port>] - optional argument. specifies the port of the server, defaults to $coordinatorPort"
+    echo "[-n <documentCount>] - optional argument. the number of documents projected and updated, defaults to $documentCount"
+    echo "[-f <fieldCount>] - optional argument. the number of top level fields of each document, defaults to $fieldCount"
+    echo "[-r <repetitions>] - optional argument. the number of times each case is timed, defaults to $repetitions"
+    exit 1;
+fi
+
+function RunPsql()
+{
+  psql -X -q -p $coordinatorPort -d postgres -v ON_ERROR_STOP=1 "$@"
+}
+
+# The input: documents with fieldCount string fields and a nested document.
+RunPsql <<EOSQL
+DROP TABLE IF EXISTS splice_writer_benchmark;
+CREATE TABLE splice_writer_benchmark AS
+SELECT i AS id, documentdb_core.bson_json_to_bson(
+         format('{ "_id": %s, %s, "nested": { "a": %s, "b": "%s" } }', i,
+                (SELECT string_agg(format('"f%s": "%s"', j, md5((i * j)::text)), ', ')
+                 FROM generate_series(1, $fieldCount) j),
+                i, repeat('x', 1024))) AS document
+FROM generate_series(1, $documentCount) i;
+EOSQL
+
+function TimeQuery()
+{
+  local description=$1
+  local query=$2
+  for spliceWriter in false true; do
+    echo "$description, documentdb.enableBsonSpliceWriter = $spliceWriter"
+    for ((i = 0; i < $repetitions; i++)); do
+      RunPsql -c "SET documentdb.enableBsonSpliceWriter TO $spliceWriter" \
+        -c "\\timing on" \
+        -c "$query" | grep "Time:"
+    done
+  done
+}
+
+TimeQuery "\$project exclusion of one field" \
+  "SELECT COUNT(documentdb_api_catalog.bson_dollar_project(document, '{ \"f100\": 0 }')) FROM splice_writer_benchmark"
+
+TimeQuery "\$addFields of a nested field" \
+  "SELECT COUNT(documentdb_api_catalog.bson_dollar_add_fields(document, '{ \"nested.c\": 1 }')) FROM splice_writer_benchmark"
+
+TimeQuery "\$set of one field" \
+  "SELECT COUNT((documentdb_api_internal.bson_update_document(document, '{ \"\": { \"\$set\": { \"f100\": 1 } } }', '{}')).newDocument) FROM splice_writer_benchmark"
+
+TimeQuery "\$inc of a nested field" \
+  "SELECT COUNT((documentdb_api_internal.bson_update_document(document, '{ \"\": { \"\$inc\": { \"nested.a\": 1 } } }', '{}')).newDocument) FROM splice_writer_benchmark"
+
+RunPsql -c "DROP TABLE splice_writer_benchmark"